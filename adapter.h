@@ -0,0 +1,139 @@
+#ifndef ADAPTER_H
+#define ADAPTER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * picks the adapter to create the device on. adapters are described by plain structs
+ * filled from DXGI_ADAPTER_DESC1 and a feature level probe, so the ranking runs without
+ * DXGI. the header only needs the C library; bench_adapter.c checks it on any platform
+ * with made-up adapters. an adapter is eligible if it supports the minimum feature level and is hardware,
+ * or software when allowed; eligible adapters are ordered by
+ *
+ *   hardware first, then the OS's GPU preference order, the highest feature level,
+ *   the most dedicated video memory and finally enumeration order
+ *
+ * and when none is eligible the caller falls back to WARP.
+ */
+
+#define ADAPTER_MAX 16
+#define ADAPTER_NONE 0xFFFFFFFFu
+/* preference of adapters enumerated without IDXGIFactory6 */
+#define ADAPTER_NO_PREFERENCE 0xFFFFFFFFu
+
+/* D3D_FEATURE_LEVEL values */
+#define ADAPTER_FEATURE_LEVEL_11_0 0xb000
+#define ADAPTER_FEATURE_LEVEL_11_1 0xb100
+#define ADAPTER_FEATURE_LEVEL_12_0 0xc000
+#define ADAPTER_FEATURE_LEVEL_12_1 0xc100
+
+/* the Microsoft Basic Render Driver, which not every driver stack flags as software */
+#define ADAPTER_BASIC_RENDER_VENDOR 0x1414
+#define ADAPTER_BASIC_RENDER_DEVICE 0x8c
+
+typedef struct adapter_info {
+	char name[128];
+	uint32_t vendor;
+	uint32_t device;
+	uint64_t dedicated_video_memory;
+	uint64_t shared_system_memory;
+	/* non-zero when the driver flags the adapter as software */
+	int software;
+	/* highest feature level a device can be created at, 0 if none */
+	uint32_t feature_level;
+	/* position in the OS's GPU preference order, ADAPTER_NO_PREFERENCE if unknown */
+	uint32_t preference;
+} adapter_info_t;
+
+typedef struct adapter_prefs {
+	uint32_t min_feature_level;
+	int allow_software;
+} adapter_prefs_t;
+
+static int adapter_is_software(adapter_info_t const * info) {
+	return info->software || (info->vendor == ADAPTER_BASIC_RENDER_VENDOR && info->device == ADAPTER_BASIC_RENDER_DEVICE);
+}
+
+static int adapter_eligible(adapter_info_t const * info, adapter_prefs_t const * prefs) {
+	if (info->feature_level == 0 || info->feature_level < prefs->min_feature_level) {
+		return 0;
+	}
+	return prefs->allow_software || !adapter_is_software(info);
+}
+
+/* negative if a goes first */
+static int adapter_compare(adapter_info_t const * infos, uint32_t a, uint32_t b) {
+	adapter_info_t const * x = &infos[a];
+	adapter_info_t const * y = &infos[b];
+
+	int x_software = adapter_is_software(x);
+	int y_software = adapter_is_software(y);
+	if (x_software != y_software) {
+		return x_software ? 1 : -1;
+	}
+	if (x->preference != y->preference) {
+		return x->preference < y->preference ? -1 : 1;
+	}
+	if (x->feature_level != y->feature_level) {
+		return x->feature_level > y->feature_level ? -1 : 1;
+	}
+	if (x->dedicated_video_memory != y->dedicated_video_memory) {
+		return x->dedicated_video_memory > y->dedicated_video_memory ? -1 : 1;
+	}
+	return a < b ? -1 : a > b;
+}
+
+/* fills order with the eligible adapters, best first, and returns how many there are; only the first ADAPTER_MAX are looked at */
+static uint32_t adapter_rank(adapter_info_t const * infos, uint32_t count, adapter_prefs_t const * prefs, uint32_t * order) {
+	if (count > ADAPTER_MAX) {
+		count = ADAPTER_MAX;
+	}
+
+	uint32_t eligible = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (!adapter_eligible(&infos[i], prefs)) {
+			continue;
+		}
+
+		/* a handful of adapters at most, insertion keeps it simple */
+		uint32_t j = eligible++;
+		while (j > 0 && adapter_compare(infos, i, order[j - 1]) < 0) {
+			order[j] = order[j - 1];
+			--j;
+		}
+		order[j] = i;
+	}
+
+	return eligible;
+}
+
+/* the index of the best adapter, ADAPTER_NONE when the caller has to fall back to WARP */
+static uint32_t adapter_pick(adapter_info_t const * infos, uint32_t count, adapter_prefs_t const * prefs) {
+	uint32_t order[ADAPTER_MAX];
+	return adapter_rank(infos, count, prefs, order) > 0 ? order[0] : ADAPTER_NONE;
+}
+
+static void adapter_log(adapter_info_t const * infos, uint32_t count, adapter_prefs_t const * prefs, uint32_t chosen, FILE * fp) {
+	for (uint32_t i = 0; i < count; ++i) {
+		adapter_info_t const * info = &infos[i];
+		char level[16];
+		if (info->feature_level != 0) {
+			snprintf(level, sizeof(level), "%u_%u", info->feature_level >> 12, (info->feature_level >> 8) & 0xF);
+		} else {
+			snprintf(level, sizeof(level), "none");
+		}
+
+		char const * verdict = "";
+		if (i == chosen) {
+			verdict = ", chosen";
+		} else if (info->feature_level == 0 || info->feature_level < prefs->min_feature_level) {
+			verdict = ", skipped for its feature level";
+		} else if (!adapter_eligible(info, prefs)) {
+			verdict = ", skipped as software";
+		}
+		fprintf(fp, "adapter %u: %s (%04x:%04x), %llu MiB dedicated, %llu MiB shared, feature level %s%s%s\n", i, info->name, info->vendor, info->device, (unsigned long long) (info->dedicated_video_memory >> 20), (unsigned long long) (info->shared_system_memory >> 20), level, adapter_is_software(info) ? ", software" : "", verdict);
+	}
+}
+
+#endif
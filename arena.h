@@ -0,0 +1,242 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "jobs.h"
+
+/*
+ * frame-scoped memory for transient CPU data such as barrier arrays, draw packets and
+ * lists of command lists. every thread of the job pool bumps its own chain of blocks, so
+ * allocating takes no lock. a frame's memory stays valid until the fence it was stamped
+ * with completes; arena_retire then rewinds each thread to its first block in O(1) and
+ * keeps the blocks for the next frame that uses the slot.
+ *
+ * requests larger than ARENA_OVERSIZE go to malloc and are freed on retire, so a
+ * single huge array doesn't pin a huge block forever.
+ */
+
+#define ARENA_FRAMES 2
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_OVERSIZE (ARENA_BLOCK_SIZE / 4)
+#define ARENA_ALIGN 16
+#define ARENA_THREADS (JOBS_MAX_THREADS + 1)
+
+typedef struct arena_block {
+	struct arena_block * next;
+	/* keeps data ARENA_ALIGN aligned behind the header */
+	UINT64 pad;
+} arena_block_t;
+
+typedef struct arena_large {
+	struct arena_large * next;
+	UINT64 pad;
+} arena_large_t;
+
+typedef struct arena_stats {
+	UINT64 bytes;
+	UINT64 allocations;
+	UINT64 oversize_bytes;
+	UINT64 oversize_allocations;
+	/* blocks malloc'd because the chain ran out, zero once the arena has warmed up */
+	UINT64 grown;
+	UINT64 failed;
+} arena_stats_t;
+
+/* one cache line apart, threads only ever write their own */
+typedef struct arena_thread {
+	arena_block_t * first;
+	arena_block_t * current;
+	SIZE_T offset;
+	arena_large_t * large;
+	arena_stats_t stats;
+	BYTE pad[64 - (4 * sizeof(void *) + sizeof(arena_stats_t)) % 64];
+} arena_thread_t;
+
+typedef struct arena_frame {
+	arena_thread_t threads[ARENA_THREADS];
+	/* fence that has to complete before the frame's memory can be reused */
+	UINT64 fence;
+	BOOL open;
+} arena_frame_t;
+
+typedef struct arena {
+	arena_frame_t frames[ARENA_FRAMES];
+	UINT frame;
+
+	/* of the last frame ended, the largest frame seen and every frame ended */
+	arena_stats_t last;
+	arena_stats_t peak;
+	arena_stats_t total;
+	UINT frames_ended;
+} arena_t;
+
+static void arena_init(arena_t * arena) {
+	memset(arena, 0, sizeof(*arena));
+	arena->frame = ARENA_FRAMES - 1;
+}
+
+static void arena_free_large(arena_thread_t * thread) {
+	arena_large_t * large = thread->large;
+	while (large != NULL) {
+		arena_large_t * next = large->next;
+		free(large);
+		large = next;
+	}
+	thread->large = NULL;
+}
+
+static void arena_reset_frame(arena_frame_t * frame) {
+	for (UINT t = 0; t < ARENA_THREADS; ++t) {
+		arena_thread_t * thread = &frame->threads[t];
+		thread->current = thread->first;
+		thread->offset = 0;
+		if (thread->large != NULL) {
+			arena_free_large(thread);
+		}
+		memset(&thread->stats, 0, sizeof(thread->stats));
+	}
+	frame->open = FALSE;
+}
+
+/* rewinds every ended frame whose fence is at or below completed */
+static void arena_retire(arena_t * arena, UINT64 completed) {
+	for (UINT f = 0; f < ARENA_FRAMES; ++f) {
+		arena_frame_t * frame = &arena->frames[f];
+		if (!frame->open && frame->fence != 0 && frame->fence <= completed) {
+			arena_reset_frame(frame);
+			frame->fence = 0;
+		}
+	}
+}
+
+/*
+ * moves on to the next slot. returns 1 if that slot's fence hasn't been retired yet,
+ * which means more frames are in flight than ARENA_FRAMES.
+ */
+static int arena_begin_frame(arena_t * arena) {
+	UINT next = (arena->frame + 1) % ARENA_FRAMES;
+	if (arena->frames[next].fence != 0 || arena->frames[next].open) {
+		return 1;
+	}
+
+	arena->frame = next;
+	arena->frames[next].open = TRUE;
+	return 0;
+}
+
+static void arena_add_stats(arena_stats_t * to, arena_stats_t const * from) {
+	to->bytes += from->bytes;
+	to->allocations += from->allocations;
+	to->oversize_bytes += from->oversize_bytes;
+	to->oversize_allocations += from->oversize_allocations;
+	to->grown += from->grown;
+	to->failed += from->failed;
+}
+
+/* no more allocations this frame; the memory lives until fence is retired */
+static void arena_end_frame(arena_t * arena, UINT64 fence) {
+	arena_frame_t * frame = &arena->frames[arena->frame];
+	arena_stats_t stats = { 0 };
+
+	for (UINT t = 0; t < ARENA_THREADS; ++t) {
+		arena_add_stats(&stats, &frame->threads[t].stats);
+	}
+
+	arena->last = stats;
+	arena_add_stats(&arena->total, &stats);
+	if (stats.bytes + stats.oversize_bytes > arena->peak.bytes + arena->peak.oversize_bytes) {
+		arena->peak = stats;
+	}
+	++arena->frames_ended;
+
+	frame->fence = fence;
+	frame->open = FALSE;
+}
+
+static void * arena_alloc_large(arena_thread_t * thread, SIZE_T size) {
+	arena_large_t * large = malloc(sizeof(arena_large_t) + size);
+	if (large == NULL) {
+		++thread->stats.failed;
+		return NULL;
+	}
+
+	large->next = thread->large;
+	thread->large = large;
+	thread->stats.oversize_bytes += size;
+	++thread->stats.oversize_allocations;
+	return large + 1;
+}
+
+/* ARENA_ALIGN aligned memory valid until the current frame retires, NULL if out of memory */
+static void * arena_alloc(arena_t * arena, SIZE_T size) {
+	arena_thread_t * thread = &arena->frames[arena->frame].threads[jobs_thread_index()];
+	size = (size + ARENA_ALIGN - 1) & ~(SIZE_T) (ARENA_ALIGN - 1);
+
+	if (size > ARENA_OVERSIZE) {
+		return arena_alloc_large(thread, size);
+	}
+
+	if (thread->current == NULL || thread->offset + size > ARENA_BLOCK_SIZE) {
+		arena_block_t * next = thread->current != NULL ? thread->current->next : thread->first;
+		if (next == NULL) {
+			next = malloc(sizeof(arena_block_t) + ARENA_BLOCK_SIZE);
+			if (next == NULL) {
+				++thread->stats.failed;
+				return NULL;
+			}
+			next->next = NULL;
+			if (thread->current != NULL) {
+				thread->current->next = next;
+			} else {
+				thread->first = next;
+			}
+			++thread->stats.grown;
+		}
+		thread->current = next;
+		thread->offset = 0;
+	}
+
+	void * ptr = (BYTE *) (thread->current + 1) + thread->offset;
+	thread->offset += size;
+	thread->stats.bytes += size;
+	++thread->stats.allocations;
+	return ptr;
+}
+
+static void * arena_calloc(arena_t * arena, SIZE_T count, SIZE_T size) {
+	void * ptr = arena_alloc(arena, count * size);
+	if (ptr != NULL) {
+		memset(ptr, 0, count * size);
+	}
+	return ptr;
+}
+
+static void arena_destroy(arena_t * arena) {
+	for (UINT f = 0; f < ARENA_FRAMES; ++f) {
+		for (UINT t = 0; t < ARENA_THREADS; ++t) {
+			arena_thread_t * thread = &arena->frames[f].threads[t];
+			arena_block_t * block = thread->first;
+			while (block != NULL) {
+				arena_block_t * next = block->next;
+				free(block);
+				block = next;
+			}
+			arena_free_large(thread);
+		}
+	}
+	memset(arena, 0, sizeof(*arena));
+}
+
+static void arena_report(arena_t const * arena, FILE * fp) {
+	if (arena->frames_ended == 0) {
+		return;
+	}
+
+	double frames = (double) arena->frames_ended;
+	fprintf(fp, "arena: %.1f bytes in %.1f allocations per frame (peak %llu bytes in %llu), %.2f oversize per frame, %llu blocks grown, %llu failed, %llu KiB reserved\n", (double) arena->total.bytes / frames, (double) arena->total.allocations / frames, (unsigned long long) arena->peak.bytes, (unsigned long long) arena->peak.allocations, (double) arena->total.oversize_allocations / frames, (unsigned long long) arena->total.grown, (unsigned long long) arena->total.failed, (unsigned long long) (arena->total.grown * ARENA_BLOCK_SIZE / 1024));
+}
+
+#endif
@@ -0,0 +1,1005 @@
+#ifndef BC_H
+#define BC_H
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <windows.h>
+#include <immintrin.h>
+#include "jobs.h"
+
+/*
+ * block compression of RGBA8 images on the CPU, for the texture container. every format
+ * stores 4x4 blocks, gathered with the last row and column repeated for images that
+ * aren't a multiple of 4:
+ *
+ *   BC1  RGB in 8 bytes, two 565 endpoints and 2 bit indices. a block with texels under
+ *        half alpha uses the 3 colour mode, its fourth entry is transparent black
+ *   BC3  BC1's colour block, always in 4 colour mode, after a BC4 block of alpha
+ *   BC4  red in 8 bytes, two 8 bit endpoints and 3 bit indices
+ *   BC5  a BC4 block of red and one of green
+ *   BC7  mode 6 only: one subset of RGBA, 7 bit endpoints with a p-bit each and 4 bit
+ *        indices, in 16 bytes
+ *
+ * the quality sets how hard the encoder searches for endpoints:
+ *
+ *   fast    the bounding box, inset a little
+ *   normal  the extent along the principal axis, then one least squares refinement
+ *   high    two refinements, every p-bit pair, then each quantized endpoint channel is
+ *           nudged while the error drops; BC4 tries both of its modes around its range
+ *
+ * each candidate is scored by fitting the block's texels to its palette. that fit is
+ * the inner loop of the search, so it has a scalar version and an SSE2 _sse version
+ * the encoder uses, with the same results. blocks are independent and bc_encode spreads
+ * rows of them over the job pool.
+ */
+
+typedef enum bc_quality {
+	BC_QUALITY_FAST,
+	BC_QUALITY_NORMAL,
+	BC_QUALITY_HIGH,
+	BC_QUALITIES,
+} bc_quality_t;
+
+static char const * const bc_quality_names[BC_QUALITIES] = { "fast", "normal", "high" };
+
+/* DXGI_FORMAT values, the UNORM variants */
+#define BC_FORMAT_BC1 71
+#define BC_FORMAT_BC3 77
+#define BC_FORMAT_BC4 80
+#define BC_FORMAT_BC5 83
+#define BC_FORMAT_BC7 98
+
+/* greedy passes over the endpoint channels at high quality */
+#define BC_NUDGE_PASSES 2
+
+/* a block split by channel, four texels to a register */
+typedef union bc_pixels {
+	__m128 v[4][4];
+	float c[4][16];
+} bc_pixels_t;
+
+/* 0 for formats this doesn't encode */
+static UINT bc_block_bytes(UINT format) {
+	switch (format) {
+	case BC_FORMAT_BC1:
+	case BC_FORMAT_BC4:
+		return 8;
+	case BC_FORMAT_BC3:
+	case BC_FORMAT_BC5:
+	case BC_FORMAT_BC7:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+/* the leading RGBA channels the format keeps, the rest decode to 0 or opaque */
+static UINT bc_format_channels(UINT format) {
+	switch (format) {
+	case BC_FORMAT_BC1: return 3;
+	case BC_FORMAT_BC4: return 1;
+	case BC_FORMAT_BC5: return 2;
+	default: return 4;
+	}
+}
+
+static char const * bc_format_name(UINT format) {
+	switch (format) {
+	case BC_FORMAT_BC1: return "bc1";
+	case BC_FORMAT_BC3: return "bc3";
+	case BC_FORMAT_BC4: return "bc4";
+	case BC_FORMAT_BC5: return "bc5";
+	case BC_FORMAT_BC7: return "bc7";
+	default: return "unknown";
+	}
+}
+
+/* 0 if the name isn't one of bc_format_name's */
+static UINT bc_format_from_name(char const * name) {
+	static UINT const formats[] = { BC_FORMAT_BC1, BC_FORMAT_BC3, BC_FORMAT_BC4, BC_FORMAT_BC5, BC_FORMAT_BC7 };
+	for (UINT i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+		if (strcmp(name, bc_format_name(formats[i])) == 0) {
+			return formats[i];
+		}
+	}
+	return 0;
+}
+
+/* the block at block column bx and row by, 16 RGBA texels */
+static void bc_gather(BYTE const * rgba, UINT width, UINT height, UINT pitch, UINT bx, UINT by, BYTE * block) {
+	for (UINT y = 0; y < 4; ++y) {
+		UINT sy = by * 4 + y < height ? by * 4 + y : height - 1;
+		for (UINT x = 0; x < 4; ++x) {
+			UINT sx = bx * 4 + x < width ? bx * 4 + x : width - 1;
+			memcpy(block + (y * 4 + x) * 4, rgba + (SIZE_T) sy * pitch + sx * 4, 4);
+		}
+	}
+}
+
+static void bc_pixels_load(BYTE const * block, bc_pixels_t * px) {
+	for (UINT i = 0; i < 16; ++i) {
+		for (UINT c = 0; c < 4; ++c) {
+			px->c[c][i] = block[i * 4 + c];
+		}
+	}
+}
+
+/*
+ * the nearest palette entry for every texel over the first `channels` channels, ties to
+ * the lower index. returns the summed squared error.
+ */
+static float bc_fit(bc_pixels_t const * px, float const (* palette)[4], UINT entries, UINT channels, BYTE * indices) {
+	float error = 0;
+	for (UINT i = 0; i < 16; ++i) {
+		float best = FLT_MAX;
+		UINT index = 0;
+		for (UINT k = 0; k < entries; ++k) {
+			float d = 0;
+			for (UINT c = 0; c < channels; ++c) {
+				float e = px->c[c][i] - palette[k][c];
+				d += e * e;
+			}
+			if (d < best) {
+				best = d;
+				index = k;
+			}
+		}
+		indices[i] = (BYTE) index;
+		error += best;
+	}
+	return error;
+}
+
+/* four texels per register against one entry at a time; the errors are summed in texel order like bc_fit */
+static float bc_fit_sse(bc_pixels_t const * px, float const (* palette)[4], UINT entries, UINT channels, BYTE * indices) {
+	float errors[16];
+	UINT32 picked[16];
+	for (UINT g = 0; g < 4; ++g) {
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128i index = _mm_setzero_si128();
+		for (UINT k = 0; k < entries; ++k) {
+			__m128 e = _mm_sub_ps(px->v[0][g], _mm_set1_ps(palette[k][0]));
+			__m128 d = _mm_mul_ps(e, e);
+			for (UINT c = 1; c < channels; ++c) {
+				e = _mm_sub_ps(px->v[c][g], _mm_set1_ps(palette[k][c]));
+				d = _mm_add_ps(d, _mm_mul_ps(e, e));
+			}
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+			best = _mm_min_ps(d, best);
+			index = _mm_or_si128(_mm_andnot_si128(closer, index), _mm_and_si128(closer, _mm_set1_epi32((int) k)));
+		}
+		_mm_storeu_ps(errors + g * 4, best);
+		_mm_storeu_si128((__m128i *) (picked + g * 4), index);
+	}
+
+	float error = 0;
+	for (UINT i = 0; i < 16; ++i) {
+		indices[i] = (BYTE) picked[i];
+		error += errors[i];
+	}
+	return error;
+}
+
+/*
+ * least squares endpoints for fixed indices: texel i is weights[index] of e0 and the rest
+ * of e1. returns 0 and leaves the endpoints alone when the indices don't pin both down.
+ */
+static int bc_least_squares(bc_pixels_t const * px, UINT channels, BYTE const * indices, float const * weights, float * e0, float * e1) {
+	float aa = 0, ab = 0, bb = 0;
+	float ax[4] = { 0 }, bx[4] = { 0 };
+	for (UINT i = 0; i < 16; ++i) {
+		float a = weights[indices[i]];
+		float b = 1 - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (UINT c = 0; c < channels; ++c) {
+			ax[c] += a * px->c[c][i];
+			bx[c] += b * px->c[c][i];
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f) {
+		return 0;
+	}
+	for (UINT c = 0; c < channels; ++c) {
+		float v0 = (bb * ax[c] - ab * bx[c]) / det;
+		float v1 = (aa * bx[c] - ab * ax[c]) / det;
+		e0[c] = v0 < 0 ? 0 : v0 > 255 ? 255 : v0;
+		e1[c] = v1 < 0 ? 0 : v1 > 255 ? 255 : v1;
+	}
+	return 1;
+}
+
+/*
+ * the extent of the texels along their principal axis, by power iteration from the
+ * bounding box's diagonal; the box itself when the texels are all the same
+ */
+static void bc_principal_extent(bc_pixels_t const * px, UINT channels, float * lo, float * hi) {
+	float mean[4] = { 0 };
+	float min[4], max[4];
+	for (UINT c = 0; c < channels; ++c) {
+		min[c] = max[c] = px->c[c][0];
+		for (UINT i = 0; i < 16; ++i) {
+			float v = px->c[c][i];
+			mean[c] += v;
+			min[c] = v < min[c] ? v : min[c];
+			max[c] = v > max[c] ? v : max[c];
+		}
+		mean[c] /= 16;
+	}
+
+	float cov[4][4] = { { 0 } };
+	for (UINT i = 0; i < 16; ++i) {
+		for (UINT a = 0; a < channels; ++a) {
+			for (UINT b = a; b < channels; ++b) {
+				cov[a][b] += (px->c[a][i] - mean[a]) * (px->c[b][i] - mean[b]);
+			}
+		}
+	}
+	for (UINT a = 0; a < channels; ++a) {
+		for (UINT b = 0; b < a; ++b) {
+			cov[a][b] = cov[b][a];
+		}
+	}
+
+	float axis[4];
+	float length = 0;
+	for (UINT c = 0; c < channels; ++c) {
+		axis[c] = max[c] - min[c];
+		length += axis[c] * axis[c];
+	}
+	if (length == 0) {
+		memcpy(lo, min, sizeof(float) * channels);
+		memcpy(hi, max, sizeof(float) * channels);
+		return;
+	}
+
+	for (UINT iteration = 0; iteration < 8; ++iteration) {
+		float next[4] = { 0 };
+		length = 0;
+		for (UINT a = 0; a < channels; ++a) {
+			for (UINT b = 0; b < channels; ++b) {
+				next[a] += cov[a][b] * axis[b];
+			}
+			length += next[a] * next[a];
+		}
+		if (length < 1e-12f) {
+			break;
+		}
+		float scale = 1 / sqrtf(length);
+		for (UINT c = 0; c < channels; ++c) {
+			axis[c] = next[c] * scale;
+		}
+	}
+
+	/* the diagonal wasn't normalized if the covariance was degenerate from the start */
+	length = 0;
+	for (UINT c = 0; c < channels; ++c) {
+		length += axis[c] * axis[c];
+	}
+	float scale = 1 / sqrtf(length);
+	for (UINT c = 0; c < channels; ++c) {
+		axis[c] *= scale;
+	}
+
+	float tmin = FLT_MAX, tmax = -FLT_MAX;
+	for (UINT i = 0; i < 16; ++i) {
+		float t = 0;
+		for (UINT c = 0; c < channels; ++c) {
+			t += (px->c[c][i] - mean[c]) * axis[c];
+		}
+		tmin = t < tmin ? t : tmin;
+		tmax = t > tmax ? t : tmax;
+	}
+	for (UINT c = 0; c < channels; ++c) {
+		float l = mean[c] + axis[c] * tmin;
+		float h = mean[c] + axis[c] * tmax;
+		lo[c] = l < 0 ? 0 : l > 255 ? 255 : l;
+		hi[c] = h < 0 ? 0 : h > 255 ? 255 : h;
+	}
+}
+
+/* the bounding box, each side moved in by `inset` of its width */
+static void bc_inset_box(bc_pixels_t const * px, UINT channels, float inset, float * lo, float * hi) {
+	for (UINT c = 0; c < channels; ++c) {
+		float min = px->c[c][0], max = px->c[c][0];
+		for (UINT i = 1; i < 16; ++i) {
+			min = px->c[c][i] < min ? px->c[c][i] : min;
+			max = px->c[c][i] > max ? px->c[c][i] : max;
+		}
+		float d = (max - min) * inset;
+		lo[c] = min + d;
+		hi[c] = max - d;
+	}
+}
+
+static void bc_put_bits(BYTE * out, UINT * pos, UINT value, UINT bits) {
+	for (UINT b = 0; b < bits; ++b, ++*pos) {
+		out[*pos >> 3] |= (BYTE) (((value >> b) & 1) << (*pos & 7));
+	}
+}
+
+static UINT bc_get_bits(BYTE const * in, UINT * pos, UINT bits) {
+	UINT value = 0;
+	for (UINT b = 0; b < bits; ++b, ++*pos) {
+		value |= (UINT) ((in[*pos >> 3] >> (*pos & 7)) & 1) << b;
+	}
+	return value;
+}
+
+/* BC1 and BC3 colour */
+
+static UINT bc_round(float v, UINT max) {
+	int q = (int) (v * (float) max / 255.0f + 0.5f);
+	return q < 0 ? 0 : q > (int) max ? max : (UINT) q;
+}
+
+static USHORT bc_pack565(float const * rgb) {
+	return (USHORT) (bc_round(rgb[0], 31) << 11 | bc_round(rgb[1], 63) << 5 | bc_round(rgb[2], 31));
+}
+
+static void bc_unpack565(USHORT c, BYTE * rgb) {
+	UINT r = c >> 11 & 31, g = c >> 5 & 63, b = c & 31;
+	rgb[0] = (BYTE) (r << 3 | r >> 2);
+	rgb[1] = (BYTE) (g << 2 | g >> 4);
+	rgb[2] = (BYTE) (b << 3 | b >> 2);
+}
+
+/* the four entries of a colour block, RGBA */
+static void bc_color_palette(USHORT c0, USHORT c1, BOOL four, BYTE (* palette)[4]) {
+	bc_unpack565(c0, palette[0]);
+	bc_unpack565(c1, palette[1]);
+	palette[0][3] = palette[1][3] = 255;
+	for (UINT c = 0; c < 3; ++c) {
+		UINT a = palette[0][c], b = palette[1][c];
+		if (four) {
+			palette[2][c] = (BYTE) ((2 * a + b) / 3);
+			palette[3][c] = (BYTE) ((a + 2 * b) / 3);
+		} else {
+			palette[2][c] = (BYTE) ((a + b) / 2);
+			palette[3][c] = 0;
+		}
+	}
+	palette[2][3] = 255;
+	palette[3][3] = four ? 255 : 0;
+}
+
+/* scores the endpoints, the 3 colour mode leaves its transparent entry out of the fit */
+static float bc_color_try(bc_pixels_t const * px, USHORT c0, USHORT c1, BOOL four, BYTE * indices) {
+	BYTE entries[4][4];
+	float palette[4][4];
+	bc_color_palette(c0, c1, four, entries);
+	for (UINT k = 0; k < 4; ++k) {
+		for (UINT c = 0; c < 4; ++c) {
+			palette[k][c] = entries[k][c];
+		}
+	}
+	return bc_fit_sse(px, palette, four ? 4 : 3, 3, indices);
+}
+
+static void bc_nudge565(USHORT c, UINT channel, int step, USHORT * out, BOOL * ok) {
+	static UINT const shift[3] = { 11, 5, 0 };
+	static UINT const mask[3] = { 31, 63, 31 };
+	int v = (int) (c >> shift[channel] & mask[channel]) + step;
+	*ok = v >= 0 && v <= (int) mask[channel];
+	*out = (USHORT) ((c & ~(mask[channel] << shift[channel])) | (UINT) (*ok ? v : 0) << shift[channel]);
+}
+
+/*
+ * 8 bytes of colour. with `punch` the texels under half alpha become index 3 of the
+ * 3 colour mode; they are fitted as the opaque texels' mean, which pulls the fit a
+ * little toward the middle but keeps the kernel free of masks.
+ */
+static void bc_encode_color(BYTE const * block, bc_quality_t quality, BOOL punch, BYTE * out) {
+	bc_pixels_t px;
+	bc_pixels_load(block, &px);
+
+	UINT transparent = 0;
+	UINT opaque = 0;
+	float mean[3] = { 0 };
+	if (punch) {
+		for (UINT i = 0; i < 16; ++i) {
+			if (block[i * 4 + 3] < 128) {
+				transparent |= 1u << i;
+			} else {
+				++opaque;
+				for (UINT c = 0; c < 3; ++c) {
+					mean[c] += px.c[c][i];
+				}
+			}
+		}
+	}
+
+	USHORT c0, c1;
+	BYTE indices[16];
+	BOOL four = transparent == 0;
+	if (transparent == 0xFFFF) {
+		c0 = c1 = 0;
+		memset(indices, 3, sizeof(indices));
+	} else {
+		if (transparent != 0) {
+			for (UINT i = 0; i < 16; ++i) {
+				if (transparent & (1u << i)) {
+					for (UINT c = 0; c < 3; ++c) {
+						px.c[c][i] = mean[c] / (float) opaque;
+					}
+				}
+			}
+		}
+
+		float e0[4], e1[4];
+		if (quality == BC_QUALITY_FAST) {
+			bc_inset_box(&px, 3, 1.0f / 16, e1, e0);
+		} else {
+			bc_principal_extent(&px, 3, e1, e0);
+		}
+		c0 = bc_pack565(e0);
+		c1 = bc_pack565(e1);
+		float error = bc_color_try(&px, c0, c1, four, indices);
+
+		/* weight of c0 per index */
+		static float const weights4[4] = { 1, 0, 2.0f / 3, 1.0f / 3 };
+		static float const weights3[3] = { 1, 0, 0.5f };
+		UINT refinements = quality == BC_QUALITY_FAST ? 0 : quality == BC_QUALITY_NORMAL ? 1 : 2;
+		for (UINT r = 0; r < refinements && error > 0; ++r) {
+			if (!bc_least_squares(&px, 3, indices, four ? weights4 : weights3, e0, e1)) {
+				break;
+			}
+			USHORT n0 = bc_pack565(e0), n1 = bc_pack565(e1);
+			BYTE trial[16];
+			float e = bc_color_try(&px, n0, n1, four, trial);
+			if (e >= error) {
+				break;
+			}
+			c0 = n0;
+			c1 = n1;
+			error = e;
+			memcpy(indices, trial, sizeof(indices));
+		}
+
+		if (quality == BC_QUALITY_HIGH) {
+			for (UINT pass = 0; pass < BC_NUDGE_PASSES && error > 0; ++pass) {
+				BOOL improved = FALSE;
+				for (UINT channel = 0; channel < 6; ++channel) {
+					for (int step = -1; step <= 1; step += 2) {
+						USHORT n0 = c0, n1 = c1;
+						BOOL ok;
+						bc_nudge565(channel < 3 ? c0 : c1, channel % 3, step, channel < 3 ? &n0 : &n1, &ok);
+						if (!ok) {
+							continue;
+						}
+						BYTE trial[16];
+						float e = bc_color_try(&px, n0, n1, four, trial);
+						if (e < error) {
+							c0 = n0;
+							c1 = n1;
+							error = e;
+							memcpy(indices, trial, sizeof(indices));
+							improved = TRUE;
+						}
+					}
+				}
+				if (!improved) {
+					break;
+				}
+			}
+		}
+
+		/* the order of the endpoints is what picks the mode */
+		if (four) {
+			if (c0 < c1) {
+				USHORT t = c0;
+				c0 = c1;
+				c1 = t;
+				for (UINT i = 0; i < 16; ++i) {
+					indices[i] ^= 1;
+				}
+			} else if (c0 == c1) {
+				memset(indices, 0, sizeof(indices));
+			}
+		} else {
+			if (c0 > c1) {
+				USHORT t = c0;
+				c0 = c1;
+				c1 = t;
+				for (UINT i = 0; i < 16; ++i) {
+					indices[i] = indices[i] < 2 ? indices[i] ^ 1 : indices[i];
+				}
+			}
+			for (UINT i = 0; i < 16; ++i) {
+				if (transparent & (1u << i)) {
+					indices[i] = 3;
+				}
+			}
+		}
+	}
+
+	UINT32 bits = 0;
+	for (UINT i = 0; i < 16; ++i) {
+		bits |= (UINT32) indices[i] << (i * 2);
+	}
+	memcpy(out, &c0, 2);
+	memcpy(out + 2, &c1, 2);
+	memcpy(out + 4, &bits, 4);
+}
+
+/* BC4, also the alpha of BC3 and both halves of BC5 */
+
+static void bc4_palette(BYTE e0, BYTE e1, BYTE * palette) {
+	palette[0] = e0;
+	palette[1] = e1;
+	if (e0 > e1) {
+		for (UINT k = 1; k < 7; ++k) {
+			palette[k + 1] = (BYTE) (((7 - k) * e0 + k * e1 + 3) / 7);
+		}
+	} else {
+		for (UINT k = 1; k < 5; ++k) {
+			palette[k + 1] = (BYTE) (((5 - k) * e0 + k * e1 + 2) / 5);
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+/* the nearest of the 8 entries for every value, ties to the lower index; returns the summed squared error */
+static UINT bc4_fit(BYTE const * values, BYTE const * palette, BYTE * indices) {
+	UINT error = 0;
+	for (UINT i = 0; i < 16; ++i) {
+		UINT best = 256;
+		UINT index = 0;
+		for (UINT k = 0; k < 8; ++k) {
+			UINT d = values[i] > palette[k] ? values[i] - palette[k] : palette[k] - values[i];
+			if (d < best) {
+				best = d;
+				index = k;
+			}
+		}
+		indices[i] = (BYTE) index;
+		error += best * best;
+	}
+	return error;
+}
+
+/* all 16 values in one register, bytes compared unsigned through max and min */
+static UINT bc4_fit_sse(BYTE const * values, BYTE const * palette, BYTE * indices) {
+	__m128i x = _mm_loadu_si128((__m128i const *) values);
+	__m128i p = _mm_set1_epi8((char) palette[0]);
+	__m128i best = _mm_or_si128(_mm_subs_epu8(x, p), _mm_subs_epu8(p, x));
+	__m128i index = _mm_setzero_si128();
+	for (UINT k = 1; k < 8; ++k) {
+		p = _mm_set1_epi8((char) palette[k]);
+		__m128i d = _mm_or_si128(_mm_subs_epu8(x, p), _mm_subs_epu8(p, x));
+		/* d >= best exactly where max(d, best) is d */
+		__m128i not_closer = _mm_cmpeq_epi8(_mm_max_epu8(d, best), d);
+		index = _mm_or_si128(_mm_and_si128(not_closer, index), _mm_andnot_si128(not_closer, _mm_set1_epi8((char) k)));
+		best = _mm_min_epu8(d, best);
+	}
+	_mm_storeu_si128((__m128i *) indices, index);
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8(best, zero);
+	__m128i hi = _mm_unpackhi_epi8(best, zero);
+	__m128i sum = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (UINT) _mm_cvtsi128_si32(sum);
+}
+
+static UINT bc4_try(BYTE const * values, UINT e0, UINT e1, BYTE * indices) {
+	BYTE palette[8];
+	bc4_palette((BYTE) e0, (BYTE) e1, palette);
+	return bc4_fit_sse(values, palette, indices);
+}
+
+/* 8 bytes for the 16 values of one channel */
+static void bc_encode_bc4(BYTE const * values, bc_quality_t quality, BYTE * out) {
+	UINT min = 255, max = 0, inner_min = 255, inner_max = 0;
+	for (UINT i = 0; i < 16; ++i) {
+		UINT v = values[i];
+		min = v < min ? v : min;
+		max = v > max ? v : max;
+		if (v != 0 && v != 255) {
+			inner_min = v < inner_min ? v : inner_min;
+			inner_max = v > inner_max ? v : inner_max;
+		}
+	}
+
+	BYTE indices[16];
+	UINT e0 = max, e1 = min;
+	UINT error;
+	if (max == min) {
+		/* the 6 value mode with both endpoints the value, every index 0 is exact */
+		memset(indices, 0, sizeof(indices));
+		error = 0;
+	} else {
+		error = bc4_try(values, e0, e1, indices);
+	}
+
+	/* the 6 value mode has 0 and 255 for free, its endpoints only span what's between */
+	if (quality != BC_QUALITY_FAST && error > 0 && inner_min <= inner_max) {
+		BYTE trial[16];
+		UINT e = bc4_try(values, inner_min, inner_max, trial);
+		if (e < error) {
+			e0 = inner_min;
+			e1 = inner_max;
+			error = e;
+			memcpy(indices, trial, sizeof(indices));
+		}
+	}
+
+	if (quality == BC_QUALITY_HIGH && error > 0) {
+		UINT ranges[2][2] = { { max, min }, { inner_min, inner_max } };
+		for (UINT mode = 0; mode < (inner_min <= inner_max ? 2u : 1u); ++mode) {
+			for (int d0 = -2; d0 <= 2; ++d0) {
+				for (int d1 = -2; d1 <= 2; ++d1) {
+					int a = (int) ranges[mode][0] + d0, b = (int) ranges[mode][1] + d1;
+					/* each mode only where its endpoint order holds */
+					if (a < 0 || a > 255 || b < 0 || b > 255 || (mode == 0 ? a <= b : a > b)) {
+						continue;
+					}
+					BYTE trial[16];
+					UINT e = bc4_try(values, (UINT) a, (UINT) b, trial);
+					if (e < error) {
+						e0 = (UINT) a;
+						e1 = (UINT) b;
+						error = e;
+						memcpy(indices, trial, sizeof(indices));
+					}
+				}
+			}
+		}
+	}
+
+	memset(out, 0, 8);
+	out[0] = (BYTE) e0;
+	out[1] = (BYTE) e1;
+	UINT pos = 16;
+	for (UINT i = 0; i < 16; ++i) {
+		bc_put_bits(out, &pos, indices[i], 3);
+	}
+}
+
+/* BC7 mode 6 */
+
+static BYTE const bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+/* the 8 bit endpoint a 7 bit value and its p-bit expand to */
+static UINT bc7_quantize(float v, UINT p) {
+	int q = (int) ((v - (float) p) * 0.5f + 0.5f);
+	return q < 0 ? 0 : q > 127 ? 127 : (UINT) q;
+}
+
+/* endpoints as 7 bit channels and a p-bit each */
+typedef struct bc7_endpoints {
+	UINT q[2][4];
+	UINT p[2];
+} bc7_endpoints_t;
+
+static void bc7_palette(bc7_endpoints_t const * ep, float (* palette)[4]) {
+	for (UINT c = 0; c < 4; ++c) {
+		UINT a = ep->q[0][c] << 1 | ep->p[0];
+		UINT b = ep->q[1][c] << 1 | ep->p[1];
+		for (UINT k = 0; k < 16; ++k) {
+			palette[k][c] = (float) (((64 - bc7_weights[k]) * a + bc7_weights[k] * b + 32) >> 6);
+		}
+	}
+}
+
+static float bc7_try(bc_pixels_t const * px, bc7_endpoints_t const * ep, BYTE * indices) {
+	float palette[16][4];
+	bc7_palette(ep, palette);
+	return bc_fit_sse(px, palette, 16, 4, indices);
+}
+
+static void bc7_quantize_endpoints(float const * e0, float const * e1, UINT p0, UINT p1, bc7_endpoints_t * ep) {
+	ep->p[0] = p0;
+	ep->p[1] = p1;
+	for (UINT c = 0; c < 4; ++c) {
+		ep->q[0][c] = bc7_quantize(e0[c], p0);
+		ep->q[1][c] = bc7_quantize(e1[c], p1);
+	}
+}
+
+/* the p-bit that lands the endpoint closest to where it was asked to be */
+static UINT bc7_best_pbit(float const * e) {
+	float error[2] = { 0, 0 };
+	for (UINT p = 0; p < 2; ++p) {
+		for (UINT c = 0; c < 4; ++c) {
+			float d = e[c] - (float) (bc7_quantize(e[c], p) << 1 | p);
+			error[p] += d * d;
+		}
+	}
+	return error[1] < error[0];
+}
+
+static void bc_encode_bc7(BYTE const * block, bc_quality_t quality, BYTE * out) {
+	bc_pixels_t px;
+	bc_pixels_load(block, &px);
+
+	float e0[4], e1[4];
+	if (quality == BC_QUALITY_FAST) {
+		bc_inset_box(&px, 4, 1.0f / 32, e0, e1);
+	} else {
+		bc_principal_extent(&px, 4, e0, e1);
+	}
+
+	bc7_endpoints_t ep;
+	BYTE indices[16];
+	bc7_quantize_endpoints(e0, e1, bc7_best_pbit(e0), bc7_best_pbit(e1), &ep);
+	float error = bc7_try(&px, &ep, indices);
+
+	/* weight of e0 per index */
+	float weights[16];
+	for (UINT k = 0; k < 16; ++k) {
+		weights[k] = (float) (64 - bc7_weights[k]) / 64;
+	}
+
+	UINT refinements = quality == BC_QUALITY_FAST ? 0 : quality == BC_QUALITY_NORMAL ? 1 : 2;
+	for (UINT r = 0; r < refinements && error > 0; ++r) {
+		if (!bc_least_squares(&px, 4, indices, weights, e0, e1)) {
+			break;
+		}
+
+		/* at high quality every p-bit pair, otherwise the nearest */
+		UINT pairs = quality == BC_QUALITY_HIGH ? 4 : 1;
+		BOOL improved = FALSE;
+		for (UINT pair = 0; pair < pairs; ++pair) {
+			bc7_endpoints_t trial_ep;
+			if (pairs == 1) {
+				bc7_quantize_endpoints(e0, e1, bc7_best_pbit(e0), bc7_best_pbit(e1), &trial_ep);
+			} else {
+				bc7_quantize_endpoints(e0, e1, pair & 1, pair >> 1, &trial_ep);
+			}
+			BYTE trial[16];
+			float e = bc7_try(&px, &trial_ep, trial);
+			if (e < error) {
+				ep = trial_ep;
+				error = e;
+				memcpy(indices, trial, sizeof(indices));
+				improved = TRUE;
+			}
+		}
+		if (!improved) {
+			break;
+		}
+	}
+
+	if (quality == BC_QUALITY_HIGH) {
+		for (UINT pass = 0; pass < BC_NUDGE_PASSES && error > 0; ++pass) {
+			BOOL improved = FALSE;
+			for (UINT channel = 0; channel < 8; ++channel) {
+				for (int step = -1; step <= 1; step += 2) {
+					bc7_endpoints_t trial_ep = ep;
+					int v = (int) trial_ep.q[channel / 4][channel % 4] + step;
+					if (v < 0 || v > 127) {
+						continue;
+					}
+					trial_ep.q[channel / 4][channel % 4] = (UINT) v;
+					BYTE trial[16];
+					float e = bc7_try(&px, &trial_ep, trial);
+					if (e < error) {
+						ep = trial_ep;
+						error = e;
+						memcpy(indices, trial, sizeof(indices));
+						improved = TRUE;
+					}
+				}
+			}
+			if (!improved) {
+				break;
+			}
+		}
+	}
+
+	/* the first index is stored without its top bit, so it has to be under 8 */
+	if (indices[0] >= 8) {
+		for (UINT c = 0; c < 4; ++c) {
+			UINT t = ep.q[0][c];
+			ep.q[0][c] = ep.q[1][c];
+			ep.q[1][c] = t;
+		}
+		UINT t = ep.p[0];
+		ep.p[0] = ep.p[1];
+		ep.p[1] = t;
+		for (UINT i = 0; i < 16; ++i) {
+			indices[i] = (BYTE) (15 - indices[i]);
+		}
+	}
+
+	memset(out, 0, 16);
+	UINT pos = 0;
+	bc_put_bits(out, &pos, 1 << 6, 7);
+	for (UINT c = 0; c < 4; ++c) {
+		bc_put_bits(out, &pos, ep.q[0][c], 7);
+		bc_put_bits(out, &pos, ep.q[1][c], 7);
+	}
+	bc_put_bits(out, &pos, ep.p[0], 1);
+	bc_put_bits(out, &pos, ep.p[1], 1);
+	bc_put_bits(out, &pos, indices[0], 3);
+	for (UINT i = 1; i < 16; ++i) {
+		bc_put_bits(out, &pos, indices[i], 4);
+	}
+}
+
+/* one block of 16 RGBA texels into bc_block_bytes(format) bytes */
+static void bc_encode_block(UINT format, bc_quality_t quality, BYTE const * block, BYTE * out) {
+	BYTE channel[16];
+	switch (format) {
+	case BC_FORMAT_BC1:
+		bc_encode_color(block, quality, TRUE, out);
+		break;
+	case BC_FORMAT_BC3:
+		for (UINT i = 0; i < 16; ++i) {
+			channel[i] = block[i * 4 + 3];
+		}
+		bc_encode_bc4(channel, quality, out);
+		bc_encode_color(block, quality, FALSE, out + 8);
+		break;
+	case BC_FORMAT_BC4:
+	case BC_FORMAT_BC5:
+		for (UINT half = 0; half < (format == BC_FORMAT_BC5 ? 2u : 1u); ++half) {
+			for (UINT i = 0; i < 16; ++i) {
+				channel[i] = block[i * 4 + half];
+			}
+			bc_encode_bc4(channel, quality, out + half * 8);
+		}
+		break;
+	case BC_FORMAT_BC7:
+		bc_encode_bc7(block, quality, out);
+		break;
+	}
+}
+
+static void bc_decode_bc4(BYTE const * in, BYTE * rgba, UINT channel) {
+	BYTE palette[8];
+	bc4_palette(in[0], in[1], palette);
+	UINT pos = 16;
+	for (UINT i = 0; i < 16; ++i) {
+		rgba[i * 4 + channel] = palette[bc_get_bits(in, &pos, 3)];
+	}
+}
+
+static void bc_decode_color(BYTE const * in, BYTE * rgba, BOOL always_four) {
+	USHORT c0, c1;
+	UINT32 bits;
+	memcpy(&c0, in, 2);
+	memcpy(&c1, in + 2, 2);
+	memcpy(&bits, in + 4, 4);
+
+	BYTE palette[4][4];
+	bc_color_palette(c0, c1, always_four || c0 > c1, palette);
+	for (UINT i = 0; i < 16; ++i) {
+		memcpy(rgba + i * 4, palette[bits >> (i * 2) & 3], 4);
+	}
+}
+
+/* non-zero for BC7 blocks in any mode but 6, which is all the encoder writes */
+static int bc_decode_bc7(BYTE const * in, BYTE * rgba) {
+	if ((in[0] & 0x7F) != 1 << 6) {
+		return 1;
+	}
+
+	bc7_endpoints_t ep;
+	UINT pos = 7;
+	for (UINT c = 0; c < 4; ++c) {
+		ep.q[0][c] = bc_get_bits(in, &pos, 7);
+		ep.q[1][c] = bc_get_bits(in, &pos, 7);
+	}
+	ep.p[0] = bc_get_bits(in, &pos, 1);
+	ep.p[1] = bc_get_bits(in, &pos, 1);
+
+	float palette[16][4];
+	bc7_palette(&ep, palette);
+	for (UINT i = 0; i < 16; ++i) {
+		UINT index = bc_get_bits(in, &pos, i == 0 ? 3 : 4);
+		for (UINT c = 0; c < 4; ++c) {
+			rgba[i * 4 + c] = (BYTE) palette[index][c];
+		}
+	}
+	return 0;
+}
+
+/* 16 RGBA texels, channels the format doesn't keep come out as 0 and alpha as opaque */
+static int bc_decode_block(UINT format, BYTE const * in, BYTE * rgba) {
+	for (UINT i = 0; i < 16; ++i) {
+		rgba[i * 4 + 0] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = 0;
+		rgba[i * 4 + 3] = 255;
+	}
+
+	switch (format) {
+	case BC_FORMAT_BC1:
+		bc_decode_color(in, rgba, FALSE);
+		return 0;
+	case BC_FORMAT_BC3:
+		bc_decode_color(in + 8, rgba, TRUE);
+		bc_decode_bc4(in, rgba, 3);
+		return 0;
+	case BC_FORMAT_BC4:
+		bc_decode_bc4(in, rgba, 0);
+		return 0;
+	case BC_FORMAT_BC5:
+		bc_decode_bc4(in, rgba, 0);
+		bc_decode_bc4(in + 8, rgba, 1);
+		return 0;
+	case BC_FORMAT_BC7:
+		return bc_decode_bc7(in, rgba);
+	default:
+		return 1;
+	}
+}
+
+typedef struct bc_image {
+	UINT format;
+	bc_quality_t quality;
+	BYTE const * rgba;
+	UINT width;
+	UINT height;
+	UINT pitch;
+	BYTE * out;
+	UINT out_pitch;
+} bc_image_t;
+
+static void bc_encode_rows(void * user, UINT begin, UINT end) {
+	bc_image_t const * image = user;
+	UINT block_bytes = bc_block_bytes(image->format);
+	UINT columns = (image->width + 3) / 4;
+	for (UINT by = begin; by < end; ++by) {
+		BYTE * row = image->out + (SIZE_T) by * image->out_pitch;
+		for (UINT bx = 0; bx < columns; ++bx) {
+			BYTE block[64];
+			bc_gather(image->rgba, image->width, image->height, image->pitch, bx, by, block);
+			bc_encode_block(image->format, image->quality, block, row + bx * block_bytes);
+		}
+	}
+}
+
+/*
+ * encodes an RGBA8 image of `pitch` bytes per row into rows of blocks `out_pitch` bytes
+ * apart, on the job pool. non-zero for formats bc_block_bytes doesn't know.
+ */
+static int bc_encode(UINT format, bc_quality_t quality, BYTE const * rgba, UINT width, UINT height, UINT pitch, BYTE * out, UINT out_pitch) {
+	if (bc_block_bytes(format) == 0) {
+		return 1;
+	}
+
+	bc_image_t image = {
+		.format = format,
+		.quality = quality,
+		.rgba = rgba,
+		.width = width,
+		.height = height,
+		.pitch = pitch,
+		.out = out,
+		.out_pitch = out_pitch,
+	};
+	jobs_parallel_for((height + 3) / 4, 1, bc_encode_rows, &image);
+	return 0;
+}
+
+/* the inverse, into an RGBA8 image; non-zero if a block doesn't decode */
+static int bc_decode(UINT format, BYTE const * in, UINT in_pitch, UINT width, UINT height, BYTE * rgba, UINT pitch) {
+	UINT block_bytes = bc_block_bytes(format);
+	if (block_bytes == 0) {
+		return 1;
+	}
+
+	for (UINT by = 0; by < (height + 3) / 4; ++by) {
+		for (UINT bx = 0; bx < (width + 3) / 4; ++bx) {
+			BYTE block[64];
+			if (bc_decode_block(format, in + (SIZE_T) by * in_pitch + bx * block_bytes, block) != 0) {
+				return 1;
+			}
+			for (UINT y = 0; y < 4 && by * 4 + y < height; ++y) {
+				for (UINT x = 0; x < 4 && bx * 4 + x < width; ++x) {
+					memcpy(rgba + (SIZE_T) (by * 4 + y) * pitch + (bx * 4 + x) * 4, block + (y * 4 + x) * 4, 4);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+#endif
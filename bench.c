@@ -0,0 +1,4011 @@
+/*
+ * CPU-only benchmarks and self-checks for the header modules, no device needed.
+ * built as its own executable next to main.c; `bench [name ...]` runs the named
+ * benchmarks, no arguments runs all of them. a non-zero exit means a check failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "linmath.h"
+#include "timer.h"
+#include "jobs.h"
+#include "release.h"
+#include "gpumem.h"
+#include "vshade.h"
+#include "precull.h"
+#include "overdraw.h"
+#include "draworder.h"
+#include "scene.h"
+#include "skin.h"
+#include "xform.h"
+#include "bundle.h"
+#include "gpusched.h"
+#include "particles.h"
+#include "arena.h"
+#include "drawqueue.h"
+#include "psocache.h"
+#include "trace.h"
+#include "present.h"
+#include "viewport.h"
+#include "bc.h"
+#include "stream.h"
+#include "lod.h"
+#include "meshlet.h"
+#include "occlusion.h"
+#include "bvh.h"
+
+#define CHECK(cond, msg, ...) { if (!(cond)) { fprintf(stderr, "check failed: " msg, __VA_ARGS__); return 1; } }
+
+static UINT64 bench_seed = 0x9E3779B97F4A7C15ull;
+
+static UINT bench_rand(void) {
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 7;
+	bench_seed ^= bench_seed << 17;
+	return (UINT) (bench_seed >> 32);
+}
+
+static float bench_randf(float lo, float hi) {
+	return lo + (hi - lo) * (float) (bench_rand() & 0xFFFFFF) / (float) 0xFFFFFF;
+}
+
+/* the stub tasks log when they start and end on one counter, and which thread ran them */
+enum { BENCH_TASKS = 9 };
+static volatile LONG bench_task_clock;
+static LONG bench_task_started[BENCH_TASKS];
+static LONG bench_task_ended[BENCH_TASKS];
+static DWORD bench_task_thread[BENCH_TASKS];
+static DWORD bench_task_sleep[BENCH_TASKS];
+static int bench_task_result[BENCH_TASKS];
+
+static int bench_task_body(UINT i) {
+	bench_task_thread[i] = GetCurrentThreadId();
+	bench_task_started[i] = InterlockedIncrement(&bench_task_clock);
+	Sleep(bench_task_sleep[i]);
+	bench_task_ended[i] = InterlockedIncrement(&bench_task_clock);
+	return bench_task_result[i];
+}
+
+#define BENCH_TASK(i) static int bench_task_##i(void) { return bench_task_body(i); }
+BENCH_TASK(0)
+BENCH_TASK(1)
+BENCH_TASK(2)
+BENCH_TASK(3)
+BENCH_TASK(4)
+BENCH_TASK(5)
+BENCH_TASK(6)
+BENCH_TASK(7)
+BENCH_TASK(8)
+
+static task_fn_t const bench_task_fns[BENCH_TASKS] = {
+	bench_task_0, bench_task_1, bench_task_2, bench_task_3, bench_task_4, bench_task_5, bench_task_6, bench_task_7, bench_task_8,
+};
+
+static void bench_tasks_reset(task_t * tasks, UINT count) {
+	bench_task_clock = 0;
+	for (UINT i = 0; i < BENCH_TASKS; ++i) {
+		bench_task_started[i] = bench_task_ended[i] = 0;
+		bench_task_thread[i] = 0;
+		bench_task_result[i] = 0;
+	}
+	for (UINT i = 0; i < count; ++i) {
+		tasks[i].fn = bench_task_fns[i];
+	}
+}
+
+/* every task that ran started after each of its deps ended, on the logged clock and on the graph's timers */
+static int bench_tasks_ordered(task_graph_t const * graph) {
+	for (UINT i = 0; i < graph->count; ++i) {
+		task_t const * task = &graph->tasks[i];
+		if (bench_task_started[i] == 0) {
+			continue;
+		}
+		for (UINT d = 0; d < graph->count; ++d) {
+			if ((task->deps & TASK_BIT(d)) != 0) {
+				CHECK(bench_task_ended[d] != 0 && bench_task_ended[d] < bench_task_started[i], "%s started at %d before %s ended at %d\n", task->name, (int) bench_task_started[i], graph->tasks[d].name, (int) bench_task_ended[d]);
+			}
+		}
+	}
+	CHECK(task_graph_verify(graph) == 0, "the graph's own timings are out of order\n");
+	return 0;
+}
+
+static int bench_taskgraph(void) {
+	DWORD caller = GetCurrentThreadId();
+
+	/* a diamond into a main-thread join, a chain hanging off it, and a task with no deps beside them */
+	task_t tasks[] = {
+		{ .name = "load", .deps = 0 },
+		{ .name = "left", .deps = TASK_BIT(0) },
+		{ .name = "right", .deps = TASK_BIT(0) },
+		{ .name = "join", .deps = TASK_BIT(1) | TASK_BIT(2), .main_thread = TRUE },
+		{ .name = "chain 1", .deps = TASK_BIT(3) },
+		{ .name = "chain 2", .deps = TASK_BIT(4) },
+		{ .name = "chain 3", .deps = TASK_BIT(5), .main_thread = TRUE },
+		{ .name = "window", .deps = 0, .main_thread = TRUE },
+		{ .name = "free", .deps = 0 },
+	};
+	static DWORD const sleeps[BENCH_TASKS] = { 4, 2, 6, 1, 2, 1, 1, 3, 8 };
+	memcpy(bench_task_sleep, sleeps, sizeof(sleeps));
+
+	task_graph_t graph = {
+		.tasks = tasks,
+		.count = sizeof(tasks) / sizeof(tasks[0]),
+	};
+	bench_tasks_reset(tasks, graph.count);
+	CHECK(task_graph_run(&graph) == 0, "the graph failed\n");
+	for (UINT i = 0; i < graph.count; ++i) {
+		CHECK(bench_task_started[i] != 0 && !tasks[i].skipped && tasks[i].result == 0, "%s didn't run\n", tasks[i].name);
+		CHECK(!tasks[i].main_thread || (bench_task_thread[i] == caller && tasks[i].thread == 0), "%s ran off the calling thread\n", tasks[i].name);
+	}
+	if (bench_tasks_ordered(&graph) != 0) {
+		return 1;
+	}
+	task_graph_trace(&graph, stdout);
+
+	/* a failure skips everything downstream of it, the failing task's result comes back */
+	task_t failing[] = {
+		{ .name = "load", .deps = 0 },
+		{ .name = "compile", .deps = TASK_BIT(0) },
+		{ .name = "pipeline", .deps = TASK_BIT(1) },
+		{ .name = "present", .deps = TASK_BIT(2), .main_thread = TRUE },
+		{ .name = "textures", .deps = TASK_BIT(0) | TASK_BIT(1) },
+	};
+	static DWORD const failing_sleeps[BENCH_TASKS] = { 2, 1, 1, 1, 1 };
+	memcpy(bench_task_sleep, failing_sleeps, sizeof(failing_sleeps));
+
+	graph = (task_graph_t) {
+		.tasks = failing,
+		.count = sizeof(failing) / sizeof(failing[0]),
+	};
+	bench_tasks_reset(failing, graph.count);
+	bench_task_result[1] = 7;
+	CHECK(task_graph_run(&graph) == 7, "the graph returned %d, not the failing task's result\n", (int) graph.failed);
+	CHECK(bench_task_started[0] != 0 && bench_task_started[1] != 0 && failing[1].result == 7, "the failing task didn't run\n");
+	for (UINT i = 2; i < graph.count; ++i) {
+		CHECK(bench_task_started[i] == 0 && failing[i].skipped && failing[i].result == 0, "%s ran after its dependency failed\n", failing[i].name);
+	}
+	if (bench_tasks_ordered(&graph) != 0) {
+		return 1;
+	}
+
+	return 0;
+}
+
+/* stands in for a COM object: Release counts, and flags a release before the object's fence completed */
+typedef struct bench_com {
+	IUnknown unknown;
+	UINT releases;
+	UINT64 fence;
+} bench_com_t;
+
+static UINT64 bench_com_completed;
+static UINT bench_com_early;
+
+static HRESULT STDMETHODCALLTYPE bench_com_query(IUnknown * self, REFIID riid, void ** out) {
+	*out = NULL;
+	return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE bench_com_add_ref(IUnknown * self) {
+	return 1;
+}
+
+static ULONG STDMETHODCALLTYPE bench_com_release(IUnknown * self) {
+	bench_com_t * com = (bench_com_t *) self;
+	++com->releases;
+	bench_com_early += com->fence > bench_com_completed;
+	return 0;
+}
+
+static IUnknownVtbl bench_com_vtbl = {
+	bench_com_query,
+	bench_com_add_ref,
+	bench_com_release,
+};
+
+static int bench_release(void) {
+	/* enough objects for three chunks of slots, retired over FENCES fence values */
+	enum { OBJECTS = 600, FENCES = 5, REUSED = 40 };
+	bench_com_t * coms = calloc(OBJECTS + REUSED + 1, sizeof(bench_com_t));
+	IUnknown ** refs = calloc(OBJECTS + REUSED, sizeof(IUnknown *));
+	com_handle_t * handles = calloc(OBJECTS + REUSED, sizeof(com_handle_t));
+	CHECK(coms != NULL && refs != NULL && handles != NULL, "allocation\n");
+
+	release_stats_t base;
+	release_get_stats(&base);
+	UINT64 bytes = 0;
+	for (UINT i = 0; i < OBJECTS + REUSED + 1; ++i) {
+		coms[i].unknown.lpVtbl = &bench_com_vtbl;
+	}
+	for (UINT i = 0; i < OBJECTS; ++i) {
+		refs[i] = &coms[i].unknown;
+		handles[i] = com_track((void **) &refs[i], (i + 1) * 16);
+		CHECK(handles[i] != 0, "object %u wasn't tracked\n", i);
+		bytes += (i + 1) * 16;
+	}
+	CHECK(releases.chunk_count * COM_CHUNK_SIZE >= OBJECTS && releases.chunk_count >= 3, "%u objects fit in %u chunks\n", OBJECTS, releases.chunk_count);
+
+	release_stats_t stats;
+	release_get_stats(&stats);
+	CHECK(stats.tracked == base.tracked + OBJECTS && stats.tracked_bytes == base.tracked_bytes + bytes, "%u tracked (%llu bytes)\n", stats.tracked, (unsigned long long) stats.tracked_bytes);
+
+	/* retire fences only grow, the same way the frame loop hands them out */
+	UINT64 pending_bytes[FENCES + 1] = { 0 };
+	UINT pending[FENCES + 1] = { 0 };
+	for (UINT i = 0; i < OBJECTS; ++i) {
+		coms[i].fence = 1 + i * FENCES / OBJECTS;
+		CHECK(com_retire(handles[i], coms[i].fence) == 0, "object %u didn't retire\n", i);
+		CHECK(refs[i] == NULL, "object %u's pointer wasn't cleared\n", i);
+		for (UINT64 f = 0; f < coms[i].fence; ++f) {
+			pending_bytes[f] += (i + 1) * 16;
+			++pending[f];
+		}
+	}
+	release_get_stats(&stats);
+	CHECK(stats.tracked == base.tracked && stats.tracked_bytes == base.tracked_bytes, "%u still tracked after retiring\n", stats.tracked - base.tracked);
+
+	for (UINT64 completed = 0; completed <= FENCES; ++completed) {
+		/* pending[f] counts the objects retired after fence f */
+		UINT before = completed == 0 ? OBJECTS : pending[completed - 1];
+		release_get_stats(&stats);
+		CHECK(stats.pending == base.pending + before, "fence %llu: %u pending before collecting\n", (unsigned long long) completed, stats.pending - base.pending);
+
+		bench_com_completed = completed;
+		UINT released = release_collect(completed);
+		CHECK(released == before - pending[completed], "fence %llu released %u\n", (unsigned long long) completed, released);
+		CHECK(bench_com_early == 0, "fence %llu: %u objects released before their fence\n", (unsigned long long) completed, bench_com_early);
+
+		release_get_stats(&stats);
+		CHECK(stats.pending == base.pending + pending[completed] && stats.pending_bytes == base.pending_bytes + pending_bytes[completed], "fence %llu: %u pending (%llu bytes), expected %u (%llu bytes)\n", (unsigned long long) completed, stats.pending - base.pending, (unsigned long long) (stats.pending_bytes - base.pending_bytes), pending[completed], (unsigned long long) pending_bytes[completed]);
+		for (UINT i = 0; i < OBJECTS; ++i) {
+			CHECK(coms[i].releases == (coms[i].fence <= completed), "fence %llu: object %u released %u times\n", (unsigned long long) completed, i, coms[i].releases);
+		}
+	}
+
+	/* the freed slots come back with a new generation, so the old handles can't reach them */
+	UINT reused = 0;
+	for (UINT i = 0; i < REUSED; ++i) {
+		refs[OBJECTS + i] = &coms[OBJECTS + i].unknown;
+		handles[OBJECTS + i] = com_track((void **) &refs[OBJECTS + i], 64);
+		CHECK(handles[OBJECTS + i] != 0, "object %u wasn't tracked\n", OBJECTS + i);
+		for (UINT j = 0; j < OBJECTS; ++j) {
+			if ((UINT) handles[j] == (UINT) handles[OBJECTS + i]) {
+				CHECK(handles[j] != handles[OBJECTS + i], "a reused slot kept its handle\n");
+				++reused;
+			}
+		}
+	}
+	CHECK(reused == REUSED, "%u of %u new objects reused a slot\n", reused, REUSED);
+	for (UINT i = 0; i < OBJECTS; ++i) {
+		CHECK(com_retire(handles[i], FENCES + 1) != 0, "stale handle %u retired\n", i);
+	}
+	for (UINT i = 0; i < REUSED; ++i) {
+		CHECK(refs[OBJECTS + i] == &coms[OBJECTS + i].unknown, "a stale handle cleared object %u\n", OBJECTS + i);
+		coms[OBJECTS + i].fence = FENCES + 1;
+		CHECK(com_retire(handles[OBJECTS + i], FENCES + 1) == 0, "object %u didn't retire\n", OBJECTS + i);
+		CHECK(com_retire(handles[OBJECTS + i], FENCES + 1) != 0, "object %u retired twice\n", OBJECTS + i);
+	}
+
+	/* untracked objects go through the same queue */
+	bench_com_t * deferred = &coms[OBJECTS + REUSED];
+	deferred->fence = FENCES + 2;
+	CHECK(release_defer(&deferred->unknown, deferred->fence, 32) == 0, "defer failed\n");
+	bench_com_completed = FENCES + 1;
+	CHECK(release_collect(FENCES + 1) == REUSED, "the reused objects weren't released\n");
+	CHECK(deferred->releases == 0 && bench_com_early == 0, "released before its fence\n");
+	bench_com_completed = UINT64_MAX;
+	CHECK(release_collect(UINT64_MAX) == 1 && deferred->releases == 1, "the deferred object wasn't released\n");
+	CHECK(release_collect(UINT64_MAX) == 0, "the queue wasn't empty\n");
+	for (UINT i = 0; i < OBJECTS + REUSED + 1; ++i) {
+		CHECK(coms[i].releases == 1, "object %u released %u times\n", i, coms[i].releases);
+	}
+
+	release_get_stats(&stats);
+	CHECK(stats.pending == base.pending && stats.pending_bytes == base.pending_bytes && stats.released == base.released + OBJECTS + REUSED + 1, "%u pending, %llu released\n", stats.pending, (unsigned long long) (stats.released - base.released));
+	release_report(stdout);
+
+	free(coms);
+	free(refs);
+	free(handles);
+	return 0;
+}
+
+static void * bench_fake_create_heap(void * user, UINT kind, UINT64 size) {
+	static UINT next = 0;
+	return (void *) (UINT_PTR) ++next;
+}
+
+static void bench_fake_destroy_heap(void * user, void * heap) {
+}
+
+static void bench_fake_move(void * user, void * alloc_user, void * heap, UINT64 old_offset, UINT64 new_offset, UINT64 size) {
+	++*(UINT *) user;
+}
+
+static int bench_gpumem(void) {
+	enum { LIVE = 4096, OPS = 200000 };
+	static UINT live_block[LIVE];
+	static UINT64 live_offset[LIVE];
+	static UINT64 sizes[OPS];
+	tlsf_t tlsf;
+
+	CHECK(tlsf_init(&tlsf, 1ull << 34, GPUMEM_ALIGN_DEFAULT) == 0, "tlsf_init\n");
+	for (UINT i = 0; i < LIVE; ++i) {
+		live_block[i] = TLSF_NONE;
+	}
+
+	/* fuzz: random sizes and alignment classes, full consistency check every so often */
+	UINT failed = 0;
+	for (UINT op = 0; op < OPS; ++op) {
+		UINT slot = bench_rand() % LIVE;
+		if (live_block[slot] != TLSF_NONE) {
+			tlsf_free(&tlsf, live_block[slot]);
+			live_block[slot] = TLSF_NONE;
+		} else {
+			UINT64 size = (UINT64) (1 + bench_rand() % 128) * GPUMEM_ALIGN_DEFAULT - (bench_rand() % 2) * 1000;
+			UINT64 alignment = bench_rand() % 8 == 0 ? GPUMEM_ALIGN_MSAA : GPUMEM_ALIGN_DEFAULT;
+			live_block[slot] = tlsf_alloc(&tlsf, size, alignment, &live_offset[slot]);
+			if (live_block[slot] == TLSF_NONE) {
+				++failed;
+				continue;
+			}
+			CHECK((live_offset[slot] & (alignment - 1)) == 0, "misaligned offset %llu\n", (unsigned long long) live_offset[slot]);
+			CHECK(tlsf.blocks[live_block[slot]].size >= size, "short block\n");
+		}
+
+		if (op % 997 == 0) {
+			int err = tlsf_check(&tlsf);
+			CHECK(err == 0, "tlsf_check %d after op %u\n", err, op);
+		}
+	}
+	CHECK(tlsf_check(&tlsf) == 0, "tlsf_check after fuzz\n");
+
+	for (UINT i = 0; i < LIVE; ++i) {
+		if (live_block[i] != TLSF_NONE) {
+			tlsf_free(&tlsf, live_block[i]);
+			live_block[i] = TLSF_NONE;
+		}
+	}
+	CHECK(tlsf.used == 0 && tlsf_largest_free(&tlsf) == tlsf.size, "heap did not coalesce back\n");
+	printf("gpumem: fuzz %u ops ok, %u allocations did not fit\n", OPS, failed);
+
+	/* throughput: fill half the slots, then churn */
+	for (UINT i = 0; i < OPS; ++i) {
+		sizes[i] = (UINT64) (1 + bench_rand() % 64) * GPUMEM_ALIGN_DEFAULT;
+	}
+
+	LONGLONG start = timer_now();
+	for (UINT op = 0; op < OPS; ++op) {
+		UINT slot = op % LIVE;
+		if (live_block[slot] != TLSF_NONE) {
+			tlsf_free(&tlsf, live_block[slot]);
+		}
+		live_block[slot] = tlsf_alloc(&tlsf, sizes[op], GPUMEM_ALIGN_DEFAULT, &live_offset[slot]);
+	}
+	double ms = timer_ms(timer_now() - start);
+	printf("gpumem: tlsf alloc+free %.1f ns per op\n", ms * 1e6 / OPS);
+	tlsf_destroy(&tlsf);
+
+	/* pool with a fake backend: spill into several heaps, free most, defragment */
+	UINT moves = 0;
+	gpumem_t mem;
+	gpumem_init(&mem, "bench", 0, 64ull << 20, 512ull << 20, (gpumem_backend_t) {
+		.create_heap = bench_fake_create_heap,
+		.destroy_heap = bench_fake_destroy_heap,
+		.move = bench_fake_move,
+		.user = &moves,
+	});
+
+	static UINT ids[LIVE];
+	for (UINT i = 0; i < LIVE; ++i) {
+		ids[i] = gpumem_alloc(&mem, (UINT64) (1 + bench_rand() % 4) * GPUMEM_ALIGN_DEFAULT, GPUMEM_ALIGN_DEFAULT, NULL);
+	}
+
+	gpumem_stats_t stats;
+	gpumem_get_stats(&mem, &stats);
+	CHECK(stats.reserved <= stats.budget, "budget exceeded\n");
+	printf("gpumem: %u heaps, %llu of %llu bytes used, %llu allocations over budget\n", stats.heaps, (unsigned long long) stats.used, (unsigned long long) stats.reserved, (unsigned long long) stats.failed);
+
+	for (UINT i = 0; i < LIVE; ++i) {
+		if (ids[i] != GPUMEM_NONE && bench_rand() % 4 != 0) {
+			gpumem_free(&mem, ids[i]);
+			ids[i] = GPUMEM_NONE;
+		}
+	}
+
+	start = timer_now();
+	UINT64 moved = gpumem_defragment(&mem);
+	ms = timer_ms(timer_now() - start);
+
+	for (UINT i = 0; i < mem.heap_count; ++i) {
+		CHECK(tlsf_check(&mem.heaps[i].tlsf) == 0, "tlsf_check after defragment\n");
+	}
+	for (UINT i = 0; i < LIVE; ++i) {
+		if (ids[i] != GPUMEM_NONE) {
+			gpumem_alloc_t alloc = gpumem_get(&mem, ids[i]);
+			CHECK(mem.heaps[alloc.heap].tlsf.blocks[alloc.block].offset == alloc.offset, "stale allocation record\n");
+		}
+	}
+
+	printf("gpumem: defragment moved %llu bytes in %u moves, %.3f ms\n", (unsigned long long) moved, moves, ms);
+	gpumem_dump_json(&mem, stdout);
+	gpumem_destroy(&mem);
+
+	return 0;
+}
+
+static void bench_random_mvp(mat4x4 mvp) {
+	mat4x4 proj;
+	mat4x4 view;
+	mat4x4_perspective(proj, 1.0f, 16.0f / 9.0f, 0.1f, 100.0f);
+	mat4x4_look_at(view, (vec3) { bench_randf(-5, 5), bench_randf(-5, 5), 5 }, (vec3) { 0, 0, 0 }, (vec3) { 0, 1, 0 });
+	mat4x4_mul(mvp, proj, view);
+}
+
+static vertex_t * bench_random_vertices(UINT count, float extent) {
+	vertex_t * vertices = malloc(sizeof(vertex_t) * count);
+	if (vertices == NULL) {
+		return NULL;
+	}
+
+	for (UINT i = 0; i < count; ++i) {
+		vertices[i] = (vertex_t) {
+			.pos = { bench_randf(-extent, extent), bench_randf(-extent, extent), bench_randf(-extent, extent), 1 },
+			.color = { 1, 0, 1, 1 },
+		};
+	}
+
+	return vertices;
+}
+
+static int bench_vshade(void) {
+	enum { COUNT = 1 << 22, REPEAT = 8 };
+	mat4x4 mvp;
+	bench_random_mvp(mvp);
+
+	vertex_t * vertices = bench_random_vertices(COUNT, 4);
+	vec4 * reference = malloc(sizeof(vec4) * COUNT);
+	vshade_out_t out = { 0 };
+	CHECK(vertices != NULL && reference != NULL && vshade_out_alloc(&out, COUNT) == 0, "allocation\n");
+
+	/* the baseline is the plain linmath loop, what a caller would write without this module */
+	LONGLONG start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		for (UINT i = 0; i < COUNT; ++i) {
+			mat4x4_mul_vec4(reference[i], mvp, vertices[i].pos);
+		}
+	}
+	double baseline = timer_ms(timer_now() - start);
+
+	start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		vshade_scalar(mvp, vertices, 0, COUNT, &out);
+	}
+	double scalar = timer_ms(timer_now() - start);
+
+	start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		vshade_run(mvp, vertices, COUNT, &out);
+	}
+	double simd = timer_ms(timer_now() - start);
+
+	UINT mismatched = 0;
+	for (UINT i = 0; i < COUNT; ++i) {
+		float const * c = reference[i];
+		float err = fabsf(out.x[i] - c[0]) + fabsf(out.y[i] - c[1]) + fabsf(out.z[i] - c[2]) + fabsf(out.w[i] - c[3]);
+		CHECK(err <= 1e-4f * (1 + fabsf(c[3])), "vertex %u differs from mat4x4_mul_vec4 by %g\n", i, err);
+		if (out.outcode[i] != vshade_outcode(out.x[i], out.y[i], out.z[i], out.w[i])) {
+			++mismatched;
+		}
+	}
+	CHECK(mismatched == 0, "%u outcodes differ from the scalar rule\n", mismatched);
+
+	start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		vshade_parallel(mvp, vertices, COUNT, &out);
+	}
+	double parallel = timer_ms(timer_now() - start);
+
+	double total = (double) COUNT * REPEAT / 1e6;
+	printf("vshade: mat4x4_mul_vec4 loop %.1f Mvert/s\n", total / (baseline / 1000));
+	printf("vshade: scalar + outcodes  %.1f Mvert/s\n", total / (scalar / 1000));
+	printf("vshade: %-6s x%-2u         %.1f Mvert/s\n", VSHADE_PATH, VSHADE_LANES, total / (simd / 1000));
+	printf("vshade: %-6s x%u threads   %.1f Mvert/s\n", VSHADE_PATH, jobs_thread_count(), total / (parallel / 1000));
+
+	vshade_out_free(&out);
+	free(reference);
+	free(vertices);
+	return 0;
+}
+
+static int bench_precull(void) {
+	enum { VERTICES = 1 << 20, TRIANGLES = 1 << 21, REPEAT = 8 };
+	mat4x4 mvp;
+	bench_random_mvp(mvp);
+
+	/* triangles over a volume larger than the frustum, nearby vertices like a real index buffer, one in 16 degenerate */
+	vertex_t * vertices = bench_random_vertices(VERTICES, 12);
+	UINT * indices = malloc(sizeof(UINT) * 3 * TRIANGLES);
+	UINT * reference = malloc(sizeof(UINT) * 3 * TRIANGLES);
+	UINT * out = malloc(sizeof(UINT) * 3 * TRIANGLES);
+	vshade_out_t clip = { 0 };
+	CHECK(vertices != NULL && indices != NULL && reference != NULL && out != NULL && vshade_out_alloc(&clip, VERTICES) == 0, "allocation\n");
+
+	for (UINT t = 0; t < TRIANGLES; ++t) {
+		UINT a = (UINT) ((UINT64) t * VERTICES / TRIANGLES);
+		indices[t * 3 + 0] = a;
+		indices[t * 3 + 1] = (a + 1 + bench_rand() % 64) % VERTICES;
+		indices[t * 3 + 2] = bench_rand() % 16 == 0 ? a : (a + 1 + bench_rand() % 64) % VERTICES;
+	}
+	vshade_parallel(mvp, vertices, VERTICES, &clip);
+
+	precull_t cull;
+	precull_init(&cull, PRECULL_CULL_BACK, FALSE);
+
+	/* reference: one scalar pass over everything */
+	precull_stats_t expected = { .triangles = TRIANGLES };
+	precull_job_t job = {
+		.cull = &cull,
+		.clip = &clip,
+		.indices = indices,
+		.triangles = TRIANGLES,
+		.cull_sign = precull_cull_sign(&cull),
+	};
+	LONGLONG start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		expected = (precull_stats_t) { .triangles = TRIANGLES };
+		expected.kept = precull_scalar(&job, 0, TRIANGLES, reference, &expected);
+	}
+	double scalar = timer_ms(timer_now() - start);
+
+	precull_stats_t stats;
+	for (UINT r = 0; r < REPEAT; ++r) {
+		precull_run(&cull, &clip, indices, TRIANGLES, out, &stats);
+	}
+
+	CHECK(stats.kept == expected.kept && stats.backface == expected.backface && stats.zero_area == expected.zero_area && stats.offscreen == expected.offscreen, "counts differ from the scalar pass\n");
+	CHECK(stats.kept + stats.backface + stats.zero_area + stats.offscreen == TRIANGLES, "triangles unaccounted for\n");
+	CHECK(memcmp(out, reference, sizeof(UINT) * 3 * stats.kept) == 0, "compacted indices differ from the scalar pass\n");
+
+	/* flipping the winding rule has to swap which side gets culled */
+	precull_t flipped;
+	precull_init(&flipped, PRECULL_CULL_BACK, TRUE);
+	precull_stats_t flip;
+	precull_run(&flipped, &clip, indices, TRIANGLES, out, &flip);
+	precull_destroy(&flipped);
+	CHECK(flip.offscreen == stats.offscreen && flip.zero_area == stats.zero_area, "winding changed the other categories\n");
+
+	double total = (double) TRIANGLES * REPEAT / 1e6;
+	precull_report(&stats, stdout);
+	printf("precull: scalar             %.1f Mtri/s\n", total / (scalar / 1000));
+	printf("precull: %-6s x%u threads   %.1f Mtri/s\n", PRECULL_PATH, jobs_thread_count(), total / (cull.total.ms / 1000));
+
+	precull_destroy(&cull);
+	vshade_out_free(&clip);
+	free(out);
+	free(reference);
+	free(indices);
+	free(vertices);
+	return 0;
+}
+
+/* right-handed perspective with D3D's 0..1 clip depth, linmath's mat4x4_perspective targets -1..1 */
+static void bench_perspective(mat4x4 m, float y_fov, float aspect, float n, float f) {
+	float a = 1.0f / tanf(y_fov / 2.0f);
+	memset(m, 0, sizeof(mat4x4));
+	m[0][0] = a / aspect;
+	m[1][1] = a;
+	m[2][2] = f / (n - f);
+	m[2][3] = -1.0f;
+	m[3][2] = n * f / (n - f);
+}
+
+/* order may be NULL for the packets as pushed */
+static void bench_overdraw_pass(overdraw_t * od, vshade_out_t const * clip, UINT const * indices, draw_packet_t const * packets, UINT const * order, UINT count, const char * label, overdraw_stats_t * stats) {
+	overdraw_clear(od);
+
+	LONGLONG start = timer_now();
+	for (UINT i = 0; i < count; ++i) {
+		draw_packet_t const * packet = &packets[order != NULL ? order[i] : i];
+		overdraw_draw(od, clip, &indices[packet->first_index], packet->index_count / 3);
+	}
+	double ms = timer_ms(timer_now() - start);
+
+	overdraw_get_stats(od, stats);
+	overdraw_report(stats, label, stdout);
+	printf("overdraw: %s rasterized in %.3f ms\n", label, ms);
+}
+
+static int bench_overdraw(void) {
+	enum { WIDTH = 800, HEIGHT = 600, QUADS = 2000 };
+	static UINT const quad[6] = { 0, 1, 2, 2, 1, 3 };
+	overdraw_t od;
+	overdraw_t flat;
+	vshade_out_t clip = { 0 };
+	overdraw_stats_t stats;
+
+	vertex_t * vertices = malloc(sizeof(vertex_t) * QUADS * 4);
+	UINT * indices = malloc(sizeof(UINT) * QUADS * 6);
+	draw_queue_t queue;
+	draw_queue_init(&queue);
+	CHECK(vertices != NULL && indices != NULL && draw_queue_reserve(&queue, QUADS) == 0 && vshade_out_alloc(&clip, QUADS * 4) == 0, "allocation\n");
+	CHECK(overdraw_init(&od, WIDTH, HEIGHT, TRUE) == 0 && overdraw_init(&flat, WIDTH, HEIGHT, FALSE) == 0, "allocation\n");
+
+	mat4x4 mvp;
+	bench_perspective(mvp, 1.0f, (float) WIDTH / HEIGHT, 0.1f, 100.0f);
+
+	/* sanity: a full-screen quad shades every pixel exactly once, shared diagonal included */
+	vertices[0] = (vertex_t) { .pos = { -1,  1, 0.5f, 1 } };
+	vertices[1] = (vertex_t) { .pos = {  1,  1, 0.5f, 1 } };
+	vertices[2] = (vertex_t) { .pos = { -1, -1, 0.5f, 1 } };
+	vertices[3] = (vertex_t) { .pos = {  1, -1, 0.5f, 1 } };
+	mat4x4 identity;
+	mat4x4_identity(identity);
+	vshade_run(identity, vertices, 4, &clip);
+	overdraw_draw(&od, &clip, quad, 2);
+	overdraw_get_stats(&od, &stats);
+	CHECK(stats.histogram[1] == stats.pixels, "full-screen quad shaded %llu of %llu pixels once\n", (unsigned long long) stats.histogram[1], (unsigned long long) stats.pixels);
+
+	/* dense scene: camera-facing quads layered between z = -5 and z = -60 */
+	for (UINT q = 0; q < QUADS; ++q) {
+		float z = bench_randf(-60, -5);
+		float half = bench_randf(0.02f, 0.1f) * -z;
+		float cx = bench_randf(-0.6f, 0.6f) * -z;
+		float cy = bench_randf(-0.45f, 0.45f) * -z;
+
+		vertices[q * 4 + 0] = (vertex_t) { .pos = { cx - half, cy + half, z, 1 } };
+		vertices[q * 4 + 1] = (vertex_t) { .pos = { cx + half, cy + half, z, 1 } };
+		vertices[q * 4 + 2] = (vertex_t) { .pos = { cx - half, cy - half, z, 1 } };
+		vertices[q * 4 + 3] = (vertex_t) { .pos = { cx + half, cy - half, z, 1 } };
+		for (UINT i = 0; i < 6; ++i) {
+			indices[q * 6 + i] = q * 4 + quad[i];
+		}
+
+		draw_packet_t packet = {
+			.key = draw_key(0, 0, 0, draw_view_depth(mvp, (vec3) { cx, cy, z }), FALSE),
+			.first_index = q * 6,
+			.index_count = 6,
+			.instance_count = 1,
+		};
+		CHECK(draw_queue_push(&queue, &packet) == 0, "allocation\n");
+	}
+	vshade_run(mvp, vertices, QUADS * 4, &clip);
+
+	overdraw_stats_t none;
+	overdraw_stats_t unsorted;
+	overdraw_stats_t back_to_front;
+	overdraw_stats_t front_to_back;
+
+	flat.depth_test = FALSE;
+	bench_overdraw_pass(&flat, &clip, indices, queue.packets, NULL, QUADS, "no depth test  ", &none);
+	bench_overdraw_pass(&od, &clip, indices, queue.packets, NULL, QUADS, "depth, unsorted", &unsorted);
+
+	/* the same keys with the depth bits inverted, as blended layers sort */
+	for (UINT q = 0; q < QUADS; ++q) {
+		queue.packets[q].key ^= 0xFFFFFFFFull;
+	}
+	draw_queue_sort(&queue);
+	bench_overdraw_pass(&od, &clip, indices, queue.packets, queue.order, QUADS, "back to front  ", &back_to_front);
+
+	for (UINT q = 0; q < QUADS; ++q) {
+		queue.packets[q].key ^= 0xFFFFFFFFull;
+	}
+	LONGLONG start = timer_now();
+	draw_queue_sort(&queue);
+	double sort_ms = timer_ms(timer_now() - start);
+	for (UINT i = 1; i < QUADS; ++i) {
+		CHECK(queue.packets[queue.order[i - 1]].key <= queue.packets[queue.order[i]].key, "draws out of order at %u\n", i);
+	}
+	bench_overdraw_pass(&od, &clip, indices, queue.packets, queue.order, QUADS, "front to back  ", &front_to_back);
+
+	CHECK(none.covered == unsorted.covered && unsorted.covered == front_to_back.covered, "coverage depends on order\n");
+	CHECK(back_to_front.shaded >= unsorted.shaded, "back to front shaded less than unsorted\n");
+	CHECK(front_to_back.shaded <= unsorted.shaded, "front to back shaded more than unsorted\n");
+	CHECK(front_to_back.average < 1.01, "front to back over parallel quads should shade about once, got %.3f\n", front_to_back.average);
+
+	printf("overdraw: sorted %u draws in %.3f ms, front to back shades %.1f%% of the unsorted work\n", QUADS, sort_ms, front_to_back.shaded * 100.0 / unsorted.shaded);
+
+	overdraw_destroy(&flat);
+	overdraw_destroy(&od);
+	vshade_out_free(&clip);
+	draw_queue_destroy(&queue);
+	free(indices);
+	free(vertices);
+	return 0;
+}
+
+static float bench_mat_error(mat4x4 const a, mat4x4 const b) {
+	float err = 0;
+	float size = 1;
+	for (int c = 0; c < 4; ++c) {
+		for (int r = 0; r < 4; ++r) {
+			err = fmaxf(err, fabsf(a[c][r] - b[c][r]));
+			size = fmaxf(size, fabsf(b[c][r]));
+		}
+	}
+	return err / size;
+}
+
+static void bench_random_local(mat4x4 local) {
+	mat4x4 rotation;
+	mat4x4_translate(local, bench_randf(-1, 1), bench_randf(-1, 1), bench_randf(-1, 1));
+	mat4x4_identity(rotation);
+	mat4x4_rotate(rotation, rotation, bench_randf(-1, 1), bench_randf(-1, 1), bench_randf(-1, 1) + 2, bench_randf(0, 3.14f));
+	mat4x4_mul(local, local, rotation);
+}
+
+static int bench_scene(void) {
+	enum { NODES = 100000, FRAMES = 64 };
+	static UINT const percent[] = { 1, 10, 100 };
+	static mat4x4 reference[NODES];
+	static UINT parents[NODES];
+	scene_t scene;
+
+	/* random tree, a parent drawn from the nodes before it gives a depth around ln(n) */
+	scene_init(&scene);
+	CHECK(scene_reserve(&scene, NODES) == 0, "allocation\n");
+	for (UINT i = 0; i < NODES; ++i) {
+		parents[i] = i < 8 ? SCENE_NONE : bench_rand() % i;
+		UINT id = scene_add(&scene, parents[i]);
+		CHECK(id == i, "scene_add returned %u for node %u\n", id, i);
+
+		mat4x4 local;
+		bench_random_local(local);
+		scene_set_local(&scene, id, local);
+	}
+	CHECK(scene_update(&scene) == 0, "scene_update\n");
+	printf("scene: %u nodes in %u levels, first update with sort %.3f ms\n", scene.stats.nodes, scene.stats.levels, scene.stats.ms);
+
+	for (UINT p = 0; p < sizeof(percent) / sizeof(percent[0]); ++p) {
+		UINT changes = NODES * percent[p] / 100;
+		double ms = 0;
+		UINT64 updated = 0;
+
+		for (UINT f = 0; f < FRAMES; ++f) {
+			for (UINT c = 0; c < changes; ++c) {
+				mat4x4 local;
+				bench_random_local(local);
+				scene_set_local(&scene, percent[p] == 100 ? c : bench_rand() % NODES, local);
+			}
+
+			CHECK(scene_update(&scene) == 0, "scene_update\n");
+			ms += scene.stats.ms;
+			updated += scene.stats.updated;
+		}
+
+		/* serial reference: ids are created after their parents, so one pass in id order works */
+		for (UINT i = 0; i < NODES; ++i) {
+			mat4x4 local;
+			mat4x4_dup(local, scene.local[scene.slot[i]]);
+			if (parents[i] == SCENE_NONE) {
+				mat4x4_dup(reference[i], local);
+			} else {
+				mat4x4_mul(reference[i], reference[parents[i]], local);
+			}
+		}
+
+		/* same summation order, but FMA contraction may round either side differently */
+		for (UINT i = 0; i < NODES; ++i) {
+			mat4x4 world;
+			scene_get_world(&scene, i, world);
+			float err = bench_mat_error(world, reference[i]);
+			CHECK(err < 1e-5f, "node %u world differs from the serial pass by %g\n", i, err);
+		}
+
+		printf("scene: %3u%% locals changed, %6.0f worlds recomputed, %.3f ms per update\n", percent[p], (double) updated / FRAMES, ms / FRAMES);
+	}
+
+	/* a full recompute without the hierarchy bookkeeping, what every frame cost before */
+	LONGLONG start = timer_now();
+	for (UINT f = 0; f < FRAMES; ++f) {
+		for (UINT i = 0; i < NODES; ++i) {
+			if (parents[i] == SCENE_NONE) {
+				mat4x4_dup(reference[i], scene.local[scene.slot[i]]);
+			} else {
+				mat4x4_mul(reference[i], reference[parents[i]], scene.local[scene.slot[i]]);
+			}
+		}
+	}
+	printf("scene: serial full recompute in id order %.3f ms per update\n", timer_ms(timer_now() - start) / FRAMES);
+
+	scene_destroy(&scene);
+	return 0;
+}
+
+static void bench_random_xform(skin_xform_t * x, float extent) {
+	vec3 axis = { bench_randf(-1, 1), bench_randf(-1, 1), bench_randf(-1, 1) + 2 };
+	quat_rotate(x->rotation, bench_randf(-3.14f, 3.14f), axis);
+	x->translation[0] = bench_randf(-extent, extent);
+	x->translation[1] = bench_randf(-extent, extent);
+	x->translation[2] = bench_randf(-extent, extent);
+	x->scale = 1;
+}
+
+static int bench_skin(void) {
+	enum { JOINTS = 64, KEYS = 16, CLIPS = 2, VERTICES = 1 << 20, REPEAT = 8 };
+	static USHORT parent[JOINTS];
+	static skin_xform_t inverse_bind[JOINTS];
+	static float times[KEYS];
+	static skin_xform_t keys[CLIPS][JOINTS][KEYS];
+	static skin_track_t tracks[CLIPS][JOINTS];
+	static skin_xform_t pose[CLIPS][JOINTS];
+	static skin_palette_t palette;
+
+	for (UINT j = 0; j < JOINTS; ++j) {
+		parent[j] = j == 0 ? SKIN_NO_PARENT : (USHORT) (bench_rand() % j);
+		bench_random_xform(&inverse_bind[j], 1);
+	}
+	for (UINT k = 0; k < KEYS; ++k) {
+		times[k] = k / (float) (KEYS - 1);
+	}
+
+	skin_clip_t clips[CLIPS];
+	for (UINT c = 0; c < CLIPS; ++c) {
+		for (UINT j = 0; j < JOINTS; ++j) {
+			for (UINT k = 0; k < KEYS; ++k) {
+				bench_random_xform(&keys[c][j][k], 0.5f);
+				keys[c][j][k].scale = bench_randf(0.9f, 1.1f);
+			}
+			tracks[c][j] = (skin_track_t) {
+				.keys = KEYS,
+				.times = times,
+				.poses = keys[c][j],
+			};
+		}
+		clips[c] = (skin_clip_t) {
+			.duration = 1,
+			.joints = JOINTS,
+			.tracks = tracks[c],
+		};
+	}
+
+	skin_skeleton_t skeleton = {
+		.joints = JOINTS,
+		.parent = parent,
+		.inverse_bind = inverse_bind,
+	};
+
+	/* sampling on a key returns the key, slerp hits both ends */
+	skin_sample(&clips[0], times[3], pose[0]);
+	for (UINT j = 0; j < JOINTS; ++j) {
+		float err = 0;
+		for (int i = 0; i < 4; ++i) {
+			err += fabsf(pose[0][j].rotation[i] - keys[0][j][3].rotation[i]);
+		}
+		CHECK(err < 1e-5f, "sample at a key differs by %g\n", err);
+	}
+
+	quat q;
+	skin_quat_slerp(q, keys[0][0][0].rotation, keys[0][0][1].rotation, 1);
+	CHECK(fabsf(fabsf(quat_mul_inner(q, keys[0][0][1].rotation)) - 1) < 1e-5f, "slerp at 1 misses the end\n");
+
+	LONGLONG start = timer_now();
+	for (UINT r = 0; r < 1000; ++r) {
+		skin_sample(&clips[0], r * 0.0137f, pose[0]);
+		skin_sample(&clips[1], r * 0.0071f, pose[1]);
+		skin_blend(pose[0], pose[0], pose[1], 0.3f, JOINTS);
+		skin_build_palette(&skeleton, pose[0], &palette);
+	}
+	double pose_us = timer_ms(timer_now() - start);
+	printf("skin: sample 2 clips + blend + palette for %u joints %.2f us\n", JOINTS, pose_us);
+
+	skin_vertex_t * in = malloc(sizeof(skin_vertex_t) * VERTICES);
+	vertex_t * reference = _aligned_malloc(sizeof(vertex_t) * VERTICES, 64);
+	vertex_t * out = _aligned_malloc(sizeof(vertex_t) * VERTICES, 64);
+	vertex_t * dq = _aligned_malloc(sizeof(vertex_t) * VERTICES, 64);
+	CHECK(in != NULL && reference != NULL && out != NULL && dq != NULL, "allocation\n");
+
+	/* every 8th vertex is rigid so linear and dual quaternion results must agree there */
+	for (UINT i = 0; i < VERTICES; ++i) {
+		skin_vertex_t * v = &in[i];
+		*v = (skin_vertex_t) {
+			.pos = { bench_randf(-1, 1), bench_randf(-1, 1), bench_randf(-1, 1), 1 },
+			.color = { 1, 0, 1, 1 },
+		};
+
+		float sum = 0;
+		for (int k = 0; k < SKIN_INFLUENCES; ++k) {
+			v->joints[k] = (BYTE) (bench_rand() % JOINTS);
+			v->weights[k] = i % 8 == 0 ? (k == 0) : bench_randf(0, 1);
+			sum += v->weights[k];
+		}
+		for (int k = 0; k < SKIN_INFLUENCES; ++k) {
+			v->weights[k] /= sum;
+		}
+	}
+
+	/* the plain linmath loop: blend the matrices, then mat4x4_mul_vec4 */
+	start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		for (UINT i = 0; i < VERTICES; ++i) {
+			mat4x4 m;
+			memset(m, 0, sizeof(m));
+			for (int k = 0; k < SKIN_INFLUENCES; ++k) {
+				mat4x4 w;
+				mat4x4_scale(w, palette.matrices[in[i].joints[k]], in[i].weights[k]);
+				mat4x4_add(m, m, w);
+			}
+			mat4x4_mul_vec4(reference[i].pos, m, in[i].pos);
+			memcpy(reference[i].color, in[i].color, sizeof(in[i].color));
+		}
+	}
+	double baseline = timer_ms(timer_now() - start);
+
+	start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		skin_linear(&palette, in, 0, VERTICES, out, FALSE);
+	}
+	double linear = timer_ms(timer_now() - start);
+
+	for (UINT i = 0; i < VERTICES; ++i) {
+		float err = 0;
+		for (int c = 0; c < 4; ++c) {
+			err += fabsf(out[i].pos[c] - reference[i].pos[c]);
+		}
+		CHECK(err < 1e-4f * (1 + fabsf(reference[i].pos[3]) + fabsf(reference[i].pos[0])), "vertex %u differs from the linmath blend by %g\n", i, err);
+	}
+
+	start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		skin_dual_quat(&palette, in, 0, VERTICES, dq, FALSE);
+	}
+	double dual = timer_ms(timer_now() - start);
+
+	for (UINT i = 0; i < VERTICES; i += 8) {
+		float err = fabsf(dq[i].pos[0] - out[i].pos[0]) + fabsf(dq[i].pos[1] - out[i].pos[1]) + fabsf(dq[i].pos[2] - out[i].pos[2]);
+		CHECK(err < 1e-3f, "rigid vertex %u differs between linear and dual quaternion by %g\n", i, err);
+	}
+
+	start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		skin_run(SKIN_LINEAR, &palette, in, VERTICES, out, TRUE);
+	}
+	double linear_mt = timer_ms(timer_now() - start);
+
+	start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		skin_run(SKIN_DUAL_QUAT, &palette, in, VERTICES, dq, TRUE);
+	}
+	double dual_mt = timer_ms(timer_now() - start);
+
+	for (UINT i = 0; i < VERTICES; ++i) {
+		float err = 0;
+		for (int c = 0; c < 4; ++c) {
+			err += fabsf(out[i].pos[c] - reference[i].pos[c]);
+		}
+		CHECK(err < 1e-4f * (1 + fabsf(reference[i].pos[3]) + fabsf(reference[i].pos[0])), "streamed vertex %u differs by %g\n", i, err);
+	}
+
+	double total = (double) VERTICES * REPEAT;
+	printf("skin: linmath blend loop        %.0f vertices/ms\n", total / baseline);
+	printf("skin: linear sse                %.0f vertices/ms\n", total / linear);
+	printf("skin: dual quat sse             %.0f vertices/ms\n", total / dual);
+	printf("skin: linear x%u threads, stream    %.0f vertices/ms\n", jobs_thread_count(), total / linear_mt);
+	printf("skin: dual quat x%u threads, stream %.0f vertices/ms\n", jobs_thread_count(), total / dual_mt);
+
+	_aligned_free(dq);
+	_aligned_free(out);
+	_aligned_free(reference);
+	free(in);
+	return 0;
+}
+
+static void bench_random_xform_kind(mat4x4 m, xform_kind_t kind) {
+	mat4x4 r;
+	mat4x4_identity(r);
+	mat4x4_rotate(r, r, bench_randf(-1, 1), bench_randf(-1, 1), bench_randf(-1, 1) + 2, bench_randf(-3.14f, 3.14f));
+
+	switch (kind) {
+		case XFORM_RIGID: {
+			mat4x4_dup(m, r);
+			break;
+		}
+		case XFORM_UNIFORM_SCALE: {
+			mat4x4_dup(m, r);
+			float s = bench_randf(0.1f, 10);
+			if (fabsf(s - 1) < 0.01f) {
+				s = 2;
+			}
+			for (int c = 0; c < 3; ++c) {
+				vec3_scale(m[c], m[c], s);
+			}
+			break;
+		}
+		case XFORM_AFFINE: {
+			mat4x4_identity(m);
+			for (int c = 0; c < 3; ++c) {
+				for (int i = 0; i < 3; ++i) {
+					m[c][i] += bench_randf(-0.5f, 0.5f);
+				}
+			}
+			break;
+		}
+		default: {
+			mat4x4 proj;
+			mat4x4_perspective(proj, bench_randf(0.5f, 1.5f), bench_randf(1, 2), 0.1f, 100);
+			r[3][0] = bench_randf(-10, 10);
+			r[3][1] = bench_randf(-10, 10);
+			r[3][2] = bench_randf(-10, 10);
+			mat4x4_mul(m, proj, r);
+			return;
+		}
+	}
+
+	m[3][0] = bench_randf(-10, 10);
+	m[3][1] = bench_randf(-10, 10);
+	m[3][2] = bench_randf(-10, 10);
+}
+
+static int bench_xform(void) {
+	enum { COUNT = 1 << 16, REPEAT = 16 };
+	static mat4x4 input[COUNT];
+	static mat4x4 reference[COUNT];
+	static mat4x4 output[COUNT];
+
+	for (xform_kind_t kind = XFORM_RIGID; kind <= XFORM_GENERAL; ++kind) {
+		UINT misclassified = 0;
+		for (UINT i = 0; i < COUNT; ++i) {
+			bench_random_xform_kind(input[i], kind);
+			misclassified += xform_classify(input[i]) != kind;
+			misclassified += xform_classify_sse(input[i]) != kind;
+			mat4x4_invert(reference[i], input[i]);
+		}
+		CHECK(misclassified == 0, "%u %s matrices classified as something else\n", misclassified, xform_kind_name(kind));
+
+		/* accuracy of the explicit, SSE and auto paths against the cofactor expansion */
+		float scalar_err = 0;
+		float sse_err = 0;
+		float identity_err = 0;
+		float normal_err = 0;
+		for (UINT i = 0; i < COUNT; ++i) {
+			mat4x4 r;
+			mat4x4 check;
+			mat4x4 identity;
+			mat4x4_identity(identity);
+
+			xform_invert(r, input[i], kind);
+			scalar_err = fmaxf(scalar_err, bench_mat_error(r, reference[i]));
+			mat4x4_mul(check, input[i], r);
+			identity_err = fmaxf(identity_err, bench_mat_error(check, identity));
+
+			xform_invert_sse(r, input[i], kind);
+			sse_err = fmaxf(sse_err, bench_mat_error(r, reference[i]));
+
+			if (kind != XFORM_GENERAL) {
+				mat4x4 n;
+				mat4x4 expected;
+				xform_normal_matrix(n, input[i], kind);
+				mat4x4_transpose(expected, reference[i]);
+				expected[0][3] = expected[1][3] = expected[2][3] = 0;
+				expected[3][0] = expected[3][1] = expected[3][2] = 0;
+				normal_err = fmaxf(normal_err, bench_mat_error(n, expected));
+				xform_normal_matrix_sse(n, input[i], kind);
+				normal_err = fmaxf(normal_err, bench_mat_error(n, expected));
+			}
+		}
+		CHECK(scalar_err < 1e-4f && sse_err < 1e-4f && normal_err < 1e-4f, "%s: error %g scalar, %g sse, %g normal\n", xform_kind_name(kind), scalar_err, sse_err, normal_err);
+
+		LONGLONG start = timer_now();
+		for (UINT r = 0; r < REPEAT; ++r) {
+			for (UINT i = 0; i < COUNT; ++i) {
+				mat4x4_invert(output[i], input[i]);
+			}
+		}
+		double general = timer_ms(timer_now() - start);
+
+		start = timer_now();
+		for (UINT r = 0; r < REPEAT; ++r) {
+			for (UINT i = 0; i < COUNT; ++i) {
+				xform_invert(output[i], input[i], kind);
+			}
+		}
+		double scalar = timer_ms(timer_now() - start);
+
+		start = timer_now();
+		for (UINT r = 0; r < REPEAT; ++r) {
+			for (UINT i = 0; i < COUNT; ++i) {
+				xform_invert_sse(output[i], input[i], kind);
+			}
+		}
+		double sse = timer_ms(timer_now() - start);
+
+		start = timer_now();
+		for (UINT r = 0; r < REPEAT; ++r) {
+			for (UINT i = 0; i < COUNT; ++i) {
+				xform_invert_auto_sse(output[i], input[i]);
+			}
+		}
+		double automatic = timer_ms(timer_now() - start);
+
+		double ns = 1e6 / ((double) COUNT * REPEAT);
+		printf("xform: %-13s mat4x4_invert %5.1f ns, explicit %5.1f ns, sse %5.1f ns, classified sse %5.1f ns, max error %.2g, M * inverse off identity by %.2g\n", xform_kind_name(kind), general * ns, scalar * ns, sse * ns, automatic * ns, fmaxf(scalar_err, sse_err), identity_err);
+	}
+
+	/* the SSE product sums in linmath's order, equal up to FMA contraction */
+	for (UINT i = 0; i + 1 < COUNT; ++i) {
+		mat4x4 a;
+		mat4x4 b;
+		mat4x4_mul(a, input[i], input[i + 1]);
+		xform_mul_sse(b, input[i], input[i + 1]);
+		float err = bench_mat_error(b, a);
+		CHECK(err < 1e-5f, "xform_mul_sse differs from mat4x4_mul by %g\n", err);
+	}
+
+	/* per-draw matrices: the linmath way against xform_build_draw */
+	mat4x4 proj;
+	mat4x4 camera;
+	mat4x4_perspective(proj, 1, 16.0f / 9.0f, 0.1f, 100);
+	bench_random_xform_kind(camera, XFORM_RIGID);
+	for (UINT i = 0; i < COUNT; ++i) {
+		bench_random_xform_kind(input[i], i % 2 == 0 ? XFORM_RIGID : XFORM_UNIFORM_SCALE);
+	}
+
+	static xform_draw_t draws[COUNT];
+	LONGLONG start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		for (UINT i = 0; i < COUNT; ++i) {
+			mat4x4 view;
+			mat4x4 inverse;
+			mat4x4_invert(view, camera);
+			mat4x4_mul(draws[i].model_view, view, input[i]);
+			mat4x4_mul(draws[i].mvp, proj, draws[i].model_view);
+			mat4x4_invert(inverse, draws[i].model_view);
+			mat4x4_transpose(draws[i].normal, inverse);
+		}
+	}
+	double linmath = timer_ms(timer_now() - start);
+
+	mat4x4 expected;
+	mat4x4_dup(expected, draws[COUNT - 1].mvp);
+
+	start = timer_now();
+	for (UINT r = 0; r < REPEAT; ++r) {
+		for (UINT i = 0; i < COUNT; ++i) {
+			xform_build_draw(&draws[i], proj, camera, input[i]);
+		}
+	}
+	double fused = timer_ms(timer_now() - start);
+	CHECK(bench_mat_error(draws[COUNT - 1].mvp, expected) < 1e-4f, "xform_build_draw mvp differs\n");
+
+	double ns = 1e6 / ((double) COUNT * REPEAT);
+	printf("xform: draw matrices, linmath %.1f ns, xform_build_draw %.1f ns\n", linmath * ns, fused * ns);
+
+	return 0;
+}
+
+/*
+ * headless stand-in for a command list: every call is validated and encoded as a packet
+ * the way a driver would, which is the CPU cost bundles save. bundles are lists of their
+ * own and executing one encodes a single packet pointing at it.
+ */
+enum {
+	BENCH_CMD_VIEWPORT,
+	BENCH_CMD_SCISSOR,
+	BENCH_CMD_BARRIER,
+	BENCH_CMD_TARGETS,
+	BENCH_CMD_CLEAR,
+	BENCH_CMD_PSO,
+	BENCH_CMD_ROOT_SIG,
+	BENCH_CMD_TOPOLOGY,
+	BENCH_CMD_VERTEX_BUFFER,
+	BENCH_CMD_INDEX_BUFFER,
+	BENCH_CMD_DRAW,
+	BENCH_CMD_BUNDLE,
+};
+
+typedef struct bench_cmd {
+	UINT op;
+	UINT args[3];
+	UINT64 ptr;
+} bench_cmd_t;
+
+typedef struct bench_list {
+	bench_cmd_t * cmds;
+	UINT count;
+	UINT capacity;
+} bench_list_t;
+
+static void bench_list_push(bench_list_t * list, UINT op, UINT64 ptr, UINT a, UINT b, UINT c) {
+	if (list->count == list->capacity) {
+		UINT capacity = list->capacity == 0 ? 256 : list->capacity * 2;
+		bench_cmd_t * cmds = realloc(list->cmds, sizeof(bench_cmd_t) * capacity);
+		if (cmds == NULL) {
+			return;
+		}
+		list->cmds = cmds;
+		list->capacity = capacity;
+	}
+
+	list->cmds[list->count++] = (bench_cmd_t) {
+		.op = op,
+		.args = { a, b, c },
+		.ptr = ptr,
+	};
+}
+
+/*
+ * a static scene's sequence, main.c's draw_sequence_t with a draw list too long to key
+ * by value, so the key is the bindings plus a version bumped whenever the list changes
+ */
+typedef struct bench_bindings {
+	UINT64 pso;
+	UINT64 root_sig;
+	UINT64 vbo;
+	UINT64 ibo;
+	UINT64 draws_version;
+} bench_bindings_t;
+
+typedef struct bench_sequence {
+	bench_bindings_t key;
+	UINT draw_count;
+	UINT pad;
+	struct {
+		UINT first_index;
+		UINT index_count;
+	} draws[];
+} bench_sequence_t;
+
+static void bench_record_sequence(bench_list_t * list, bench_sequence_t const * seq) {
+	bench_list_push(list, BENCH_CMD_PSO, seq->key.pso, 0, 0, 0);
+	bench_list_push(list, BENCH_CMD_ROOT_SIG, seq->key.root_sig, 0, 0, 0);
+	bench_list_push(list, BENCH_CMD_TOPOLOGY, 0, 4, 0, 0);
+	bench_list_push(list, BENCH_CMD_VERTEX_BUFFER, seq->key.vbo, 0, 1, 0);
+	bench_list_push(list, BENCH_CMD_INDEX_BUFFER, seq->key.ibo, 0, 0, 0);
+	for (UINT i = 0; i < seq->draw_count; ++i) {
+		bench_list_push(list, BENCH_CMD_DRAW, 0, seq->draws[i].index_count, 1, seq->draws[i].first_index);
+	}
+}
+
+typedef struct bench_bundles {
+	bench_list_t * frame;
+	UINT live;
+	UINT released;
+} bench_bundles_t;
+
+static void * bench_bundle_record(void * user, void const * data) {
+	bench_bundles_t * b = user;
+	bench_list_t * list = calloc(1, sizeof(bench_list_t));
+	if (list == NULL) {
+		return NULL;
+	}
+
+	bench_record_sequence(list, data);
+	++b->live;
+	return list;
+}
+
+static void bench_bundle_execute(void * user, void * bundle) {
+	bench_bundles_t * b = user;
+	bench_list_push(b->frame, BENCH_CMD_BUNDLE, (UINT64) (UINT_PTR) bundle, 0, 0, 0);
+}
+
+static void bench_bundle_release(void * user, void * bundle) {
+	bench_bundles_t * b = user;
+	bench_list_t * list = bundle;
+	free(list->cmds);
+	free(list);
+	--b->live;
+	++b->released;
+}
+
+/* the frame around the static sequence, the commands a bundle cannot hold */
+static void bench_record_frame(bench_list_t * frame, bench_sequence_t const * seq, bundle_cache_t * cache) {
+	frame->count = 0;
+	bench_list_push(frame, BENCH_CMD_VIEWPORT, 0, 1920, 1080, 0);
+	bench_list_push(frame, BENCH_CMD_SCISSOR, 0, 1920, 1080, 0);
+	bench_list_push(frame, BENCH_CMD_BARRIER, 0, 0, 1, 0);
+	bench_list_push(frame, BENCH_CMD_TARGETS, 0, 1, 0, 0);
+	bench_list_push(frame, BENCH_CMD_CLEAR, 0, 0, 0, 0);
+
+	if (cache == NULL || bundle_execute(cache, &seq->key, sizeof(seq->key), seq) != 0) {
+		bench_record_sequence(frame, seq);
+	}
+
+	bench_list_push(frame, BENCH_CMD_BARRIER, 0, 1, 0, 0);
+}
+
+/* what the GPU would see: bundle packets replaced by their contents */
+static void bench_list_flatten(bench_list_t * out, bench_list_t const * list) {
+	out->count = 0;
+	for (UINT i = 0; i < list->count; ++i) {
+		bench_cmd_t const * cmd = &list->cmds[i];
+		if (cmd->op != BENCH_CMD_BUNDLE) {
+			bench_list_push(out, cmd->op, cmd->ptr, cmd->args[0], cmd->args[1], cmd->args[2]);
+			continue;
+		}
+
+		bench_list_t const * bundle = (bench_list_t const *) (UINT_PTR) cmd->ptr;
+		for (UINT j = 0; j < bundle->count; ++j) {
+			bench_cmd_t const * b = &bundle->cmds[j];
+			bench_list_push(out, b->op, b->ptr, b->args[0], b->args[1], b->args[2]);
+		}
+	}
+}
+
+static int bench_bundle(void) {
+	enum { DRAWS = 10000, FRAMES = 200, INVALIDATE_EVERY = 30 };
+	SIZE_T size = sizeof(bench_sequence_t) + sizeof(((bench_sequence_t *) 0)->draws[0]) * DRAWS;
+	bench_sequence_t * seq = calloc(1, size);
+	if (seq == NULL) {
+		return 1;
+	}
+
+	seq->key.pso = 0x1000;
+	seq->key.root_sig = 0x2000;
+	seq->key.vbo = 0x10000;
+	seq->key.ibo = 0x20000;
+	seq->draw_count = DRAWS;
+	UINT first = 0;
+	for (UINT i = 0; i < DRAWS; ++i) {
+		seq->draws[i].first_index = first;
+		seq->draws[i].index_count = 3 * (1 + bench_rand() % 512);
+		first += seq->draws[i].index_count;
+	}
+
+	bench_list_t frame = { 0 };
+	bench_list_t direct = { 0 };
+	bench_list_t flat = { 0 };
+	bench_bundles_t user = {
+		.frame = &frame,
+	};
+	bundle_cache_t cache;
+	bundle_cache_init(&cache, (bundle_backend_t) {
+		.record = bench_bundle_record,
+		.execute = bench_bundle_execute,
+		.release = bench_bundle_release,
+		.user = &user,
+	});
+
+	/* replaying has to put the same commands in front of the GPU as recording directly */
+	bench_record_frame(&frame, seq, NULL);
+	bench_list_flatten(&direct, &frame);
+	bench_record_frame(&frame, seq, &cache);
+	bench_record_frame(&frame, seq, &cache);
+	bench_list_flatten(&flat, &frame);
+	CHECK(frame.count == 7, "bundled frame has %u commands, expected 7\n", frame.count);
+	CHECK(flat.count == direct.count && memcmp(flat.cmds, direct.cmds, sizeof(bench_cmd_t) * direct.count) == 0, "bundle replays a different command stream\n");
+	CHECK(cache.stats.recorded == 1 && cache.stats.hits == 1, "%llu recorded, %llu replayed, expected 1 and 1\n", (unsigned long long) cache.stats.recorded, (unsigned long long) cache.stats.hits);
+
+	/* a re-placed vertex buffer, then a rebuilt PSO, each records; going back replays */
+	seq->key.vbo = 0x18000;
+	bench_record_frame(&frame, seq, &cache);
+	seq->key.pso = 0x1100;
+	bench_record_frame(&frame, seq, &cache);
+	seq->key.vbo = 0x10000;
+	seq->key.pso = 0x1000;
+	bench_record_frame(&frame, seq, &cache);
+	CHECK(cache.stats.recorded == 3 && cache.stats.hits == 2, "invalidation: %llu recorded, %llu replayed, expected 3 and 2\n", (unsigned long long) cache.stats.recorded, (unsigned long long) cache.stats.hits);
+
+	/* a changed draw records too, and old variants fall out once the cache is full */
+	for (UINT i = 0; i < BUNDLE_MAX * 2; ++i) {
+		seq->draws[DRAWS - 1].index_count += 3;
+		++seq->key.draws_version;
+		bench_record_frame(&frame, seq, &cache);
+	}
+	CHECK(cache.count == BUNDLE_MAX && user.live == BUNDLE_MAX, "%u cached, %u live, expected %u\n", cache.count, user.live, BUNDLE_MAX);
+	CHECK(user.released == cache.stats.evicted, "%u released, %llu evicted\n", user.released, (unsigned long long) cache.stats.evicted);
+	bench_list_flatten(&flat, &frame);
+	bench_record_frame(&frame, seq, NULL);
+	CHECK(flat.count == frame.count && memcmp(flat.cmds, frame.cmds, sizeof(bench_cmd_t) * frame.count) == 0, "bundle replays a stale command stream\n");
+
+	/* per-frame recording cost of the static scene: direct, cached, cached with a periodic change */
+	LONGLONG start = timer_now();
+	for (UINT f = 0; f < FRAMES; ++f) {
+		bench_record_frame(&frame, seq, NULL);
+	}
+	double direct_ms = timer_ms(timer_now() - start) / FRAMES;
+	UINT direct_commands = frame.count;
+
+	start = timer_now();
+	for (UINT f = 0; f < FRAMES; ++f) {
+		bench_record_frame(&frame, seq, &cache);
+	}
+	double cached_ms = timer_ms(timer_now() - start) / FRAMES;
+
+	UINT64 recorded = cache.stats.recorded;
+	start = timer_now();
+	for (UINT f = 0; f < FRAMES; ++f) {
+		if (f % INVALIDATE_EVERY == 0) {
+			seq->key.ibo += 0x1000;
+		}
+		bench_record_frame(&frame, seq, &cache);
+	}
+	double churn_ms = timer_ms(timer_now() - start) / FRAMES;
+	UINT64 churn_recorded = cache.stats.recorded - recorded;
+
+	printf("bundle: %u static draws, direct %.4f ms/frame (%u commands), bundle replay %.4f ms/frame (%.0fx), re-recorded every %u frames %.4f ms/frame (%llu recordings)\n", DRAWS, direct_ms, direct_commands, cached_ms, direct_ms / cached_ms, INVALIDATE_EVERY, churn_ms, (unsigned long long) churn_recorded);
+	bundle_report(&cache, stdout);
+
+	bundle_cache_destroy(&cache);
+	CHECK(user.live == 0, "%u bundles leaked\n", user.live);
+
+	free(frame.cmds);
+	free(direct.cmds);
+	free(flat.cmds);
+	free(seq);
+
+	return 0;
+}
+
+/* a representative frame: three compute jobs feeding five graphics passes */
+enum {
+	BENCH_RES_PARTICLES,
+	BENCH_RES_DRAW_ARGS = BENCH_RES_PARTICLES + 2,
+	BENCH_RES_SKINNED = BENCH_RES_DRAW_ARGS + 2,
+	BENCH_RES_SHADOW = BENCH_RES_SKINNED + 2,
+	BENCH_RES_GBUFFER,
+	BENCH_RES_BACKBUFFER,
+};
+
+typedef struct bench_logged_pass {
+	sched_queue_t queue;
+	UINT64 reads;
+	UINT64 writes;
+	double start;
+	double end;
+} bench_logged_pass_t;
+
+/*
+ * plays frames through a scheduler on the simulated timeline. buffers is how many copies
+ * of each compute output there are; all_graphics puts every pass on the graphics queue.
+ */
+static int bench_sched_frames(UINT frames, UINT buffers, BOOL all_graphics, sched_timeline_t * timeline, sched_t * sched, bench_logged_pass_t * log, UINT * logged) {
+	*timeline = (sched_timeline_t) { 0 };
+	sched_init(sched, sched_timeline_backend(timeline));
+	*logged = 0;
+
+	for (UINT f = 0; f < frames; ++f) {
+		UINT cur = f % buffers;
+		UINT prev = (f + buffers - 1) % buffers;
+		sched_queue_t compute = all_graphics ? SCHED_GRAPHICS : SCHED_COMPUTE;
+
+		sched_pass_t passes[] = {
+			{ "particles", compute, SCHED_BIT(BENCH_RES_PARTICLES + prev), SCHED_BIT(BENCH_RES_PARTICLES + cur), 1.5f, NULL },
+			{ "cull", compute, 0, SCHED_BIT(BENCH_RES_DRAW_ARGS + cur), 0.4f, NULL },
+			{ "skin", compute, 0, SCHED_BIT(BENCH_RES_SKINNED + cur), 0.8f, NULL },
+			{ "shadow", SCHED_GRAPHICS, SCHED_BIT(BENCH_RES_SKINNED + cur), SCHED_BIT(BENCH_RES_SHADOW), 1.5f, NULL },
+			{ "gbuffer", SCHED_GRAPHICS, SCHED_BIT(BENCH_RES_SKINNED + cur) | SCHED_BIT(BENCH_RES_DRAW_ARGS + cur), SCHED_BIT(BENCH_RES_GBUFFER), 2.5f, NULL },
+			{ "lighting", SCHED_GRAPHICS, SCHED_BIT(BENCH_RES_GBUFFER) | SCHED_BIT(BENCH_RES_SHADOW), SCHED_BIT(BENCH_RES_BACKBUFFER), 1.5f, NULL },
+			{ "particle_draw", SCHED_GRAPHICS, SCHED_BIT(BENCH_RES_PARTICLES + cur), SCHED_BIT(BENCH_RES_BACKBUFFER), 0.6f, NULL },
+			{ "post", SCHED_GRAPHICS, SCHED_BIT(BENCH_RES_BACKBUFFER), SCHED_BIT(BENCH_RES_BACKBUFFER), 0.8f, NULL },
+		};
+
+		timeline->frame = f;
+		for (UINT i = 0; i < sizeof(passes) / sizeof(passes[0]); ++i) {
+			if (sched_submit(sched, &passes[i]) != 0) {
+				return 1;
+			}
+
+			sched_queue_t q = passes[i].queue;
+			sched_span_t const * span = &timeline->spans[q][timeline->count[q] - 1];
+			log[(*logged)++] = (bench_logged_pass_t) {
+				.queue = q,
+				.reads = passes[i].reads,
+				.writes = passes[i].writes,
+				.start = span->start,
+				.end = span->end,
+			};
+		}
+	}
+
+	return 0;
+}
+
+/* every conflicting pair on different queues has to run in submission order */
+static UINT bench_sched_races(bench_logged_pass_t const * log, UINT count) {
+	UINT races = 0;
+	for (UINT j = 0; j < count; ++j) {
+		for (UINT i = 0; i < j; ++i) {
+			if (log[i].queue == log[j].queue) {
+				continue;
+			}
+
+			BOOL conflict = (log[i].writes & (log[j].reads | log[j].writes)) != 0 || (log[i].reads & log[j].writes) != 0;
+			if (conflict && log[i].end > log[j].start + 1e-9) {
+				++races;
+			}
+		}
+	}
+	return races;
+}
+
+static int bench_sched(void) {
+	/* the example compute job: the SSE skinning path against the shader's scalar twin */
+	enum { VERTICES = 1 << 16, JOINTS = 64, FRAMES = 60, PASSES = 8 };
+	skin_vertex_t * in = malloc(sizeof(skin_vertex_t) * VERTICES);
+	vertex_t * expected = malloc(sizeof(vertex_t) * VERTICES);
+	vertex_t * out = malloc(sizeof(vertex_t) * VERTICES);
+	skin_palette_t * palette = malloc(sizeof(skin_palette_t));
+	bench_logged_pass_t * log = malloc(sizeof(bench_logged_pass_t) * FRAMES * PASSES);
+	if (in == NULL || expected == NULL || out == NULL || palette == NULL || log == NULL) {
+		free(in);
+		free(expected);
+		free(out);
+		free(palette);
+		free(log);
+		return 1;
+	}
+
+	for (UINT j = 0; j < JOINTS; ++j) {
+		skin_xform_t x;
+		bench_random_xform(&x, 2);
+		skin_xform_to_mat4x4(palette->matrices[j], &x);
+	}
+	for (UINT i = 0; i < VERTICES; ++i) {
+		float total = 0;
+		for (UINT c = 0; c < 4; ++c) {
+			in[i].pos[c] = c == 3 ? 1 : bench_randf(-1, 1);
+			in[i].color[c] = bench_randf(0, 1);
+			in[i].joints[c] = (BYTE) (bench_rand() % JOINTS);
+			in[i].weights[c] = bench_randf(0, 1);
+			total += in[i].weights[c];
+		}
+		for (UINT c = 0; c < 4; ++c) {
+			in[i].weights[c] /= total;
+		}
+	}
+
+	LONGLONG start = timer_now();
+	skin_linear_reference(palette, in, VERTICES, expected);
+	double reference_ms = timer_ms(timer_now() - start);
+	skin_linear(palette, in, 0, VERTICES, out, FALSE);
+	CHECK(memcmp(out, expected, sizeof(vertex_t) * VERTICES) == 0, "skin_linear differs from skin_linear_reference\n");
+	printf("sched: cs_skin CPU reference %.3f ms for %u vertices, matches skin_linear bit for bit\n", reference_ms, VERTICES);
+
+	free(in);
+	free(expected);
+	free(out);
+	free(palette);
+
+	/* the same frames serialized on one queue, async with single and double-buffered compute outputs */
+	struct {
+		const char * label;
+		UINT buffers;
+		BOOL all_graphics;
+		sched_timeline_stats_t stats;
+		sched_stats_t sched;
+	} runs[] = {
+		{ "graphics only", 2, TRUE },
+		{ "async, single-buffered", 1, FALSE },
+		{ "async, double-buffered", 2, FALSE },
+	};
+	UINT run_count = sizeof(runs) / sizeof(runs[0]);
+
+	for (UINT r = 0; r < run_count; ++r) {
+		sched_timeline_t timeline;
+		sched_t sched;
+		UINT logged;
+
+		if (bench_sched_frames(FRAMES, runs[r].buffers, runs[r].all_graphics, &timeline, &sched, log, &logged) != 0) {
+			sched_timeline_destroy(&timeline);
+			free(log);
+			fprintf(stderr, "check failed: %s: submission failed\n", runs[r].label);
+			return 1;
+		}
+
+		UINT races = bench_sched_races(log, logged);
+		sched_timeline_get_stats(&timeline, &runs[r].stats);
+		runs[r].sched = sched.stats;
+
+		sched_timeline_stats_t const * st = &runs[r].stats;
+		printf("sched: %-22s %.2f ms/frame, graphics busy %.2f, compute busy %.2f, overlapped %.2f ms/frame, %llu waits, %llu elided\n", runs[r].label, st->makespan / FRAMES, st->busy[SCHED_GRAPHICS] / FRAMES, st->busy[SCHED_COMPUTE] / FRAMES, st->overlap / FRAMES, (unsigned long long) sched.stats.waits, (unsigned long long) sched.stats.elided);
+		if (r == run_count - 1) {
+			printf("sched: first frames at 0.25 ms per column, digits are frame numbers\n");
+			sched_timeline_draw(&timeline, 0.25, 100, stdout);
+		}
+		sched_timeline_destroy(&timeline);
+
+		if (races != 0) {
+			free(log);
+			fprintf(stderr, "check failed: %s: %u conflicting passes overlap\n", runs[r].label, races);
+			return 1;
+		}
+	}
+	free(log);
+
+	CHECK(runs[0].stats.overlap == 0 && runs[0].sched.waits == 0, "one queue should neither overlap nor wait\n");
+	CHECK(runs[2].stats.makespan < runs[0].stats.makespan, "async compute is no faster than one queue\n");
+	CHECK(runs[2].stats.makespan <= runs[1].stats.makespan, "double-buffering made things slower\n");
+	printf("sched: double-buffered async compute %.1f%% faster than one queue\n", 100.0 * (1.0 - runs[2].stats.makespan / runs[0].stats.makespan));
+
+	return 0;
+}
+
+static int bench_particles_equal(particles_t const * a, particles_t const * b) {
+	if (a->count != b->count) {
+		return 0;
+	}
+
+	for (UINT s = 0; s < PARTICLE_STREAMS; ++s) {
+		if (memcmp(a->streams[s], b->streams[s], sizeof(float) * a->count) != 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int bench_particles(void) {
+	enum { CAPACITY = 1 << 20, FRAMES = 64, REPEAT = 16 };
+	particles_t reference;
+	particles_t fast;
+	if (particles_init(&reference, CAPACITY) != 0 || particles_init(&fast, CAPACITY) != 0) {
+		particles_destroy(&reference);
+		return 1;
+	}
+
+	/* fill to capacity in one burst, then a steady stream that keeps it near full */
+	particles_params_t params = {
+		.origin = { 0, -1, 0 },
+		.dt = 1.0f / 60.0f,
+		.gravity = -1.5f,
+		.damping = 0.995f,
+		.spread = 0.6f,
+		.speed = 2.5f,
+		.life_min = 0.25f,
+		.life_max = 1.5f,
+		.emit = CAPACITY,
+		.seed = 1,
+	};
+
+	UINT peak = 0;
+	for (UINT f = 0; f < FRAMES; ++f) {
+		params.seed = particles_hash(f + 1);
+		particles_update_reference(&reference, &params);
+		particles_update(&fast, &params);
+		CHECK(bench_particles_equal(&reference, &fast), "frame %u: %u reference particles, %u " PARTICLES_PATH " particles, or different contents\n", f, reference.count, fast.count);
+		params.emit = CAPACITY / 64;
+		peak = fast.count > peak ? fast.count : peak;
+	}
+	CHECK(reference.stats.expired != 0 && reference.stats.emitted != 0, "nothing expired or was emitted\n");
+
+	/* timing at a full million: long lives, so every particle is integrated and kept */
+	reference.count = 0;
+	fast.count = 0;
+	params.emit = CAPACITY;
+	params.life_min = 1e6f;
+	params.life_max = 1e6f;
+	particles_update_reference(&reference, &params);
+	particles_update(&fast, &params);
+	params.emit = 0;
+
+	double reference_ms = 0;
+	double fast_ms = 0;
+	for (UINT r = 0; r < REPEAT; ++r) {
+		particles_update_reference(&reference, &params);
+		reference_ms += reference.stats.ms;
+		particles_update(&fast, &params);
+		fast_ms += fast.stats.ms;
+	}
+	CHECK(reference.count == CAPACITY && bench_particles_equal(&reference, &fast), "steady state differs\n");
+
+	particle_gpu_t * packed = _aligned_malloc(sizeof(particle_gpu_t) * CAPACITY, 64);
+	CHECK(packed != NULL, "out of memory\n");
+	/* the first pass faults the pages in, an upload buffer would already be resident */
+	particles_pack(&fast, packed, TRUE);
+	LONGLONG start = timer_now();
+	particles_pack(&fast, packed, TRUE);
+	double pack_ms = timer_ms(timer_now() - start);
+	int packed_ok = packed[CAPACITY - 1].position[1] == fast.streams[PARTICLE_PY][CAPACITY - 1] && packed[CAPACITY - 1].life == fast.streams[PARTICLE_LIFE][CAPACITY - 1];
+	_aligned_free(packed);
+	CHECK(packed_ok, "particles_pack wrote the wrong layout\n");
+
+	double per_million = 1e6 / ((double) CAPACITY * REPEAT);
+	printf("particles: %u frames bit-identical (peak %u alive), update per million: scalar reference %.3f ms, " PARTICLES_PATH " on %u threads %.3f ms (%.1fx), pack for upload %.3f ms\n", FRAMES, peak, reference_ms * per_million, jobs_thread_count(), fast_ms * per_million, reference_ms / fast_ms, pack_ms);
+
+	particles_destroy(&reference);
+	particles_destroy(&fast);
+	return 0;
+}
+
+/* what a recording job allocates per batch of draws: packets, a few barriers, the list it records */
+typedef struct bench_packet {
+	UINT64 key;
+	UINT first_index;
+	UINT index_count;
+	UINT pso;
+	UINT pad;
+} bench_packet_t;
+
+typedef struct bench_barrier {
+	void * resource;
+	UINT before;
+	UINT after;
+	UINT subresource;
+	UINT flags;
+} bench_barrier_t;
+
+typedef struct bench_arena_job {
+	arena_t * arena;
+	/* NULL records with the arena, otherwise one malloc per allocation remembered here */
+	void ** mallocs;
+	UINT frame;
+	volatile LONG failed;
+} bench_arena_job_t;
+
+#define BENCH_ARENA_GRAIN 64
+
+static void * bench_arena_get(bench_arena_job_t * job, UINT slot, SIZE_T size) {
+	if (job->mallocs == NULL) {
+		return arena_alloc(job->arena, size);
+	}
+	return job->mallocs[slot] = malloc(size);
+}
+
+static void bench_arena_batch(bench_arena_job_t * job, UINT begin, UINT end) {
+	UINT batch = begin / BENCH_ARENA_GRAIN;
+	UINT count = end - begin;
+	UINT barriers = 1 + (batch + job->frame) % 4;
+
+	bench_packet_t * packets = bench_arena_get(job, batch * 3 + 0, sizeof(bench_packet_t) * count);
+	bench_barrier_t * barrier = bench_arena_get(job, batch * 3 + 1, sizeof(bench_barrier_t) * barriers);
+	void ** lists = bench_arena_get(job, batch * 3 + 2, sizeof(void *) * 2);
+	if (packets == NULL || barrier == NULL || lists == NULL) {
+		InterlockedIncrement(&job->failed);
+		return;
+	}
+
+	for (UINT i = 0; i < count; ++i) {
+		packets[i] = (bench_packet_t) {
+			.key = ((UINT64) job->frame << 32) | (begin + i),
+			.first_index = (begin + i) * 3,
+			.index_count = 3,
+			.pso = i & 1,
+		};
+	}
+	for (UINT i = 0; i < barriers; ++i) {
+		barrier[i] = (bench_barrier_t) {
+			.resource = packets,
+			.before = i,
+			.after = i + 1,
+		};
+	}
+	lists[0] = packets;
+	lists[1] = barrier;
+
+	/* the consumer reads back what it was given, a reused or overlapping block shows up here */
+	UINT64 sum = 0;
+	for (UINT i = 0; i < count; ++i) {
+		sum += packets[i].key & 0xFFFFFFFFu;
+	}
+	if (sum != (UINT64) count * begin + (UINT64) count * (count - 1) / 2 || barrier[barriers - 1].resource != packets || ((UINT_PTR) packets & (ARENA_ALIGN - 1)) != 0) {
+		InterlockedIncrement(&job->failed);
+	}
+}
+
+/* ranges are at least the grain, each batch of BENCH_ARENA_GRAIN draws allocates its own */
+static void bench_arena_record(void * user, UINT begin, UINT end) {
+	for (UINT batch = begin; batch < end; batch += BENCH_ARENA_GRAIN) {
+		bench_arena_batch(user, batch, batch + BENCH_ARENA_GRAIN < end ? batch + BENCH_ARENA_GRAIN : end);
+	}
+}
+
+static int bench_arena(void) {
+	enum { DRAWS = 1 << 16, FRAMES = 256, WARMUP = 4 };
+	UINT slots = DRAWS / BENCH_ARENA_GRAIN * 3;
+	arena_t * arena = malloc(sizeof(arena_t));
+	void ** mallocs = malloc(sizeof(void *) * slots);
+	CHECK(arena != NULL && mallocs != NULL, "out of memory\n");
+	arena_init(arena);
+
+	/* the fence of a frame retires two frames later, like the swapchain's frames in flight */
+	bench_arena_job_t job = {
+		.arena = arena,
+	};
+	double arena_ms = 0;
+	UINT64 grown_after_warmup = 0;
+	for (UINT f = 0; f < FRAMES; ++f) {
+		arena_retire(arena, f >= ARENA_FRAMES ? f + 1 - ARENA_FRAMES : 0);
+		CHECK(arena_begin_frame(arena) == 0, "frame %u: slot still in flight\n", f);
+		job.frame = f;
+		LONGLONG start = timer_now();
+		jobs_parallel_for(DRAWS, BENCH_ARENA_GRAIN, bench_arena_record, &job);
+		double ms = timer_ms(timer_now() - start);
+		arena_end_frame(arena, f + 1);
+		if (f >= WARMUP) {
+			arena_ms += ms;
+			grown_after_warmup += arena->last.grown;
+		}
+	}
+	CHECK(job.failed == 0, "%ld arena batches lost or overwrote their memory\n", (long) job.failed);
+	CHECK(arena_begin_frame(arena) != 0, "began a frame whose slot is still in flight\n");
+	UINT64 bytes = arena->last.bytes;
+	UINT64 allocations = arena->last.allocations;
+	/* blocks are reused, so what is reserved is bounded by one frame per thread per slot, not by the frame count */
+	UINT64 reserved = arena->total.grown * ARENA_BLOCK_SIZE;
+	CHECK(reserved <= (UINT64) ARENA_FRAMES * jobs_thread_count() * (bytes + ARENA_BLOCK_SIZE), "%llu KiB reserved for %llu bytes per frame\n", (unsigned long long) (reserved / 1024), (unsigned long long) bytes);
+
+	/* oversize requests take the malloc fallback and are freed when their frame retires */
+	arena_retire(arena, FRAMES);
+	CHECK(arena_begin_frame(arena) == 0, "retired slot not reusable\n");
+	BYTE * big = arena_alloc(arena, ARENA_OVERSIZE * 8);
+	CHECK(big != NULL && ((UINT_PTR) big & (ARENA_ALIGN - 1)) == 0, "oversize allocation failed\n");
+	memset(big, 0xAB, ARENA_OVERSIZE * 8);
+	arena_end_frame(arena, FRAMES + 1);
+	CHECK(arena->last.oversize_allocations == 1 && arena->last.bytes == 0, "oversize allocation not counted as one\n");
+	arena_retire(arena, FRAMES + 1);
+	CHECK(arena->frames[arena->frame].threads[0].large == NULL, "oversize allocation not freed on retire\n");
+	arena_report(arena, stdout);
+
+	/* the same recording with malloc, everything freed once the frame would have retired */
+	job.mallocs = mallocs;
+	job.failed = 0;
+	double malloc_ms = 0;
+	for (UINT f = 0; f < FRAMES; ++f) {
+		job.frame = f;
+		LONGLONG start = timer_now();
+		jobs_parallel_for(DRAWS, BENCH_ARENA_GRAIN, bench_arena_record, &job);
+		double ms = timer_ms(timer_now() - start);
+		if (f >= WARMUP) {
+			malloc_ms += ms;
+		}
+		start = timer_now();
+		for (UINT i = 0; i < slots; ++i) {
+			free(mallocs[i]);
+		}
+		if (f >= WARMUP) {
+			malloc_ms += timer_ms(timer_now() - start);
+		}
+	}
+	CHECK(job.failed == 0, "malloc batches failed\n");
+
+	UINT timed = FRAMES - WARMUP;
+	printf("arena: %u draws per frame in %llu allocations (%llu bytes) on %u threads, %llu blocks grown after warm-up, record with malloc/free %.3f ms, with arena %.3f ms per frame (%.1fx)\n", DRAWS, (unsigned long long) allocations, (unsigned long long) bytes, jobs_thread_count(), (unsigned long long) grown_after_warmup, malloc_ms / timed, arena_ms / timed, malloc_ms / arena_ms);
+
+	arena_destroy(arena);
+	free(arena);
+	free(mallocs);
+	return 0;
+}
+
+typedef struct bench_draw_entry {
+	UINT64 key;
+	UINT index;
+} bench_draw_entry_t;
+
+static int bench_draw_entry_compare(void const * a, void const * b) {
+	bench_draw_entry_t const * ea = a;
+	bench_draw_entry_t const * eb = b;
+	if (ea->key != eb->key) {
+		return ea->key < eb->key ? -1 : 1;
+	}
+	return ea->index < eb->index ? -1 : ea->index > eb->index;
+}
+
+/* tracks what a command list would have bound and checks every draw against it */
+typedef struct bench_draw_target {
+	draw_packet_t const * packets;
+	UINT bound[4];
+	UINT64 draws;
+	UINT64 mismatched;
+	UINT64 checksum;
+} bench_draw_target_t;
+
+static void bench_draw_set_pipeline(void * user, UINT index) {
+	((bench_draw_target_t *) user)->bound[0] = index;
+}
+
+static void bench_draw_set_root_sig(void * user, UINT index) {
+	((bench_draw_target_t *) user)->bound[1] = index;
+}
+
+static void bench_draw_set_vbuffer(void * user, UINT index) {
+	((bench_draw_target_t *) user)->bound[2] = index;
+}
+
+static void bench_draw_set_ibuffer(void * user, UINT index) {
+	((bench_draw_target_t *) user)->bound[3] = index;
+}
+
+static void bench_draw_draw(void * user, draw_packet_t const * packet) {
+	bench_draw_target_t * target = user;
+	if (target->bound[0] != packet->pipeline || target->bound[1] != packet->root_sig || target->bound[2] != packet->vbuffer || target->bound[3] != packet->ibuffer) {
+		++target->mismatched;
+	}
+	target->checksum = target->checksum * 31 + packet->first_index;
+	++target->draws;
+}
+
+static int bench_drawqueue(void) {
+	enum { PIPELINES = 24, ROOT_SIGS = 3, MESHES = 256, REPEAT = 8 };
+	UINT const sizes[] = { 10000, 100000, 1000000 };
+
+	draw_queue_t q;
+	draw_queue_init(&q);
+	bench_draw_entry_t * entries = malloc(sizeof(bench_draw_entry_t) * 1000000);
+	CHECK(entries != NULL && draw_queue_reserve(&q, 1000000) == 0, "out of memory\n");
+
+	for (UINT s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		UINT count = sizes[s];
+
+		/* a scene in code order: objects visit meshes and materials in no particular order */
+		draw_queue_reset(&q);
+		for (UINT i = 0; i < count; ++i) {
+			UINT pipeline = bench_rand() % PIPELINES;
+			UINT mesh = bench_rand() % MESHES;
+			BOOL blended = pipeline >= PIPELINES - 4;
+			float depth = bench_randf(0.1f, 500.0f);
+			draw_packet_t packet = {
+				.key = draw_key(blended ? 1 : 0, pipeline, mesh, depth, blended),
+				.pipeline = pipeline,
+				.root_sig = pipeline % ROOT_SIGS,
+				.vbuffer = mesh,
+				.ibuffer = mesh / 16,
+				.first_index = i,
+				.index_count = 3,
+				.instance_count = 1,
+				.base_vertex = 0,
+			};
+			CHECK(draw_queue_push(&q, &packet) == 0, "push failed\n");
+		}
+
+		double sort_ms = 0;
+		for (UINT r = 0; r < REPEAT; ++r) {
+			q.stats.sort_ms = 0;
+			draw_queue_sort(&q);
+			sort_ms += q.stats.sort_ms;
+		}
+
+		for (UINT i = 0; i < count; ++i) {
+			entries[i] = (bench_draw_entry_t) { q.packets[i].key, i };
+		}
+		LONGLONG start = timer_now();
+		qsort(entries, count, sizeof(bench_draw_entry_t), bench_draw_entry_compare);
+		double qsort_ms = timer_ms(timer_now() - start);
+		for (UINT i = 0; i < count; ++i) {
+			CHECK(q.order[i] == entries[i].index, "%u packets: position %u holds %u, qsort has %u\n", count, i, q.order[i], entries[i].index);
+		}
+
+		bench_draw_target_t target = { .packets = q.packets };
+		draw_backend_t backend = {
+			.set_pipeline = bench_draw_set_pipeline,
+			.set_root_sig = bench_draw_set_root_sig,
+			.set_vbuffer = bench_draw_set_vbuffer,
+			.set_ibuffer = bench_draw_set_ibuffer,
+			.draw = bench_draw_draw,
+			.user = &target,
+		};
+
+		draw_queue_stats_t unsorted = { 0 };
+		draw_translate(q.packets, NULL, count, &backend, &unsorted);
+		CHECK(target.draws == count && target.mismatched == 0, "code order: %llu draws saw the wrong state\n", (unsigned long long) target.mismatched);
+
+		draw_queue_stats_t sorted = { 0 };
+		target = (bench_draw_target_t) { .packets = q.packets };
+		draw_translate(q.packets, q.order, count, &backend, &sorted);
+		CHECK(target.draws == count && target.mismatched == 0, "sorted: %llu draws saw the wrong state\n", (unsigned long long) target.mismatched);
+
+		UINT64 unsorted_changes = (UINT64) count * 4 - unsorted.avoided;
+		UINT64 sorted_changes = (UINT64) count * 4 - sorted.avoided;
+		CHECK(sorted_changes < unsorted_changes, "sorting didn't reduce state changes\n");
+		printf("drawqueue: %7u packets, radix sort %.3f ms, qsort %.3f ms (%.1fx), state changes %llu in code order, %llu sorted (%llu of %llu avoided), translate %.3f ms\n", count, sort_ms / REPEAT, qsort_ms, qsort_ms * REPEAT / sort_ms, (unsigned long long) unsorted_changes, (unsigned long long) sorted_changes, (unsigned long long) sorted.avoided, (unsigned long long) count * 4, sorted.translate_ms);
+	}
+
+	/* depth order within a pipeline: near first when opaque, far first when blended */
+	CHECK(draw_key(0, 1, 0, 1.0f, FALSE) < draw_key(0, 1, 0, 2.0f, FALSE) && draw_key(0, 1, 0, -1.0f, FALSE) < draw_key(0, 1, 0, 0.5f, FALSE), "opaque depth order\n");
+	CHECK(draw_key(1, 1, 0, 2.0f, TRUE) < draw_key(1, 1, 0, 1.0f, TRUE) && draw_key(0, 4095, 65535, 1e30f, FALSE) < draw_key(1, 0, 0, 0.0f, TRUE), "blended depth or layer order\n");
+
+	free(entries);
+	draw_queue_destroy(&q);
+	return 0;
+}
+
+static volatile LONG bench_pso_created = 0;
+static volatile LONG bench_pso_released = 0;
+
+/* stands in for CreateGraphicsPipelineState: slow, and a new object every call */
+static void * bench_pso_create(void * user, pso_desc_t const * desc) {
+	LONGLONG start = timer_now();
+	while (timer_ms(timer_now() - start) < 0.05) {
+	}
+	return (void *) (UINT_PTR) InterlockedIncrement(&bench_pso_created);
+}
+
+static void bench_pso_release(void * user, void * pso) {
+	InterlockedIncrement(&bench_pso_released);
+}
+
+static BYTE const bench_vs_code[] = { 'D', 'X', 'B', 'C', 1, 2, 3, 4, 5, 6, 7, 8 };
+static BYTE const bench_ps_code[] = { 'D', 'X', 'B', 'C', 8, 7, 6, 5, 4, 3, 2, 1 };
+
+static pso_input_t const bench_pso_inputs[] = {
+	{ "POSITION", 0, 2, 0, 0, FALSE, 0 },
+	{ "COLOR", 0, 2, 0, 16, FALSE, 0 },
+};
+
+static pso_desc_t bench_pso_desc(void) {
+	return (pso_desc_t) {
+		.root_sig = (void *) 0x1000,
+		.vs = bench_vs_code,
+		.vs_size = sizeof(bench_vs_code),
+		.ps = bench_ps_code,
+		.ps_size = sizeof(bench_ps_code),
+		.inputs = bench_pso_inputs,
+		.input_count = 2,
+		.fill_mode = 3,
+		.cull_mode = 3,
+		.depth_clip = TRUE,
+		.src_blend = 2,
+		.dest_blend = 1,
+		.blend_op = 1,
+		.src_blend_alpha = 2,
+		.dest_blend_alpha = 1,
+		.blend_op_alpha = 1,
+		.write_mask = 15,
+		.depth_enable = TRUE,
+		.depth_write_mask = 1,
+		.depth_func = 2,
+		.topology_type = 3,
+		.rtv_count = 1,
+		.rtv_formats = { 28 },
+		.dsv_format = 40,
+		.sample_count = 1,
+	};
+}
+
+/* 1 if a and b normalize to the same key, 0 if different, -1 if either failed */
+static int bench_pso_same(pso_desc_t const * a, pso_desc_t const * b) {
+	pso_key_t ka;
+	pso_key_t kb;
+	if (pso_normalize(a, &ka) != 0 || pso_normalize(b, &kb) != 0) {
+		return -1;
+	}
+	int same = memcmp(&ka, &kb, sizeof(ka)) == 0;
+	if (same != (pso_key_hash(&ka) == pso_key_hash(&kb))) {
+		return -1;
+	}
+	return same;
+}
+
+typedef struct bench_pso_job {
+	pso_cache_t * cache;
+	UINT64 vs_hash;
+	UINT64 ps_hash;
+	void * seen[64];
+	volatile LONG wrong;
+} bench_pso_job_t;
+
+static pso_desc_t bench_pso_variant(UINT v) {
+	pso_desc_t desc = bench_pso_desc();
+	desc.cull_mode = 1 + v % 3;
+	desc.depth_func = 1 + (v / 3) % 8;
+	desc.rtv_formats[0] = v / 24 == 0 ? 28 : (v / 24 == 1 ? 10 : 2);
+	return desc;
+}
+
+static void bench_pso_lookup(void * user, UINT begin, UINT end) {
+	bench_pso_job_t * job = user;
+	for (UINT i = begin; i < end; ++i) {
+		UINT v = (i * 2654435761u >> 8) % 64;
+		pso_desc_t desc = bench_pso_variant(v);
+		/* callers that look up every frame hash their bytecode once */
+		desc.vs_hash = job->vs_hash;
+		desc.ps_hash = job->ps_hash;
+		void * pso;
+		pso_status_t status = pso_cache_get(job->cache, &desc, (i & 3) == 0, &pso);
+		if (status == PSO_PENDING) {
+			continue;
+		}
+		/* the first thread to see a variant records its object, everyone else has to match */
+		void * previous = InterlockedCompareExchangePointer(&job->seen[v], pso, NULL);
+		if (status != PSO_READY || (previous != NULL && previous != pso)) {
+			InterlockedIncrement(&job->wrong);
+		}
+	}
+}
+
+static int bench_psocache(void) {
+	enum { LOOKUPS = 1 << 16 };
+	pso_desc_t base = bench_pso_desc();
+	pso_desc_t d;
+
+	/* equivalent descriptions */
+	BYTE vs_copy[sizeof(bench_vs_code)];
+	memcpy(vs_copy, bench_vs_code, sizeof(vs_copy));
+	d = base;
+	d.vs = vs_copy;
+	CHECK(bench_pso_same(&base, &d) == 1, "bytecode is hashed by address, not content\n");
+
+	pso_input_t appended[2] = {
+		{ "position", 0, 2, 0, PSO_APPEND, FALSE, 7 },
+		{ "Color", 0, 2, 0, PSO_APPEND, FALSE, 0 },
+	};
+	d = base;
+	d.inputs = appended;
+	CHECK(bench_pso_same(&base, &d) == 1, "semantic case, appended offsets or per-vertex step rate changed the key\n");
+
+	d = base;
+	d.blend_enable = FALSE;
+	d.src_blend = 5;
+	d.dest_blend = 6;
+	d.rtv_formats[3] = 99;
+	CHECK(bench_pso_same(&base, &d) == 1, "disabled blend factors or unused targets changed the key\n");
+
+	pso_desc_t no_depth = base;
+	no_depth.depth_enable = FALSE;
+	d = no_depth;
+	d.depth_func = 8;
+	d.depth_write_mask = 0;
+	d.slope_scaled_depth_bias = -0.0f;
+	CHECK(bench_pso_same(&no_depth, &d) == 1, "disabled depth state or negative zero bias changed the key\n");
+
+	/* different pipelines */
+	BYTE vs_flipped[sizeof(bench_vs_code)];
+	memcpy(vs_flipped, bench_vs_code, sizeof(vs_flipped));
+	vs_flipped[sizeof(vs_flipped) - 1] ^= 1;
+	d = base;
+	d.vs = vs_flipped;
+	CHECK(bench_pso_same(&base, &d) == 0, "different bytecode, same key\n");
+	d = base;
+	d.cull_mode = 1;
+	CHECK(bench_pso_same(&base, &d) == 0, "different cull mode, same key\n");
+	d = base;
+	d.blend_enable = TRUE;
+	pso_desc_t blended = d;
+	d.dest_blend = 6;
+	CHECK(bench_pso_same(&blended, &d) == 0, "different enabled blend, same key\n");
+	d = base;
+	d.rtv_formats[0] = 10;
+	CHECK(bench_pso_same(&base, &d) == 0, "different target format, same key\n");
+	CHECK(bench_pso_same(&base, &no_depth) == 0, "depth test on and off, same key\n");
+	pso_input_t indexed[2] = {
+		{ "POSITION", 1, 2, 0, 0, FALSE, 0 },
+		{ "COLOR", 0, 2, 0, 16, FALSE, 0 },
+	};
+	d = base;
+	d.inputs = indexed;
+	CHECK(bench_pso_same(&base, &d) == 0, "different semantic index, same key\n");
+	d = base;
+	d.input_count = PSO_MAX_INPUTS + 1;
+	CHECK(bench_pso_same(&base, &d) == -1, "oversized input layout accepted\n");
+
+	/* concurrent lookups of 64 pipelines, a quarter of them asynchronous */
+	pso_cache_t cache;
+	CHECK(pso_cache_init(&cache, (pso_backend_t) { bench_pso_create, bench_pso_release, NULL }) == 0, "out of memory\n");
+	bench_pso_job_t job = {
+		.cache = &cache,
+		.vs_hash = pso_hash_bytecode(bench_vs_code, sizeof(bench_vs_code)),
+		.ps_hash = pso_hash_bytecode(bench_ps_code, sizeof(bench_ps_code)),
+	};
+	bench_pso_created = 0;
+	LONGLONG start = timer_now();
+	jobs_parallel_for(LOOKUPS, 256, bench_pso_lookup, &job);
+	pso_cache_wait_all(&cache);
+	double ms = timer_ms(timer_now() - start);
+	CHECK(job.wrong == 0, "%ld lookups returned a different object or failed\n", (long) job.wrong);
+	CHECK(bench_pso_created == 64 && cache.stats.created == 64 && cache.count == 64, "%ld objects created for 64 pipelines\n", (long) bench_pso_created);
+
+	/* warm: every lookup hits */
+	LONG64 hits = cache.stats.hits;
+	start = timer_now();
+	jobs_parallel_for(LOOKUPS, 256, bench_pso_lookup, &job);
+	double warm_ms = timer_ms(timer_now() - start);
+	CHECK(cache.stats.hits - hits == LOOKUPS && bench_pso_created == 64 && job.wrong == 0, "warm lookups missed\n");
+
+	/* an asynchronous miss is pending until the job pool gets to it, then resolves */
+	d = bench_pso_variant(64 + 1);
+	d.fill_mode = 2;
+	void * pso;
+	pso_status_t status = pso_cache_get(&cache, &d, TRUE, &pso);
+	CHECK(status == PSO_PENDING || status == PSO_READY, "asynchronous miss failed\n");
+	pso_cache_wait_all(&cache);
+	void * again;
+	CHECK(pso_cache_get(&cache, &d, TRUE, &again) == PSO_READY && again != NULL && (status != PSO_READY || again == pso), "asynchronous creation never became ready\n");
+
+	pso_cache_report(&cache, stdout);
+	pso_cache_destroy(&cache);
+	CHECK(bench_pso_released == bench_pso_created, "%ld of %ld objects released\n", (long) bench_pso_released, (long) bench_pso_created);
+	printf("psocache: %u cold lookups of 64 pipelines on %u threads %.3f ms, %u warm %.3f ms (%.1f ns per hit)\n", LOOKUPS, jobs_thread_count(), ms, LOOKUPS, warm_ms, warm_ms * 1e6 / LOOKUPS);
+	return 0;
+}
+
+static void bench_trace_job(void * user, UINT begin, UINT end) {
+	for (UINT i = begin; i < end; ++i) {
+		TRACE_ZONE("job") {
+			trace_counter("item", i);
+		}
+	}
+}
+
+static UINT bench_count(char const * text, char const * pattern) {
+	UINT count = 0;
+	for (char const * p = strstr(text, pattern); p != NULL; p = strstr(p + 1, pattern)) {
+		++count;
+	}
+	return count;
+}
+
+/* exports into a temporary file and reads it back, NULL on failure */
+static char * bench_trace_json(int * written) {
+	FILE * fp = tmpfile();
+	if (fp == NULL) {
+		return NULL;
+	}
+
+	*written = trace_export(fp);
+	long size = ftell(fp);
+	char * text = malloc(size + 1);
+	rewind(fp);
+	if (text != NULL && fread(text, 1, size, fp) != (size_t) size) {
+		free(text);
+		text = NULL;
+	}
+	if (text != NULL) {
+		text[size] = '\0';
+	}
+	fclose(fp);
+	return text;
+}
+
+static void bench_trace_rewind(void) {
+	for (UINT t = 0; t < trace.threads; ++t) {
+		trace.rings[t].head = 0;
+	}
+}
+
+static int bench_trace(void) {
+	enum { ZONES = 1 << 20, ITEMS = 4096 };
+	CHECK(trace_init() == 0, "failed to allocate rings\n");
+
+	/* two timer reads is the floor any zone has to pay */
+	LONGLONG start = timer_now();
+	volatile LONGLONG sink = 0;
+	for (UINT i = 0; i < ZONES; ++i) {
+		LONGLONG a = timer_now();
+		sink += timer_now() - a;
+	}
+	double timer_ns = timer_ms(timer_now() - start) * 1e6 / ZONES;
+
+	start = timer_now();
+	for (UINT i = 0; i < ZONES; ++i) {
+		TRACE_ZONE("zone") {
+			sink += i;
+		}
+	}
+	double zone_ns = timer_ms(timer_now() - start) * 1e6 / ZONES;
+
+	trace.enabled = FALSE;
+	start = timer_now();
+	for (UINT i = 0; i < ZONES; ++i) {
+		TRACE_ZONE("zone") {
+			sink += i;
+		}
+	}
+	double off_ns = timer_ms(timer_now() - start) * 1e6 / ZONES;
+	trace.enabled = TRUE;
+	CHECK(zone_ns - timer_ns < 50, "a zone costs %.1f ns on top of the timer reads\n", zone_ns - timer_ns);
+
+	/* a wrapped ring still exports its newest events, oldest first, less the slot a writer would fill next */
+	int written;
+	char * json = bench_trace_json(&written);
+	CHECK(json != NULL, "export failed\n");
+	CHECK(written == TRACE_EVENTS - 1 && bench_count(json, "\"ph\":\"X\"") == TRACE_EVENTS - 1, "%d events exported from a full ring\n", written);
+	CHECK(strncmp(json, "{", 1) == 0 && strstr(json, "\n]}\n") != NULL && bench_count(json, "thread_name") == trace.threads, "malformed trace\n");
+	free(json);
+
+	/* every thread of the pool records into its own ring, nothing lost or duplicated */
+	bench_trace_rewind();
+	jobs_parallel_for(ITEMS, 16, bench_trace_job, NULL);
+	UINT64 events = 0;
+	for (UINT t = 0; t < trace.threads; ++t) {
+		events += trace.rings[t].head;
+	}
+	CHECK(events == ITEMS * 2, "%llu events recorded for %u zones and counters\n", (unsigned long long) events, ITEMS * 2);
+	json = bench_trace_json(&written);
+	CHECK(json != NULL, "export failed\n");
+	CHECK(written == ITEMS * 2 && bench_count(json, "\"name\":\"job\",\"ph\":\"X\"") == ITEMS && bench_count(json, "\"ph\":\"C\"") == ITEMS, "%d events exported\n", written);
+	free(json);
+
+	/* zones nest by containment, the inner one has to end up inside the outer */
+	bench_trace_rewind();
+	TRACE_ZONE("outer") {
+		TRACE_ZONE("inner") {
+			sink += 1;
+		}
+	}
+	trace_event_t const * inner = &trace.rings[0].events[0];
+	trace_event_t const * outer = &trace.rings[0].events[1];
+	CHECK(trace.rings[0].head == 2 && strcmp(inner->name, "inner") == 0 && outer->start <= inner->start && inner->end <= outer->end, "nested zones out of order\n");
+
+	/* a slow frame triggers once, then the cooldown holds off the next ones */
+	trace.slow_ms = 1;
+	trace_frame();
+	start = timer_now();
+	while (timer_ms(timer_now() - start) < 2) {
+	}
+	int slow = trace_frame();
+	start = timer_now();
+	while (timer_ms(timer_now() - start) < 2) {
+	}
+	CHECK(slow == 1 && trace_frame() == 0, "slow-frame trigger\n");
+
+	printf("trace: zone %.1f ns (two timer reads %.1f ns, disabled %.1f ns), trace_init measured %.1f ns\n", zone_ns, timer_ns, off_ns, trace.zone_ns);
+	trace_report(stdout);
+	trace_destroy();
+	trace.slow_ms = 0;
+	trace.frame_start = 0;
+	trace.frame = 0;
+	trace.cooldown = 0;
+	return 0;
+}
+
+#define BENCH_DISPLAY_QUEUE 8
+
+/*
+ * flip-model display on a virtual clock: presents queue up behind the GPU, sync interval
+ * 1 frames flip on the first vblank after they're rendered, one per vblank, interval 0
+ * frames flip as soon as they're rendered. Present blocks with PRESENT_DEFAULT_LATENCY
+ * frames queued, the waitable object with max_latency.
+ */
+typedef struct bench_display {
+	LONGLONG now;
+	LONGLONG period;
+	LONGLONG gpu;
+	LONGLONG gpu_free;
+	LONGLONG last_vblank;
+	UINT max_latency;
+
+	struct {
+		UINT64 id;
+		LONGLONG ready;
+		BOOL vsync;
+	} queue[BENCH_DISPLAY_QUEUE];
+	UINT count;
+	UINT64 presents;
+	UINT64 shown;
+	LONGLONG shown_at;
+
+	/* deepest queue seen when the CPU started a frame, and presents with tearing */
+	UINT deepest;
+	UINT64 torn;
+} bench_display_t;
+
+static LONGLONG bench_display_flip_time(bench_display_t const * d) {
+	if (!d->queue[0].vsync) {
+		return d->queue[0].ready > d->shown_at ? d->queue[0].ready : d->shown_at;
+	}
+
+	LONGLONG earliest = d->queue[0].ready > d->last_vblank + 1 ? d->queue[0].ready : d->last_vblank + 1;
+	return (earliest + d->period - 1) / d->period * d->period;
+}
+
+/* flips everything due up to the time given and moves the clock there */
+static void bench_display_run(bench_display_t * d, LONGLONG to) {
+	while (d->count > 0) {
+		LONGLONG t = bench_display_flip_time(d);
+		if (t > to) {
+			break;
+		}
+
+		if (d->queue[0].vsync) {
+			d->last_vblank = t;
+		}
+		d->shown = d->queue[0].id;
+		d->shown_at = t;
+		memmove(&d->queue[0], &d->queue[1], sizeof(d->queue[0]) * --d->count);
+	}
+	if (to > d->now) {
+		d->now = to;
+	}
+}
+
+static void bench_display_block(bench_display_t * d, UINT limit) {
+	while (d->count >= limit) {
+		bench_display_run(d, bench_display_flip_time(d));
+	}
+}
+
+static LONGLONG bench_display_now(void * user) {
+	return ((bench_display_t *) user)->now;
+}
+
+static int bench_display_wait(void * user) {
+	bench_display_t * d = user;
+	bench_display_block(d, d->max_latency);
+	return 0;
+}
+
+static int bench_display_present(void * user, UINT sync_interval, BOOL tearing, UINT64 * id) {
+	bench_display_t * d = user;
+	bench_display_block(d, PRESENT_DEFAULT_LATENCY);
+
+	LONGLONG start = d->now > d->gpu_free ? d->now : d->gpu_free;
+	d->gpu_free = start + d->gpu;
+	d->queue[d->count].id = ++d->presents;
+	d->queue[d->count].ready = d->gpu_free;
+	d->queue[d->count].vsync = sync_interval > 0;
+	++d->count;
+	d->torn += tearing;
+	*id = d->presents;
+	return 0;
+}
+
+static int bench_display_displayed(void * user, UINT64 * id, LONGLONG * when) {
+	bench_display_t * d = user;
+	bench_display_run(d, d->now);
+	if (d->shown == 0) {
+		return 1;
+	}
+
+	*id = d->shown;
+	*when = d->shown_at;
+	return 0;
+}
+
+static int bench_display_set_max_latency(void * user, UINT frames) {
+	((bench_display_t *) user)->max_latency = frames;
+	return 0;
+}
+
+/* runs frames of the given CPU and GPU cost through the mode; the display keeps the queue depth and tearing seen */
+static void bench_present_run(present_t * p, bench_display_t * d, present_mode_t mode, UINT frames, double cpu_ms, double gpu_ms) {
+	LONGLONG ms = (LONGLONG) (1.0 / timer_ms(1000000) * 1000000);
+	d->gpu = (LONGLONG) (gpu_ms * ms);
+	d->deepest = 0;
+	d->torn = 0;
+	present_set_mode(p, mode);
+
+	for (UINT f = 0; f < frames; ++f) {
+		present_begin(p);
+		bench_display_run(d, d->now);
+		if (d->count > d->deepest) {
+			d->deepest = d->count;
+		}
+		present_stamp(p, PRESENT_STAMP_INPUT);
+		bench_display_run(d, d->now + (LONGLONG) (cpu_ms * 0.6 * ms));
+		present_stamp(p, PRESENT_STAMP_SIM);
+		bench_display_run(d, d->now + (LONGLONG) (cpu_ms * 0.4 * ms));
+		present_stamp(p, PRESENT_STAMP_SUBMIT);
+		present_end(p);
+	}
+}
+
+static int bench_present(void) {
+	enum { FRAMES = 600 };
+	/* a 60 Hz display, 5 ms of CPU and 8 ms of GPU work per frame */
+	double const cpu_ms = 5;
+	double const gpu_ms = 8;
+	double const refresh_ms = 1000.0 / 60.0;
+	LONGLONG ms = (LONGLONG) (1.0 / timer_ms(1000000) * 1000000);
+
+	static present_t p;
+	static bench_display_t d;
+	memset(&d, 0, sizeof(d));
+	d.period = (LONGLONG) (refresh_ms * ms);
+	/* the clock starts past zero, a zero stamp reads as not taken */
+	d.now = d.period;
+	present_backend_t backend = {
+		.now = bench_display_now,
+		.wait = bench_display_wait,
+		.present = bench_display_present,
+		.displayed = bench_display_displayed,
+		.set_max_latency = bench_display_set_max_latency,
+		.user = &d,
+	};
+
+	/* the histogram's percentiles land in the bucket of the sample */
+	present_histogram_t h;
+	memset(&h, 0, sizeof(h));
+	for (UINT i = 1; i <= 100; ++i) {
+		present_sample(&h, i);
+	}
+	present_sample(&h, 1e6);
+	CHECK(fabs(present_percentile(&h, 0.5) - 51) < PRESENT_BUCKET_MS && fabs(present_percentile(&h, 0.9) - 91) < PRESENT_BUCKET_MS && present_percentile(&h, 1) == 1e6 && h.over == 1, "percentiles off\n");
+
+	/* the middle of a bucket may lie past every sample in it */
+	memset(&h, 0, sizeof(h));
+	for (UINT i = 0; i < 100; ++i) {
+		present_sample(&h, 3.02);
+	}
+	CHECK(present_percentile(&h, 0.5) <= h.max && present_percentile(&h, 0.99) <= h.max, "p50 %.2f and p99 %.2f past max %.2f\n", present_percentile(&h, 0.5), present_percentile(&h, 0.99), h.max);
+
+	CHECK(present_init(&p, PRESENT_VSYNC, 1, FALSE, backend) == 0, "init failed\n");
+	bench_present_run(&p, &d, PRESENT_VSYNC, FRAMES, cpu_ms, gpu_ms);
+	UINT vsync_deepest = d.deepest;
+	bench_present_run(&p, &d, PRESENT_UNCAPPED, FRAMES, cpu_ms, gpu_ms);
+	CHECK(d.torn == 0, "tore without the system allowing it\n");
+	bench_present_run(&p, &d, PRESENT_WAITABLE, FRAMES, cpu_ms, gpu_ms);
+	UINT waitable_deepest = d.deepest;
+
+	present_mode_stats_t const * vsync = &p.modes[PRESENT_VSYNC];
+	present_mode_stats_t const * uncapped = &p.modes[PRESENT_UNCAPPED];
+	present_mode_stats_t const * waitable = &p.modes[PRESENT_WAITABLE];
+	double vsync_fps = vsync->intervals * 1000.0 / vsync->ms;
+	double uncapped_fps = uncapped->intervals * 1000.0 / uncapped->ms;
+	double waitable_fps = waitable->intervals * 1000.0 / waitable->ms;
+	double vsync_display = present_percentile(&vsync->latency[PRESENT_LATENCY_DISPLAY], 0.5);
+	double waitable_display = present_percentile(&waitable->latency[PRESENT_LATENCY_DISPLAY], 0.5);
+
+	/* vsync and waitable both hold the refresh rate, uncapped runs at the GPU's rate */
+	CHECK(fabs(vsync_fps - 60) < 1 && fabs(waitable_fps - 60) < 1, "vsync %.1f fps, waitable %.1f fps\n", vsync_fps, waitable_fps);
+	CHECK(fabs(uncapped_fps - 1000.0 / gpu_ms) < 2, "uncapped %.1f fps\n", uncapped_fps);
+	/* the waitable object keeps the queue at one frame, vsync lets it fill */
+	CHECK(waitable_deepest <= 1 && vsync_deepest >= PRESENT_DEFAULT_LATENCY - 1, "queue depth %u waitable, %u vsync\n", waitable_deepest, vsync_deepest);
+	/* so input is sampled a refresh or two later and reaches the screen that much sooner */
+	CHECK(waitable_display + refresh_ms < vsync_display, "display latency p50 %.2f ms waitable, %.2f ms vsync\n", waitable_display, vsync_display);
+	CHECK(waitable_display <= cpu_ms + gpu_ms + refresh_ms + PRESENT_BUCKET_MS, "waitable display latency p50 %.2f ms\n", waitable_display);
+	CHECK(vsync->latency[PRESENT_LATENCY_DISPLAY].count + vsync->unresolved + 1 >= FRAMES && waitable->unresolved == 0, "%llu vsync frames never reported shown\n", (unsigned long long) vsync->unresolved);
+
+	printf("present: simulated 60 Hz display, %.0f ms CPU and %.0f ms GPU per frame\n", cpu_ms, gpu_ms);
+	present_report(&p, stdout);
+
+	/* where the system allows tearing, every uncapped frame asks for it */
+	CHECK(present_init(&p, PRESENT_UNCAPPED, 1, TRUE, backend) == 0, "init failed\n");
+	bench_present_run(&p, &d, PRESENT_UNCAPPED, FRAMES, cpu_ms, gpu_ms);
+	CHECK(d.torn == FRAMES, "%llu of %u uncapped frames presented with tearing\n", (unsigned long long) d.torn, FRAMES);
+	return 0;
+}
+
+/* headless targets on a fake queue that finishes each batch `lag` signals after it's submitted */
+typedef struct bench_viewports {
+	bench_list_t lists[VIEWPORT_MAX][VIEWPORT_FRAMES];
+	bench_sequence_t const * seq;
+	UINT64 fence;
+	UINT64 completed;
+	UINT lag;
+	UINT submits;
+	UINT submitted_lists;
+	UINT created;
+	UINT destroyed;
+	/* a slot recorded while its last batch hadn't completed */
+	UINT overwritten;
+} bench_viewports_t;
+
+static int bench_viewport_create(void * user, UINT index, viewport_t * vp) {
+	bench_viewports_t * b = user;
+	vp->target = b->lists[index];
+	++b->created;
+	return 0;
+}
+
+static void bench_viewport_destroy(void * user, UINT index, viewport_t * vp) {
+	bench_viewports_t * b = user;
+	bench_list_t * lists = vp->target;
+	for (UINT f = 0; f < VIEWPORT_FRAMES; ++f) {
+		free(lists[f].cmds);
+		memset(&lists[f], 0, sizeof(lists[f]));
+	}
+	++b->destroyed;
+}
+
+static int bench_viewport_record(void * user, UINT index, viewport_t * vp) {
+	bench_viewports_t * b = user;
+	if (vp->fences[vp->slot] > b->completed) {
+		++b->overwritten;
+	}
+
+	bench_list_t * list = &((bench_list_t *) vp->target)[vp->slot];
+	bench_record_frame(list, b->seq, NULL);
+	list->cmds[0].args[0] = vp->width;
+	list->cmds[0].args[1] = vp->height;
+	vp->list = list;
+	return 0;
+}
+
+static int bench_viewport_present(void * user, UINT index, viewport_t * vp) {
+	return 0;
+}
+
+static int bench_viewport_submit(void * user, void * const * lists, UINT count) {
+	bench_viewports_t * b = user;
+	++b->submits;
+	b->submitted_lists += count;
+	return 0;
+}
+
+static UINT64 bench_viewport_signal(void * user) {
+	bench_viewports_t * b = user;
+	++b->fence;
+	b->completed = b->fence > b->lag ? b->fence - b->lag : 0;
+	return b->fence;
+}
+
+static UINT64 bench_viewport_completed(void * user) {
+	return ((bench_viewports_t *) user)->completed;
+}
+
+static int bench_viewport_wait(void * user, UINT64 fence) {
+	bench_viewports_t * b = user;
+	if (fence > b->completed) {
+		b->completed = fence;
+	}
+	return 0;
+}
+
+static int bench_viewports(void) {
+	enum { DRAWS = 256, FRAMES = 256 };
+	static bench_viewports_t b;
+	static viewport_set_t set;
+	memset(&b, 0, sizeof(b));
+
+	bench_sequence_t * seq = calloc(1, sizeof(bench_sequence_t) + sizeof(seq->draws[0]) * DRAWS);
+	CHECK(seq != NULL, "out of memory\n");
+	seq->draw_count = DRAWS;
+	for (UINT i = 0; i < DRAWS; ++i) {
+		seq->draws[i].first_index = i * 36;
+		seq->draws[i].index_count = 36;
+	}
+	b.seq = seq;
+	b.lag = 2;
+
+	viewport_backend_t backend = {
+		.create = bench_viewport_create,
+		.destroy = bench_viewport_destroy,
+		.record = bench_viewport_record,
+		.present = bench_viewport_present,
+		.submit = bench_viewport_submit,
+		.signal = bench_viewport_signal,
+		.completed = bench_viewport_completed,
+		.wait = bench_viewport_wait,
+		.user = &b,
+	};
+
+	/* the GPU is two batches behind: a three-deep ring never waits, a single buffer waits every frame */
+	viewport_set_init(&set, backend);
+	CHECK(viewport_add(&set, VIEWPORT_HEADLESS, 640, 480, 3) == 0 && viewport_add(&set, VIEWPORT_HEADLESS, 320, 240, 1) == 1, "add failed\n");
+	for (UINT f = 0; f < 16; ++f) {
+		CHECK(viewport_set_frame(&set) == 0, "frame failed\n");
+	}
+	CHECK(b.overwritten == 0, "%u slots recorded while in flight\n", b.overwritten);
+	CHECK(set.stats.waits == 15 && b.submits == 16 && b.submitted_lists == 32, "%llu waits, %u submits of %u lists\n", (unsigned long long) set.stats.waits, b.submits, b.submitted_lists);
+
+	/* removing frees the index for the next viewport, the set fills at VIEWPORT_MAX */
+	viewport_remove(&set, 0);
+	CHECK(set.count == 2 && viewport_add(&set, VIEWPORT_HEADLESS, 64, 64, 2) == 0, "index not reused\n");
+	while (viewport_add(&set, VIEWPORT_HEADLESS, 64, 64, 2) != VIEWPORT_NONE) {
+	}
+	CHECK(set.count == VIEWPORT_MAX && b.created == VIEWPORT_MAX + 1, "set holds %u viewports\n", set.count);
+	viewport_set_destroy(&set);
+	CHECK(b.destroyed == b.created && set.count == 0, "%u of %u destroyed\n", b.destroyed, b.created);
+
+	/* CPU cost per viewport as the set grows: one batch per frame however many there are */
+	double single = 0;
+	printf("viewports: %u draws per viewport, %u frames each\n", DRAWS, FRAMES);
+	for (UINT count = 1; count <= VIEWPORT_MAX; count *= 2) {
+		memset(&b, 0, sizeof(b));
+		b.seq = seq;
+		b.lag = 1;
+		viewport_set_init(&set, backend);
+		for (UINT i = 0; i < count; ++i) {
+			viewport_add(&set, VIEWPORT_HEADLESS, 1920, 1080, 2);
+		}
+
+		/* the first frames grow the lists */
+		for (UINT f = 0; f < 4; ++f) {
+			viewport_set_frame(&set);
+		}
+		memset(&set.stats, 0, sizeof(set.stats));
+
+		LONGLONG start = timer_now();
+		for (UINT f = 0; f < FRAMES; ++f) {
+			CHECK(viewport_set_frame(&set) == 0, "frame failed\n");
+		}
+		double ms = timer_ms(timer_now() - start) / FRAMES;
+		double per = ms / count;
+		CHECK(b.submits == FRAMES + 4 && b.overwritten == 0 && set.stats.waits == 0, "%u viewports: %u submits, %u overwritten, %llu waits\n", count, b.submits, b.overwritten, (unsigned long long) set.stats.waits);
+		if (count == 1) {
+			single = per;
+		}
+		printf("viewports: %2u, %.4f ms per frame, %.4f ms per viewport (%.2fx one viewport), record %.4f ms\n", count, ms, per, per / single, set.stats.record_ms / set.stats.drawn);
+		viewport_set_destroy(&set);
+	}
+
+	free(seq);
+	return 0;
+}
+
+/* a texture per source, RGBA8 with a different pattern each */
+static void * bench_stream_pack(UINT count, UINT width, UINT height, UINT64 * size) {
+	stream_source_t sources[STREAM_MAX_TEXTURES];
+	BYTE * pixels = malloc((SIZE_T) width * height * 4 * count);
+	if (pixels == NULL) {
+		return NULL;
+	}
+	for (UINT t = 0; t < count; ++t) {
+		BYTE * p = pixels + (SIZE_T) width * height * 4 * t;
+		for (UINT i = 0; i < width * height * 4; ++i) {
+			p[i] = (BYTE) bench_rand();
+		}
+		sources[t] = (stream_source_t) { width, height, p };
+	}
+
+	void * pack = stream_pack_build(sources, count, STREAM_FORMAT_RGBA8, BC_QUALITY_FAST, size);
+	free(pixels);
+	return pack;
+}
+
+/*
+ * textures as the bench sees them: the mips each resource holds, checked against the
+ * calls the streamer makes, on a fake queue that completes `lag` fences late
+ */
+typedef struct bench_stream {
+	stream_pack_t const * pack;
+	BYTE * staging;
+	UINT64 staging_bytes;
+	UINT first[STREAM_MAX_TEXTURES];
+	/* the resource between resize and bind, and the next mip it expects an upload for */
+	UINT next_first[STREAM_MAX_TEXTURES];
+	UINT uploaded[STREAM_MAX_TEXTURES];
+	UINT upload_end[STREAM_MAX_TEXTURES];
+	UINT64 slot_fence[STREAM_SLOTS];
+	UINT64 fence;
+	UINT64 completed;
+	UINT lag;
+	/* calls out of order, slots written while the GPU still reads them, uploads not matching the container */
+	UINT wrong;
+	UINT busy_slots;
+	UINT corrupt;
+	/* a mip above a tail uploaded while some texture had no tail yet */
+	UINT early;
+	UINT first_victim;
+} bench_stream_t;
+
+static BYTE * bench_stream_staging(void * user, UINT slot) {
+	bench_stream_t * b = user;
+	if (b->slot_fence[slot] > b->completed) {
+		++b->busy_slots;
+	}
+	return b->staging + b->staging_bytes * slot;
+}
+
+static int bench_stream_resize(void * user, UINT texture, UINT first, UINT old_first) {
+	bench_stream_t * b = user;
+	if (old_first != b->first[texture]) {
+		++b->wrong;
+	}
+	if (first > old_first && b->first_victim == STREAM_NONE) {
+		b->first_victim = texture;
+	}
+	b->next_first[texture] = first;
+	b->uploaded[texture] = first;
+	b->upload_end[texture] = first > old_first ? first : old_first;
+	return 0;
+}
+
+static int bench_stream_upload(void * user, UINT texture, UINT mip, UINT slot, UINT64 offset) {
+	bench_stream_t * b = user;
+	stream_pack_texture_t const * tex = &b->pack->textures[texture];
+	stream_pack_mip_t const * m = &b->pack->mips[tex->first_mip + mip];
+
+	/* exactly the mips the new resource adds, in order */
+	if (mip != b->uploaded[texture] || mip >= b->upload_end[texture]) {
+		++b->wrong;
+	}
+	++b->uploaded[texture];
+	if (memcmp(b->staging + b->staging_bytes * slot + offset, b->pack->data + m->offset, m->size) != 0) {
+		++b->corrupt;
+	}
+	b->slot_fence[slot] = b->fence + 1;
+	return 0;
+}
+
+static int bench_stream_bind(void * user, UINT texture, UINT first) {
+	bench_stream_t * b = user;
+	if (first != b->next_first[texture] || b->uploaded[texture] != b->upload_end[texture]) {
+		++b->wrong;
+	}
+	b->first[texture] = first;
+	return 0;
+}
+
+static UINT64 bench_stream_fence(void * user) {
+	return ((bench_stream_t *) user)->fence + 1;
+}
+
+static UINT64 bench_stream_completed(void * user) {
+	return ((bench_stream_t *) user)->completed;
+}
+
+/* one frame: the update, the load jobs it started, then the fake queue moves on */
+static int bench_stream_frame(stream_t * s, bench_stream_t * b, UINT64 frame, BOOL wait) {
+	BOOL tails = TRUE;
+	for (UINT t = 0; t < b->pack->texture_count; ++t) {
+		tails = tails && s->textures[t].first <= s->textures[t].tail;
+	}
+	UINT uploaded[STREAM_MAX_TEXTURES];
+	memcpy(uploaded, b->first, sizeof(uploaded));
+
+	if (stream_update(s, frame) != 0) {
+		return 1;
+	}
+	if (!tails) {
+		for (UINT t = 0; t < b->pack->texture_count; ++t) {
+			if (b->first[t] < uploaded[t] && b->first[t] < s->textures[t].tail) {
+				++b->early;
+			}
+		}
+	}
+	if (wait) {
+		jobs_wait(&s->pending);
+	}
+
+	++b->fence;
+	b->completed = b->fence > b->lag ? b->fence - b->lag : 0;
+	return 0;
+}
+
+/* resident bytes match the mips the textures hold plus those being loaded */
+static int bench_stream_accounted(stream_t const * s, bench_stream_t const * b) {
+	UINT64 bytes = 0;
+	for (UINT t = 0; t < b->pack->texture_count; ++t) {
+		stream_pack_texture_t const * tex = &b->pack->textures[t];
+		for (UINT m = b->first[t]; m < tex->mips; ++m) {
+			bytes += b->pack->mips[tex->first_mip + m].size;
+		}
+	}
+	for (UINT i = 0; i < STREAM_SLOTS; ++i) {
+		stream_slot_t const * slot = &s->slots[i];
+		if (slot->state == STREAM_SLOT_LOADING || slot->state == STREAM_SLOT_LOADED) {
+			bytes += slot->bytes;
+		}
+	}
+	return bytes == s->resident;
+}
+
+static int bench_stream(void) {
+	enum { TEXTURES = 8, SIZE = 256 };
+
+	/* container: layout, filtering, and rejection of anything that doesn't add up */
+	UINT64 size;
+	BYTE * data = bench_stream_pack(TEXTURES, SIZE, SIZE, &size);
+	CHECK(data != NULL, "out of memory\n");
+	stream_pack_t pack;
+	CHECK(stream_pack_parse(&pack, data, size) == 0 && pack.texture_count == TEXTURES && pack.textures[0].mips == 9, "built container didn't parse\n");
+	stream_pack_mip_t const * m0 = &pack.mips[pack.textures[3].first_mip];
+	stream_pack_mip_t const * m1 = m0 + 1;
+	BYTE const * p0 = pack.data + m0->offset;
+	UINT box = (p0[5 * 4 + 2] + p0[4 * 4 + 2] + p0[m0->row_pitch + 5 * 4 + 2] + p0[m0->row_pitch + 4 * 4 + 2] + 2) / 4;
+	CHECK(m1->width == SIZE / 2 && m1->row_pitch % STREAM_PITCH_ALIGN == 0 && m1->offset % STREAM_PLACEMENT_ALIGN == 0 && pack.data[m1->offset + 2 * 4 + 2] == box, "mip 1 is not the box filtered mip 0\n");
+
+	BYTE * bad = malloc(size);
+	CHECK(bad != NULL, "out of memory\n");
+	stream_pack_t rejected;
+	stream_pack_header_t * bad_header = (stream_pack_header_t *) bad;
+	stream_pack_texture_t * bad_textures = (stream_pack_texture_t *) (bad_header + 1);
+	stream_pack_mip_t * bad_mips = (stream_pack_mip_t *) (bad_textures + TEXTURES);
+	memcpy(bad, data, size);
+	CHECK(stream_pack_parse(&rejected, bad, size - STREAM_PLACEMENT_ALIGN) != 0, "truncated container accepted\n");
+	bad_header->magic ^= 1;
+	CHECK(stream_pack_parse(&rejected, bad, size) != 0, "bad magic accepted\n");
+	memcpy(bad, data, size);
+	bad_mips[0].offset = 0;
+	CHECK(stream_pack_parse(&rejected, bad, size) != 0, "mip overlapping the tables accepted\n");
+	memcpy(bad, data, size);
+	bad_mips[bad_textures[7].first_mip + 8].offset = size;
+	CHECK(stream_pack_parse(&rejected, bad, size) != 0, "mip past the end accepted\n");
+	memcpy(bad, data, size);
+	bad_textures[1].mips = 10;
+	CHECK(stream_pack_parse(&rejected, bad, size) != 0, "more mips than the size has accepted\n");
+	memcpy(bad, data, size);
+	bad_textures[2].height = SIZE * 2;
+	CHECK(stream_pack_parse(&rejected, bad, size) != 0, "footprints not matching the size accepted\n");
+	free(bad);
+
+	/* residency: room for the tails and about three textures in full */
+	static bench_stream_t b;
+	static stream_t s;
+	memset(&b, 0, sizeof(b));
+	b.pack = &pack;
+	b.staging_bytes = stream_staging_size(&pack);
+	b.staging = malloc(b.staging_bytes * STREAM_SLOTS);
+	CHECK(b.staging != NULL, "out of memory\n");
+	b.lag = 2;
+	b.first_victim = STREAM_NONE;
+	for (UINT t = 0; t < TEXTURES; ++t) {
+		b.first[t] = pack.textures[t].mips;
+	}
+
+	stream_backend_t backend = {
+		.staging = bench_stream_staging,
+		.resize = bench_stream_resize,
+		.upload = bench_stream_upload,
+		.bind = bench_stream_bind,
+		.fence = bench_stream_fence,
+		.completed = bench_stream_completed,
+		.user = &b,
+	};
+	CHECK(stream_init(&s, &pack, 0, b.staging_bytes, backend) == 1, "tails over the budget accepted\n");
+	UINT64 full = stream_mip_bytes(&s, 0, 0, pack.textures[0].mips);
+	UINT64 budget = stream_mip_bytes(&s, 0, s.textures[0].tail, pack.textures[0].mips) * TEXTURES + full * 3;
+	CHECK(stream_init(&s, &pack, budget, b.staging_bytes / 2, backend) == 2, "slots too small for a request accepted\n");
+	CHECK(stream_init(&s, &pack, budget, b.staging_bytes, backend) == 0, "init failed\n");
+	CHECK(stream_wanted_mip(&pack, 0, SIZE) == 0 && stream_wanted_mip(&pack, 0, SIZE / 2) == 1 && stream_wanted_mip(&pack, 0, SIZE / 2 + 1) == 0 && stream_wanted_mip(&pack, 0, 1) == 8, "wanted mip doesn't follow the extent\n");
+
+	/* textures 0 to 2 in use, 0 least recently */
+	UINT64 frame = 1;
+	for (; frame < 64; ++frame) {
+		for (UINT t = 0; t < 3; ++t) {
+			if (t > 0 || frame < 32) {
+				stream_use(&s, t, 0, frame);
+			}
+		}
+		CHECK(bench_stream_frame(&s, &b, frame, TRUE) == 0, "update failed\n");
+		CHECK(s.resident <= budget && bench_stream_accounted(&s, &b), "frame %llu: %llu bytes resident of %llu, accounting off\n", (unsigned long long) frame, (unsigned long long) s.resident, (unsigned long long) budget);
+	}
+	for (UINT t = 0; t < TEXTURES; ++t) {
+		CHECK(b.first[t] == (t < 3 ? 0 : s.textures[t].tail), "texture %u holds mips from %u\n", t, b.first[t]);
+	}
+	CHECK(b.early == 0 && s.stats.full_quality_ms > 0 && s.stats.evictions == 0, "%u mips above a tail before every tail, full quality %.3f ms, %llu evictions\n", b.early, s.stats.full_quality_ms, (unsigned long long) s.stats.evictions);
+
+	/* 3 needs room: 0 was used longest ago and goes first, 1 and 2 are in use and keep theirs */
+	for (; frame < 128; ++frame) {
+		stream_use(&s, 1, 0, frame);
+		stream_use(&s, 2, 0, frame);
+		stream_use(&s, 3, 0, frame);
+		CHECK(bench_stream_frame(&s, &b, frame, TRUE) == 0, "update failed\n");
+		CHECK(s.resident <= budget && bench_stream_accounted(&s, &b), "frame %llu: %llu bytes resident of %llu, accounting off\n", (unsigned long long) frame, (unsigned long long) s.resident, (unsigned long long) budget);
+	}
+	CHECK(b.first_victim == 0 && b.first[1] == 0 && b.first[2] == 0 && b.first[3] == 0 && b.first[0] > 0, "evicted %u first, textures hold mips from %u %u %u %u\n", b.first_victim, b.first[0], b.first[1], b.first[2], b.first[3]);
+
+	/* one more doesn't fit without evicting a texture in use, the request waits */
+	UINT64 stalls = s.stats.budget_stalls;
+	for (UINT64 end = frame + 16; frame < end; ++frame) {
+		for (UINT t = 1; t < 5; ++t) {
+			stream_use(&s, t, 0, frame);
+		}
+		CHECK(bench_stream_frame(&s, &b, frame, TRUE) == 0, "update failed\n");
+		CHECK(s.resident <= budget && bench_stream_accounted(&s, &b), "frame %llu: over budget or accounting off\n", (unsigned long long) frame);
+	}
+	CHECK(s.stats.budget_stalls > stalls && b.first[1] == 0 && b.first[2] == 0 && b.first[3] == 0, "no stall, or a texture in use lost mips\n");
+	CHECK(b.wrong == 0 && b.busy_slots == 0 && b.corrupt == 0, "%u calls out of order, %u busy slots written, %u uploads not matching the container\n", b.wrong, b.busy_slots, b.corrupt);
+	stream_report(&s, stdout);
+	stream_destroy(&s);
+	free(b.staging);
+	free(data);
+
+	/* bandwidth: larger textures, every one wanted in full, loads overlapping the frames */
+	enum { LARGE = 1024 };
+	data = bench_stream_pack(TEXTURES, LARGE, LARGE, &size);
+	CHECK(data != NULL, "out of memory\n");
+	CHECK(stream_pack_parse(&pack, data, size) == 0, "built container didn't parse\n");
+	memset(&b, 0, sizeof(b));
+	b.pack = &pack;
+	b.staging_bytes = stream_staging_size(&pack);
+	b.staging = malloc(b.staging_bytes * STREAM_SLOTS);
+	CHECK(b.staging != NULL, "out of memory\n");
+	b.lag = 1;
+	b.first_victim = STREAM_NONE;
+	for (UINT t = 0; t < TEXTURES; ++t) {
+		b.first[t] = pack.textures[t].mips;
+	}
+	CHECK(stream_init(&s, &pack, size, b.staging_bytes, backend) == 0, "init failed\n");
+
+	LONGLONG start = timer_now();
+	for (frame = 1; s.stats.full_quality_ms == 0 && frame < (1u << 24); ++frame) {
+		for (UINT t = 0; t < TEXTURES; ++t) {
+			stream_use(&s, t, 0, frame);
+		}
+		CHECK(bench_stream_frame(&s, &b, frame, FALSE) == 0, "update failed\n");
+	}
+	double ms = timer_ms(timer_now() - start);
+	stream_destroy(&s);
+	CHECK(s.stats.full_quality_ms > 0 && b.wrong == 0 && b.corrupt == 0 && b.busy_slots == 0, "never reached full quality, or %u calls out of order, %u uploads corrupt\n", b.wrong, b.corrupt);
+	printf("stream: %u textures of %ux%u (%.1f MiB container) at full quality in %llu frames, %.2f ms; %.0f MiB/s copying out of the container on %u slots\n", TEXTURES, LARGE, LARGE, (double) size / (1024.0 * 1024.0), (unsigned long long) frame - 1, ms, (double) s.stats.bytes / (1024.0 * 1024.0) * 1000.0 / timer_ms(s.stats.load_ticks), STREAM_SLOTS);
+
+	free(b.staging);
+	free(data);
+	return 0;
+}
+
+/* gradients under hard edges and a little noise, alpha ramping across but above BC1's cutout */
+static void bench_bc_image(BYTE * rgba, UINT width, UINT height) {
+	for (UINT y = 0; y < height; ++y) {
+		for (UINT x = 0; x < width; ++x) {
+			BYTE * p = rgba + ((SIZE_T) y * width + x) * 4;
+			BOOL edge = ((x / 24) ^ (y / 40)) & 1;
+			int noise = (int) (bench_rand() % 9) - 4;
+			int r = (int) (x * 255 / width) + noise;
+			int g = (int) (y * 255 / height) + (edge ? 60 : 0) + noise;
+			int b = edge ? 200 - (int) (x * 100 / width) : 40 + (int) (y * 100 / height);
+			p[0] = (BYTE) (r < 0 ? 0 : r > 255 ? 255 : r);
+			p[1] = (BYTE) (g < 0 ? 0 : g > 255 ? 255 : g);
+			p[2] = (BYTE) b;
+			p[3] = (BYTE) (128 + (x + y) * 127 / (width + height));
+		}
+	}
+}
+
+/* over the first `channels` channels of each texel */
+static double bench_bc_psnr(BYTE const * a, BYTE const * b, UINT texels, UINT channels) {
+	double sum = 0;
+	for (UINT i = 0; i < texels; ++i) {
+		for (UINT c = 0; c < channels; ++c) {
+			double d = (double) a[i * 4 + c] - (double) b[i * 4 + c];
+			sum += d * d;
+		}
+	}
+	double mse = sum / ((double) texels * channels);
+	return mse > 0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+static int bench_bc(void) {
+	enum { SIZE = 512, BLOCKS = SIZE / 4, RANDOM_BLOCKS = 4096 };
+	static UINT const formats[] = { BC_FORMAT_BC1, BC_FORMAT_BC3, BC_FORMAT_BC4, BC_FORMAT_BC5, BC_FORMAT_BC7 };
+
+	/* the kernels the search runs on, against their scalar versions */
+	for (UINT r = 0; r < RANDOM_BLOCKS; ++r) {
+		bc_pixels_t px;
+		float palette[16][4];
+		for (UINT i = 0; i < 16; ++i) {
+			for (UINT c = 0; c < 4; ++c) {
+				px.c[c][i] = (float) (bench_rand() & 255);
+				palette[i][c] = (float) (bench_rand() & 255);
+			}
+		}
+		UINT entries = r % 3 == 0 ? 3 : r % 3 == 1 ? 4 : 16;
+		UINT channels = 3 + r % 2;
+		BYTE scalar[16], simd[16];
+		float e_scalar = bc_fit(&px, palette, entries, channels, scalar);
+		float e_simd = bc_fit_sse(&px, palette, entries, channels, simd);
+		CHECK(e_scalar == e_simd && memcmp(scalar, simd, 16) == 0, "bc_fit_sse differs from bc_fit on block %u (%g against %g)\n", r, e_simd, e_scalar);
+
+		BYTE values[16], levels[8];
+		for (UINT i = 0; i < 16; ++i) {
+			values[i] = (BYTE) bench_rand();
+		}
+		bc4_palette((BYTE) bench_rand(), (BYTE) bench_rand(), levels);
+		UINT u_scalar = bc4_fit(values, levels, scalar);
+		UINT u_simd = bc4_fit_sse(values, levels, simd);
+		CHECK(u_scalar == u_simd && memcmp(scalar, simd, 16) == 0, "bc4_fit_sse differs from bc4_fit on block %u (%u against %u)\n", r, u_simd, u_scalar);
+	}
+
+	/* solid blocks come back within the endpoint precision, exactly for BC4 */
+	for (UINT r = 0; r < 256; ++r) {
+		BYTE block[64], out[16], back[64];
+		BYTE color[4] = { (BYTE) bench_rand(), (BYTE) bench_rand(), (BYTE) bench_rand(), 255 };
+		for (UINT i = 0; i < 16; ++i) {
+			memcpy(block + i * 4, color, 4);
+		}
+		for (UINT f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			for (UINT q = 0; q < BC_QUALITIES; ++q) {
+				bc_encode_block(formats[f], q, block, out);
+				CHECK(bc_decode_block(formats[f], out, back) == 0, "%s block doesn't decode\n", bc_format_name(formats[f]));
+				UINT tolerance = formats[f] == BC_FORMAT_BC4 || formats[f] == BC_FORMAT_BC5 ? 0 : formats[f] == BC_FORMAT_BC7 ? 1 : 4;
+				for (UINT i = 0; i < 16; ++i) {
+					for (UINT c = 0; c < bc_format_channels(formats[f]); ++c) {
+						int d = (int) back[i * 4 + c] - (int) color[c];
+						CHECK((UINT) abs(d) <= tolerance, "solid %s %s block is off by %d in channel %u\n", bc_format_name(formats[f]), bc_quality_names[q], d, c);
+					}
+				}
+			}
+		}
+	}
+
+	/* BC1 keeps the cutout: transparent where alpha was under half, opaque elsewhere */
+	{
+		BYTE block[64], out[8], back[64];
+		for (UINT i = 0; i < 16; ++i) {
+			block[i * 4 + 0] = (BYTE) (i * 16);
+			block[i * 4 + 1] = (BYTE) (255 - i * 16);
+			block[i * 4 + 2] = 90;
+			block[i * 4 + 3] = i % 3 == 0 ? 0 : 255;
+		}
+		for (UINT q = 0; q < BC_QUALITIES; ++q) {
+			bc_encode_block(BC_FORMAT_BC1, q, block, out);
+			bc_decode_block(BC_FORMAT_BC1, out, back);
+			for (UINT i = 0; i < 16; ++i) {
+				CHECK(back[i * 4 + 3] == (i % 3 == 0 ? 0 : 255), "BC1 %s texel %u has alpha %u\n", bc_quality_names[q], i, back[i * 4 + 3]);
+			}
+		}
+	}
+
+	BYTE * source = malloc((SIZE_T) SIZE * SIZE * 4);
+	BYTE * decoded = malloc((SIZE_T) SIZE * SIZE * 4);
+	BYTE * blocks = malloc((SIZE_T) BLOCKS * BLOCKS * 16);
+	BYTE * serial = malloc((SIZE_T) BLOCKS * BLOCKS * 16);
+	CHECK(source != NULL && decoded != NULL && blocks != NULL && serial != NULL, "allocation\n");
+	bench_bc_image(source, SIZE, SIZE);
+
+	for (UINT f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+		UINT format = formats[f];
+		UINT pitch = BLOCKS * bc_block_bytes(format);
+		double psnr[BC_QUALITIES];
+		for (UINT q = 0; q < BC_QUALITIES; ++q) {
+			LONGLONG start = timer_now();
+			CHECK(bc_encode(format, q, source, SIZE, SIZE, SIZE * 4, blocks, pitch) == 0, "%s isn't encoded\n", bc_format_name(format));
+			double ms = timer_ms(timer_now() - start);
+
+			/* the job pool splits rows, the result has to match one thread doing all of them */
+			bc_image_t image = { format, q, source, SIZE, SIZE, SIZE * 4, serial, pitch };
+			start = timer_now();
+			bc_encode_rows(&image, 0, BLOCKS);
+			double serial_ms = timer_ms(timer_now() - start);
+			CHECK(memcmp(blocks, serial, (SIZE_T) pitch * BLOCKS) == 0, "%s %s differs between the job pool and one thread\n", bc_format_name(format), bc_quality_names[q]);
+
+			CHECK(bc_decode(format, blocks, pitch, SIZE, SIZE, decoded, SIZE * 4) == 0, "%s %s doesn't decode\n", bc_format_name(format), bc_quality_names[q]);
+			psnr[q] = bench_bc_psnr(source, decoded, SIZE * SIZE, bc_format_channels(format));
+			double mb = (double) SIZE * SIZE * 4 / 1e6;
+			printf("bc: %s %-6s %8.1f MB/s on %u threads, %7.1f MB/s on one, PSNR %.2f dB\n", bc_format_name(format), bc_quality_names[q], mb * 1000.0 / ms, jobs_thread_count(), mb * 1000.0 / serial_ms, psnr[q]);
+		}
+		CHECK(psnr[BC_QUALITY_HIGH] >= psnr[BC_QUALITY_FAST], "%s at high quality is worse than fast, %.2f against %.2f dB\n", bc_format_name(format), psnr[BC_QUALITY_HIGH], psnr[BC_QUALITY_FAST]);
+		CHECK(psnr[BC_QUALITY_FAST] > 30, "%s at fast quality is only %.2f dB\n", bc_format_name(format), psnr[BC_QUALITY_FAST]);
+	}
+
+	/* containers take block compressed mips down to the tail, and nothing that isn't whole blocks there */
+	stream_source_t sources[2] = { { SIZE, SIZE, source }, { 36, 36, source } };
+	UINT64 size;
+	void * pack = stream_pack_build(sources, 1, BC_FORMAT_BC7, BC_QUALITY_FAST, &size);
+	CHECK(pack != NULL, "BC7 container isn't built\n");
+	stream_pack_t parsed;
+	int err = stream_pack_parse(&parsed, pack, size);
+	CHECK(err == 0 && parsed.textures[0].format == BC_FORMAT_BC7, "BC7 container doesn't parse (%d)\n", err);
+	stream_pack_mip_t const * mip = &parsed.mips[parsed.textures[0].first_mip];
+	CHECK(bc_decode(BC_FORMAT_BC7, parsed.data + mip->offset, mip->row_pitch, mip->width, mip->height, decoded, SIZE * 4) == 0 && bench_bc_psnr(source, decoded, SIZE * SIZE, 4) > 30, "BC7 container mip 0 doesn't decode to the source\n");
+	free(pack);
+	CHECK(stream_pack_build(sources, 2, BC_FORMAT_BC1, BC_QUALITY_FAST, &size) == NULL, "36x36 BC1 texture accepted, its 18x18 mip isn't whole blocks\n");
+
+	free(source);
+	free(decoded);
+	free(blocks);
+	free(serial);
+	return 0;
+}
+
+/* a sphere of rows x columns quads with a bumpy radius, the seam column duplicated the way UVs would have it */
+static UINT bench_lod_sphere(UINT rows, UINT columns, vertex_t * vertices, UINT * indices) {
+	for (UINT r = 0; r <= rows; ++r) {
+		for (UINT c = 0; c <= columns; ++c) {
+			float theta = (float) r / (float) rows * 3.14159265f;
+			float phi = (float) (c % columns) / (float) columns * 6.28318531f;
+			float radius = 1 + 0.05f * sinf(theta * 7) * cosf(phi * 5);
+			vertex_t * v = &vertices[r * (columns + 1) + c];
+			*v = (vertex_t) {
+				.pos = { radius * sinf(theta) * cosf(phi), radius * cosf(theta), radius * sinf(theta) * sinf(phi), 1 },
+				.color = { (float) c / (float) columns, (float) r / (float) rows, 0.5f, 1 },
+			};
+		}
+	}
+
+	/* the poles are rows of vertices at one point, the quads there are single triangles */
+	UINT count = 0;
+	for (UINT r = 0; r < rows; ++r) {
+		for (UINT c = 0; c < columns; ++c) {
+			UINT a = r * (columns + 1) + c, b = a + 1, d = a + columns + 1, e = d + 1;
+			UINT quad[6] = { a, d, b, b, d, e };
+			UINT first = r == 0 ? 3 : 0;
+			UINT end = r == rows - 1 ? 3 : 6;
+			memcpy(indices + count, quad + first, sizeof(UINT) * (end - first));
+			count += end - first;
+		}
+	}
+	return count / 3;
+}
+
+static double bench_lod_area(vertex_t const * vertices, UINT const * indices, UINT count) {
+	double area = 0;
+	for (UINT i = 0; i < count; i += 3) {
+		double n[3];
+		lod_normal(vertices[indices[i]].pos, vertices[indices[i + 1]].pos, vertices[indices[i + 2]].pos, n);
+		area += 0.5 * sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	}
+	return area;
+}
+
+/* every level valid and smaller than the last, at no less error */
+static int bench_lod_check(lod_chain_t const * chain, vertex_t const * vertices, UINT vertex_count, char const * name) {
+	for (UINT l = 0; l < chain->level_count; ++l) {
+		lod_level_t const * level = &chain->levels[l];
+		CHECK(level->index_count % 3 == 0 && level->first_index + level->index_count <= chain->index_count, "%s level %u is out of the index array\n", name, l);
+		if (l > 0) {
+			CHECK(level->index_count < chain->levels[l - 1].index_count && level->error >= chain->levels[l - 1].error, "%s level %u isn't coarser than level %u\n", name, l, l - 1);
+		}
+		for (UINT i = 0; i < level->index_count; i += 3) {
+			UINT const * t = &chain->indices[level->first_index + i];
+			CHECK(t[0] < vertex_count && t[1] < vertex_count && t[2] < vertex_count, "%s level %u indexes past the vertices\n", name, l);
+			CHECK(memcmp(vertices[t[0]].pos, vertices[t[1]].pos, 12) != 0 && memcmp(vertices[t[1]].pos, vertices[t[2]].pos, 12) != 0 && memcmp(vertices[t[2]].pos, vertices[t[0]].pos, 12) != 0, "%s level %u has a degenerate triangle at %u\n", name, l, i / 3);
+		}
+	}
+	return 0;
+}
+
+/* frames of a camera flying over a field of meshes, returns the selector's triangles per frame */
+static void bench_lod_fly(lod_selector_t * lod, lod_chain_t const * chain, UINT side, UINT frames, float sway, UINT * levels) {
+	enum { WIDTH = 1280, HEIGHT = 720 };
+	mat4x4 projection;
+	mat4x4_perspective(projection, 1.0f, (float) WIDTH / HEIGHT, 0.1f, 1000.0f);
+
+	for (UINT f = 0; f < frames; ++f) {
+		/* forward across the field, or swaying in place when sway is set */
+		float z = sway != 0 ? sway * sinf((float) f * 0.7f) : (float) f * 0.5f;
+		vec3 eye = { (float) side * 2.0f, 3.0f, -10.0f + z };
+		vec3 center = { (float) side * 2.0f, 0.0f, z + 20.0f };
+		vec3 up = { 0, 1, 0 };
+		mat4x4 view, vp;
+		mat4x4_look_at(view, eye, center, up);
+		mat4x4_mul(vp, projection, view);
+
+		for (UINT i = 0; i < side * side; ++i) {
+			mat4x4 model, mvp;
+			mat4x4_translate(model, (float) (i % side) * 4.0f, 0, (float) (i / side) * 4.0f);
+			mat4x4_mul(mvp, vp, model);
+			lod_select(lod, chain, mvp, WIDTH, HEIGHT, &levels[i]);
+		}
+		lod_frame(lod);
+	}
+}
+
+static int bench_lod(void) {
+	enum { ROWS = 64, COLUMNS = 128, VERTICES = (ROWS + 1) * (COLUMNS + 1), TRIANGLES = (ROWS - 1) * COLUMNS * 2, GRID = 48, SIDE = 64, FRAMES = 120 };
+	vertex_t * vertices = malloc(sizeof(vertex_t) * VERTICES);
+	UINT * indices = malloc(sizeof(UINT) * TRIANGLES * 3);
+	UINT * levels = calloc(SIDE * SIDE, sizeof(UINT));
+	CHECK(vertices != NULL && indices != NULL && levels != NULL, "allocation\n");
+
+	/* a flat grid simplifies without error and keeps its outline, so its area */
+	for (UINT y = 0; y <= GRID; ++y) {
+		for (UINT x = 0; x <= GRID; ++x) {
+			vertices[y * (GRID + 1) + x] = (vertex_t) { .pos = { (float) x, (float) y, 0, 1 }, .color = { 1, 1, 1, 1 } };
+		}
+	}
+	UINT grid_triangles = 0;
+	for (UINT y = 0; y < GRID; ++y) {
+		for (UINT x = 0; x < GRID; ++x) {
+			UINT a = y * (GRID + 1) + x;
+			UINT quad[6] = { a, a + GRID + 1, a + 1, a + 1, a + GRID + 1, a + GRID + 2 };
+			memcpy(indices + grid_triangles * 3, quad, sizeof(quad));
+			grid_triangles += 2;
+		}
+	}
+	lod_chain_t grid;
+	CHECK(lod_build(&grid, vertices[0].pos, sizeof(vertex_t), (GRID + 1) * (GRID + 1), indices, grid_triangles, 2) == 0, "grid chain isn't built\n");
+	if (bench_lod_check(&grid, vertices, (GRID + 1) * (GRID + 1), "grid") != 0) {
+		return 1;
+	}
+	lod_level_t const * last = &grid.levels[grid.level_count - 1];
+	double area = bench_lod_area(vertices, grid.indices + last->first_index, last->index_count);
+	lod_chain_report(&grid, "flat grid", stdout);
+	CHECK(last->error < 1e-3f && last->index_count / 3 < grid_triangles / 10, "flat grid only went down to %u triangles, error %g\n", last->index_count / 3, last->error);
+	CHECK(fabs(area - GRID * GRID) < GRID * GRID * 1e-3, "flat grid's last level covers %.3f, not %u\n", area, GRID * GRID);
+	lod_destroy(&grid);
+
+	UINT triangles = bench_lod_sphere(ROWS, COLUMNS, vertices, indices);
+	lod_chain_t chain;
+	LONGLONG start = timer_now();
+	CHECK(lod_build(&chain, vertices[0].pos, sizeof(vertex_t), VERTICES, indices, triangles, 32) == 0, "sphere chain isn't built\n");
+	double build_ms = timer_ms(timer_now() - start);
+	if (bench_lod_check(&chain, vertices, VERTICES, "sphere") != 0) {
+		return 1;
+	}
+	CHECK(chain.level_count >= 4, "sphere has only %u levels\n", chain.level_count);
+	CHECK(fabsf(chain.radius - 1.05f) < 0.06f, "sphere's bounding radius is %g\n", chain.radius);
+	lod_chain_report(&chain, "bumpy sphere", stdout);
+	printf("lod: %u triangles simplified in %.2f ms\n", triangles, build_ms);
+
+	/* the same flight with and without levels */
+	lod_selector_t off = { .threshold = 1, .hysteresis = 0.1f, .disabled = TRUE };
+	lod_selector_t on = { .threshold = 1, .hysteresis = 0.1f };
+	bench_lod_fly(&off, &chain, SIDE, FRAMES, 0, levels);
+	memset(levels, 0, sizeof(UINT) * SIDE * SIDE);
+	start = timer_now();
+	bench_lod_fly(&on, &chain, SIDE, FRAMES, 0, levels);
+	double select_ms = timer_ms(timer_now() - start);
+	printf("lod: %u meshes, %u frames, selection and mvp %.3f ms per frame\n", SIDE * SIDE, FRAMES, select_ms / FRAMES);
+	lod_report(&off, stdout);
+	lod_report(&on, stdout);
+	CHECK(off.stats.triangles == off.stats.full_triangles && on.stats.full_triangles == off.stats.full_triangles, "the runs didn't draw the same meshes\n");
+	CHECK(on.stats.triangles * 4 < on.stats.full_triangles, "levels only cut the triangles to %.1f%%\n", 100.0 * (double) on.stats.triangles / (double) on.stats.full_triangles);
+
+	/* a camera swaying in place pops less with the band than without, after a frame to settle */
+	lod_selector_t sharp = { .threshold = 1, .hysteresis = 0 };
+	lod_selector_t banded = { .threshold = 1, .hysteresis = 0.2f };
+	lod_selector_t * sways[2] = { &sharp, &banded };
+	for (UINT i = 0; i < 2; ++i) {
+		memset(levels, 0, sizeof(UINT) * SIDE * SIDE);
+		bench_lod_fly(sways[i], &chain, SIDE, 1, 0.25f, levels);
+		sways[i]->stats.switches = 0;
+		bench_lod_fly(sways[i], &chain, SIDE, FRAMES, 0.25f, levels);
+	}
+	printf("lod: swaying camera, %llu level switches without hysteresis, %llu with 20%%\n", (unsigned long long) sharp.stats.switches, (unsigned long long) banded.stats.switches);
+	CHECK(banded.stats.switches * 2 < sharp.stats.switches, "hysteresis didn't halve the switches, %llu against %llu\n", (unsigned long long) banded.stats.switches, (unsigned long long) sharp.stats.switches);
+
+	lod_destroy(&chain);
+	free(vertices);
+	free(indices);
+	free(levels);
+	return 0;
+}
+
+typedef struct bench_meshlet_tri {
+	UINT v[3];
+} bench_meshlet_tri_t;
+
+static int bench_meshlet_tri_compare(void const * a, void const * b) {
+	bench_meshlet_tri_t const * x = a;
+	bench_meshlet_tri_t const * y = b;
+	for (int k = 0; k < 3; ++k) {
+		if (x->v[k] != y->v[k]) {
+			return x->v[k] < y->v[k] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+/* rotated to start at the smallest id, which keeps the winding */
+static bench_meshlet_tri_t bench_meshlet_tri(UINT a, UINT b, UINT c) {
+	if (b < a && b < c) {
+		return (bench_meshlet_tri_t) { { b, c, a } };
+	}
+	if (c < a && c < b) {
+		return (bench_meshlet_tri_t) { { c, a, b } };
+	}
+	return (bench_meshlet_tri_t) { { a, b, c } };
+}
+
+/* TRUE when a meshlet is kept, or really is outside a plane or back facing in every triangle */
+static BOOL bench_meshlet_culled(meshlet_mesh_t const * mesh, meshlet_view_t const * view, vertex_t const * vertices, UINT index, int verdict) {
+	meshlet_t const * m = &mesh->meshlets[index];
+	UINT const * ids = &mesh->vertices[m->vertex_offset];
+
+	if (verdict == MESHLET_FRUSTUM) {
+		for (int p = 0; p < 6; ++p) {
+			double const plane[4] = { view->planes[p][0], view->planes[p][1], view->planes[p][2], view->planes[p][3] };
+			BOOL outside = TRUE;
+			for (UINT v = 0; v < m->vertex_count && outside; ++v) {
+				float const * pos = vertices[ids[v]].pos;
+				outside = plane[0] * pos[0] + plane[1] * pos[1] + plane[2] * pos[2] + plane[3] < 0;
+			}
+			if (outside) {
+				return TRUE;
+			}
+		}
+		return FALSE;
+	}
+
+	if (verdict == MESHLET_BACKFACE) {
+		for (UINT t = 0; t < m->triangle_count; ++t) {
+			BYTE const * tri = &mesh->triangles[(m->triangle_offset + t) * 3];
+			float const * a = vertices[ids[tri[0]]].pos;
+			float const * b = vertices[ids[tri[1]]].pos;
+			float const * c = vertices[ids[tri[2]]].pos;
+			double e0[3] = { (double) b[0] - a[0], (double) b[1] - a[1], (double) b[2] - a[2] };
+			double e1[3] = { (double) c[0] - a[0], (double) c[1] - a[1], (double) c[2] - a[2] };
+			double n[3] = { e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0] };
+			double facing = n[0] * (a[0] - (double) view->eye[0]) + n[1] * (a[1] - (double) view->eye[1]) + n[2] * (a[2] - (double) view->eye[2]);
+			if (facing * view->cone_sign < 0) {
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static int bench_meshlets(void) {
+	enum { ROWS = 384, COLUMNS = 768, VERTICES = (ROWS + 1) * (COLUMNS + 1), TRIANGLES = (ROWS - 1) * COLUMNS * 2, VIEWS = 48 };
+	vertex_t * vertices = malloc(sizeof(vertex_t) * VERTICES);
+	UINT * indices = malloc(sizeof(UINT) * 3 * TRIANGLES);
+	UINT * out = malloc(sizeof(UINT) * 3 * TRIANGLES);
+	UINT * reference = malloc(sizeof(UINT) * 3 * TRIANGLES);
+	UINT * culled = malloc(sizeof(UINT) * 3 * TRIANGLES);
+	bench_meshlet_tri_t * expected = malloc(sizeof(bench_meshlet_tri_t) * TRIANGLES);
+	bench_meshlet_tri_t * clustered = malloc(sizeof(bench_meshlet_tri_t) * TRIANGLES);
+	vshade_out_t clip = { 0 };
+	CHECK(vertices != NULL && indices != NULL && out != NULL && reference != NULL && culled != NULL && expected != NULL && clustered != NULL && vshade_out_alloc(&clip, VERTICES) == 0, "allocation\n");
+
+	UINT triangles = bench_lod_sphere(ROWS, COLUMNS, vertices, indices);
+	CHECK(triangles == TRIANGLES, "sphere has %u triangles\n", triangles);
+
+	meshlet_mesh_t mesh;
+	LONGLONG start = timer_now();
+	CHECK(meshlet_build(&mesh, vertices[0].pos, sizeof(vertex_t), VERTICES, indices, TRIANGLES) == 0, "meshlets aren't built\n");
+	double build_ms = timer_ms(timer_now() - start);
+	meshlet_mesh_report(&mesh, "bumpy sphere", stdout);
+	printf("meshlets: built in %.2f ms\n", build_ms);
+
+	/* every meshlet within limits, and every triangle in exactly one with its winding */
+	UINT * ids = malloc(sizeof(UINT) * (mesh.count + 1));
+	UINT * reference_ids = malloc(sizeof(UINT) * (mesh.count + 1));
+	CHECK(ids != NULL && reference_ids != NULL, "allocation\n");
+	CHECK(mesh.triangle_count == TRIANGLES, "meshlets hold %u of %u triangles\n", mesh.triangle_count, TRIANGLES);
+	UINT count = 0;
+	for (UINT i = 0; i < mesh.count; ++i) {
+		meshlet_t const * m = &mesh.meshlets[i];
+		CHECK(m->vertex_count >= 3 && m->vertex_count <= MESHLET_MAX_VERTICES && m->triangle_count >= 1 && m->triangle_count <= MESHLET_MAX_TRIANGLES, "meshlet %u has %u vertices and %u triangles\n", i, m->vertex_count, m->triangle_count);
+		for (UINT t = 0; t < m->triangle_count; ++t) {
+			BYTE const * tri = &mesh.triangles[(m->triangle_offset + t) * 3];
+			CHECK(tri[0] < m->vertex_count && tri[1] < m->vertex_count && tri[2] < m->vertex_count, "meshlet %u indexes past its vertices\n", i);
+			UINT const * v = &mesh.vertices[m->vertex_offset];
+			clustered[count++] = bench_meshlet_tri(v[tri[0]], v[tri[1]], v[tri[2]]);
+		}
+	}
+	for (UINT t = 0; t < TRIANGLES; ++t) {
+		expected[t] = bench_meshlet_tri(indices[t * 3 + 0], indices[t * 3 + 1], indices[t * 3 + 2]);
+	}
+	qsort(expected, TRIANGLES, sizeof(bench_meshlet_tri_t), bench_meshlet_tri_compare);
+	qsort(clustered, TRIANGLES, sizeof(bench_meshlet_tri_t), bench_meshlet_tri_compare);
+	CHECK(memcmp(expected, clustered, sizeof(bench_meshlet_tri_t) * TRIANGLES) == 0, "meshlets don't hold the mesh's triangles once each\n");
+
+	precull_t cull;
+	precull_init(&cull, PRECULL_CULL_BACK, FALSE);
+	meshlet_culler_t culler;
+	meshlet_culler_init(&culler, precull_cull_sign(&cull));
+	meshlet_culler_t keep_facing;
+	meshlet_culler_init(&keep_facing, 0);
+
+	double precull_ms = 0;
+	double combined_ms = 0;
+	for (UINT v = 0; v < VIEWS; ++v) {
+		/* around the sphere at varying distance, looking near it so some views turn away */
+		float theta = bench_randf(0, 3.14159265f);
+		float phi = bench_randf(0, 6.28318531f);
+		float distance = bench_randf(1.6f, 4.0f);
+		vec3 eye = { distance * sinf(theta) * cosf(phi), distance * cosf(theta), distance * sinf(theta) * sinf(phi) };
+		mat4x4 proj;
+		mat4x4 view;
+		mat4x4 mvp;
+		mat4x4_perspective(proj, 1.0f, 16.0f / 9.0f, 0.1f, 100.0f);
+		mat4x4_look_at(view, eye, (vec3) { bench_randf(-1.5f, 1.5f), bench_randf(-1.5f, 1.5f), bench_randf(-1.5f, 1.5f) }, (vec3) { 0, 1, 0 });
+		mat4x4_mul(mvp, proj, view);
+
+		meshlet_stats_t stats;
+		UINT kept = meshlet_cull_run(&culler, &mesh, mvp, out, ids, &stats);
+		CHECK(stats.meshlets == mesh.count && stats.kept + stats.frustum + stats.backface == mesh.count && stats.triangles == TRIANGLES, "meshlets unaccounted for\n");
+
+		/* the serial scalar tests have to agree with the threaded SSE run */
+		meshlet_view_t reference_view;
+		meshlet_view_from_mvp(&reference_view, mvp, culler.cull_sign);
+		UINT reference_kept = 0;
+		UINT64 frustum = 0;
+		UINT64 backface = 0;
+		for (UINT i = 0; i < mesh.count; ++i) {
+			int verdict = meshlet_test(&mesh, &reference_view, i);
+			frustum += verdict == MESHLET_FRUSTUM;
+			backface += verdict == MESHLET_BACKFACE;
+			if (verdict == MESHLET_KEPT) {
+				reference_ids[reference_kept++] = i;
+			}
+		}
+		CHECK(reference_kept == stats.kept && frustum == stats.frustum && backface == stats.backface, "view %u: scalar verdicts differ\n", v);
+		CHECK(memcmp(ids, reference_ids, sizeof(UINT) * reference_kept) == 0, "view %u: kept meshlets differ from the serial pass\n", v);
+		meshlet_expand(&mesh, reference_ids, reference_kept, reference);
+		CHECK(memcmp(out, reference, sizeof(UINT) * 3 * kept) == 0, "view %u: compacted indices differ from the serial pass\n", v);
+
+		/* conservative, checked in doubles: a culled meshlet is fully outside one plane or faces away entirely */
+		for (UINT i = 0; i < mesh.count; ++i) {
+			int verdict = meshlet_test(&mesh, &reference_view, i);
+			CHECK(bench_meshlet_culled(&mesh, &reference_view, vertices, i, verdict), "view %u: meshlet %u was culled by %s but is visible\n", v, i, verdict == MESHLET_FRUSTUM ? "frustum" : "cone");
+		}
+
+		vshade_parallel(mvp, vertices, VERTICES, &clip);
+		precull_stats_t alone;
+		precull_stats_t after;
+		precull_run(&cull, &clip, indices, TRIANGLES, culled, &alone);
+		precull_run(&cull, &clip, out, kept, culled, &after);
+		precull_ms += alone.ms;
+		combined_ms += stats.ms + after.ms;
+		CHECK(after.kept <= alone.kept, "view %u: pre-culling kept more after meshlet culling\n", v);
+
+		meshlet_stats_t facing;
+		meshlet_cull_run(&keep_facing, &mesh, mvp, out, NULL, &facing);
+		CHECK(facing.backface == 0 && facing.frustum == stats.frustum, "view %u: culling without facing still culled by cones\n", v);
+	}
+
+	CHECK(culler.total.backface > 0 && culler.total.frustum > 0, "the views culled %llu meshlets by cones and %llu by frustum\n", (unsigned long long) culler.total.backface, (unsigned long long) culler.total.frustum);
+	meshlet_report(&culler.total, stdout);
+	printf("meshlets: %u views, precull alone %.3f ms per view, meshlets then precull %.3f ms per view, %u threads\n", VIEWS, precull_ms / VIEWS, combined_ms / VIEWS, jobs_thread_count());
+
+	meshlet_culler_destroy(&culler);
+	meshlet_culler_destroy(&keep_facing);
+	precull_destroy(&cull);
+	meshlet_destroy(&mesh);
+	vshade_out_free(&clip);
+	free(vertices);
+	free(indices);
+	free(out);
+	free(reference);
+	free(culled);
+	free(expected);
+	free(clustered);
+	free(ids);
+	free(reference_ids);
+	return 0;
+}
+
+/* twelve outward counter-clockwise triangles over corners numbered by their x, y, z bits */
+static void bench_box_indices(UINT * out) {
+	static UINT const faces[6][4] = {
+		{ 0, 2, 6, 4 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 5, 7, 6 },
+	};
+	static float const outward[6][3] = {
+		{ -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 },
+	};
+
+	for (int f = 0; f < 6; ++f) {
+		UINT q[4];
+		memcpy(q, faces[f], sizeof(q));
+		float p[3][3];
+		for (int v = 0; v < 3; ++v) {
+			for (int k = 0; k < 3; ++k) {
+				p[v][k] = (float) (q[v] >> k & 1);
+			}
+		}
+		float e0[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+		float e1[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+		float n[3] = { e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0] };
+		if (n[0] * outward[f][0] + n[1] * outward[f][1] + n[2] * outward[f][2] < 0) {
+			UINT t = q[1];
+			q[1] = q[3];
+			q[3] = t;
+		}
+
+		UINT tris[6] = { q[0], q[1], q[2], q[0], q[2], q[3] };
+		memcpy(out + f * 6, tris, sizeof(tris));
+	}
+}
+
+/* every pixel's nearest occluder depth at its center, FLT_MAX where nothing covers it */
+static void bench_occlusion_reference(occlusion_t const * occ, float * depth) {
+	for (UINT i = 0; i < occ->width * occ->height; ++i) {
+		depth[i] = FLT_MAX;
+	}
+
+	for (UINT t = 0; t < occ->setup_count; ++t) {
+		occlusion_triangle_t const * tri = &occ->setup[t];
+		for (UINT ty = tri->tile_y0; ty < tri->tile_y1; ++ty) {
+			for (UINT tx = tri->tile_x0; tx < tri->tile_x1; ++tx) {
+				UINT rows[4];
+				_mm_storeu_si128((__m128i *) rows, occlusion_tile_coverage(tri, tx, ty));
+				for (UINT r = 0; r < 4; ++r) {
+					for (UINT b = 0; b < 32; ++b) {
+						if ((rows[r] >> b & 1) == 0) {
+							continue;
+						}
+						float x = tx * OCCLUSION_TILE_WIDTH + b + 0.5f;
+						float y = ty * OCCLUSION_TILE_HEIGHT + r + 0.5f;
+						float z = tri->plane[0] * x + tri->plane[1] * y + tri->plane[2];
+						float * d = &depth[(ty * OCCLUSION_TILE_HEIGHT + r) * occ->width + tx * OCCLUSION_TILE_WIDTH + b];
+						*d = z < *d ? z : *d;
+					}
+				}
+			}
+		}
+	}
+}
+
+static int bench_occlusion(void) {
+	enum { GRID = 40, PROPS = 4, OBJECTS = GRID * GRID * (1 + PROPS), OCCLUDERS = 48, FRAMES = 64, WIDTH = 320, HEIGHT = 180 };
+	float const cell = 12;
+	float * boxes = malloc(sizeof(float) * 6 * OBJECTS);
+	BYTE * visible = malloc(OBJECTS);
+	float * scores = malloc(sizeof(float) * GRID * GRID);
+	vertex_t * corners = malloc(sizeof(vertex_t) * 8 * OCCLUDERS);
+	UINT * indices = malloc(sizeof(UINT) * 36 * OCCLUDERS);
+	float * reference = malloc(sizeof(float) * WIDTH * HEIGHT);
+	vshade_out_t clip = { 0 };
+	CHECK(boxes != NULL && visible != NULL && scores != NULL && corners != NULL && indices != NULL && reference != NULL && vshade_out_alloc(&clip, 8 * OCCLUDERS) == 0, "allocation\n");
+
+	/* blocks of towers between streets, cars and kiosks along the kerbs */
+	for (UINT i = 0; i < GRID * GRID; ++i) {
+		float x = (float) (i % GRID) * cell;
+		float z = (float) (i / GRID) * cell;
+		float half_x = bench_randf(3, 4.5f);
+		float half_z = bench_randf(3, 4.5f);
+		float r = bench_randf(0, 1);
+		float * b = &boxes[i * 6];
+		b[0] = x - half_x;
+		b[1] = 0;
+		b[2] = z - half_z;
+		b[3] = x + half_x;
+		b[4] = 4 + 56 * r * r;
+		b[5] = z + half_z;
+	}
+	for (UINT i = 0; i < GRID * GRID * PROPS; ++i) {
+		UINT block = i / PROPS;
+		float x = (float) (block % GRID) * cell + bench_randf(-4.5f, 4.5f);
+		float z = (float) (block / GRID) * cell + (i % 2 == 0 ? 5.2f : -5.2f);
+		float * b = &boxes[(GRID * GRID + i) * 6];
+		b[0] = x - 2.2f;
+		b[1] = 0;
+		b[2] = z - 0.9f;
+		b[3] = x + 2.2f;
+		b[4] = bench_randf(1.4f, 2.6f);
+		b[5] = z + 0.9f;
+	}
+
+	UINT box_indices[36];
+	bench_box_indices(box_indices);
+
+	precull_t winding;
+	precull_init(&winding, PRECULL_CULL_BACK, FALSE);
+	occlusion_t occ;
+	CHECK(occlusion_init(&occ, WIDTH, HEIGHT, precull_cull_sign(&winding)) == 0, "occlusion buffer isn't allocated\n");
+	CHECK(occ.width == WIDTH && occ.height == HEIGHT, "buffer is %ux%u\n", occ.width, occ.height);
+
+	/* an empty buffer hides nothing */
+	mat4x4 proj;
+	mat4x4 view;
+	mat4x4 mvp;
+	mat4x4_perspective(proj, 1.0f, 16.0f / 9.0f, 0.5f, 2000.0f);
+	mat4x4_look_at(view, (vec3) { 6, 1.8f, GRID * cell / 2 + 6 }, (vec3) { 100, 1.8f, GRID * cell / 2 + 6 }, (vec3) { 0, 1, 0 });
+	mat4x4_mul(mvp, proj, view);
+	CHECK(occlusion_test_boxes(&occ, mvp, boxes, OBJECTS, visible) == 0, "an empty buffer culled boxes\n");
+
+	/*
+	 * a flat quad over the whole view can't hide itself, a small one behind it is hidden.
+	 * both windings so either faces front. the big one's diagonal lies off-screen, pixel
+	 * centers on an edge shared by two triangles are covered by neither
+	 */
+	float const quads[2][4] = { { 0, 40, 30, -30 }, { -3, 0.5f, 1.5f, -1.5f } };
+	occlusion_draw_t quad_draws[2];
+	for (UINT q = 0; q < 2; ++q) {
+		float z = quads[q][0];
+		float half = quads[q][1];
+		float x = quads[q][2];
+		float y = quads[q][3];
+		for (UINT c = 0; c < 4; ++c) {
+			corners[q * 4 + c] = (vertex_t) {
+				.pos = { x + ((c == 1 || c == 2) ? half : -half), y + (c >= 2 ? half : -half), z, 1 },
+			};
+		}
+		UINT const quad_indices[12] = { 0, 1, 2, 0, 2, 3, 0, 2, 1, 0, 3, 2 };
+		for (UINT k = 0; k < 12; ++k) {
+			indices[q * 12 + k] = q * 4 + quad_indices[k];
+		}
+		quad_draws[q] = (occlusion_draw_t) {
+			.first_index = q * 12,
+			.index_count = 12,
+			.box = { x - half, y - half, z, x + half, y + half, z },
+		};
+	}
+	mat4x4_look_at(view, (vec3) { 0, 0, 5 }, (vec3) { 0, 0, 0 }, (vec3) { 0, 1, 0 });
+	mat4x4_mul(mvp, proj, view);
+	vshade_run(mvp, corners, 8, &clip);
+	occlusion_clear(&occ);
+	CHECK(occlusion_test_draws(&occ, mvp, &clip, indices, quad_draws, 2, visible) == 0, "quads weren't rasterized\n");
+	CHECK(visible[0] && !visible[1], "facing quad visible %u, quad behind it visible %u\n", visible[0], visible[1]);
+	occ.total = (occlusion_stats_t) { 0 };
+
+	UINT64 pixels_checked = 0;
+	UINT64 in_view = 0;
+	UINT64 culled_in_view = 0;
+	for (UINT frame = 0; frame < FRAMES; ++frame) {
+		/* driving down a street between the blocks, looking around a little */
+		float t = (float) frame / FRAMES;
+		vec3 eye = { 6 + t * (GRID - 2) * cell, 1.8f, GRID * cell / 2 + 6 };
+		float yaw = sinf(t * 12.0f) * 0.6f;
+		vec3 target = { eye[0] + cosf(yaw), 1.8f, eye[2] + sinf(yaw) };
+		mat4x4_look_at(view, eye, target, (vec3) { 0, 1, 0 });
+		mat4x4_mul(mvp, proj, view);
+
+		/* occluders are the towers in the frustum that look largest from here */
+		meshlet_view_t frustum;
+		meshlet_view_from_mvp(&frustum, mvp, 0);
+		for (UINT i = 0; i < GRID * GRID; ++i) {
+			float const * b = &boxes[i * 6];
+			vec3 center = { (b[0] + b[3]) * 0.5f, (b[1] + b[4]) * 0.5f, (b[2] + b[5]) * 0.5f };
+			vec3 extent = { b[3] - center[0], b[4] - center[1], b[5] - center[2] };
+			float radius = sqrtf(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]);
+			float depth = max(draw_view_depth(mvp, center), 1.0f);
+			float size = (b[3] - b[0]) * (b[4] - b[1]) + (b[5] - b[2]) * (b[4] - b[1]);
+			scores[i] = size / (depth * depth);
+			for (int p = 0; p < 6; ++p) {
+				float const * plane = frustum.planes[p];
+				if (plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3] < -radius) {
+					scores[i] = 0;
+				}
+			}
+		}
+		for (UINT o = 0; o < OCCLUDERS; ++o) {
+			UINT best = 0;
+			for (UINT i = 1; i < GRID * GRID; ++i) {
+				best = scores[i] > scores[best] ? i : best;
+			}
+			scores[best] = -1;
+
+			float const * b = &boxes[best * 6];
+			for (UINT c = 0; c < 8; ++c) {
+				corners[o * 8 + c] = (vertex_t) {
+					.pos = { b[(c & 1) * 3], b[1 + (c >> 1 & 1) * 3], b[2 + (c >> 2 & 1) * 3], 1 },
+				};
+			}
+			for (UINT k = 0; k < 36; ++k) {
+				indices[o * 36 + k] = o * 8 + box_indices[k];
+			}
+		}
+
+		occlusion_clear(&occ);
+		vshade_run(mvp, corners, 8 * OCCLUDERS, &clip);
+		CHECK(occlusion_rasterize(&occ, &clip, indices, 12 * OCCLUDERS) == 0, "occluders weren't rasterized\n");
+		UINT culled = occlusion_test_boxes(&occ, mvp, boxes, OBJECTS, visible);
+
+		/* the threaded tests agree with one box at a time */
+		for (UINT i = 0; i < OBJECTS; ++i) {
+			occlusion_rect_t rect;
+			BOOL alone = !occlusion_box_rect(&occ, mvp, &boxes[i * 6], &boxes[i * 6 + 3], &rect) || occlusion_test_rect(&occ, &rect);
+			CHECK(alone == visible[i], "frame %u: box %u tested differently on the pool\n", frame, i);
+		}
+		for (UINT i = 0; i < OBJECTS; ++i) {
+			float const * b = &boxes[i * 6];
+			BOOL outside = FALSE;
+			for (int p = 0; p < 6; ++p) {
+				float const * plane = frustum.planes[p];
+				outside |= plane[0] * (plane[0] > 0 ? b[3] : b[0]) + plane[1] * (plane[1] > 0 ? b[4] : b[1]) + plane[2] * (plane[2] > 0 ? b[5] : b[2]) + plane[3] < 0;
+			}
+			CHECK(!outside || visible[i], "frame %u: box %u outside the frustum was culled\n", frame, i);
+			in_view += !outside;
+		}
+		culled_in_view += culled;
+
+		/* no tile bound is nearer than the occluders at any pixel, and culled boxes really are behind them */
+		bench_occlusion_reference(&occ, reference);
+		for (UINT y = 0; y < HEIGHT; ++y) {
+			for (UINT x = 0; x < WIDTH; ++x) {
+				UINT tile = (y / OCCLUSION_TILE_HEIGHT) * occ.tiles_x + x / OCCLUSION_TILE_WIDTH;
+				UINT rows[4];
+				_mm_storeu_si128((__m128i *) rows, occ.masks[tile]);
+				float bound = (rows[y % OCCLUSION_TILE_HEIGHT] >> (x % OCCLUSION_TILE_WIDTH) & 1) ? occ.z1[tile] : occ.z0[tile];
+				CHECK(bound >= reference[y * WIDTH + x], "frame %u: pixel %u, %u is bounded at %g in front of an occluder at %g\n", frame, x, y, bound, reference[y * WIDTH + x]);
+			}
+		}
+		for (UINT i = 0; i < OBJECTS; ++i) {
+			if (visible[i]) {
+				continue;
+			}
+			occlusion_rect_t rect;
+			CHECK(occlusion_box_rect(&occ, mvp, &boxes[i * 6], &boxes[i * 6 + 3], &rect), "frame %u: box %u was culled without a rectangle\n", frame, i);
+			for (UINT y = rect.y0; y < rect.y1; ++y) {
+				for (UINT x = rect.x0; x < rect.x1; ++x) {
+					CHECK(reference[y * WIDTH + x] <= rect.zmin, "frame %u: box %u was culled but shows at %u, %u\n", frame, i, x, y);
+					++pixels_checked;
+				}
+			}
+		}
+	}
+
+	occlusion_report(&occ, stdout);
+	printf("occlusion: %u objects in a %ux%u city, %u occluders per frame, %.1f objects in the frustum per frame of which %.1f%% culled, %llu pixels of culled boxes checked\n", OBJECTS, GRID, GRID, OCCLUDERS, (double) in_view / FRAMES, culled_in_view * 100.0 / (double) in_view, (unsigned long long) pixels_checked);
+	CHECK(culled_in_view * 2 > in_view, "only %.1f%% of the city in view was culled\n", culled_in_view * 100.0 / (double) in_view);
+	CHECK(occ.total.rasterized * 3 < occ.total.triangles * 2, "back faces weren't skipped, %llu of %llu rasterized\n", (unsigned long long) occ.total.rasterized, (unsigned long long) occ.total.triangles);
+
+	occlusion_destroy(&occ);
+	precull_destroy(&winding);
+	vshade_out_free(&clip);
+	free(boxes);
+	free(visible);
+	free(scores);
+	free(corners);
+	free(indices);
+	free(reference);
+	return 0;
+}
+
+/* every object sits in exactly one leaf, and every bound holds what is under it */
+static int bvh_bench_check(bvh_t const * bvh, float const * boxes, UINT count) {
+	BYTE * seen = calloc(count, 1);
+	CHECK(seen != NULL, "allocation\n");
+	CHECK(bvh->item_count == count, "%u of %u objects\n", bvh->item_count, count);
+	for (UINT i = 0; i < count; ++i) {
+		UINT item = bvh->items[i];
+		CHECK(item < count && !seen[item], "object %u is listed twice or out of range\n", item);
+		seen[item] = 1;
+	}
+
+	for (UINT node = 0; node < bvh->node_count; ++node) {
+		bvh_node_t const * n = &bvh->nodes[node];
+		CHECK(n->child_count >= 1 && n->child_count <= 4, "node %u has %u children\n", node, n->child_count);
+		for (UINT slot = 0; slot < n->child_count; ++slot) {
+			if (n->child[slot] != BVH_LEAF) {
+				bvh_node_t const * c = &bvh->nodes[n->child[slot]];
+				CHECK(n->child[slot] > node && c->parent == node * 4 + slot, "node %u slot %u has a bad child\n", node, slot);
+				CHECK(c->first[0] == n->first[slot] && c->first[c->child_count - 1] + c->count[c->child_count - 1] == n->first[slot] + n->count[slot], "node %u slot %u doesn't own its child's objects\n", node, slot);
+			} else {
+				CHECK(n->count[slot] >= 1 && n->count[slot] <= BVH_MAX_LEAF, "leaf of %u objects\n", n->count[slot]);
+			}
+			for (UINT i = n->first[slot]; i < n->first[slot] + n->count[slot]; ++i) {
+				UINT item = bvh->items[i];
+				float const * b = &boxes[item * 6];
+				for (int k = 0; k < 3; ++k) {
+					CHECK(b[k] >= n->bounds[k][slot] && b[3 + k] <= n->bounds[3 + k][slot], "object %u sticks out of node %u slot %u\n", item, node, slot);
+				}
+				if (n->child[slot] == BVH_LEAF) {
+					CHECK(bvh->leaf_of[item] == node * 4 + slot, "object %u has the wrong leaf\n", item);
+				}
+			}
+		}
+	}
+
+	free(seen);
+	return 0;
+}
+
+static int bvh_bench_compare(UINT const * found, UINT found_count, UINT const * expected, UINT expected_count, BYTE * marks, UINT count) {
+	CHECK(found_count == expected_count, "the hierarchy found %u objects, the scan %u\n", found_count, expected_count);
+	memset(marks, 0, count);
+	for (UINT i = 0; i < expected_count; ++i) {
+		marks[expected[i]] = 1;
+	}
+	for (UINT i = 0; i < found_count; ++i) {
+		CHECK(marks[found[i]] == 1, "object %u was found by the hierarchy only or twice\n", found[i]);
+		marks[found[i]] = 2;
+	}
+	return 0;
+}
+
+static void bvh_bench_view(mat4x4 mvp, float side) {
+	mat4x4 proj;
+	mat4x4 view;
+	vec3 eye = { bench_randf(0, side), bench_randf(0, side), bench_randf(0, side) };
+	vec3 at = { bench_randf(0, side), bench_randf(0, side), bench_randf(0, side) };
+	mat4x4_perspective(proj, 1.0f, 16.0f / 9.0f, 0.5f, side * 0.4f);
+	mat4x4_look_at(view, eye, at, (vec3) { 0, 1, 0 });
+	mat4x4_mul(mvp, proj, view);
+}
+
+static int bench_bvh(void) {
+	enum { QUERIES = 32, FRAMES = 8, MOVED_PERCENT = 10 };
+	static UINT const counts[] = { 10000, 100000, 1000000 };
+
+	for (UINT c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		UINT count = counts[c];
+		UINT moved_count = count * MOVED_PERCENT / 100;
+		float side = cbrtf((float) count) * 8;
+		float * boxes = malloc(sizeof(float) * 6 * count);
+		UINT * found = malloc(sizeof(UINT) * count);
+		UINT * expected = malloc(sizeof(UINT) * count);
+		UINT * moved = malloc(sizeof(UINT) * moved_count);
+		BYTE * marks = malloc(count);
+		bvh_node_t * refit = NULL;
+		CHECK(boxes != NULL && found != NULL && expected != NULL && moved != NULL && marks != NULL, "allocation\n");
+
+		/* clumps of small props around larger pieces, so the boxes aren't uniform */
+		for (UINT i = 0; i < count; ++i) {
+			float * b = &boxes[i * 6];
+			float size = i % 16 == 0 ? bench_randf(2, 6) : bench_randf(0.25f, 1.5f);
+			for (int k = 0; k < 3; ++k) {
+				float center = i % 16 == 0 ? bench_randf(0, side) : boxes[(i & ~15u) * 6 + k] + bench_randf(-6, 6);
+				b[k] = center - size * 0.5f;
+				b[3 + k] = center + size * 0.5f;
+			}
+		}
+
+		bvh_t bvh;
+		LONGLONG start = timer_now();
+		CHECK(bvh_build(&bvh, boxes, count) == 0, "%u objects didn't build\n", count);
+		double build_ms = timer_ms(timer_now() - start);
+		if (bvh_bench_check(&bvh, boxes, count) != 0) {
+			return 1;
+		}
+		float built_cost = bvh_sah_cost(&bvh);
+
+		double scan_ms = 0;
+		UINT64 visible = 0;
+		for (UINT q = 0; q < QUERIES; ++q) {
+			mat4x4 mvp;
+			bvh_bench_view(mvp, side);
+			UINT found_count = bvh_frustum(&bvh, boxes, mvp, found);
+			start = timer_now();
+			UINT expected_count = bvh_brute_force(boxes, count, mvp, expected);
+			scan_ms += timer_ms(timer_now() - start);
+			if (bvh_bench_compare(found, found_count, expected, expected_count, marks, count) != 0) {
+				return 1;
+			}
+			visible += expected_count;
+		}
+		double query_ms = bvh.stats.ms;
+		bvh_report(&bvh, "built", stdout);
+
+		/* a tenth of the objects drift each frame, refit in place and checked against a full refit */
+		double update_ms = 0;
+		double refit_ms = 0;
+		refit = malloc(sizeof(bvh_node_t) * bvh.node_count);
+		CHECK(refit != NULL, "allocation\n");
+		for (UINT frame = 0; frame < FRAMES; ++frame) {
+			for (UINT i = 0; i < moved_count; ++i) {
+				UINT item = bench_rand() % count;
+				float * b = &boxes[item * 6];
+				for (int k = 0; k < 3; ++k) {
+					float step = bench_randf(-1.5f, 1.5f);
+					b[k] += step;
+					b[3 + k] += step;
+				}
+				moved[i] = item;
+			}
+
+			memcpy(refit, bvh.nodes, sizeof(bvh_node_t) * bvh.node_count);
+			start = timer_now();
+			bvh_update(&bvh, boxes, moved, moved_count);
+			update_ms += timer_ms(timer_now() - start);
+
+			bvh_node_t * updated = bvh.nodes;
+			bvh.nodes = refit;
+			start = timer_now();
+			bvh_refit(&bvh, boxes);
+			refit_ms += timer_ms(timer_now() - start);
+			bvh.nodes = updated;
+			CHECK(memcmp(refit, updated, sizeof(bvh_node_t) * bvh.node_count) == 0, "frame %u: the incremental refit differs from a full one\n", frame);
+		}
+		if (bvh_bench_check(&bvh, boxes, count) != 0) {
+			return 1;
+		}
+
+		bvh.stats = (bvh_stats_t) { 0 };
+		for (UINT q = 0; q < QUERIES; ++q) {
+			mat4x4 mvp;
+			bvh_bench_view(mvp, side);
+			UINT found_count = bvh_frustum(&bvh, boxes, mvp, found);
+			UINT expected_count = bvh_brute_force(boxes, count, mvp, expected);
+			if (bvh_bench_compare(found, found_count, expected, expected_count, marks, count) != 0) {
+				return 1;
+			}
+		}
+		bvh_report(&bvh, "refit", stdout);
+		float refit_cost = bvh_sah_cost(&bvh);
+
+		bvh_t rebuilt;
+		CHECK(bvh_build(&rebuilt, boxes, count) == 0, "%u objects didn't rebuild\n", count);
+		float rebuilt_cost = bvh_sah_cost(&rebuilt);
+		bvh_destroy(&rebuilt);
+
+		printf("bvh: %u objects, build %.2f ms, %u%% moved: update %.3f ms, full refit %.3f ms, SAH cost %.3g built, %.3g refit, %.3g rebuilt; %.1f visible, query %.4f ms vs %.4f ms scan (%.1fx)\n", count, build_ms, MOVED_PERCENT, update_ms / FRAMES, refit_ms / FRAMES, built_cost, refit_cost, rebuilt_cost, (double) visible / QUERIES, query_ms / QUERIES, scan_ms / QUERIES, scan_ms / query_ms);
+		CHECK(count < 100000 || query_ms * 2 < scan_ms, "querying %u objects took %.4f ms against %.4f ms for the scan\n", count, query_ms / QUERIES, scan_ms / QUERIES);
+		CHECK(built_cost < 0.5f, "SAH cost %.3g of a scan\n", built_cost);
+
+		bvh_destroy(&bvh);
+		free(boxes);
+		free(found);
+		free(expected);
+		free(moved);
+		free(marks);
+		free(refit);
+	}
+	return 0;
+}
+
+struct {
+	const char * name;
+	int (* fn)(void);
+} static benches[] = {
+	{ "taskgraph", bench_taskgraph },
+	{ "release", bench_release },
+	{ "gpumem", bench_gpumem },
+	{ "vshade", bench_vshade },
+	{ "precull", bench_precull },
+	{ "overdraw", bench_overdraw },
+	{ "scene", bench_scene },
+	{ "skin", bench_skin },
+	{ "xform", bench_xform },
+	{ "bundle", bench_bundle },
+	{ "sched", bench_sched },
+	{ "particles", bench_particles },
+	{ "arena", bench_arena },
+	{ "drawqueue", bench_drawqueue },
+	{ "psocache", bench_psocache },
+	{ "trace", bench_trace },
+	{ "present", bench_present },
+	{ "viewports", bench_viewports },
+	{ "stream", bench_stream },
+	{ "bc", bench_bc },
+	{ "lod", bench_lod },
+	{ "meshlets", bench_meshlets },
+	{ "occlusion", bench_occlusion },
+	{ "bvh", bench_bvh },
+};
+
+int main(int argc, char ** argv) {
+	int failed = 0;
+
+	if (jobs_init(0) != 0) {
+		fprintf(stderr, "Failed to start worker threads\n");
+		return 1;
+	}
+
+	for (UINT i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+		BOOL run = argc <= 1;
+		for (int a = 1; a < argc; ++a) {
+			if (strcmp(argv[a], benches[i].name) == 0) {
+				run = TRUE;
+			}
+		}
+
+		if (run && benches[i].fn() != 0) {
+			fprintf(stderr, "%s failed\n", benches[i].name);
+			failed = 1;
+		}
+	}
+
+	jobs_shutdown();
+	return failed;
+}
@@ -0,0 +1,103 @@
+/*
+ * self-checks for adapter ranking against made-up adapter descriptions. adapter.h only
+ * needs the C library, so unlike bench.c this builds and runs anywhere:
+ *
+ *   cc bench_adapter.c -o bench_adapter && ./bench_adapter
+ *
+ * a non-zero exit means a check failed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "adapter.h"
+
+/* the message is the first of the variadic arguments, so checks without values stay standard C */
+#define CHECK(cond, ...) { if (!(cond)) { fprintf(stderr, "check failed: " __VA_ARGS__); return 1; } }
+
+#define MIB (1024ull * 1024)
+
+static adapter_info_t bench_adapter(char const * name, uint32_t vendor, uint32_t device, uint64_t dedicated_mib, int software, uint32_t feature_level, uint32_t preference) {
+	adapter_info_t info;
+	memset(&info, 0, sizeof(info));
+	snprintf(info.name, sizeof(info.name), "%s", name);
+	info.vendor = vendor;
+	info.device = device;
+	info.dedicated_video_memory = dedicated_mib * MIB;
+	info.shared_system_memory = 8192 * MIB;
+	info.software = software;
+	info.feature_level = feature_level;
+	info.preference = preference;
+	return info;
+}
+
+static int bench_adapter_ranking(void) {
+	adapter_prefs_t prefs = {
+		.min_feature_level = ADAPTER_FEATURE_LEVEL_11_0,
+		.allow_software = 0,
+	};
+	uint32_t order[ADAPTER_MAX];
+
+	/* a laptop: the OS's preference order puts the discrete GPU first */
+	adapter_info_t laptop[] = {
+		bench_adapter("integrated", 0x8086, 0x9a49, 128, 0, ADAPTER_FEATURE_LEVEL_12_1, 1),
+		bench_adapter("discrete", 0x10de, 0x2520, 6144, 0, ADAPTER_FEATURE_LEVEL_12_1, 0),
+		bench_adapter("Microsoft Basic Render Driver", 0x1414, 0x8c, 0, 1, ADAPTER_FEATURE_LEVEL_12_1, 2),
+	};
+	CHECK(adapter_rank(laptop, 3, &prefs, order) == 2 && order[0] == 1 && order[1] == 0, "laptop ranked %u, %u\n", order[0], order[1]);
+
+	/* asked for minimum power the OS reverses the order, the ranking follows it */
+	laptop[0].preference = 0;
+	laptop[1].preference = 1;
+	CHECK(adapter_pick(laptop, 3, &prefs) == 0, "minimum power preference ignored\n");
+
+	/* no preference order from the OS: feature level first, then dedicated memory, then enumeration order */
+	adapter_info_t desktop[] = {
+		bench_adapter("old", 0x1002, 0x6798, 3072, 0, ADAPTER_FEATURE_LEVEL_11_1, ADAPTER_NO_PREFERENCE),
+		bench_adapter("small", 0x10de, 0x1f82, 4096, 0, ADAPTER_FEATURE_LEVEL_12_1, ADAPTER_NO_PREFERENCE),
+		bench_adapter("big", 0x10de, 0x2204, 24576, 0, ADAPTER_FEATURE_LEVEL_12_1, ADAPTER_NO_PREFERENCE),
+		bench_adapter("big twin", 0x10de, 0x2204, 24576, 0, ADAPTER_FEATURE_LEVEL_12_1, ADAPTER_NO_PREFERENCE),
+		bench_adapter("no d3d12", 0x1002, 0x9874, 1024, 0, 0, ADAPTER_NO_PREFERENCE),
+	};
+	CHECK(adapter_rank(desktop, 5, &prefs, order) == 4 && order[0] == 2 && order[1] == 3 && order[2] == 1 && order[3] == 0, "desktop ranked %u, %u, %u, %u\n", order[0], order[1], order[2], order[3]);
+
+	/* a higher minimum feature level drops the old card */
+	prefs.min_feature_level = ADAPTER_FEATURE_LEVEL_12_0;
+	CHECK(adapter_rank(desktop, 5, &prefs, order) == 3, "feature level minimum ignored\n");
+	prefs.min_feature_level = ADAPTER_FEATURE_LEVEL_11_0;
+
+	/* a VM with only the basic render driver: nothing fits, the caller goes to WARP */
+	adapter_info_t vm[] = {
+		bench_adapter("Microsoft Basic Render Driver", 0x1414, 0x8c, 0, 0, ADAPTER_FEATURE_LEVEL_12_1, 0),
+	};
+	CHECK(adapter_pick(vm, 1, &prefs) == ADAPTER_NONE, "basic render driver picked as hardware\n");
+	CHECK(adapter_pick(NULL, 0, &prefs) == ADAPTER_NONE, "picked from no adapters\n");
+
+	/* allowed in, software still ranks behind any hardware adapter that fits */
+	prefs.allow_software = 1;
+	CHECK(adapter_pick(vm, 1, &prefs) == 0, "software adapter not picked when allowed\n");
+	laptop[2].preference = 0;
+	laptop[1].preference = 2;
+	CHECK(adapter_rank(laptop, 3, &prefs, order) == 3 && order[2] == 2, "software ranked ahead of hardware\n");
+
+	/* more adapters than order holds: the ones past ADAPTER_MAX are left out, nothing written past the end */
+	adapter_info_t many[ADAPTER_MAX + 4];
+	uint32_t guarded[ADAPTER_MAX + 4];
+	for (uint32_t i = 0; i < ADAPTER_MAX + 4; ++i) {
+		many[i] = bench_adapter("many", 0x10de, 0x2204, 1024 * (i + 1), 0, ADAPTER_FEATURE_LEVEL_12_1, ADAPTER_NO_PREFERENCE);
+		guarded[i] = ADAPTER_NONE;
+	}
+	CHECK(adapter_rank(many, ADAPTER_MAX + 4, &prefs, guarded) == ADAPTER_MAX && guarded[0] == ADAPTER_MAX - 1 && guarded[ADAPTER_MAX] == ADAPTER_NONE, "ranked past ADAPTER_MAX\n");
+	CHECK(adapter_pick(many, ADAPTER_MAX + 4, &prefs) == ADAPTER_MAX - 1, "picked past ADAPTER_MAX\n");
+
+	adapter_log(laptop, 3, &prefs, order[0], stdout);
+	return 0;
+}
+
+int main(void) {
+	if (bench_adapter_ranking() != 0) {
+		fprintf(stderr, "adapter failed\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,160 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "timer.h"
+
+/*
+ * cache of recorded bundles keyed by what they reference. the key is a flat blob of
+ * everything the recording depends on (pipeline and root signature pointers, buffer
+ * views, the draw arguments or a version of them) and bundle_execute replays the bundle
+ * recorded under an identical key, recording a new one on a miss. a changed PSO, a
+ * re-placed buffer or a new draw list changes the key and so records again; stale
+ * entries age out through LRU eviction. keys are hashed and compared every call, so
+ * long draw lists should be keyed by a version rather than by value.
+ *
+ * the backend does the API work, which keeps this usable without a device.
+ */
+
+#define BUNDLE_MAX 16
+
+typedef struct bundle_backend {
+	/* records the sequence described by data into a new bundle, NULL on failure */
+	void * (* record)(void * user, void const * data);
+	void (* execute)(void * user, void * bundle);
+	/* the bundle may still be in flight, defer the release to the current fence */
+	void (* release)(void * user, void * bundle);
+	void * user;
+} bundle_backend_t;
+
+typedef struct bundle_entry {
+	UINT64 hash;
+	void * key;
+	SIZE_T size;
+	void * bundle;
+	UINT64 last_used;
+} bundle_entry_t;
+
+typedef struct bundle_stats {
+	UINT64 hits;
+	UINT64 recorded;
+	UINT64 evicted;
+	UINT64 failed;
+	double record_ms;
+} bundle_stats_t;
+
+typedef struct bundle_cache {
+	bundle_backend_t backend;
+	bundle_entry_t entries[BUNDLE_MAX];
+	UINT count;
+	UINT64 uses;
+	bundle_stats_t stats;
+} bundle_cache_t;
+
+/* FNV-1a */
+static UINT64 bundle_hash(void const * data, SIZE_T size) {
+	BYTE const * bytes = data;
+	UINT64 hash = 0xCBF29CE484222325ull;
+
+	for (SIZE_T i = 0; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+static void bundle_cache_init(bundle_cache_t * cache, bundle_backend_t backend) {
+	*cache = (bundle_cache_t) {
+		.backend = backend,
+	};
+}
+
+static void bundle_evict(bundle_cache_t * cache, UINT index) {
+	bundle_entry_t * entry = &cache->entries[index];
+
+	cache->backend.release(cache->backend.user, entry->bundle);
+	free(entry->key);
+
+	cache->entries[index] = cache->entries[--cache->count];
+	++cache->stats.evicted;
+}
+
+/* drops every bundle, for changes the blobs cannot see such as a device reset */
+static void bundle_invalidate(bundle_cache_t * cache) {
+	while (cache->count > 0) {
+		bundle_evict(cache, cache->count - 1);
+	}
+}
+
+static void bundle_cache_destroy(bundle_cache_t * cache) {
+	bundle_invalidate(cache);
+}
+
+/*
+ * replays the bundle cached under key, recording one from data first if no key matches
+ * byte for byte. key should be fully initialized, padding included, since it is
+ * compared raw; data is only read on a miss. returns 1 if recording failed, in which
+ * case nothing was executed.
+ */
+static int bundle_execute(bundle_cache_t * cache, void const * key, SIZE_T size, void const * data) {
+	UINT64 hash = bundle_hash(key, size);
+	++cache->uses;
+
+	for (UINT i = 0; i < cache->count; ++i) {
+		bundle_entry_t * entry = &cache->entries[i];
+		if (entry->hash == hash && entry->size == size && memcmp(entry->key, key, size) == 0) {
+			entry->last_used = cache->uses;
+			++cache->stats.hits;
+			cache->backend.execute(cache->backend.user, entry->bundle);
+			return 0;
+		}
+	}
+
+	if (cache->count == BUNDLE_MAX) {
+		UINT oldest = 0;
+		for (UINT i = 1; i < cache->count; ++i) {
+			if (cache->entries[i].last_used < cache->entries[oldest].last_used) {
+				oldest = i;
+			}
+		}
+		bundle_evict(cache, oldest);
+	}
+
+	void * copy = malloc(size);
+	if (copy == NULL) {
+		++cache->stats.failed;
+		return 1;
+	}
+	memcpy(copy, key, size);
+
+	LONGLONG start = timer_now();
+	void * bundle = cache->backend.record(cache->backend.user, data);
+	cache->stats.record_ms += timer_ms(timer_now() - start);
+
+	if (bundle == NULL) {
+		free(copy);
+		++cache->stats.failed;
+		return 1;
+	}
+
+	cache->entries[cache->count++] = (bundle_entry_t) {
+		.hash = hash,
+		.key = copy,
+		.size = size,
+		.bundle = bundle,
+		.last_used = cache->uses,
+	};
+	++cache->stats.recorded;
+
+	cache->backend.execute(cache->backend.user, bundle);
+	return 0;
+}
+
+static void bundle_report(bundle_cache_t const * cache, FILE * fp) {
+	fprintf(fp, "bundle: %llu replays, %llu recorded (%.3f ms), %llu evicted, %llu failed, %u cached\n", (unsigned long long) cache->stats.hits, (unsigned long long) cache->stats.recorded, cache->stats.record_ms, (unsigned long long) cache->stats.evicted, (unsigned long long) cache->stats.failed, cache->count);
+}
+
+#endif
@@ -0,0 +1,685 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <immintrin.h>
+#include "linmath.h"
+#include "timer.h"
+#include "jobs.h"
+
+/*
+ * a bounding volume hierarchy over object boxes for frustum queries.
+ *
+ * boxes are six floats, min xyz then max xyz. the build is top-down with the surface
+ * area heuristic over up to BVH_BINS centroid bins along the widest axis, splitting
+ * until a leaf is cheaper than its best split. small nodes get one bin per object,
+ * most nodes are small and clearing sixteen bins for each would dominate the build. the binary tree is then collapsed into nodes of
+ * four children whose bounds are stored SoA, so one SSE pass tests all four against a
+ * plane. every subtree owns a contiguous run of object ids, which lets a subtree that
+ * is fully inside the frustum be copied out without visiting it.
+ *
+ * nodes come after their parents, so a full refit is one backwards pass. an update
+ * marks the slots above each moved object and that pass then only refits marked ones.
+ * refits keep the topology; bvh_sah_cost tells when a rebuild pays off.
+ *
+ * a box is outside when its corner farthest along a plane's normal is behind that
+ * plane, the same test the brute-force scan does on every box, so both return the
+ * same set.
+ */
+
+#define BVH_BINS 16
+#define BVH_MAX_LEAF 8
+/* cost of a traversal step relative to one box test */
+#define BVH_TRAVERSAL_COST 1.0f
+/* nodes with at least this many objects bin them on the job pool */
+#define BVH_PARALLEL_BINNING 65536
+#define BVH_BIN_CHUNK 16384
+#define BVH_STACK 256
+#define BVH_LEAF 0x80000000u
+#define BVH_NONE 0xFFFFFFFFu
+
+typedef struct bvh_node {
+	/* min x y z, max x y z of each child */
+	float bounds[6][4];
+	/* a node index, or BVH_LEAF for children that hold objects directly */
+	UINT child[4];
+	/* the child's run of bvh_t.items */
+	UINT first[4];
+	UINT count[4];
+	/* parent node * 4 + slot, BVH_NONE for the root */
+	UINT parent;
+	UINT child_count;
+} bvh_node_t;
+
+typedef struct bvh_stats {
+	UINT64 queries;
+	UINT64 nodes;
+	UINT64 tested;
+	UINT64 accepted;
+	UINT64 visible;
+	double ms;
+} bvh_stats_t;
+
+typedef struct bvh {
+	bvh_node_t * nodes;
+	UINT node_count;
+	/* object ids in leaf order */
+	UINT * items;
+	UINT item_count;
+	/* node * 4 + slot of each object's leaf */
+	UINT * leaf_of;
+	/* a bit per slot that an update has to refit */
+	BYTE * dirty;
+
+	bvh_stats_t stats;
+} bvh_t;
+
+typedef struct bvh_build_node {
+	float bounds[6];
+	UINT left;
+	UINT right;
+	UINT first;
+	UINT count;
+} bvh_build_node_t;
+
+/* an object as the build sees it, moved with the partition so binning reads memory in order */
+typedef struct bvh_ref {
+	float bounds[6];
+	float center[3];
+	UINT item;
+} bvh_ref_t;
+
+typedef struct bvh_bin {
+	float bounds[6];
+	/* the box around the centroids, which bounds the next split */
+	float centers[6];
+	UINT count;
+} bvh_bin_t;
+
+typedef struct bvh_builder {
+	bvh_ref_t * refs;
+	bvh_build_node_t * nodes;
+	UINT node_count;
+	UINT inner_count;
+	bvh_bin_t * chunk_bins;
+} bvh_builder_t;
+
+typedef struct bvh_binning {
+	bvh_builder_t const * builder;
+	UINT first;
+	UINT count;
+	UINT bins;
+	int axis;
+	float min;
+	float scale;
+} bvh_binning_t;
+
+static void bvh_destroy(bvh_t * bvh) {
+	free(bvh->nodes);
+	free(bvh->items);
+	free(bvh->leaf_of);
+	free(bvh->dirty);
+	memset(bvh, 0, sizeof(*bvh));
+}
+
+static void bvh_box_empty(float * box) {
+	box[0] = box[1] = box[2] = FLT_MAX;
+	box[3] = box[4] = box[5] = -FLT_MAX;
+}
+
+static void bvh_box_grow(float * box, float const * other) {
+	for (int k = 0; k < 3; ++k) {
+		box[k] = other[k] < box[k] ? other[k] : box[k];
+		box[3 + k] = other[3 + k] > box[3 + k] ? other[3 + k] : box[3 + k];
+	}
+}
+
+static void bvh_box_grow_point(float * box, float const * point) {
+	for (int k = 0; k < 3; ++k) {
+		box[k] = point[k] < box[k] ? point[k] : box[k];
+		box[3 + k] = point[k] > box[3 + k] ? point[k] : box[3 + k];
+	}
+}
+
+/* half the surface area, all the heuristic needs */
+static float bvh_box_area(float const * box) {
+	float dx = box[3] - box[0];
+	float dy = box[4] - box[1];
+	float dz = box[5] - box[2];
+	if (dx < 0 || dy < 0 || dz < 0) {
+		return 0;
+	}
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static void bvh_range_bounds(bvh_builder_t const * b, UINT first, UINT count, float * bounds, float * centers) {
+	bvh_box_empty(bounds);
+	bvh_box_empty(centers);
+	for (UINT i = first; i < first + count; ++i) {
+		bvh_box_grow(bounds, b->refs[i].bounds);
+		bvh_box_grow_point(centers, b->refs[i].center);
+	}
+}
+
+static UINT bvh_bin_index(bvh_binning_t const * binning, bvh_ref_t const * ref) {
+	float offset = (ref->center[binning->axis] - binning->min) * binning->scale;
+	UINT bin = offset > 0 ? (UINT) offset : 0;
+	return bin < binning->bins ? bin : binning->bins - 1;
+}
+
+static void bvh_bin_items(bvh_binning_t const * binning, UINT begin, UINT end, bvh_bin_t * bins) {
+	bvh_builder_t const * b = binning->builder;
+	for (UINT i = 0; i < binning->bins; ++i) {
+		bvh_box_empty(bins[i].bounds);
+		bvh_box_empty(bins[i].centers);
+		bins[i].count = 0;
+	}
+	for (UINT i = begin; i < end; ++i) {
+		bvh_ref_t const * ref = &b->refs[i];
+		bvh_bin_t * bin = &bins[bvh_bin_index(binning, ref)];
+		bvh_box_grow(bin->bounds, ref->bounds);
+		bvh_box_grow_point(bin->centers, ref->center);
+		++bin->count;
+	}
+}
+
+static void bvh_bin_range(void * user, UINT begin, UINT end) {
+	bvh_binning_t const * binning = user;
+	for (UINT chunk = begin; chunk < end; ++chunk) {
+		UINT first = binning->first + chunk * BVH_BIN_CHUNK;
+		UINT last = binning->first + binning->count;
+		last = first + BVH_BIN_CHUNK < last ? first + BVH_BIN_CHUNK : last;
+		bvh_bin_items(binning, first, last, &binning->builder->chunk_bins[chunk * BVH_BINS]);
+	}
+}
+
+/* bounds and centers cover the range, binning carries both down so each node reads its objects once */
+static UINT bvh_build_range(bvh_builder_t * b, UINT first, UINT count, float const * bounds, float const * centers) {
+	UINT index = b->node_count++;
+	bvh_build_node_t * node = &b->nodes[index];
+	node->first = first;
+	node->count = count;
+	node->left = node->right = BVH_NONE;
+	memcpy(node->bounds, bounds, sizeof(node->bounds));
+
+	if (count <= 1) {
+		return index;
+	}
+
+	int axis = 0;
+	for (int k = 1; k < 3; ++k) {
+		if (centers[3 + k] - centers[k] > centers[3 + axis] - centers[axis]) {
+			axis = k;
+		}
+	}
+	float extent = centers[3 + axis] - centers[axis];
+
+	float child_bounds[2][6];
+	float child_centers[2][6];
+	UINT split;
+	if (extent > 0) {
+		bvh_binning_t binning = {
+			.builder = b,
+			.first = first,
+			.count = count,
+			.bins = count < BVH_BINS ? count : BVH_BINS,
+			.axis = axis,
+			.min = centers[axis],
+		};
+		binning.scale = binning.bins / extent;
+
+		bvh_bin_t bins[BVH_BINS];
+		if (count >= BVH_PARALLEL_BINNING && b->chunk_bins != NULL) {
+			UINT chunks = (count + BVH_BIN_CHUNK - 1) / BVH_BIN_CHUNK;
+			jobs_parallel_for(chunks, 1, bvh_bin_range, &binning);
+
+			memcpy(bins, b->chunk_bins, sizeof(bins));
+			for (UINT chunk = 1; chunk < chunks; ++chunk) {
+				for (UINT i = 0; i < binning.bins; ++i) {
+					bvh_bin_t const * bin = &b->chunk_bins[chunk * BVH_BINS + i];
+					bvh_box_grow(bins[i].bounds, bin->bounds);
+					bvh_box_grow(bins[i].centers, bin->centers);
+					bins[i].count += bin->count;
+				}
+			}
+		} else {
+			bvh_bin_items(&binning, first, first + count, bins);
+		}
+
+		/* sweep from the right, then score every plane between bins from the left */
+		float right_area[BVH_BINS];
+		UINT right_count[BVH_BINS];
+		float box[6];
+		bvh_box_empty(box);
+		UINT n = 0;
+		for (UINT i = binning.bins - 1; i > 0; --i) {
+			bvh_box_grow(box, bins[i].bounds);
+			n += bins[i].count;
+			right_area[i] = bvh_box_area(box);
+			right_count[i] = n;
+		}
+
+		float best_cost = FLT_MAX;
+		UINT best = 0;
+		bvh_box_empty(box);
+		n = 0;
+		for (UINT i = 0; i < binning.bins - 1; ++i) {
+			bvh_box_grow(box, bins[i].bounds);
+			n += bins[i].count;
+			if (n == 0 || right_count[i + 1] == 0) {
+				continue;
+			}
+			float cost = bvh_box_area(box) * n + right_area[i + 1] * right_count[i + 1];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best = i + 1;
+			}
+		}
+
+		/* the lowest and highest centroid land in the first and last bin, so some plane always splits */
+		float area = bvh_box_area(bounds);
+		float split_cost = BVH_TRAVERSAL_COST + (area > 0 ? best_cost / area : (float) count);
+		if (count <= BVH_MAX_LEAF && (float) count <= split_cost) {
+			return index;
+		}
+
+		for (int side = 0; side < 2; ++side) {
+			bvh_box_empty(child_bounds[side]);
+			bvh_box_empty(child_centers[side]);
+		}
+		for (UINT i = 0; i < binning.bins; ++i) {
+			bvh_box_grow(child_bounds[i >= best], bins[i].bounds);
+			bvh_box_grow(child_centers[i >= best], bins[i].centers);
+		}
+
+		bvh_ref_t * refs = b->refs;
+		UINT lo = first;
+		UINT hi = first + count;
+		while (lo < hi) {
+			if (bvh_bin_index(&binning, &refs[lo]) < best) {
+				++lo;
+			} else {
+				bvh_ref_t t = refs[lo];
+				refs[lo] = refs[--hi];
+				refs[hi] = t;
+			}
+		}
+		split = lo;
+	} else if (count <= BVH_MAX_LEAF) {
+		/* all centroids in one point, splitting can't separate anything */
+		return index;
+	} else {
+		split = first + count / 2;
+		bvh_range_bounds(b, first, split - first, child_bounds[0], child_centers[0]);
+		bvh_range_bounds(b, split, first + count - split, child_bounds[1], child_centers[1]);
+	}
+
+	++b->inner_count;
+	UINT left = bvh_build_range(b, first, split - first, child_bounds[0], child_centers[0]);
+	UINT right = bvh_build_range(b, split, first + count - split, child_bounds[1], child_centers[1]);
+	b->nodes[index].left = left;
+	b->nodes[index].right = right;
+	return index;
+}
+
+static void bvh_set_child(bvh_t * bvh, bvh_builder_t const * b, UINT node, UINT slot, UINT source);
+
+/* takes the binary node's grandchildren until four children are collected, widest first */
+static UINT bvh_collapse(bvh_t * bvh, bvh_builder_t const * b, UINT source, UINT parent) {
+	UINT index = bvh->node_count++;
+	UINT children[4];
+	UINT count = 0;
+
+	bvh_build_node_t const * root = &b->nodes[source];
+	if (root->left == BVH_NONE) {
+		children[count++] = source;
+	} else {
+		children[count++] = root->left;
+		children[count++] = root->right;
+	}
+
+	while (count < 4) {
+		UINT widest = BVH_NONE;
+		float widest_area = -1;
+		for (UINT i = 0; i < count; ++i) {
+			bvh_build_node_t const * c = &b->nodes[children[i]];
+			float area = bvh_box_area(c->bounds);
+			if (c->left != BVH_NONE && area > widest_area) {
+				widest = i;
+				widest_area = area;
+			}
+		}
+		if (widest == BVH_NONE) {
+			break;
+		}
+
+		bvh_build_node_t const * c = &b->nodes[children[widest]];
+		children[widest] = c->left;
+		children[count++] = c->right;
+	}
+
+	/* back in object order, so the slots tile the node's run left to right */
+	for (UINT i = 1; i < count; ++i) {
+		for (UINT j = i; j > 0 && b->nodes[children[j]].first < b->nodes[children[j - 1]].first; --j) {
+			UINT t = children[j];
+			children[j] = children[j - 1];
+			children[j - 1] = t;
+		}
+	}
+
+	bvh_node_t * node = &bvh->nodes[index];
+	memset(node, 0, sizeof(*node));
+	node->parent = parent;
+	node->child_count = count;
+	for (UINT slot = 0; slot < 4; ++slot) {
+		node->bounds[0][slot] = node->bounds[1][slot] = node->bounds[2][slot] = FLT_MAX;
+		node->bounds[3][slot] = node->bounds[4][slot] = node->bounds[5][slot] = -FLT_MAX;
+	}
+	for (UINT slot = 0; slot < count; ++slot) {
+		bvh_set_child(bvh, b, index, slot, children[slot]);
+	}
+	return index;
+}
+
+static void bvh_set_child(bvh_t * bvh, bvh_builder_t const * b, UINT node, UINT slot, UINT source) {
+	bvh_build_node_t const * c = &b->nodes[source];
+	for (int k = 0; k < 6; ++k) {
+		bvh->nodes[node].bounds[k][slot] = c->bounds[k];
+	}
+	bvh->nodes[node].first[slot] = c->first;
+	bvh->nodes[node].count[slot] = c->count;
+
+	if (c->left == BVH_NONE) {
+		bvh->nodes[node].child[slot] = BVH_LEAF;
+		for (UINT i = c->first; i < c->first + c->count; ++i) {
+			bvh->leaf_of[bvh->items[i]] = node * 4 + slot;
+		}
+	} else {
+		UINT child = bvh_collapse(bvh, b, source, node * 4 + slot);
+		bvh->nodes[node].child[slot] = child;
+	}
+}
+
+/* builds over count boxes of six floats each, returns 0 on success */
+static int bvh_build(bvh_t * bvh, float const * boxes, UINT count) {
+	memset(bvh, 0, sizeof(*bvh));
+	if (count == 0) {
+		return 1;
+	}
+
+	bvh_builder_t b = {
+		.refs = malloc(sizeof(bvh_ref_t) * count),
+		.nodes = malloc(sizeof(bvh_build_node_t) * 2 * count),
+		.chunk_bins = count >= BVH_PARALLEL_BINNING ? malloc(sizeof(bvh_bin_t) * BVH_BINS * ((count + BVH_BIN_CHUNK - 1) / BVH_BIN_CHUNK)) : NULL,
+	};
+	bvh->items = malloc(sizeof(UINT) * count);
+	bvh->leaf_of = malloc(sizeof(UINT) * count);
+
+	int result = 1;
+	if (b.refs == NULL || b.nodes == NULL || bvh->items == NULL || bvh->leaf_of == NULL) {
+		goto done;
+	}
+
+	for (UINT i = 0; i < count; ++i) {
+		bvh_ref_t * ref = &b.refs[i];
+		memcpy(ref->bounds, &boxes[i * 6], sizeof(ref->bounds));
+		for (int k = 0; k < 3; ++k) {
+			ref->center[k] = (ref->bounds[k] + ref->bounds[3 + k]) * 0.5f;
+		}
+		ref->item = i;
+	}
+	float bounds[6];
+	float centers[6];
+	bvh_range_bounds(&b, 0, count, bounds, centers);
+	bvh_build_range(&b, 0, count, bounds, centers);
+
+	/* every four-wide node replaces at least one binary inner node, plus a root over a leaf */
+	bvh->nodes = malloc(sizeof(bvh_node_t) * (b.inner_count + 1));
+	bvh->dirty = calloc(b.inner_count + 1, 1);
+	if (bvh->nodes == NULL || bvh->dirty == NULL) {
+		goto done;
+	}
+	for (UINT i = 0; i < count; ++i) {
+		bvh->items[i] = b.refs[i].item;
+	}
+	bvh->item_count = count;
+	bvh_collapse(bvh, &b, 0, BVH_NONE);
+	result = 0;
+
+done:
+	free(b.refs);
+	free(b.nodes);
+	free(b.chunk_bins);
+	if (result != 0) {
+		bvh_destroy(bvh);
+	}
+	return result;
+}
+
+static void bvh_refit_slot(bvh_t * bvh, float const * boxes, UINT node, UINT slot) {
+	bvh_node_t * n = &bvh->nodes[node];
+	float box[6];
+	bvh_box_empty(box);
+
+	if (n->child[slot] == BVH_LEAF) {
+		for (UINT i = n->first[slot]; i < n->first[slot] + n->count[slot]; ++i) {
+			bvh_box_grow(box, &boxes[bvh->items[i] * 6]);
+		}
+	} else {
+		bvh_node_t const * c = &bvh->nodes[n->child[slot]];
+		__m128 lo[3];
+		__m128 hi[3];
+		for (int k = 0; k < 3; ++k) {
+			lo[k] = _mm_loadu_ps(c->bounds[k]);
+			hi[k] = _mm_loadu_ps(c->bounds[3 + k]);
+			lo[k] = _mm_min_ps(lo[k], _mm_shuffle_ps(lo[k], lo[k], _MM_SHUFFLE(1, 0, 3, 2)));
+			hi[k] = _mm_max_ps(hi[k], _mm_shuffle_ps(hi[k], hi[k], _MM_SHUFFLE(1, 0, 3, 2)));
+			box[k] = _mm_cvtss_f32(_mm_min_ss(lo[k], _mm_shuffle_ps(lo[k], lo[k], _MM_SHUFFLE(2, 3, 0, 1))));
+			box[3 + k] = _mm_cvtss_f32(_mm_max_ss(hi[k], _mm_shuffle_ps(hi[k], hi[k], _MM_SHUFFLE(2, 3, 0, 1))));
+		}
+	}
+
+	for (int k = 0; k < 6; ++k) {
+		n->bounds[k][slot] = box[k];
+	}
+}
+
+/* every bound from the current boxes; empty slots stay empty so unused lanes never pass */
+static void bvh_refit(bvh_t * bvh, float const * boxes) {
+	for (UINT node = bvh->node_count; node-- > 0;) {
+		for (UINT slot = 0; slot < bvh->nodes[node].child_count; ++slot) {
+			bvh_refit_slot(bvh, boxes, node, slot);
+		}
+	}
+}
+
+/* refits the leaves of the moved objects and their ancestors, boxes holds every object */
+static void bvh_update(bvh_t * bvh, float const * boxes, UINT const * moved, UINT count) {
+	UINT last = 0;
+	for (UINT i = 0; i < count; ++i) {
+		UINT at = bvh->leaf_of[moved[i]];
+		last = at / 4 > last ? at / 4 : last;
+		/* stops at the first slot another object already marked, everything above it is too */
+		while (at != BVH_NONE && (bvh->dirty[at / 4] >> at % 4 & 1) == 0) {
+			bvh->dirty[at / 4] |= 1 << at % 4;
+			at = bvh->nodes[at / 4].parent;
+		}
+	}
+
+	if (count == 0) {
+		return;
+	}
+	for (UINT node = last + 1; node-- > 0;) {
+		BYTE dirty = bvh->dirty[node];
+		if (dirty == 0) {
+			continue;
+		}
+		for (UINT slot = 0; slot < 4; ++slot) {
+			if (dirty >> slot & 1) {
+				bvh_refit_slot(bvh, boxes, node, slot);
+			}
+		}
+		bvh->dirty[node] = 0;
+	}
+}
+
+/* expected cost of a query relative to testing every box, lower is better */
+static float bvh_sah_cost(bvh_t const * bvh) {
+	float root[6];
+	bvh_box_empty(root);
+	bvh_node_t const * top = &bvh->nodes[0];
+	for (UINT slot = 0; slot < top->child_count; ++slot) {
+		float box[6] = { top->bounds[0][slot], top->bounds[1][slot], top->bounds[2][slot], top->bounds[3][slot], top->bounds[4][slot], top->bounds[5][slot] };
+		bvh_box_grow(root, box);
+	}
+
+	double cost = BVH_TRAVERSAL_COST;
+	for (UINT node = 0; node < bvh->node_count; ++node) {
+		bvh_node_t const * n = &bvh->nodes[node];
+		for (UINT slot = 0; slot < n->child_count; ++slot) {
+			float box[6] = { n->bounds[0][slot], n->bounds[1][slot], n->bounds[2][slot], n->bounds[3][slot], n->bounds[4][slot], n->bounds[5][slot] };
+			/* four children are tested together, each costs one box test plus a step if it is a node */
+			cost += bvh_box_area(box) * (n->child[slot] == BVH_LEAF ? (double) n->count[slot] : BVH_TRAVERSAL_COST);
+		}
+	}
+
+	float area = bvh_box_area(root);
+	return area > 0 ? (float) (cost / area / bvh->item_count) : 1;
+}
+
+/* the clip conditions -w <= x, y <= w and 0 <= z <= w as planes on the rows of the mvp, inside positive */
+static void bvh_planes_from_mvp(mat4x4 const mvp, float planes[6][4]) {
+	for (int k = 0; k < 4; ++k) {
+		planes[0][k] = mvp[k][3] + mvp[k][0];
+		planes[1][k] = mvp[k][3] - mvp[k][0];
+		planes[2][k] = mvp[k][3] + mvp[k][1];
+		planes[3][k] = mvp[k][3] - mvp[k][1];
+		planes[4][k] = mvp[k][2];
+		planes[5][k] = mvp[k][3] - mvp[k][2];
+	}
+}
+
+static BOOL bvh_box_visible(float const planes[6][4], float const * box) {
+	for (int p = 0; p < 6; ++p) {
+		float const * plane = planes[p];
+		float x = plane[0] > 0 ? box[3] : box[0];
+		float y = plane[1] > 0 ? box[4] : box[1];
+		float z = plane[2] > 0 ? box[5] : box[2];
+		if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/* the linear scan the hierarchy replaces, writes the visible ids in order and returns how many */
+static UINT bvh_brute_force(float const * boxes, UINT count, mat4x4 const mvp, UINT * out) {
+	float planes[6][4];
+	bvh_planes_from_mvp(mvp, planes);
+
+	UINT visible = 0;
+	for (UINT i = 0; i < count; ++i) {
+		if (bvh_box_visible(planes, &boxes[i * 6])) {
+			out[visible++] = i;
+		}
+	}
+	return visible;
+}
+
+/*
+ * writes the ids of the visible objects to out, which needs room for all of them, and
+ * returns how many there are. the order follows the leaves, not the ids.
+ */
+static UINT bvh_frustum(bvh_t * bvh, float const * boxes, mat4x4 const mvp, UINT * out) {
+	LONGLONG start = timer_now();
+	float planes[6][4];
+	bvh_planes_from_mvp(mvp, planes);
+
+	UINT64 nodes = 0;
+	UINT64 tested = 0;
+	UINT64 accepted = 0;
+	UINT visible = 0;
+
+	UINT stack[BVH_STACK];
+	UINT top = 0;
+	if (bvh->node_count > 0) {
+		stack[top++] = 0;
+	}
+
+	while (top > 0) {
+		bvh_node_t const * node = &bvh->nodes[stack[--top]];
+		++nodes;
+
+		/* the farthest corner behind a plane culls, the nearest one in front of all keeps everything */
+		__m128 outside = _mm_setzero_ps();
+		__m128 straddles = _mm_setzero_ps();
+		for (int p = 0; p < 6; ++p) {
+			float const * plane = planes[p];
+			__m128 far_d = _mm_mul_ps(_mm_set1_ps(plane[0]), _mm_loadu_ps(node->bounds[plane[0] > 0 ? 3 : 0]));
+			far_d = _mm_add_ps(far_d, _mm_mul_ps(_mm_set1_ps(plane[1]), _mm_loadu_ps(node->bounds[plane[1] > 0 ? 4 : 1])));
+			far_d = _mm_add_ps(far_d, _mm_mul_ps(_mm_set1_ps(plane[2]), _mm_loadu_ps(node->bounds[plane[2] > 0 ? 5 : 2])));
+			far_d = _mm_add_ps(far_d, _mm_set1_ps(plane[3]));
+			__m128 near_d = _mm_mul_ps(_mm_set1_ps(plane[0]), _mm_loadu_ps(node->bounds[plane[0] > 0 ? 0 : 3]));
+			near_d = _mm_add_ps(near_d, _mm_mul_ps(_mm_set1_ps(plane[1]), _mm_loadu_ps(node->bounds[plane[1] > 0 ? 1 : 4])));
+			near_d = _mm_add_ps(near_d, _mm_mul_ps(_mm_set1_ps(plane[2]), _mm_loadu_ps(node->bounds[plane[2] > 0 ? 2 : 5])));
+			near_d = _mm_add_ps(near_d, _mm_set1_ps(plane[3]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(far_d, _mm_setzero_ps()));
+			straddles = _mm_or_ps(straddles, _mm_cmplt_ps(near_d, _mm_setzero_ps()));
+		}
+		int out_mask = _mm_movemask_ps(outside);
+		int partial_mask = _mm_movemask_ps(straddles);
+
+		/* pushed in reverse so the children pop in order */
+		for (UINT slot = node->child_count; slot-- > 0;) {
+			if (out_mask >> slot & 1) {
+				continue;
+			}
+
+			if ((partial_mask >> slot & 1) == 0) {
+				memcpy(&out[visible], &bvh->items[node->first[slot]], sizeof(UINT) * node->count[slot]);
+				visible += node->count[slot];
+				accepted += node->count[slot];
+			} else if (node->child[slot] == BVH_LEAF) {
+				for (UINT i = node->first[slot]; i < node->first[slot] + node->count[slot]; ++i) {
+					UINT item = bvh->items[i];
+					if (bvh_box_visible(planes, &boxes[item * 6])) {
+						out[visible++] = item;
+					}
+				}
+				tested += node->count[slot];
+			} else if (top < BVH_STACK) {
+				stack[top++] = node->child[slot];
+			} else {
+				/* too deep to descend, the scan still finds everything */
+				for (UINT i = node->first[slot]; i < node->first[slot] + node->count[slot]; ++i) {
+					UINT item = bvh->items[i];
+					if (bvh_box_visible(planes, &boxes[item * 6])) {
+						out[visible++] = item;
+					}
+				}
+				tested += node->count[slot];
+			}
+		}
+	}
+
+	++bvh->stats.queries;
+	bvh->stats.nodes += nodes;
+	bvh->stats.tested += tested;
+	bvh->stats.accepted += accepted;
+	bvh->stats.visible += visible;
+	bvh->stats.ms += timer_ms(timer_now() - start);
+	return visible;
+}
+
+static void bvh_report(bvh_t const * bvh, char const * name, FILE * fp) {
+	bvh_stats_t const * s = &bvh->stats;
+	double queries = s->queries > 0 ? (double) s->queries : 1;
+	fprintf(fp, "bvh: %s, %u objects in %u nodes, SAH cost %.3g; per query %.1f nodes, %.1f boxes tested, %.1f accepted whole, %.1f visible, %.4f ms\n", name, bvh->item_count, bvh->node_count, bvh_sah_cost(bvh), s->nodes / queries, s->tested / queries, s->accepted / queries, s->visible / queries, s->ms / queries);
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef DRAWORDER_H
+#define DRAWORDER_H
+
+#include <windows.h>
+#include "linmath.h"
+
+/*
+ * submission order for opaque draws. sorting front to back by view depth lets the
+ * depth test reject hidden pixels before they are shaded; draw_key in drawqueue.h puts
+ * the depth into the low bits of a packet's sort key.
+ */
+
+/* clip-space w of a draw's bounding center, the view depth for perspective projections */
+static float draw_view_depth(mat4x4 mvp, vec3 center) {
+	return mvp[0][3] * center[0] + mvp[1][3] * center[1] + mvp[2][3] * center[2] + mvp[3][3];
+}
+
+#endif
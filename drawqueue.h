@@ -0,0 +1,291 @@
+#ifndef DRAWQUEUE_H
+#define DRAWQUEUE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "timer.h"
+
+/*
+ * draws go in as packets with a 64-bit sort key, are radix sorted once per frame and
+ * then translated into commands in key order. the key puts the layer first, then the
+ * pipeline, then the resource bindings and finally the depth:
+ *
+ *   63..60 layer   59..48 pipeline   47..32 bindings   31..0 depth
+ *
+ * so draws sharing a pipeline and bindings end up next to each other and the translator
+ * only emits a state change where consecutive packets differ. packets refer to pipelines,
+ * root signatures and buffers by index into the caller's tables; the backend maps the
+ * indices to API objects.
+ */
+
+#define DRAW_KEY_LAYER_SHIFT 60
+#define DRAW_KEY_PIPELINE_SHIFT 48
+#define DRAW_KEY_BINDINGS_SHIFT 32
+#define DRAW_KEY_LAYERS 16
+#define DRAW_KEY_PIPELINES 4096
+#define DRAW_KEY_BINDINGS 65536
+
+#define DRAW_NONE 0xFFFF
+/* below this a pass over every digit costs more than an insertion sort */
+#define DRAW_QUEUE_SMALL 64
+
+typedef struct draw_packet {
+	UINT64 key;
+	USHORT pipeline;
+	USHORT root_sig;
+	USHORT vbuffer;
+	USHORT ibuffer;
+	UINT first_index;
+	UINT index_count;
+	UINT instance_count;
+	INT base_vertex;
+} draw_packet_t;
+
+typedef struct draw_backend {
+	void (* set_pipeline)(void * user, UINT pipeline);
+	void (* set_root_sig)(void * user, UINT root_sig);
+	void (* set_vbuffer)(void * user, UINT vbuffer);
+	void (* set_ibuffer)(void * user, UINT ibuffer);
+	void (* draw)(void * user, draw_packet_t const * packet);
+	void * user;
+} draw_backend_t;
+
+typedef struct draw_queue_stats {
+	UINT64 packets;
+	UINT64 pipeline_changes;
+	UINT64 root_sig_changes;
+	UINT64 vbuffer_changes;
+	UINT64 ibuffer_changes;
+	/* state sets a translator that set everything per packet would have issued on top */
+	UINT64 avoided;
+	UINT64 sorts;
+	double sort_ms;
+	double translate_ms;
+} draw_queue_stats_t;
+
+typedef struct draw_queue {
+	draw_packet_t * packets;
+	UINT count;
+	UINT capacity;
+
+	/* keys and packet indices, sorted ping-pong; order points at the result */
+	UINT64 * keys[2];
+	UINT * indices[2];
+	UINT * order;
+
+	draw_queue_stats_t stats;
+} draw_queue_t;
+
+/* flips floats into unsigned integers that sort in the same order, negatives included */
+static UINT draw_key_depth(float depth) {
+	UINT bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+/* near to far for opaque layers; back_to_front inverts depth for blended ones */
+static UINT64 draw_key(UINT layer, UINT pipeline, UINT bindings, float depth, BOOL back_to_front) {
+	UINT d = draw_key_depth(depth);
+	if (back_to_front) {
+		d = ~d;
+	}
+
+	return ((UINT64) (layer & (DRAW_KEY_LAYERS - 1)) << DRAW_KEY_LAYER_SHIFT)
+		| ((UINT64) (pipeline & (DRAW_KEY_PIPELINES - 1)) << DRAW_KEY_PIPELINE_SHIFT)
+		| ((UINT64) (bindings & (DRAW_KEY_BINDINGS - 1)) << DRAW_KEY_BINDINGS_SHIFT)
+		| d;
+}
+
+static void draw_queue_init(draw_queue_t * q) {
+	memset(q, 0, sizeof(*q));
+}
+
+static void draw_queue_destroy(draw_queue_t * q) {
+	free(q->packets);
+	for (UINT i = 0; i < 2; ++i) {
+		free(q->keys[i]);
+		free(q->indices[i]);
+	}
+	memset(q, 0, sizeof(*q));
+}
+
+/* storage is kept, so a steady frame pushes without allocating */
+static void draw_queue_reset(draw_queue_t * q) {
+	q->count = 0;
+	q->order = NULL;
+}
+
+static int draw_queue_reserve(draw_queue_t * q, UINT capacity) {
+	if (capacity <= q->capacity) {
+		return 0;
+	}
+
+	draw_packet_t * packets = realloc(q->packets, sizeof(draw_packet_t) * capacity);
+	if (packets == NULL) {
+		return 1;
+	}
+	q->packets = packets;
+
+	/* sort scratch holds nothing between frames, no need to keep contents */
+	for (UINT i = 0; i < 2; ++i) {
+		free(q->keys[i]);
+		free(q->indices[i]);
+		q->keys[i] = malloc(sizeof(UINT64) * capacity);
+		q->indices[i] = malloc(sizeof(UINT) * capacity);
+		if (q->keys[i] == NULL || q->indices[i] == NULL) {
+			return 1;
+		}
+	}
+
+	q->capacity = capacity;
+	return 0;
+}
+
+static int draw_queue_push(draw_queue_t * q, draw_packet_t const * packet) {
+	if (q->count == q->capacity && draw_queue_reserve(q, q->capacity < 256 ? 256 : q->capacity * 2) != 0) {
+		return 1;
+	}
+
+	q->packets[q->count++] = *packet;
+	return 0;
+}
+
+/*
+ * stable LSD radix sort of the keys, 8 bits per pass. all eight histograms come from one
+ * read of the keys, and a pass whose digit is the same for every key is skipped, which
+ * drops most of the layer and pipeline passes in practice.
+ */
+static void draw_queue_sort(draw_queue_t * q) {
+	LONGLONG start = timer_now();
+	UINT count = q->count;
+	UINT64 * keys = q->keys[0];
+	UINT * indices = q->indices[0];
+
+	for (UINT i = 0; i < count; ++i) {
+		keys[i] = q->packets[i].key;
+		indices[i] = i;
+	}
+
+	if (count < DRAW_QUEUE_SMALL) {
+		for (UINT i = 1; i < count; ++i) {
+			UINT64 key = keys[i];
+			UINT index = indices[i];
+			UINT j = i;
+			while (j > 0 && keys[j - 1] > key) {
+				keys[j] = keys[j - 1];
+				indices[j] = indices[j - 1];
+				--j;
+			}
+			keys[j] = key;
+			indices[j] = index;
+		}
+	} else {
+		UINT histogram[8][256];
+		memset(histogram, 0, sizeof(histogram));
+		for (UINT i = 0; i < count; ++i) {
+			UINT64 key = keys[i];
+			for (UINT d = 0; d < 8; ++d) {
+				++histogram[d][(key >> (d * 8)) & 0xFF];
+			}
+		}
+
+		UINT src = 0;
+		for (UINT d = 0; d < 8; ++d) {
+			UINT * h = histogram[d];
+			if (h[(keys[0] >> (d * 8)) & 0xFF] == count) {
+				continue;
+			}
+
+			UINT offset = 0;
+			for (UINT b = 0; b < 256; ++b) {
+				UINT n = h[b];
+				h[b] = offset;
+				offset += n;
+			}
+
+			UINT64 const * in_keys = q->keys[src];
+			UINT const * in_indices = q->indices[src];
+			UINT64 * out_keys = q->keys[src ^ 1];
+			UINT * out_indices = q->indices[src ^ 1];
+			for (UINT i = 0; i < count; ++i) {
+				UINT slot = h[(in_keys[i] >> (d * 8)) & 0xFF]++;
+				out_keys[slot] = in_keys[i];
+				out_indices[slot] = in_indices[i];
+			}
+
+			src ^= 1;
+			keys = q->keys[src];
+		}
+		indices = q->indices[src];
+	}
+
+	q->order = indices;
+	++q->stats.sorts;
+	q->stats.sort_ms += timer_ms(timer_now() - start);
+}
+
+/*
+ * walks packets in order and calls the backend, skipping every set whose index matches
+ * what the previous packet left bound. order may be NULL for packets already in order.
+ */
+static void draw_translate(draw_packet_t const * packets, UINT const * order, UINT count, draw_backend_t const * backend, draw_queue_stats_t * stats) {
+	LONGLONG start = timer_now();
+	UINT pipeline = DRAW_NONE;
+	UINT root_sig = DRAW_NONE;
+	UINT vbuffer = DRAW_NONE;
+	UINT ibuffer = DRAW_NONE;
+	UINT64 changes = 0;
+
+	for (UINT i = 0; i < count; ++i) {
+		draw_packet_t const * packet = &packets[order != NULL ? order[i] : i];
+
+		/* a new root signature unbinds everything set through the old one, the pipeline stays */
+		if (packet->root_sig != root_sig) {
+			root_sig = packet->root_sig;
+			backend->set_root_sig(backend->user, root_sig);
+			++stats->root_sig_changes;
+			++changes;
+		}
+		if (packet->pipeline != pipeline) {
+			pipeline = packet->pipeline;
+			backend->set_pipeline(backend->user, pipeline);
+			++stats->pipeline_changes;
+			++changes;
+		}
+		if (packet->vbuffer != vbuffer) {
+			vbuffer = packet->vbuffer;
+			backend->set_vbuffer(backend->user, vbuffer);
+			++stats->vbuffer_changes;
+			++changes;
+		}
+		if (packet->ibuffer != ibuffer) {
+			ibuffer = packet->ibuffer;
+			backend->set_ibuffer(backend->user, ibuffer);
+			++stats->ibuffer_changes;
+			++changes;
+		}
+
+		backend->draw(backend->user, packet);
+	}
+
+	stats->packets += count;
+	stats->avoided += (UINT64) count * 4 - changes;
+	stats->translate_ms += timer_ms(timer_now() - start);
+}
+
+/* translates the queue in sorted order, sorting first if it hasn't been */
+static void draw_queue_submit(draw_queue_t * q, draw_backend_t const * backend) {
+	if (q->order == NULL) {
+		draw_queue_sort(q);
+	}
+	draw_translate(q->packets, q->order, q->count, backend, &q->stats);
+}
+
+static void draw_queue_report(draw_queue_stats_t const * stats, FILE * fp) {
+	UINT64 changes = stats->pipeline_changes + stats->root_sig_changes + stats->vbuffer_changes + stats->ibuffer_changes;
+	fprintf(fp, "drawqueue: %llu packets, %llu state changes (%llu pipeline, %llu root signature, %llu vertex, %llu index), %llu avoided, sort %.3f ms over %llu sorts, translate %.3f ms\n", (unsigned long long) stats->packets, (unsigned long long) changes, (unsigned long long) stats->pipeline_changes, (unsigned long long) stats->root_sig_changes, (unsigned long long) stats->vbuffer_changes, (unsigned long long) stats->ibuffer_changes, (unsigned long long) stats->avoided, stats->sort_ms, (unsigned long long) stats->sorts, stats->translate_ms);
+}
+
+#endif
@@ -0,0 +1,833 @@
+#ifndef GPUMEM_H
+#define GPUMEM_H
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+
+/*
+ * two-level segregated fit allocator over the byte range of one heap.
+ * it never touches the memory it hands out, so it runs fine on the CPU alone.
+ * block records live in a growable array and are referred to by index.
+ */
+
+#define TLSF_SL_BITS 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_BITS)
+#define TLSF_FL_COUNT 64
+#define TLSF_NONE UINT_MAX
+
+typedef struct tlsf_block {
+	UINT64 offset;
+	UINT64 size;
+	UINT prev_phys;
+	UINT next_phys;
+	UINT prev_free;
+	UINT next_free;
+	BOOL free;
+} tlsf_block_t;
+
+typedef struct tlsf {
+	UINT64 size;
+	UINT64 granularity;
+
+	tlsf_block_t * blocks;
+	UINT block_capacity;
+	UINT block_count;
+	UINT unused;
+
+	UINT64 fl_bitmap;
+	UINT sl_bitmap[TLSF_FL_COUNT];
+	UINT heads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+	UINT64 used;
+	UINT alloc_count;
+} tlsf_t;
+
+/* both return 0 for v == 0, where the scan leaves index untouched */
+static UINT tlsf_msb(UINT64 v) {
+	unsigned long index = 0;
+	_BitScanReverse64(&index, v);
+	return (UINT) index;
+}
+
+static UINT tlsf_lsb(UINT64 v) {
+	unsigned long index = 0;
+	_BitScanForward64(&index, v);
+	return (UINT) index;
+}
+
+static void tlsf_mapping(UINT64 size, UINT * fl, UINT * sl) {
+	if (size < TLSF_SL_COUNT) {
+		*fl = 0;
+		*sl = (UINT) size;
+		return;
+	}
+
+	*fl = tlsf_msb(size);
+	*sl = (UINT) (size >> (*fl - TLSF_SL_BITS)) ^ TLSF_SL_COUNT;
+	*fl -= TLSF_SL_BITS - 1;
+}
+
+static UINT tlsf_new_block(tlsf_t * tlsf) {
+	if (tlsf->unused != TLSF_NONE) {
+		UINT index = tlsf->unused;
+		tlsf->unused = tlsf->blocks[index].next_free;
+		return index;
+	}
+
+	if (tlsf->block_count == tlsf->block_capacity) {
+		UINT capacity = tlsf->block_capacity == 0 ? 64 : tlsf->block_capacity * 2;
+		tlsf_block_t * blocks = realloc(tlsf->blocks, sizeof(tlsf_block_t) * capacity);
+		if (blocks == NULL) {
+			return TLSF_NONE;
+		}
+
+		tlsf->blocks = blocks;
+		tlsf->block_capacity = capacity;
+	}
+
+	return tlsf->block_count++;
+}
+
+static int tlsf_reserve(tlsf_t * tlsf, UINT count) {
+	if (count <= tlsf->block_capacity) {
+		return 0;
+	}
+
+	if (count < tlsf->block_capacity * 2) {
+		count = tlsf->block_capacity * 2;
+	}
+
+	tlsf_block_t * blocks = realloc(tlsf->blocks, sizeof(tlsf_block_t) * count);
+	if (blocks == NULL) {
+		return 1;
+	}
+
+	tlsf->blocks = blocks;
+	tlsf->block_capacity = count;
+	return 0;
+}
+
+static void tlsf_drop_block(tlsf_t * tlsf, UINT index) {
+	tlsf->blocks[index].size = 0;
+	tlsf->blocks[index].next_free = tlsf->unused;
+	tlsf->unused = index;
+}
+
+static void tlsf_insert_free(tlsf_t * tlsf, UINT index) {
+	tlsf_block_t * block = &tlsf->blocks[index];
+	UINT fl, sl;
+	tlsf_mapping(block->size, &fl, &sl);
+
+	block->free = TRUE;
+	block->prev_free = TLSF_NONE;
+	block->next_free = tlsf->heads[fl][sl];
+	if (block->next_free != TLSF_NONE) {
+		tlsf->blocks[block->next_free].prev_free = index;
+	}
+
+	tlsf->heads[fl][sl] = index;
+	tlsf->fl_bitmap |= 1ull << fl;
+	tlsf->sl_bitmap[fl] |= 1u << sl;
+}
+
+static void tlsf_remove_free(tlsf_t * tlsf, UINT index) {
+	tlsf_block_t * block = &tlsf->blocks[index];
+	UINT fl, sl;
+	tlsf_mapping(block->size, &fl, &sl);
+
+	if (block->prev_free != TLSF_NONE) {
+		tlsf->blocks[block->prev_free].next_free = block->next_free;
+	} else {
+		tlsf->heads[fl][sl] = block->next_free;
+		if (block->next_free == TLSF_NONE) {
+			tlsf->sl_bitmap[fl] &= ~(1u << sl);
+			if (tlsf->sl_bitmap[fl] == 0) {
+				tlsf->fl_bitmap &= ~(1ull << fl);
+			}
+		}
+	}
+
+	if (block->next_free != TLSF_NONE) {
+		tlsf->blocks[block->next_free].prev_free = block->prev_free;
+	}
+
+	block->free = FALSE;
+}
+
+static void tlsf_clear(tlsf_t * tlsf) {
+	tlsf->block_count = 0;
+	tlsf->unused = TLSF_NONE;
+	tlsf->fl_bitmap = 0;
+	tlsf->used = 0;
+	tlsf->alloc_count = 0;
+	for (UINT fl = 0; fl < TLSF_FL_COUNT; ++fl) {
+		tlsf->sl_bitmap[fl] = 0;
+		for (UINT sl = 0; sl < TLSF_SL_COUNT; ++sl) {
+			tlsf->heads[fl][sl] = TLSF_NONE;
+		}
+	}
+}
+
+/* granularity must be a power of two, every offset and size is a multiple of it */
+static int tlsf_init(tlsf_t * tlsf, UINT64 size, UINT64 granularity) {
+	*tlsf = (tlsf_t) {
+		.size = size & ~(granularity - 1),
+		.granularity = granularity,
+		.blocks = NULL,
+		.block_capacity = 0,
+	};
+	tlsf_clear(tlsf);
+
+	UINT index = tlsf_new_block(tlsf);
+	if (index == TLSF_NONE) {
+		return 1;
+	}
+
+	tlsf->blocks[index] = (tlsf_block_t) {
+		.offset = 0,
+		.size = tlsf->size,
+		.prev_phys = TLSF_NONE,
+		.next_phys = TLSF_NONE,
+	};
+	tlsf_insert_free(tlsf, index);
+
+	return 0;
+}
+
+static void tlsf_destroy(tlsf_t * tlsf) {
+	free(tlsf->blocks);
+	tlsf->blocks = NULL;
+	tlsf->block_capacity = 0;
+	tlsf->block_count = 0;
+}
+
+/* first non-empty free list whose blocks are all >= size */
+static UINT tlsf_find(tlsf_t * tlsf, UINT64 size) {
+	UINT fl, sl;
+
+	if (size >= TLSF_SL_COUNT) {
+		UINT64 round = (1ull << (tlsf_msb(size) - TLSF_SL_BITS)) - 1;
+		if (size + round < size) {
+			return TLSF_NONE;
+		}
+		size += round;
+	}
+	tlsf_mapping(size, &fl, &sl);
+	if (fl >= TLSF_FL_COUNT) {
+		return TLSF_NONE;
+	}
+
+	UINT sl_map = tlsf->sl_bitmap[fl] & (~0u << sl);
+	if (sl_map == 0) {
+		UINT64 fl_map = fl + 1 < TLSF_FL_COUNT ? tlsf->fl_bitmap & (~0ull << (fl + 1)) : 0;
+		if (fl_map == 0) {
+			return TLSF_NONE;
+		}
+
+		fl = tlsf_lsb(fl_map);
+		sl_map = tlsf->sl_bitmap[fl];
+	}
+
+	return tlsf->heads[fl][tlsf_lsb(sl_map)];
+}
+
+/* splits size bytes off the front of a used block, the remainder goes back on a free list */
+static int tlsf_split(tlsf_t * tlsf, UINT index, UINT64 size) {
+	if (tlsf->blocks[index].size == size) {
+		return 0;
+	}
+
+	UINT rest = tlsf_new_block(tlsf);
+	if (rest == TLSF_NONE) {
+		return 1;
+	}
+
+	tlsf_block_t * block = &tlsf->blocks[index];
+	tlsf->blocks[rest] = (tlsf_block_t) {
+		.offset = block->offset + size,
+		.size = block->size - size,
+		.prev_phys = index,
+		.next_phys = block->next_phys,
+	};
+
+	if (block->next_phys != TLSF_NONE) {
+		tlsf->blocks[block->next_phys].prev_phys = rest;
+	}
+	block->next_phys = rest;
+	block->size = size;
+
+	tlsf_insert_free(tlsf, rest);
+	return 0;
+}
+
+/* returns the block index or TLSF_NONE, *offset receives the aligned start */
+static UINT tlsf_alloc(tlsf_t * tlsf, UINT64 size, UINT64 alignment, UINT64 * offset) {
+	if (size == 0) {
+		size = tlsf->granularity;
+	}
+	size = (size + tlsf->granularity - 1) & ~(tlsf->granularity - 1);
+	if (alignment < tlsf->granularity) {
+		alignment = tlsf->granularity;
+	}
+
+	/* both splits below need a block record, make sure neither can fail halfway */
+	if (tlsf_reserve(tlsf, tlsf->block_count + 2) != 0) {
+		return TLSF_NONE;
+	}
+
+	/* worst case padding, offsets are already granularity aligned */
+	UINT index = tlsf_find(tlsf, size + alignment - tlsf->granularity);
+	if (index == TLSF_NONE) {
+		return TLSF_NONE;
+	}
+
+	tlsf_remove_free(tlsf, index);
+
+	UINT64 start = tlsf->blocks[index].offset;
+	UINT64 pad = ((start + alignment - 1) & ~(alignment - 1)) - start;
+	if (pad > 0) {
+		/* keep the padding as its own free block in front */
+		tlsf_split(tlsf, index, pad);
+
+		UINT aligned = tlsf->blocks[index].next_phys;
+		tlsf_remove_free(tlsf, aligned);
+		tlsf_insert_free(tlsf, index);
+		index = aligned;
+	}
+
+	tlsf_split(tlsf, index, size);
+
+	tlsf->used += size;
+	++tlsf->alloc_count;
+	*offset = tlsf->blocks[index].offset;
+
+	return index;
+}
+
+static void tlsf_merge_next(tlsf_t * tlsf, UINT index) {
+	tlsf_block_t * block = &tlsf->blocks[index];
+	UINT next = block->next_phys;
+
+	block->size += tlsf->blocks[next].size;
+	block->next_phys = tlsf->blocks[next].next_phys;
+	if (block->next_phys != TLSF_NONE) {
+		tlsf->blocks[block->next_phys].prev_phys = index;
+	}
+
+	tlsf_drop_block(tlsf, next);
+}
+
+static void tlsf_free(tlsf_t * tlsf, UINT index) {
+	tlsf->used -= tlsf->blocks[index].size;
+	--tlsf->alloc_count;
+
+	UINT next = tlsf->blocks[index].next_phys;
+	if (next != TLSF_NONE && tlsf->blocks[next].free) {
+		tlsf_remove_free(tlsf, next);
+		tlsf_merge_next(tlsf, index);
+	}
+
+	UINT prev = tlsf->blocks[index].prev_phys;
+	if (prev != TLSF_NONE && tlsf->blocks[prev].free) {
+		tlsf_remove_free(tlsf, prev);
+		tlsf_merge_next(tlsf, prev);
+		index = prev;
+	}
+
+	tlsf_insert_free(tlsf, index);
+}
+
+static UINT64 tlsf_largest_free(tlsf_t const * tlsf) {
+	if (tlsf->fl_bitmap == 0) {
+		return 0;
+	}
+
+	UINT fl = tlsf_msb(tlsf->fl_bitmap);
+	UINT sl = tlsf_msb(tlsf->sl_bitmap[fl]);
+	UINT64 largest = 0;
+	for (UINT i = tlsf->heads[fl][sl]; i != TLSF_NONE; i = tlsf->blocks[i].next_free) {
+		if (tlsf->blocks[i].size > largest) {
+			largest = tlsf->blocks[i].size;
+		}
+	}
+
+	return largest;
+}
+
+/* walks the physical chain and every free list, returns 0 when consistent */
+static int tlsf_check(tlsf_t const * tlsf) {
+	UINT64 offset = 0;
+	UINT64 used = 0;
+	UINT free_blocks = 0;
+	UINT allocs = 0;
+	UINT prev = TLSF_NONE;
+	BOOL prev_free = FALSE;
+
+	UINT index = 0;
+	while (index < tlsf->block_count && (tlsf->blocks[index].size == 0 || tlsf->blocks[index].prev_phys != TLSF_NONE)) {
+		++index;
+	}
+
+	for (; index != TLSF_NONE; index = tlsf->blocks[index].next_phys) {
+		tlsf_block_t const * block = &tlsf->blocks[index];
+		if (block->offset != offset || block->prev_phys != prev || block->size == 0) {
+			return 1;
+		}
+		if ((block->offset | block->size) & (tlsf->granularity - 1)) {
+			return 2;
+		}
+		if (block->free && prev_free) {
+			return 3;
+		}
+
+		if (block->free) {
+			++free_blocks;
+		} else {
+			used += block->size;
+			++allocs;
+		}
+
+		prev_free = block->free;
+		offset += block->size;
+		prev = index;
+	}
+
+	if (offset != tlsf->size || used != tlsf->used || allocs != tlsf->alloc_count) {
+		return 4;
+	}
+
+	UINT listed = 0;
+	for (UINT fl = 0; fl < TLSF_FL_COUNT; ++fl) {
+		for (UINT sl = 0; sl < TLSF_SL_COUNT; ++sl) {
+			BOOL bit = (tlsf->fl_bitmap >> fl & 1) && (tlsf->sl_bitmap[fl] >> sl & 1);
+			if (bit != (tlsf->heads[fl][sl] != TLSF_NONE)) {
+				return 5;
+			}
+
+			for (UINT i = tlsf->heads[fl][sl]; i != TLSF_NONE; i = tlsf->blocks[i].next_free) {
+				UINT bfl, bsl;
+				tlsf_mapping(tlsf->blocks[i].size, &bfl, &bsl);
+				if (!tlsf->blocks[i].free || bfl != fl || bsl != sl) {
+					return 6;
+				}
+				++listed;
+			}
+		}
+	}
+
+	return listed == free_blocks ? 0 : 7;
+}
+
+/*
+ * placed-resource sub-allocation on top of tlsf.
+ *
+ * a pool owns heaps of one kind (heap type + heap flags, decided by the backend) and
+ * hands out allocation ids that stay valid across defragmentation. heaps are created
+ * and destroyed through the backend callbacks, so a fake backend can exercise it all.
+ */
+
+#define GPUMEM_ALIGN_DEFAULT (64ull * 1024)
+#define GPUMEM_ALIGN_MSAA (4ull * 1024 * 1024)
+#define GPUMEM_MAX_HEAPS 64
+#define GPUMEM_NONE UINT_MAX
+
+typedef struct gpumem_backend {
+	void * (* create_heap)(void * user, UINT kind, UINT64 size);
+	void (* destroy_heap)(void * user, void * heap);
+	/* copy size bytes from old_offset to new_offset within heap and re-place the resource, alloc_user is what gpumem_alloc got */
+	void (* move)(void * user, void * alloc_user, void * heap, UINT64 old_offset, UINT64 new_offset, UINT64 size);
+	void * user;
+} gpumem_backend_t;
+
+typedef struct gpumem_heap {
+	void * heap;
+	tlsf_t tlsf;
+	UINT64 peak;
+} gpumem_heap_t;
+
+typedef struct gpumem_alloc {
+	UINT heap;
+	UINT block;
+	UINT64 offset;
+	UINT64 size;
+	UINT64 alignment;
+	void * user;
+} gpumem_alloc_t;
+
+typedef struct gpumem_stats {
+	UINT heaps;
+	UINT64 reserved;
+	UINT64 used;
+	UINT allocs;
+	UINT64 largest_free;
+	UINT64 budget;
+	UINT64 failed;
+	UINT64 moved;
+} gpumem_stats_t;
+
+typedef struct gpumem {
+	const char * name;
+	UINT kind;
+	UINT64 heap_size;
+	UINT64 budget;
+	gpumem_backend_t backend;
+
+	gpumem_heap_t heaps[GPUMEM_MAX_HEAPS];
+	UINT heap_count;
+
+	gpumem_alloc_t * allocs;
+	UINT alloc_capacity;
+	UINT alloc_free;
+
+	UINT64 reserved;
+	UINT64 failed;
+	UINT64 moved;
+	SRWLOCK lock;
+} gpumem_t;
+
+/* budget == 0 means unlimited, otherwise new heaps are refused past it */
+static void gpumem_init(gpumem_t * mem, const char * name, UINT kind, UINT64 heap_size, UINT64 budget, gpumem_backend_t backend) {
+	*mem = (gpumem_t) {
+		.name = name,
+		.kind = kind,
+		.heap_size = heap_size,
+		.budget = budget,
+		.backend = backend,
+		.heap_count = 0,
+		.allocs = NULL,
+		.alloc_capacity = 0,
+		.alloc_free = GPUMEM_NONE,
+		.reserved = 0,
+		.failed = 0,
+		.moved = 0,
+	};
+	InitializeSRWLock(&mem->lock);
+}
+
+static void gpumem_set_budget(gpumem_t * mem, UINT64 budget) {
+	AcquireSRWLockExclusive(&mem->lock);
+	mem->budget = budget;
+	ReleaseSRWLockExclusive(&mem->lock);
+}
+
+static UINT gpumem_new_alloc(gpumem_t * mem) {
+	if (mem->alloc_free == GPUMEM_NONE) {
+		UINT capacity = mem->alloc_capacity == 0 ? 64 : mem->alloc_capacity * 2;
+		gpumem_alloc_t * allocs = realloc(mem->allocs, sizeof(gpumem_alloc_t) * capacity);
+		if (allocs == NULL) {
+			return GPUMEM_NONE;
+		}
+
+		for (UINT i = capacity; i > mem->alloc_capacity; --i) {
+			allocs[i - 1] = (gpumem_alloc_t) { .heap = GPUMEM_NONE, .block = mem->alloc_free };
+			mem->alloc_free = i - 1;
+		}
+
+		mem->allocs = allocs;
+		mem->alloc_capacity = capacity;
+	}
+
+	UINT id = mem->alloc_free;
+	mem->alloc_free = mem->allocs[id].block;
+	return id;
+}
+
+static int gpumem_add_heap(gpumem_t * mem, UINT64 size) {
+	if (mem->heap_count == GPUMEM_MAX_HEAPS) {
+		return 1;
+	}
+
+	if (mem->budget != 0 && mem->reserved + size > mem->budget) {
+		return 2;
+	}
+
+	void * heap = mem->backend.create_heap(mem->backend.user, mem->kind, size);
+	if (heap == NULL) {
+		return 3;
+	}
+
+	gpumem_heap_t * h = &mem->heaps[mem->heap_count];
+	if (tlsf_init(&h->tlsf, size, GPUMEM_ALIGN_DEFAULT) != 0) {
+		mem->backend.destroy_heap(mem->backend.user, heap);
+		return 4;
+	}
+
+	h->heap = heap;
+	h->peak = 0;
+	mem->reserved += size;
+	++mem->heap_count;
+
+	return 0;
+}
+
+/* returns an allocation id or GPUMEM_NONE, user is handed back in move callbacks */
+static UINT gpumem_alloc(gpumem_t * mem, UINT64 size, UINT64 alignment, void * user) {
+	AcquireSRWLockExclusive(&mem->lock);
+
+	UINT id = gpumem_new_alloc(mem);
+	if (id == GPUMEM_NONE) {
+		++mem->failed;
+		ReleaseSRWLockExclusive(&mem->lock);
+		return GPUMEM_NONE;
+	}
+
+	UINT64 offset = 0;
+	UINT block = TLSF_NONE;
+	UINT heap = 0;
+	for (; heap < mem->heap_count; ++heap) {
+		block = tlsf_alloc(&mem->heaps[heap].tlsf, size, alignment, &offset);
+		if (block != TLSF_NONE) {
+			break;
+		}
+	}
+
+	if (block == TLSF_NONE) {
+		/* oversize requests get a heap of their own */
+		UINT64 heap_size = mem->heap_size;
+		UINT64 need = size + (alignment > GPUMEM_ALIGN_DEFAULT ? alignment : GPUMEM_ALIGN_DEFAULT);
+		while (heap_size < need) {
+			heap_size *= 2;
+		}
+
+		if (gpumem_add_heap(mem, heap_size) == 0) {
+			heap = mem->heap_count - 1;
+			block = tlsf_alloc(&mem->heaps[heap].tlsf, size, alignment, &offset);
+		}
+	}
+
+	if (block == TLSF_NONE) {
+		mem->allocs[id].block = mem->alloc_free;
+		mem->alloc_free = id;
+		++mem->failed;
+		ReleaseSRWLockExclusive(&mem->lock);
+		return GPUMEM_NONE;
+	}
+
+	gpumem_heap_t * h = &mem->heaps[heap];
+	if (h->tlsf.used > h->peak) {
+		h->peak = h->tlsf.used;
+	}
+
+	mem->allocs[id] = (gpumem_alloc_t) {
+		.heap = heap,
+		.block = block,
+		.offset = offset,
+		.size = h->tlsf.blocks[block].size,
+		.alignment = alignment > GPUMEM_ALIGN_DEFAULT ? alignment : GPUMEM_ALIGN_DEFAULT,
+		.user = user,
+	};
+
+	ReleaseSRWLockExclusive(&mem->lock);
+	return id;
+}
+
+static void gpumem_free(gpumem_t * mem, UINT id) {
+	AcquireSRWLockExclusive(&mem->lock);
+	if (id < mem->alloc_capacity && mem->allocs[id].heap != GPUMEM_NONE) {
+		gpumem_alloc_t * alloc = &mem->allocs[id];
+		tlsf_free(&mem->heaps[alloc->heap].tlsf, alloc->block);
+
+		alloc->heap = GPUMEM_NONE;
+		alloc->user = NULL;
+		alloc->block = mem->alloc_free;
+		mem->alloc_free = id;
+	}
+	ReleaseSRWLockExclusive(&mem->lock);
+}
+
+static gpumem_alloc_t gpumem_get(gpumem_t * mem, UINT id) {
+	AcquireSRWLockShared(&mem->lock);
+	gpumem_alloc_t alloc = mem->allocs[id];
+	ReleaseSRWLockShared(&mem->lock);
+	return alloc;
+}
+
+static void * gpumem_heap_of(gpumem_t * mem, UINT id) {
+	AcquireSRWLockShared(&mem->lock);
+	void * heap = mem->heaps[mem->allocs[id].heap].heap;
+	ReleaseSRWLockShared(&mem->lock);
+	return heap;
+}
+
+static int gpumem_compare_offset(void const * a, void const * b) {
+	gpumem_alloc_t const * x = *(gpumem_alloc_t * const *) a;
+	gpumem_alloc_t const * y = *(gpumem_alloc_t * const *) b;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/*
+ * slides every allocation down towards offset 0 inside its heap and releases heaps
+ * that end up empty. the GPU must not be using any of the moved ranges, and since
+ * old and new ranges may overlap the backend move callback has to copy through a
+ * staging buffer. returns the number of bytes moved.
+ */
+static UINT64 gpumem_defragment(gpumem_t * mem) {
+	UINT64 moved = 0;
+
+	AcquireSRWLockExclusive(&mem->lock);
+
+	gpumem_alloc_t ** sorted = malloc(sizeof(gpumem_alloc_t *) * (mem->alloc_capacity + 1));
+	if (sorted == NULL) {
+		ReleaseSRWLockExclusive(&mem->lock);
+		return 0;
+	}
+
+	for (UINT heap = 0; heap < mem->heap_count; ++heap) {
+		gpumem_heap_t * h = &mem->heaps[heap];
+		UINT count = 0;
+
+		for (UINT i = 0; i < mem->alloc_capacity; ++i) {
+			if (mem->allocs[i].heap == heap) {
+				sorted[count++] = &mem->allocs[i];
+			}
+		}
+		qsort(sorted, count, sizeof(gpumem_alloc_t *), gpumem_compare_offset);
+
+		/* rebuild the physical chain directly: used blocks packed, one free tail */
+		tlsf_t * tlsf = &h->tlsf;
+		if (tlsf_reserve(tlsf, count * 2 + 1) != 0) {
+			continue;
+		}
+		tlsf_clear(tlsf);
+
+		UINT64 cursor = 0;
+		UINT prev = TLSF_NONE;
+		for (UINT i = 0; i < count; ++i) {
+			gpumem_alloc_t * alloc = sorted[i];
+			UINT64 target = (cursor + alloc->alignment - 1) & ~(alloc->alignment - 1);
+
+			if (target > cursor) {
+				UINT pad = tlsf_new_block(tlsf);
+				tlsf->blocks[pad] = (tlsf_block_t) { .offset = cursor, .size = target - cursor, .prev_phys = prev, .next_phys = TLSF_NONE };
+				if (prev != TLSF_NONE) {
+					tlsf->blocks[prev].next_phys = pad;
+				}
+				tlsf_insert_free(tlsf, pad);
+				prev = pad;
+			}
+
+			if (target != alloc->offset) {
+				mem->backend.move(mem->backend.user, alloc->user, h->heap, alloc->offset, target, alloc->size);
+				moved += alloc->size;
+			}
+
+			UINT block = tlsf_new_block(tlsf);
+			tlsf->blocks[block] = (tlsf_block_t) { .offset = target, .size = alloc->size, .prev_phys = prev, .next_phys = TLSF_NONE, .free = FALSE };
+			if (prev != TLSF_NONE) {
+				tlsf->blocks[prev].next_phys = block;
+			}
+
+			alloc->offset = target;
+			alloc->block = block;
+			tlsf->used += alloc->size;
+			++tlsf->alloc_count;
+
+			prev = block;
+			cursor = target + alloc->size;
+		}
+
+		if (cursor < tlsf->size) {
+			UINT tail = tlsf_new_block(tlsf);
+			tlsf->blocks[tail] = (tlsf_block_t) { .offset = cursor, .size = tlsf->size - cursor, .prev_phys = prev, .next_phys = TLSF_NONE };
+			if (prev != TLSF_NONE) {
+				tlsf->blocks[prev].next_phys = tail;
+			}
+			tlsf_insert_free(tlsf, tail);
+		}
+	}
+
+	free(sorted);
+
+	/* drop empty heaps, renumbering the ones after them */
+	for (UINT heap = mem->heap_count; heap > 0; --heap) {
+		gpumem_heap_t * h = &mem->heaps[heap - 1];
+		if (h->tlsf.alloc_count != 0) {
+			continue;
+		}
+
+		mem->backend.destroy_heap(mem->backend.user, h->heap);
+		mem->reserved -= h->tlsf.size;
+		tlsf_destroy(&h->tlsf);
+
+		for (UINT i = heap; i < mem->heap_count; ++i) {
+			mem->heaps[i - 1] = mem->heaps[i];
+		}
+		--mem->heap_count;
+
+		for (UINT i = 0; i < mem->alloc_capacity; ++i) {
+			if (mem->allocs[i].heap != GPUMEM_NONE && mem->allocs[i].heap >= heap) {
+				--mem->allocs[i].heap;
+			}
+		}
+	}
+
+	mem->moved += moved;
+	ReleaseSRWLockExclusive(&mem->lock);
+
+	return moved;
+}
+
+static void gpumem_get_stats(gpumem_t * mem, gpumem_stats_t * stats) {
+	AcquireSRWLockShared(&mem->lock);
+	*stats = (gpumem_stats_t) {
+		.heaps = mem->heap_count,
+		.reserved = mem->reserved,
+		.budget = mem->budget,
+		.failed = mem->failed,
+		.moved = mem->moved,
+	};
+
+	for (UINT i = 0; i < mem->heap_count; ++i) {
+		UINT64 largest = tlsf_largest_free(&mem->heaps[i].tlsf);
+		stats->used += mem->heaps[i].tlsf.used;
+		stats->allocs += mem->heaps[i].tlsf.alloc_count;
+		if (largest > stats->largest_free) {
+			stats->largest_free = largest;
+		}
+	}
+	ReleaseSRWLockShared(&mem->lock);
+}
+
+static void gpumem_dump_json(gpumem_t * mem, FILE * fp) {
+	AcquireSRWLockShared(&mem->lock);
+
+	fprintf(fp, "{\"name\":\"%s\",\"kind\":%u,\"budget\":%llu,\"reserved\":%llu,\"failed\":%llu,\"moved\":%llu,\"heaps\":[", mem->name, mem->kind, (unsigned long long) mem->budget, (unsigned long long) mem->reserved, (unsigned long long) mem->failed, (unsigned long long) mem->moved);
+
+	for (UINT i = 0; i < mem->heap_count; ++i) {
+		tlsf_t const * tlsf = &mem->heaps[i].tlsf;
+		UINT free_blocks = 0;
+		for (UINT b = 0; b < tlsf->block_count; ++b) {
+			if (tlsf->blocks[b].size != 0 && tlsf->blocks[b].free) {
+				++free_blocks;
+			}
+		}
+
+		UINT64 free_bytes = tlsf->size - tlsf->used;
+		UINT64 largest = tlsf_largest_free(tlsf);
+		double fragmentation = free_bytes == 0 ? 0.0 : 1.0 - (double) largest / (double) free_bytes;
+
+		fprintf(fp, "%s{\"size\":%llu,\"used\":%llu,\"peak\":%llu,\"allocs\":%u,\"free_blocks\":%u,\"largest_free\":%llu,\"fragmentation\":%.4f}", i == 0 ? "" : ",", (unsigned long long) tlsf->size, (unsigned long long) tlsf->used, (unsigned long long) mem->heaps[i].peak, tlsf->alloc_count, free_blocks, (unsigned long long) largest, fragmentation);
+	}
+
+	fprintf(fp, "]}\n");
+	ReleaseSRWLockShared(&mem->lock);
+}
+
+/* every allocation must have been freed or be about to die with its heap */
+static void gpumem_destroy(gpumem_t * mem) {
+	for (UINT i = 0; i < mem->heap_count; ++i) {
+		mem->backend.destroy_heap(mem->backend.user, mem->heaps[i].heap);
+		tlsf_destroy(&mem->heaps[i].tlsf);
+	}
+
+	free(mem->allocs);
+	mem->allocs = NULL;
+	mem->alloc_capacity = 0;
+	mem->alloc_free = GPUMEM_NONE;
+	mem->heap_count = 0;
+	mem->reserved = 0;
+}
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef GPUSCHED_H
+#define GPUSCHED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+/*
+ * submission across the graphics and compute queues. passes are submitted in frame
+ * order with the resources they read and write as bitmasks; each queue signals its own
+ * fence after every pass, and a pass only waits on another queue's fence where it
+ * reads what that queue wrote, or writes what it read or wrote. work on one queue is
+ * ordered already and is never waited on. a wait that an earlier wait already covers
+ * is dropped.
+ *
+ * hazards carry across frames, so double-buffering what compute produces lets the
+ * compute passes of frame n + 1 run while graphics is still on frame n. main.c doesn't
+ * get that overlap yet: its per-frame upload buffers and allocators are single-buffered,
+ * so the frame loop still drains the graphics queue once a frame after present, and
+ * the overlap only shows in sched_timeline_t. the hazards a frame ring would need,
+ * including the particle state's indirect arguments, are tracked already.
+ *
+ * the backend does the API work. sched_timeline_t is a backend that plays the
+ * schedule against per-pass cost estimates, for looking at overlap without a device.
+ */
+
+#define SCHED_MAX_RESOURCES 64
+#define SCHED_BIT(resource) (1ull << (resource))
+
+typedef enum sched_queue {
+	SCHED_GRAPHICS,
+	SCHED_COMPUTE,
+	SCHED_QUEUES,
+} sched_queue_t;
+
+typedef struct sched_pass {
+	const char * name;
+	sched_queue_t queue;
+	UINT64 reads;
+	UINT64 writes;
+	/* estimated GPU time, only the timeline looks at it */
+	float cost_ms;
+	/* the backend's, usually the command list */
+	void * user;
+} sched_pass_t;
+
+/* non-zero returns are failures and stop sched_submit */
+typedef struct sched_backend {
+	int (* wait)(void * user, sched_queue_t queue, sched_queue_t signaler, UINT64 value);
+	int (* submit)(void * user, sched_pass_t const * pass);
+	int (* signal)(void * user, sched_queue_t queue, UINT64 value);
+	void * user;
+} sched_backend_t;
+
+typedef struct sched_stats {
+	UINT64 passes;
+	UINT64 waits;
+	/* hazards an earlier wait on the same fence already covered */
+	UINT64 elided;
+} sched_stats_t;
+
+typedef struct sched_resource {
+	sched_queue_t writer;
+	/* fence value of the last write on writer's fence, 0 if never written */
+	UINT64 written;
+	/* fence value of the last read on each queue's fence */
+	UINT64 read[SCHED_QUEUES];
+} sched_resource_t;
+
+typedef struct sched {
+	sched_backend_t backend;
+	/* last value each queue signaled on its own fence */
+	UINT64 signaled[SCHED_QUEUES];
+	/* waited[a][b]: highest value of b's fence queue a has waited for */
+	UINT64 waited[SCHED_QUEUES][SCHED_QUEUES];
+	sched_resource_t resources[SCHED_MAX_RESOURCES];
+	sched_stats_t stats;
+} sched_t;
+
+static const char * sched_queue_name(sched_queue_t queue) {
+	return queue == SCHED_COMPUTE ? "compute" : "graphics";
+}
+
+static void sched_init(sched_t * sched, sched_backend_t backend) {
+	*sched = (sched_t) {
+		.backend = backend,
+	};
+}
+
+/* waits where the pass needs to, submits it and signals its queue; the pass's fence value is sched->signaled[pass->queue] */
+static int sched_submit(sched_t * sched, sched_pass_t const * pass) {
+	sched_queue_t q = pass->queue;
+	UINT64 need[SCHED_QUEUES] = { 0 };
+
+	for (UINT r = 0; r < SCHED_MAX_RESOURCES; ++r) {
+		UINT64 bit = SCHED_BIT(r);
+		if (((pass->reads | pass->writes) & bit) == 0) {
+			continue;
+		}
+
+		sched_resource_t const * res = &sched->resources[r];
+
+		/* read after write, write after write */
+		if (res->written != 0 && res->writer != q && res->written > need[res->writer]) {
+			need[res->writer] = res->written;
+		}
+
+		/* write after read */
+		if (pass->writes & bit) {
+			for (UINT o = 0; o < SCHED_QUEUES; ++o) {
+				if (o != q && res->read[o] > need[o]) {
+					need[o] = res->read[o];
+				}
+			}
+		}
+	}
+
+	for (UINT o = 0; o < SCHED_QUEUES; ++o) {
+		if (need[o] == 0) {
+			continue;
+		}
+
+		if (need[o] <= sched->waited[q][o]) {
+			++sched->stats.elided;
+			continue;
+		}
+
+		if (sched->backend.wait(sched->backend.user, q, o, need[o]) != 0) {
+			return 1;
+		}
+		sched->waited[q][o] = need[o];
+		++sched->stats.waits;
+	}
+
+	if (sched->backend.submit(sched->backend.user, pass) != 0) {
+		return 1;
+	}
+
+	UINT64 value = sched->signaled[q] + 1;
+	if (sched->backend.signal(sched->backend.user, q, value) != 0) {
+		return 1;
+	}
+	sched->signaled[q] = value;
+	++sched->stats.passes;
+
+	for (UINT r = 0; r < SCHED_MAX_RESOURCES; ++r) {
+		UINT64 bit = SCHED_BIT(r);
+		if (pass->reads & bit) {
+			sched->resources[r].read[q] = value;
+		}
+		if (pass->writes & bit) {
+			sched->resources[r].writer = q;
+			sched->resources[r].written = value;
+		}
+	}
+
+	return 0;
+}
+
+static void sched_report(sched_t const * sched, FILE * fp) {
+	fprintf(fp, "sched: %llu passes, %llu cross-queue waits, %llu covered by earlier waits, fences at %llu graphics / %llu compute\n", (unsigned long long) sched->stats.passes, (unsigned long long) sched->stats.waits, (unsigned long long) sched->stats.elided, (unsigned long long) sched->signaled[SCHED_GRAPHICS], (unsigned long long) sched->signaled[SCHED_COMPUTE]);
+}
+
+/*
+ * simulated queues: each runs its passes back to back, starting a pass once the queue
+ * is free and every fence it waits for has been reached. submission is treated as
+ * instant, so the result is what the GPU could do with the CPU never in the way.
+ */
+
+typedef struct sched_span {
+	double start;
+	double end;
+	const char * name;
+	UINT frame;
+} sched_span_t;
+
+typedef struct sched_timeline {
+	/* when the queue finishes what it has been given */
+	double clock[SCHED_QUEUES];
+	/* earliest start of the next pass, raised by waits */
+	double ready[SCHED_QUEUES];
+	/* one span per signaled value, span[q][v - 1] */
+	sched_span_t * spans[SCHED_QUEUES];
+	UINT count[SCHED_QUEUES];
+	UINT capacity[SCHED_QUEUES];
+	/* tagged onto spans, set by the caller */
+	UINT frame;
+} sched_timeline_t;
+
+typedef struct sched_timeline_stats {
+	double busy[SCHED_QUEUES];
+	/* time both queues were busy */
+	double overlap;
+	double makespan;
+} sched_timeline_stats_t;
+
+static void sched_timeline_destroy(sched_timeline_t * timeline) {
+	for (UINT q = 0; q < SCHED_QUEUES; ++q) {
+		free(timeline->spans[q]);
+	}
+	*timeline = (sched_timeline_t) { 0 };
+}
+
+static int sched_timeline_wait(void * user, sched_queue_t queue, sched_queue_t signaler, UINT64 value) {
+	sched_timeline_t * timeline = user;
+	if (value > timeline->count[signaler]) {
+		/* waiting on a value nobody signaled yet would hang a real queue */
+		return 1;
+	}
+
+	double done = timeline->spans[signaler][value - 1].end;
+	if (done > timeline->ready[queue]) {
+		timeline->ready[queue] = done;
+	}
+
+	return 0;
+}
+
+static int sched_timeline_submit(void * user, sched_pass_t const * pass) {
+	sched_timeline_t * timeline = user;
+	sched_queue_t q = pass->queue;
+
+	if (timeline->count[q] == timeline->capacity[q]) {
+		UINT capacity = timeline->capacity[q] == 0 ? 64 : timeline->capacity[q] * 2;
+		sched_span_t * spans = realloc(timeline->spans[q], sizeof(sched_span_t) * capacity);
+		if (spans == NULL) {
+			return 1;
+		}
+		timeline->spans[q] = spans;
+		timeline->capacity[q] = capacity;
+	}
+
+	double start = timeline->clock[q] > timeline->ready[q] ? timeline->clock[q] : timeline->ready[q];
+	timeline->clock[q] = start + pass->cost_ms;
+	timeline->spans[q][timeline->count[q]++] = (sched_span_t) {
+		.start = start,
+		.end = start + pass->cost_ms,
+		.name = pass->name,
+		.frame = timeline->frame,
+	};
+
+	return 0;
+}
+
+/* the span was pushed by submit, the value is its index + 1 */
+static int sched_timeline_signal(void * user, sched_queue_t queue, UINT64 value) {
+	sched_timeline_t * timeline = user;
+	return value == timeline->count[queue] ? 0 : 1;
+}
+
+static sched_backend_t sched_timeline_backend(sched_timeline_t * timeline) {
+	return (sched_backend_t) {
+		.wait = sched_timeline_wait,
+		.submit = sched_timeline_submit,
+		.signal = sched_timeline_signal,
+		.user = timeline,
+	};
+}
+
+static void sched_timeline_get_stats(sched_timeline_t const * timeline, sched_timeline_stats_t * stats) {
+	*stats = (sched_timeline_stats_t) { 0 };
+
+	for (UINT q = 0; q < SCHED_QUEUES; ++q) {
+		for (UINT i = 0; i < timeline->count[q]; ++i) {
+			stats->busy[q] += timeline->spans[q][i].end - timeline->spans[q][i].start;
+		}
+		if (timeline->clock[q] > stats->makespan) {
+			stats->makespan = timeline->clock[q];
+		}
+	}
+
+	/* spans on a queue are sorted and disjoint, so a merge walk finds the intersections */
+	sched_span_t const * g = timeline->spans[SCHED_GRAPHICS];
+	sched_span_t const * c = timeline->spans[SCHED_COMPUTE];
+	UINT i = 0;
+	UINT j = 0;
+	while (i < timeline->count[SCHED_GRAPHICS] && j < timeline->count[SCHED_COMPUTE]) {
+		double start = g[i].start > c[j].start ? g[i].start : c[j].start;
+		double end = g[i].end < c[j].end ? g[i].end : c[j].end;
+		if (end > start) {
+			stats->overlap += end - start;
+		}
+
+		if (g[i].end < c[j].end) {
+			++i;
+		} else {
+			++j;
+		}
+	}
+}
+
+/* one row per queue, each column ms_per_column wide, labelled with the pass's frame number mod 10 */
+static void sched_timeline_draw(sched_timeline_t const * timeline, double ms_per_column, UINT columns, FILE * fp) {
+	char row[256];
+	if (columns > sizeof(row) - 1) {
+		columns = sizeof(row) - 1;
+	}
+
+	for (UINT q = 0; q < SCHED_QUEUES; ++q) {
+		memset(row, '.', columns);
+		row[columns] = '\0';
+
+		for (UINT i = 0; i < timeline->count[q]; ++i) {
+			sched_span_t const * span = &timeline->spans[q][i];
+			for (UINT x = (UINT) (span->start / ms_per_column); x < columns && (x + 0.5) * ms_per_column < span->end; ++x) {
+				row[x] = (char) ('0' + span->frame % 10);
+			}
+		}
+
+		fprintf(fp, "%-8s |%s|\n", sched_queue_name(q), row);
+	}
+}
+
+#endif
@@ -0,0 +1,471 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdio.h>
+#include <windows.h>
+#include "timer.h"
+
+#define JOBS_MAX_THREADS 32
+#define JOBS_QUEUE_SIZE 1024
+
+typedef void (* job_fn_t)(void * user);
+
+typedef struct job {
+	job_fn_t fn;
+	void * user;
+} job_t;
+
+/*
+ * fixed pool of worker threads pulling from one locked ring buffer.
+ * thread index 0 is whoever called jobs_init (the main thread), workers are 1..count
+ */
+struct {
+	HANDLE threads[JOBS_MAX_THREADS];
+	UINT thread_count;
+	DWORD tls;
+
+	SRWLOCK lock;
+	CONDITION_VARIABLE wake;
+	job_t queue[JOBS_QUEUE_SIZE];
+	UINT head;
+	UINT count;
+	BOOL running;
+} static jobs = {
+	.thread_count = 0,
+	.head = 0,
+	.count = 0,
+	.running = FALSE,
+};
+
+static BOOL jobs_try_pop(job_t * job) {
+	BOOL popped = FALSE;
+
+	AcquireSRWLockExclusive(&jobs.lock);
+	if (jobs.count > 0) {
+		*job = jobs.queue[jobs.head];
+		jobs.head = (jobs.head + 1) % JOBS_QUEUE_SIZE;
+		--jobs.count;
+		popped = TRUE;
+	}
+	ReleaseSRWLockExclusive(&jobs.lock);
+
+	return popped;
+}
+
+static DWORD WINAPI jobs_worker(void * param) {
+	TlsSetValue(jobs.tls, param);
+
+	for (;;) {
+		job_t job;
+
+		AcquireSRWLockExclusive(&jobs.lock);
+		while (jobs.count == 0 && jobs.running) {
+			SleepConditionVariableSRW(&jobs.wake, &jobs.lock, INFINITE, 0);
+		}
+
+		if (jobs.count == 0) {
+			ReleaseSRWLockExclusive(&jobs.lock);
+			break;
+		}
+
+		job = jobs.queue[jobs.head];
+		jobs.head = (jobs.head + 1) % JOBS_QUEUE_SIZE;
+		--jobs.count;
+		ReleaseSRWLockExclusive(&jobs.lock);
+
+		job.fn(job.user);
+	}
+
+	return 0;
+}
+
+/* count == 0 picks one worker per logical processor minus the calling thread */
+static int jobs_init(UINT count) {
+	if (jobs.running) {
+		return 0;
+	}
+
+	if (count == 0) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		count = info.dwNumberOfProcessors > 1 ? info.dwNumberOfProcessors - 1 : 1;
+	}
+
+	if (count > JOBS_MAX_THREADS) {
+		count = JOBS_MAX_THREADS;
+	}
+
+	jobs.tls = TlsAlloc();
+	if (jobs.tls == TLS_OUT_OF_INDEXES) {
+		return 1;
+	}
+	TlsSetValue(jobs.tls, (void *) 0);
+
+	InitializeSRWLock(&jobs.lock);
+	InitializeConditionVariable(&jobs.wake);
+	jobs.head = 0;
+	jobs.count = 0;
+	jobs.running = TRUE;
+
+	for (UINT i = 0; i < count; ++i) {
+		jobs.threads[i] = CreateThread(NULL, 0, jobs_worker, (void *) (UINT_PTR) (i + 1), 0, NULL);
+		if (jobs.threads[i] == NULL) {
+			break;
+		}
+		++jobs.thread_count;
+	}
+
+	return jobs.thread_count == 0 ? 2 : 0;
+}
+
+static void jobs_shutdown(void) {
+	if (!jobs.running) {
+		return;
+	}
+
+	AcquireSRWLockExclusive(&jobs.lock);
+	jobs.running = FALSE;
+	WakeAllConditionVariable(&jobs.wake);
+	ReleaseSRWLockExclusive(&jobs.lock);
+
+	for (UINT i = 0; i < jobs.thread_count; ++i) {
+		WaitForSingleObject(jobs.threads[i], INFINITE);
+		CloseHandle(jobs.threads[i]);
+		jobs.threads[i] = NULL;
+	}
+
+	jobs.thread_count = 0;
+	TlsFree(jobs.tls);
+}
+
+/* 0 on the main thread, 1..thread_count on workers */
+static UINT jobs_thread_index(void) {
+	if (jobs.thread_count == 0) {
+		return 0;
+	}
+
+	return (UINT) (UINT_PTR) TlsGetValue(jobs.tls);
+}
+
+static UINT jobs_thread_count(void) {
+	return jobs.thread_count + 1;
+}
+
+/* runs the job inline when there are no workers or the queue is full */
+static void jobs_push(job_fn_t fn, void * user) {
+	if (jobs.thread_count > 0) {
+		AcquireSRWLockExclusive(&jobs.lock);
+		if (jobs.count < JOBS_QUEUE_SIZE) {
+			jobs.queue[(jobs.head + jobs.count) % JOBS_QUEUE_SIZE] = (job_t) { fn, user };
+			++jobs.count;
+			WakeConditionVariable(&jobs.wake);
+			ReleaseSRWLockExclusive(&jobs.lock);
+			return;
+		}
+		ReleaseSRWLockExclusive(&jobs.lock);
+	}
+
+	fn(user);
+}
+
+/* helps drain the queue until *counter reaches zero */
+static void jobs_wait(volatile LONG * counter) {
+	while (ReadAcquire(counter) > 0) {
+		job_t job;
+		if (jobs_try_pop(&job)) {
+			job.fn(job.user);
+		} else {
+			SwitchToThread();
+		}
+	}
+}
+
+typedef void (* jobs_range_fn_t)(void * user, UINT begin, UINT end);
+
+typedef struct jobs_range {
+	jobs_range_fn_t fn;
+	void * user;
+	UINT begin;
+	UINT end;
+	volatile LONG * counter;
+} jobs_range_t;
+
+static void jobs_range_run(void * param) {
+	jobs_range_t * range = param;
+	range->fn(range->user, range->begin, range->end);
+	InterlockedDecrement(range->counter);
+}
+
+/* splits [0, count) into chunks of at least grain items and blocks until all chunks ran */
+static void jobs_parallel_for(UINT count, UINT grain, jobs_range_fn_t fn, void * user) {
+	jobs_range_t ranges[(JOBS_MAX_THREADS + 1) * 4];
+	UINT chunks = jobs_thread_count() * 4;
+	volatile LONG counter;
+
+	if (grain == 0) {
+		grain = 1;
+	}
+
+	if (chunks > count / grain) {
+		chunks = count / grain;
+	}
+
+	if (chunks <= 1 || jobs.thread_count == 0) {
+		if (count > 0) {
+			fn(user, 0, count);
+		}
+		return;
+	}
+
+	UINT step = (count + chunks - 1) / chunks;
+	chunks = (count + step - 1) / step;
+	counter = (LONG) chunks;
+
+	for (UINT i = 0; i < chunks; ++i) {
+		ranges[i] = (jobs_range_t) {
+			.fn = fn,
+			.user = user,
+			.begin = i * step,
+			.end = (i + 1) * step < count ? (i + 1) * step : count,
+			.counter = &counter,
+		};
+	}
+
+	/* the caller takes the first chunk itself */
+	for (UINT i = 1; i < chunks; ++i) {
+		jobs_push(jobs_range_run, &ranges[i]);
+	}
+	jobs_range_run(&ranges[0]);
+
+	jobs_wait(&counter);
+}
+
+/*
+ * dependency graph of startup steps. tasks are referenced by index, and deps is a
+ * bitmask of the indices that must have finished before a task may start.
+ * main_thread tasks only ever run on the thread that called task_graph_run
+ * (window creation and anything that may send it messages).
+ */
+#define TASK_MAX 64
+#define TASK_BIT(i) (1ull << (i))
+
+typedef int (* task_fn_t)(void);
+
+typedef struct task {
+	const char * name;
+	task_fn_t fn;
+	UINT64 deps;
+	BOOL main_thread;
+
+	/* filled in by task_graph_run */
+	int result;
+	LONGLONG start;
+	LONGLONG end;
+	UINT thread;
+	BOOL skipped;
+} task_t;
+
+typedef struct task_graph {
+	task_t * tasks;
+	UINT count;
+
+	volatile LONG64 finished;
+	volatile LONG64 scheduled;
+	volatile LONG64 main_ready;
+	volatile LONG remaining;
+	volatile LONG failed;
+	LONGLONG start;
+	LONGLONG end;
+} task_graph_t;
+
+typedef struct task_graph_job {
+	task_graph_t * graph;
+	UINT index;
+} task_graph_job_t;
+
+static task_graph_job_t task_graph_jobs[TASK_MAX];
+
+static void task_graph_run_task(void * param);
+
+/* claims and schedules every task whose deps are all finished */
+static void task_graph_schedule(task_graph_t * graph) {
+	LONG64 finished = ReadAcquire64(&graph->finished);
+
+	for (UINT i = 0; i < graph->count; ++i) {
+		task_t * task = &graph->tasks[i];
+		LONG64 bit = (LONG64) TASK_BIT(i);
+
+		if ((graph->scheduled & bit) != 0 || (task->deps & (UINT64) finished) != task->deps) {
+			continue;
+		}
+
+		if ((InterlockedOr64(&graph->scheduled, bit) & bit) != 0) {
+			continue;
+		}
+
+		if (task->main_thread) {
+			InterlockedOr64(&graph->main_ready, bit);
+		} else {
+			task_graph_jobs[i] = (task_graph_job_t) { graph, i };
+			jobs_push(task_graph_run_task, &task_graph_jobs[i]);
+		}
+	}
+}
+
+static void task_graph_run_task(void * param) {
+	task_graph_job_t * job = param;
+	task_graph_t * graph = job->graph;
+	task_t * task = &graph->tasks[job->index];
+
+	task->thread = jobs_thread_index();
+	task->start = timer_now();
+	if (ReadAcquire(&graph->failed) == 0) {
+		task->result = task->fn();
+		task->skipped = FALSE;
+		if (task->result != 0) {
+			InterlockedCompareExchange(&graph->failed, task->result, 0);
+		}
+	} else {
+		task->result = 0;
+		task->skipped = TRUE;
+	}
+	task->end = timer_now();
+
+	InterlockedOr64(&graph->finished, (LONG64) TASK_BIT(job->index));
+	task_graph_schedule(graph);
+	InterlockedDecrement(&graph->remaining);
+}
+
+/* returns the first non-zero task result, tasks after a failure are skipped */
+static int task_graph_run(task_graph_t * graph) {
+	if (graph->count > TASK_MAX) {
+		return -1;
+	}
+
+	for (UINT i = 0; i < graph->count; ++i) {
+		graph->tasks[i].result = 0;
+		graph->tasks[i].skipped = TRUE;
+	}
+
+	graph->finished = 0;
+	graph->scheduled = 0;
+	graph->main_ready = 0;
+	graph->remaining = (LONG) graph->count;
+	graph->failed = 0;
+	graph->start = timer_now();
+
+	task_graph_schedule(graph);
+
+	while (ReadAcquire(&graph->remaining) > 0) {
+		LONG64 ready = InterlockedExchange64(&graph->main_ready, 0);
+		if (ready != 0) {
+			for (UINT i = 0; i < graph->count; ++i) {
+				if ((ready & (LONG64) TASK_BIT(i)) != 0) {
+					task_graph_jobs[i] = (task_graph_job_t) { graph, i };
+					task_graph_run_task(&task_graph_jobs[i]);
+				}
+			}
+			continue;
+		}
+
+		job_t job;
+		if (jobs_try_pop(&job)) {
+			job.fn(job.user);
+		} else {
+			SwitchToThread();
+		}
+	}
+
+	graph->end = timer_now();
+	return graph->failed;
+}
+
+/* checks that no task started before all of its deps ended */
+static int task_graph_verify(task_graph_t const * graph) {
+	for (UINT i = 0; i < graph->count; ++i) {
+		task_t const * task = &graph->tasks[i];
+		if (task->skipped) {
+			continue;
+		}
+
+		for (UINT d = 0; d < graph->count; ++d) {
+			if ((task->deps & TASK_BIT(d)) == 0) {
+				continue;
+			}
+
+			if (graph->tasks[d].skipped || graph->tasks[d].end > task->start) {
+				fprintf(stderr, "startup: %s started before its dependency %s finished\n", task->name, graph->tasks[d].name);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* per-task timings plus the longest dependency chain by measured duration */
+static void task_graph_trace(task_graph_t const * graph, FILE * fp) {
+	double path[TASK_MAX];
+	int prev[TASK_MAX];
+	UINT order[TASK_MAX];
+	double serial = 0;
+
+	/* every dep started (and ended) before its dependents, so start order is a topological order */
+	for (UINT i = 0; i < graph->count; ++i) {
+		order[i] = i;
+	}
+	for (UINT i = 1; i < graph->count; ++i) {
+		UINT o = order[i];
+		UINT j = i;
+		while (j > 0 && graph->tasks[order[j - 1]].start > graph->tasks[o].start) {
+			order[j] = order[j - 1];
+			--j;
+		}
+		order[j] = o;
+	}
+
+	fprintf(fp, "startup: %-16s %10s %10s %6s\n", "step", "start ms", "took ms", "thread");
+
+	int last = -1;
+	for (UINT k = 0; k < graph->count; ++k) {
+		UINT i = order[k];
+		task_t const * task = &graph->tasks[i];
+		double took = timer_ms(task->end - task->start);
+
+		path[i] = took;
+		prev[i] = -1;
+		for (UINT d = 0; d < graph->count; ++d) {
+			if ((task->deps & TASK_BIT(d)) != 0 && path[d] + took > path[i]) {
+				path[i] = path[d] + took;
+				prev[i] = (int) d;
+			}
+		}
+
+		if (last < 0 || path[i] > path[last]) {
+			last = (int) i;
+		}
+
+		serial += took;
+		fprintf(fp, "startup: %-16s %10.3f %10.3f %6u%s\n", task->name, timer_ms(task->start - graph->start), took, task->thread, task->skipped ? " (skipped)" : "");
+	}
+
+	fprintf(fp, "startup: wall %.3f ms, serial sum %.3f ms\n", timer_ms(graph->end - graph->start), serial);
+
+	if (last < 0) {
+		return;
+	}
+
+	int chain[TASK_MAX];
+	UINT len = 0;
+	for (int i = last; i >= 0; i = prev[i]) {
+		chain[len++] = i;
+	}
+
+	fprintf(fp, "startup: critical path %.3f ms:", path[last]);
+	while (len > 0) {
+		--len;
+		fprintf(fp, " %s%s", graph->tasks[chain[len]].name, len > 0 ? " ->" : "\n");
+	}
+}
+
+#endif
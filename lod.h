@@ -0,0 +1,630 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "linmath.h"
+
+/*
+ * levels of detail for indexed triangle meshes, built offline by quadric error metric
+ * simplification and picked per draw from how large the mesh's bounding sphere is on
+ * screen.
+ *
+ * simplification collapses an edge onto one of its endpoints, so every level indexes
+ * the original vertices: the levels are ranges of one index array and a single vertex
+ * buffer, skinned or not, serves all of them. vertices at the same position are welded
+ * first, and a collapsed corner takes the attributes of the vertex it moved onto.
+ * each vertex carries the quadric of its faces' planes weighted by area, plus planes
+ * perpendicular to open edges so borders keep their shape; open edges only collapse
+ * along the border.
+ * collapses run in passes of increasing cost, each pass touching a vertex's
+ * neighbourhood at most once and skipping collapses that would flip a face.
+ *
+ * a collapse costs the mean squared distance to the planes the merged quadric holds, and
+ * a level's error is the square root of the largest cost collapsed so far, in object
+ * units. at runtime that error is projected with the sphere's scale under the
+ * mvp, and the coarsest level that stays under the pixel threshold is drawn; a level
+ * changes only once the error leaves a band around the threshold, so a mesh hovering at
+ * a boundary doesn't pop back and forth.
+ */
+
+#define LOD_MAX_LEVELS 8
+/* each level aims for this fraction of the previous one's triangles */
+#define LOD_RATIO 0.5f
+/* a level is kept only if it drops at least this fraction of the previous one's triangles */
+#define LOD_MIN_PROGRESS 0.1f
+#define LOD_BORDER_WEIGHT 10.0
+/* a collapse is rejected if it turns a face by more than about 75 degrees */
+#define LOD_FLIP_COS 0.25
+
+typedef struct lod_level {
+	UINT first_index;
+	UINT index_count;
+	/* object units, 0 for the full mesh */
+	float error;
+} lod_level_t;
+
+typedef struct lod_chain {
+	/* every level's indices, level 0 first */
+	UINT * indices;
+	UINT index_count;
+	lod_level_t levels[LOD_MAX_LEVELS];
+	UINT level_count;
+	/* the bounding sphere of the vertices, in object space */
+	float center[3];
+	float radius;
+} lod_chain_t;
+
+/* symmetric 4x4, the upper triangle row by row, and the summed weight of its planes */
+typedef struct lod_quadric {
+	double q[10];
+	double weight;
+} lod_quadric_t;
+
+static void lod_quadric_add_plane(lod_quadric_t * quadric, double a, double b, double c, double d, double weight) {
+	double p[4] = { a, b, c, d };
+	UINT k = 0;
+	for (UINT i = 0; i < 4; ++i) {
+		for (UINT j = i; j < 4; ++j) {
+			quadric->q[k++] += p[i] * p[j] * weight;
+		}
+	}
+	quadric->weight += weight;
+}
+
+/* the weighted mean squared distance from v to the planes of both quadrics */
+static double lod_quadric_error(lod_quadric_t const * a, lod_quadric_t const * b, float const * v) {
+	double p[4] = { v[0], v[1], v[2], 1 };
+	double error = 0;
+	UINT k = 0;
+	for (UINT i = 0; i < 4; ++i) {
+		for (UINT j = i; j < 4; ++j, ++k) {
+			double term = (a->q[k] + b->q[k]) * p[i] * p[j];
+			error += i == j ? term : 2 * term;
+		}
+	}
+	double weight = a->weight + b->weight;
+	return error > 0 && weight > 0 ? error / weight : 0;
+}
+
+typedef struct lod_sort_vertex {
+	float p[3];
+	UINT index;
+} lod_sort_vertex_t;
+
+static int lod_compare_vertices(void const * a, void const * b) {
+	lod_sort_vertex_t const * x = a;
+	lod_sort_vertex_t const * y = b;
+	for (UINT c = 0; c < 3; ++c) {
+		if (x->p[c] != y->p[c]) {
+			return x->p[c] < y->p[c] ? -1 : 1;
+		}
+	}
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static int lod_compare_keys(void const * a, void const * b) {
+	UINT64 x = *(UINT64 const *) a;
+	UINT64 y = *(UINT64 const *) b;
+	return x < y ? -1 : x > y;
+}
+
+typedef struct lod_collapse {
+	double cost;
+	UINT from;
+	UINT to;
+} lod_collapse_t;
+
+static int lod_compare_collapses(void const * a, void const * b) {
+	lod_collapse_t const * x = a;
+	lod_collapse_t const * y = b;
+	if (x->cost != y->cost) {
+		return x->cost < y->cost ? -1 : 1;
+	}
+	return x->from < y->from ? -1 : x->from > y->from;
+}
+
+/* the simplifier's working state, over welded vertex ids */
+typedef struct lod_simplifier {
+	UINT vertex_count;
+	float (* positions)[3];
+	/* the vertex each one is welded to, and the one it was collapsed onto */
+	UINT * weld;
+	UINT * remap;
+	lod_quadric_t * quadrics;
+	BYTE * border;
+	BYTE * locked;
+
+	/* the current triangles, three welded ids each */
+	UINT * triangles;
+	UINT triangle_count;
+
+	/* vertex to triangle adjacency of the current triangles */
+	UINT * adjacency_offsets;
+	UINT * adjacency;
+
+	UINT64 * edges;
+	lod_collapse_t * collapses;
+
+	double max_cost;
+} lod_simplifier_t;
+
+static void lod_simplifier_free(lod_simplifier_t * s) {
+	free(s->positions);
+	free(s->weld);
+	free(s->remap);
+	free(s->quadrics);
+	free(s->border);
+	free(s->locked);
+	free(s->triangles);
+	free(s->adjacency_offsets);
+	free(s->adjacency);
+	free(s->edges);
+	free(s->collapses);
+}
+
+static UINT lod_find(lod_simplifier_t * s, UINT v) {
+	while (s->remap[v] != v) {
+		s->remap[v] = s->remap[s->remap[v]];
+		v = s->remap[v];
+	}
+	return v;
+}
+
+static void lod_build_adjacency(lod_simplifier_t * s) {
+	memset(s->adjacency_offsets, 0, sizeof(UINT) * (s->vertex_count + 1));
+	for (UINT i = 0; i < s->triangle_count * 3; ++i) {
+		++s->adjacency_offsets[s->triangles[i] + 1];
+	}
+	for (UINT v = 0; v < s->vertex_count; ++v) {
+		s->adjacency_offsets[v + 1] += s->adjacency_offsets[v];
+	}
+	/* filled through the offsets, then shifted back */
+	for (UINT i = 0; i < s->triangle_count * 3; ++i) {
+		s->adjacency[s->adjacency_offsets[s->triangles[i]]++] = i / 3;
+	}
+	for (UINT v = s->vertex_count; v > 0; --v) {
+		s->adjacency_offsets[v] = s->adjacency_offsets[v - 1];
+	}
+	s->adjacency_offsets[0] = 0;
+}
+
+static void lod_normal(float const * a, float const * b, float const * c, double * n) {
+	double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+/* whether moving `from` onto `to` keeps every face around `from` that survives facing the same way */
+static BOOL lod_collapse_keeps_faces(lod_simplifier_t const * s, UINT from, UINT to) {
+	for (UINT a = s->adjacency_offsets[from]; a < s->adjacency_offsets[from + 1]; ++a) {
+		UINT const * t = &s->triangles[s->adjacency[a] * 3];
+		if (t[0] == to || t[1] == to || t[2] == to) {
+			continue;
+		}
+
+		float const * p[3];
+		float const * q[3];
+		for (UINT k = 0; k < 3; ++k) {
+			p[k] = s->positions[t[k]];
+			q[k] = t[k] == from ? s->positions[to] : p[k];
+		}
+		double before[3], after[3];
+		lod_normal(p[0], p[1], p[2], before);
+		lod_normal(q[0], q[1], q[2], after);
+		double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+		double lengths = sqrt(before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) * sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+		if (lengths == 0 || dot < LOD_FLIP_COS * lengths) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/* marks the vertices on open edges, edges is sorted by the caller */
+static void lod_find_borders(lod_simplifier_t * s, UINT edge_count) {
+	memset(s->border, 0, s->vertex_count);
+	for (UINT e = 0; e < edge_count; ) {
+		UINT run = 1;
+		while (e + run < edge_count && s->edges[e + run] == s->edges[e]) {
+			++run;
+		}
+		if (run == 1) {
+			UINT a = (UINT) (s->edges[e] >> 32);
+			UINT b = (UINT) s->edges[e];
+			s->border[a] = s->border[b] = 1;
+		}
+		e += run;
+	}
+}
+
+/*
+ * one pass of collapses in order of cost, until the triangle count reaches target.
+ * returns the number of collapses made.
+ */
+static UINT lod_pass(lod_simplifier_t * s, UINT target, BOOL add_border_planes) {
+	lod_build_adjacency(s);
+
+	/* every edge once, the smaller id in the high half; an edge seen once is open */
+	UINT edge_count = 0;
+	for (UINT t = 0; t < s->triangle_count; ++t) {
+		for (UINT k = 0; k < 3; ++k) {
+			UINT a = s->triangles[t * 3 + k];
+			UINT b = s->triangles[t * 3 + (k + 1) % 3];
+			UINT lo = a < b ? a : b, hi = a < b ? b : a;
+			s->edges[edge_count++] = (UINT64) lo << 32 | hi;
+		}
+	}
+	qsort(s->edges, edge_count, sizeof(UINT64), lod_compare_keys);
+	lod_find_borders(s, edge_count);
+
+	if (add_border_planes) {
+		for (UINT t = 0; t < s->triangle_count; ++t) {
+			UINT const * tri = &s->triangles[t * 3];
+			double n[3];
+			lod_normal(s->positions[tri[0]], s->positions[tri[1]], s->positions[tri[2]], n);
+			for (UINT k = 0; k < 3; ++k) {
+				UINT a = tri[k], b = tri[(k + 1) % 3];
+				if (!s->border[a] || !s->border[b]) {
+					continue;
+				}
+				UINT64 key = (UINT64) (a < b ? a : b) << 32 | (a < b ? b : a);
+				UINT64 const * found = bsearch(&key, s->edges, edge_count, sizeof(UINT64), lod_compare_keys);
+				UINT64 const * last = s->edges + edge_count;
+				BOOL open = found != NULL && (found == s->edges || found[-1] != key) && (found + 1 == last || found[1] != key);
+				if (!open) {
+					continue;
+				}
+
+				/* the plane through the edge, perpendicular to the face */
+				float const * pa = s->positions[a];
+				float const * pb = s->positions[b];
+				double e[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+				double p[3] = { e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0] };
+				double length = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+				double edge_squared = e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+				if (length == 0) {
+					continue;
+				}
+				p[0] /= length;
+				p[1] /= length;
+				p[2] /= length;
+				double d = -(p[0] * pa[0] + p[1] * pa[1] + p[2] * pa[2]);
+				lod_quadric_add_plane(&s->quadrics[a], p[0], p[1], p[2], d, edge_squared * LOD_BORDER_WEIGHT);
+				lod_quadric_add_plane(&s->quadrics[b], p[0], p[1], p[2], d, edge_squared * LOD_BORDER_WEIGHT);
+			}
+		}
+	}
+
+	/* both directions of every edge that may collapse; border vertices stay on the border */
+	UINT collapse_count = 0;
+	for (UINT e = 0; e < edge_count; ) {
+		UINT run = 1;
+		while (e + run < edge_count && s->edges[e + run] == s->edges[e]) {
+			++run;
+		}
+		UINT a = (UINT) (s->edges[e] >> 32);
+		UINT b = (UINT) s->edges[e];
+		BOOL open = run == 1;
+		for (UINT dir = 0; dir < 2; ++dir) {
+			UINT from = dir == 0 ? a : b;
+			UINT to = dir == 0 ? b : a;
+			if (s->border[from] && !open) {
+				continue;
+			}
+			s->collapses[collapse_count++] = (lod_collapse_t) {
+				.cost = lod_quadric_error(&s->quadrics[from], &s->quadrics[to], s->positions[to]),
+				.from = from,
+				.to = to,
+			};
+		}
+		e += run;
+	}
+	qsort(s->collapses, collapse_count, sizeof(lod_collapse_t), lod_compare_collapses);
+
+	memset(s->locked, 0, s->vertex_count);
+	UINT remaining = s->triangle_count;
+	UINT collapsed = 0;
+	for (UINT c = 0; c < collapse_count && remaining > target; ++c) {
+		lod_collapse_t const * collapse = &s->collapses[c];
+		UINT from = collapse->from, to = collapse->to;
+		if (s->locked[from] || s->locked[to] || !lod_collapse_keeps_faces(s, from, to)) {
+			continue;
+		}
+
+		UINT removed = 0;
+		for (UINT a = s->adjacency_offsets[from]; a < s->adjacency_offsets[from + 1]; ++a) {
+			UINT const * t = &s->triangles[s->adjacency[a] * 3];
+			removed += t[0] == to || t[1] == to || t[2] == to;
+		}
+		if (removed >= remaining) {
+			continue;
+		}
+
+		/* the neighbourhoods are final for this pass, later collapses would see stale faces */
+		for (UINT v = 0; v < 2; ++v) {
+			UINT center = v == 0 ? from : to;
+			for (UINT a = s->adjacency_offsets[center]; a < s->adjacency_offsets[center + 1]; ++a) {
+				UINT const * t = &s->triangles[s->adjacency[a] * 3];
+				s->locked[t[0]] = s->locked[t[1]] = s->locked[t[2]] = 1;
+			}
+		}
+
+		s->remap[from] = to;
+		for (UINT k = 0; k < 10; ++k) {
+			s->quadrics[to].q[k] += s->quadrics[from].q[k];
+		}
+		s->quadrics[to].weight += s->quadrics[from].weight;
+		if (collapse->cost > s->max_cost) {
+			s->max_cost = collapse->cost;
+		}
+		remaining -= removed;
+		++collapsed;
+	}
+
+	/* moves the corners and drops the faces that lost an edge */
+	UINT kept = 0;
+	for (UINT t = 0; t < s->triangle_count; ++t) {
+		UINT a = lod_find(s, s->triangles[t * 3 + 0]);
+		UINT b = lod_find(s, s->triangles[t * 3 + 1]);
+		UINT c = lod_find(s, s->triangles[t * 3 + 2]);
+		if (a == b || b == c || c == a) {
+			continue;
+		}
+		s->triangles[kept * 3 + 0] = a;
+		s->triangles[kept * 3 + 1] = b;
+		s->triangles[kept * 3 + 2] = c;
+		++kept;
+	}
+	s->triangle_count = kept;
+	return collapsed;
+}
+
+static void lod_destroy(lod_chain_t * chain) {
+	free(chain->indices);
+	memset(chain, 0, sizeof(*chain));
+}
+
+/*
+ * builds the chain for triangle_count triangles of indices into vertex_count positions
+ * `stride` bytes apart. levels stop at LOD_MAX_LEVELS, at min_triangles, or when the
+ * simplifier stops making progress. non-zero when out of memory or the input is empty.
+ */
+static int lod_build(lod_chain_t * chain, float const * positions, UINT stride, UINT vertex_count, UINT const * indices, UINT triangle_count, UINT min_triangles) {
+	memset(chain, 0, sizeof(*chain));
+	if (vertex_count == 0 || triangle_count == 0) {
+		return 1;
+	}
+
+	lod_simplifier_t s = { .vertex_count = vertex_count };
+	s.positions = malloc(sizeof(float) * 3 * vertex_count);
+	s.weld = malloc(sizeof(UINT) * vertex_count);
+	s.remap = malloc(sizeof(UINT) * vertex_count);
+	s.quadrics = calloc(vertex_count, sizeof(lod_quadric_t));
+	s.border = malloc(vertex_count);
+	s.locked = malloc(vertex_count);
+	s.triangles = malloc(sizeof(UINT) * 3 * triangle_count);
+	s.adjacency_offsets = malloc(sizeof(UINT) * (vertex_count + 1));
+	s.adjacency = malloc(sizeof(UINT) * 3 * triangle_count);
+	s.edges = malloc(sizeof(UINT64) * 3 * triangle_count);
+	s.collapses = malloc(sizeof(lod_collapse_t) * 6 * triangle_count);
+	lod_sort_vertex_t * sorted = malloc(sizeof(lod_sort_vertex_t) * vertex_count);
+	/* no level is larger than the mesh */
+	chain->indices = malloc(sizeof(UINT) * 3 * triangle_count * LOD_MAX_LEVELS);
+	if (s.positions == NULL || s.weld == NULL || s.remap == NULL || s.quadrics == NULL || s.border == NULL || s.locked == NULL || s.triangles == NULL || s.adjacency_offsets == NULL || s.adjacency == NULL || s.edges == NULL || s.collapses == NULL || sorted == NULL || chain->indices == NULL) {
+		free(sorted);
+		lod_simplifier_free(&s);
+		lod_destroy(chain);
+		return 1;
+	}
+
+	for (UINT v = 0; v < vertex_count; ++v) {
+		float const * p = (float const *) ((BYTE const *) positions + (SIZE_T) v * stride);
+		memcpy(s.positions[v], p, sizeof(float) * 3);
+		memcpy(sorted[v].p, p, sizeof(float) * 3);
+		sorted[v].index = v;
+		s.remap[v] = v;
+	}
+	qsort(sorted, vertex_count, sizeof(lod_sort_vertex_t), lod_compare_vertices);
+	for (UINT i = 0; i < vertex_count; ++i) {
+		BOOL same = i > 0 && memcmp(sorted[i].p, sorted[i - 1].p, sizeof(sorted[i].p)) == 0;
+		s.weld[sorted[i].index] = same ? s.weld[sorted[i - 1].index] : sorted[i].index;
+	}
+
+	/* the bounding sphere around the box's center */
+	float min[3], max[3];
+	memcpy(min, s.positions[0], sizeof(min));
+	memcpy(max, s.positions[0], sizeof(max));
+	for (UINT v = 1; v < vertex_count; ++v) {
+		for (UINT c = 0; c < 3; ++c) {
+			min[c] = s.positions[v][c] < min[c] ? s.positions[v][c] : min[c];
+			max[c] = s.positions[v][c] > max[c] ? s.positions[v][c] : max[c];
+		}
+	}
+	float radius = 0;
+	for (UINT c = 0; c < 3; ++c) {
+		chain->center[c] = (min[c] + max[c]) * 0.5f;
+	}
+	for (UINT v = 0; v < vertex_count; ++v) {
+		float d[3] = { s.positions[v][0] - chain->center[0], s.positions[v][1] - chain->center[1], s.positions[v][2] - chain->center[2] };
+		float r = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		radius = r > radius ? r : radius;
+	}
+	chain->radius = radius;
+
+	/* faces that weld to a point or a line carry no plane and are dropped */
+	for (UINT t = 0; t < triangle_count; ++t) {
+		UINT a = s.weld[indices[t * 3 + 0]], b = s.weld[indices[t * 3 + 1]], c = s.weld[indices[t * 3 + 2]];
+		if (a == b || b == c || c == a) {
+			continue;
+		}
+		s.triangles[s.triangle_count * 3 + 0] = a;
+		s.triangles[s.triangle_count * 3 + 1] = b;
+		s.triangles[s.triangle_count * 3 + 2] = c;
+		++s.triangle_count;
+
+		double n[3];
+		lod_normal(s.positions[a], s.positions[b], s.positions[c], n);
+		double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length == 0) {
+			continue;
+		}
+		double d = -(n[0] * s.positions[a][0] + n[1] * s.positions[a][1] + n[2] * s.positions[a][2]) / length;
+		for (UINT k = 0; k < 3; ++k) {
+			UINT v = s.triangles[(s.triangle_count - 1) * 3 + k];
+			lod_quadric_add_plane(&s.quadrics[v], n[0] / length, n[1] / length, n[2] / length, d, length * 0.5);
+		}
+	}
+	free(sorted);
+
+	memcpy(chain->indices, indices, sizeof(UINT) * 3 * triangle_count);
+	chain->levels[0] = (lod_level_t) { 0, triangle_count * 3, 0 };
+	chain->index_count = triangle_count * 3;
+	chain->level_count = 1;
+
+	BOOL first_pass = TRUE;
+	while (chain->level_count < LOD_MAX_LEVELS && s.triangle_count > min_triangles) {
+		UINT previous = s.triangle_count;
+		UINT target = (UINT) ((float) previous * LOD_RATIO);
+		target = target > min_triangles ? target : min_triangles;
+		while (s.triangle_count > target && lod_pass(&s, target, first_pass) > 0) {
+			first_pass = FALSE;
+		}
+		first_pass = FALSE;
+		if ((float) (previous - s.triangle_count) < (float) previous * LOD_MIN_PROGRESS) {
+			break;
+		}
+
+		/* corners that didn't move keep their own vertex, and with it their attributes */
+		lod_level_t * level = &chain->levels[chain->level_count++];
+		level->first_index = chain->index_count;
+		for (UINT t = 0; t < triangle_count; ++t) {
+			UINT corner[3];
+			UINT welded[3];
+			for (UINT k = 0; k < 3; ++k) {
+				UINT original = indices[t * 3 + k];
+				welded[k] = lod_find(&s, s.weld[original]);
+				corner[k] = welded[k] == s.weld[original] ? original : welded[k];
+			}
+			if (welded[0] == welded[1] || welded[1] == welded[2] || welded[2] == welded[0]) {
+				continue;
+			}
+			memcpy(chain->indices + chain->index_count, corner, sizeof(corner));
+			chain->index_count += 3;
+		}
+		level->index_count = chain->index_count - level->first_index;
+		level->error = (float) sqrt(s.max_cost);
+	}
+
+	lod_simplifier_free(&s);
+	return 0;
+}
+
+typedef struct lod_stats {
+	UINT64 frames;
+	UINT64 draws;
+	/* triangles of the levels drawn, and of level 0 for the same draws */
+	UINT64 triangles;
+	UINT64 full_triangles;
+	UINT64 switches;
+	UINT64 levels[LOD_MAX_LEVELS];
+} lod_stats_t;
+
+typedef struct lod_selector {
+	/* the projected error a level may have, in pixels */
+	float threshold;
+	/* the band around the threshold, as a fraction of it */
+	float hysteresis;
+	/* level 0 always, still counting what the levels would have saved */
+	BOOL disabled;
+	lod_stats_t stats;
+} lod_selector_t;
+
+/*
+ * pixels one object unit at the chain's center covers under mvp, from the lengths of
+ * mvp's x and y rows; 0 when the sphere reaches the eye plane and nothing but the full
+ * mesh will do
+ */
+static float lod_pixels_per_unit(lod_chain_t const * chain, mat4x4 const mvp, UINT width, UINT height) {
+	float w = mvp[3][3];
+	for (UINT c = 0; c < 3; ++c) {
+		w += mvp[c][3] * chain->center[c];
+	}
+	float sx = sqrtf(mvp[0][0] * mvp[0][0] + mvp[1][0] * mvp[1][0] + mvp[2][0] * mvp[2][0]) * (float) width * 0.5f;
+	float sy = sqrtf(mvp[0][1] * mvp[0][1] + mvp[1][1] * mvp[1][1] + mvp[2][1] * mvp[2][1]) * (float) height * 0.5f;
+	float scale = sx > sy ? sx : sy;
+	/* the row of w scales the radius too */
+	float sw = sqrtf(mvp[0][3] * mvp[0][3] + mvp[1][3] * mvp[1][3] + mvp[2][3] * mvp[2][3]);
+	if (w <= chain->radius * sw) {
+		return 0;
+	}
+	return scale / w;
+}
+
+/* the coarsest level whose error stays under `pixels` at this scale */
+static UINT lod_coarsest_under(lod_chain_t const * chain, float pixels_per_unit, float pixels) {
+	UINT level = 0;
+	while (level + 1 < chain->level_count && chain->levels[level + 1].error * pixels_per_unit <= pixels) {
+		++level;
+	}
+	return level;
+}
+
+/*
+ * picks the level for one draw given the level it drew last, which it updates, and
+ * returns it. a draw moves to a coarser level once that level is well under the
+ * threshold and back to a finer one once the current level is well over it.
+ */
+static UINT lod_select(lod_selector_t * lod, lod_chain_t const * chain, mat4x4 const mvp, UINT width, UINT height, UINT * current) {
+	UINT level = *current < chain->level_count ? *current : chain->level_count - 1;
+	float scale = lod_pixels_per_unit(chain, mvp, width, height);
+	if (scale == 0 || lod->disabled) {
+		level = 0;
+	} else {
+		UINT coarser = lod_coarsest_under(chain, scale, lod->threshold * (1 - lod->hysteresis));
+		UINT finer = lod_coarsest_under(chain, scale, lod->threshold * (1 + lod->hysteresis));
+		if (level < coarser) {
+			level = coarser;
+		} else if (level > finer) {
+			level = finer;
+		}
+	}
+
+	lod_stats_t * st = &lod->stats;
+	st->switches += level != *current;
+	++st->draws;
+	++st->levels[level];
+	st->triangles += chain->levels[level].index_count / 3;
+	st->full_triangles += chain->levels[0].index_count / 3;
+	*current = level;
+	return level;
+}
+
+static void lod_frame(lod_selector_t * lod) {
+	++lod->stats.frames;
+}
+
+static void lod_chain_report(lod_chain_t const * chain, char const * name, FILE * fp) {
+	fprintf(fp, "lod: %s, %u levels:", name, chain->level_count);
+	for (UINT l = 0; l < chain->level_count; ++l) {
+		fprintf(fp, " %u (%.3g)", chain->levels[l].index_count / 3, chain->levels[l].error);
+	}
+	fprintf(fp, " triangles (error)\n");
+}
+
+static void lod_report(lod_selector_t const * lod, FILE * fp) {
+	lod_stats_t const * st = &lod->stats;
+	if (st->frames == 0) {
+		return;
+	}
+
+	double frames = (double) st->frames;
+	fprintf(fp, "lod: %s, %.0f triangles per frame against %.0f at full detail (%.1f%%), %.1f draws and %.2f level switches per frame, threshold %.2f px\n", lod->disabled ? "off" : "on", (double) st->triangles / frames, (double) st->full_triangles / frames, st->full_triangles != 0 ? 100.0 * (double) st->triangles / (double) st->full_triangles : 100.0, (double) st->draws / frames, (double) st->switches / frames, lod->threshold);
+}
+
+#endif
@@ -6,6 +6,85 @@
 #include <dxgidebug.h>
 #include <windows.h>
 #include "linmath.h"
+#include "vertex.h"
+#include "timer.h"
+#include "jobs.h"
+#include "release.h"
+#include "gpumem.h"
+#include "vshade.h"
+#include "precull.h"
+#include "draworder.h"
+#include "overdraw.h"
+#include "scene.h"
+#include "skin.h"
+#include "bundle.h"
+#include "gpusched.h"
+#include "particles.h"
+#include "arena.h"
+#include "drawqueue.h"
+#include "psocache.h"
+#include "trace.h"
+#include "present.h"
+#include "adapter.h"
+#include "viewport.h"
+#include "bc.h"
+#include "stream.h"
+#include "lod.h"
+#include "meshlet.h"
+#include "occlusion.h"
+#include "bvh.h"
+
+/* depth-tested for opaque geometry, the other one matches the original depthless pipeline */
+enum {
+	PSO_DEPTH,
+	PSO_NO_DEPTH,
+	PSO_COUNT,
+};
+
+/* the compute queue skins into one buffer while the other may still be drawn from */
+#define SKIN_BUFFERS 2
+#define PALETTE_SLOT_SIZE (sizeof(mat4x4) * SKIN_MAX_JOINTS)
+
+/* each frame's particle update reads one buffer and appends the survivors to the other */
+#define PARTICLES_MAX (1u << 20)
+#define PARTICLE_BUFFERS 2
+/* the particle counts of both buffers, then the D3D12_DRAW_ARGUMENTS cs_particles_args writes */
+#define PARTICLE_STATE_SIZE 32
+#define PARTICLE_ARGS_OFFSET 16
+
+enum {
+	PARTICLE_SHADER_UPDATE,
+	PARTICLE_SHADER_EMIT,
+	PARTICLE_SHADER_ARGS,
+	PARTICLE_SHADER_VS,
+	/* the mesh's pixel shader samples a texture the particles don't have */
+	PARTICLE_SHADER_PS,
+	PARTICLE_SHADERS,
+};
+
+/* resources the scheduler tracks between the queues */
+enum {
+	RESOURCE_SKINNED,
+	RESOURCE_PARTICLES = RESOURCE_SKINNED + SKIN_BUFFERS,
+	/* the live count and the indirect draw's arguments, single-buffered */
+	RESOURCE_PARTICLE_STATE = RESOURCE_PARTICLES + PARTICLE_BUFFERS,
+	RESOURCE_BACKBUFFER,
+};
+
+/* a viewport's API objects: a swapchain's buffers for windows, plain textures for headless targets */
+typedef struct d3d_viewport {
+	HWND hwnd;
+	IDXGISwapChain3 * swapchain;
+	ID3D12Resource * buffers[VIEWPORT_FRAMES];
+	ID3D12CommandAllocator * allocators[VIEWPORT_FRAMES];
+	ID3D12GraphicsCommandList * list;
+} d3d_viewport_t;
+
+/* what a scheduler pass hands to ExecuteCommandLists in one call */
+typedef struct cmdlist_batch {
+	ID3D12CommandList * lists[1 + VIEWPORT_MAX];
+	UINT count;
+} cmdlist_batch_t;
 
 struct {
 	HWND hwnd;
@@ -22,27 +101,196 @@ struct {
 	ID3D12CommandQueue * cmdqueue;
 	ID3D12CommandAllocator * cmdallocator;
 	ID3D12GraphicsCommandList * cmdlist;
+	ID3D12CommandQueue * computequeue;
+	ID3D12CommandAllocator * computeallocator;
+	ID3D12GraphicsCommandList * computelist;
 	ID3D12DescriptorHeap * rtvheap;
+	ID3D12DescriptorHeap * dsvheap;
+	ID3D12Resource * depthbuffer;
 	ID3D12Resource * cbo;
 	void * cbvdata;
 	ID3D12RootSignature * root_sig;
-	ID3D12PipelineState * pso;
-	ID3D12Resource * vbo;
+	ID3D12PipelineState * pso[PSO_COUNT];
+	ID3D12RootSignature * compute_root_sig;
+	ID3D12PipelineState * skin_pso;
+	/* bind-pose vertices and palette slots the skinning pass reads, the buffers it writes */
+	ID3D12Resource * skin_in;
+	ID3D12Resource * palette_buf;
+	BYTE * palettedata;
+	ID3D12Resource * skin_out[SKIN_BUFFERS];
+	UINT skin_slot;
+	/* points at the skin_out buffer of the frame being drawn */
 	D3D12_VERTEX_BUFFER_VIEW vbo_view;
+	ID3D12Resource * ibo;
+	D3D12_INDEX_BUFFER_VIEW ibo_view;
+	UINT * ibodata;
 	ID3D12Fence * fence;
 	UINT64 fence_value;
 	HANDLE fence_event;
 
+	/* one fence per queue, signaled and waited on by the scheduler */
+	ID3D12Fence * queue_fence[SCHED_QUEUES];
+	sched_t sched;
+
 	ID3D12Resource * framebuffers[2];
 
 	UINT rtvsize;
 
+	gpumem_t upload;
+	UINT cbo_alloc;
+	UINT skin_in_alloc;
+	UINT palette_alloc;
+	UINT ibo_alloc;
+
 	mat4x4 mvp;
 
+	/* the view is the root, the mesh hangs off it; mvp is the mesh's world matrix */
+	scene_t scene;
+	UINT view_node;
+	UINT mesh_node;
+
+	/* the mesh is skinned on the compute queue for drawing and on the CPU for culling */
+	skin_xform_t pose[1];
+	skin_palette_t palette;
+	vertex_t skinned[3];
+	float anim_time;
+
+	/* clip-space copy of the mesh and the triangles that survive pre-culling */
+	vshade_out_t clip;
+	precull_t cull;
+	UINT index_count;
+	UINT culled[3];
+
+	/* the mesh's levels of detail and the one it drew last; -nolod keeps level 0, -lodpixels sets the threshold */
+	lod_chain_t mesh_lods;
+	lod_selector_t lod;
+	UINT mesh_lod;
+
+	/* clusters of every level, culled as a whole ahead of pre-culling; -nomeshlets skips them */
+	meshlet_mesh_t mesh_meshlets[LOD_MAX_LEVELS];
+	meshlet_culler_t meshlet_cull;
+	BOOL use_meshlets;
+	UINT clustered[3];
+
+	/* -occlusion: the pre-culled mesh goes into a CPU depth buffer and draws hidden behind it are dropped */
+	BOOL use_occlusion;
+	occlusion_t occlusion;
+
+	/* object-space bounds of every draw, indexed so the frustum query skips what it can't see */
+	bvh_t draw_bvh;
+	float draw_boxes[6];
+	UINT draw_visible[1];
+
+	/* -overdraw: shade counts of every frame's draws, rasterized on the CPU */
+	BOOL measure_overdraw;
+	overdraw_t overdraw;
+
+	/* the static part of the frame is replayed from a cached bundle unless -nobundles */
+	BOOL use_bundles;
+	bundle_cache_t bundles;
+	double record_ms;
+	UINT recorded_frames;
+
+	/* simulated by the cs_particles_* shaders, or on the worker pool and uploaded with -cpuparticles */
+	BOOL cpu_particles;
+	particles_t particles;
+	particles_params_t particle_params;
+	ID3D12RootSignature * particle_compute_sig;
+	ID3D12RootSignature * particle_draw_sig;
+	ID3D12PipelineState * particle_pso[PARTICLE_SHADER_VS];
+	ID3D12PipelineState * particle_draw_pso;
+	ID3D12CommandSignature * particle_cmdsig;
+	ID3D12Resource * particle_buf[PARTICLE_BUFFERS];
+	ID3D12Resource * particle_state;
+	ID3D12Resource * particle_upload;
+	particle_gpu_t * particle_uploaddata;
+	UINT particle_slot;
+	/* timestamps around the particle dispatches and the count they left, read back after the frame */
+	ID3D12QueryHeap * particle_queries;
+	ID3D12Resource * particle_readback;
+	UINT64 * particle_readbackdata;
+	UINT64 compute_frequency;
+	double particle_ms;
+	double particle_alive;
+	UINT particle_frames;
+
+	/* transient per-frame CPU data, rewound when the frame's fence completes */
+	arena_t arena;
+
+	/* the frame's draws as sort-keyed packets; translation is counted when a sequence is recorded */
+	draw_queue_t draw_queue;
+	draw_queue_stats_t translated;
+
+	/* owns every graphics pipeline; pso[] and particle_draw_pso point into it */
+	pso_cache_t psos;
+
+	/* -trace writes the zones still in the rings at exit, F12 writes them on demand */
+	BOOL trace_at_exit;
+	BOOL trace_requested;
+	/* D packs state.upload at the top of the next frame */
+	BOOL defrag_requested;
+
+	/* -present picks the mode, F5 cycles through them; -latency is the waitable queue depth */
+	present_t present;
+	present_mode_t present_mode;
+	UINT max_latency;
+	BOOL tearing;
+	HANDLE latency_object;
+
+	/* -warp skips the hardware adapters, -software lets software ones compete, -lowpower prefers integrated */
+	BOOL force_warp;
+	BOOL allow_software;
+	BOOL low_power;
+
+	/* -windows and -viewports add windows and headless targets drawn next to the main window */
+	UINT window_viewports;
+	UINT headless_viewports;
+	viewport_set_t viewports;
+	d3d_viewport_t viewport_targets[VIEWPORT_MAX];
+	ID3D12DescriptorHeap * viewport_rtvheap;
+	/* the mesh pipeline without depth, viewports have no depth buffer */
+	ID3D12PipelineState * viewport_pso;
+	/* the frame's sequence while the viewports record */
+	struct draw_sequence const * viewport_sequence;
+
+	/* -texpack names the container, written with generated textures if it isn't there; -texbudget is in MiB */
+	char const * pack_path;
+	UINT64 texture_budget;
+	/* what the container is written in; -texformat or -texquality rewrites it at startup */
+	UINT texture_format;
+	bc_quality_t texture_quality;
+	BOOL texture_reencode;
+	HANDLE pack_file;
+	HANDLE pack_mapping;
+	void const * pack_view;
+	stream_pack_t pack;
+	stream_t stream;
+	ID3D12Resource * textures[STREAM_MAX_TEXTURES];
+	/* the finest mip each resource holds */
+	UINT texture_first[STREAM_MAX_TEXTURES];
+	/* STREAM_SLOTS upload slots, persistently mapped */
+	ID3D12Resource * stream_staging;
+	BYTE * stream_staging_data;
+	/* shader visible, an SRV per texture */
+	ID3D12DescriptorHeap * srvheap;
+	UINT srvsize;
+	/* the texture on the mesh, T cycles through the container */
+	UINT texture_index;
+
 	struct {
-		IUnknown *** ptrs;
-		UINT count;
-	} inited;
+		char * src;
+		SIZE_T len;
+		ID3DBlob * vs;
+		ID3DBlob * ps;
+		ID3DBlob * cs;
+		com_handle_t vs_handle;
+		com_handle_t ps_handle;
+		com_handle_t cs_handle;
+		ID3DBlob * particles[PARTICLE_SHADERS];
+		com_handle_t particle_handles[PARTICLE_SHADERS];
+	} shader;
+
+	LONGLONG startup;
 } static state = {
 	.width = 800,
 	.height = 600,
@@ -58,31 +306,188 @@ struct {
 	.cmdqueue = NULL,
 	.cmdallocator = NULL,
 	.cmdlist = NULL,
+	.computequeue = NULL,
+	.computeallocator = NULL,
+	.computelist = NULL,
 	.rtvheap = NULL,
+	.dsvheap = NULL,
+	.depthbuffer = NULL,
 	.cbvdata = NULL,
 	.cbo = NULL,
 	.root_sig = NULL,
-	.pso = NULL,
-	.vbo = NULL,
+	.pso = { NULL, NULL },
+	.compute_root_sig = NULL,
+	.skin_pso = NULL,
+	.skin_in = NULL,
+	.palette_buf = NULL,
+	.palettedata = NULL,
+	.skin_out = { NULL, NULL },
+	.skin_slot = 0,
 	.vbo_view = {
 		.BufferLocation = 0,
 		.SizeInBytes = 0,
 		.StrideInBytes = 0,
 	},
+	.ibo = NULL,
+	.ibo_view = {
+		.BufferLocation = 0,
+		.SizeInBytes = 0,
+		.Format = DXGI_FORMAT_R32_UINT,
+	},
+	.ibodata = NULL,
 	.fence = NULL,
 	.fence_value = 0,
 	.fence_event = NULL,
-	
+
+	.queue_fence = { NULL, NULL },
+	.sched = { 0 },
+
 	.framebuffers = { NULL, NULL },
-	
+
 	.rtvsize = 0,
 
+	.cbo_alloc = GPUMEM_NONE,
+	.skin_in_alloc = GPUMEM_NONE,
+	.palette_alloc = GPUMEM_NONE,
+	.ibo_alloc = GPUMEM_NONE,
+
 	.mvp = {
 		1, 0, 0, 0,
 		0, 1, 0, 0,
 		0, 0, 1, 0,
 		0, 0, 0, 1,
 	},
+
+	.anim_time = 0,
+
+	.scene = { 0 },
+	.view_node = SCENE_NONE,
+	.mesh_node = SCENE_NONE,
+
+	.clip = { 0 },
+	.index_count = 0,
+
+	.mesh_lods = { 0 },
+	.lod = {
+		.threshold = 1.0f,
+		.hysteresis = 0.2f,
+		.disabled = FALSE,
+	},
+	.mesh_lod = 0,
+
+	.mesh_meshlets = { { 0 } },
+	.meshlet_cull = { 0 },
+	.use_meshlets = TRUE,
+
+	.use_occlusion = FALSE,
+	.occlusion = { 0 },
+
+	.draw_bvh = { 0 },
+	.draw_boxes = { 0 },
+	.draw_visible = { 0 },
+
+	.measure_overdraw = FALSE,
+	.overdraw = { 0 },
+
+	.use_bundles = TRUE,
+	.bundles = { 0 },
+	.record_ms = 0,
+	.recorded_frames = 0,
+
+	.cpu_particles = FALSE,
+	.particles = { 0 },
+	/* about a million alive once emission and expiry balance */
+	.particle_params = {
+		.origin = { 0, -1, 0 },
+		.dt = 1.0f / 60.0f,
+		.gravity = -1.5f,
+		.damping = 0.995f,
+		.spread = 0.4f,
+		.speed = 2.5f,
+		.life_min = 1,
+		.life_max = 3,
+		.emit = PARTICLES_MAX / 128,
+		.seed = 0,
+	},
+	.particle_compute_sig = NULL,
+	.particle_draw_sig = NULL,
+	.particle_pso = { NULL, NULL, NULL },
+	.particle_draw_pso = NULL,
+	.particle_cmdsig = NULL,
+	.particle_buf = { NULL, NULL },
+	.particle_state = NULL,
+	.particle_upload = NULL,
+	.particle_uploaddata = NULL,
+	.particle_slot = 0,
+	.particle_queries = NULL,
+	.particle_readback = NULL,
+	.particle_readbackdata = NULL,
+	.compute_frequency = 0,
+	.particle_ms = 0,
+	.particle_alive = 0,
+	.particle_frames = 0,
+
+	.arena = { 0 },
+
+	.draw_queue = { 0 },
+	.translated = { 0 },
+
+	.psos = { 0 },
+
+	.trace_at_exit = FALSE,
+	.trace_requested = FALSE,
+	.defrag_requested = FALSE,
+
+	.present = { 0 },
+	.present_mode = PRESENT_VSYNC,
+	.max_latency = 1,
+	.tearing = FALSE,
+	.latency_object = NULL,
+
+	.force_warp = FALSE,
+	.allow_software = FALSE,
+	.low_power = FALSE,
+
+	.window_viewports = 0,
+	.headless_viewports = 0,
+	.viewports = { 0 },
+	.viewport_targets = { { 0 } },
+	.viewport_rtvheap = NULL,
+	.viewport_pso = NULL,
+	.viewport_sequence = NULL,
+
+	.pack_path = "textures.pack",
+	.texture_budget = 8ull * 1024 * 1024,
+	.texture_format = BC_FORMAT_BC7,
+	.texture_quality = BC_QUALITY_NORMAL,
+	.texture_reencode = FALSE,
+	.pack_file = INVALID_HANDLE_VALUE,
+	.pack_mapping = NULL,
+	.pack_view = NULL,
+	.pack = { 0 },
+	.stream = { 0 },
+	.textures = { NULL },
+	.texture_first = { 0 },
+	.stream_staging = NULL,
+	.stream_staging_data = NULL,
+	.srvheap = NULL,
+	.srvsize = 0,
+	.texture_index = 0,
+
+	.shader = {
+		.src = NULL,
+		.len = 0,
+		.vs = NULL,
+		.ps = NULL,
+		.cs = NULL,
+		.vs_handle = 0,
+		.ps_handle = 0,
+		.cs_handle = 0,
+		.particles = { NULL, NULL, NULL, NULL, NULL },
+		.particle_handles = { 0, 0, 0, 0, 0 },
+	},
+
+	.startup = 0,
 };
 
 static LRESULT CALLBACK wnd_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
@@ -92,574 +497,2719 @@ static LRESULT CALLBACK wnd_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lpar
 			return 0;
 		}
 		case WM_SIZE: {
-			state.width = LOWORD(lparam);
-			state.height = HIWORD(lparam);
+			/* viewport windows share the class and keep their size */
+			if (hwnd == state.hwnd) {
+				state.width = LOWORD(lparam);
+				state.height = HIWORD(lparam);
+			}
 			return 0;
 		}
 		case WM_DESTROY: {
-			PostQuitMessage(0);
+			if (hwnd == state.hwnd) {
+				PostQuitMessage(0);
+			}
 			return 0;
 		}
+		case WM_KEYDOWN: {
+			if (wparam == VK_F12) {
+				state.trace_requested = TRUE;
+				return 0;
+			}
+			/* messages are pumped between frames, so the frame in flight keeps the mode it began with */
+			if (wparam == VK_F5 && state.present.backend.present != NULL) {
+				present_set_mode(&state.present, (state.present.mode + 1) % PRESENT_MODES);
+				fprintf(stderr, "present: %s\n", present_mode_names[state.present.mode]);
+				return 0;
+			}
+			if (wparam == 'D') {
+				state.defrag_requested = TRUE;
+				return 0;
+			}
+			if (wparam == 'T' && state.pack.texture_count != 0) {
+				state.texture_index = (state.texture_index + 1) % state.pack.texture_count;
+				return 0;
+			}
+			break;
+		}
 	}
 
 	return DefWindowProcA(hwnd, msg, wparam, lparam);
 }
 
 static void cleanup(void) {
+	/* BAIL ends up here too, so with -trace a failed run leaves its last frames behind */
+	if (state.trace_at_exit && trace.enabled) {
+		trace_dump("exit");
+	}
+	/* load jobs write into the staging buffer, they finish before the pool goes */
+	stream_destroy(&state.stream);
+	jobs_shutdown();
+
 	if (state.hwnd != NULL) {
 		DestroyWindow(state.hwnd);
 	}
 
-	if (state.inited.ptrs != NULL) {
-		for (UINT i = 0; i < state.inited.count; ++i) {
-			if (state.inited.ptrs[i] == NULL) {
-				continue;
-			}
-			if (*(state.inited.ptrs[i]) == NULL) {
-				continue;
-			}
+	present_report(&state.present, stderr);
+	viewport_set_report(&state.viewports, stderr);
+	/* fine after BAIL too, a set with no viewports never touches the fence */
+	viewport_set_destroy(&state.viewports);
+	if (state.latency_object != NULL) {
+		CloseHandle(state.latency_object);
+		state.latency_object = NULL;
+	}
 
-			(*(state.inited.ptrs[i]))->lpVtbl->Release((*(state.inited.ptrs[i])));
-			(*(state.inited.ptrs[i])) = NULL;
-			state.inited.ptrs[i] = NULL;
-		}
+	if (state.fence != NULL) {
+		release_report(stderr);
+		gpumem_dump_json(&state.upload, stderr);
+	}
+	if (state.cull.runs != 0) {
+		precull_report(&state.cull.total, stderr);
+	}
+	precull_destroy(&state.cull);
 
-		free(state.inited.ptrs);
+	if (state.mesh_lods.level_count != 0) {
+		lod_chain_report(&state.mesh_lods, "mesh", stderr);
+		lod_report(&state.lod, stderr);
 	}
-}
+	if (state.meshlet_cull.runs != 0) {
+		meshlet_report(&state.meshlet_cull.total, stderr);
+	}
+	meshlet_culler_destroy(&state.meshlet_cull);
+	for (UINT i = 0; i < LOD_MAX_LEVELS; ++i) {
+		meshlet_destroy(&state.mesh_meshlets[i]);
+	}
+	if (state.occlusion.frames != 0) {
+		occlusion_report(&state.occlusion, stderr);
+	}
+	occlusion_destroy(&state.occlusion);
+	if (state.draw_bvh.stats.queries != 0) {
+		bvh_report(&state.draw_bvh, "draws", stderr);
+	}
+	bvh_destroy(&state.draw_bvh);
+	lod_destroy(&state.mesh_lods);
 
-static int push_inited(void ** com) {
-	IUnknown *** ptrs = realloc(state.inited.ptrs, sizeof(IUnknown **) * (state.inited.count + 1));
-	if (ptrs == NULL) {
-		return 1;
+	if (state.overdraw.frames != 0) {
+		overdraw_report(&state.overdraw.total, "all frames", stderr);
 	}
+	overdraw_destroy(&state.overdraw);
 
-	state.inited.ptrs = ptrs;
-	state.inited.ptrs[state.inited.count++] = (IUnknown **) com;
-	return 0;
+	if (state.recorded_frames != 0) {
+		fprintf(stderr, "record: %.4f ms per frame over %u frames, bundles %s\n", state.record_ms / state.recorded_frames, state.recorded_frames, state.use_bundles ? "on" : "off");
+		bundle_report(&state.bundles, stderr);
+	}
+	if (state.sched.stats.passes != 0) {
+		sched_report(&state.sched, stderr);
+	}
+	if (state.particle_frames != 0) {
+		fprintf(stderr, "particles: %s path, %.3f ms per frame, %.3f ms per million over %u frames\n", state.cpu_particles ? "cpu " PARTICLES_PATH : "gpu", state.particle_ms / state.particle_frames, state.particle_alive != 0 ? state.particle_ms * 1e6 / state.particle_alive : 0.0, state.particle_frames);
+	}
+	particles_destroy(&state.particles);
+	if (state.stream.pack != NULL) {
+		stream_report(&state.stream, stderr);
+	}
+	arena_report(&state.arena, stderr);
+	if (state.draw_queue.stats.sorts != 0) {
+		/* the sort is the queue's, the state changes are from recording, once per bundle */
+		state.translated.sorts = state.draw_queue.stats.sorts;
+		state.translated.sort_ms = state.draw_queue.stats.sort_ms;
+		draw_queue_report(&state.translated, stderr);
+	}
+	draw_queue_destroy(&state.draw_queue);
+	if (state.psos.entries != NULL) {
+		pso_cache_report(&state.psos, stderr);
+	}
+	arena_destroy(&state.arena);
+	/* both queue their objects on the fence, so this has to happen before release_shutdown */
+	pso_cache_destroy(&state.psos);
+	bundle_cache_destroy(&state.bundles);
+	if (trace.enabled) {
+		trace_report(stderr);
+	}
+	trace_destroy();
+	scene_destroy(&state.scene);
+	vshade_out_free(&state.clip);
+
+	release_shutdown();
+	gpumem_destroy(&state.upload);
+
+	/* textures change with residency, so they are released here rather than tracked */
+	for (UINT t = 0; t < STREAM_MAX_TEXTURES; ++t) {
+		if (state.textures[t] != NULL) {
+			state.textures[t]->lpVtbl->Release(state.textures[t]);
+			state.textures[t] = NULL;
+		}
+	}
+	if (state.pack_view != NULL) {
+		UnmapViewOfFile(state.pack_view);
+		state.pack_view = NULL;
+	}
+	if (state.pack_mapping != NULL) {
+		CloseHandle(state.pack_mapping);
+		state.pack_mapping = NULL;
+	}
+	if (state.pack_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(state.pack_file);
+		state.pack_file = INVALID_HANDLE_VALUE;
+	}
+
+	free(state.shader.src);
+	state.shader.src = NULL;
 }
 
-#define PUSH_INITED(com) { if (push_inited(com) != 0) { BAIL(-1, "Push inited failure\n"); } }
+/* FAIL is for startup steps and helpers, main() does the cleanup once with BAIL */
+#define TRACK(com, bytes) { if (com_track((void **) (com), (bytes)) == 0) { FAIL(-1, "Track failure\n"); } }
+#define FAIL(retval, msg, ...) { fprintf(stderr, msg, __VA_ARGS__); return retval; }
 #define BAIL(retval, msg, ...) { fprintf(stderr, msg, __VA_ARGS__); cleanup(); return retval; }
 #define BAIL_NO_MSG(retval) { cleanup(); return retval; }
 
 static int wait_for_fence(void) {
+	LONGLONG zone = trace_begin();
 	UINT64 fence = state.fence_value;
 	if (FAILED(state.cmdqueue->lpVtbl->Signal(state.cmdqueue, state.fence, ++fence))) {
-		BAIL(20, "Failed to signal fence\n");
+		FAIL(20, "Failed to signal fence\n");
 	}
 	++state.fence_value;
 
 	if (state.fence->lpVtbl->GetCompletedValue(state.fence) < fence) {
 		if (FAILED(state.fence->lpVtbl->SetEventOnCompletion(state.fence, fence, state.fence_event))) {
-			BAIL(21, "Failed to set fence event\n");
+			FAIL(21, "Failed to set fence event\n");
 		}
 		WaitForSingleObject(state.fence_event, INFINITE);
 	}
 
+	trace_end("wait_for_fence", zone);
 	return 0;
 }
 
-typedef struct vertex {
-	float pos[4];
-	float color[4];
-} vertex_t;
+#define UPLOAD_HEAP_SIZE (16ull * 1024 * 1024)
 
-int main(void) {
-	WNDCLASSEXA wc = {
-		.cbSize = sizeof(WNDCLASSEXA),
-		.style = CS_HREDRAW | CS_VREDRAW,
-		.lpfnWndProc = wnd_proc,
-		.cbClsExtra = 0,
-		.cbWndExtra = 0,
-		.hInstance = GetModuleHandle(NULL),
-		.hIcon = LoadIcon(NULL, IDC_ARROW),
-		.hCursor = LoadCursor(NULL, IDC_ARROW),
-		.hbrBackground = (HBRUSH) GetStockObject(0),
-		.lpszClassName = "d3d12",
-		.hIconSm = LoadImageA(GetModuleHandle(NULL), MAKEINTRESOURCEA(5), IMAGE_ICON, GetSystemMetrics(SM_CXSMICON), GetSystemMetrics(SM_CYSMICON), LR_DEFAULTCOLOR),
+static void * upload_create_heap(void * user, UINT kind, UINT64 size) {
+	D3D12_HEAP_DESC desc = {
+		.SizeInBytes = size,
+		.Properties = {
+			.Type = D3D12_HEAP_TYPE_UPLOAD,
+			.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+			.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
+			.CreationNodeMask = 1,
+			.VisibleNodeMask = 1,
+		},
+		.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT,
+		.Flags = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS,
 	};
 
-	RegisterClassExA(&wc);
-	
-	{
-		RECT rect = {
-			.top = 0,
-			.left = 0,
-			.right = state.width,
-			.bottom = state.height,
-		};
-		AdjustWindowRectEx(&rect, WS_OVERLAPPEDWINDOW, FALSE, 0);
-
-		state.hwnd = CreateWindowExA(0, wc.lpszClassName, "d3d12", WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT, rect.right - rect.left, rect.bottom - rect.top, NULL, NULL, wc.hInstance, NULL);
+	ID3D12Heap * heap;
+	if (FAILED(state.device->lpVtbl->CreateHeap(state.device, &desc, &IID_ID3D12Heap, (void **) &heap))) {
+		return NULL;
 	}
 
-	ShowWindow(state.hwnd, SW_SHOWDEFAULT);
-	UpdateWindow(state.hwnd);
+	return heap;
+}
 
-	UINT factory_flags = 0;
+static void upload_destroy_heap(void * user, void * heap) {
+	((ID3D12Heap *) heap)->lpVtbl->Release((ID3D12Heap *) heap);
+}
 
-	#ifdef _DEBUG
-	{
-		ID3D12Debug * debug;
-		if (SUCCEEDED(D3D12GetDebugInterface(&IID_ID3D12Debug, (void **) &debug))) {
-			debug->lpVtbl->EnableDebugLayer(debug);
-			factory_flags |= DXGI_CREATE_FACTORY_DEBUG;
-		}
-	}
+static D3D12_RESOURCE_DESC buffer_desc(UINT64 size) {
+	return (D3D12_RESOURCE_DESC) {
+		.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER,
+		.Alignment = 0,
+		.Width = size,
+		.Height = 1,
+		.DepthOrArraySize = 1,
+		.MipLevels = 1,
+		.Format = DXGI_FORMAT_UNKNOWN,
+		.SampleDesc = {
+			.Count = 1,
+			.Quality = 0,
+		},
+		.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR,
+		.Flags = D3D12_RESOURCE_FLAG_NONE,
+	};
+}
 
-	{
-		IDXGIDebug1 * debug;
-		if (SUCCEEDED(DXGIGetDebugInterface1(0, &IID_IDXGIDebug1, (void **) &debug))) {
-			debug->lpVtbl->EnableLeakTrackingForThread(debug);
-		}
-	}
-	#endif
+/*
+ * re-places an upload buffer at its new offset, copying through a staging copy since
+ * the ranges may overlap. the old resource is retired on the current fence; callers
+ * re-fetch GPU addresses and mappings after gpumem_defragment.
+ */
+static void upload_move(void * user, void * alloc_user, void * heap, UINT64 old_offset, UINT64 new_offset, UINT64 size) {
+	ID3D12Resource ** resource = alloc_user;
+	ID3D12Resource * moved;
+	D3D12_RESOURCE_DESC desc = buffer_desc(size);
+	D3D12_RANGE range = {
+		.Begin = 0,
+		.End = 0,
+	};
 
-	if (FAILED(CreateDXGIFactory2(factory_flags, &IID_IDXGIFactory4, (void **) &state.factory))) {
-		BAIL(1, "Failed to create factory\n");
+	if (FAILED(state.device->lpVtbl->CreatePlacedResource(state.device, heap, new_offset, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, &IID_ID3D12Resource, (void **) &moved))) {
+		fprintf(stderr, "Failed to re-place buffer during defragment\n");
+		return;
 	}
-	PUSH_INITED(&state.factory);
-
-	{
-		IDXGIAdapter1 * adapter;
-		if (FAILED(state.factory->lpVtbl->EnumAdapters1(state.factory, 0, &adapter))) {
-			BAIL(2, "Failed to enumerate adapters\n");
-		}
 
-		DXGI_ADAPTER_DESC1 desc;
-		adapter->lpVtbl->GetDesc1(adapter, &desc);
+	void * staging = malloc(size);
+	void * src;
+	void * dst;
+	if (staging != NULL && SUCCEEDED((*resource)->lpVtbl->Map(*resource, 0, &range, &src))) {
+		memcpy(staging, src, size);
+		(*resource)->lpVtbl->Unmap(*resource, 0, NULL);
 
-		if (FAILED(D3D12CreateDevice((IUnknown *) adapter, D3D_FEATURE_LEVEL_11_0, &IID_ID3D12Device, &state.device))) {
-			BAIL(3, "Failed to create device\n");
+		if (SUCCEEDED(moved->lpVtbl->Map(moved, 0, &range, &dst))) {
+			memcpy(dst, staging, size);
+			moved->lpVtbl->Unmap(moved, 0, NULL);
 		}
-		PUSH_INITED(&state.device);
-		adapter->lpVtbl->Release(adapter);
 	}
+	free(staging);
 
-	{
-		D3D12_COMMAND_QUEUE_DESC queue_desc = {
-			.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE,
-			.Type = D3D12_COMMAND_LIST_TYPE_DIRECT,
-		};
-
-		if (FAILED(state.device->lpVtbl->CreateCommandQueue(state.device, &queue_desc, &IID_ID3D12CommandQueue, &state.cmdqueue))) {
-			BAIL(4, "Failed to create command queue\n");
-		}
-		PUSH_INITED(&state.cmdqueue);
-
-		DXGI_SWAP_CHAIN_DESC1 swap_desc = {
-			.BufferCount = state.framecount,
-			.Width = state.width,
-			.Height = state.height,
-			.Format = DXGI_FORMAT_R8G8B8A8_UNORM,
-			.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT,
-			.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD,
-			.SampleDesc = {
-				.Count = 1,
-				.Quality = 0,
-			},
-		};
+	release_defer((IUnknown *) *resource, state.fence_value, 0);
+	*resource = moved;
+}
 
-		IDXGISwapChain1 * swapchain;
-		if (FAILED(state.factory->lpVtbl->CreateSwapChainForHwnd(state.factory, (IUnknown *) state.cmdqueue, state.hwnd, &swap_desc, NULL, NULL, &swapchain))) {
-			BAIL(5, "Failed to create swapchain\n");
-		}
+/* placed upload buffer sub-allocated from state.upload, tracked like any other object */
+static int create_upload_buffer(UINT64 size, ID3D12Resource ** resource, UINT * alloc) {
+	*alloc = gpumem_alloc(&state.upload, size, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT, resource);
+	if (*alloc == GPUMEM_NONE) {
+		return 1;
+	}
 
-		if (FAILED(state.factory->lpVtbl->MakeWindowAssociation(state.factory, state.hwnd, DXGI_MWA_NO_ALT_ENTER))) {
-			BAIL(6, "Failed to make window association\n");
-		}
+	gpumem_alloc_t placed = gpumem_get(&state.upload, *alloc);
+	D3D12_RESOURCE_DESC desc = buffer_desc(size);
 
-		state.swapchain = swapchain;
-		PUSH_INITED(&swapchain);
-		state.frameindex = state.swapchain->lpVtbl->GetCurrentBackBufferIndex(state.swapchain);
+	if (FAILED(state.device->lpVtbl->CreatePlacedResource(state.device, gpumem_heap_of(&state.upload, *alloc), placed.offset, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, &IID_ID3D12Resource, (void **) resource))) {
+		gpumem_free(&state.upload, *alloc);
+		*alloc = GPUMEM_NONE;
+		return 2;
 	}
 
-	{
-		D3D12_DESCRIPTOR_HEAP_DESC heap_desc = {
-			.NumDescriptors = state.framecount,
-			.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV,
-			.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE, 
-		};
+	return 0;
+}
 
-		if (FAILED(state.device->lpVtbl->CreateDescriptorHeap(state.device, &heap_desc, &IID_ID3D12DescriptorHeap, &state.rtvheap))) {
-			BAIL(7, "Failed to create descriptor heap\n");
-		}
-		PUSH_INITED(&state.rtvheap);
+/*
+ * packs state.upload, on request with the D key. only called at the top of a frame, where
+ * the loop has drained the queue the viewports share, so no moved range is in use. the
+ * persistent mappings and the views holding GPU addresses are taken again from whichever
+ * buffers were re-placed.
+ */
+static int upload_defragment(void) {
+	ID3D12Resource * cbo = state.cbo;
+	ID3D12Resource * ibo = state.ibo;
+	ID3D12Resource * palette_buf = state.palette_buf;
+	UINT64 moved = gpumem_defragment(&state.upload);
+	fprintf(stderr, "upload: defragmented, %llu bytes moved\n", (unsigned long long) moved);
+
+	void * data;
+	D3D12_RANGE range = {
+		.Begin = 0,
+		.End = 0,
+	};
 
-		state.rtvsize = state.device->lpVtbl->GetDescriptorHandleIncrementSize(state.device, D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+	if (state.cbo != cbo) {
+		if (FAILED(state.cbo->lpVtbl->Map(state.cbo, 0, &range, &data))) {
+			FAIL(19, "Failed to map constant buffer\n");
+		}
+		state.cbvdata = data;
 
+		D3D12_CONSTANT_BUFFER_VIEW_DESC cbv_desc = {
+			.BufferLocation = state.cbo->lpVtbl->GetGPUVirtualAddress(state.cbo),
+			.SizeInBytes = 256,
+		};
 		D3D12_CPU_DESCRIPTOR_HANDLE handle;
 		state.rtvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.rtvheap, &handle);
-		for (UINT i = 0; i < state.framecount; ++i) {
-			ID3D12Resource * resource;
-			if (FAILED(state.swapchain->lpVtbl->GetBuffer(state.swapchain, i, &IID_ID3D12Resource, &resource))) {
-				BAIL(8, "Failed to get swapchain buffer\n");
-			}
-
-			state.device->lpVtbl->CreateRenderTargetView(state.device, resource, NULL, handle);
-			state.framebuffers[i] = resource;
-			PUSH_INITED(&state.framebuffers[i]);
+		state.device->lpVtbl->CreateConstantBufferView(state.device, &cbv_desc, handle);
+	}
 
-			handle.ptr += state.rtvsize;
+	if (state.ibo != ibo) {
+		if (FAILED(state.ibo->lpVtbl->Map(state.ibo, 0, &range, &data))) {
+			FAIL(19, "Failed to map index buffer\n");
 		}
+		state.ibodata = data;
+		state.ibo_view.BufferLocation = state.ibo->lpVtbl->GetGPUVirtualAddress(state.ibo);
+	}
 
-		if (FAILED(state.device->lpVtbl->CreateCommandAllocator(state.device, D3D12_COMMAND_LIST_TYPE_DIRECT, &IID_ID3D12CommandAllocator, &state.cmdallocator))) {
-			BAIL(9, "Failed to create command allocator\n");
+	if (state.palette_buf != palette_buf) {
+		if (FAILED(state.palette_buf->lpVtbl->Map(state.palette_buf, 0, &range, &data))) {
+			FAIL(19, "Failed to map constant buffer\n");
 		}
-		PUSH_INITED(&state.cmdallocator);
+		state.palettedata = data;
 	}
 
-	{
-		D3D12_FEATURE_DATA_ROOT_SIGNATURE feat_data = {
-			.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1,
-		};
+	return 0;
+}
 
-		if (FAILED(state.device->lpVtbl->CheckFeatureSupport(state.device, D3D12_FEATURE_ROOT_SIGNATURE, &feat_data, sizeof(feat_data))) {
-			feat_data.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
-		}
+/*
+ * everything the static part of the frame references. it is recorded either straight
+ * into the frame's list or once into a bundle keyed by these exact bytes, so a rebuilt
+ * PSO, a re-placed buffer or a changed draw list records a new bundle. the draw list is
+ * short enough to key by value.
+ */
+#define SEQUENCE_MAX_DRAWS 1
+
+typedef struct draw_sequence {
+	/* the tables the packets index, one root signature and one mesh for now */
+	ID3D12PipelineState * pso[PSO_COUNT];
+	ID3D12RootSignature * root_sig;
+	/* the SRV of the mesh's texture in state.srvheap */
+	D3D12_GPU_DESCRIPTOR_HANDLE texture;
+	D3D12_VERTEX_BUFFER_VIEW vbo_view;
+	D3D12_INDEX_BUFFER_VIEW ibo_view;
+	UINT draw_count;
+	/* in sort key order */
+	draw_packet_t draws[SEQUENCE_MAX_DRAWS];
+} draw_sequence_t;
+
+typedef struct sequence_target {
+	ID3D12GraphicsCommandList * list;
+	draw_sequence_t const * seq;
+} sequence_target_t;
+
+static void sequence_set_pipeline(void * user, UINT pipeline) {
+	sequence_target_t * target = user;
+	target->list->lpVtbl->SetPipelineState(target->list, target->seq->pso[pipeline]);
+}
 
-		D3D12_DESCRIPTOR_RANGE1 range = {
-			.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_CBV,
-			.NumDescriptors = 1,
-			.BaseShaderRegister = 0,
-			.RegisterSpace = 0,
-			.Flags = D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC,
-			.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND,
-		};
+/* setting the root signature drops the bindings, so the texture table goes with it */
+static void sequence_set_root_sig(void * user, UINT root_sig) {
+	sequence_target_t * target = user;
+	target->list->lpVtbl->SetGraphicsRootSignature(target->list, target->seq->root_sig);
+	target->list->lpVtbl->SetGraphicsRootDescriptorTable(target->list, 0, target->seq->texture);
+}
 
-		D3D12_ROOT_PARAMETER1 parameters = {
-			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE,
-		};
+static void sequence_set_vbuffer(void * user, UINT vbuffer) {
+	sequence_target_t * target = user;
+	target->list->lpVtbl->IASetVertexBuffers(target->list, 0, 1, &target->seq->vbo_view);
+}
 
-		D3D12_ROOT_SIGNATURE_DESC sig_desc = {
-			.NumParameters = 0,
-			.pParameters = NULL,
-			.NumStaticSamplers = 0,
-			.pStaticSamplers = NULL,
-			.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT,
-		};
+static void sequence_set_ibuffer(void * user, UINT ibuffer) {
+	sequence_target_t * target = user;
+	target->list->lpVtbl->IASetIndexBuffer(target->list, &target->seq->ibo_view);
+}
 
-		ID3DBlob * sig;
-		ID3DBlob * err;
+static void sequence_draw(void * user, draw_packet_t const * packet) {
+	sequence_target_t * target = user;
+	if (packet->index_count != 0) {
+		target->list->lpVtbl->DrawIndexedInstanced(target->list, packet->index_count, packet->instance_count, packet->first_index, packet->base_vertex, 0);
+	}
+}
 
-		if (FAILED(D3D12SerializeRootSignature(&sig_desc, D3D_ROOT_SIGNATURE_VERSION_1, &sig, &err))) {
-			BAIL(10, "Failed to serialize root signature\n");
-		}
+/*
+ * viewports, scissors, targets and barriers are not allowed in bundles and stay outside.
+ * the list has to have state.srvheap set, a bundle sets it itself.
+ */
+static void record_sequence(ID3D12GraphicsCommandList * list, draw_sequence_t const * seq) {
+	sequence_target_t target = {
+		.list = list,
+		.seq = seq,
+	};
+	draw_backend_t backend = {
+		.set_pipeline = sequence_set_pipeline,
+		.set_root_sig = sequence_set_root_sig,
+		.set_vbuffer = sequence_set_vbuffer,
+		.set_ibuffer = sequence_set_ibuffer,
+		.draw = sequence_draw,
+		.user = &target,
+	};
 
-		if (FAILED(state.device->lpVtbl->CreateRootSignature(state.device, 0, sig->lpVtbl->GetBufferPointer(sig), sig->lpVtbl->GetBufferSize(sig), &IID_ID3D12RootSignature, &state.root_sig))) {
-			BAIL(11, "Failed to create root signature\n");
-		}
-		PUSH_INITED(&state.root_sig);
+	list->lpVtbl->IASetPrimitiveTopology(list, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	draw_translate(seq->draws, NULL, seq->draw_count, &backend, &state.translated);
+}
 
-		sig->lpVtbl->Release(sig);
-		if (err != NULL) {
-			err->lpVtbl->Release(err);
-		}
+/* each bundle owns its allocator, so evicting one never has to reset memory another still uses */
+typedef struct bundle_list {
+	ID3D12CommandAllocator * allocator;
+	ID3D12GraphicsCommandList * list;
+} bundle_list_t;
+
+static void * bundle_record(void * user, void const * data) {
+	draw_sequence_t const * seq = data;
+	bundle_list_t * bundle = malloc(sizeof(bundle_list_t));
+	if (bundle == NULL) {
+		return NULL;
 	}
 
-	{
-		UINT flags = 0;
-		#ifdef _DEBUG
-		flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
-		#endif
+	if (FAILED(state.device->lpVtbl->CreateCommandAllocator(state.device, D3D12_COMMAND_LIST_TYPE_BUNDLE, &IID_ID3D12CommandAllocator, (void **) &bundle->allocator))) {
+		free(bundle);
+		return NULL;
+	}
 
-		ID3DBlob * vs;
-		ID3DBlob * ps;
-		ID3DBlob * err;
+	if (FAILED(state.device->lpVtbl->CreateCommandList(state.device, 0, D3D12_COMMAND_LIST_TYPE_BUNDLE, bundle->allocator, NULL, &IID_ID3D12GraphicsCommandList, (void **) &bundle->list))) {
+		bundle->allocator->lpVtbl->Release(bundle->allocator);
+		free(bundle);
+		return NULL;
+	}
 
-		char * src = NULL;
-		SIZE_T len = 0;
+	bundle->list->lpVtbl->SetDescriptorHeaps(bundle->list, 1, &state.srvheap);
+	record_sequence(bundle->list, seq);
 
-		{
-			FILE * fp = fopen("main.hlsl", "rb");
-			if (fp == NULL) {
-				BAIL(12, "Failed to open main.hlsl\n");
-			}
+	if (FAILED(bundle->list->lpVtbl->Close(bundle->list))) {
+		bundle->list->lpVtbl->Release(bundle->list);
+		bundle->allocator->lpVtbl->Release(bundle->allocator);
+		free(bundle);
+		return NULL;
+	}
 
-			fseek(fp, 0, SEEK_END);
-			len = ftell(fp);
-			fseek(fp, 0, SEEK_SET);
+	return bundle;
+}
 
-			src = malloc(len + 1);
-			if (src == NULL) {
-				BAIL(13, "Failed to allocate memory for main.hlsl\n");
-			}
+static void bundle_replay(void * user, void * bundle) {
+	state.cmdlist->lpVtbl->ExecuteBundle(state.cmdlist, ((bundle_list_t *) bundle)->list);
+}
 
-			if (fread(src, 1, len, fp) != len) {
-				BAIL(14, "Failed to read main.hlsl\n");
-			}
+static void bundle_release(void * user, void * bundle) {
+	bundle_list_t * b = bundle;
+	release_defer((IUnknown *) b->list, state.fence_value, 0);
+	release_defer((IUnknown *) b->allocator, state.fence_value, 0);
+	free(b);
+}
 
-			fclose(fp);
-		}
+/* appends the particle step that reads buffer in and writes buffer out to the compute list */
+static void record_particles(ID3D12GraphicsCommandList * list, UINT in, UINT out) {
+	UINT buffers[3] = { PARTICLES_MAX, in, out };
+	D3D12_RESOURCE_BARRIER uav = {
+		.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV,
+		.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+		.UAV = {
+			.pResource = NULL,
+		},
+	};
 
-		if (FAILED(D3DCompile(src, len, "main.hlsl", NULL, NULL, "vs", "vs_5_0", flags, 0, &vs, &err))) {
-			if (err != NULL) {
-				OutputDebugStringA(err->lpVtbl->GetBufferPointer(err));
-				fprintf(stderr, "D3DCompiler error: %s\n", (char *) err->lpVtbl->GetBufferPointer(err));
-				err->lpVtbl->Release(err);
-				BAIL(15, "Failed to compile vertex shader\n");
-			} else {
-				BAIL(15, "Failed to compile vertex shader\n");
-			}
-		}
+	list->lpVtbl->EndQuery(list, state.particle_queries, D3D12_QUERY_TYPE_TIMESTAMP, 0);
+	list->lpVtbl->SetComputeRootSignature(list, state.particle_compute_sig);
+	list->lpVtbl->SetComputeRoot32BitConstants(list, 0, sizeof(particles_params_t) / sizeof(UINT), &state.particle_params, 0);
+	list->lpVtbl->SetComputeRoot32BitConstants(list, 1, 3, buffers, 0);
+	list->lpVtbl->SetComputeRootShaderResourceView(list, 2, state.particle_buf[in]->lpVtbl->GetGPUVirtualAddress(state.particle_buf[in]));
+	list->lpVtbl->SetComputeRootUnorderedAccessView(list, 3, state.particle_buf[out]->lpVtbl->GetGPUVirtualAddress(state.particle_buf[out]));
+	list->lpVtbl->SetComputeRootUnorderedAccessView(list, 4, state.particle_state->lpVtbl->GetGPUVirtualAddress(state.particle_state));
+
+	/* the count is only known on the GPU, so every slot gets a thread and the excess returns early */
+	list->lpVtbl->SetPipelineState(list, state.particle_pso[PARTICLE_SHADER_UPDATE]);
+	list->lpVtbl->Dispatch(list, PARTICLES_MAX / 256, 1, 1);
+	list->lpVtbl->ResourceBarrier(list, 1, &uav);
+	list->lpVtbl->SetPipelineState(list, state.particle_pso[PARTICLE_SHADER_EMIT]);
+	list->lpVtbl->Dispatch(list, (state.particle_params.emit + 63) / 64, 1, 1);
+	list->lpVtbl->ResourceBarrier(list, 1, &uav);
+	list->lpVtbl->SetPipelineState(list, state.particle_pso[PARTICLE_SHADER_ARGS]);
+	list->lpVtbl->Dispatch(list, 1, 1, 1);
+	list->lpVtbl->EndQuery(list, state.particle_queries, D3D12_QUERY_TYPE_TIMESTAMP, 1);
+
+	list->lpVtbl->ResourceBarrier(list, 1, (D3D12_RESOURCE_BARRIER[]) {
+		{
+			.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
+			.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+			.Transition = {
+				.pResource = state.particle_state,
+				.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+				.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+				.StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE,
+			},
+		},
+	});
+	list->lpVtbl->ResolveQueryData(list, state.particle_queries, D3D12_QUERY_TYPE_TIMESTAMP, 0, 2, state.particle_readback, 0);
+	list->lpVtbl->CopyBufferRegion(list, state.particle_readback, sizeof(UINT64) * 2, state.particle_state, sizeof(UINT) * out, sizeof(UINT));
+}
 
-		if (FAILED(D3DCompile(src, len, "main.hlsl", NULL, NULL, "ps", "ps_5_0", flags, 0, &ps, &err))) {
-			vs->lpVtbl->Release(vs);
-			if (err != NULL) {
-				OutputDebugStringA(err->lpVtbl->GetBufferPointer(err));
-				fprintf(stderr, "D3DCompiler error: %s\n", (char *) err->lpVtbl->GetBufferPointer(err));
-				err->lpVtbl->Release(err);
-				BAIL(15, "Failed to compile pixel shader\n");
-			} else {
-				BAIL(15, "Failed to compile pixel shader\n");
-			}
-		}
+static ID3D12CommandQueue * sched_d3d_queue(sched_queue_t queue) {
+	return queue == SCHED_COMPUTE ? state.computequeue : state.cmdqueue;
+}
 
-		free(src);
+static int sched_d3d_wait(void * user, sched_queue_t queue, sched_queue_t signaler, UINT64 value) {
+	ID3D12CommandQueue * q = sched_d3d_queue(queue);
+	return FAILED(q->lpVtbl->Wait(q, state.queue_fence[signaler], value));
+}
 
-		D3D12_INPUT_ELEMENT_DESC input_desc[] = {
-			{
-				.SemanticName = "POSITION",
-				.SemanticIndex = 0,
-				.Format = DXGI_FORMAT_R32G32B32A32_FLOAT,
-				.InputSlot = 0,
-				.AlignedByteOffset = 0,
-				.InputSlotClass = D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
-				.InstanceDataStepRate = 0,
-			},
-			{
-				.SemanticName = "COLOR",
-				.SemanticIndex = 0,
-				.Format = DXGI_FORMAT_R32G32B32A32_FLOAT,
-				.InputSlot = 0,
-				.AlignedByteOffset = 12,
-					.InputSlotClass = D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
-					.InstanceDataStepRate = 0,
-			},
-		};
+static int sched_d3d_submit(void * user, sched_pass_t const * pass) {
+	ID3D12CommandQueue * q = sched_d3d_queue(pass->queue);
+	cmdlist_batch_t const * batch = pass->user;
+	TRACE_ZONE("ExecuteCommandLists") {
+		q->lpVtbl->ExecuteCommandLists(q, batch->count, batch->lists);
+	}
+	return 0;
+}
 
-		D3D12_GRAPHICS_PIPELINE_STATE_DESC ps_desc = {
-			.InputLayout = {
-				.pInputElementDescs = input_desc,
-				.NumElements = sizeof(input_desc) / sizeof(D3D12_INPUT_ELEMENT_DESC),
-			},
-			.pRootSignature = state.root_sig,
-			.VS = {
-				vs->lpVtbl->GetBufferPointer(vs),
-				vs->lpVtbl->GetBufferSize(vs),
-			},
-			.PS = {
-				ps->lpVtbl->GetBufferPointer(ps),
-				ps->lpVtbl->GetBufferSize(ps),
-			},
-			.RasterizerState = {
-				.FillMode = D3D12_FILL_MODE_SOLID,
-				.CullMode = D3D12_CULL_MODE_BACK,
-				.FrontCounterClockwise = FALSE,
-				.DepthBias = D3D12_DEFAULT_DEPTH_BIAS,
-				.DepthBiasClamp = D3D12_DEFAULT_DEPTH_BIAS_CLAMP,
-				.SlopeScaledDepthBias = D3D12_DEFAULT_SLOPE_SCALED_DEPTH_BIAS,
-				.DepthClipEnable = TRUE,
-				.MultisampleEnable = FALSE,
-				.AntialiasedLineEnable = FALSE,
-				.ForcedSampleCount = 0,
-				.ConservativeRaster = D3D12_CONSERVATIVE_RASTERIZATION_MODE_OFF,
-			},
-			.BlendState = {
-				.AlphaToCoverageEnable = FALSE,
-				.IndependentBlendEnable = FALSE,
-				.RenderTarget = {
-					[0] = {
-						.BlendEnable = FALSE,
-						.LogicOpEnable = FALSE,
-						.SrcBlend = D3D12_BLEND_ONE,
-						.DestBlend = D3D12_BLEND_ZERO,
-						.BlendOp = D3D12_BLEND_OP_ADD,
-						.SrcBlendAlpha = D3D12_BLEND_ONE,
-						.DestBlendAlpha = D3D12_BLEND_ZERO,
-						.BlendOpAlpha = D3D12_BLEND_OP_ADD,
-						.LogicOp = D3D12_LOGIC_OP_NOOP,
-						.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL,
-					},
-				},
-			},
-			.DepthStencilState = {
-				.DepthEnable = FALSE,
-				.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ALL,
-				.DepthFunc = D3D12_COMPARISON_FUNC_LESS,
-				.StencilEnable = FALSE,
-				.StencilReadMask = D3D12_DEFAULT_STENCIL_READ_MASK,
-				.StencilWriteMask = D3D12_DEFAULT_STENCIL_WRITE_MASK,
-				.FrontFace = {
-					.StencilFailOp = D3D12_STENCIL_OP_KEEP,
-					.StencilDepthFailOp = D3D12_STENCIL_OP_KEEP,
-					.StencilPassOp = D3D12_STENCIL_OP_KEEP,
-					.StencilFunc = D3D12_COMPARISON_FUNC_ALWAYS,
-				},
-			},
-			.SampleMask = UINT_MAX,
-			.SampleDesc = {
-				.Count = 1,
-				.Quality = 0,
-			},
-			.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE,
-			.NumRenderTargets = 1,
-			.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM,
-			.DSVFormat = DXGI_FORMAT_UNKNOWN,
-		};
+static int sched_d3d_signal(void * user, sched_queue_t queue, UINT64 value) {
+	ID3D12CommandQueue * q = sched_d3d_queue(queue);
+	return FAILED(q->lpVtbl->Signal(q, state.queue_fence[queue], value));
+}
 
-		if (FAILED(state.device->lpVtbl->CreateGraphicsPipelineState(state.device, &ps_desc, &IID_ID3D12PipelineState, &state.pso))) {
-			vs->lpVtbl->Release(vs);
-			ps->lpVtbl->Release(ps);
-			if (err != NULL) {
-				err->lpVtbl->Release(err);
-			}
-			BAIL(16, "Failed to create pipeline state\n");
-		}
-		PUSH_INITED(&state.pso);
+static LONGLONG present_d3d_now(void * user) {
+	return timer_now();
+}
 
-		vs->lpVtbl->Release(vs);
-		ps->lpVtbl->Release(ps);
-		if (err != NULL) {
-			err->lpVtbl->Release(err);
-		}
+/* a timeout only means the display stalled, the frame goes ahead anyway */
+static int present_d3d_wait(void * user) {
+	return WaitForSingleObjectEx(state.latency_object, 1000, TRUE) == WAIT_FAILED;
+}
 
-		if (FAILED(state.device->lpVtbl->CreateCommandList(state.device, 0, D3D12_COMMAND_LIST_TYPE_DIRECT, state.cmdallocator, NULL, &IID_ID3D12GraphicsCommandList, &state.cmdlist))) {
-			BAIL(17, "Failed to create command list\n");
-		}
-		PUSH_INITED(&state.cmdlist);
+static int present_d3d_present(void * user, UINT sync_interval, BOOL tearing, UINT64 * id) {
+	if (FAILED(state.swapchain->lpVtbl->Present(state.swapchain, sync_interval, tearing ? DXGI_PRESENT_ALLOW_TEARING : 0))) {
+		return 1;
+	}
+
+	UINT count = 0;
+	state.swapchain->lpVtbl->GetLastPresentCount(state.swapchain, &count);
+	*id = count;
+	return 0;
+}
 
-		state.cmdlist->lpVtbl->Close(state.cmdlist);
+/* fails while the statistics are disjoint, e.g. right after a mode change or while occluded */
+static int present_d3d_displayed(void * user, UINT64 * id, LONGLONG * when) {
+	DXGI_FRAME_STATISTICS stats;
+	if (FAILED(state.swapchain->lpVtbl->GetFrameStatistics(state.swapchain, &stats))) {
+		return 1;
 	}
 
-	{
-		D3D12_HEAP_PROPERTIES props = {
-			.Type = D3D12_HEAP_TYPE_UPLOAD,
-			.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
-			.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
-			.CreationNodeMask = 1,
-			.VisibleNodeMask = 1,
-		};
+	*id = stats.PresentCount;
+	*when = stats.SyncQPCTime.QuadPart;
+	return 0;
+}
 
-		D3D12_RESOURCE_DESC desc = {
-			.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER,
-			.Alignment = 0,
-			.Width = 256,
-			.Height = 1,
-			.DepthOrArraySize = 1,
-			.MipLevels = 1,
-			.Format = DXGI_FORMAT_UNKNOWN,
-			.SampleDesc = {
-				.Count = 1,
-				.Quality = 0,
-			},
-			.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR,
-			.Flags = D3D12_RESOURCE_FLAG_NONE,
-		};
+static int present_d3d_set_max_latency(void * user, UINT frames) {
+	return FAILED(state.swapchain->lpVtbl->SetMaximumFrameLatency(state.swapchain, frames));
+}
 
-		if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, &IID_ID3D12Resource, &state.cbo))) {
-			BAIL(18, "Failed to create constant buffer\n");
+/* viewport_remove has waited for the viewport's fences, nothing here is still in use */
+static void viewport_d3d_destroy(void * user, UINT index, viewport_t * vp) {
+	d3d_viewport_t * target = vp->target;
+	if (target->list != NULL) {
+		target->list->lpVtbl->Release(target->list);
+	}
+	for (UINT i = 0; i < VIEWPORT_FRAMES; ++i) {
+		if (target->allocators[i] != NULL) {
+			target->allocators[i]->lpVtbl->Release(target->allocators[i]);
 		}
-		PUSH_INITED(&state.cbo);
+		if (target->buffers[i] != NULL) {
+			target->buffers[i]->lpVtbl->Release(target->buffers[i]);
+		}
+	}
+	if (target->swapchain != NULL) {
+		target->swapchain->lpVtbl->Release(target->swapchain);
+	}
+	if (target->hwnd != NULL) {
+		DestroyWindow(target->hwnd);
+	}
+	memset(target, 0, sizeof(*target));
+}
 
-		D3D12_CONSTANT_BUFFER_VIEW_DESC cbv_desc = {
-			.BufferLocation = state.cbo->lpVtbl->GetGPUVirtualAddress(state.cbo),
-			.SizeInBytes = 256,
-		};
+static int viewport_d3d_create_window(viewport_t * vp, d3d_viewport_t * target) {
+	/* no close box, a viewport window lives as long as the main one */
+	DWORD style = WS_OVERLAPPED | WS_CAPTION;
+	RECT rect = {
+		.top = 0,
+		.left = 0,
+		.right = vp->width,
+		.bottom = vp->height,
+	};
+	AdjustWindowRectEx(&rect, style, FALSE, 0);
 
-		D3D12_CPU_DESCRIPTOR_HANDLE handle;
-		state.rtvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.rtvheap, &handle);
-		state.device->lpVtbl->CreateConstantBufferView(state.device, &cbv_desc, handle);
+	target->hwnd = CreateWindowExA(0, "d3d12", "d3d12 viewport", style, CW_USEDEFAULT, CW_USEDEFAULT, rect.right - rect.left, rect.bottom - rect.top, NULL, NULL, GetModuleHandle(NULL), NULL);
+	if (target->hwnd == NULL) {
+		return 1;
+	}
+	ShowWindow(target->hwnd, SW_SHOWNOACTIVATE);
+
+	/* flip model needs two buffers at least */
+	if (vp->frames < 2) {
+		vp->frames = 2;
+	}
+
+	DXGI_SWAP_CHAIN_DESC1 swap_desc = {
+		.BufferCount = vp->frames,
+		.Width = vp->width,
+		.Height = vp->height,
+		.Format = DXGI_FORMAT_R8G8B8A8_UNORM,
+		.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT,
+		.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD,
+		.SampleDesc = {
+			.Count = 1,
+			.Quality = 0,
+		},
+	};
+
+	IDXGISwapChain1 * swapchain;
+	if (FAILED(state.factory->lpVtbl->CreateSwapChainForHwnd(state.factory, (IUnknown *) state.cmdqueue, target->hwnd, &swap_desc, NULL, NULL, &swapchain))) {
+		return 1;
+	}
+	target->swapchain = (IDXGISwapChain3 *) swapchain;
+
+	for (UINT i = 0; i < vp->frames; ++i) {
+		if (FAILED(target->swapchain->lpVtbl->GetBuffer(target->swapchain, i, &IID_ID3D12Resource, (void **) &target->buffers[i]))) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int viewport_d3d_create_headless(viewport_t * vp, d3d_viewport_t * target) {
+	D3D12_HEAP_PROPERTIES heap_props = {
+		.Type = D3D12_HEAP_TYPE_DEFAULT,
+		.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+		.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
+		.CreationNodeMask = 1,
+		.VisibleNodeMask = 1,
+	};
+
+	D3D12_RESOURCE_DESC desc = {
+		.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D,
+		.Alignment = 0,
+		.Width = vp->width,
+		.Height = vp->height,
+		.DepthOrArraySize = 1,
+		.MipLevels = 1,
+		.Format = DXGI_FORMAT_R8G8B8A8_UNORM,
+		.SampleDesc = {
+			.Count = 1,
+			.Quality = 0,
+		},
+		.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN,
+		.Flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET,
+	};
+
+	/* common and present are the same state, so recording is the same as for a swapchain buffer */
+	for (UINT i = 0; i < vp->frames; ++i) {
+		if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &heap_props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COMMON, NULL, &IID_ID3D12Resource, (void **) &target->buffers[i]))) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int viewport_d3d_create(void * user, UINT index, viewport_t * vp) {
+	d3d_viewport_t * target = &state.viewport_targets[index];
+	memset(target, 0, sizeof(*target));
+	vp->target = target;
+
+	int err = vp->kind == VIEWPORT_WINDOW ? viewport_d3d_create_window(vp, target) : viewport_d3d_create_headless(vp, target);
+	if (err == 0) {
+		D3D12_CPU_DESCRIPTOR_HANDLE handle;
+		state.viewport_rtvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.viewport_rtvheap, &handle);
+		for (UINT i = 0; i < vp->frames && err == 0; ++i) {
+			D3D12_CPU_DESCRIPTOR_HANDLE rtv = { handle.ptr + (SIZE_T) (vp->rtv_base + i) * state.rtvsize };
+			state.device->lpVtbl->CreateRenderTargetView(state.device, target->buffers[i], NULL, rtv);
+			err = FAILED(state.device->lpVtbl->CreateCommandAllocator(state.device, D3D12_COMMAND_LIST_TYPE_DIRECT, &IID_ID3D12CommandAllocator, (void **) &target->allocators[i]));
+		}
+	}
+	if (err == 0) {
+		err = FAILED(state.device->lpVtbl->CreateCommandList(state.device, 0, D3D12_COMMAND_LIST_TYPE_DIRECT, target->allocators[0], NULL, &IID_ID3D12GraphicsCommandList, (void **) &target->list));
+	}
+	if (err == 0) {
+		err = FAILED(target->list->lpVtbl->Close(target->list));
+	}
+
+	if (err != 0) {
+		viewport_d3d_destroy(user, index, vp);
+	}
+	return err;
+}
+
+/* the main window's sequence again, at the viewport's size and without depth */
+static int viewport_d3d_record(void * user, UINT index, viewport_t * vp) {
+	d3d_viewport_t * target = vp->target;
+	ID3D12GraphicsCommandList * list = target->list;
+	ID3D12CommandAllocator * allocator = target->allocators[vp->slot];
+	UINT buffer = vp->kind == VIEWPORT_WINDOW ? target->swapchain->lpVtbl->GetCurrentBackBufferIndex(target->swapchain) : vp->slot;
+
+	if (FAILED(allocator->lpVtbl->Reset(allocator)) || FAILED(list->lpVtbl->Reset(list, allocator, state.viewport_pso))) {
+		return 1;
+	}
+
+	D3D12_VIEWPORT viewport = {
+		.TopLeftX = 0,
+		.TopLeftY = 0,
+		.Width = vp->width,
+		.Height = vp->height,
+		.MinDepth = 0,
+		.MaxDepth = 1,
+	};
+
+	D3D12_RECT scissor = {
+		.left = 0,
+		.top = 0,
+		.right = vp->width,
+		.bottom = vp->height,
+	};
+
+	list->lpVtbl->SetDescriptorHeaps(list, 1, &state.srvheap);
+	list->lpVtbl->SetGraphicsRootSignature(list, state.root_sig);
+	list->lpVtbl->RSSetViewports(list, 1, &viewport);
+	list->lpVtbl->RSSetScissorRects(list, 1, &scissor);
+
+	D3D12_RESOURCE_BARRIER barrier = {
+		.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
+		.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+		.Transition = {
+			.pResource = target->buffers[buffer],
+			.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+			.StateBefore = D3D12_RESOURCE_STATE_PRESENT,
+			.StateAfter = D3D12_RESOURCE_STATE_RENDER_TARGET,
+		},
+	};
+	list->lpVtbl->ResourceBarrier(list, 1, &barrier);
+
+	D3D12_CPU_DESCRIPTOR_HANDLE rtv;
+	state.viewport_rtvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.viewport_rtvheap, &rtv);
+	rtv.ptr += (SIZE_T) (vp->rtv_base + buffer) * state.rtvsize;
+	list->lpVtbl->OMSetRenderTargets(list, 1, &rtv, FALSE, NULL);
+	list->lpVtbl->ClearRenderTargetView(list, rtv, (float[4]) { 0, 0.25f + 0.05f * index, 1, 1 }, 0, NULL);
+
+	draw_sequence_t sequence = *state.viewport_sequence;
+	for (UINT i = 0; i < PSO_COUNT; ++i) {
+		sequence.pso[i] = state.viewport_pso;
+	}
+	record_sequence(list, &sequence);
+
+	barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET;
+	barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_PRESENT;
+	list->lpVtbl->ResourceBarrier(list, 1, &barrier);
+
+	if (FAILED(list->lpVtbl->Close(list))) {
+		return 1;
+	}
+
+	vp->list = list;
+	return 0;
+}
+
+/* interval 0, the main window's present already paces the frame */
+static int viewport_d3d_present(void * user, UINT index, viewport_t * vp) {
+	d3d_viewport_t * target = vp->target;
+	return FAILED(target->swapchain->lpVtbl->Present(target->swapchain, 0, 0));
+}
+
+static int viewport_d3d_submit(void * user, void * const * lists, UINT count) {
+	state.cmdqueue->lpVtbl->ExecuteCommandLists(state.cmdqueue, count, (ID3D12CommandList * const *) lists);
+	return 0;
+}
+
+static UINT64 viewport_d3d_signal(void * user) {
+	if (FAILED(state.cmdqueue->lpVtbl->Signal(state.cmdqueue, state.fence, state.fence_value + 1))) {
+		return state.fence_value;
+	}
+	return ++state.fence_value;
+}
+
+static UINT64 viewport_d3d_completed(void * user) {
+	return state.fence->lpVtbl->GetCompletedValue(state.fence);
+}
+
+static int viewport_d3d_wait(void * user, UINT64 fence) {
+	if (FAILED(state.fence->lpVtbl->SetEventOnCompletion(state.fence, fence, state.fence_event))) {
+		return 1;
+	}
+	WaitForSingleObject(state.fence_event, INFINITE);
+	return 0;
+}
+
+/* stream_update runs while the frame records, the work recorded now completes on the signal after the frame's submission */
+static UINT64 stream_d3d_fence(void * user) {
+	return state.fence_value + 1;
+}
+
+static UINT64 stream_d3d_completed(void * user) {
+	return state.fence->lpVtbl->GetCompletedValue(state.fence);
+}
+
+static BYTE * stream_d3d_staging(void * user, UINT slot) {
+	return state.stream_staging_data + (SIZE_T) slot * state.stream.staging_bytes;
+}
+
+static D3D12_RESOURCE_BARRIER texture_barrier(ID3D12Resource * resource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after) {
+	return (D3D12_RESOURCE_BARRIER) {
+		.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
+		.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+		.Transition = {
+			.pResource = resource,
+			.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+			.StateBefore = before,
+			.StateAfter = after,
+		},
+	};
+}
+
+/* a new resource for the resident range, the mips both hold are copied across on the GPU */
+static int stream_d3d_resize(void * user, UINT texture, UINT first, UINT old_first) {
+	stream_pack_texture_t const * tex = &state.pack.textures[texture];
+	stream_pack_mip_t const * top = &state.pack.mips[tex->first_mip + first];
+	ID3D12GraphicsCommandList * list = state.cmdlist;
+
+	D3D12_HEAP_PROPERTIES heap_props = {
+		.Type = D3D12_HEAP_TYPE_DEFAULT,
+		.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+		.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
+		.CreationNodeMask = 1,
+		.VisibleNodeMask = 1,
+	};
+
+	D3D12_RESOURCE_DESC desc = {
+		.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D,
+		.Alignment = 0,
+		.Width = top->width,
+		.Height = top->height,
+		.DepthOrArraySize = 1,
+		.MipLevels = (UINT16) (tex->mips - first),
+		.Format = tex->format,
+		.SampleDesc = {
+			.Count = 1,
+			.Quality = 0,
+		},
+		.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN,
+		.Flags = D3D12_RESOURCE_FLAG_NONE,
+	};
+
+	ID3D12Resource * resource;
+	if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &heap_props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COPY_DEST, NULL, &IID_ID3D12Resource, (void **) &resource))) {
+		return 1;
+	}
+
+	ID3D12Resource * old = state.textures[texture];
+	if (old != NULL) {
+		D3D12_RESOURCE_BARRIER barrier = texture_barrier(old, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE);
+		list->lpVtbl->ResourceBarrier(list, 1, &barrier);
+		for (UINT m = first > old_first ? first : old_first; m < tex->mips; ++m) {
+			D3D12_TEXTURE_COPY_LOCATION dst = {
+				.pResource = resource,
+				.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
+				.SubresourceIndex = m - first,
+			};
+			D3D12_TEXTURE_COPY_LOCATION src = {
+				.pResource = old,
+				.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
+				.SubresourceIndex = m - old_first,
+			};
+			list->lpVtbl->CopyTextureRegion(list, &dst, 0, 0, 0, &src, NULL);
+		}
+		release_defer((IUnknown *) old, stream_d3d_fence(user), 0);
+	}
+
+	state.textures[texture] = resource;
+	state.texture_first[texture] = first;
+	return 0;
+}
+
+static int stream_d3d_upload(void * user, UINT texture, UINT mip, UINT slot, UINT64 offset) {
+	stream_pack_texture_t const * tex = &state.pack.textures[texture];
+	stream_pack_mip_t const * footprint = &state.pack.mips[tex->first_mip + mip];
+
+	D3D12_TEXTURE_COPY_LOCATION dst = {
+		.pResource = state.textures[texture],
+		.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
+		.SubresourceIndex = mip - state.texture_first[texture],
+	};
+	D3D12_TEXTURE_COPY_LOCATION src = {
+		.pResource = state.stream_staging,
+		.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT,
+		.PlacedFootprint = {
+			.Offset = (UINT64) slot * state.stream.staging_bytes + offset,
+			.Footprint = {
+				.Format = tex->format,
+				.Width = footprint->width,
+				.Height = footprint->height,
+				.Depth = 1,
+				.RowPitch = footprint->row_pitch,
+			},
+		},
+	};
+	state.cmdlist->lpVtbl->CopyTextureRegion(state.cmdlist, &dst, 0, 0, 0, &src, NULL);
+	return 0;
+}
+
+/* the previous frame has finished by the time this one records, so the SRV is rewritten in place */
+static int stream_d3d_bind(void * user, UINT texture, UINT first) {
+	ID3D12Resource * resource = state.textures[texture];
+	D3D12_RESOURCE_BARRIER barrier = texture_barrier(resource, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	state.cmdlist->lpVtbl->ResourceBarrier(state.cmdlist, 1, &barrier);
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc = {
+		.Format = state.pack.textures[texture].format,
+		.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D,
+		.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING,
+		.Texture2D = {
+			.MostDetailedMip = 0,
+			.MipLevels = (UINT) -1,
+			.PlaneSlice = 0,
+			.ResourceMinLODClamp = 0,
+		},
+	};
+
+	D3D12_CPU_DESCRIPTOR_HANDLE handle;
+	state.srvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.srvheap, &handle);
+	handle.ptr += (SIZE_T) texture * state.srvsize;
+	state.device->lpVtbl->CreateShaderResourceView(state.device, resource, &srv_desc, handle);
+	return 0;
+}
+
+#define TEXTURE_COUNT 8
+#define TEXTURE_SIZE 512
+
+/* a checkerboard per texture, each with its own cell size and tint, over a gradient */
+static void generate_texture(UINT index, BYTE * rgba) {
+	UINT cell = 8u << (index % 4);
+	BYTE tint[3] = { (BYTE) (index & 1 ? 255 : 96), (BYTE) (index & 2 ? 255 : 96), (BYTE) (index & 4 ? 255 : 96) };
+	for (UINT y = 0; y < TEXTURE_SIZE; ++y) {
+		for (UINT x = 0; x < TEXTURE_SIZE; ++x) {
+			BOOL dark = ((x / cell) ^ (y / cell)) & 1;
+			BYTE * p = rgba + ((SIZE_T) y * TEXTURE_SIZE + x) * 4;
+			for (UINT c = 0; c < 3; ++c) {
+				UINT shade = dark ? 64 : 192 + (x + y) * 63 / (2 * TEXTURE_SIZE);
+				p[c] = (BYTE) (shade * tint[c] / 255);
+			}
+			p[3] = 255;
+		}
+	}
+}
+
+static int write_texture_pack(char const * path) {
+	BYTE * pixels = malloc((SIZE_T) TEXTURE_SIZE * TEXTURE_SIZE * 4 * TEXTURE_COUNT);
+	if (pixels == NULL) {
+		return 1;
+	}
+
+	stream_source_t sources[TEXTURE_COUNT];
+	for (UINT t = 0; t < TEXTURE_COUNT; ++t) {
+		sources[t] = (stream_source_t) {
+			.width = TEXTURE_SIZE,
+			.height = TEXTURE_SIZE,
+			.rgba = pixels + (SIZE_T) TEXTURE_SIZE * TEXTURE_SIZE * 4 * t,
+		};
+		generate_texture(t, pixels + (SIZE_T) TEXTURE_SIZE * TEXTURE_SIZE * 4 * t);
+	}
+
+	UINT64 size;
+	LONGLONG start = timer_now();
+	void * pack = stream_pack_build(sources, TEXTURE_COUNT, state.texture_format, state.texture_quality, &size);
+	free(pixels);
+	if (pack == NULL) {
+		return 1;
+	}
+	fprintf(stderr, "textures: %u textures written as %s (%s) in %.1f ms\n", TEXTURE_COUNT, stream_format_name(state.texture_format), bc_quality_names[state.texture_quality], timer_ms(timer_now() - start));
+
+	FILE * fp = fopen(path, "wb");
+	int err = fp == NULL || fwrite(pack, 1, size, fp) != size;
+	if (fp != NULL) {
+		fclose(fp);
+	}
+	free(pack);
+	return err;
+}
+
+/* maps the container, nothing is loaded until the first frame asks for the tails */
+static int init_textures(void) {
+	BOOL missing = GetFileAttributesA(state.pack_path) == INVALID_FILE_ATTRIBUTES;
+	if ((missing || state.texture_reencode) && write_texture_pack(state.pack_path) != 0) {
+		FAIL(33, "Failed to write texture container %s\n", state.pack_path);
+	}
+
+	LARGE_INTEGER size;
+	state.pack_file = CreateFileA(state.pack_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (state.pack_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(state.pack_file, &size)) {
+		FAIL(33, "Failed to open texture container %s\n", state.pack_path);
+	}
+	state.pack_mapping = CreateFileMappingA(state.pack_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (state.pack_mapping != NULL) {
+		state.pack_view = MapViewOfFile(state.pack_mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (state.pack_view == NULL) {
+		FAIL(33, "Failed to map texture container %s\n", state.pack_path);
+	}
+	if (stream_pack_parse(&state.pack, state.pack_view, (UINT64) size.QuadPart) != 0) {
+		FAIL(33, "%s is not a valid texture container\n", state.pack_path);
+	}
+
+	D3D12_DESCRIPTOR_HEAP_DESC heap_desc = {
+		.NumDescriptors = STREAM_MAX_TEXTURES,
+		.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV,
+		.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE,
+	};
+
+	if (FAILED(state.device->lpVtbl->CreateDescriptorHeap(state.device, &heap_desc, &IID_ID3D12DescriptorHeap, &state.srvheap))) {
+		FAIL(7, "Failed to create descriptor heap\n");
+	}
+	TRACK(&state.srvheap, 0);
+	state.srvsize = state.device->lpVtbl->GetDescriptorHandleIncrementSize(state.device, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+	/* null views read as zero until a texture's tail is in */
+	D3D12_SHADER_RESOURCE_VIEW_DESC null_desc = {
+		.Format = DXGI_FORMAT_R8G8B8A8_UNORM,
+		.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D,
+		.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING,
+		.Texture2D = {
+			.MostDetailedMip = 0,
+			.MipLevels = 1,
+		},
+	};
+	D3D12_CPU_DESCRIPTOR_HANDLE handle;
+	state.srvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.srvheap, &handle);
+	for (UINT t = 0; t < STREAM_MAX_TEXTURES; ++t) {
+		state.device->lpVtbl->CreateShaderResourceView(state.device, NULL, &null_desc, handle);
+		handle.ptr += state.srvsize;
+	}
+
+	/* committed rather than placed in state.upload, a defragment must not move it under a load job */
+	UINT64 staging_bytes = stream_staging_size(&state.pack);
+	D3D12_HEAP_PROPERTIES heap_props = {
+		.Type = D3D12_HEAP_TYPE_UPLOAD,
+		.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+		.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
+		.CreationNodeMask = 1,
+		.VisibleNodeMask = 1,
+	};
+	D3D12_RESOURCE_DESC desc = buffer_desc(staging_bytes * STREAM_SLOTS);
+	if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &heap_props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, &IID_ID3D12Resource, (void **) &state.stream_staging))) {
+		FAIL(33, "Failed to create texture staging buffer\n");
+	}
+	TRACK(&state.stream_staging, staging_bytes * STREAM_SLOTS);
+
+	D3D12_RANGE range = {
+		.Begin = 0,
+		.End = 0,
+	};
+	if (FAILED(state.stream_staging->lpVtbl->Map(state.stream_staging, 0, &range, (void **) &state.stream_staging_data))) {
+		FAIL(33, "Failed to map texture staging buffer\n");
+	}
+
+	int err = stream_init(&state.stream, &state.pack, state.texture_budget, staging_bytes, (stream_backend_t) {
+		.staging = stream_d3d_staging,
+		.resize = stream_d3d_resize,
+		.upload = stream_d3d_upload,
+		.bind = stream_d3d_bind,
+		.fence = stream_d3d_fence,
+		.completed = stream_d3d_completed,
+		.user = NULL,
+	});
+	if (err != 0) {
+		FAIL(33, "A texture budget of %llu MiB doesn't hold the smallest mips\n", (unsigned long long) (state.texture_budget >> 20));
+	}
+
+	return 0;
+}
+
+/* VIEWPORT_FRAMES descriptors per viewport, whether or not it uses them all */
+static int init_viewports(void) {
+	D3D12_DESCRIPTOR_HEAP_DESC heap_desc = {
+		.NumDescriptors = VIEWPORT_MAX * VIEWPORT_FRAMES,
+		.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV,
+		.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE,
+	};
+
+	if (FAILED(state.device->lpVtbl->CreateDescriptorHeap(state.device, &heap_desc, &IID_ID3D12DescriptorHeap, &state.viewport_rtvheap))) {
+		FAIL(7, "Failed to create descriptor heap\n");
+	}
+	TRACK(&state.viewport_rtvheap, 0);
+
+	for (UINT i = 0; i < state.window_viewports + state.headless_viewports; ++i) {
+		BOOL window = i < state.window_viewports;
+		UINT index = viewport_add(&state.viewports, window ? VIEWPORT_WINDOW : VIEWPORT_HEADLESS, window ? 320 : state.width, window ? 240 : state.height, 2);
+		if (index == VIEWPORT_NONE) {
+			FAIL(32, "Failed to create %s viewport %u\n", window ? "window" : "headless", i);
+		}
+	}
+
+	return 0;
+}
+
+static int init_window(void) {
+	WNDCLASSEXA wc = {
+		.cbSize = sizeof(WNDCLASSEXA),
+		.style = CS_HREDRAW | CS_VREDRAW,
+		.lpfnWndProc = wnd_proc,
+		.cbClsExtra = 0,
+		.cbWndExtra = 0,
+		.hInstance = GetModuleHandle(NULL),
+		.hIcon = LoadIcon(NULL, IDC_ARROW),
+		.hCursor = LoadCursor(NULL, IDC_ARROW),
+		.hbrBackground = (HBRUSH) GetStockObject(0),
+		.lpszClassName = "d3d12",
+		.hIconSm = LoadImageA(GetModuleHandle(NULL), MAKEINTRESOURCEA(5), IMAGE_ICON, GetSystemMetrics(SM_CXSMICON), GetSystemMetrics(SM_CYSMICON), LR_DEFAULTCOLOR),
+	};
+
+	RegisterClassExA(&wc);
+
+	{
+		RECT rect = {
+			.top = 0,
+			.left = 0,
+			.right = state.width,
+			.bottom = state.height,
+		};
+		AdjustWindowRectEx(&rect, WS_OVERLAPPEDWINDOW, FALSE, 0);
+
+		state.hwnd = CreateWindowExA(0, wc.lpszClassName, "d3d12", WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT, rect.right - rect.left, rect.bottom - rect.top, NULL, NULL, wc.hInstance, NULL);
+	}
+
+	ShowWindow(state.hwnd, SW_SHOWDEFAULT);
+	UpdateWindow(state.hwnd);
+
+	return 0;
+}
+
+static int init_factory(void) {
+	UINT factory_flags = 0;
+
+	#ifdef _DEBUG
+	{
+		ID3D12Debug * debug;
+		if (SUCCEEDED(D3D12GetDebugInterface(&IID_ID3D12Debug, (void **) &debug))) {
+			debug->lpVtbl->EnableDebugLayer(debug);
+			factory_flags |= DXGI_CREATE_FACTORY_DEBUG;
+		}
+	}
+
+	{
+		IDXGIDebug1 * debug;
+		if (SUCCEEDED(DXGIGetDebugInterface1(0, &IID_IDXGIDebug1, (void **) &debug))) {
+			debug->lpVtbl->EnableLeakTrackingForThread(debug);
+		}
+	}
+	#endif
+
+	if (FAILED(CreateDXGIFactory2(factory_flags, &IID_IDXGIFactory4, (void **) &state.factory))) {
+		FAIL(1, "Failed to create factory\n");
+	}
+	TRACK(&state.factory, 0);
+
+	return 0;
+}
+
+static D3D_FEATURE_LEVEL const probe_levels[] = {
+	D3D_FEATURE_LEVEL_12_1,
+	D3D_FEATURE_LEVEL_12_0,
+	D3D_FEATURE_LEVEL_11_1,
+	D3D_FEATURE_LEVEL_11_0,
+};
+
+/* no device is created, a NULL output only asks whether one could be */
+static UINT probe_feature_level(IDXGIAdapter1 * adapter) {
+	for (UINT i = 0; i < sizeof(probe_levels) / sizeof(probe_levels[0]); ++i) {
+		if (SUCCEEDED(D3D12CreateDevice((IUnknown *) adapter, probe_levels[i], &IID_ID3D12Device, NULL))) {
+			return probe_levels[i];
+		}
+	}
+
+	return 0;
+}
+
+static void describe_adapter(IDXGIAdapter1 * adapter, UINT preference, adapter_info_t * info) {
+	DXGI_ADAPTER_DESC1 desc;
+	memset(info, 0, sizeof(*info));
+	adapter->lpVtbl->GetDesc1(adapter, &desc);
+
+	WideCharToMultiByte(CP_UTF8, 0, desc.Description, -1, info->name, sizeof(info->name), NULL, NULL);
+	info->vendor = desc.VendorId;
+	info->device = desc.DeviceId;
+	info->dedicated_video_memory = desc.DedicatedVideoMemory;
+	info->shared_system_memory = desc.SharedSystemMemory;
+	info->software = (desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE) != 0;
+	info->feature_level = probe_feature_level(adapter);
+	info->preference = preference;
+}
+
+/* in the OS's preference order where IDXGIFactory6 is there to ask, plain order otherwise */
+static UINT enumerate_adapters(IDXGIAdapter1 ** adapters, adapter_info_t * infos) {
+	UINT count = 0;
+
+	IDXGIFactory6 * factory6;
+	if (SUCCEEDED(state.factory->lpVtbl->QueryInterface(state.factory, &IID_IDXGIFactory6, (void **) &factory6))) {
+		DXGI_GPU_PREFERENCE preference = state.low_power ? DXGI_GPU_PREFERENCE_MINIMUM_POWER : DXGI_GPU_PREFERENCE_HIGH_PERFORMANCE;
+		while (count < ADAPTER_MAX && SUCCEEDED(factory6->lpVtbl->EnumAdapterByGpuPreference(factory6, count, preference, &IID_IDXGIAdapter1, (void **) &adapters[count]))) {
+			describe_adapter(adapters[count], count, &infos[count]);
+			++count;
+		}
+		factory6->lpVtbl->Release(factory6);
+		return count;
+	}
+
+	while (count < ADAPTER_MAX && SUCCEEDED(state.factory->lpVtbl->EnumAdapters1(state.factory, count, &adapters[count]))) {
+		describe_adapter(adapters[count], ADAPTER_NO_PREFERENCE, &infos[count]);
+		++count;
+	}
+	return count;
+}
+
+static int init_device(void) {
+	IDXGIAdapter1 * adapters[ADAPTER_MAX];
+	adapter_info_t infos[ADAPTER_MAX];
+	adapter_prefs_t prefs = {
+		.min_feature_level = D3D_FEATURE_LEVEL_11_0,
+		.allow_software = state.allow_software,
+	};
+
+	UINT count = state.force_warp ? 0 : enumerate_adapters(adapters, infos);
+	UINT chosen = adapter_pick(infos, count, &prefs);
+	adapter_log(infos, count, &prefs, chosen, stderr);
+
+	IDXGIAdapter1 * adapter;
+	if (chosen != ADAPTER_NONE) {
+		adapter = adapters[chosen];
+		adapter->lpVtbl->AddRef(adapter);
+	} else {
+		fprintf(stderr, "adapter: %s, falling back to WARP\n", state.force_warp ? "-warp given" : "no hardware adapter fits");
+		if (FAILED(state.factory->lpVtbl->EnumWarpAdapter(state.factory, &IID_IDXGIAdapter1, (void **) &adapter))) {
+			adapter = NULL;
+		}
+	}
+	for (UINT i = 0; i < count; ++i) {
+		adapters[i]->lpVtbl->Release(adapters[i]);
+	}
+	if (adapter == NULL) {
+		FAIL(2, "Failed to enumerate adapters\n");
+	}
+
+	if (FAILED(D3D12CreateDevice((IUnknown *) adapter, D3D_FEATURE_LEVEL_11_0, &IID_ID3D12Device, &state.device))) {
+		adapter->lpVtbl->Release(adapter);
+		FAIL(3, "Failed to create device\n");
+	}
+
+	/* upload heaps live in the non-local segment, hold them to what the OS grants us */
+	IDXGIAdapter3 * adapter3;
+	if (SUCCEEDED(adapter->lpVtbl->QueryInterface(adapter, &IID_IDXGIAdapter3, (void **) &adapter3))) {
+		DXGI_QUERY_VIDEO_MEMORY_INFO info;
+		if (SUCCEEDED(adapter3->lpVtbl->QueryVideoMemoryInfo(adapter3, 0, DXGI_MEMORY_SEGMENT_GROUP_NON_LOCAL, &info))) {
+			gpumem_set_budget(&state.upload, info.Budget > info.CurrentUsage ? info.Budget - info.CurrentUsage : 0);
+		}
+		adapter3->lpVtbl->Release(adapter3);
+	}
+
+	adapter->lpVtbl->Release(adapter);
+	TRACK(&state.device, 0);
+
+	return 0;
+}
+
+static int init_queue(void) {
+	D3D12_COMMAND_QUEUE_DESC queue_desc = {
+		.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE,
+		.Type = D3D12_COMMAND_LIST_TYPE_DIRECT,
+	};
+
+	if (FAILED(state.device->lpVtbl->CreateCommandQueue(state.device, &queue_desc, &IID_ID3D12CommandQueue, &state.cmdqueue))) {
+		FAIL(4, "Failed to create command queue\n");
+	}
+	TRACK(&state.cmdqueue, 0);
+
+	return 0;
+}
+
+static int init_compute_queue(void) {
+	D3D12_COMMAND_QUEUE_DESC queue_desc = {
+		.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE,
+		.Type = D3D12_COMMAND_LIST_TYPE_COMPUTE,
+	};
+
+	if (FAILED(state.device->lpVtbl->CreateCommandQueue(state.device, &queue_desc, &IID_ID3D12CommandQueue, &state.computequeue))) {
+		FAIL(28, "Failed to create compute queue\n");
+	}
+	TRACK(&state.computequeue, 0);
+
+	if (FAILED(state.device->lpVtbl->CreateCommandAllocator(state.device, D3D12_COMMAND_LIST_TYPE_COMPUTE, &IID_ID3D12CommandAllocator, &state.computeallocator))) {
+		FAIL(9, "Failed to create command allocator\n");
+	}
+	TRACK(&state.computeallocator, 0);
+
+	return 0;
+}
+
+static int init_swapchain(void) {
+	/* tearing needs a flag at creation, the waitable object too; both cost nothing when unused */
+	IDXGIFactory5 * factory5;
+	if (SUCCEEDED(state.factory->lpVtbl->QueryInterface(state.factory, &IID_IDXGIFactory5, (void **) &factory5))) {
+		BOOL allow = FALSE;
+		if (SUCCEEDED(factory5->lpVtbl->CheckFeatureSupport(factory5, DXGI_FEATURE_PRESENT_ALLOW_TEARING, &allow, sizeof(allow)))) {
+			state.tearing = allow;
+		}
+		factory5->lpVtbl->Release(factory5);
+	}
+
+	DXGI_SWAP_CHAIN_DESC1 swap_desc = {
+		.BufferCount = state.framecount,
+		.Width = state.width,
+		.Height = state.height,
+		.Format = DXGI_FORMAT_R8G8B8A8_UNORM,
+		.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT,
+		.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD,
+		.SampleDesc = {
+			.Count = 1,
+			.Quality = 0,
+		},
+		.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT | (state.tearing ? DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING : 0),
+	};
+
+	IDXGISwapChain1 * swapchain;
+	if (FAILED(state.factory->lpVtbl->CreateSwapChainForHwnd(state.factory, (IUnknown *) state.cmdqueue, state.hwnd, &swap_desc, NULL, NULL, &swapchain))) {
+		FAIL(5, "Failed to create swapchain\n");
+	}
+
+	state.swapchain = (IDXGISwapChain3 *) swapchain;
+	TRACK(&state.swapchain, 0);
+
+	if (FAILED(state.factory->lpVtbl->MakeWindowAssociation(state.factory, state.hwnd, DXGI_MWA_NO_ALT_ENTER))) {
+		FAIL(6, "Failed to make window association\n");
+	}
+
+	state.frameindex = state.swapchain->lpVtbl->GetCurrentBackBufferIndex(state.swapchain);
+
+	state.latency_object = state.swapchain->lpVtbl->GetFrameLatencyWaitableObject(state.swapchain);
+	if (state.latency_object == NULL) {
+		FAIL(5, "Failed to get frame latency waitable object\n");
+	}
+
+	return 0;
+}
+
+static int init_rtv(void) {
+	D3D12_DESCRIPTOR_HEAP_DESC heap_desc = {
+		.NumDescriptors = state.framecount,
+		.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV,
+		.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE,
+	};
+
+	if (FAILED(state.device->lpVtbl->CreateDescriptorHeap(state.device, &heap_desc, &IID_ID3D12DescriptorHeap, &state.rtvheap))) {
+		FAIL(7, "Failed to create descriptor heap\n");
+	}
+	TRACK(&state.rtvheap, 0);
+
+	state.rtvsize = state.device->lpVtbl->GetDescriptorHandleIncrementSize(state.device, D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+
+	D3D12_CPU_DESCRIPTOR_HANDLE handle;
+	state.rtvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.rtvheap, &handle);
+	for (UINT i = 0; i < state.framecount; ++i) {
+		ID3D12Resource * resource;
+		if (FAILED(state.swapchain->lpVtbl->GetBuffer(state.swapchain, i, &IID_ID3D12Resource, &resource))) {
+			FAIL(8, "Failed to get swapchain buffer\n");
+		}
+
+		state.device->lpVtbl->CreateRenderTargetView(state.device, resource, NULL, handle);
+		state.framebuffers[i] = resource;
+		TRACK(&state.framebuffers[i], 0);
+
+		handle.ptr += state.rtvsize;
+	}
+
+	return 0;
+}
+
+static int init_dsv(void) {
+	D3D12_DESCRIPTOR_HEAP_DESC heap_desc = {
+		.NumDescriptors = 1,
+		.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV,
+		.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE,
+	};
+
+	if (FAILED(state.device->lpVtbl->CreateDescriptorHeap(state.device, &heap_desc, &IID_ID3D12DescriptorHeap, &state.dsvheap))) {
+		FAIL(7, "Failed to create descriptor heap\n");
+	}
+	TRACK(&state.dsvheap, 0);
+
+	D3D12_HEAP_PROPERTIES heap_props = {
+		.Type = D3D12_HEAP_TYPE_DEFAULT,
+		.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+		.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
+		.CreationNodeMask = 1,
+		.VisibleNodeMask = 1,
+	};
+
+	D3D12_RESOURCE_DESC desc = {
+		.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D,
+		.Alignment = 0,
+		.Width = state.width,
+		.Height = state.height,
+		.DepthOrArraySize = 1,
+		.MipLevels = 1,
+		.Format = DXGI_FORMAT_D32_FLOAT,
+		.SampleDesc = {
+			.Count = 1,
+			.Quality = 0,
+		},
+		.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN,
+		.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL | D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE,
+	};
+
+	D3D12_CLEAR_VALUE clear = {
+		.Format = DXGI_FORMAT_D32_FLOAT,
+		.DepthStencil = {
+			.Depth = 1.0f,
+			.Stencil = 0,
+		},
+	};
+
+	if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &heap_props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_DEPTH_WRITE, &clear, &IID_ID3D12Resource, &state.depthbuffer))) {
+		FAIL(26, "Failed to create depth buffer\n");
+	}
+	TRACK(&state.depthbuffer, (UINT64) state.width * state.height * 4);
+
+	D3D12_DEPTH_STENCIL_VIEW_DESC dsv_desc = {
+		.Format = DXGI_FORMAT_D32_FLOAT,
+		.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D,
+		.Flags = D3D12_DSV_FLAG_NONE,
+		.Texture2D = {
+			.MipSlice = 0,
+		},
+	};
+
+	D3D12_CPU_DESCRIPTOR_HANDLE handle;
+	state.dsvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.dsvheap, &handle);
+	state.device->lpVtbl->CreateDepthStencilView(state.device, state.depthbuffer, &dsv_desc, handle);
+
+	return 0;
+}
+
+static int init_allocator(void) {
+	if (FAILED(state.device->lpVtbl->CreateCommandAllocator(state.device, D3D12_COMMAND_LIST_TYPE_DIRECT, &IID_ID3D12CommandAllocator, &state.cmdallocator))) {
+		FAIL(9, "Failed to create command allocator\n");
+	}
+	TRACK(&state.cmdallocator, 0);
+
+	return 0;
+}
+
+static int init_root_sig(void) {
+	D3D12_FEATURE_DATA_ROOT_SIGNATURE feat_data = {
+		.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1,
+	};
+
+	if (FAILED(state.device->lpVtbl->CheckFeatureSupport(state.device, D3D12_FEATURE_ROOT_SIGNATURE, &feat_data, sizeof(feat_data)))) {
+		feat_data.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+	}
+
+	/* the streamed texture, t2 in main.hlsl */
+	D3D12_DESCRIPTOR_RANGE range = {
+		.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV,
+		.NumDescriptors = 1,
+		.BaseShaderRegister = 2,
+		.RegisterSpace = 0,
+		.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND,
+	};
+
+	D3D12_ROOT_PARAMETER parameters = {
+		.ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE,
+		.DescriptorTable = {
+			.NumDescriptorRanges = 1,
+			.pDescriptorRanges = &range,
+		},
+		.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL,
+	};
+
+	/* trilinear, so a mip streaming in blends in rather than popping at the boundary */
+	D3D12_STATIC_SAMPLER_DESC sampler = {
+		.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR,
+		.AddressU = D3D12_TEXTURE_ADDRESS_MODE_WRAP,
+		.AddressV = D3D12_TEXTURE_ADDRESS_MODE_WRAP,
+		.AddressW = D3D12_TEXTURE_ADDRESS_MODE_WRAP,
+		.MipLODBias = 0,
+		.MaxAnisotropy = 1,
+		.ComparisonFunc = D3D12_COMPARISON_FUNC_NEVER,
+		.BorderColor = D3D12_STATIC_BORDER_COLOR_OPAQUE_BLACK,
+		.MinLOD = 0,
+		.MaxLOD = D3D12_FLOAT32_MAX,
+		.ShaderRegister = 0,
+		.RegisterSpace = 0,
+		.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL,
+	};
+
+	D3D12_ROOT_SIGNATURE_DESC sig_desc = {
+		.NumParameters = 1,
+		.pParameters = &parameters,
+		.NumStaticSamplers = 1,
+		.pStaticSamplers = &sampler,
+		.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT,
+	};
+
+	ID3DBlob * sig;
+	ID3DBlob * err;
+
+	if (FAILED(D3D12SerializeRootSignature(&sig_desc, D3D_ROOT_SIGNATURE_VERSION_1, &sig, &err))) {
+		FAIL(10, "Failed to serialize root signature\n");
+	}
+
+	if (FAILED(state.device->lpVtbl->CreateRootSignature(state.device, 0, sig->lpVtbl->GetBufferPointer(sig), sig->lpVtbl->GetBufferSize(sig), &IID_ID3D12RootSignature, &state.root_sig))) {
+		FAIL(11, "Failed to create root signature\n");
+	}
+	TRACK(&state.root_sig, 0);
+
+	sig->lpVtbl->Release(sig);
+	if (err != NULL) {
+		err->lpVtbl->Release(err);
+	}
+
+	return 0;
+}
+
+static int create_root_sig(D3D12_ROOT_PARAMETER const * parameters, UINT count, ID3D12RootSignature ** root_sig) {
+	D3D12_ROOT_SIGNATURE_DESC sig_desc = {
+		.NumParameters = count,
+		.pParameters = parameters,
+		.NumStaticSamplers = 0,
+		.pStaticSamplers = NULL,
+		.Flags = D3D12_ROOT_SIGNATURE_FLAG_NONE,
+	};
+
+	ID3DBlob * sig;
+	ID3DBlob * err = NULL;
+
+	if (FAILED(D3D12SerializeRootSignature(&sig_desc, D3D_ROOT_SIGNATURE_VERSION_1, &sig, &err))) {
+		if (err != NULL) {
+			err->lpVtbl->Release(err);
+		}
+		FAIL(10, "Failed to serialize root signature\n");
+	}
+
+	if (FAILED(state.device->lpVtbl->CreateRootSignature(state.device, 0, sig->lpVtbl->GetBufferPointer(sig), sig->lpVtbl->GetBufferSize(sig), &IID_ID3D12RootSignature, root_sig))) {
+		sig->lpVtbl->Release(sig);
+		FAIL(11, "Failed to create root signature\n");
+	}
+	TRACK(root_sig, 0);
+
+	sig->lpVtbl->Release(sig);
+	if (err != NULL) {
+		err->lpVtbl->Release(err);
+	}
+
+	return 0;
+}
+
+/* palette as a root CBV, vertex count as a root constant, input and output as root SRV and UAV */
+static int init_compute_root_sig(void) {
+	D3D12_ROOT_PARAMETER parameters[] = {
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV,
+			.Descriptor = {
+				.ShaderRegister = 1,
+				.RegisterSpace = 0,
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+		},
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS,
+			.Constants = {
+				.ShaderRegister = 2,
+				.RegisterSpace = 0,
+				.Num32BitValues = 1,
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+		},
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV,
+			.Descriptor = {
+				.ShaderRegister = 0,
+				.RegisterSpace = 0,
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+		},
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_UAV,
+			.Descriptor = {
+				.ShaderRegister = 0,
+				.RegisterSpace = 0,
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+		},
+	};
+
+	return create_root_sig(parameters, sizeof(parameters) / sizeof(parameters[0]), &state.compute_root_sig);
+}
+
+/* params and buffer indices as root constants, the buffers as root descriptors */
+static int init_particle_sigs(void) {
+	D3D12_ROOT_PARAMETER compute[] = {
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS,
+			.Constants = {
+				.ShaderRegister = 3,
+				.RegisterSpace = 0,
+				.Num32BitValues = sizeof(particles_params_t) / sizeof(UINT),
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+		},
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS,
+			.Constants = {
+				.ShaderRegister = 4,
+				.RegisterSpace = 0,
+				.Num32BitValues = 3,
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+		},
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV,
+			.Descriptor = {
+				.ShaderRegister = 1,
+				.RegisterSpace = 0,
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+		},
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_UAV,
+			.Descriptor = {
+				.ShaderRegister = 1,
+				.RegisterSpace = 0,
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+		},
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_UAV,
+			.Descriptor = {
+				.ShaderRegister = 2,
+				.RegisterSpace = 0,
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+		},
+	};
+
+	D3D12_ROOT_PARAMETER draw[] = {
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV,
+			.Descriptor = {
+				.ShaderRegister = 0,
+				.RegisterSpace = 0,
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX,
+		},
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV,
+			.Descriptor = {
+				.ShaderRegister = 1,
+				.RegisterSpace = 0,
+			},
+			.ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX,
+		},
+	};
+
+	int err = create_root_sig(compute, sizeof(compute) / sizeof(compute[0]), &state.particle_compute_sig);
+	if (err != 0) {
+		return err;
+	}
+
+	return create_root_sig(draw, sizeof(draw) / sizeof(draw[0]), &state.particle_draw_sig);
+}
+
+static int init_shader_read(void) {
+	FILE * fp = fopen("main.hlsl", "rb");
+	if (fp == NULL) {
+		FAIL(12, "Failed to open main.hlsl\n");
+	}
+
+	fseek(fp, 0, SEEK_END);
+	state.shader.len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	state.shader.src = malloc(state.shader.len + 1);
+	if (state.shader.src == NULL) {
+		fclose(fp);
+		FAIL(13, "Failed to allocate memory for main.hlsl\n");
+	}
+
+	if (fread(state.shader.src, 1, state.shader.len, fp) != state.shader.len) {
+		fclose(fp);
+		FAIL(14, "Failed to read main.hlsl\n");
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static int compile_shader(const char * entry, const char * target, ID3DBlob ** blob, com_handle_t * handle) {
+	UINT flags = 0;
+	#ifdef _DEBUG
+	flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+	#endif
+
+	ID3DBlob * err = NULL;
+
+	if (FAILED(D3DCompile(state.shader.src, state.shader.len, "main.hlsl", NULL, NULL, entry, target, flags, 0, blob, &err))) {
+		if (err != NULL) {
+			OutputDebugStringA(err->lpVtbl->GetBufferPointer(err));
+			fprintf(stderr, "D3DCompiler error: %s\n", (char *) err->lpVtbl->GetBufferPointer(err));
+			err->lpVtbl->Release(err);
+		}
+		return 1;
+	}
+
+	if (err != NULL) {
+		err->lpVtbl->Release(err);
+	}
+
+	*handle = com_track((void **) blob, 0);
+	if (*handle == 0) {
+		FAIL(-1, "Track failure\n");
+	}
+
+	return 0;
+}
+
+static int init_compile_vs(void) {
+	if (compile_shader("vs", "vs_5_0", &state.shader.vs, &state.shader.vs_handle) != 0) {
+		FAIL(15, "Failed to compile vertex shader\n");
+	}
+
+	return 0;
+}
+
+static int init_compile_ps(void) {
+	if (compile_shader("ps", "ps_5_0", &state.shader.ps, &state.shader.ps_handle) != 0) {
+		FAIL(15, "Failed to compile pixel shader\n");
+	}
+
+	return 0;
+}
+
+static int init_compile_cs(void) {
+	if (compile_shader("cs_skin", "cs_5_0", &state.shader.cs, &state.shader.cs_handle) != 0) {
+		FAIL(15, "Failed to compile compute shader\n");
+	}
+
+	return 0;
+}
+
+static int init_compile_particles(void) {
+	static struct {
+		const char * entry;
+		const char * target;
+	} const shaders[PARTICLE_SHADERS] = {
+		[PARTICLE_SHADER_UPDATE] = { "cs_particles_update", "cs_5_0" },
+		[PARTICLE_SHADER_EMIT] = { "cs_particles_emit", "cs_5_0" },
+		[PARTICLE_SHADER_ARGS] = { "cs_particles_args", "cs_5_0" },
+		[PARTICLE_SHADER_VS] = { "vs_particles", "vs_5_0" },
+		[PARTICLE_SHADER_PS] = { "ps_particles", "ps_5_0" },
+	};
+
+	for (UINT i = 0; i < PARTICLE_SHADERS; ++i) {
+		if (compile_shader(shaders[i].entry, shaders[i].target, &state.shader.particles[i], &state.shader.particle_handles[i]) != 0) {
+			FAIL(15, "Failed to compile %s\n", shaders[i].entry);
+		}
+	}
+
+	return 0;
+}
+
+static int init_compute_pso(void) {
+	ID3DBlob * cs = state.shader.cs;
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC cs_desc = {
+		.pRootSignature = state.compute_root_sig,
+		.CS = {
+			cs->lpVtbl->GetBufferPointer(cs),
+			cs->lpVtbl->GetBufferSize(cs),
+		},
+		.NodeMask = 0,
+		.CachedPSO = {
+			.pCachedBlob = NULL,
+			.CachedBlobSizeInBytes = 0,
+		},
+		.Flags = D3D12_PIPELINE_STATE_FLAG_NONE,
+	};
+
+	if (FAILED(state.device->lpVtbl->CreateComputePipelineState(state.device, &cs_desc, &IID_ID3D12PipelineState, &state.skin_pso))) {
+		FAIL(16, "Failed to create pipeline state\n");
+	}
+	TRACK(&state.skin_pso, 0);
+
+	com_retire(state.shader.cs_handle, 0);
+
+	if (FAILED(state.device->lpVtbl->CreateCommandList(state.device, 0, D3D12_COMMAND_LIST_TYPE_COMPUTE, state.computeallocator, state.skin_pso, &IID_ID3D12GraphicsCommandList, &state.computelist))) {
+		FAIL(17, "Failed to create command list\n");
+	}
+	TRACK(&state.computelist, 0);
+
+	state.computelist->lpVtbl->Close(state.computelist);
+
+	return 0;
+}
+
+/* everything pso_desc_t leaves out is the default, which is all this renderer uses */
+static void * pso_create_d3d(void * user, pso_desc_t const * desc) {
+	D3D12_INPUT_ELEMENT_DESC inputs[PSO_MAX_INPUTS];
+	for (UINT i = 0; i < desc->input_count; ++i) {
+		pso_input_t const * in = &desc->inputs[i];
+		inputs[i] = (D3D12_INPUT_ELEMENT_DESC) {
+			.SemanticName = in->semantic,
+			.SemanticIndex = in->semantic_index,
+			.Format = in->format,
+			.InputSlot = in->slot,
+			.AlignedByteOffset = in->offset,
+			.InputSlotClass = in->per_instance ? D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA : D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
+			.InstanceDataStepRate = in->step_rate,
+		};
+	}
+
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC ps_desc = {
+		.InputLayout = {
+			.pInputElementDescs = desc->input_count != 0 ? inputs : NULL,
+			.NumElements = desc->input_count,
+		},
+		.pRootSignature = desc->root_sig,
+		.VS = {
+			desc->vs,
+			desc->vs_size,
+		},
+		.PS = {
+			desc->ps,
+			desc->ps_size,
+		},
+		.RasterizerState = {
+			.FillMode = desc->fill_mode,
+			.CullMode = desc->cull_mode,
+			.FrontCounterClockwise = desc->front_ccw,
+			.DepthBias = desc->depth_bias,
+			.DepthBiasClamp = desc->depth_bias_clamp,
+			.SlopeScaledDepthBias = desc->slope_scaled_depth_bias,
+			.DepthClipEnable = desc->depth_clip,
+			.MultisampleEnable = FALSE,
+			.AntialiasedLineEnable = FALSE,
+			.ForcedSampleCount = 0,
+			.ConservativeRaster = D3D12_CONSERVATIVE_RASTERIZATION_MODE_OFF,
+		},
+		.BlendState = {
+			.AlphaToCoverageEnable = FALSE,
+			.IndependentBlendEnable = FALSE,
+			.RenderTarget = {
+				[0] = {
+					.BlendEnable = desc->blend_enable,
+					.LogicOpEnable = FALSE,
+					.SrcBlend = desc->src_blend,
+					.DestBlend = desc->dest_blend,
+					.BlendOp = desc->blend_op,
+					.SrcBlendAlpha = desc->src_blend_alpha,
+					.DestBlendAlpha = desc->dest_blend_alpha,
+					.BlendOpAlpha = desc->blend_op_alpha,
+					.LogicOp = D3D12_LOGIC_OP_NOOP,
+					.RenderTargetWriteMask = desc->write_mask,
+				},
+			},
+		},
+		.DepthStencilState = {
+			.DepthEnable = desc->depth_enable,
+			.DepthWriteMask = desc->depth_write_mask,
+			.DepthFunc = desc->depth_func,
+			.StencilEnable = FALSE,
+			.StencilReadMask = D3D12_DEFAULT_STENCIL_READ_MASK,
+			.StencilWriteMask = D3D12_DEFAULT_STENCIL_WRITE_MASK,
+			.FrontFace = {
+				.StencilFailOp = D3D12_STENCIL_OP_KEEP,
+				.StencilDepthFailOp = D3D12_STENCIL_OP_KEEP,
+				.StencilPassOp = D3D12_STENCIL_OP_KEEP,
+				.StencilFunc = D3D12_COMPARISON_FUNC_ALWAYS,
+			},
+		},
+		.SampleMask = UINT_MAX,
+		.SampleDesc = {
+			.Count = desc->sample_count,
+			.Quality = desc->sample_quality,
+		},
+		.PrimitiveTopologyType = desc->topology_type,
+		.NumRenderTargets = desc->rtv_count,
+		.DSVFormat = desc->dsv_format,
+	};
+	for (UINT i = 0; i < desc->rtv_count; ++i) {
+		ps_desc.RTVFormats[i] = desc->rtv_formats[i];
+	}
+
+	ID3D12PipelineState * pso;
+	if (FAILED(state.device->lpVtbl->CreateGraphicsPipelineState(state.device, &ps_desc, &IID_ID3D12PipelineState, (void **) &pso))) {
+		return NULL;
+	}
+
+	return pso;
+}
+
+/* frames may still reference it */
+static void pso_release_d3d(void * user, void * pso) {
+	release_defer(pso, state.fence_value, 0);
+}
+
+static pso_input_t const input_desc[] = {
+	{
+		.semantic = "POSITION",
+		.semantic_index = 0,
+		.format = DXGI_FORMAT_R32G32B32A32_FLOAT,
+		.slot = 0,
+		.offset = 0,
+		.per_instance = FALSE,
+		.step_rate = 0,
+	},
+	{
+		.semantic = "COLOR",
+		.semantic_index = 0,
+		.format = DXGI_FORMAT_R32G32B32A32_FLOAT,
+		.slot = 0,
+		.offset = 12,
+		.per_instance = FALSE,
+		.step_rate = 0,
+	},
+};
+
+/* pipelines come from the cache, which owns them; equal descriptions share one object */
+static int init_pso(void) {
+	ID3DBlob * vs = state.shader.vs;
+	ID3DBlob * ps = state.shader.ps;
+
+	if (pso_cache_init(&state.psos, (pso_backend_t) {
+		.create = pso_create_d3d,
+		.release = pso_release_d3d,
+		.user = NULL,
+	}) != 0) {
+		FAIL(16, "Failed to allocate pipeline cache\n");
+	}
 
-		void * cbegin;
-		D3D12_RANGE range = {
-			.Begin = 0,
-			.End = 0,
-		};
+	pso_desc_t desc = {
+		.root_sig = state.root_sig,
+		.vs = vs->lpVtbl->GetBufferPointer(vs),
+		.vs_size = vs->lpVtbl->GetBufferSize(vs),
+		.ps = ps->lpVtbl->GetBufferPointer(ps),
+		.ps_size = ps->lpVtbl->GetBufferSize(ps),
+		.vs_hash = 0,
+		.ps_hash = 0,
+		.inputs = input_desc,
+		.input_count = sizeof(input_desc) / sizeof(input_desc[0]),
+		.fill_mode = D3D12_FILL_MODE_SOLID,
+		.cull_mode = D3D12_CULL_MODE_BACK,
+		.front_ccw = FALSE,
+		.depth_bias = D3D12_DEFAULT_DEPTH_BIAS,
+		.depth_bias_clamp = D3D12_DEFAULT_DEPTH_BIAS_CLAMP,
+		.slope_scaled_depth_bias = D3D12_DEFAULT_SLOPE_SCALED_DEPTH_BIAS,
+		.depth_clip = TRUE,
+		.blend_enable = FALSE,
+		.src_blend = D3D12_BLEND_ONE,
+		.dest_blend = D3D12_BLEND_ZERO,
+		.blend_op = D3D12_BLEND_OP_ADD,
+		.src_blend_alpha = D3D12_BLEND_ONE,
+		.dest_blend_alpha = D3D12_BLEND_ZERO,
+		.blend_op_alpha = D3D12_BLEND_OP_ADD,
+		.write_mask = D3D12_COLOR_WRITE_ENABLE_ALL,
+		.depth_enable = TRUE,
+		.depth_write_mask = D3D12_DEPTH_WRITE_MASK_ALL,
+		.depth_func = D3D12_COMPARISON_FUNC_LESS,
+		.topology_type = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE,
+		.rtv_count = 1,
+		.rtv_formats = { DXGI_FORMAT_R8G8B8A8_UNORM },
+		.dsv_format = DXGI_FORMAT_D32_FLOAT,
+		.sample_count = 1,
+		.sample_quality = 0,
+	};
+
+	for (UINT i = 0; i < PSO_COUNT; ++i) {
+		desc.depth_enable = i == PSO_DEPTH;
 
-		if (FAILED(state.cbo->lpVtbl->Map(state.cbo, 0, &range, &cbegin))) {
-			BAIL(19, "Failed to map constant buffer\n");
+		void * pso;
+		if (pso_cache_get(&state.psos, &desc, FALSE, &pso) != PSO_READY) {
+			FAIL(16, "Failed to create pipeline state\n");
 		}
+		state.pso[i] = pso;
+	}
 
-		state.cbvdata = cbegin;
-		memcpy(state.cbvdata, state.mvp, sizeof(state.mvp));
+	/* viewports draw the mesh into targets without a depth buffer */
+	desc.depth_enable = FALSE;
+	desc.dsv_format = DXGI_FORMAT_UNKNOWN;
+	void * viewport_pso;
+	if (pso_cache_get(&state.psos, &desc, FALSE, &viewport_pso) != PSO_READY) {
+		FAIL(16, "Failed to create pipeline state\n");
+	}
+	state.viewport_pso = viewport_pso;
+	desc.dsv_format = DXGI_FORMAT_D32_FLOAT;
+
+	/* particles: no vertex input, both faces, depth tested against the mesh but not written */
+	ID3DBlob * particle_vs = state.shader.particles[PARTICLE_SHADER_VS];
+	ID3DBlob * particle_ps = state.shader.particles[PARTICLE_SHADER_PS];
+	desc.root_sig = state.particle_draw_sig;
+	desc.vs = particle_vs->lpVtbl->GetBufferPointer(particle_vs);
+	desc.vs_size = particle_vs->lpVtbl->GetBufferSize(particle_vs);
+	desc.ps = particle_ps->lpVtbl->GetBufferPointer(particle_ps);
+	desc.ps_size = particle_ps->lpVtbl->GetBufferSize(particle_ps);
+	desc.inputs = NULL;
+	desc.input_count = 0;
+	desc.cull_mode = D3D12_CULL_MODE_NONE;
+	desc.depth_enable = TRUE;
+	desc.depth_write_mask = D3D12_DEPTH_WRITE_MASK_ZERO;
+
+	void * pso;
+	if (pso_cache_get(&state.psos, &desc, FALSE, &pso) != PSO_READY) {
+		FAIL(16, "Failed to create pipeline state\n");
 	}
+	state.particle_draw_pso = pso;
 
-	{
-		vertex_t vertices[3] = {
-			{  0,  1,  0,  0,		1, 0, 1, 1 },
-			{  1, -1,  0,  0,		1, 0, 1, 1 },
-			{  2, -1,  0,  0,		1, 0, 1, 1 },
-		};
+	/* the bytecode is baked into the pso, the blobs never reach the GPU so any fence will do */
+	com_retire(state.shader.particle_handles[PARTICLE_SHADER_VS], 0);
+	com_retire(state.shader.particle_handles[PARTICLE_SHADER_PS], 0);
+	com_retire(state.shader.vs_handle, 0);
+	com_retire(state.shader.ps_handle, 0);
 
-		D3D12_HEAP_PROPERTIES props = {
-			.Type = D3D12_HEAP_TYPE_UPLOAD,
-			.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
-			.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
-			.CreationNodeMask = 1,
-			.VisibleNodeMask = 1,
-		};
+	free(state.shader.src);
+	state.shader.src = NULL;
 
-		D3D12_RESOURCE_DESC desc = {
-			.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER,
-			.Alignment = 0,
-			.Width = sizeof(vertices),
-			.Height = 1,
-			.DepthOrArraySize = 1,
-			.MipLevels = 1,
-			.Format = DXGI_FORMAT_UNKNOWN,
-			.SampleDesc = {
-				.Count = 1,
-				.Quality = 0,
-			},
-			.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR,
-			.Flags = D3D12_RESOURCE_FLAG_NONE,
-		};
+	return 0;
+}
+
+static int init_cmdlist(void) {
+	if (FAILED(state.device->lpVtbl->CreateCommandList(state.device, 0, D3D12_COMMAND_LIST_TYPE_DIRECT, state.cmdallocator, NULL, &IID_ID3D12GraphicsCommandList, &state.cmdlist))) {
+		FAIL(17, "Failed to create command list\n");
+	}
+	TRACK(&state.cmdlist, 0);
+
+	state.cmdlist->lpVtbl->Close(state.cmdlist);
+
+	return 0;
+}
+
+static int init_cbo(void) {
+	if (create_upload_buffer(256, &state.cbo, &state.cbo_alloc) != 0) {
+		FAIL(18, "Failed to create constant buffer\n");
+	}
+	TRACK(&state.cbo, 256);
+
+	D3D12_CONSTANT_BUFFER_VIEW_DESC cbv_desc = {
+		.BufferLocation = state.cbo->lpVtbl->GetGPUVirtualAddress(state.cbo),
+		.SizeInBytes = 256,
+	};
+
+	D3D12_CPU_DESCRIPTOR_HANDLE handle;
+	state.rtvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.rtvheap, &handle);
+	state.device->lpVtbl->CreateConstantBufferView(state.device, &cbv_desc, handle);
+
+	void * cbegin;
+	D3D12_RANGE range = {
+		.Begin = 0,
+		.End = 0,
+	};
+
+	if (FAILED(state.cbo->lpVtbl->Map(state.cbo, 0, &range, &cbegin))) {
+		FAIL(19, "Failed to map constant buffer\n");
+	}
+
+	state.cbvdata = cbegin;
+	memcpy(state.cbvdata, state.mvp, sizeof(state.mvp));
+
+	return 0;
+}
+
+static skin_vertex_t const vertices[3] = {
+	{ {  0,  1,  0,  0 },		{ 1, 0, 1, 1 },		{ 0, 0, 0, 0 },		{ 1, 0, 0, 0 } },
+	{ {  1, -1,  0,  0 },		{ 1, 0, 1, 1 },		{ 0, 0, 0, 0 },		{ 1, 0, 0, 0 } },
+	{ {  2, -1,  0,  0 },		{ 1, 0, 1, 1 },		{ 0, 0, 0, 0 },		{ 1, 0, 0, 0 } },
+};
+
+/* a single root joint holding its rest pose, so the skinned mesh matches the bind pose */
+static USHORT const skeleton_parent[1] = { SKIN_NO_PARENT };
+static skin_xform_t const skeleton_inverse_bind[1] = {
+	{ { 0, 0, 0, 1 }, { 0, 0, 0 }, 1 },
+};
+static skin_skeleton_t const skeleton = {
+	.joints = 1,
+	.parent = skeleton_parent,
+	.inverse_bind = skeleton_inverse_bind,
+};
+
+static float const rest_times[1] = { 0 };
+static skin_xform_t const rest_poses[1] = {
+	{ { 0, 0, 0, 1 }, { 0, 0, 0 }, 1 },
+};
+static skin_track_t const rest_tracks[1] = {
+	{ 1, rest_times, rest_poses },
+};
+static skin_clip_t const rest_clip = {
+	.duration = 1,
+	.joints = 1,
+	.tracks = rest_tracks,
+};
+
+static UINT const indices[3] = { 0, 1, 2 };
+
+/* pixels the mesh spans along its longer side, from this frame's clip positions */
+static UINT mesh_screen_extent(void) {
+	UINT screen = state.width > state.height ? state.width : state.height;
+	float min_x = 1e30f, max_x = -1e30f, min_y = 1e30f, max_y = -1e30f;
+	for (UINT i = 0; i < sizeof(vertices) / sizeof(vertices[0]); ++i) {
+		float w = state.clip.w[i];
+		/* crosses the eye plane, as good as filling the screen */
+		if (w <= 0) {
+			return screen;
+		}
+		float x = state.clip.x[i] / w;
+		float y = state.clip.y[i] / w;
+		min_x = x < min_x ? x : min_x;
+		max_x = x > max_x ? x : max_x;
+		min_y = y < min_y ? y : min_y;
+		max_y = y > max_y ? y : max_y;
+	}
+
+	float width = (max_x - min_x) * 0.5f * state.width;
+	float height = (max_y - min_y) * 0.5f * state.height;
+	float extent = width > height ? width : height;
+	return extent < 1 ? 1 : extent > screen ? screen : (UINT) extent;
+}
+
+static int init_scene(void) {
+	scene_init(&state.scene);
+
+	state.view_node = scene_add(&state.scene, SCENE_NONE);
+	state.mesh_node = scene_add(&state.scene, state.view_node);
+	if (state.view_node == SCENE_NONE || state.mesh_node == SCENE_NONE || scene_update(&state.scene) != 0) {
+		FAIL(27, "Failed to build scene\n");
+	}
+
+	scene_get_world(&state.scene, state.mesh_node, state.mvp);
+
+	/* the mesh's levels index its own vertices, so the skinned buffer serves all of them */
+	if (lod_build(&state.mesh_lods, vertices[0].pos, sizeof(skin_vertex_t), sizeof(vertices) / sizeof(vertices[0]), indices, sizeof(indices) / sizeof(indices[0]) / 3, 1) != 0) {
+		FAIL(27, "Failed to build the mesh's levels of detail\n");
+	}
+
+	for (UINT i = 0; i < state.mesh_lods.level_count; ++i) {
+		lod_level_t const * level = &state.mesh_lods.levels[i];
+		if (meshlet_build(&state.mesh_meshlets[i], vertices[0].pos, sizeof(skin_vertex_t), sizeof(vertices) / sizeof(vertices[0]), state.mesh_lods.indices + level->first_index, level->index_count / 3) != 0) {
+			FAIL(27, "Failed to build the mesh's meshlets\n");
+		}
+	}
+
+	/* built over the bind pose, each frame refits it to the skinned one */
+	UINT count = sizeof(vertices) / sizeof(vertices[0]);
+	for (int k = 0; k < 3; ++k) {
+		state.draw_boxes[k] = state.draw_boxes[3 + k] = vertices[0].pos[k];
+	}
+	for (UINT i = 1; i < count; ++i) {
+		for (int k = 0; k < 3; ++k) {
+			state.draw_boxes[k] = min(state.draw_boxes[k], vertices[i].pos[k]);
+			state.draw_boxes[3 + k] = max(state.draw_boxes[3 + k], vertices[i].pos[k]);
+		}
+	}
+	if (bvh_build(&state.draw_bvh, state.draw_boxes, 1) != 0) {
+		FAIL(27, "Failed to build the draw hierarchy\n");
+	}
+
+	return 0;
+}
+
+static void mesh_bounds(vec3 lo, vec3 hi) {
+	UINT count = sizeof(vertices) / sizeof(vertices[0]);
+
+	for (int k = 0; k < 3; ++k) {
+		lo[k] = hi[k] = state.skinned[0].pos[k];
+	}
+	for (UINT i = 1; i < count; ++i) {
+		for (int k = 0; k < 3; ++k) {
+			lo[k] = min(lo[k], state.skinned[i].pos[k]);
+			hi[k] = max(hi[k], state.skinned[i].pos[k]);
+		}
+	}
+}
+
+static void mesh_center(vec3 center) {
+	UINT count = sizeof(vertices) / sizeof(vertices[0]);
+
+	center[0] = center[1] = center[2] = 0;
+	for (UINT i = 0; i < count; ++i) {
+		center[0] += state.skinned[i].pos[0] / count;
+		center[1] += state.skinned[i].pos[1] / count;
+		center[2] += state.skinned[i].pos[2] / count;
+	}
+}
+
+/*
+ * the bind-pose vertices, written once, and a palette slot per skin buffer, mapped for
+ * good. the skinning pass writes a default-heap buffer that the draw then reads as its
+ * vertex buffer; buffers are promoted out of the common state on first use and decay
+ * back after every ExecuteCommandLists, so neither queue needs barriers for them.
+ */
+static int init_vbo(void) {
+	if (create_upload_buffer(sizeof(vertices), &state.skin_in, &state.skin_in_alloc) != 0) {
+		FAIL(18, "Failed to create vertex buffer\n");
+	}
+	TRACK(&state.skin_in, sizeof(vertices));
+
+	void * vbegin;
+	D3D12_RANGE range = {
+		.Begin = 0,
+		.End = 0,
+	};
+
+	if (FAILED(state.skin_in->lpVtbl->Map(state.skin_in, 0, &range, &vbegin))) {
+		FAIL(19, "Failed to map vertex buffer\n");
+	}
+	memcpy(vbegin, vertices, sizeof(vertices));
+	state.skin_in->lpVtbl->Unmap(state.skin_in, 0, NULL);
+
+	if (create_upload_buffer(PALETTE_SLOT_SIZE * SKIN_BUFFERS, &state.palette_buf, &state.palette_alloc) != 0) {
+		FAIL(18, "Failed to create constant buffer\n");
+	}
+	TRACK(&state.palette_buf, PALETTE_SLOT_SIZE * SKIN_BUFFERS);
+
+	void * pbegin;
+	if (FAILED(state.palette_buf->lpVtbl->Map(state.palette_buf, 0, &range, &pbegin))) {
+		FAIL(19, "Failed to map constant buffer\n");
+	}
+	state.palettedata = pbegin;
+
+	D3D12_HEAP_PROPERTIES heap_props = {
+		.Type = D3D12_HEAP_TYPE_DEFAULT,
+		.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+		.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
+		.CreationNodeMask = 1,
+		.VisibleNodeMask = 1,
+	};
+
+	D3D12_RESOURCE_DESC desc = buffer_desc(sizeof(state.skinned));
+	desc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+
+	for (UINT i = 0; i < SKIN_BUFFERS; ++i) {
+		if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &heap_props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COMMON, NULL, &IID_ID3D12Resource, &state.skin_out[i]))) {
+			FAIL(18, "Failed to create vertex buffer\n");
+		}
+		TRACK(&state.skin_out[i], sizeof(state.skinned));
+	}
+
+	state.vbo_view.SizeInBytes = sizeof(state.skinned);
+	state.vbo_view.StrideInBytes = sizeof(vertex_t);
+
+	return 0;
+}
+
+/* stays mapped, the frame loop writes the pre-culled indices into it every frame */
+static int init_ibo(void) {
+	if (create_upload_buffer(sizeof(indices), &state.ibo, &state.ibo_alloc) != 0) {
+		FAIL(18, "Failed to create index buffer\n");
+	}
+	TRACK(&state.ibo, sizeof(indices));
+
+	void * ibegin;
+	D3D12_RANGE range = {
+		.Begin = 0,
+		.End = 0,
+	};
+
+	if (FAILED(state.ibo->lpVtbl->Map(state.ibo, 0, &range, &ibegin))) {
+		FAIL(19, "Failed to map index buffer\n");
+	}
+
+	state.ibodata = ibegin;
+	state.ibo_view.BufferLocation = state.ibo->lpVtbl->GetGPUVirtualAddress(state.ibo);
+	state.ibo_view.SizeInBytes = sizeof(indices);
+
+	if (vshade_out_alloc(&state.clip, sizeof(vertices) / sizeof(vertices[0])) != 0) {
+		FAIL(25, "Failed to allocate clip-space vertices\n");
+	}
+
+	/* must agree with the rasterizer state in init_pso */
+	precull_init(&state.cull, PRECULL_CULL_BACK, FALSE);
+	meshlet_culler_init(&state.meshlet_cull, precull_cull_sign(&state.cull));
+
+	/* covers the whole viewport whatever its size, a quarter of 720p is plenty for occluders */
+	if (state.use_occlusion && occlusion_init(&state.occlusion, 320, 180, precull_cull_sign(&state.cull)) != 0) {
+		FAIL(25, "Failed to allocate the occlusion buffer\n");
+	}
+
+	return 0;
+}
+
+static int init_fence(void) {
+	if (FAILED(state.device->lpVtbl->CreateFence(state.device, 0, D3D12_FENCE_FLAG_NONE, &IID_ID3D12Fence, &state.fence))) {
+		FAIL(20, "Failed to create fence\n");
+	}
+	TRACK(&state.fence, 0);
+	state.fence_value = 1;
+
+	for (UINT i = 0; i < SCHED_QUEUES; ++i) {
+		if (FAILED(state.device->lpVtbl->CreateFence(state.device, 0, D3D12_FENCE_FLAG_NONE, &IID_ID3D12Fence, &state.queue_fence[i]))) {
+			FAIL(20, "Failed to create fence\n");
+		}
+		TRACK(&state.queue_fence[i], 0);
+	}
 
-		if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, &IID_ID3D12Resource, &state.vbo))) {
-			BAIL(18, "Failed to create vertex buffer\n");
+	state.fence_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (state.fence_event == NULL) {
+		if (FAILED(HRESULT_FROM_WIN32(GetLastError()))) {
+			FAIL(21, "Failed to create fence event\n");
 		}
-		PUSH_INITED(&state.vbo);
+	}
+
+	int err = wait_for_fence();
+	if (err != 0) {
+		FAIL(err, "Failed to wait for fence\n");
+	}
+
+	return 0;
+}
 
-		void * vbegin;
-		D3D12_RANGE range = {
-			.Begin = 0,
-			.End = 0,
+/* update, emit and args share the compute root signature; the command signature draws the args */
+static int init_particle_psos(void) {
+	for (UINT i = 0; i < PARTICLE_SHADER_VS; ++i) {
+		ID3DBlob * cs = state.shader.particles[i];
+
+		D3D12_COMPUTE_PIPELINE_STATE_DESC cs_desc = {
+			.pRootSignature = state.particle_compute_sig,
+			.CS = {
+				cs->lpVtbl->GetBufferPointer(cs),
+				cs->lpVtbl->GetBufferSize(cs),
+			},
+			.NodeMask = 0,
+			.CachedPSO = {
+				.pCachedBlob = NULL,
+				.CachedBlobSizeInBytes = 0,
+			},
+			.Flags = D3D12_PIPELINE_STATE_FLAG_NONE,
 		};
 
-		if (FAILED(state.vbo->lpVtbl->Map(state.vbo, 0, &range, &vbegin))) {
-			BAIL(19, "Failed to map vertex buffer\n");
+		if (FAILED(state.device->lpVtbl->CreateComputePipelineState(state.device, &cs_desc, &IID_ID3D12PipelineState, &state.particle_pso[i]))) {
+			FAIL(16, "Failed to create pipeline state\n");
 		}
+		TRACK(&state.particle_pso[i], 0);
+
+		com_retire(state.shader.particle_handles[i], 0);
+	}
+
+	D3D12_INDIRECT_ARGUMENT_DESC argument = {
+		.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW,
+	};
+
+	D3D12_COMMAND_SIGNATURE_DESC sig_desc = {
+		.ByteStride = sizeof(D3D12_DRAW_ARGUMENTS),
+		.NumArgumentDescs = 1,
+		.pArgumentDescs = &argument,
+		.NodeMask = 0,
+	};
+
+	/* only draw arguments, so no root signature */
+	if (FAILED(state.device->lpVtbl->CreateCommandSignature(state.device, &sig_desc, NULL, &IID_ID3D12CommandSignature, &state.particle_cmdsig))) {
+		FAIL(29, "Failed to create command signature\n");
+	}
+	TRACK(&state.particle_cmdsig, 0);
+
+	return 0;
+}
 
-		memcpy(vbegin, vertices, sizeof(vertices));
-		state.vbo->lpVtbl->Unmap(state.vbo, 0, NULL);
+/*
+ * committed buffers are zeroed on creation, which is the empty starting state: no
+ * particles in either buffer. the CPU path keeps its own streams and one upload buffer.
+ */
+static int init_particle_buffers(void) {
+	D3D12_HEAP_PROPERTIES heap_props = {
+		.Type = D3D12_HEAP_TYPE_DEFAULT,
+		.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+		.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN,
+		.CreationNodeMask = 1,
+		.VisibleNodeMask = 1,
+	};
 
-		state.vbo_view.BufferLocation = state.vbo->lpVtbl->GetGPUVirtualAddress(state.vbo);
-		state.vbo_view.SizeInBytes = sizeof(vertices);
-		state.vbo_view.StrideInBytes = sizeof(vertex_t);
+	UINT64 size = sizeof(particle_gpu_t) * (UINT64) PARTICLES_MAX;
+	D3D12_RESOURCE_DESC desc = buffer_desc(size);
+	desc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
 
-		if (FAILED(state.device->lpVtbl->CreateFence(state.device, 0, D3D12_FENCE_FLAG_NONE, &IID_ID3D12Fence, &state.fence))) {
-			BAIL(20, "Failed to create fence\n");
+	for (UINT i = 0; i < PARTICLE_BUFFERS; ++i) {
+		if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &heap_props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COMMON, NULL, &IID_ID3D12Resource, &state.particle_buf[i]))) {
+			FAIL(18, "Failed to create particle buffer\n");
 		}
-		state.fence_value = 1;
+		TRACK(&state.particle_buf[i], size);
+	}
+
+	desc = buffer_desc(PARTICLE_STATE_SIZE);
+	desc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+	if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &heap_props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COMMON, NULL, &IID_ID3D12Resource, &state.particle_state))) {
+		FAIL(18, "Failed to create particle buffer\n");
+	}
+	TRACK(&state.particle_state, PARTICLE_STATE_SIZE);
+
+	D3D12_QUERY_HEAP_DESC query_desc = {
+		.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP,
+		.Count = 2,
+		.NodeMask = 0,
+	};
+
+	if (FAILED(state.device->lpVtbl->CreateQueryHeap(state.device, &query_desc, &IID_ID3D12QueryHeap, &state.particle_queries))) {
+		FAIL(29, "Failed to create query heap\n");
+	}
+	TRACK(&state.particle_queries, 0);
+
+	if (FAILED(state.computequeue->lpVtbl->GetTimestampFrequency(state.computequeue, &state.compute_frequency))) {
+		FAIL(29, "Failed to get timestamp frequency\n");
+	}
+
+	/* two timestamps, then the count */
+	heap_props.Type = D3D12_HEAP_TYPE_READBACK;
+	desc = buffer_desc(PARTICLE_STATE_SIZE);
+	if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &heap_props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COPY_DEST, NULL, &IID_ID3D12Resource, &state.particle_readback))) {
+		FAIL(18, "Failed to create readback buffer\n");
+	}
+	TRACK(&state.particle_readback, PARTICLE_STATE_SIZE);
+
+	void * rbegin;
+	if (FAILED(state.particle_readback->lpVtbl->Map(state.particle_readback, 0, NULL, &rbegin))) {
+		FAIL(19, "Failed to map readback buffer\n");
+	}
+	state.particle_readbackdata = rbegin;
+
+	if (!state.cpu_particles) {
+		return 0;
+	}
+
+	if (particles_init(&state.particles, PARTICLES_MAX) != 0) {
+		FAIL(25, "Failed to allocate particles\n");
+	}
+
+	heap_props.Type = D3D12_HEAP_TYPE_UPLOAD;
+	desc = buffer_desc(size);
+	if (FAILED(state.device->lpVtbl->CreateCommittedResource(state.device, &heap_props, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, &IID_ID3D12Resource, &state.particle_upload))) {
+		FAIL(18, "Failed to create particle buffer\n");
+	}
+	TRACK(&state.particle_upload, size);
+
+	void * ubegin;
+	D3D12_RANGE range = {
+		.Begin = 0,
+		.End = 0,
+	};
 
-		state.fence_event = CreateEvent(NULL, FALSE, FALSE, NULL);
-		if (state.fence_event == NULL) {
-			if (FAILED(HRESULT_FROM_WIN32(GetLastError()))) {
-				BAIL(21, "Failed to create fence event\n");
+	if (FAILED(state.particle_upload->lpVtbl->Map(state.particle_upload, 0, &range, &ubegin))) {
+		FAIL(19, "Failed to map particle buffer\n");
+	}
+	state.particle_uploaddata = ubegin;
+
+	return 0;
+}
+
+enum {
+	STARTUP_WINDOW,
+	STARTUP_FACTORY,
+	STARTUP_DEVICE,
+	STARTUP_QUEUE,
+	STARTUP_COMPUTE_QUEUE,
+	STARTUP_SWAPCHAIN,
+	STARTUP_RTV,
+	STARTUP_DSV,
+	STARTUP_ALLOCATOR,
+	STARTUP_ROOT_SIG,
+	STARTUP_COMPUTE_ROOT_SIG,
+	STARTUP_SHADER_READ,
+	STARTUP_COMPILE_VS,
+	STARTUP_COMPILE_PS,
+	STARTUP_COMPILE_CS,
+	STARTUP_COMPILE_PARTICLES,
+	STARTUP_PARTICLE_SIGS,
+	STARTUP_PARTICLE_PSOS,
+	STARTUP_PARTICLE_BUFFERS,
+	STARTUP_PSO,
+	STARTUP_COMPUTE_PSO,
+	STARTUP_CMDLIST,
+	STARTUP_SCENE,
+	STARTUP_CBO,
+	STARTUP_VBO,
+	STARTUP_IBO,
+	STARTUP_FENCE,
+	STARTUP_TEXTURES,
+	STARTUP_COUNT,
+};
+
+/* the window and swapchain stay on the main thread, which owns the message queue */
+static task_t startup_tasks[STARTUP_COUNT] = {
+	[STARTUP_WINDOW] = { "window", init_window, 0, TRUE },
+	[STARTUP_FACTORY] = { "factory", init_factory, 0, FALSE },
+	[STARTUP_DEVICE] = { "device", init_device, TASK_BIT(STARTUP_FACTORY), FALSE },
+	[STARTUP_QUEUE] = { "queue", init_queue, TASK_BIT(STARTUP_DEVICE), FALSE },
+	[STARTUP_COMPUTE_QUEUE] = { "compute_queue", init_compute_queue, TASK_BIT(STARTUP_DEVICE), FALSE },
+	[STARTUP_SWAPCHAIN] = { "swapchain", init_swapchain, TASK_BIT(STARTUP_WINDOW) | TASK_BIT(STARTUP_QUEUE), TRUE },
+	[STARTUP_RTV] = { "rtv", init_rtv, TASK_BIT(STARTUP_SWAPCHAIN), FALSE },
+	[STARTUP_DSV] = { "dsv", init_dsv, TASK_BIT(STARTUP_SWAPCHAIN), FALSE },
+	[STARTUP_ALLOCATOR] = { "allocator", init_allocator, TASK_BIT(STARTUP_DEVICE), FALSE },
+	[STARTUP_ROOT_SIG] = { "root_sig", init_root_sig, TASK_BIT(STARTUP_DEVICE), FALSE },
+	[STARTUP_COMPUTE_ROOT_SIG] = { "compute_root_sig", init_compute_root_sig, TASK_BIT(STARTUP_DEVICE), FALSE },
+	[STARTUP_SHADER_READ] = { "shader_read", init_shader_read, 0, FALSE },
+	[STARTUP_COMPILE_VS] = { "compile_vs", init_compile_vs, TASK_BIT(STARTUP_SHADER_READ), FALSE },
+	[STARTUP_COMPILE_PS] = { "compile_ps", init_compile_ps, TASK_BIT(STARTUP_SHADER_READ), FALSE },
+	[STARTUP_COMPILE_CS] = { "compile_cs", init_compile_cs, TASK_BIT(STARTUP_SHADER_READ), FALSE },
+	/* init_pso frees the shader source, so every compile has to be done by then */
+	[STARTUP_COMPILE_PARTICLES] = { "compile_particles", init_compile_particles, TASK_BIT(STARTUP_SHADER_READ), FALSE },
+	[STARTUP_PARTICLE_SIGS] = { "particle_sigs", init_particle_sigs, TASK_BIT(STARTUP_DEVICE), FALSE },
+	[STARTUP_PARTICLE_PSOS] = { "particle_psos", init_particle_psos, TASK_BIT(STARTUP_PARTICLE_SIGS) | TASK_BIT(STARTUP_COMPILE_PARTICLES), FALSE },
+	[STARTUP_PARTICLE_BUFFERS] = { "particle_buffers", init_particle_buffers, TASK_BIT(STARTUP_DEVICE) | TASK_BIT(STARTUP_COMPUTE_QUEUE), FALSE },
+	[STARTUP_PSO] = { "pso", init_pso, TASK_BIT(STARTUP_ROOT_SIG) | TASK_BIT(STARTUP_PARTICLE_SIGS) | TASK_BIT(STARTUP_COMPILE_VS) | TASK_BIT(STARTUP_COMPILE_PS) | TASK_BIT(STARTUP_COMPILE_CS) | TASK_BIT(STARTUP_COMPILE_PARTICLES), FALSE },
+	[STARTUP_COMPUTE_PSO] = { "compute_pso", init_compute_pso, TASK_BIT(STARTUP_COMPUTE_ROOT_SIG) | TASK_BIT(STARTUP_COMPILE_CS) | TASK_BIT(STARTUP_COMPUTE_QUEUE), FALSE },
+	[STARTUP_CMDLIST] = { "cmdlist", init_cmdlist, TASK_BIT(STARTUP_PSO) | TASK_BIT(STARTUP_ALLOCATOR), FALSE },
+	[STARTUP_SCENE] = { "scene", init_scene, 0, FALSE },
+	[STARTUP_CBO] = { "cbo", init_cbo, TASK_BIT(STARTUP_RTV) | TASK_BIT(STARTUP_SCENE), FALSE },
+	[STARTUP_VBO] = { "vbo", init_vbo, TASK_BIT(STARTUP_DEVICE), FALSE },
+	[STARTUP_IBO] = { "ibo", init_ibo, TASK_BIT(STARTUP_DEVICE), FALSE },
+	[STARTUP_FENCE] = { "fence", init_fence, TASK_BIT(STARTUP_QUEUE), FALSE },
+	[STARTUP_TEXTURES] = { "textures", init_textures, TASK_BIT(STARTUP_DEVICE), FALSE },
+};
+
+int main(int argc, char ** argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-overdraw") == 0) {
+			state.measure_overdraw = TRUE;
+		} else if (strcmp(argv[i], "-nobundles") == 0) {
+			state.use_bundles = FALSE;
+		} else if (strcmp(argv[i], "-nolod") == 0) {
+			state.lod.disabled = TRUE;
+		} else if (strcmp(argv[i], "-lodpixels") == 0 && i + 1 < argc) {
+			state.lod.threshold = (float) atof(argv[++i]);
+		} else if (strcmp(argv[i], "-nomeshlets") == 0) {
+			state.use_meshlets = FALSE;
+		} else if (strcmp(argv[i], "-occlusion") == 0) {
+			state.use_occlusion = TRUE;
+		} else if (strcmp(argv[i], "-cpuparticles") == 0) {
+			state.cpu_particles = TRUE;
+		} else if (strcmp(argv[i], "-trace") == 0) {
+			state.trace_at_exit = TRUE;
+		} else if (strcmp(argv[i], "-slowframe") == 0 && i + 1 < argc) {
+			trace.slow_ms = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-present") == 0 && i + 1 < argc) {
+			++i;
+			for (UINT m = 0; m < PRESENT_MODES; ++m) {
+				if (strcmp(argv[i], present_mode_names[m]) == 0) {
+					state.present_mode = m;
+				}
+			}
+		} else if (strcmp(argv[i], "-latency") == 0 && i + 1 < argc) {
+			state.max_latency = (UINT) atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-warp") == 0) {
+			state.force_warp = TRUE;
+		} else if (strcmp(argv[i], "-software") == 0) {
+			state.allow_software = TRUE;
+		} else if (strcmp(argv[i], "-lowpower") == 0) {
+			state.low_power = TRUE;
+		} else if (strcmp(argv[i], "-windows") == 0 && i + 1 < argc) {
+			state.window_viewports = (UINT) atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-viewports") == 0 && i + 1 < argc) {
+			state.headless_viewports = (UINT) atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-texpack") == 0 && i + 1 < argc) {
+			state.pack_path = argv[++i];
+		} else if (strcmp(argv[i], "-texbudget") == 0 && i + 1 < argc) {
+			state.texture_budget = (UINT64) atoi(argv[++i]) * 1024 * 1024;
+		} else if (strcmp(argv[i], "-texformat") == 0 && i + 1 < argc) {
+			UINT format = stream_format_from_name(argv[++i]);
+			if (format != 0) {
+				state.texture_format = format;
+				state.texture_reencode = TRUE;
 			}
+		} else if (strcmp(argv[i], "-texquality") == 0 && i + 1 < argc) {
+			++i;
+			for (UINT q = 0; q < BC_QUALITIES; ++q) {
+				if (strcmp(argv[i], bc_quality_names[q]) == 0) {
+					state.texture_quality = q;
+					state.texture_reencode = TRUE;
+				}
+			}
+		}
+	}
+
+	state.startup = timer_now();
+
+	gpumem_init(&state.upload, "upload", D3D12_HEAP_TYPE_UPLOAD, UPLOAD_HEAP_SIZE, 0, (gpumem_backend_t) {
+		.create_heap = upload_create_heap,
+		.destroy_heap = upload_destroy_heap,
+		.move = upload_move,
+		.user = NULL,
+	});
+
+	if (jobs_init(0) != 0) {
+		BAIL(23, "Failed to start worker threads\n");
+	}
+
+	if (trace_init() != 0) {
+		BAIL(30, "Failed to allocate trace buffers\n");
+	}
+
+	{
+		task_graph_t graph = {
+			.tasks = startup_tasks,
+			.count = STARTUP_COUNT,
+		};
+
+		int err = task_graph_run(&graph);
+		task_graph_trace(&graph, stderr);
+		if (err != 0) {
+			BAIL(err, "Startup failed\n");
 		}
 
-		int err = wait_for_fence();
+		if (task_graph_verify(&graph) != 0) {
+			BAIL(24, "Startup ran out of dependency order\n");
+		}
+
+		release_collect(state.fence->lpVtbl->GetCompletedValue(state.fence));
+	}
+
+	if (state.measure_overdraw && overdraw_init(&state.overdraw, state.width, state.height, TRUE) != 0) {
+		BAIL(25, "Failed to allocate overdraw buffers\n");
+	}
+
+	sched_init(&state.sched, (sched_backend_t) {
+		.wait = sched_d3d_wait,
+		.submit = sched_d3d_submit,
+		.signal = sched_d3d_signal,
+		.user = NULL,
+	});
+
+	arena_init(&state.arena);
+
+	if (present_init(&state.present, state.present_mode, state.max_latency, state.tearing, (present_backend_t) {
+		.now = present_d3d_now,
+		.wait = present_d3d_wait,
+		.present = present_d3d_present,
+		.displayed = present_d3d_displayed,
+		.set_max_latency = present_d3d_set_max_latency,
+		.user = NULL,
+	}) != 0) {
+		BAIL(31, "Failed to set maximum frame latency\n");
+	}
+
+	viewport_set_init(&state.viewports, (viewport_backend_t) {
+		.create = viewport_d3d_create,
+		.destroy = viewport_d3d_destroy,
+		.record = viewport_d3d_record,
+		.present = viewport_d3d_present,
+		.submit = viewport_d3d_submit,
+		.signal = viewport_d3d_signal,
+		.completed = viewport_d3d_completed,
+		.wait = viewport_d3d_wait,
+		.user = NULL,
+	});
+	if (state.window_viewports + state.headless_viewports > 0) {
+		int err = init_viewports();
 		if (err != 0) {
-			BAIL(err, "Failed to wait for fence\n");
+			BAIL(err, "Failed to create viewports\n");
 		}
 	}
 
+	bundle_cache_init(&state.bundles, (bundle_backend_t) {
+		.record = bundle_record,
+		.execute = bundle_replay,
+		.release = bundle_release,
+		.user = NULL,
+	});
+
 	while (state.running) {
+		if (trace_frame() != 0) {
+			trace_dump("slow");
+		}
+		if (state.trace_requested) {
+			trace_dump("request");
+			state.trace_requested = FALSE;
+		}
+		if (state.defrag_requested) {
+			state.defrag_requested = FALSE;
+			int err = upload_defragment();
+			if (err != 0) {
+				BAIL(err, "Failed to defragment upload memory\n");
+			}
+		}
+
+		/* waitable mode sleeps here, input pumped right after is as fresh as it gets */
+		LONGLONG wait = trace_begin();
+		if (present_begin(&state.present) != 0) {
+			BAIL(31, "Failed to wait for the swapchain\n");
+		}
+		trace_end("present wait", wait);
+
+		TRACE_ZONE("message pump") {
+			MSG msg;
+			while (PeekMessageA(&msg, NULL, 0, 0, PM_REMOVE) != 0) {
+				TranslateMessage(&msg);
+				DispatchMessageA(&msg);
+			}
+		}
+		present_stamp(&state.present, PRESENT_STAMP_INPUT);
+
 		{
 			state.frameindex = state.swapchain->lpVtbl->GetCurrentBackBufferIndex(state.swapchain);
+			if (arena_begin_frame(&state.arena) != 0) {
+				BAIL(25, "Frame memory still in flight\n");
+			}
+
 			D3D12_VIEWPORT viewport = {
 				.TopLeftX = 0,
 				.TopLeftY = 0,
@@ -676,8 +3226,185 @@ int main(void) {
 				.bottom = state.height,
 			};
 
-			state.cmdallocator->lpVtbl->Reset(state.cmdallocator);
-			state.cmdlist->lpVtbl->Reset(state.cmdlist, state.cmdallocator, state.pso);
+			/* the previous frame has retired, so the constant, vertex and index buffers are free to rewrite */
+			LONGLONG zone = trace_begin();
+			if (scene_update(&state.scene) != 0) {
+				BAIL(27, "Failed to update scene\n");
+			}
+			scene_get_world(&state.scene, state.mesh_node, state.mvp);
+			memcpy(state.cbvdata, state.mvp, sizeof(state.mvp));
+
+			/* the compute queue skins into the buffer the previous frame did not draw from */
+			UINT slot = state.skin_slot;
+			state.skin_slot = (state.skin_slot + 1) % SKIN_BUFFERS;
+
+			skin_sample(&rest_clip, state.anim_time, state.pose);
+			skin_build_palette(&skeleton, state.pose, &state.palette);
+			memcpy(state.palettedata + PALETTE_SLOT_SIZE * slot, state.palette.matrices, sizeof(mat4x4) * skeleton.joints);
+			/* culling runs before the GPU gets to the mesh, so it needs its own skinned copy */
+			skin_run(SKIN_LINEAR, &state.palette, vertices, sizeof(vertices) / sizeof(vertices[0]), state.skinned, FALSE);
+			state.anim_time += 1.0f / 60.0f;
+
+			/* ping-pong: this frame's particles come from the buffer the last one wrote */
+			UINT particles_in = state.particle_slot;
+			UINT particles_out = (state.particle_slot + 1) % PARTICLE_BUFFERS;
+			state.particle_slot = particles_out;
+			state.particle_params.seed = particles_hash(state.particle_frames);
+
+			/* the previous frame has retired, so the upload buffer is free to overwrite */
+			if (state.cpu_particles) {
+				particles_update(&state.particles, &state.particle_params);
+				particles_pack(&state.particles, state.particle_uploaddata, TRUE);
+			}
+
+			trace_end("update", zone);
+			present_stamp(&state.present, PRESENT_STAMP_SIM);
+
+			UINT vertex_count = sizeof(vertices) / sizeof(vertices[0]);
+			TRACE_ZONE("allocator reset") {
+				state.computeallocator->lpVtbl->Reset(state.computeallocator);
+			}
+			zone = trace_begin();
+			state.computelist->lpVtbl->Reset(state.computelist, state.computeallocator, state.skin_pso);
+			state.computelist->lpVtbl->SetComputeRootSignature(state.computelist, state.compute_root_sig);
+			state.computelist->lpVtbl->SetComputeRootConstantBufferView(state.computelist, 0, state.palette_buf->lpVtbl->GetGPUVirtualAddress(state.palette_buf) + PALETTE_SLOT_SIZE * slot);
+			state.computelist->lpVtbl->SetComputeRoot32BitConstant(state.computelist, 1, vertex_count, 0);
+			state.computelist->lpVtbl->SetComputeRootShaderResourceView(state.computelist, 2, state.skin_in->lpVtbl->GetGPUVirtualAddress(state.skin_in));
+			state.computelist->lpVtbl->SetComputeRootUnorderedAccessView(state.computelist, 3, state.skin_out[slot]->lpVtbl->GetGPUVirtualAddress(state.skin_out[slot]));
+			state.computelist->lpVtbl->Dispatch(state.computelist, (vertex_count + 63) / 64, 1, 1);
+			if (!state.cpu_particles) {
+				record_particles(state.computelist, particles_in, particles_out);
+			}
+			if (FAILED(state.computelist->lpVtbl->Close(state.computelist))) {
+				BAIL(22, "Failed to close command list\n");
+			}
+			trace_end("record compute", zone);
+
+			state.vbo_view.BufferLocation = state.skin_out[slot]->lpVtbl->GetGPUVirtualAddress(state.skin_out[slot]);
+
+			zone = trace_begin();
+			vshade_run(state.mvp, state.skinned, sizeof(vertices) / sizeof(vertices[0]), &state.clip);
+			UINT level_index = lod_select(&state.lod, &state.mesh_lods, state.mvp, state.width, state.height, &state.mesh_lod);
+			lod_level_t const * level = &state.mesh_lods.levels[level_index];
+			lod_frame(&state.lod);
+
+			/* the bounds follow the skinned pose, whole clusters go before their triangles are tested */
+			UINT const * level_indices = state.mesh_lods.indices + level->first_index;
+			UINT level_triangles = level->index_count / 3;
+			if (state.use_meshlets) {
+				meshlet_refit(&state.mesh_meshlets[level_index], state.skinned[0].pos, sizeof(vertex_t));
+				level_triangles = meshlet_cull_run(&state.meshlet_cull, &state.mesh_meshlets[level_index], state.mvp, state.clustered, NULL, NULL);
+				level_indices = state.clustered;
+			}
+			state.index_count = precull_run(&state.cull, &state.clip, level_indices, level_triangles, state.culled, NULL) * 3;
+			memcpy(state.ibodata, state.culled, sizeof(UINT) * state.index_count);
+
+			/*
+			 * opaque draws go front to back so the depth test rejects hidden pixels before shading;
+			 * the key keeps draws of a pipeline and mesh together and front to back within them
+			 */
+			vec3 center;
+			mesh_center(center);
+			draw_packet_t packet = {
+				.key = draw_key(0, PSO_DEPTH, 0, draw_view_depth(state.mvp, center), FALSE),
+				.pipeline = PSO_DEPTH,
+				.root_sig = 0,
+				.vbuffer = 0,
+				.ibuffer = 0,
+				.first_index = 0,
+				.index_count = state.index_count,
+				.instance_count = 1,
+				.base_vertex = 0,
+			};
+
+			/* draws outside the frustum go before anything rasterizes them */
+			UINT moved = 0;
+			mesh_bounds(&state.draw_boxes[0], &state.draw_boxes[3]);
+			bvh_update(&state.draw_bvh, state.draw_boxes, &moved, 1);
+			draw_queue_reset(&state.draw_queue);
+			if (bvh_frustum(&state.draw_bvh, state.draw_boxes, state.mvp, state.draw_visible) != 0 && draw_queue_push(&state.draw_queue, &packet) != 0) {
+				BAIL(25, "Failed to queue draw\n");
+			}
+			draw_queue_sort(&state.draw_queue);
+			draw_packet_t const * packets = state.draw_queue.packets;
+			UINT const * order = state.draw_queue.order;
+			UINT draw_count = state.draw_queue.count;
+
+			/* nearest first, each draw is tested against the ones before it and then occludes the rest, never itself */
+			if (state.use_occlusion && draw_count > 0) {
+				occlusion_draw_t * occluders = arena_alloc(&state.arena, sizeof(occlusion_draw_t) * draw_count);
+				BYTE * visible = arena_alloc(&state.arena, draw_count);
+				UINT * kept = arena_alloc(&state.arena, sizeof(UINT) * draw_count);
+				if (occluders == NULL || visible == NULL || kept == NULL) {
+					BAIL(25, "Failed to allocate frame memory\n");
+				}
+				/* packets are pushed in draw box order */
+				for (UINT i = 0; i < draw_count; ++i) {
+					occluders[i].first_index = packets[order[i]].first_index;
+					occluders[i].index_count = packets[order[i]].index_count;
+					memcpy(occluders[i].box, &state.draw_boxes[order[i] * 6], sizeof(occluders[i].box));
+				}
+
+				occlusion_clear(&state.occlusion);
+				if (occlusion_test_draws(&state.occlusion, state.mvp, &state.clip, state.culled, occluders, draw_count, visible) != 0) {
+					BAIL(25, "Failed to rasterize occluders\n");
+				}
+
+				UINT count = 0;
+				for (UINT i = 0; i < draw_count; ++i) {
+					if (visible[i]) {
+						kept[count++] = order[i];
+					}
+				}
+				order = kept;
+				draw_count = count;
+			}
+
+			if (state.measure_overdraw) {
+				overdraw_stats_t stats;
+				overdraw_clear(&state.overdraw);
+				for (UINT i = 0; i < draw_count; ++i) {
+					draw_packet_t const * packet = &packets[order[i]];
+					overdraw_draw(&state.overdraw, &state.clip, &state.culled[packet->first_index], packet->index_count / 3);
+				}
+				overdraw_get_stats(&state.overdraw, &stats);
+			}
+
+			trace_end("cull and sort", zone);
+
+			/* zeroed first, the bundle cache compares the padding too */
+			draw_sequence_t sequence;
+			memset(&sequence, 0, sizeof(sequence));
+			memcpy(sequence.pso, state.pso, sizeof(state.pso));
+			sequence.root_sig = state.root_sig;
+			state.srvheap->lpVtbl->GetGPUDescriptorHandleForHeapStart(state.srvheap, &sequence.texture);
+			sequence.texture.ptr += (UINT64) state.texture_index * state.srvsize;
+			sequence.vbo_view = state.vbo_view;
+			sequence.ibo_view = state.ibo_view;
+			sequence.draw_count = draw_count;
+			for (UINT i = 0; i < draw_count; ++i) {
+				sequence.draws[i] = packets[order[i]];
+				/* already in order; the depth bits would change the bundle key every frame */
+				sequence.draws[i].key = 0;
+			}
+
+			LONGLONG record_start = timer_now();
+
+			TRACE_ZONE("allocator reset") {
+				state.cmdallocator->lpVtbl->Reset(state.cmdallocator);
+			}
+			state.cmdlist->lpVtbl->Reset(state.cmdlist, state.cmdallocator, state.pso[PSO_DEPTH]);
+			state.cmdlist->lpVtbl->SetDescriptorHeaps(state.cmdlist, 1, &state.srvheap);
+
+			/* texture copies go ahead of the draws that sample them */
+			zone = trace_begin();
+			UINT64 stream_frame = (UINT64) state.recorded_frames + 1;
+			stream_use(&state.stream, state.texture_index, stream_wanted_mip(&state.pack, state.texture_index, mesh_screen_extent()), stream_frame);
+			if (stream_update(&state.stream, stream_frame) != 0) {
+				BAIL(33, "Failed to stream textures\n");
+			}
+			trace_counter("texture bytes resident", (double) state.stream.resident);
+			trace_end("stream", zone);
 
 			state.cmdlist->lpVtbl->SetGraphicsRootSignature(state.cmdlist, state.root_sig);
 			state.cmdlist->lpVtbl->RSSetViewports(state.cmdlist, 1, &viewport);
@@ -699,12 +3426,43 @@ int main(void) {
 			D3D12_CPU_DESCRIPTOR_HANDLE handle;
 			state.rtvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.rtvheap, &handle);
 			handle.ptr += state.frameindex * state.rtvsize;
-			state.cmdlist->lpVtbl->OMSetRenderTargets(state.cmdlist, 1, &handle, FALSE, NULL);
+			D3D12_CPU_DESCRIPTOR_HANDLE dsv;
+			state.dsvheap->lpVtbl->GetCPUDescriptorHandleForHeapStart(state.dsvheap, &dsv);
+			state.cmdlist->lpVtbl->OMSetRenderTargets(state.cmdlist, 1, &handle, FALSE, &dsv);
 
 			state.cmdlist->lpVtbl->ClearRenderTargetView(state.cmdlist, handle, (float[4]) { 0, 1, 0, 1 }, 0, NULL);
+			state.cmdlist->lpVtbl->ClearDepthStencilView(state.cmdlist, dsv, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, NULL);
+			if (!state.use_bundles) {
+				record_sequence(state.cmdlist, &sequence);
+			} else if (bundle_execute(&state.bundles, &sequence, sizeof(sequence), &sequence) != 0) {
+				/* recording a bundle failed, the direct path draws the same thing */
+				record_sequence(state.cmdlist, &sequence);
+			}
+
+			state.cmdlist->lpVtbl->SetPipelineState(state.cmdlist, state.particle_draw_pso);
+			state.cmdlist->lpVtbl->SetGraphicsRootSignature(state.cmdlist, state.particle_draw_sig);
 			state.cmdlist->lpVtbl->IASetPrimitiveTopology(state.cmdlist, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-			state.cmdlist->lpVtbl->IASetVertexBuffers(state.cmdlist, 0, 1, &state.vbo_view);
-			state.cmdlist->lpVtbl->DrawInstanced(state.cmdlist, 3, 1, 0, 0);
+			state.cmdlist->lpVtbl->SetGraphicsRootConstantBufferView(state.cmdlist, 0, state.cbo->lpVtbl->GetGPUVirtualAddress(state.cbo));
+			if (state.cpu_particles) {
+				state.cmdlist->lpVtbl->SetGraphicsRootShaderResourceView(state.cmdlist, 1, state.particle_upload->lpVtbl->GetGPUVirtualAddress(state.particle_upload));
+				state.cmdlist->lpVtbl->DrawInstanced(state.cmdlist, 3, state.particles.count, 0, 0);
+			} else {
+				/* buffers decay back to common once the list has executed, no transition back needed */
+				state.cmdlist->lpVtbl->SetGraphicsRootShaderResourceView(state.cmdlist, 1, state.particle_buf[particles_out]->lpVtbl->GetGPUVirtualAddress(state.particle_buf[particles_out]));
+				state.cmdlist->lpVtbl->ResourceBarrier(state.cmdlist, 1, (D3D12_RESOURCE_BARRIER[]) {
+					{
+						.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
+						.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+						.Transition = {
+							.pResource = state.particle_state,
+							.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+							.StateBefore = D3D12_RESOURCE_STATE_COMMON,
+							.StateAfter = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT,
+						},
+					},
+				});
+				state.cmdlist->lpVtbl->ExecuteIndirect(state.cmdlist, state.particle_cmdsig, 1, state.particle_state, PARTICLE_ARGS_OFFSET, NULL, 0);
+			}
 
 			state.cmdlist->lpVtbl->ResourceBarrier(state.cmdlist, 1, (D3D12_RESOURCE_BARRIER[]) {
 				{
@@ -723,24 +3481,101 @@ int main(void) {
 				BAIL(22, "Failed to close command list\n");
 			}
 
-			int err = wait_for_fence();
-			if (err != 0) {
-				BAIL(err, "Failed to wait for fence\n");
+			state.record_ms += timer_ms(timer_now() - record_start);
+			++state.recorded_frames;
+			trace_end("record", record_start);
+
+			/* the extra viewports draw the same sequence and go out in the draw pass's submission */
+			state.viewport_sequence = &sequence;
+			zone = trace_begin();
+			if (viewport_set_begin(&state.viewports) != 0) {
+				BAIL(32, "Failed to record viewports\n");
+			}
+			trace_end("record viewports", zone);
+
+			/*
+			 * the draw waits for the skinning it reads; the next skinning into this buffer waits for the draw.
+			 * the particle state is rewritten every frame, so the draw's indirect read of it is ordered too
+			 */
+			UINT64 particles_read = state.cpu_particles ? 0 : SCHED_BIT(RESOURCE_PARTICLES + particles_in);
+			UINT64 particles_written = state.cpu_particles ? 0 : SCHED_BIT(RESOURCE_PARTICLES + particles_out) | SCHED_BIT(RESOURCE_PARTICLE_STATE);
+			cmdlist_batch_t compute_batch = {
+				.lists = { (ID3D12CommandList *) state.computelist },
+				.count = 1,
+			};
+			cmdlist_batch_t draw_batch = {
+				.lists = { (ID3D12CommandList *) state.cmdlist },
+				.count = 1,
+			};
+			for (UINT i = 0; i < state.viewports.list_count; ++i) {
+				draw_batch.lists[draw_batch.count++] = state.viewports.lists[i];
+			}
+			sched_pass_t passes[] = {
+				{
+					.name = "skin",
+					.queue = SCHED_COMPUTE,
+					.reads = particles_read,
+					.writes = SCHED_BIT(RESOURCE_SKINNED + slot) | particles_written,
+					.user = &compute_batch,
+				},
+				{
+					.name = "draw",
+					.queue = SCHED_GRAPHICS,
+					.reads = SCHED_BIT(RESOURCE_SKINNED + slot) | particles_written,
+					.writes = SCHED_BIT(RESOURCE_BACKBUFFER),
+					.user = &draw_batch,
+				},
+			};
+			for (UINT i = 0; i < sizeof(passes) / sizeof(passes[0]); ++i) {
+				if (sched_submit(&state.sched, &passes[i]) != 0) {
+					BAIL(28, "Failed to submit %s pass\n", passes[i].name);
+				}
 			}
+			present_stamp(&state.present, PRESENT_STAMP_SUBMIT);
 
-			state.cmdqueue->lpVtbl->ExecuteCommandLists(state.cmdqueue, 1, (ID3D12CommandList * []) { state.cmdlist });
-			state.swapchain->lpVtbl->Present(state.swapchain, 1, 0);
+			zone = trace_begin();
+			if (present_end(&state.present) != 0) {
+				BAIL(31, "Failed to present\n");
+			}
+			trace_end("Present", zone);
+			if (viewport_set_end(&state.viewports, state.fence_value + 1) != 0) {
+				BAIL(32, "Failed to present viewports\n");
+			}
+			/* the signal below is the first one after everything this frame submitted */
+			arena_end_frame(&state.arena, state.fence_value + 1);
+
+			if (state.startup != 0) {
+				fprintf(stderr, "startup: first frame presented after %.3f ms\n", timer_ms(timer_now() - state.startup));
+				state.startup = 0;
+			}
 
-			err = wait_for_fence();
+			/*
+			 * the frame's constants, indices, upload and readback buffers and its command allocators
+			 * are single-buffered, so the loop still drains the GPU here once a frame
+			 */
+			int err = wait_for_fence();
 			if (err != 0) {
 				BAIL(err, "Failed to wait for fence\n");
 			}
-		}
 
-		MSG msg;
-		if (PeekMessageA(&msg, state.hwnd, 0, 0, PM_REMOVE) != 0) {
-			TranslateMessage(&msg);
-			DispatchMessageA(&msg);
+			/* the draw waited for the compute queue, so its readback has landed too */
+			UINT alive;
+			if (state.cpu_particles) {
+				state.particle_ms += state.particles.stats.ms;
+				alive = state.particles.count;
+			} else {
+				UINT64 const * ticks = state.particle_readbackdata;
+				state.particle_ms += (double) (ticks[1] - ticks[0]) * 1000.0 / (double) state.compute_frequency;
+				alive = *(UINT const *) &ticks[2];
+			}
+			state.particle_alive += alive;
+			++state.particle_frames;
+			trace_counter("particles alive", alive);
+			trace_counter("arena bytes", (double) state.arena.last.bytes);
+
+			UINT64 completed = state.fence->lpVtbl->GetCompletedValue(state.fence);
+			release_collect(completed);
+			arena_retire(&state.arena, completed);
 		}
 	}
 
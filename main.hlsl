@@ -8,6 +8,7 @@ struct ps_input_t
 {
 	float4 position : SV_POSITION;
 	float4 color : COLOR;
+	float2 uv : TEXCOORD;
 };
 
 cbuffer cbuffer0 : register(b0)
@@ -21,11 +22,222 @@ ps_input_t vs(vs_input_t input)
 
 	output.position = mul(cbuf_mvp, input.position);
 	output.color = input.color;
+	/* the mesh has no texture coordinates, its object space xy spans the texture */
+	output.uv = float2(input.position.x * 0.5, 0.5 - input.position.y * 0.5);
 
 	return output;
 }
 
+/* streamed in by stream.h, the one table of the mesh root signature */
+Texture2D albedo : register(t2);
+SamplerState albedo_sampler : register(s0);
+
 float4 ps(ps_input_t input) : SV_TARGET
+{
+	return input.color * albedo.Sample(albedo_sampler, input.uv);
+}
+
+/* linear blend skinning on the compute queue, skin_linear_reference in skin.h is the CPU twin */
+
+struct skin_vertex_t
+{
+	float4 position;
+	float4 color;
+	uint joints;
+	float4 weights;
+};
+
+struct vertex_t
+{
+	float4 position;
+	float4 color;
+};
+
+/* registers are unique across the file, shader model 5.0 has no register spaces */
+
+/* linmath matrices as uploaded, register 4 * joint + c holds column c */
+cbuffer skin_palette : register(b1)
+{
+	float4 skin_palette[256 * 4];
+}
+
+cbuffer skin_params : register(b2)
+{
+	uint skin_vertex_count;
+}
+
+StructuredBuffer<skin_vertex_t> skin_in : register(t0);
+RWStructuredBuffer<vertex_t> skin_out : register(u0);
+
+[numthreads(64, 1, 1)]
+void cs_skin(uint3 id : SV_DispatchThreadID)
+{
+	if (id.x >= skin_vertex_count)
+	{
+		return;
+	}
+
+	skin_vertex_t v = skin_in[id.x];
+	float4 col[4] = { float4(0, 0, 0, 0), float4(0, 0, 0, 0), float4(0, 0, 0, 0), float4(0, 0, 0, 0) };
+
+	[unroll]
+	for (uint k = 0; k < 4; ++k)
+	{
+		uint joint = (v.joints >> (8 * k)) & 0xFF;
+		[unroll]
+		for (uint c = 0; c < 4; ++c)
+		{
+			col[c] = col[c] + v.weights[k] * skin_palette[joint * 4 + c];
+		}
+	}
+
+	vertex_t output;
+	output.position = col[0] * v.position.x + col[1] * v.position.y + col[2] * v.position.z + col[3] * v.position.w;
+	output.color = v.color;
+	skin_out[id.x] = output;
+}
+
+
+/*
+ * particles: update appends the survivors of one buffer to the other, emit appends new
+ * ones, args clamps the count and fills the indirect draw. particles.h is the CPU twin.
+ */
+
+struct particle_t
+{
+	float3 position;
+	float age;
+	float3 velocity;
+	float life;
+};
+
+/* particles_params_t in particles.h */
+cbuffer particle_params : register(b3)
+{
+	float3 particle_origin;
+	float particle_dt;
+	float particle_gravity;
+	float particle_damping;
+	float particle_spread;
+	float particle_speed;
+	float particle_life_min;
+	float particle_life_max;
+	uint particle_emit;
+	uint particle_seed;
+}
+
+cbuffer particle_buffers : register(b4)
+{
+	uint particle_capacity;
+	uint particle_in;
+	uint particle_out;
+}
+
+StructuredBuffer<particle_t> particles_in : register(t1);
+RWStructuredBuffer<particle_t> particles_out : register(u1);
+/* uint 0 and 1 count the particles in each buffer, bytes 16 to 32 are the draw arguments */
+RWByteAddressBuffer particle_state : register(u2);
+
+uint particle_hash(uint x)
+{
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+	return x;
+}
+
+float particle_unorm(uint h)
+{
+	return (float) (h >> 8) * (1.0f / 16777216.0f);
+}
+
+[numthreads(256, 1, 1)]
+void cs_particles_update(uint3 id : SV_DispatchThreadID)
+{
+	uint count = min(particle_state.Load(particle_in * 4), particle_capacity);
+	if (id.x >= count)
+	{
+		return;
+	}
+
+	particle_t p = particles_in[id.x];
+	float age = p.age + particle_dt;
+	if (!(age < p.life))
+	{
+		return;
+	}
+
+	float gdt = particle_gravity * particle_dt;
+	float3 v = float3(p.velocity.x * particle_damping, (p.velocity.y + gdt) * particle_damping, p.velocity.z * particle_damping);
+	p.position = p.position + v * particle_dt;
+	p.velocity = v;
+	p.age = age;
+
+	uint slot;
+	particle_state.InterlockedAdd(particle_out * 4, 1, slot);
+	particles_out[slot] = p;
+}
+
+[numthreads(64, 1, 1)]
+void cs_particles_emit(uint3 id : SV_DispatchThreadID)
+{
+	if (id.x >= particle_emit)
+	{
+		return;
+	}
+
+	uint slot;
+	particle_state.InterlockedAdd(particle_out * 4, 1, slot);
+	if (slot >= particle_capacity)
+	{
+		return;
+	}
+
+	uint h = particle_hash(particle_seed ^ particle_hash(id.x));
+	float r0 = particle_unorm(h);
+	h = particle_hash(h);
+	float r1 = particle_unorm(h);
+	h = particle_hash(h);
+	float r2 = particle_unorm(h);
+	h = particle_hash(h);
+	float r3 = particle_unorm(h);
+
+	particle_t p;
+	p.position = particle_origin;
+	p.velocity = float3((r0 * 2.0f - 1.0f) * particle_spread, particle_speed * (0.5f + 0.5f * r1), (r2 * 2.0f - 1.0f) * particle_spread);
+	p.age = 0;
+	p.life = particle_life_min + (particle_life_max - particle_life_min) * r3;
+	particles_out[slot] = p;
+}
+
+/* emit may have counted past capacity; the buffer just read is next frame's output, so it starts over */
+[numthreads(1, 1, 1)]
+void cs_particles_args(uint3 id : SV_DispatchThreadID)
+{
+	uint count = min(particle_state.Load(particle_out * 4), particle_capacity);
+	particle_state.Store(particle_out * 4, count);
+	particle_state.Store(particle_in * 4, 0);
+	particle_state.Store4(16, uint4(3, count, 0, 0));
+}
+
+/* one small triangle per particle, faded from yellow to red over its life */
+ps_input_t vs_particles(uint vertex : SV_VertexID, uint instance : SV_InstanceID)
+{
+	particle_t p = particles_in[instance];
+	float2 corner = float2(vertex == 1 ? 1.0f : 0.0f, vertex == 2 ? 1.0f : 0.0f) * 0.01f;
+
+	ps_input_t output;
+	output.position = mul(cbuf_mvp, float4(p.position, 1));
+	output.position.xy += corner * output.position.w;
+	output.color = lerp(float4(1, 1, 0, 1), float4(1, 0, 0, 1), saturate(p.age / p.life));
+	output.uv = float2(0, 0);
+
+	return output;
+}
+
+float4 ps_particles(ps_input_t input) : SV_TARGET
 {
 	return input.color;
 }
\ No newline at end of file
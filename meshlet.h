@@ -0,0 +1,744 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <immintrin.h>
+#include "linmath.h"
+#include "timer.h"
+#include "jobs.h"
+
+/*
+ * clusters of an indexed mesh that are culled as a whole before triangle pre-culling.
+ *
+ * the builder grows one meshlet at a time from a seed triangle, always adding the
+ * adjacent triangle that brings in the fewest new vertices, with ties broken towards
+ * the meshlet's average normal so the normal cones stay narrow and towards its center so
+ * the spheres stay small. a meshlet closes when it reaches MESHLET_MAX_VERTICES or
+ * MESHLET_MAX_TRIANGLES or runs out of neighbours. triangles keep their winding and
+ * are stored as byte indices into the meshlet's vertex list.
+ *
+ * each meshlet has a bounding sphere and a cone around its average normal; both are
+ * kept as SoA arrays padded to four so the culler tests four meshlets per iteration.
+ * a meshlet is dropped when its sphere is fully outside a frustum plane, or when the
+ * eye sits where every triangle in the cone faces the culled way:
+ *
+ *   dot(center - eye, axis) > cutoff * |center - eye| + radius
+ *
+ * with cutoff the sine of the cone's half angle. both tests give up MESHLET_SLACK of the
+ * magnitudes they sum, so a verdict can't flip on rounding or FMA contraction and the
+ * pass stays more conservative than pre-culling. planes and eye are taken from the mvp,
+ * in the mesh's own space. kept meshlets expand into a compacted index buffer in their
+ * original order.
+ */
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+/* meshlets per culling job */
+#define MESHLET_CHUNK 512
+/* cones whose widest normal is this close to perpendicular never cull */
+#define MESHLET_CONE_MIN_DOT 0.1f
+/* weights of normal deviation and of distance in mean edge lengths against new vertices when growing a meshlet */
+#define MESHLET_NORMAL_WEIGHT 0.5f
+#define MESHLET_SPREAD_WEIGHT 0.1f
+/* relative margin of the sphere and cone tests */
+#define MESHLET_SLACK 1e-4f
+
+#define MESHLET_KEPT 0
+#define MESHLET_FRUSTUM 1
+#define MESHLET_BACKFACE 2
+
+typedef struct meshlet {
+	UINT vertex_offset;
+	UINT triangle_offset;
+	UINT vertex_count;
+	UINT triangle_count;
+} meshlet_t;
+
+typedef struct meshlet_mesh {
+	meshlet_t * meshlets;
+	UINT count;
+	/* mesh vertex ids, vertex_count per meshlet */
+	UINT * vertices;
+	UINT vertex_count;
+	/* three local ids per triangle */
+	BYTE * triangles;
+	UINT triangle_count;
+
+	/* bounds, count rounded up to 4; padding lanes have cutoff 1 and an infinite radius */
+	float * bounds;
+	float * center[3];
+	float * radius;
+	float * axis[3];
+	float * cutoff;
+} meshlet_mesh_t;
+
+typedef struct meshlet_view {
+	/* left, right, bottom, top, near, far; normalized, inside is positive */
+	float planes[6][4];
+	float eye[3];
+	/* flips the cone axes to the culled side, 0 when cones don't cull */
+	float cone_sign;
+} meshlet_view_t;
+
+typedef struct meshlet_stats {
+	UINT64 meshlets;
+	UINT64 kept;
+	UINT64 frustum;
+	UINT64 backface;
+	UINT64 triangles;
+	UINT64 kept_triangles;
+	double ms;
+} meshlet_stats_t;
+
+typedef struct meshlet_culler {
+	/* precull_cull_sign of the rasterizer state, 0 keeps every facing */
+	int cull_sign;
+
+	UINT * scratch;
+	UINT scratch_capacity;
+	meshlet_stats_t * chunks;
+	UINT chunk_capacity;
+
+	/* accumulated over every meshlet_cull_run */
+	meshlet_stats_t total;
+	UINT64 runs;
+} meshlet_culler_t;
+
+static void meshlet_destroy(meshlet_mesh_t * mesh) {
+	free(mesh->meshlets);
+	free(mesh->vertices);
+	free(mesh->triangles);
+	_aligned_free(mesh->bounds);
+	memset(mesh, 0, sizeof(*mesh));
+}
+
+static float const * meshlet_position(float const * positions, UINT stride, UINT vertex) {
+	return (float const *) ((BYTE const *) positions + (size_t) stride * vertex);
+}
+
+/* unit normal, zero for degenerate triangles */
+static void meshlet_normal(float const * a, float const * b, float const * c, float * n) {
+	float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+	n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+	n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+	n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+
+	float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	float inv = length > 0 ? 1 / length : 0;
+	n[0] *= inv;
+	n[1] *= inv;
+	n[2] *= inv;
+}
+
+typedef struct meshlet_refit_job {
+	meshlet_mesh_t * mesh;
+	float const * positions;
+	UINT stride;
+} meshlet_refit_job_t;
+
+static void meshlet_bounds(meshlet_mesh_t * mesh, UINT index, float const * positions, UINT stride) {
+	meshlet_t const * m = &mesh->meshlets[index];
+	UINT const * ids = &mesh->vertices[m->vertex_offset];
+
+	/* the box's center keeps the sphere tight enough and costs one pass */
+	float lo[3] = { INFINITY, INFINITY, INFINITY };
+	float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+	for (UINT v = 0; v < m->vertex_count; ++v) {
+		float const * p = meshlet_position(positions, stride, ids[v]);
+		for (int k = 0; k < 3; ++k) {
+			lo[k] = p[k] < lo[k] ? p[k] : lo[k];
+			hi[k] = p[k] > hi[k] ? p[k] : hi[k];
+		}
+	}
+
+	float center[3] = { (lo[0] + hi[0]) * 0.5f, (lo[1] + hi[1]) * 0.5f, (lo[2] + hi[2]) * 0.5f };
+	float radius = 0;
+	for (UINT v = 0; v < m->vertex_count; ++v) {
+		float const * p = meshlet_position(positions, stride, ids[v]);
+		float d[3] = { p[0] - center[0], p[1] - center[1], p[2] - center[2] };
+		float r = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		radius = r > radius ? r : radius;
+	}
+
+	BYTE const * tris = &mesh->triangles[m->triangle_offset * 3];
+	float axis[3] = { 0, 0, 0 };
+	for (UINT t = 0; t < m->triangle_count; ++t) {
+		float n[3];
+		meshlet_normal(meshlet_position(positions, stride, ids[tris[t * 3 + 0]]), meshlet_position(positions, stride, ids[tris[t * 3 + 1]]), meshlet_position(positions, stride, ids[tris[t * 3 + 2]]), n);
+		axis[0] += n[0];
+		axis[1] += n[1];
+		axis[2] += n[2];
+	}
+
+	float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	float inv = length > 0 ? 1 / length : 0;
+	axis[0] *= inv;
+	axis[1] *= inv;
+	axis[2] *= inv;
+
+	/* a degenerate triangle has a zero normal, which disables the cone like a wide one */
+	float min_dot = length > 0 ? 1 : 0;
+	for (UINT t = 0; t < m->triangle_count; ++t) {
+		float n[3];
+		meshlet_normal(meshlet_position(positions, stride, ids[tris[t * 3 + 0]]), meshlet_position(positions, stride, ids[tris[t * 3 + 1]]), meshlet_position(positions, stride, ids[tris[t * 3 + 2]]), n);
+		float d = n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2];
+		min_dot = d < min_dot ? d : min_dot;
+	}
+
+	for (int k = 0; k < 3; ++k) {
+		mesh->center[k][index] = center[k];
+		mesh->axis[k][index] = axis[k];
+	}
+	mesh->radius[index] = radius;
+	mesh->cutoff[index] = min_dot <= MESHLET_CONE_MIN_DOT ? 1 : sqrtf(1 - min_dot * min_dot);
+}
+
+static void meshlet_refit_range(void * user, UINT begin, UINT end) {
+	meshlet_refit_job_t * job = user;
+	for (UINT i = begin; i < end; ++i) {
+		meshlet_bounds(job->mesh, i, job->positions, job->stride);
+	}
+}
+
+/* recomputes the bounds for moved vertices, e.g. after skinning; the clusters stay */
+static void meshlet_refit(meshlet_mesh_t * mesh, float const * positions, UINT stride) {
+	meshlet_refit_job_t job = {
+		.mesh = mesh,
+		.positions = positions,
+		.stride = stride,
+	};
+	jobs_parallel_for(mesh->count, MESHLET_CHUNK, meshlet_refit_range, &job);
+}
+
+/*
+ * clusters triangles (three indices each) over vertex_count positions spaced stride
+ * bytes apart, and fits their bounds. returns 0 on success.
+ */
+static int meshlet_build(meshlet_mesh_t * mesh, float const * positions, UINT stride, UINT vertex_count, UINT const * indices, UINT triangles) {
+	memset(mesh, 0, sizeof(*mesh));
+
+	/* vertex to triangle adjacency, plus each triangle's normal and centroid for the tie break */
+	UINT * offsets = calloc((size_t) vertex_count + 1, sizeof(UINT));
+	UINT * adjacency = malloc(sizeof(UINT) * 3 * ((size_t) triangles + 1));
+	float * normals = malloc(sizeof(float) * 6 * ((size_t) triangles + 1));
+	BYTE * emitted = calloc((size_t) triangles + 1, 1);
+	UINT * queued = calloc((size_t) triangles + 1, sizeof(UINT));
+	BYTE * local = malloc((size_t) vertex_count + 1);
+	UINT * candidates = malloc(sizeof(UINT) * 3 * ((size_t) triangles + 1));
+	UINT * cursor = malloc(sizeof(UINT) * ((size_t) vertex_count + 1));
+
+	mesh->meshlets = malloc(sizeof(meshlet_t) * ((size_t) triangles + 1));
+	mesh->vertices = malloc(sizeof(UINT) * 3 * ((size_t) triangles + 1));
+	mesh->triangles = malloc(3 * ((size_t) triangles + 1));
+
+	int result = 1;
+	if (offsets == NULL || adjacency == NULL || normals == NULL || emitted == NULL || queued == NULL || local == NULL || candidates == NULL || cursor == NULL || mesh->meshlets == NULL || mesh->vertices == NULL || mesh->triangles == NULL) {
+		goto done;
+	}
+
+	for (UINT i = 0; i < triangles * 3; ++i) {
+		if (indices[i] >= vertex_count) {
+			goto done;
+		}
+		++offsets[indices[i] + 1];
+	}
+	for (UINT v = 0; v < vertex_count; ++v) {
+		offsets[v + 1] += offsets[v];
+	}
+	memcpy(cursor, offsets, sizeof(UINT) * vertex_count);
+	double edges = 0;
+	for (UINT t = 0; t < triangles; ++t) {
+		UINT const * tri = &indices[t * 3];
+		for (int k = 0; k < 3; ++k) {
+			/* a triangle that repeats a vertex is listed once for it */
+			if (k == 0 || tri[k] != tri[0]) {
+				if (k != 2 || tri[2] != tri[1]) {
+					adjacency[cursor[tri[k]]++] = t;
+				}
+			}
+		}
+		float const * a = meshlet_position(positions, stride, tri[0]);
+		float const * b = meshlet_position(positions, stride, tri[1]);
+		float const * c = meshlet_position(positions, stride, tri[2]);
+		meshlet_normal(a, b, c, &normals[t * 6]);
+		for (int k = 0; k < 3; ++k) {
+			normals[t * 6 + 3 + k] = (a[k] + b[k] + c[k]) / 3;
+		}
+		edges += sqrt((b[0] - a[0]) * (b[0] - a[0]) + (b[1] - a[1]) * (b[1] - a[1]) + (b[2] - a[2]) * (b[2] - a[2]));
+	}
+	float spread = edges > 0 ? (float) (MESHLET_SPREAD_WEIGHT * triangles / edges) : 0;
+	memset(local, 0xFF, vertex_count);
+
+	UINT scan = 0;
+	UINT seed = 0;
+	UINT remaining = triangles;
+	while (remaining > 0) {
+		meshlet_t * m = &mesh->meshlets[mesh->count];
+		*m = (meshlet_t) {
+			.vertex_offset = mesh->vertex_count,
+			.triangle_offset = mesh->triangle_count,
+		};
+		UINT stamp = mesh->count + 1;
+		UINT candidate_count = 0;
+		float normal[3] = { 0, 0, 0 };
+		float sum[3] = { 0, 0, 0 };
+
+		/* the seed comes from the last meshlet's border when there is one left there */
+		if (seed >= triangles || emitted[seed]) {
+			while (emitted[scan]) {
+				++scan;
+			}
+			seed = scan;
+		}
+
+		UINT next = seed;
+		while (next < triangles) {
+			UINT const * tri = &indices[next * 3];
+			for (int k = 0; k < 3; ++k) {
+				UINT v = tri[k];
+				if (local[v] == 0xFF) {
+					local[v] = (BYTE) m->vertex_count++;
+					mesh->vertices[mesh->vertex_count++] = v;
+					float const * p = meshlet_position(positions, stride, v);
+					sum[0] += p[0];
+					sum[1] += p[1];
+					sum[2] += p[2];
+					for (UINT a = offsets[v]; a < cursor[v]; ++a) {
+						UINT t = adjacency[a];
+						if (!emitted[t] && queued[t] != stamp) {
+							queued[t] = stamp;
+							candidates[candidate_count++] = t;
+						}
+					}
+				}
+				mesh->triangles[mesh->triangle_count * 3 + k] = local[v];
+			}
+			++mesh->triangle_count;
+			++m->triangle_count;
+			emitted[next] = 1;
+			--remaining;
+			normal[0] += normals[next * 6 + 0];
+			normal[1] += normals[next * 6 + 1];
+			normal[2] += normals[next * 6 + 2];
+
+			if (m->triangle_count == MESHLET_MAX_TRIANGLES) {
+				break;
+			}
+
+			float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			float inv = length > 0 ? 1 / length : 0;
+			float center[3] = { sum[0] / m->vertex_count, sum[1] / m->vertex_count, sum[2] / m->vertex_count };
+			float best_score = INFINITY;
+			next = triangles;
+
+			UINT kept = 0;
+			for (UINT c = 0; c < candidate_count; ++c) {
+				UINT t = candidates[c];
+				if (emitted[t]) {
+					continue;
+				}
+				candidates[kept++] = t;
+
+				UINT const * cand = &indices[t * 3];
+				UINT fresh = (local[cand[0]] == 0xFF) + (local[cand[1]] == 0xFF && cand[1] != cand[0]) + (local[cand[2]] == 0xFF && cand[2] != cand[0] && cand[2] != cand[1]);
+				if (m->vertex_count + fresh > MESHLET_MAX_VERTICES) {
+					continue;
+				}
+
+				float const * n = &normals[t * 6];
+				float d[3] = { n[3] - center[0], n[4] - center[1], n[5] - center[2] };
+				float score = (float) fresh + MESHLET_NORMAL_WEIGHT * (1 - (n[0] * normal[0] + n[1] * normal[1] + n[2] * normal[2]) * inv) + spread * sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+				if (score < best_score) {
+					best_score = score;
+					next = t;
+				}
+			}
+			candidate_count = kept;
+		}
+
+		/* the next meshlet starts next to this one, on its first triangle that's left */
+		seed = triangles;
+		for (UINT c = 0; c < candidate_count; ++c) {
+			if (!emitted[candidates[c]]) {
+				seed = candidates[c];
+				break;
+			}
+		}
+
+		for (UINT v = 0; v < m->vertex_count; ++v) {
+			local[mesh->vertices[m->vertex_offset + v]] = 0xFF;
+		}
+		++mesh->count;
+	}
+
+	/* trim to what was used, failing to shrink keeps the larger block */
+	meshlet_t * meshlets = realloc(mesh->meshlets, sizeof(meshlet_t) * (mesh->count + 1));
+	UINT * vertices = realloc(mesh->vertices, sizeof(UINT) * (mesh->vertex_count + 1));
+	mesh->meshlets = meshlets != NULL ? meshlets : mesh->meshlets;
+	mesh->vertices = vertices != NULL ? vertices : mesh->vertices;
+
+	UINT padded = (mesh->count + 3) & ~3u;
+	mesh->bounds = _aligned_malloc(sizeof(float) * 8 * (padded + 4), 16);
+	if (mesh->bounds == NULL) {
+		goto done;
+	}
+	for (int k = 0; k < 3; ++k) {
+		mesh->center[k] = mesh->bounds + (size_t) k * padded;
+		mesh->axis[k] = mesh->bounds + (size_t) (4 + k) * padded;
+	}
+	mesh->radius = mesh->bounds + (size_t) 3 * padded;
+	mesh->cutoff = mesh->bounds + (size_t) 7 * padded;
+
+	for (UINT i = mesh->count; i < padded; ++i) {
+		for (int k = 0; k < 3; ++k) {
+			mesh->center[k][i] = 0;
+			mesh->axis[k][i] = 0;
+		}
+		mesh->radius[i] = INFINITY;
+		mesh->cutoff[i] = 1;
+	}
+	meshlet_refit(mesh, positions, stride);
+	result = 0;
+
+done:
+	free(offsets);
+	free(adjacency);
+	free(normals);
+	free(emitted);
+	free(queued);
+	free(local);
+	free(candidates);
+	free(cursor);
+	if (result != 0) {
+		meshlet_destroy(mesh);
+	}
+	return result;
+}
+
+/*
+ * the clip conditions -w <= x, y <= w and 0 <= z <= w are planes on the rows of the
+ * mvp. clip-space |x y w| of a triangle equals the determinant of the mvp's x, y and w
+ * rows times the triangle's signed volume with the eye, so with the eye at the point
+ * those rows map to zero, facing becomes a plain dot product in mesh space.
+ */
+static void meshlet_view_from_mvp(meshlet_view_t * view, mat4x4 const mvp, int cull_sign) {
+	float rows[4][4];
+	for (int r = 0; r < 4; ++r) {
+		for (int c = 0; c < 4; ++c) {
+			rows[r][c] = mvp[c][r];
+		}
+	}
+
+	for (int k = 0; k < 4; ++k) {
+		view->planes[0][k] = rows[3][k] + rows[0][k];
+		view->planes[1][k] = rows[3][k] - rows[0][k];
+		view->planes[2][k] = rows[3][k] + rows[1][k];
+		view->planes[3][k] = rows[3][k] - rows[1][k];
+		view->planes[4][k] = rows[2][k];
+		view->planes[5][k] = rows[3][k] - rows[2][k];
+	}
+	for (int p = 0; p < 6; ++p) {
+		float * plane = view->planes[p];
+		float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		if (length > 0) {
+			plane[0] /= length;
+			plane[1] /= length;
+			plane[2] /= length;
+			plane[3] /= length;
+		} else {
+			/* a plane without direction can't separate anything */
+			plane[3] = INFINITY;
+		}
+	}
+
+	/* solve rows x, y, w of the upper 3x3 for -translation by Cramer's rule */
+	float const * x = rows[0];
+	float const * y = rows[1];
+	float const * w = rows[3];
+	float det = x[0] * (y[1] * w[2] - y[2] * w[1]) - x[1] * (y[0] * w[2] - y[2] * w[0]) + x[2] * (y[0] * w[1] - y[1] * w[0]);
+	float scale = fabsf(x[0]) + fabsf(x[1]) + fabsf(x[2]) + fabsf(y[0]) + fabsf(y[1]) + fabsf(y[2]) + fabsf(w[0]) + fabsf(w[1]) + fabsf(w[2]);
+
+	view->eye[0] = view->eye[1] = view->eye[2] = 0;
+	view->cone_sign = 0;
+	/* an orthographic projection puts the eye at infinity, cones are left out then */
+	if (cull_sign == 0 || fabsf(det) <= 1e-6f * scale * scale * scale) {
+		return;
+	}
+
+	float b[3] = { -x[3], -y[3], -w[3] };
+	float inv = 1 / det;
+	view->eye[0] = (b[0] * (y[1] * w[2] - y[2] * w[1]) - x[1] * (b[1] * w[2] - y[2] * b[2]) + x[2] * (b[1] * w[1] - y[1] * b[2])) * inv;
+	view->eye[1] = (x[0] * (b[1] * w[2] - y[2] * b[2]) - b[0] * (y[0] * w[2] - y[2] * w[0]) + x[2] * (y[0] * b[2] - b[1] * w[0])) * inv;
+	view->eye[2] = (x[0] * (y[1] * b[2] - b[1] * w[1]) - x[1] * (y[0] * b[2] - b[1] * w[0]) + b[0] * (y[0] * w[1] - y[1] * w[0])) * inv;
+	view->cone_sign = (float) cull_sign * (det > 0 ? 1.0f : -1.0f);
+}
+
+static int meshlet_test(meshlet_mesh_t const * mesh, meshlet_view_t const * view, UINT i) {
+	float cx = mesh->center[0][i];
+	float cy = mesh->center[1][i];
+	float cz = mesh->center[2][i];
+	float r = mesh->radius[i];
+	/* bounds every product in the plane distance, the planes are normalized */
+	float slack = MESHLET_SLACK * (fabsf(cx) + fabsf(cy) + fabsf(cz) + r);
+
+	for (int p = 0; p < 6; ++p) {
+		float const * plane = view->planes[p];
+		if (plane[0] * cx + plane[1] * cy + plane[2] * cz + plane[3] < -r - (slack + MESHLET_SLACK * fabsf(plane[3]))) {
+			return MESHLET_FRUSTUM;
+		}
+	}
+
+	if (view->cone_sign != 0) {
+		float dx = cx - view->eye[0];
+		float dy = cy - view->eye[1];
+		float dz = cz - view->eye[2];
+		float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+		float d = (dx * mesh->axis[0][i] + dy * mesh->axis[1][i] + dz * mesh->axis[2][i]) * view->cone_sign;
+		if (d > mesh->cutoff[i] * distance + r + MESHLET_SLACK * (distance + r)) {
+			return MESHLET_BACKFACE;
+		}
+	}
+
+	return MESHLET_KEPT;
+}
+
+/* the verdicts of meshlets first..first + 3 in two bits each, same arithmetic as meshlet_test */
+static UINT meshlet_test_sse(meshlet_mesh_t const * mesh, meshlet_view_t const * view, UINT first) {
+	__m128 cx = _mm_loadu_ps(&mesh->center[0][first]);
+	__m128 cy = _mm_loadu_ps(&mesh->center[1][first]);
+	__m128 cz = _mm_loadu_ps(&mesh->center[2][first]);
+	__m128 r = _mm_loadu_ps(&mesh->radius[first]);
+	__m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), r);
+	__m128 const magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 slack = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_and_ps(cx, magnitude), _mm_and_ps(cy, magnitude)), _mm_and_ps(cz, magnitude)), r);
+	slack = _mm_mul_ps(_mm_set1_ps(MESHLET_SLACK), slack);
+
+	__m128 outside = _mm_setzero_ps();
+	for (int p = 0; p < 6; ++p) {
+		float const * plane = view->planes[p];
+		__m128 d = _mm_mul_ps(_mm_set1_ps(plane[0]), cx);
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane[1]), cy));
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane[2]), cz));
+		d = _mm_add_ps(d, _mm_set1_ps(plane[3]));
+		__m128 limit = _mm_sub_ps(neg_r, _mm_add_ps(slack, _mm_set1_ps(MESHLET_SLACK * fabsf(plane[3]))));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(d, limit));
+	}
+	int frustum = _mm_movemask_ps(outside);
+
+	int backface = 0;
+	if (view->cone_sign != 0) {
+		__m128 dx = _mm_sub_ps(cx, _mm_set1_ps(view->eye[0]));
+		__m128 dy = _mm_sub_ps(cy, _mm_set1_ps(view->eye[1]));
+		__m128 dz = _mm_sub_ps(cz, _mm_set1_ps(view->eye[2]));
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		__m128 d = _mm_mul_ps(dx, _mm_loadu_ps(&mesh->axis[0][first]));
+		d = _mm_add_ps(d, _mm_mul_ps(dy, _mm_loadu_ps(&mesh->axis[1][first])));
+		d = _mm_add_ps(d, _mm_mul_ps(dz, _mm_loadu_ps(&mesh->axis[2][first])));
+		d = _mm_mul_ps(d, _mm_set1_ps(view->cone_sign));
+		__m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&mesh->cutoff[first]), distance), r);
+		limit = _mm_add_ps(limit, _mm_mul_ps(_mm_set1_ps(MESHLET_SLACK), _mm_add_ps(distance, r)));
+		backface = _mm_movemask_ps(_mm_cmpgt_ps(d, limit)) & ~frustum;
+	}
+
+	UINT verdicts = 0;
+	for (int lane = 0; lane < 4; ++lane) {
+		verdicts |= (UINT) ((frustum >> lane & 1) ? MESHLET_FRUSTUM : (backface >> lane & 1) ? MESHLET_BACKFACE : MESHLET_KEPT) << (lane * 2);
+	}
+	return verdicts;
+}
+
+typedef struct meshlet_job {
+	meshlet_culler_t * culler;
+	meshlet_mesh_t const * mesh;
+	meshlet_view_t const * view;
+	UINT * out_indices;
+	UINT * out_meshlets;
+} meshlet_job_t;
+
+/* writes the ids of kept meshlets in begin..end to out and counts into stats */
+static UINT meshlet_classify(meshlet_job_t const * job, UINT begin, UINT end, UINT * out, meshlet_stats_t * stats) {
+	meshlet_mesh_t const * mesh = job->mesh;
+	UINT kept = 0;
+
+	/* begin is a multiple of 4 and the bounds are padded, so the last group reads padding */
+	for (UINT i = begin; i < end; i += 4) {
+		UINT verdicts = meshlet_test_sse(mesh, job->view, i);
+		UINT lanes = end - i < 4 ? end - i : 4;
+		for (UINT lane = 0; lane < lanes; ++lane) {
+			UINT triangles = mesh->meshlets[i + lane].triangle_count;
+			stats->triangles += triangles;
+			switch (verdicts >> (lane * 2) & 3) {
+				case MESHLET_KEPT: {
+					out[kept++] = i + lane;
+					stats->kept_triangles += triangles;
+					break;
+				}
+				case MESHLET_FRUSTUM: {
+					++stats->frustum;
+					break;
+				}
+				case MESHLET_BACKFACE: {
+					++stats->backface;
+					break;
+				}
+			}
+		}
+	}
+
+	stats->meshlets += end - begin;
+	stats->kept += kept;
+	return kept;
+}
+
+static void meshlet_expand(meshlet_mesh_t const * mesh, UINT const * ids, UINT count, UINT * out) {
+	for (UINT i = 0; i < count; ++i) {
+		meshlet_t const * m = &mesh->meshlets[ids[i]];
+		UINT const * vertices = &mesh->vertices[m->vertex_offset];
+		BYTE const * tris = &mesh->triangles[m->triangle_offset * 3];
+		for (UINT t = 0; t < m->triangle_count * 3; ++t) {
+			out[t] = vertices[tris[t]];
+		}
+		out += m->triangle_count * 3;
+	}
+}
+
+static void meshlet_chunk_range(void * user, UINT begin, UINT end) {
+	meshlet_job_t * job = user;
+
+	for (UINT chunk = begin; chunk < end; ++chunk) {
+		UINT first = chunk * MESHLET_CHUNK;
+		UINT last = first + MESHLET_CHUNK < job->mesh->count ? first + MESHLET_CHUNK : job->mesh->count;
+		meshlet_stats_t * stats = &job->culler->chunks[chunk];
+
+		*stats = (meshlet_stats_t) { 0 };
+		meshlet_classify(job, first, last, &job->culler->scratch[first], stats);
+	}
+}
+
+/* chunks[i].meshlets and .triangles hold the output offsets once the prefix sum ran */
+static void meshlet_copy_range(void * user, UINT begin, UINT end) {
+	meshlet_job_t * job = user;
+
+	for (UINT chunk = begin; chunk < end; ++chunk) {
+		meshlet_stats_t const * stats = &job->culler->chunks[chunk];
+		UINT const * ids = &job->culler->scratch[chunk * MESHLET_CHUNK];
+		if (job->out_meshlets != NULL) {
+			memcpy(&job->out_meshlets[stats->meshlets], ids, sizeof(UINT) * stats->kept);
+		}
+		meshlet_expand(job->mesh, ids, (UINT) stats->kept, &job->out_indices[stats->triangles * 3]);
+	}
+}
+
+static void meshlet_culler_init(meshlet_culler_t * culler, int cull_sign) {
+	*culler = (meshlet_culler_t) {
+		.cull_sign = cull_sign,
+	};
+}
+
+static void meshlet_culler_destroy(meshlet_culler_t * culler) {
+	free(culler->scratch);
+	free(culler->chunks);
+	culler->scratch = NULL;
+	culler->chunks = NULL;
+	culler->scratch_capacity = 0;
+	culler->chunk_capacity = 0;
+}
+
+/*
+ * writes the triangles of the meshlets that survive mvp to out_indices, which needs
+ * room for all of the mesh's triangles, and returns how many there are. out_meshlets,
+ * when not NULL, receives the kept meshlet ids. stats may be NULL.
+ */
+static UINT meshlet_cull_run(meshlet_culler_t * culler, meshlet_mesh_t const * mesh, mat4x4 const mvp, UINT * out_indices, UINT * out_meshlets, meshlet_stats_t * stats) {
+	LONGLONG start = timer_now();
+	UINT chunk_count = (mesh->count + MESHLET_CHUNK - 1) / MESHLET_CHUNK;
+	meshlet_stats_t sum = { 0 };
+
+	meshlet_view_t view;
+	meshlet_view_from_mvp(&view, mvp, culler->cull_sign);
+
+	meshlet_job_t job = {
+		.culler = culler,
+		.mesh = mesh,
+		.view = &view,
+		.out_indices = out_indices,
+		.out_meshlets = out_meshlets,
+	};
+
+	if (culler->scratch_capacity < mesh->count) {
+		UINT * scratch = realloc(culler->scratch, sizeof(UINT) * mesh->count);
+		if (scratch == NULL) {
+			return 0;
+		}
+		culler->scratch = scratch;
+		culler->scratch_capacity = mesh->count;
+	}
+
+	if (chunk_count <= 1) {
+		UINT kept = meshlet_classify(&job, 0, mesh->count, culler->scratch, &sum);
+		if (out_meshlets != NULL) {
+			memcpy(out_meshlets, culler->scratch, sizeof(UINT) * kept);
+		}
+		meshlet_expand(mesh, culler->scratch, kept, out_indices);
+	} else {
+		if (culler->chunk_capacity < chunk_count) {
+			meshlet_stats_t * chunks = realloc(culler->chunks, sizeof(meshlet_stats_t) * chunk_count);
+			if (chunks == NULL) {
+				return 0;
+			}
+			culler->chunks = chunks;
+			culler->chunk_capacity = chunk_count;
+		}
+
+		jobs_parallel_for(chunk_count, 1, meshlet_chunk_range, &job);
+
+		for (UINT i = 0; i < chunk_count; ++i) {
+			meshlet_stats_t * chunk = &culler->chunks[i];
+			sum.meshlets += chunk->meshlets;
+			sum.frustum += chunk->frustum;
+			sum.backface += chunk->backface;
+			sum.triangles += chunk->triangles;
+			chunk->meshlets = sum.kept;
+			sum.kept += chunk->kept;
+			chunk->triangles = sum.kept_triangles;
+			sum.kept_triangles += chunk->kept_triangles;
+		}
+
+		jobs_parallel_for(chunk_count, 1, meshlet_copy_range, &job);
+	}
+
+	sum.ms = timer_ms(timer_now() - start);
+
+	culler->total.meshlets += sum.meshlets;
+	culler->total.kept += sum.kept;
+	culler->total.frustum += sum.frustum;
+	culler->total.backface += sum.backface;
+	culler->total.triangles += sum.triangles;
+	culler->total.kept_triangles += sum.kept_triangles;
+	culler->total.ms += sum.ms;
+	++culler->runs;
+
+	if (stats != NULL) {
+		*stats = sum;
+	}
+
+	return (UINT) sum.kept_triangles;
+}
+
+static void meshlet_mesh_report(meshlet_mesh_t const * mesh, char const * name, FILE * fp) {
+	double count = mesh->count > 0 ? (double) mesh->count : 1;
+	fprintf(fp, "meshlets: %s has %u meshlets over %u triangles, %.1f vertices and %.1f triangles each\n", name, mesh->count, mesh->triangle_count, mesh->vertex_count / count, mesh->triangle_count / count);
+}
+
+static void meshlet_report(meshlet_stats_t const * stats, FILE * fp) {
+	double meshlets = stats->meshlets > 0 ? (double) stats->meshlets : 1;
+	double triangles = stats->triangles > 0 ? (double) stats->triangles : 1;
+	fprintf(fp, "meshlets: %llu meshlets, kept %llu, frustum %llu (%.1f%%), backface %llu (%.1f%%); %llu of %llu triangles kept (%.1f%%), %.3f ms, %.3f ms per million triangles\n", (unsigned long long) stats->meshlets, (unsigned long long) stats->kept, (unsigned long long) stats->frustum, stats->frustum * 100.0 / meshlets, (unsigned long long) stats->backface, stats->backface * 100.0 / meshlets, (unsigned long long) stats->kept_triangles, (unsigned long long) stats->triangles, stats->kept_triangles * 100.0 / triangles, stats->ms, stats->ms * 1e6 / triangles);
+}
+
+#endif
@@ -0,0 +1,685 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <immintrin.h>
+#include "linmath.h"
+#include "timer.h"
+#include "jobs.h"
+#include "vshade.h"
+
+/*
+ * masked software occlusion culling: a few occluder triangles go into a small depth
+ * buffer on the CPU and object boxes are tested against it before their draws are
+ * queued.
+ *
+ * the buffer is split into tiles of 32x4 pixels. a tile holds no per-pixel depth, only
+ * a reference depth z0 for the whole tile, a working depth z1 and a 128-bit mask of the
+ * pixels z1 applies to. each bound is the farthest any occluder can be there, so a
+ * pixel's depth is at most z1 when its mask bit is set and z0 otherwise. a triangle
+ * merges its coverage into the working layer at its farthest depth inside the tile;
+ * once the mask is full the working layer becomes the new reference. when a triangle
+ * is much nearer than the working layer, the layer is dropped and its pixels fall back
+ * to z0, which keeps the bounds tight for near occluders in front of far ones.
+ *
+ * rows of a tile take their coverage from the triangle's edge equations, four rows per
+ * SSE vector. blocks of OCCLUSION_COARSE x OCCLUSION_COARSE tiles keep their largest
+ * z0 so a box test can skip whole blocks. rasterization runs in bands of tile rows on
+ * the job pool, every band sees the triangles in submission order.
+ *
+ * pixel centers must lie inside an occluder triangle to be covered, and a box is only
+ * hidden when its nearest corner is behind the bound of every pixel its screen rectangle
+ * touches. depth is z / w of vshade's clip space, boxes crossing w = 0 are visible.
+ */
+
+#define OCCLUSION_TILE_WIDTH 32
+#define OCCLUSION_TILE_HEIGHT 4
+/* tiles per side of a coarse block, also the tile rows of a rasterization band */
+#define OCCLUSION_COARSE 4
+#define OCCLUSION_MIN_W 1e-5f
+
+#if defined(__AVX2__)
+#define OCCLUSION_PATH "avx2"
+#else
+#define OCCLUSION_PATH "sse2"
+#endif
+
+typedef struct occlusion_triangle {
+	/* edge functions A x + B y + C, positive inside, and 1 / A */
+	float edge[3][3];
+	float inv_a[3];
+	/* z = plane[0] x + plane[1] y + plane[2] in pixels, capped by the farthest vertex */
+	float plane[3];
+	float zmax;
+	/* tile range, x1 <= x0 for triangles that were culled */
+	UINT tile_x0;
+	UINT tile_y0;
+	UINT tile_x1;
+	UINT tile_y1;
+} occlusion_triangle_t;
+
+/* pixels x0..x1 - 1 by y0..y1 - 1 and the nearest depth of what covers them */
+typedef struct occlusion_rect {
+	UINT x0;
+	UINT y0;
+	UINT x1;
+	UINT y1;
+	float zmin;
+} occlusion_rect_t;
+
+typedef struct occlusion_stats {
+	UINT64 triangles;
+	UINT64 rasterized;
+	UINT64 tile_updates;
+	UINT64 objects;
+	UINT64 culled;
+	double raster_ms;
+	double test_ms;
+} occlusion_stats_t;
+
+typedef struct occlusion {
+	UINT width;
+	UINT height;
+	UINT tiles_x;
+	UINT tiles_y;
+	UINT coarse_x;
+	UINT coarse_y;
+	/* precull_cull_sign of the occluders' rasterizer state, 0 rasterizes both facings */
+	int cull_sign;
+
+	__m128i * masks;
+	float * z0;
+	float * z1;
+	float * coarse;
+
+	occlusion_triangle_t * setup;
+	UINT setup_capacity;
+	UINT setup_count;
+	UINT64 * band_updates;
+
+	/* accumulated since occlusion_init, frames counts occlusion_clear */
+	occlusion_stats_t total;
+	UINT64 frames;
+} occlusion_t;
+
+static void occlusion_destroy(occlusion_t * occ) {
+	_aligned_free(occ->masks);
+	free(occ->z0);
+	free(occ->z1);
+	free(occ->coarse);
+	free(occ->setup);
+	free(occ->band_updates);
+	*occ = (occlusion_t) { 0 };
+}
+
+static void occlusion_clear(occlusion_t * occ) {
+	UINT tiles = occ->tiles_x * occ->tiles_y;
+	memset(occ->masks, 0, sizeof(__m128i) * tiles);
+	for (UINT i = 0; i < tiles; ++i) {
+		occ->z0[i] = FLT_MAX;
+		occ->z1[i] = 0;
+	}
+	for (UINT i = 0; i < occ->coarse_x * occ->coarse_y; ++i) {
+		occ->coarse[i] = FLT_MAX;
+	}
+	++occ->frames;
+}
+
+/* the size is rounded up to whole tiles, returns 0 on success */
+static int occlusion_init(occlusion_t * occ, UINT width, UINT height, int cull_sign) {
+	UINT tiles_x = (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH;
+	UINT tiles_y = (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT;
+	UINT coarse_x = (tiles_x + OCCLUSION_COARSE - 1) / OCCLUSION_COARSE;
+	UINT coarse_y = (tiles_y + OCCLUSION_COARSE - 1) / OCCLUSION_COARSE;
+
+	*occ = (occlusion_t) {
+		.width = tiles_x * OCCLUSION_TILE_WIDTH,
+		.height = tiles_y * OCCLUSION_TILE_HEIGHT,
+		.tiles_x = tiles_x,
+		.tiles_y = tiles_y,
+		.coarse_x = coarse_x,
+		.coarse_y = coarse_y,
+		.cull_sign = cull_sign,
+		.masks = _aligned_malloc(sizeof(__m128i) * tiles_x * tiles_y, 16),
+		.z0 = malloc(sizeof(float) * tiles_x * tiles_y),
+		.z1 = malloc(sizeof(float) * tiles_x * tiles_y),
+		.coarse = malloc(sizeof(float) * coarse_x * coarse_y),
+		.band_updates = malloc(sizeof(UINT64) * coarse_y),
+	};
+
+	if (tiles_x == 0 || tiles_y == 0 || occ->masks == NULL || occ->z0 == NULL || occ->z1 == NULL || occ->coarse == NULL || occ->band_updates == NULL) {
+		occlusion_destroy(occ);
+		return 1;
+	}
+
+	occlusion_clear(occ);
+	occ->frames = 0;
+	return 0;
+}
+
+/*
+ * one triangle in front of the near plane, from clip-space x y z w. the y-down screen
+ * area is positive for triangles that are clockwise on screen: the same sign as
+ * precull's |x y w| determinant.
+ */
+static void occlusion_setup_clipped(occlusion_t const * occ, float const (* v)[4], occlusion_triangle_t * out) {
+	out->tile_x0 = out->tile_x1 = 0;
+
+	float sx[3];
+	float sy[3];
+	float sz[3];
+	for (int i = 0; i < 3; ++i) {
+		float w = v[i][3];
+		if (w <= OCCLUSION_MIN_W) {
+			return;
+		}
+
+		sx[i] = (v[i][0] / w * 0.5f + 0.5f) * occ->width;
+		sy[i] = (0.5f - v[i][1] / w * 0.5f) * occ->height;
+		sz[i] = v[i][2] / w;
+	}
+
+	float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+	if (area == 0 || (occ->cull_sign > 0 && area > 0) || (occ->cull_sign < 0 && area < 0)) {
+		return;
+	}
+	if (area < 0) {
+		float t;
+		t = sx[1]; sx[1] = sx[2]; sx[2] = t;
+		t = sy[1]; sy[1] = sy[2]; sy[2] = t;
+		t = sz[1]; sz[1] = sz[2]; sz[2] = t;
+		area = -area;
+	}
+
+	/* pixels whose centers can be inside, in whole tiles */
+	float minx = min(sx[0], min(sx[1], sx[2]));
+	float maxx = max(sx[0], max(sx[1], sx[2]));
+	float miny = min(sy[0], min(sy[1], sy[2]));
+	float maxy = max(sy[0], max(sy[1], sy[2]));
+	if (maxx < 0.5f || maxy < 0.5f || minx > occ->width - 0.5f || miny > occ->height - 0.5f) {
+		return;
+	}
+	UINT px0 = minx < 0.5f ? 0 : (UINT) ceilf(minx - 0.5f);
+	UINT py0 = miny < 0.5f ? 0 : (UINT) ceilf(miny - 0.5f);
+	UINT px1 = maxx > occ->width - 0.5f ? occ->width - 1 : (UINT) floorf(maxx - 0.5f);
+	UINT py1 = maxy > occ->height - 0.5f ? occ->height - 1 : (UINT) floorf(maxy - 0.5f);
+	if (px1 < px0 || py1 < py0) {
+		return;
+	}
+
+	for (int e = 0; e < 3; ++e) {
+		int f = (e + 1) % 3;
+		float a = -(sy[f] - sy[e]);
+		float b = sx[f] - sx[e];
+		out->edge[e][0] = a;
+		out->edge[e][1] = b;
+		out->edge[e][2] = (sy[f] - sy[e]) * sx[e] - (sx[f] - sx[e]) * sy[e];
+		out->inv_a[e] = a != 0 ? 1 / a : 0;
+	}
+
+	float dz1 = sz[1] - sz[0];
+	float dz2 = sz[2] - sz[0];
+	out->plane[0] = (dz1 * (sy[2] - sy[0]) - dz2 * (sy[1] - sy[0])) / area;
+	out->plane[1] = (dz2 * (sx[1] - sx[0]) - dz1 * (sx[2] - sx[0])) / area;
+	out->plane[2] = sz[0] - out->plane[0] * sx[0] - out->plane[1] * sy[0];
+	out->zmax = max(sz[0], max(sz[1], sz[2]));
+
+	out->tile_x0 = px0 / OCCLUSION_TILE_WIDTH;
+	out->tile_y0 = py0 / OCCLUSION_TILE_HEIGHT;
+	out->tile_x1 = px1 / OCCLUSION_TILE_WIDTH + 1;
+	out->tile_y1 = py1 / OCCLUSION_TILE_HEIGHT + 1;
+}
+
+/*
+ * clips against vshade's near plane z = 0 into out[0] and out[1], which keeps the walls
+ * beside the camera as occluders. out[1] is empty unless clipping left a quad.
+ */
+static void occlusion_setup(occlusion_t const * occ, vshade_out_t const * clip, UINT const * tri, occlusion_triangle_t * out) {
+	float in[3][4];
+	for (int i = 0; i < 3; ++i) {
+		in[i][0] = clip->x[tri[i]];
+		in[i][1] = clip->y[tri[i]];
+		in[i][2] = clip->z[tri[i]];
+		in[i][3] = clip->w[tri[i]];
+	}
+	out[0].tile_x0 = out[0].tile_x1 = 0;
+	out[1].tile_x0 = out[1].tile_x1 = 0;
+
+	if (in[0][2] >= 0 && in[1][2] >= 0 && in[2][2] >= 0) {
+		occlusion_setup_clipped(occ, in, &out[0]);
+		return;
+	}
+
+	float poly[4][4];
+	int count = 0;
+	for (int i = 0; i < 3; ++i) {
+		float const * a = in[i];
+		float const * b = in[(i + 1) % 3];
+		if (a[2] >= 0) {
+			memcpy(poly[count++], a, sizeof(float) * 4);
+		}
+		if ((a[2] >= 0) != (b[2] >= 0)) {
+			float t = a[2] / (a[2] - b[2]);
+			for (int k = 0; k < 4; ++k) {
+				poly[count][k] = a[k] + (b[k] - a[k]) * t;
+			}
+			poly[count++][2] = 0;
+		}
+	}
+
+	if (count >= 3) {
+		occlusion_setup_clipped(occ, (float const (*)[4]) poly, &out[0]);
+	}
+	if (count == 4) {
+		float fan[3][4];
+		memcpy(fan[0], poly[0], sizeof(float) * 4);
+		memcpy(fan[1], poly[2], sizeof(float) * 4);
+		memcpy(fan[2], poly[3], sizeof(float) * 4);
+		occlusion_setup_clipped(occ, (float const (*)[4]) fan, &out[1]);
+	}
+}
+
+/* bits first..end - 1 of each lane, counts run 0..32 */
+#if defined(__AVX2__)
+static __m128i occlusion_span_mask(__m128i first, __m128i end) {
+	__m128i const ones = _mm_set1_epi32(-1);
+	return _mm_andnot_si128(_mm_sllv_epi32(ones, end), _mm_sllv_epi32(ones, first));
+}
+#else
+static __m128i occlusion_span_mask(__m128i first, __m128i end) {
+	UINT f[4];
+	UINT e[4];
+	UINT m[4];
+	_mm_storeu_si128((__m128i *) f, first);
+	_mm_storeu_si128((__m128i *) e, end);
+	for (int i = 0; i < 4; ++i) {
+		UINT from = f[i] >= 32 ? 0 : ~0u << f[i];
+		UINT to = e[i] >= 32 ? 0 : ~0u << e[i];
+		m[i] = from & ~to;
+	}
+	return _mm_loadu_si128((__m128i const *) m);
+}
+#endif
+
+/*
+ * coverage of the tile's four rows, one 32-bit lane per row with bit i for pixel i.
+ * each row is the span between the nearest left and right edge crossings.
+ */
+static __m128i occlusion_tile_coverage(occlusion_triangle_t const * tri, UINT tx, UINT ty) {
+	float x0 = (float) (tx * OCCLUSION_TILE_WIDTH);
+	float y0 = (float) (ty * OCCLUSION_TILE_HEIGHT);
+	__m128 const y = _mm_add_ps(_mm_set1_ps(y0), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+	__m128 const zero = _mm_setzero_ps();
+	__m128 left = _mm_set1_ps(-INFINITY);
+	__m128 right = _mm_set1_ps(INFINITY);
+
+	for (int e = 0; e < 3; ++e) {
+		float const * edge = tri->edge[e];
+		__m128 rest = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge[1]), y), _mm_set1_ps(edge[2]));
+		if (edge[0] > 0) {
+			left = _mm_max_ps(left, _mm_mul_ps(_mm_sub_ps(zero, rest), _mm_set1_ps(tri->inv_a[e])));
+		} else if (edge[0] < 0) {
+			right = _mm_min_ps(right, _mm_mul_ps(_mm_sub_ps(zero, rest), _mm_set1_ps(tri->inv_a[e])));
+		} else {
+			/* a horizontal edge keeps or drops whole rows */
+			__m128 outside = _mm_cmplt_ps(rest, zero);
+			left = _mm_or_ps(_mm_and_ps(outside, _mm_set1_ps(INFINITY)), _mm_andnot_ps(outside, left));
+		}
+	}
+
+	/* pixel x is covered when x + 0.5 lies in [left, right] */
+	__m128 const limit = _mm_set1_ps((float) OCCLUSION_TILE_WIDTH);
+	__m128 from = _mm_min_ps(_mm_max_ps(_mm_sub_ps(left, _mm_set1_ps(x0 + 0.5f)), zero), limit);
+	__m128 to = _mm_min_ps(_mm_max_ps(_mm_sub_ps(right, _mm_set1_ps(x0 - 0.5f)), zero), limit);
+	__m128i first = _mm_cvttps_epi32(from);
+	first = _mm_sub_epi32(first, _mm_castps_si128(_mm_cmplt_ps(_mm_cvtepi32_ps(first), from)));
+	__m128i end = _mm_cvttps_epi32(to);
+
+	return occlusion_span_mask(first, end);
+}
+
+static BOOL occlusion_mask_empty(__m128i mask) {
+	return _mm_movemask_epi8(_mm_cmpeq_epi32(mask, _mm_setzero_si128())) == 0xFFFF;
+}
+
+static BOOL occlusion_mask_full(__m128i mask) {
+	return _mm_movemask_epi8(_mm_cmpeq_epi32(mask, _mm_set1_epi32(-1))) == 0xFFFF;
+}
+
+/* the triangle's farthest depth over the tile, no nearer than any pixel it covers there */
+static float occlusion_tile_depth(occlusion_triangle_t const * tri, UINT tx, UINT ty) {
+	float x = (float) ((tx + (tri->plane[0] > 0)) * OCCLUSION_TILE_WIDTH);
+	float y = (float) ((ty + (tri->plane[1] > 0)) * OCCLUSION_TILE_HEIGHT);
+	float z = tri->plane[0] * x + tri->plane[1] * y + tri->plane[2];
+	return z < tri->zmax ? z : tri->zmax;
+}
+
+static void occlusion_update_tile(occlusion_t * occ, UINT tile, __m128i coverage, float z) {
+	float z0 = occ->z0[tile];
+	if (z >= z0) {
+		return;
+	}
+
+	__m128i mask = _mm_load_si128(&occ->masks[tile]);
+	float z1 = occ->z1[tile];
+	if (occlusion_mask_empty(mask)) {
+		z1 = z;
+	} else if (z1 - z > z0 - z1) {
+		/* much nearer than the working layer, which falls back to the reference */
+		mask = _mm_setzero_si128();
+		z1 = z;
+	} else {
+		z1 = z > z1 ? z : z1;
+	}
+	mask = _mm_or_si128(mask, coverage);
+
+	if (occlusion_mask_full(mask)) {
+		occ->z0[tile] = z1;
+		mask = _mm_setzero_si128();
+		z1 = 0;
+	}
+	_mm_store_si128(&occ->masks[tile], mask);
+	occ->z1[tile] = z1;
+}
+
+typedef struct occlusion_job {
+	occlusion_t * occ;
+	vshade_out_t const * clip;
+	UINT const * indices;
+} occlusion_job_t;
+
+static void occlusion_setup_range(void * user, UINT begin, UINT end) {
+	occlusion_job_t * job = user;
+	for (UINT t = begin; t < end; ++t) {
+		occlusion_setup(job->occ, job->clip, &job->indices[t * 3], &job->occ->setup[t * 2]);
+	}
+}
+
+/* one band of OCCLUSION_COARSE tile rows, then its coarse blocks */
+static void occlusion_band_range(void * user, UINT begin, UINT end) {
+	occlusion_job_t * job = user;
+	occlusion_t * occ = job->occ;
+
+	for (UINT band = begin; band < end; ++band) {
+		UINT row0 = band * OCCLUSION_COARSE;
+		UINT row1 = row0 + OCCLUSION_COARSE < occ->tiles_y ? row0 + OCCLUSION_COARSE : occ->tiles_y;
+		UINT64 updates = 0;
+
+		for (UINT t = 0; t < occ->setup_count; ++t) {
+			occlusion_triangle_t const * tri = &occ->setup[t];
+			UINT y0 = tri->tile_y0 > row0 ? tri->tile_y0 : row0;
+			UINT y1 = tri->tile_y1 < row1 ? tri->tile_y1 : row1;
+			for (UINT ty = y0; ty < y1; ++ty) {
+				for (UINT tx = tri->tile_x0; tx < tri->tile_x1; ++tx) {
+					__m128i coverage = occlusion_tile_coverage(tri, tx, ty);
+					if (occlusion_mask_empty(coverage)) {
+						continue;
+					}
+					occlusion_update_tile(occ, ty * occ->tiles_x + tx, coverage, occlusion_tile_depth(tri, tx, ty));
+					++updates;
+				}
+			}
+		}
+
+		for (UINT bx = 0; bx < occ->coarse_x; ++bx) {
+			UINT x0 = bx * OCCLUSION_COARSE;
+			UINT x1 = x0 + OCCLUSION_COARSE < occ->tiles_x ? x0 + OCCLUSION_COARSE : occ->tiles_x;
+			float farthest = 0;
+			for (UINT ty = row0; ty < row1; ++ty) {
+				for (UINT tx = x0; tx < x1; ++tx) {
+					float z = occ->z0[ty * occ->tiles_x + tx];
+					farthest = z > farthest ? z : farthest;
+				}
+			}
+			occ->coarse[band * occ->coarse_x + bx] = farthest;
+		}
+		occ->band_updates[band] = updates;
+	}
+}
+
+/* adds the triangles (three indices each) of vshade output as occluders, returns 0 on success */
+static int occlusion_rasterize(occlusion_t * occ, vshade_out_t const * clip, UINT const * indices, UINT triangles) {
+	LONGLONG start = timer_now();
+
+	/* near plane clipping can split every triangle in two */
+	if (occ->setup_capacity < triangles * 2) {
+		occlusion_triangle_t * setup = realloc(occ->setup, sizeof(occlusion_triangle_t) * 2 * triangles);
+		if (setup == NULL) {
+			return 1;
+		}
+		occ->setup = setup;
+		occ->setup_capacity = triangles * 2;
+	}
+
+	occlusion_job_t job = {
+		.occ = occ,
+		.clip = clip,
+		.indices = indices,
+	};
+	jobs_parallel_for(triangles, 256, occlusion_setup_range, &job);
+
+	/* culled triangles drop out here so the bands walk only what covers something */
+	UINT kept = 0;
+	for (UINT t = 0; t < triangles * 2; ++t) {
+		if (occ->setup[t].tile_x1 > occ->setup[t].tile_x0) {
+			occ->setup[kept++] = occ->setup[t];
+		}
+	}
+	occ->setup_count = kept;
+
+	jobs_parallel_for(occ->coarse_y, 1, occlusion_band_range, &job);
+
+	occ->total.triangles += triangles;
+	occ->total.rasterized += kept;
+	for (UINT band = 0; band < occ->coarse_y; ++band) {
+		occ->total.tile_updates += occ->band_updates[band];
+	}
+	occ->total.raster_ms += timer_ms(timer_now() - start);
+	return 0;
+}
+
+/*
+ * the pixels the box can touch and its nearest depth. FALSE when the box can't be
+ * tested: it crosses the w = 0 plane or lies off-screen.
+ */
+static BOOL occlusion_box_rect(occlusion_t const * occ, mat4x4 const mvp, float const * lo, float const * hi, occlusion_rect_t * rect) {
+	__m128 const x = _mm_setr_ps(lo[0], hi[0], lo[0], hi[0]);
+	__m128 const y = _mm_setr_ps(lo[1], lo[1], hi[1], hi[1]);
+	__m128 clip[2][4];
+	for (int g = 0; g < 2; ++g) {
+		__m128 z = _mm_set1_ps(g == 0 ? lo[2] : hi[2]);
+		for (int r = 0; r < 4; ++r) {
+			__m128 v = _mm_mul_ps(_mm_set1_ps(mvp[0][r]), x);
+			v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(mvp[1][r]), y));
+			v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(mvp[2][r]), z));
+			clip[g][r] = _mm_add_ps(v, _mm_set1_ps(mvp[3][r]));
+		}
+	}
+
+	__m128 const min_w = _mm_set1_ps(OCCLUSION_MIN_W);
+	if (_mm_movemask_ps(_mm_or_ps(_mm_cmple_ps(clip[0][3], min_w), _mm_cmple_ps(clip[1][3], min_w))) != 0) {
+		return FALSE;
+	}
+
+	__m128 lo_v[3];
+	__m128 hi_v[3];
+	__m128 const half = _mm_set1_ps(0.5f);
+	for (int g = 0; g < 2; ++g) {
+		__m128 inv = _mm_div_ps(_mm_set1_ps(1), clip[g][3]);
+		__m128 v[3] = {
+			_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(clip[g][0], inv), half), half), _mm_set1_ps((float) occ->width)),
+			_mm_mul_ps(_mm_sub_ps(half, _mm_mul_ps(_mm_mul_ps(clip[g][1], inv), half)), _mm_set1_ps((float) occ->height)),
+			_mm_mul_ps(clip[g][2], inv),
+		};
+		for (int k = 0; k < 3; ++k) {
+			lo_v[k] = g == 0 ? v[k] : _mm_min_ps(lo_v[k], v[k]);
+			hi_v[k] = g == 0 ? v[k] : _mm_max_ps(hi_v[k], v[k]);
+		}
+	}
+
+	float bounds[6];
+	for (int k = 0; k < 3; ++k) {
+		__m128 l = _mm_min_ps(lo_v[k], _mm_shuffle_ps(lo_v[k], lo_v[k], _MM_SHUFFLE(1, 0, 3, 2)));
+		__m128 h = _mm_max_ps(hi_v[k], _mm_shuffle_ps(hi_v[k], hi_v[k], _MM_SHUFFLE(1, 0, 3, 2)));
+		bounds[k] = _mm_cvtss_f32(_mm_min_ss(l, _mm_shuffle_ps(l, l, _MM_SHUFFLE(2, 3, 0, 1))));
+		bounds[3 + k] = _mm_cvtss_f32(_mm_max_ss(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(2, 3, 0, 1))));
+	}
+
+	if (bounds[3] < 0 || bounds[4] < 0 || bounds[0] >= occ->width || bounds[1] >= occ->height) {
+		return FALSE;
+	}
+
+	*rect = (occlusion_rect_t) {
+		.x0 = bounds[0] <= 0 ? 0 : (UINT) bounds[0],
+		.y0 = bounds[1] <= 0 ? 0 : (UINT) bounds[1],
+		.x1 = bounds[3] >= occ->width - 1 ? occ->width : (UINT) bounds[3] + 1,
+		.y1 = bounds[4] >= occ->height - 1 ? occ->height : (UINT) bounds[4] + 1,
+		.zmin = bounds[2],
+	};
+	return TRUE;
+}
+
+/* TRUE when some pixel of the rectangle may show something nearer than every occluder */
+static BOOL occlusion_test_rect(occlusion_t const * occ, occlusion_rect_t const * rect) {
+	UINT tx0 = rect->x0 / OCCLUSION_TILE_WIDTH;
+	UINT ty0 = rect->y0 / OCCLUSION_TILE_HEIGHT;
+	UINT tx1 = (rect->x1 - 1) / OCCLUSION_TILE_WIDTH + 1;
+	UINT ty1 = (rect->y1 - 1) / OCCLUSION_TILE_HEIGHT + 1;
+	float zmin = rect->zmin;
+
+	for (UINT by = ty0 / OCCLUSION_COARSE; by <= (ty1 - 1) / OCCLUSION_COARSE; ++by) {
+		for (UINT bx = tx0 / OCCLUSION_COARSE; bx <= (tx1 - 1) / OCCLUSION_COARSE; ++bx) {
+			if (zmin >= occ->coarse[by * occ->coarse_x + bx]) {
+				continue;
+			}
+
+			UINT y0 = by * OCCLUSION_COARSE > ty0 ? by * OCCLUSION_COARSE : ty0;
+			UINT y1 = (by + 1) * OCCLUSION_COARSE < ty1 ? (by + 1) * OCCLUSION_COARSE : ty1;
+			UINT x0 = bx * OCCLUSION_COARSE > tx0 ? bx * OCCLUSION_COARSE : tx0;
+			UINT x1 = (bx + 1) * OCCLUSION_COARSE < tx1 ? (bx + 1) * OCCLUSION_COARSE : tx1;
+			for (UINT ty = y0; ty < y1; ++ty) {
+				int rows[4];
+				for (int r = 0; r < 4; ++r) {
+					UINT py = ty * OCCLUSION_TILE_HEIGHT + r;
+					rows[r] = py >= rect->y0 && py < rect->y1 ? -1 : 0;
+				}
+				__m128i row_mask = _mm_setr_epi32(rows[0], rows[1], rows[2], rows[3]);
+
+				for (UINT tx = x0; tx < x1; ++tx) {
+					UINT tile = ty * occ->tiles_x + tx;
+					if (zmin >= occ->z0[tile]) {
+						continue;
+					}
+
+					UINT px = tx * OCCLUSION_TILE_WIDTH;
+					UINT from = rect->x0 > px ? rect->x0 - px : 0;
+					UINT to = rect->x1 - px < OCCLUSION_TILE_WIDTH ? rect->x1 - px : OCCLUSION_TILE_WIDTH;
+					UINT columns = (from >= 32 ? 0 : ~0u << from) & ~(to >= 32 ? 0 : ~0u << to);
+					__m128i touched = _mm_and_si128(_mm_set1_epi32((int) columns), row_mask);
+
+					/* pixels only the reference bounds are nearer than it, the rest have z1 */
+					if (!occlusion_mask_empty(_mm_andnot_si128(_mm_load_si128(&occ->masks[tile]), touched)) || zmin < occ->z1[tile]) {
+						return TRUE;
+					}
+				}
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+/* TRUE when the box may be visible; not thread safe because of the stats, see occlusion_test_boxes */
+static BOOL occlusion_test_box(occlusion_t * occ, mat4x4 const mvp, float const * lo, float const * hi) {
+	LONGLONG start = timer_now();
+	occlusion_rect_t rect;
+	BOOL visible = !occlusion_box_rect(occ, mvp, lo, hi, &rect) || occlusion_test_rect(occ, &rect);
+
+	++occ->total.objects;
+	occ->total.culled += !visible;
+	occ->total.test_ms += timer_ms(timer_now() - start);
+	return visible;
+}
+
+typedef struct occlusion_test_job {
+	occlusion_t const * occ;
+	float const * mvp;
+	float const * boxes;
+	BYTE * visible;
+} occlusion_test_job_t;
+
+static void occlusion_test_range(void * user, UINT begin, UINT end) {
+	occlusion_test_job_t * job = user;
+	mat4x4 mvp;
+	memcpy(mvp, job->mvp, sizeof(mat4x4));
+
+	for (UINT i = begin; i < end; ++i) {
+		float const * box = &job->boxes[i * 6];
+		occlusion_rect_t rect;
+		job->visible[i] = !occlusion_box_rect(job->occ, mvp, box, box + 3, &rect) || occlusion_test_rect(job->occ, &rect);
+	}
+}
+
+/*
+ * tests count boxes of six floats each, min xyz then max xyz, on the job pool. writes
+ * 1 to visible for the boxes that may be seen and returns how many were culled.
+ */
+static UINT occlusion_test_boxes(occlusion_t * occ, mat4x4 const mvp, float const * boxes, UINT count, BYTE * visible) {
+	LONGLONG start = timer_now();
+	occlusion_test_job_t job = {
+		.occ = occ,
+		.mvp = &mvp[0][0],
+		.boxes = boxes,
+		.visible = visible,
+	};
+	jobs_parallel_for(count, 64, occlusion_test_range, &job);
+
+	UINT culled = 0;
+	for (UINT i = 0; i < count; ++i) {
+		culled += !visible[i];
+	}
+
+	occ->total.objects += count;
+	occ->total.culled += culled;
+	occ->total.test_ms += timer_ms(timer_now() - start);
+	return culled;
+}
+
+typedef struct occlusion_draw {
+	/* three indices per triangle, into the indices passed with the draws */
+	UINT first_index;
+	UINT index_count;
+	/* min xyz then max xyz */
+	float box[6];
+} occlusion_draw_t;
+
+/*
+ * draws that are their own occluders, nearest first: each box is tested against the
+ * draws before it, and only then do its triangles join the occluders. tested against
+ * its own triangles, a flat draw facing the camera would hide itself. writes 1 to
+ * visible for the draws that may be seen, returns 0 on success.
+ */
+static int occlusion_test_draws(occlusion_t * occ, mat4x4 const mvp, vshade_out_t const * clip, UINT const * indices, occlusion_draw_t const * draws, UINT count, BYTE * visible) {
+	for (UINT i = 0; i < count; ++i) {
+		occlusion_draw_t const * draw = &draws[i];
+		visible[i] = (BYTE) occlusion_test_box(occ, mvp, draw->box, draw->box + 3);
+		if (visible[i] && occlusion_rasterize(occ, clip, indices + draw->first_index, draw->index_count / 3) != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void occlusion_report(occlusion_t const * occ, FILE * fp) {
+	occlusion_stats_t const * s = &occ->total;
+	double objects = s->objects > 0 ? (double) s->objects : 1;
+	double frames = occ->frames > 0 ? (double) occ->frames : 1;
+	fprintf(fp, "occlusion: %ux%u %s, %llu objects, culled %llu (%.1f%%); %llu occluder triangles, %llu rasterized into %llu tiles; per frame %.3f ms rasterizing, %.3f ms testing (%.1f ns per object)\n", occ->width, occ->height, OCCLUSION_PATH, (unsigned long long) s->objects, (unsigned long long) s->culled, s->culled * 100.0 / objects, (unsigned long long) s->triangles, (unsigned long long) s->rasterized, (unsigned long long) s->tile_updates, s->raster_ms / frames, s->test_ms / frames, s->test_ms * 1e6 / objects);
+}
+
+#endif
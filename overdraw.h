@@ -0,0 +1,241 @@
+#ifndef OVERDRAW_H
+#define OVERDRAW_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "timer.h"
+#include "jobs.h"
+#include "vshade.h"
+
+/*
+ * counts how many times each pixel gets shaded, on the CPU so it works without a
+ * device. triangles from vshade output are rasterized in submission order with the
+ * D3D12 rules this repo's PSOs use: pixel centers, top-left fill, viewport depth
+ * 0..1 and an early LESS depth test when enabled. a pixel counts as shaded when it
+ * passes the depth test, i.e. what early-Z lets through to the pixel shader.
+ * triangles crossing w = 0 are skipped since there is no clipper; pre-cull or keep
+ * scenes in front of the camera when measuring.
+ */
+
+#define OVERDRAW_BUCKETS 9
+#define OVERDRAW_BAND 16
+
+typedef struct overdraw_stats {
+	UINT64 shaded;
+	UINT64 covered;
+	UINT64 pixels;
+	/* pixels shaded 0, 1, ... 7 times, the last bucket is 8 or more */
+	UINT64 histogram[OVERDRAW_BUCKETS];
+	double average;
+} overdraw_stats_t;
+
+typedef struct overdraw {
+	UINT width;
+	UINT height;
+	BOOL depth_test;
+	float * depth;
+	UINT * count;
+
+	/* accumulated by overdraw_get_stats, cleared by overdraw_init */
+	overdraw_stats_t total;
+	UINT64 frames;
+} overdraw_t;
+
+static void overdraw_destroy(overdraw_t * od) {
+	free(od->depth);
+	free(od->count);
+	*od = (overdraw_t) { 0 };
+}
+
+static void overdraw_clear(overdraw_t * od) {
+	for (UINT i = 0; i < od->width * od->height; ++i) {
+		od->depth[i] = 1.0f;
+	}
+	memset(od->count, 0, sizeof(UINT) * od->width * od->height);
+}
+
+static int overdraw_init(overdraw_t * od, UINT width, UINT height, BOOL depth_test) {
+	*od = (overdraw_t) {
+		.width = width,
+		.height = height,
+		.depth_test = depth_test,
+		.depth = malloc(sizeof(float) * width * height),
+		.count = malloc(sizeof(UINT) * width * height),
+	};
+
+	if (od->depth == NULL || od->count == NULL) {
+		overdraw_destroy(od);
+		return 1;
+	}
+
+	overdraw_clear(od);
+	return 0;
+}
+
+typedef struct overdraw_job {
+	overdraw_t * od;
+	vshade_out_t const * clip;
+	UINT const * indices;
+	UINT triangles;
+} overdraw_job_t;
+
+/* top edges run left to right, left edges run upwards, for clockwise triangles in y-down space */
+static BOOL overdraw_top_left(float ax, float ay, float bx, float by) {
+	return (ay == by && bx > ax) || by < ay;
+}
+
+static void overdraw_triangle(overdraw_t * od, vshade_out_t const * clip, UINT const * tri, UINT row_begin, UINT row_end) {
+	float sx[3];
+	float sy[3];
+	float sz[3];
+
+	for (int v = 0; v < 3; ++v) {
+		UINT i = tri[v];
+		float w = clip->w[i];
+		if (w <= 0) {
+			return;
+		}
+
+		sx[v] = (clip->x[i] / w * 0.5f + 0.5f) * od->width;
+		sy[v] = (0.5f - clip->y[i] / w * 0.5f) * od->height;
+		sz[v] = clip->z[i] / w;
+	}
+
+	float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+	if (area == 0) {
+		return;
+	}
+
+	/* facing was decided by the cull mode before this point, both windings rasterize */
+	if (area < 0) {
+		float t;
+		t = sx[1]; sx[1] = sx[2]; sx[2] = t;
+		t = sy[1]; sy[1] = sy[2]; sy[2] = t;
+		t = sz[1]; sz[1] = sz[2]; sz[2] = t;
+		area = -area;
+	}
+
+	float minx = min(sx[0], min(sx[1], sx[2]));
+	float maxx = max(sx[0], max(sx[1], sx[2]));
+	float miny = min(sy[0], min(sy[1], sy[2]));
+	float maxy = max(sy[0], max(sy[1], sy[2]));
+
+	int x0 = max((int) (minx - 0.5f), 0);
+	int x1 = min((int) (maxx + 0.5f) + 1, (int) od->width);
+	int y0 = max((int) (miny - 0.5f), (int) row_begin);
+	int y1 = min((int) (maxy + 0.5f) + 1, (int) row_end);
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	/* edge i is opposite vertex i, positive inside */
+	float ex[3];
+	float ey[3];
+	float ec[3];
+	BOOL inclusive[3];
+	for (int e = 0; e < 3; ++e) {
+		int a = (e + 1) % 3;
+		int b = (e + 2) % 3;
+		ex[e] = -(sy[b] - sy[a]);
+		ey[e] = sx[b] - sx[a];
+		ec[e] = -(ex[e] * sx[a] + ey[e] * sy[a]);
+		inclusive[e] = overdraw_top_left(sx[a], sy[a], sx[b], sy[b]);
+	}
+
+	float inv_area = 1.0f / area;
+	for (int y = y0; y < y1; ++y) {
+		float py = y + 0.5f;
+		float * depth = &od->depth[y * od->width];
+		UINT * count = &od->count[y * od->width];
+
+		for (int x = x0; x < x1; ++x) {
+			float px = x + 0.5f;
+			float w[3];
+			BOOL inside = TRUE;
+
+			for (int e = 0; e < 3; ++e) {
+				w[e] = ex[e] * px + ey[e] * py + ec[e];
+				if (w[e] < 0 || (w[e] == 0 && !inclusive[e])) {
+					inside = FALSE;
+					break;
+				}
+			}
+
+			if (!inside) {
+				continue;
+			}
+
+			float z = (w[0] * sz[0] + w[1] * sz[1] + w[2] * sz[2]) * inv_area;
+			if (z < 0 || z > 1) {
+				continue;
+			}
+
+			if (od->depth_test) {
+				if (!(z < depth[x])) {
+					continue;
+				}
+				depth[x] = z;
+			}
+
+			++count[x];
+		}
+	}
+}
+
+/* every band walks all triangles in order, so per-pixel order matches submission */
+static void overdraw_band_range(void * user, UINT begin, UINT end) {
+	overdraw_job_t * job = user;
+	UINT row_begin = begin * OVERDRAW_BAND;
+	UINT row_end = min(end * OVERDRAW_BAND, job->od->height);
+
+	for (UINT t = 0; t < job->triangles; ++t) {
+		overdraw_triangle(job->od, job->clip, &job->indices[t * 3], row_begin, row_end);
+	}
+}
+
+/* rasterizes one draw on top of what is already in the buffers */
+static void overdraw_draw(overdraw_t * od, vshade_out_t const * clip, UINT const * indices, UINT triangles) {
+	overdraw_job_t job = {
+		.od = od,
+		.clip = clip,
+		.indices = indices,
+		.triangles = triangles,
+	};
+
+	UINT bands = (od->height + OVERDRAW_BAND - 1) / OVERDRAW_BAND;
+	jobs_parallel_for(bands, 1, overdraw_band_range, &job);
+}
+
+/* stats for the buffers as they are, also folded into od->total */
+static void overdraw_get_stats(overdraw_t * od, overdraw_stats_t * stats) {
+	*stats = (overdraw_stats_t) { .pixels = (UINT64) od->width * od->height };
+
+	for (UINT i = 0; i < od->width * od->height; ++i) {
+		UINT count = od->count[i];
+		stats->shaded += count;
+		stats->covered += count != 0;
+		++stats->histogram[min(count, OVERDRAW_BUCKETS - 1)];
+	}
+	stats->average = stats->covered != 0 ? (double) stats->shaded / stats->covered : 0;
+
+	od->total.shaded += stats->shaded;
+	od->total.covered += stats->covered;
+	od->total.pixels += stats->pixels;
+	for (UINT i = 0; i < OVERDRAW_BUCKETS; ++i) {
+		od->total.histogram[i] += stats->histogram[i];
+	}
+	od->total.average = od->total.covered != 0 ? (double) od->total.shaded / od->total.covered : 0;
+	++od->frames;
+}
+
+static void overdraw_report(overdraw_stats_t const * stats, const char * label, FILE * fp) {
+	fprintf(fp, "overdraw: %s %.3f shades per covered pixel, %llu of %llu pixels covered, histogram", label, stats->average, (unsigned long long) stats->covered, (unsigned long long) stats->pixels);
+	for (UINT i = 0; i < OVERDRAW_BUCKETS; ++i) {
+		fprintf(fp, " %s%u:%llu", i == OVERDRAW_BUCKETS - 1 ? ">=" : "", i, (unsigned long long) stats->histogram[i]);
+	}
+	fprintf(fp, "\n");
+}
+
+#endif
@@ -0,0 +1,489 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <immintrin.h>
+#include "timer.h"
+#include "jobs.h"
+
+/*
+ * CPU particle simulation, the fallback and reference for the cs_particles_* shaders
+ * in main.hlsl. particles live in SoA streams; a step ages and integrates every
+ * particle, drops the expired ones, then emits new ones at the end.
+ *
+ * particles_update runs on the worker pool: chunks count their survivors, a prefix sum
+ * places them, then each chunk integrates and compacts into the other set of streams.
+ * survivors keep their order, so it matches particles_update_reference bit for bit.
+ * emission is a hash of the particle's emission index and the frame seed, the same
+ * on both paths and on the GPU.
+ */
+
+#define PARTICLES_CHUNK 16384
+
+#if defined(__AVX2__)
+#define PARTICLES_PATH "avx2"
+#else
+#define PARTICLES_PATH "sse2"
+#endif
+
+enum {
+	PARTICLE_PX,
+	PARTICLE_PY,
+	PARTICLE_PZ,
+	PARTICLE_VX,
+	PARTICLE_VY,
+	PARTICLE_VZ,
+	PARTICLE_AGE,
+	PARTICLE_LIFE,
+	PARTICLE_STREAMS,
+};
+
+/* laid out like the particle_params root constants in main.hlsl */
+typedef struct particles_params {
+	float origin[3];
+	float dt;
+	float gravity;
+	/* velocity scale per step */
+	float damping;
+	/* horizontal speed range of new particles */
+	float spread;
+	/* upward speed of new particles, half to full */
+	float speed;
+	float life_min;
+	float life_max;
+	UINT emit;
+	UINT seed;
+} particles_params_t;
+
+/* one particle as the GPU stores it, matches particle_t in main.hlsl */
+typedef struct particle_gpu {
+	float position[3];
+	float age;
+	float velocity[3];
+	float life;
+} particle_gpu_t;
+
+typedef struct particles_stats {
+	UINT alive;
+	UINT expired;
+	UINT emitted;
+	double ms;
+} particles_stats_t;
+
+typedef struct particles {
+	UINT capacity;
+	UINT count;
+	/* current streams and the ones the next step writes */
+	float * streams[PARTICLE_STREAMS];
+	float * next[PARTICLE_STREAMS];
+
+	UINT * kept;
+	UINT chunk_capacity;
+
+	particles_stats_t stats;
+} particles_t;
+
+#if defined(__AVX2__)
+/* lane indices of the set bits of every 8-bit mask, packed to the front */
+static int particles_compress[256][8];
+#endif
+
+static void particles_destroy(particles_t * p) {
+	for (UINT s = 0; s < PARTICLE_STREAMS; ++s) {
+		_aligned_free(p->streams[s]);
+		_aligned_free(p->next[s]);
+	}
+	free(p->kept);
+	*p = (particles_t) { 0 };
+}
+
+static int particles_init(particles_t * p, UINT capacity) {
+	*p = (particles_t) {
+		.capacity = capacity,
+	};
+
+	/* the vector path stores whole registers, give it a register of slack */
+	SIZE_T bytes = sizeof(float) * ((SIZE_T) capacity + 8);
+	for (UINT s = 0; s < PARTICLE_STREAMS; ++s) {
+		p->streams[s] = _aligned_malloc(bytes, 64);
+		p->next[s] = _aligned_malloc(bytes, 64);
+		if (p->streams[s] == NULL || p->next[s] == NULL) {
+			particles_destroy(p);
+			return 1;
+		}
+	}
+
+	p->chunk_capacity = (capacity + PARTICLES_CHUNK - 1) / PARTICLES_CHUNK;
+	p->kept = malloc(sizeof(UINT) * (p->chunk_capacity + 1));
+	if (p->kept == NULL) {
+		particles_destroy(p);
+		return 1;
+	}
+
+#if defined(__AVX2__)
+	for (UINT mask = 0; mask < 256; ++mask) {
+		UINT n = 0;
+		for (UINT lane = 0; lane < 8; ++lane) {
+			if (mask & (1u << lane)) {
+				particles_compress[mask][n++] = lane;
+			}
+		}
+		while (n < 8) {
+			particles_compress[mask][n++] = 0;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+/* lowbias32, also in main.hlsl */
+static UINT particles_hash(UINT x) {
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static float particles_unorm(UINT h) {
+	return (float) (h >> 8) * (1.0f / 16777216.0f);
+}
+
+/* the index-th particle emitted with params, written into slot of the streams */
+static void particles_emit_one(particles_params_t const * params, UINT index, float * const * streams, UINT slot) {
+	UINT h = particles_hash(params->seed ^ particles_hash(index));
+	float r0 = particles_unorm(h);
+	h = particles_hash(h);
+	float r1 = particles_unorm(h);
+	h = particles_hash(h);
+	float r2 = particles_unorm(h);
+	h = particles_hash(h);
+	float r3 = particles_unorm(h);
+
+	streams[PARTICLE_PX][slot] = params->origin[0];
+	streams[PARTICLE_PY][slot] = params->origin[1];
+	streams[PARTICLE_PZ][slot] = params->origin[2];
+	streams[PARTICLE_VX][slot] = (r0 * 2.0f - 1.0f) * params->spread;
+	streams[PARTICLE_VY][slot] = params->speed * (0.5f + 0.5f * r1);
+	streams[PARTICLE_VZ][slot] = (r2 * 2.0f - 1.0f) * params->spread;
+	streams[PARTICLE_AGE][slot] = 0;
+	streams[PARTICLE_LIFE][slot] = params->life_min + (params->life_max - params->life_min) * r3;
+}
+
+static UINT particles_emit_count(particles_t const * p, particles_params_t const * params, UINT alive) {
+	return params->emit < p->capacity - alive ? params->emit : p->capacity - alive;
+}
+
+static void particles_swap(particles_t * p) {
+	for (UINT s = 0; s < PARTICLE_STREAMS; ++s) {
+		float * t = p->streams[s];
+		p->streams[s] = p->next[s];
+		p->next[s] = t;
+	}
+}
+
+/* single-threaded scalar step, operation for operation what cs_particles_update does */
+static void particles_update_reference(particles_t * p, particles_params_t const * params) {
+	LONGLONG start = timer_now();
+	float * const * in = p->streams;
+	float * const * out = p->next;
+	float dt = params->dt;
+	float gdt = params->gravity * params->dt;
+	float damping = params->damping;
+	UINT alive = 0;
+
+	for (UINT i = 0; i < p->count; ++i) {
+		float age = in[PARTICLE_AGE][i] + dt;
+		if (!(age < in[PARTICLE_LIFE][i])) {
+			continue;
+		}
+
+		float vx = in[PARTICLE_VX][i] * damping;
+		float vy = (in[PARTICLE_VY][i] + gdt) * damping;
+		float vz = in[PARTICLE_VZ][i] * damping;
+
+		out[PARTICLE_PX][alive] = in[PARTICLE_PX][i] + vx * dt;
+		out[PARTICLE_PY][alive] = in[PARTICLE_PY][i] + vy * dt;
+		out[PARTICLE_PZ][alive] = in[PARTICLE_PZ][i] + vz * dt;
+		out[PARTICLE_VX][alive] = vx;
+		out[PARTICLE_VY][alive] = vy;
+		out[PARTICLE_VZ][alive] = vz;
+		out[PARTICLE_AGE][alive] = age;
+		out[PARTICLE_LIFE][alive] = in[PARTICLE_LIFE][i];
+		++alive;
+	}
+
+	UINT emitted = particles_emit_count(p, params, alive);
+	for (UINT i = 0; i < emitted; ++i) {
+		particles_emit_one(params, i, out, alive + i);
+	}
+
+	p->stats = (particles_stats_t) {
+		.alive = alive + emitted,
+		.expired = p->count - alive,
+		.emitted = emitted,
+	};
+	p->count = alive + emitted;
+	particles_swap(p);
+	p->stats.ms = timer_ms(timer_now() - start);
+}
+
+typedef struct particles_job {
+	particles_t * p;
+	particles_params_t const * params;
+	UINT alive;
+} particles_job_t;
+
+static UINT particles_chunk_end(particles_t const * p, UINT chunk) {
+	UINT end = (chunk + 1) * PARTICLES_CHUNK;
+	return end < p->count ? end : p->count;
+}
+
+static void particles_count_range(void * user, UINT begin, UINT end) {
+	particles_job_t * job = user;
+	particles_t * p = job->p;
+	float const * age = p->streams[PARTICLE_AGE];
+	float const * life = p->streams[PARTICLE_LIFE];
+
+	for (UINT c = begin; c < end; ++c) {
+		UINT i = c * PARTICLES_CHUNK;
+		UINT last = particles_chunk_end(p, c);
+		UINT kept = 0;
+
+#if defined(__AVX2__)
+		__m256 dt = _mm256_set1_ps(job->params->dt);
+		for (; i + 8 <= last; i += 8) {
+			__m256 a = _mm256_add_ps(_mm256_loadu_ps(&age[i]), dt);
+			kept += __popcnt(_mm256_movemask_ps(_mm256_cmp_ps(a, _mm256_loadu_ps(&life[i]), _CMP_LT_OQ)));
+		}
+#else
+		__m128 dt = _mm_set1_ps(job->params->dt);
+		for (; i + 4 <= last; i += 4) {
+			__m128 a = _mm_add_ps(_mm_loadu_ps(&age[i]), dt);
+			kept += __popcnt(_mm_movemask_ps(_mm_cmplt_ps(a, _mm_loadu_ps(&life[i]))));
+		}
+#endif
+		for (; i < last; ++i) {
+			kept += age[i] + job->params->dt < life[i];
+		}
+
+		p->kept[c] = kept;
+	}
+}
+
+static void particles_step_range(void * user, UINT begin, UINT end) {
+	particles_job_t * job = user;
+	particles_t * p = job->p;
+	particles_params_t const * params = job->params;
+	float * const * in = p->streams;
+	float * const * out = p->next;
+	float dt = params->dt;
+	float gdt = params->gravity * params->dt;
+	float damping = params->damping;
+
+	for (UINT c = begin; c < end; ++c) {
+		UINT i = c * PARTICLES_CHUNK;
+		UINT last = particles_chunk_end(p, c);
+		/* kept holds exclusive offsets by now */
+		UINT o = p->kept[c];
+
+#if defined(__AVX2__)
+		UINT o_end = p->kept[c + 1];
+		__m256 vdt = _mm256_set1_ps(dt);
+		__m256 vgdt = _mm256_set1_ps(gdt);
+		__m256 vdamping = _mm256_set1_ps(damping);
+
+		for (; i + 8 <= last; i += 8) {
+			__m256 life = _mm256_loadu_ps(&in[PARTICLE_LIFE][i]);
+			__m256 age = _mm256_add_ps(_mm256_loadu_ps(&in[PARTICLE_AGE][i]), vdt);
+			int mask = _mm256_movemask_ps(_mm256_cmp_ps(age, life, _CMP_LT_OQ));
+			if (mask == 0) {
+				continue;
+			}
+
+			__m256 v[PARTICLE_STREAMS];
+			v[PARTICLE_VX] = _mm256_mul_ps(_mm256_loadu_ps(&in[PARTICLE_VX][i]), vdamping);
+			v[PARTICLE_VY] = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(&in[PARTICLE_VY][i]), vgdt), vdamping);
+			v[PARTICLE_VZ] = _mm256_mul_ps(_mm256_loadu_ps(&in[PARTICLE_VZ][i]), vdamping);
+			v[PARTICLE_PX] = _mm256_add_ps(_mm256_loadu_ps(&in[PARTICLE_PX][i]), _mm256_mul_ps(v[PARTICLE_VX], vdt));
+			v[PARTICLE_PY] = _mm256_add_ps(_mm256_loadu_ps(&in[PARTICLE_PY][i]), _mm256_mul_ps(v[PARTICLE_VY], vdt));
+			v[PARTICLE_PZ] = _mm256_add_ps(_mm256_loadu_ps(&in[PARTICLE_PZ][i]), _mm256_mul_ps(v[PARTICLE_VZ], vdt));
+			v[PARTICLE_AGE] = age;
+			v[PARTICLE_LIFE] = life;
+
+			UINT n = __popcnt(mask);
+			__m256i perm = _mm256_loadu_si256((__m256i const *) particles_compress[mask]);
+			if (o + 8 <= o_end) {
+				for (UINT s = 0; s < PARTICLE_STREAMS; ++s) {
+					_mm256_storeu_ps(&out[s][o], _mm256_permutevar8x32_ps(v[s], perm));
+				}
+			} else {
+				/* the next chunk's survivors start at o_end, and another thread is writing them */
+				__m256i keep = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+				for (UINT s = 0; s < PARTICLE_STREAMS; ++s) {
+					_mm256_maskstore_ps(&out[s][o], keep, _mm256_permutevar8x32_ps(v[s], perm));
+				}
+			}
+			o += n;
+		}
+#else
+		__m128 vdt = _mm_set1_ps(dt);
+		__m128 vgdt = _mm_set1_ps(gdt);
+		__m128 vdamping = _mm_set1_ps(damping);
+
+		for (; i + 4 <= last; i += 4) {
+			__m128 life = _mm_loadu_ps(&in[PARTICLE_LIFE][i]);
+			__m128 age = _mm_add_ps(_mm_loadu_ps(&in[PARTICLE_AGE][i]), vdt);
+			int mask = _mm_movemask_ps(_mm_cmplt_ps(age, life));
+			if (mask == 0) {
+				continue;
+			}
+
+			__m128 v[PARTICLE_STREAMS];
+			v[PARTICLE_VX] = _mm_mul_ps(_mm_loadu_ps(&in[PARTICLE_VX][i]), vdamping);
+			v[PARTICLE_VY] = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&in[PARTICLE_VY][i]), vgdt), vdamping);
+			v[PARTICLE_VZ] = _mm_mul_ps(_mm_loadu_ps(&in[PARTICLE_VZ][i]), vdamping);
+			v[PARTICLE_PX] = _mm_add_ps(_mm_loadu_ps(&in[PARTICLE_PX][i]), _mm_mul_ps(v[PARTICLE_VX], vdt));
+			v[PARTICLE_PY] = _mm_add_ps(_mm_loadu_ps(&in[PARTICLE_PY][i]), _mm_mul_ps(v[PARTICLE_VY], vdt));
+			v[PARTICLE_PZ] = _mm_add_ps(_mm_loadu_ps(&in[PARTICLE_PZ][i]), _mm_mul_ps(v[PARTICLE_VZ], vdt));
+			v[PARTICLE_AGE] = age;
+			v[PARTICLE_LIFE] = life;
+
+			/* most groups survive whole, and four in a row never cross into the next chunk */
+			if (mask == 0xF) {
+				for (UINT s = 0; s < PARTICLE_STREAMS; ++s) {
+					_mm_storeu_ps(&out[s][o], v[s]);
+				}
+				o += 4;
+				continue;
+			}
+
+			float lanes[PARTICLE_STREAMS][4];
+			for (UINT s = 0; s < PARTICLE_STREAMS; ++s) {
+				_mm_storeu_ps(lanes[s], v[s]);
+			}
+
+			for (UINT lane = 0; lane < 4; ++lane) {
+				if (mask & (1 << lane)) {
+					for (UINT s = 0; s < PARTICLE_STREAMS; ++s) {
+						out[s][o] = lanes[s][lane];
+					}
+					++o;
+				}
+			}
+		}
+#endif
+
+		for (; i < last; ++i) {
+			float age = in[PARTICLE_AGE][i] + dt;
+			if (!(age < in[PARTICLE_LIFE][i])) {
+				continue;
+			}
+
+			float vx = in[PARTICLE_VX][i] * damping;
+			float vy = (in[PARTICLE_VY][i] + gdt) * damping;
+			float vz = in[PARTICLE_VZ][i] * damping;
+
+			out[PARTICLE_PX][o] = in[PARTICLE_PX][i] + vx * dt;
+			out[PARTICLE_PY][o] = in[PARTICLE_PY][i] + vy * dt;
+			out[PARTICLE_PZ][o] = in[PARTICLE_PZ][i] + vz * dt;
+			out[PARTICLE_VX][o] = vx;
+			out[PARTICLE_VY][o] = vy;
+			out[PARTICLE_VZ][o] = vz;
+			out[PARTICLE_AGE][o] = age;
+			out[PARTICLE_LIFE][o] = in[PARTICLE_LIFE][i];
+			++o;
+		}
+	}
+}
+
+static void particles_emit_range(void * user, UINT begin, UINT end) {
+	particles_job_t * job = user;
+	for (UINT i = begin; i < end; ++i) {
+		particles_emit_one(job->params, i, job->p->next, job->alive + i);
+	}
+}
+
+/* one step of the simulation on the worker pool, same result as particles_update_reference */
+static void particles_update(particles_t * p, particles_params_t const * params) {
+	LONGLONG start = timer_now();
+	UINT chunks = (p->count + PARTICLES_CHUNK - 1) / PARTICLES_CHUNK;
+	particles_job_t job = {
+		.p = p,
+		.params = params,
+	};
+
+	jobs_parallel_for(chunks, 1, particles_count_range, &job);
+
+	UINT alive = 0;
+	for (UINT c = 0; c < chunks; ++c) {
+		UINT kept = p->kept[c];
+		p->kept[c] = alive;
+		alive += kept;
+	}
+	p->kept[chunks] = alive;
+
+	jobs_parallel_for(chunks, 1, particles_step_range, &job);
+
+	job.alive = alive;
+	UINT emitted = particles_emit_count(p, params, alive);
+	jobs_parallel_for(emitted, 4096, particles_emit_range, &job);
+
+	p->stats = (particles_stats_t) {
+		.alive = alive + emitted,
+		.expired = p->count - alive,
+		.emitted = emitted,
+	};
+	p->count = alive + emitted;
+	particles_swap(p);
+	p->stats.ms = timer_ms(timer_now() - start);
+}
+
+typedef struct particles_pack_job {
+	particles_t const * p;
+	particle_gpu_t * out;
+	BOOL stream;
+} particles_pack_job_t;
+
+static void particles_pack_range(void * user, UINT begin, UINT end) {
+	particles_pack_job_t const * job = user;
+	float * const * s = job->p->streams;
+
+	for (UINT i = begin; i < end; ++i) {
+		__m128 a = _mm_setr_ps(s[PARTICLE_PX][i], s[PARTICLE_PY][i], s[PARTICLE_PZ][i], s[PARTICLE_AGE][i]);
+		__m128 b = _mm_setr_ps(s[PARTICLE_VX][i], s[PARTICLE_VY][i], s[PARTICLE_VZ][i], s[PARTICLE_LIFE][i]);
+		if (job->stream) {
+			_mm_stream_ps(job->out[i].position, a);
+			_mm_stream_ps(job->out[i].velocity, b);
+		} else {
+			_mm_storeu_ps(job->out[i].position, a);
+			_mm_storeu_ps(job->out[i].velocity, b);
+		}
+	}
+
+	if (job->stream) {
+		_mm_sfence();
+	}
+}
+
+/* interleaves the streams into the layout cs_particles_update writes, for an upload buffer */
+static void particles_pack(particles_t const * p, particle_gpu_t * out, BOOL upload) {
+	particles_pack_job_t job = {
+		.p = p,
+		.out = out,
+		.stream = upload && ((UINT_PTR) out & 15) == 0,
+	};
+
+	jobs_parallel_for(p->count, 8192, particles_pack_range, &job);
+}
+
+static void particles_report(particles_stats_t const * stats, const char * label, FILE * fp) {
+	fprintf(fp, "particles %s: %u alive, %u expired, %u emitted, %.3f ms (%.3f ms per million)\n", label, stats->alive, stats->expired, stats->emitted, stats->ms, stats->alive != 0 ? stats->ms * 1e6 / stats->alive : 0.0);
+}
+
+#endif
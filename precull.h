@@ -0,0 +1,363 @@
+#ifndef PRECULL_H
+#define PRECULL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <immintrin.h>
+#include "timer.h"
+#include "jobs.h"
+#include "vshade.h"
+
+/*
+ * triangle rejection ahead of submission, on clip-space output from vshade.
+ *
+ * a triangle is off-screen when all three vertices share an outcode bit or all sit at
+ * or behind w = 0. repeated indices or a zero determinant mark a zero-area triangle. facing uses the homogeneous determinant |x y w| of the three
+ * vertices, which has the sign of the screen-space area when every w > 0; triangles
+ * with mixed w signs are kept since only the rasterizer can clip them properly.
+ * surviving indices are compacted in their original order.
+ */
+
+#define PRECULL_CHUNK 16384
+
+#if defined(__AVX2__)
+#define PRECULL_PATH "avx2"
+#else
+#define PRECULL_PATH "scalar"
+#endif
+
+typedef enum precull_cull {
+	PRECULL_CULL_NONE,
+	PRECULL_CULL_FRONT,
+	PRECULL_CULL_BACK,
+} precull_cull_t;
+
+typedef struct precull_stats {
+	UINT64 triangles;
+	UINT64 kept;
+	UINT64 backface;
+	UINT64 zero_area;
+	UINT64 offscreen;
+	double ms;
+} precull_stats_t;
+
+typedef struct precull {
+	/* mirror D3D12_RASTERIZER_DESC: CullMode and FrontCounterClockwise */
+	precull_cull_t cull;
+	BOOL front_ccw;
+
+	UINT * scratch;
+	UINT scratch_capacity;
+	precull_stats_t * chunks;
+	UINT chunk_capacity;
+
+	/* accumulated over every precull_run */
+	precull_stats_t total;
+	UINT64 runs;
+} precull_t;
+
+static void precull_init(precull_t * cull, precull_cull_t mode, BOOL front_ccw) {
+	*cull = (precull_t) {
+		.cull = mode,
+		.front_ccw = front_ccw,
+	};
+}
+
+static void precull_destroy(precull_t * cull) {
+	free(cull->scratch);
+	free(cull->chunks);
+	cull->scratch = NULL;
+	cull->chunks = NULL;
+	cull->scratch_capacity = 0;
+	cull->chunk_capacity = 0;
+}
+
+/*
+ * the determinant is positive for counter-clockwise triangles in y-up clip space,
+ * which are clockwise once the rasterizer flips y into render-target space.
+ * returns the sign a triangle must have to be culled, 0 when nothing is culled.
+ */
+static int precull_cull_sign(precull_t const * cull) {
+	if (cull->cull == PRECULL_CULL_NONE) {
+		return 0;
+	}
+
+	int front = cull->front_ccw ? -1 : 1;
+	return cull->cull == PRECULL_CULL_BACK ? -front : front;
+}
+
+typedef struct precull_job {
+	precull_t * cull;
+	vshade_out_t const * clip;
+	UINT const * indices;
+	UINT triangles;
+	int cull_sign;
+} precull_job_t;
+
+/* 0 kept, 1 off-screen, 2 zero area, 3 culled by facing */
+static int precull_classify(vshade_out_t const * clip, UINT a, UINT b, UINT c, int cull_sign) {
+	if ((clip->outcode[a] & clip->outcode[b] & clip->outcode[c]) != 0) {
+		return 1;
+	}
+
+	float wa = clip->w[a];
+	float wb = clip->w[b];
+	float wc = clip->w[c];
+	if (wa <= 0 && wb <= 0 && wc <= 0) {
+		return 1;
+	}
+
+	if (wa <= 0 || wb <= 0 || wc <= 0) {
+		return 0;
+	}
+
+	if (a == b || b == c || c == a) {
+		return 2;
+	}
+
+	float det = clip->x[a] * (clip->y[b] * wc - clip->y[c] * wb) - clip->y[a] * (clip->x[b] * wc - clip->x[c] * wb) + wa * (clip->x[b] * clip->y[c] - clip->x[c] * clip->y[b]);
+	if (det == 0) {
+		return 2;
+	}
+
+	if ((cull_sign > 0 && det > 0) || (cull_sign < 0 && det < 0)) {
+		return 3;
+	}
+
+	return 0;
+}
+
+static UINT precull_scalar(precull_job_t const * job, UINT begin, UINT end, UINT * out, precull_stats_t * stats) {
+	UINT kept = 0;
+
+	for (UINT t = begin; t < end; ++t) {
+		UINT const * tri = &job->indices[t * 3];
+		switch (precull_classify(job->clip, tri[0], tri[1], tri[2], job->cull_sign)) {
+			case 0: {
+				out[kept * 3 + 0] = tri[0];
+				out[kept * 3 + 1] = tri[1];
+				out[kept * 3 + 2] = tri[2];
+				++kept;
+				break;
+			}
+			case 1: {
+				++stats->offscreen;
+				break;
+			}
+			case 2: {
+				++stats->zero_area;
+				break;
+			}
+			case 3: {
+				++stats->backface;
+				break;
+			}
+		}
+	}
+
+	return kept;
+}
+
+#if defined(__AVX2__)
+/* the eight triangles at tris, of which the lanes in mask count; vertex data fetched with gathers */
+static UINT precull_simd8(vshade_out_t const * clip, UINT const * tris, int mask, int cull_sign_int, UINT * out, precull_stats_t * stats) {
+	__m256i const stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	__m256i const byte = _mm256_set1_epi32(0xFF);
+	__m256 const zero = _mm256_setzero_ps();
+	__m256 const cull_sign = _mm256_set1_ps((float) cull_sign_int);
+	UINT kept = 0;
+
+	int const * base = (int const *) tris;
+	__m256i idx[3] = {
+		_mm256_i32gather_epi32(base + 0, stride, 4),
+		_mm256_i32gather_epi32(base + 1, stride, 4),
+		_mm256_i32gather_epi32(base + 2, stride, 4),
+	};
+
+	__m256 x[3];
+	__m256 y[3];
+	__m256 w[3];
+	__m256i code = byte;
+	for (int v = 0; v < 3; ++v) {
+		x[v] = _mm256_i32gather_ps(clip->x, idx[v], 4);
+		y[v] = _mm256_i32gather_ps(clip->y, idx[v], 4);
+		w[v] = _mm256_i32gather_ps(clip->w, idx[v], 4);
+		/* reads up to three bytes past the last outcode, vshade_out_alloc pads for it */
+		code = _mm256_and_si256(code, _mm256_i32gather_epi32((int const *) clip->outcode, idx[v], 1));
+	}
+
+	__m256 w_pos = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(w[0], zero, _CMP_GT_OQ), _mm256_cmp_ps(w[1], zero, _CMP_GT_OQ)), _mm256_cmp_ps(w[2], zero, _CMP_GT_OQ));
+	__m256 w_nonpos = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(w[0], zero, _CMP_LE_OQ), _mm256_cmp_ps(w[1], zero, _CMP_LE_OQ)), _mm256_cmp_ps(w[2], zero, _CMP_LE_OQ));
+
+	__m256 det = _mm256_mul_ps(x[0], _mm256_sub_ps(_mm256_mul_ps(y[1], w[2]), _mm256_mul_ps(y[2], w[1])));
+	det = _mm256_sub_ps(det, _mm256_mul_ps(y[0], _mm256_sub_ps(_mm256_mul_ps(x[1], w[2]), _mm256_mul_ps(x[2], w[1]))));
+	det = _mm256_add_ps(det, _mm256_mul_ps(w[0], _mm256_sub_ps(_mm256_mul_ps(x[1], y[2]), _mm256_mul_ps(x[2], y[1]))));
+
+	int offscreen = (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_xor_si256(_mm256_cmpeq_epi32(code, _mm256_setzero_si256()), _mm256_set1_epi32(-1)))) | _mm256_movemask_ps(w_nonpos)) & mask;
+	int pos = _mm256_movemask_ps(w_pos) & ~offscreen & mask;
+	__m256i repeated = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi32(idx[0], idx[1]), _mm256_cmpeq_epi32(idx[1], idx[2])), _mm256_cmpeq_epi32(idx[2], idx[0]));
+	int zero_area = (_mm256_movemask_ps(_mm256_cmp_ps(det, zero, _CMP_EQ_OQ)) | _mm256_movemask_ps(_mm256_castsi256_ps(repeated))) & pos;
+	int culled = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_mul_ps(det, cull_sign), zero, _CMP_GT_OQ)) & pos & ~zero_area;
+
+	stats->offscreen += __popcnt(offscreen);
+	stats->zero_area += __popcnt(zero_area);
+	stats->backface += __popcnt(culled);
+
+	int keep = ~(offscreen | zero_area | culled) & mask;
+	while (keep != 0) {
+		unsigned long lane;
+		_BitScanForward(&lane, keep);
+		keep &= keep - 1;
+
+		UINT const * tri = &tris[lane * 3];
+		out[kept * 3 + 0] = tri[0];
+		out[kept * 3 + 1] = tri[1];
+		out[kept * 3 + 2] = tri[2];
+		++kept;
+	}
+
+	return kept;
+}
+
+/*
+ * the tail goes through the same arithmetic padded with copies of its last triangle:
+ * with FMA contraction the scalar determinant can round to the other sign, and a
+ * triangle's verdict would then depend on where it sits in the list
+ */
+static UINT precull_simd(precull_job_t const * job, UINT begin, UINT end, UINT * out, precull_stats_t * stats) {
+	UINT kept = 0;
+
+	UINT t = begin;
+	for (; t + 8 <= end; t += 8) {
+		kept += precull_simd8(job->clip, &job->indices[t * 3], 0xFF, job->cull_sign, out + kept * 3, stats);
+	}
+
+	if (t < end) {
+		UINT tail[24];
+		for (UINT i = 0; i < 8; ++i) {
+			UINT const * tri = &job->indices[(t + i < end ? t + i : end - 1) * 3];
+			tail[i * 3 + 0] = tri[0];
+			tail[i * 3 + 1] = tri[1];
+			tail[i * 3 + 2] = tri[2];
+		}
+		kept += precull_simd8(job->clip, tail, (1 << (end - t)) - 1, job->cull_sign, out + kept * 3, stats);
+	}
+
+	return kept;
+}
+#else
+static UINT precull_simd(precull_job_t const * job, UINT begin, UINT end, UINT * out, precull_stats_t * stats) {
+	return precull_scalar(job, begin, end, out, stats);
+}
+#endif
+
+/* each chunk compacts into scratch at its own triangle offset */
+static void precull_chunk_range(void * user, UINT begin, UINT end) {
+	precull_job_t * job = user;
+
+	for (UINT chunk = begin; chunk < end; ++chunk) {
+		UINT first = chunk * PRECULL_CHUNK;
+		UINT last = first + PRECULL_CHUNK < job->triangles ? first + PRECULL_CHUNK : job->triangles;
+		precull_stats_t * stats = &job->cull->chunks[chunk];
+
+		*stats = (precull_stats_t) { .triangles = last - first };
+		stats->kept = precull_simd(job, first, last, &job->cull->scratch[first * 3], stats);
+	}
+}
+
+typedef struct precull_copy {
+	precull_t * cull;
+	UINT * out;
+} precull_copy_t;
+
+/* chunks[i].triangles holds the output offset once the prefix sum ran */
+static void precull_copy_range(void * user, UINT begin, UINT end) {
+	precull_copy_t * copy = user;
+
+	for (UINT chunk = begin; chunk < end; ++chunk) {
+		precull_stats_t const * stats = &copy->cull->chunks[chunk];
+		memcpy(&copy->out[stats->triangles * 3], &copy->cull->scratch[(UINT64) chunk * PRECULL_CHUNK * 3], sizeof(UINT) * 3 * stats->kept);
+	}
+}
+
+/*
+ * writes the surviving triangles of indices (3 per triangle) to out, which needs room
+ * for all of them, and returns how many survived. stats may be NULL.
+ */
+static UINT precull_run(precull_t * cull, vshade_out_t const * clip, UINT const * indices, UINT triangles, UINT * out, precull_stats_t * stats) {
+	LONGLONG start = timer_now();
+	UINT chunk_count = (triangles + PRECULL_CHUNK - 1) / PRECULL_CHUNK;
+	precull_stats_t sum = { .triangles = triangles };
+
+	precull_job_t job = {
+		.cull = cull,
+		.clip = clip,
+		.indices = indices,
+		.triangles = triangles,
+		.cull_sign = precull_cull_sign(cull),
+	};
+
+	if (chunk_count <= 1) {
+		sum.kept = precull_simd(&job, 0, triangles, out, &sum);
+	} else {
+		if (cull->scratch_capacity < triangles * 3) {
+			UINT * scratch = realloc(cull->scratch, sizeof(UINT) * 3 * triangles);
+			if (scratch == NULL) {
+				return 0;
+			}
+			cull->scratch = scratch;
+			cull->scratch_capacity = triangles * 3;
+		}
+
+		if (cull->chunk_capacity < chunk_count) {
+			precull_stats_t * chunks = realloc(cull->chunks, sizeof(precull_stats_t) * chunk_count);
+			if (chunks == NULL) {
+				return 0;
+			}
+			cull->chunks = chunks;
+			cull->chunk_capacity = chunk_count;
+		}
+
+		jobs_parallel_for(chunk_count, 1, precull_chunk_range, &job);
+
+		for (UINT i = 0; i < chunk_count; ++i) {
+			precull_stats_t * chunk = &cull->chunks[i];
+			sum.backface += chunk->backface;
+			sum.zero_area += chunk->zero_area;
+			sum.offscreen += chunk->offscreen;
+			chunk->triangles = sum.kept;
+			sum.kept += chunk->kept;
+		}
+
+		precull_copy_t copy = {
+			.cull = cull,
+			.out = out,
+		};
+		jobs_parallel_for(chunk_count, 1, precull_copy_range, &copy);
+	}
+
+	sum.ms = timer_ms(timer_now() - start);
+
+	cull->total.triangles += sum.triangles;
+	cull->total.kept += sum.kept;
+	cull->total.backface += sum.backface;
+	cull->total.zero_area += sum.zero_area;
+	cull->total.offscreen += sum.offscreen;
+	cull->total.ms += sum.ms;
+	++cull->runs;
+
+	if (stats != NULL) {
+		*stats = sum;
+	}
+
+	return (UINT) sum.kept;
+}
+
+static void precull_report(precull_stats_t const * stats, FILE * fp) {
+	double triangles = stats->triangles > 0 ? (double) stats->triangles : 1;
+	fprintf(fp, "precull: %llu triangles, kept %llu, backface %llu (%.1f%%), zero area %llu (%.1f%%), off-screen %llu (%.1f%%), %.3f ms\n", (unsigned long long) stats->triangles, (unsigned long long) stats->kept, (unsigned long long) stats->backface, stats->backface * 100.0 / triangles, (unsigned long long) stats->zero_area, stats->zero_area * 100.0 / triangles, (unsigned long long) stats->offscreen, stats->offscreen * 100.0 / triangles, stats->ms);
+}
+
+#endif
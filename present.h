@@ -0,0 +1,277 @@
+#ifndef PRESENT_H
+#define PRESENT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+#include "timer.h"
+
+/*
+ * frame pacing and input-to-photon latency. the mode decides how a frame is presented:
+ *
+ *   vsync     sync interval 1, the CPU blocks in Present once the queue is full
+ *   uncapped  sync interval 0, with tearing where the system allows it
+ *   waitable  sync interval 1, the CPU waits for the swapchain before sampling input,
+ *             so no more than max_latency frames are ever queued
+ *
+ * every frame is stamped when input is sampled, when simulation and submission finish
+ * and when Present returns, and once the display reports the frame on screen. latencies
+ * from the input stamp go into per-mode histograms. the swapchain is behind a backend,
+ * including the clock, so the pacing runs against a simulated display without a device.
+ */
+
+typedef enum present_mode {
+	PRESENT_VSYNC,
+	PRESENT_UNCAPPED,
+	PRESENT_WAITABLE,
+	PRESENT_MODES,
+} present_mode_t;
+
+static char const * const present_mode_names[PRESENT_MODES] = { "vsync", "uncapped", "waitable" };
+
+typedef enum present_stamp {
+	PRESENT_STAMP_INPUT,
+	PRESENT_STAMP_SIM,
+	PRESENT_STAMP_SUBMIT,
+	PRESENT_STAMP_PRESENT,
+	PRESENT_STAMPS,
+} present_stamp_t;
+
+/* latencies measured from the input stamp */
+typedef enum present_latency {
+	PRESENT_LATENCY_SIM,
+	PRESENT_LATENCY_SUBMIT,
+	PRESENT_LATENCY_PRESENT,
+	PRESENT_LATENCY_DISPLAY,
+	PRESENT_LATENCIES,
+} present_latency_t;
+
+static char const * const present_latency_names[PRESENT_LATENCIES] = { "sim", "submit", "present", "display" };
+
+/* what DXGI queues without a waitable swapchain */
+#define PRESENT_DEFAULT_LATENCY 3
+#define PRESENT_MAX_LATENCY 16
+#define PRESENT_PENDING 64
+#define PRESENT_BUCKETS 2048
+#define PRESENT_BUCKET_MS 0.1
+
+typedef struct present_backend {
+	LONGLONG (* now)(void * user);
+	/* blocks until the swapchain takes another frame without going over the max latency */
+	int (* wait)(void * user);
+	/* fills id with the present count the display reports frames back with */
+	int (* present)(void * user, UINT sync_interval, BOOL tearing, UINT64 * id);
+	/* the latest frame on screen and the vblank it went out on, non-zero if not known */
+	int (* displayed)(void * user, UINT64 * id, LONGLONG * when);
+	int (* set_max_latency)(void * user, UINT frames);
+	void * user;
+} present_backend_t;
+
+typedef struct present_histogram {
+	UINT buckets[PRESENT_BUCKETS];
+	/* samples past the last bucket */
+	UINT over;
+	UINT64 count;
+	double sum;
+	double max;
+} present_histogram_t;
+
+typedef struct present_frame {
+	LONGLONG stamps[PRESENT_STAMPS];
+	UINT64 id;
+	present_mode_t mode;
+} present_frame_t;
+
+typedef struct present_mode_stats {
+	present_histogram_t latency[PRESENT_LATENCIES];
+	UINT64 frames;
+	/* presented frames the display never reported back, dropped or statistics lost */
+	UINT64 unresolved;
+	/* time between consecutive presents of the mode, for the frame rate */
+	UINT64 intervals;
+	double ms;
+} present_mode_stats_t;
+
+typedef struct present {
+	present_backend_t backend;
+	present_mode_t mode;
+	/* queue depth of the waitable mode */
+	UINT max_latency;
+	/* whether the system allows tearing; without it uncapped still presents with interval 0 */
+	BOOL tearing;
+
+	present_frame_t current;
+	LONGLONG last_present;
+
+	/* presented, waiting for the display to report them */
+	present_frame_t pending[PRESENT_PENDING];
+	UINT pending_head;
+	UINT pending_count;
+
+	present_mode_stats_t modes[PRESENT_MODES];
+} present_t;
+
+static int present_set_mode(present_t * p, present_mode_t mode) {
+	p->mode = mode;
+	p->last_present = 0;
+	return p->backend.set_max_latency(p->backend.user, mode == PRESENT_WAITABLE ? p->max_latency : PRESENT_DEFAULT_LATENCY);
+}
+
+static int present_init(present_t * p, present_mode_t mode, UINT max_latency, BOOL tearing, present_backend_t backend) {
+	memset(p, 0, sizeof(*p));
+	p->backend = backend;
+	p->max_latency = max_latency < 1 ? 1 : max_latency > PRESENT_MAX_LATENCY ? PRESENT_MAX_LATENCY : max_latency;
+	p->tearing = tearing;
+	return present_set_mode(p, mode);
+}
+
+static void present_sample(present_histogram_t * h, double ms) {
+	UINT bucket = (UINT) (ms / PRESENT_BUCKET_MS);
+	if (ms < 0 || bucket >= PRESENT_BUCKETS) {
+		++h->over;
+	} else {
+		++h->buckets[bucket];
+	}
+	++h->count;
+	h->sum += ms;
+	if (ms > h->max) {
+		h->max = ms;
+	}
+}
+
+/* q in [0, 1], to the middle of the bucket but never past the largest sample */
+static double present_percentile(present_histogram_t const * h, double q) {
+	if (h->count == 0) {
+		return 0;
+	}
+
+	UINT64 target = (UINT64) (q * (double) (h->count - 1)) + 1;
+	UINT64 seen = 0;
+	for (UINT b = 0; b < PRESENT_BUCKETS; ++b) {
+		seen += h->buckets[b];
+		if (seen >= target) {
+			double mid = (b + 0.5) * PRESENT_BUCKET_MS;
+			return mid < h->max ? mid : h->max;
+		}
+	}
+	return h->max;
+}
+
+static double present_elapsed_ms(present_frame_t const * frame, LONGLONG when) {
+	return timer_ms(when - frame->stamps[PRESENT_STAMP_INPUT]);
+}
+
+/*
+ * first thing in a frame. in waitable mode this is where the CPU sleeps, so the input
+ * sampled right after is as fresh as the queue allows; stamp PRESENT_STAMP_INPUT then.
+ */
+static int present_begin(present_t * p) {
+	memset(&p->current, 0, sizeof(p->current));
+	p->current.mode = p->mode;
+
+	if (p->mode == PRESENT_WAITABLE && p->backend.wait(p->backend.user) != 0) {
+		return 1;
+	}
+
+	return 0;
+}
+
+static void present_stamp(present_t * p, present_stamp_t stamp) {
+	p->current.stamps[stamp] = p->backend.now(p->backend.user);
+}
+
+/* matches the display's report against the frames still pending */
+static void present_resolve(present_t * p) {
+	UINT64 id;
+	LONGLONG when;
+	if (p->pending_count == 0 || p->backend.displayed(p->backend.user, &id, &when) != 0) {
+		return;
+	}
+
+	/* frames older than the one on screen either went out on an earlier vblank we didn't see or were dropped */
+	while (p->pending_count > 0) {
+		present_frame_t const * frame = &p->pending[p->pending_head];
+		if (frame->id > id) {
+			break;
+		}
+
+		present_mode_stats_t * stats = &p->modes[frame->mode];
+		if (frame->id == id) {
+			present_sample(&stats->latency[PRESENT_LATENCY_DISPLAY], present_elapsed_ms(frame, when));
+		} else {
+			++stats->unresolved;
+		}
+		p->pending_head = (p->pending_head + 1) % PRESENT_PENDING;
+		--p->pending_count;
+	}
+}
+
+/* presents the frame the way the mode asks, stamps it and records its latencies */
+static int present_end(present_t * p) {
+	present_frame_t * frame = &p->current;
+	if (frame->stamps[PRESENT_STAMP_INPUT] == 0) {
+		present_stamp(p, PRESENT_STAMP_INPUT);
+	}
+
+	UINT sync_interval = p->mode == PRESENT_UNCAPPED ? 0 : 1;
+	BOOL tearing = p->mode == PRESENT_UNCAPPED && p->tearing;
+	if (p->backend.present(p->backend.user, sync_interval, tearing, &frame->id) != 0) {
+		return 1;
+	}
+	present_stamp(p, PRESENT_STAMP_PRESENT);
+
+	present_mode_stats_t * stats = &p->modes[frame->mode];
+	LONGLONG now = frame->stamps[PRESENT_STAMP_PRESENT];
+	for (UINT s = PRESENT_STAMP_SIM; s <= PRESENT_STAMP_PRESENT; ++s) {
+		if (frame->stamps[s] != 0) {
+			present_sample(&stats->latency[PRESENT_LATENCY_SIM + s - PRESENT_STAMP_SIM], present_elapsed_ms(frame, frame->stamps[s]));
+		}
+	}
+	if (p->last_present != 0) {
+		stats->ms += timer_ms(now - p->last_present);
+		++stats->intervals;
+	}
+	p->last_present = now;
+	++stats->frames;
+
+	/* a full ring means the display stopped reporting, the oldest frame won't be matched */
+	if (p->pending_count == PRESENT_PENDING) {
+		++p->modes[p->pending[p->pending_head].mode].unresolved;
+		p->pending_head = (p->pending_head + 1) % PRESENT_PENDING;
+		--p->pending_count;
+	}
+	p->pending[(p->pending_head + p->pending_count) % PRESENT_PENDING] = *frame;
+	++p->pending_count;
+
+	present_resolve(p);
+	return 0;
+}
+
+static void present_report(present_t const * p, FILE * fp) {
+	for (UINT m = 0; m < PRESENT_MODES; ++m) {
+		present_mode_stats_t const * stats = &p->modes[m];
+		if (stats->frames == 0) {
+			continue;
+		}
+
+		double fps = stats->ms > 0 ? (double) stats->intervals * 1000.0 / stats->ms : 0;
+		char mode[64];
+		if (m == PRESENT_WAITABLE) {
+			snprintf(mode, sizeof(mode), "%s, max latency %u", present_mode_names[m], p->max_latency);
+		} else if (m == PRESENT_UNCAPPED) {
+			snprintf(mode, sizeof(mode), "%s, %s", present_mode_names[m], p->tearing ? "tearing" : "no tearing");
+		} else {
+			snprintf(mode, sizeof(mode), "%s", present_mode_names[m]);
+		}
+		fprintf(fp, "present: %s, %llu frames at %.1f fps, %llu not matched on screen\n", mode, (unsigned long long) stats->frames, fps, (unsigned long long) stats->unresolved);
+		for (UINT l = 0; l < PRESENT_LATENCIES; ++l) {
+			present_histogram_t const * h = &stats->latency[l];
+			if (h->count == 0) {
+				continue;
+			}
+			fprintf(fp, "  input to %-7s mean %6.2f ms, p50 %6.2f, p90 %6.2f, p99 %6.2f, max %6.2f over %llu frames\n", present_latency_names[l], h->sum / (double) h->count, present_percentile(h, 0.5), present_percentile(h, 0.9), present_percentile(h, 0.99), h->max, (unsigned long long) h->count);
+		}
+	}
+}
+
+#endif
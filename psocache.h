@@ -0,0 +1,463 @@
+#ifndef PSOCACHE_H
+#define PSOCACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "timer.h"
+#include "jobs.h"
+
+/*
+ * graphics pipeline cache. a pso_desc_t mirrors the parts of
+ * D3D12_GRAPHICS_PIPELINE_STATE_DESC this renderer sets, with the same enum values, and
+ * pso_normalize turns it into a flat key: bytecode by content hash, semantics in upper
+ * case, appended offsets resolved, and state that a disabled stage ignores zeroed. two
+ * descriptions that would build the same pipeline get the same key and share one object.
+ *
+ * lookups take a shared lock, misses insert a pending entry under the exclusive lock and
+ * create either inline or on the job pool. the backend does the API work, which keeps
+ * this testable without a device.
+ */
+
+#define PSO_CACHE_SIZE 256
+#define PSO_MAX_INPUTS 16
+#define PSO_MAX_TARGETS 8
+/* D3D12_APPEND_ALIGNED_ELEMENT */
+#define PSO_APPEND 0xFFFFFFFFu
+
+typedef enum pso_status {
+	PSO_EMPTY,
+	PSO_PENDING,
+	PSO_READY,
+	PSO_FAILED,
+} pso_status_t;
+
+typedef struct pso_input {
+	const char * semantic;
+	UINT semantic_index;
+	/* DXGI_FORMAT */
+	UINT format;
+	UINT slot;
+	/* bytes from the start of the vertex or PSO_APPEND */
+	UINT offset;
+	BOOL per_instance;
+	UINT step_rate;
+} pso_input_t;
+
+/* enum fields hold the D3D12 values, the backend copies them across */
+typedef struct pso_desc {
+	void * root_sig;
+	/* bytecode has to stay alive until an asynchronous creation finishes */
+	void const * vs;
+	SIZE_T vs_size;
+	void const * ps;
+	SIZE_T ps_size;
+	/* pso_hash_bytecode of vs and ps, 0 to hash them on every lookup */
+	UINT64 vs_hash;
+	UINT64 ps_hash;
+	pso_input_t const * inputs;
+	UINT input_count;
+
+	UINT fill_mode;
+	UINT cull_mode;
+	BOOL front_ccw;
+	INT depth_bias;
+	float depth_bias_clamp;
+	float slope_scaled_depth_bias;
+	BOOL depth_clip;
+
+	BOOL blend_enable;
+	UINT src_blend;
+	UINT dest_blend;
+	UINT blend_op;
+	UINT src_blend_alpha;
+	UINT dest_blend_alpha;
+	UINT blend_op_alpha;
+	UINT write_mask;
+
+	BOOL depth_enable;
+	UINT depth_write_mask;
+	UINT depth_func;
+
+	UINT topology_type;
+	UINT rtv_count;
+	UINT rtv_formats[PSO_MAX_TARGETS];
+	UINT dsv_format;
+	UINT sample_count;
+	UINT sample_quality;
+} pso_desc_t;
+
+typedef struct pso_input_key {
+	UINT64 semantic;
+	UINT semantic_index;
+	UINT format;
+	UINT slot;
+	UINT offset;
+	UINT per_instance;
+	UINT step_rate;
+} pso_input_key_t;
+
+/* every field is written by pso_normalize, padding included, so keys compare with memcmp */
+typedef struct pso_key {
+	UINT64 vs;
+	UINT64 ps;
+	UINT64 vs_size;
+	UINT64 ps_size;
+	UINT64 root_sig;
+	UINT input_count;
+	UINT pad;
+	pso_input_key_t inputs[PSO_MAX_INPUTS];
+
+	UINT raster[7];
+	UINT blend[8];
+	UINT depth[3];
+	UINT output[PSO_MAX_TARGETS + 5];
+	UINT pad_end;
+} pso_key_t;
+
+typedef struct pso_cache pso_cache_t;
+
+typedef struct pso_entry {
+	pso_key_t key;
+	UINT64 hash;
+	volatile LONG status;
+	void * pso;
+
+	/* a copy for the job that creates it, the inputs point into the entry */
+	pso_desc_t desc;
+	pso_input_t inputs[PSO_MAX_INPUTS];
+	pso_cache_t * cache;
+} pso_entry_t;
+
+typedef struct pso_backend {
+	/* NULL on failure */
+	void * (* create)(void * user, pso_desc_t const * desc);
+	void (* release)(void * user, void * pso);
+	void * user;
+} pso_backend_t;
+
+typedef struct pso_cache_stats {
+	volatile LONG64 hits;
+	volatile LONG64 misses;
+	volatile LONG64 created;
+	volatile LONG64 failed;
+	/* lookups that found the entry still being created and had to wait for it */
+	volatile LONG64 waited;
+	volatile LONG64 create_ticks;
+} pso_cache_stats_t;
+
+struct pso_cache {
+	pso_backend_t backend;
+	SRWLOCK lock;
+	pso_entry_t * entries;
+	UINT count;
+	volatile LONG pending;
+	pso_cache_stats_t stats;
+};
+
+/* FNV-1a, seeded so the pieces of a key can be chained */
+static UINT64 pso_hash(UINT64 hash, void const * data, SIZE_T size) {
+	BYTE const * bytes = data;
+	for (SIZE_T i = 0; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+	}
+	return hash;
+}
+
+#define PSO_HASH_SEED 0xCBF29CE484222325ull
+
+/* never 0, which pso_desc_t uses for not computed */
+static UINT64 pso_hash_bytecode(void const * code, SIZE_T size) {
+	UINT64 hash = pso_hash(PSO_HASH_SEED, code, size);
+	return hash != 0 ? hash : 1;
+}
+
+/* HLSL semantics are case-insensitive */
+static UINT64 pso_hash_semantic(const char * semantic) {
+	UINT64 hash = PSO_HASH_SEED;
+	for (const char * c = semantic; c != NULL && *c != '\0'; ++c) {
+		BYTE upper = (BYTE) (*c >= 'a' && *c <= 'z' ? *c - 'a' + 'A' : *c);
+		hash = (hash ^ upper) * 0x100000001B3ull;
+	}
+	return hash;
+}
+
+/* bytes per element of the vertex formats in use, 0 for anything else */
+static UINT pso_format_size(UINT format) {
+	switch (format) {
+	case 2:  /* R32G32B32A32_FLOAT */
+	case 3:  /* R32G32B32A32_UINT */
+		return 16;
+	case 6:  /* R32G32B32_FLOAT */
+		return 12;
+	case 10: /* R16G16B16A16_FLOAT */
+	case 16: /* R32G32_FLOAT */
+		return 8;
+	case 28: /* R8G8B8A8_UNORM */
+	case 30: /* R8G8B8A8_UINT */
+	case 34: /* R16G16_FLOAT */
+	case 41: /* R32_FLOAT */
+	case 42: /* R32_UINT */
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+static UINT pso_float_bits(float f) {
+	/* -0 and +0 bias the same */
+	if (f == 0.0f) {
+		return 0;
+	}
+	UINT bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+/* returns 1 if the description has more inputs or targets than a key holds */
+static int pso_normalize(pso_desc_t const * desc, pso_key_t * key) {
+	if (desc->input_count > PSO_MAX_INPUTS || desc->rtv_count > PSO_MAX_TARGETS) {
+		return 1;
+	}
+
+	memset(key, 0, sizeof(*key));
+	key->vs = desc->vs_hash != 0 ? desc->vs_hash : pso_hash_bytecode(desc->vs, desc->vs_size);
+	key->ps = desc->ps_hash != 0 ? desc->ps_hash : pso_hash_bytecode(desc->ps, desc->ps_size);
+	key->vs_size = desc->vs_size;
+	key->ps_size = desc->ps_size;
+	key->root_sig = (UINT64) (UINT_PTR) desc->root_sig;
+	key->input_count = desc->input_count;
+
+	/* appended elements start where the previous element of the same slot ended */
+	UINT slot_end[PSO_MAX_INPUTS] = { 0 };
+	for (UINT i = 0; i < desc->input_count; ++i) {
+		pso_input_t const * in = &desc->inputs[i];
+		UINT slot = in->slot % PSO_MAX_INPUTS;
+		UINT offset = in->offset;
+		if (offset == PSO_APPEND && pso_format_size(in->format) != 0) {
+			offset = slot_end[slot];
+		}
+		if (offset != PSO_APPEND) {
+			slot_end[slot] = offset + pso_format_size(in->format);
+		}
+
+		key->inputs[i] = (pso_input_key_t) {
+			.semantic = pso_hash_semantic(in->semantic),
+			.semantic_index = in->semantic_index,
+			.format = in->format,
+			.slot = in->slot,
+			.offset = offset,
+			.per_instance = in->per_instance ? 1 : 0,
+			/* per-vertex data ignores the step rate */
+			.step_rate = in->per_instance ? in->step_rate : 0,
+		};
+	}
+
+	key->raster[0] = desc->fill_mode;
+	key->raster[1] = desc->cull_mode;
+	key->raster[2] = desc->front_ccw ? 1 : 0;
+	key->raster[3] = (UINT) desc->depth_bias;
+	key->raster[4] = pso_float_bits(desc->depth_bias_clamp);
+	key->raster[5] = pso_float_bits(desc->slope_scaled_depth_bias);
+	key->raster[6] = desc->depth_clip ? 1 : 0;
+
+	if (desc->blend_enable) {
+		key->blend[0] = 1;
+		key->blend[1] = desc->src_blend;
+		key->blend[2] = desc->dest_blend;
+		key->blend[3] = desc->blend_op;
+		key->blend[4] = desc->src_blend_alpha;
+		key->blend[5] = desc->dest_blend_alpha;
+		key->blend[6] = desc->blend_op_alpha;
+	}
+	key->blend[7] = desc->write_mask;
+
+	if (desc->depth_enable) {
+		key->depth[0] = 1;
+		key->depth[1] = desc->depth_write_mask;
+		key->depth[2] = desc->depth_func;
+	}
+
+	key->output[0] = desc->topology_type;
+	key->output[1] = desc->rtv_count;
+	key->output[2] = desc->dsv_format;
+	key->output[3] = desc->sample_count;
+	key->output[4] = desc->sample_quality;
+	for (UINT i = 0; i < desc->rtv_count; ++i) {
+		key->output[5 + i] = desc->rtv_formats[i];
+	}
+
+	return 0;
+}
+
+/* a word at a time, the key is a whole number of them and looked up every draw setup */
+static UINT64 pso_key_hash(pso_key_t const * key) {
+	UINT64 const * words = (UINT64 const *) key;
+	UINT64 hash = PSO_HASH_SEED;
+	for (SIZE_T i = 0; i < sizeof(*key) / sizeof(UINT64); ++i) {
+		hash = (hash ^ words[i]) * 0x100000001B3ull;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+static int pso_cache_init(pso_cache_t * cache, pso_backend_t backend) {
+	memset(cache, 0, sizeof(*cache));
+	cache->backend = backend;
+	InitializeSRWLock(&cache->lock);
+	cache->entries = calloc(PSO_CACHE_SIZE, sizeof(pso_entry_t));
+	return cache->entries == NULL;
+}
+
+/* linear probing, NULL if the key isn't in the table; call under either lock */
+static pso_entry_t * pso_cache_find(pso_cache_t * cache, pso_key_t const * key, UINT64 hash, UINT * free_slot) {
+	for (UINT i = 0; i < PSO_CACHE_SIZE; ++i) {
+		UINT slot = (UINT) ((hash + i) % PSO_CACHE_SIZE);
+		pso_entry_t * entry = &cache->entries[slot];
+		if (entry->status == PSO_EMPTY) {
+			*free_slot = slot;
+			return NULL;
+		}
+		if (entry->hash == hash && memcmp(&entry->key, key, sizeof(*key)) == 0) {
+			return entry;
+		}
+	}
+
+	*free_slot = PSO_CACHE_SIZE;
+	return NULL;
+}
+
+static void pso_cache_create(pso_entry_t * entry) {
+	pso_cache_t * cache = entry->cache;
+	LONGLONG start = timer_now();
+	void * pso = cache->backend.create(cache->backend.user, &entry->desc);
+	InterlockedAdd64(&cache->stats.create_ticks, timer_now() - start);
+
+	entry->pso = pso;
+	if (pso != NULL) {
+		InterlockedIncrement64(&cache->stats.created);
+	} else {
+		InterlockedIncrement64(&cache->stats.failed);
+	}
+	WriteRelease(&entry->status, pso != NULL ? PSO_READY : PSO_FAILED);
+}
+
+static void pso_cache_create_job(void * user) {
+	pso_entry_t * entry = user;
+	pso_cache_create(entry);
+	InterlockedDecrement(&entry->cache->pending);
+}
+
+/* runs queued jobs, the creation among them, until the entry is no longer pending */
+static void pso_cache_wait_entry(pso_entry_t * entry) {
+	while (ReadAcquire(&entry->status) == PSO_PENDING) {
+		job_t job;
+		if (jobs_try_pop(&job)) {
+			job.fn(job.user);
+		} else {
+			SwitchToThread();
+		}
+	}
+}
+
+/*
+ * looks the pipeline up and creates it on a miss. with async, a miss queues the creation
+ * and returns PSO_PENDING (as does a hit on an entry still being created) so the caller
+ * can draw something else this frame; without, it waits. *pso is set when PSO_READY.
+ */
+static pso_status_t pso_cache_get(pso_cache_t * cache, pso_desc_t const * desc, BOOL async, void ** pso) {
+	pso_key_t key;
+	*pso = NULL;
+	if (pso_normalize(desc, &key) != 0) {
+		return PSO_FAILED;
+	}
+	UINT64 hash = pso_key_hash(&key);
+	UINT free_slot;
+
+	AcquireSRWLockShared(&cache->lock);
+	pso_entry_t * entry = pso_cache_find(cache, &key, hash, &free_slot);
+	ReleaseSRWLockShared(&cache->lock);
+
+	if (entry == NULL) {
+		AcquireSRWLockExclusive(&cache->lock);
+		/* someone may have inserted it between the two locks */
+		entry = pso_cache_find(cache, &key, hash, &free_slot);
+		if (entry == NULL) {
+			if (free_slot == PSO_CACHE_SIZE || cache->count >= PSO_CACHE_SIZE * 3 / 4) {
+				ReleaseSRWLockExclusive(&cache->lock);
+				InterlockedIncrement64(&cache->stats.failed);
+				return PSO_FAILED;
+			}
+
+			entry = &cache->entries[free_slot];
+			entry->key = key;
+			entry->hash = hash;
+			entry->pso = NULL;
+			entry->cache = cache;
+			entry->desc = *desc;
+			memcpy(entry->inputs, desc->inputs, sizeof(pso_input_t) * desc->input_count);
+			entry->desc.inputs = entry->inputs;
+			++cache->count;
+			WriteRelease(&entry->status, PSO_PENDING);
+			ReleaseSRWLockExclusive(&cache->lock);
+
+			InterlockedIncrement64(&cache->stats.misses);
+			if (async) {
+				InterlockedIncrement(&cache->pending);
+				jobs_push(pso_cache_create_job, entry);
+			} else {
+				pso_cache_create(entry);
+			}
+		} else {
+			ReleaseSRWLockExclusive(&cache->lock);
+			InterlockedIncrement64(&cache->stats.hits);
+		}
+	} else {
+		InterlockedIncrement64(&cache->stats.hits);
+	}
+
+	LONG status = ReadAcquire(&entry->status);
+	if (status == PSO_PENDING) {
+		if (async) {
+			return PSO_PENDING;
+		}
+		InterlockedIncrement64(&cache->stats.waited);
+		pso_cache_wait_entry(entry);
+		status = ReadAcquire(&entry->status);
+	}
+
+	if (status == PSO_READY) {
+		*pso = entry->pso;
+	}
+	return (pso_status_t) status;
+}
+
+/* blocks until every asynchronous creation has finished */
+static void pso_cache_wait_all(pso_cache_t * cache) {
+	jobs_wait(&cache->pending);
+}
+
+static void pso_cache_destroy(pso_cache_t * cache) {
+	if (cache->entries == NULL) {
+		return;
+	}
+
+	pso_cache_wait_all(cache);
+	for (UINT i = 0; i < PSO_CACHE_SIZE; ++i) {
+		pso_entry_t * entry = &cache->entries[i];
+		if (entry->status == PSO_READY) {
+			cache->backend.release(cache->backend.user, entry->pso);
+		}
+	}
+
+	free(cache->entries);
+	cache->entries = NULL;
+	cache->count = 0;
+}
+
+static void pso_cache_report(pso_cache_t const * cache, FILE * fp) {
+	fprintf(fp, "psocache: %lld hits, %lld misses, %lld created (%.3f ms), %lld failed, %lld waited, %u cached\n", (long long) cache->stats.hits, (long long) cache->stats.misses, (long long) cache->stats.created, timer_ms(cache->stats.create_ticks), (long long) cache->stats.failed, (long long) cache->stats.waited, cache->count);
+}
+
+#endif
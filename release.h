@@ -0,0 +1,327 @@
+#ifndef RELEASE_H
+#define RELEASE_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+
+/*
+ * lifetime tracking for COM objects.
+ *
+ * com_track registers the address of a pointer (usually a state field) in a pooled
+ * handle table. com_retire takes the object out of the table and queues it with the
+ * fence value of the last frame that used it; release_collect releases every queued
+ * object whose fence has completed. retire fences are monotonic, so the queue stays
+ * sorted and collection only ever pops from the head.
+ *
+ * only IUnknown::Release is ever called, so anything with a compatible vtable works.
+ */
+
+#define COM_CHUNK_SIZE 256
+
+typedef UINT64 com_handle_t;
+
+typedef struct com_slot {
+	IUnknown ** ref;
+	UINT64 bytes;
+	UINT generation;
+	UINT next_free;
+} com_slot_t;
+
+typedef struct release_entry {
+	IUnknown * obj;
+	UINT64 fence;
+	UINT64 bytes;
+} release_entry_t;
+
+typedef struct release_stats {
+	UINT tracked;
+	UINT64 tracked_bytes;
+	UINT pending;
+	UINT64 pending_bytes;
+	UINT64 released;
+	UINT64 batches;
+} release_stats_t;
+
+struct {
+	SRWLOCK lock;
+
+	/* slots live in fixed chunks so growing the table never moves them */
+	com_slot_t ** chunks;
+	UINT chunk_count;
+	UINT slot_count;
+	UINT free_head;
+	UINT tracked;
+	UINT64 tracked_bytes;
+
+	release_entry_t * ring;
+	UINT ring_capacity;
+	UINT ring_head;
+	UINT ring_count;
+	UINT64 pending_bytes;
+
+	UINT64 released;
+	UINT64 batches;
+} static releases = {
+	.lock = SRWLOCK_INIT,
+	.chunks = NULL,
+	.chunk_count = 0,
+	.slot_count = 0,
+	.free_head = UINT_MAX,
+	.tracked = 0,
+	.tracked_bytes = 0,
+	.ring = NULL,
+	.ring_capacity = 0,
+	.ring_head = 0,
+	.ring_count = 0,
+	.pending_bytes = 0,
+	.released = 0,
+	.batches = 0,
+};
+
+static com_slot_t * com_slot(UINT index) {
+	return &releases.chunks[index / COM_CHUNK_SIZE][index % COM_CHUNK_SIZE];
+}
+
+static int com_grow(void) {
+	if ((releases.chunk_count & (releases.chunk_count - 1)) == 0) {
+		UINT capacity = releases.chunk_count == 0 ? 1 : releases.chunk_count * 2;
+		com_slot_t ** chunks = realloc(releases.chunks, sizeof(com_slot_t *) * capacity);
+		if (chunks == NULL) {
+			return 1;
+		}
+		releases.chunks = chunks;
+	}
+
+	com_slot_t * chunk = malloc(sizeof(com_slot_t) * COM_CHUNK_SIZE);
+	if (chunk == NULL) {
+		return 1;
+	}
+
+	releases.chunks[releases.chunk_count++] = chunk;
+
+	/* thread the new slots onto the free list, lowest index first */
+	for (UINT i = COM_CHUNK_SIZE; i > 0; --i) {
+		chunk[i - 1] = (com_slot_t) {
+			.ref = NULL,
+			.bytes = 0,
+			.generation = 1,
+			.next_free = releases.free_head,
+		};
+		releases.free_head = releases.slot_count + i - 1;
+	}
+	releases.slot_count += COM_CHUNK_SIZE;
+
+	return 0;
+}
+
+/* returns 0 on failure, bytes is only used for reporting */
+static com_handle_t com_track(void ** com, UINT64 bytes) {
+	com_handle_t handle = 0;
+
+	AcquireSRWLockExclusive(&releases.lock);
+	if (releases.free_head != UINT_MAX || com_grow() == 0) {
+		UINT index = releases.free_head;
+		com_slot_t * slot = com_slot(index);
+
+		releases.free_head = slot->next_free;
+		slot->ref = (IUnknown **) com;
+		slot->bytes = bytes;
+		slot->next_free = UINT_MAX;
+
+		++releases.tracked;
+		releases.tracked_bytes += bytes;
+		handle = ((UINT64) slot->generation << 32) | (UINT64) (index + 1);
+	}
+	ReleaseSRWLockExclusive(&releases.lock);
+
+	return handle;
+}
+
+static com_slot_t * com_lookup(com_handle_t handle) {
+	UINT index = (UINT) (handle & 0xFFFFFFFF);
+	if (index == 0 || index > releases.slot_count) {
+		return NULL;
+	}
+
+	com_slot_t * slot = com_slot(index - 1);
+	if (slot->generation != (UINT) (handle >> 32) || slot->ref == NULL) {
+		return NULL;
+	}
+
+	return slot;
+}
+
+static void com_free_slot(com_slot_t * slot, UINT index) {
+	--releases.tracked;
+	releases.tracked_bytes -= slot->bytes;
+
+	slot->ref = NULL;
+	slot->bytes = 0;
+	++slot->generation;
+	slot->next_free = releases.free_head;
+	releases.free_head = index;
+}
+
+static int release_push(IUnknown * obj, UINT64 fence, UINT64 bytes) {
+	if (releases.ring_count == releases.ring_capacity) {
+		UINT capacity = releases.ring_capacity == 0 ? 64 : releases.ring_capacity * 2;
+		release_entry_t * ring = malloc(sizeof(release_entry_t) * capacity);
+		if (ring == NULL) {
+			return 1;
+		}
+
+		for (UINT i = 0; i < releases.ring_count; ++i) {
+			ring[i] = releases.ring[(releases.ring_head + i) % releases.ring_capacity];
+		}
+
+		free(releases.ring);
+		releases.ring = ring;
+		releases.ring_capacity = capacity;
+		releases.ring_head = 0;
+	}
+
+	releases.ring[(releases.ring_head + releases.ring_count) % releases.ring_capacity] = (release_entry_t) { obj, fence, bytes };
+	++releases.ring_count;
+	releases.pending_bytes += bytes;
+
+	return 0;
+}
+
+/* queues an untracked object for release once fence completes */
+static int release_defer(IUnknown * obj, UINT64 fence, UINT64 bytes) {
+	if (obj == NULL) {
+		return 0;
+	}
+
+	AcquireSRWLockExclusive(&releases.lock);
+	int err = release_push(obj, fence, bytes);
+	ReleaseSRWLockExclusive(&releases.lock);
+
+	return err;
+}
+
+/* clears the tracked pointer and queues the object for release once fence completes */
+static int com_retire(com_handle_t handle, UINT64 fence) {
+	int err = 1;
+
+	AcquireSRWLockExclusive(&releases.lock);
+	com_slot_t * slot = com_lookup(handle);
+	if (slot != NULL) {
+		IUnknown * obj = *slot->ref;
+		err = 0;
+		if (obj != NULL) {
+			err = release_push(obj, fence, slot->bytes);
+		}
+
+		if (err == 0) {
+			*slot->ref = NULL;
+			com_free_slot(slot, (UINT) (handle & 0xFFFFFFFF) - 1);
+		}
+	}
+	ReleaseSRWLockExclusive(&releases.lock);
+
+	return err;
+}
+
+/* releases every queued object whose fence is <= completed, returns how many */
+static UINT release_collect(UINT64 completed) {
+	IUnknown * batch[64];
+	UINT total = 0;
+
+	for (;;) {
+		UINT count = 0;
+
+		AcquireSRWLockExclusive(&releases.lock);
+		while (releases.ring_count > 0 && count < sizeof(batch) / sizeof(batch[0])) {
+			release_entry_t * entry = &releases.ring[releases.ring_head];
+			if (entry->fence > completed) {
+				break;
+			}
+
+			batch[count++] = entry->obj;
+			releases.pending_bytes -= entry->bytes;
+			releases.ring_head = (releases.ring_head + 1) % releases.ring_capacity;
+			--releases.ring_count;
+		}
+
+		if (count > 0) {
+			releases.released += count;
+			++releases.batches;
+		}
+		ReleaseSRWLockExclusive(&releases.lock);
+
+		/* Release outside the lock, destructors may retire other objects */
+		for (UINT i = 0; i < count; ++i) {
+			batch[i]->lpVtbl->Release(batch[i]);
+		}
+
+		total += count;
+		if (count < sizeof(batch) / sizeof(batch[0])) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+static void release_get_stats(release_stats_t * stats) {
+	AcquireSRWLockShared(&releases.lock);
+	*stats = (release_stats_t) {
+		.tracked = releases.tracked,
+		.tracked_bytes = releases.tracked_bytes,
+		.pending = releases.ring_count,
+		.pending_bytes = releases.pending_bytes,
+		.released = releases.released,
+		.batches = releases.batches,
+	};
+	ReleaseSRWLockShared(&releases.lock);
+}
+
+static void release_report(FILE * fp) {
+	release_stats_t stats;
+	release_get_stats(&stats);
+
+	fprintf(fp, "release: %u tracked (%llu bytes), %u pending (%llu bytes), %llu released in %llu batches\n", stats.tracked, (unsigned long long) stats.tracked_bytes, stats.pending, (unsigned long long) stats.pending_bytes, (unsigned long long) stats.released, (unsigned long long) stats.batches);
+}
+
+/* the GPU must be idle: releases everything still tracked or pending and frees the tables */
+static void release_shutdown(void) {
+	AcquireSRWLockExclusive(&releases.lock);
+	for (UINT i = 0; i < releases.slot_count; ++i) {
+		com_slot_t * slot = com_slot(i);
+		if (slot->ref == NULL) {
+			continue;
+		}
+
+		if (*slot->ref != NULL) {
+			release_push(*slot->ref, 0, slot->bytes);
+			*slot->ref = NULL;
+		}
+		com_free_slot(slot, i);
+	}
+	ReleaseSRWLockExclusive(&releases.lock);
+
+	release_collect(UINT64_MAX);
+
+	AcquireSRWLockExclusive(&releases.lock);
+	for (UINT i = 0; i < releases.chunk_count; ++i) {
+		free(releases.chunks[i]);
+	}
+	free(releases.chunks);
+	free(releases.ring);
+
+	releases.chunks = NULL;
+	releases.chunk_count = 0;
+	releases.slot_count = 0;
+	releases.free_head = UINT_MAX;
+	releases.ring = NULL;
+	releases.ring_capacity = 0;
+	releases.ring_head = 0;
+	releases.ring_count = 0;
+	ReleaseSRWLockExclusive(&releases.lock);
+}
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "linmath.h"
+#include "timer.h"
+#include "jobs.h"
+#include "xform.h"
+
+/*
+ * transform hierarchy. nodes live in SoA arrays ordered by depth, so every parent sits
+ * in an earlier level than its children and a level can be updated in parallel once
+ * the one above it is done. scene_set_local marks a node dirty; scene_update pushes
+ * the flag down one level at a time and recomputes world = parent world * local only
+ * where it is set, with xform_mul_sse. that sums in linmath's order, but once the
+ * compiler contracts products into FMAs the worlds only match mat4x4_mul up to rounding.
+ *
+ * ids are handed out by scene_add and stay valid, slots move when the order is rebuilt.
+ */
+
+#define SCENE_NONE 0xFFFFFFFFu
+#define SCENE_MAX_DEPTH 64
+#define SCENE_GRAIN 1024
+
+typedef struct scene_stats {
+	UINT nodes;
+	UINT levels;
+	/* nodes whose world matrix was recomputed by the last scene_update */
+	UINT updated;
+	double ms;
+} scene_stats_t;
+
+typedef struct scene {
+	UINT count;
+	UINT capacity;
+	BOOL sorted;
+
+	/* by slot */
+	UINT * parent;
+	UINT * id;
+	BYTE * dirty;
+	mat4x4 * local;
+	mat4x4 * world;
+
+	/* by id */
+	UINT * slot;
+	BYTE * depth;
+
+	/* slots of level d are level[d] .. level[d + 1] */
+	UINT level[SCENE_MAX_DEPTH + 1];
+	UINT levels;
+
+	scene_stats_t stats;
+} scene_t;
+
+static void scene_destroy(scene_t * scene) {
+	free(scene->parent);
+	free(scene->id);
+	free(scene->dirty);
+	_aligned_free(scene->local);
+	_aligned_free(scene->world);
+	free(scene->slot);
+	free(scene->depth);
+	*scene = (scene_t) { 0 };
+}
+
+static void scene_init(scene_t * scene) {
+	*scene = (scene_t) {
+		.sorted = TRUE,
+	};
+}
+
+static int scene_reserve(scene_t * scene, UINT capacity) {
+	if (capacity <= scene->capacity) {
+		return 0;
+	}
+
+	UINT * parent = realloc(scene->parent, sizeof(UINT) * capacity);
+	if (parent != NULL) {
+		scene->parent = parent;
+	}
+	UINT * id = realloc(scene->id, sizeof(UINT) * capacity);
+	if (id != NULL) {
+		scene->id = id;
+	}
+	BYTE * dirty = realloc(scene->dirty, capacity);
+	if (dirty != NULL) {
+		scene->dirty = dirty;
+	}
+	UINT * slot = realloc(scene->slot, sizeof(UINT) * capacity);
+	if (slot != NULL) {
+		scene->slot = slot;
+	}
+	BYTE * depth = realloc(scene->depth, capacity);
+	if (depth != NULL) {
+		scene->depth = depth;
+	}
+	mat4x4 * local = _aligned_realloc(scene->local, sizeof(mat4x4) * capacity, 64);
+	if (local != NULL) {
+		scene->local = local;
+	}
+	mat4x4 * world = _aligned_realloc(scene->world, sizeof(mat4x4) * capacity, 64);
+	if (world != NULL) {
+		scene->world = world;
+	}
+
+	if (parent == NULL || id == NULL || dirty == NULL || slot == NULL || depth == NULL || local == NULL || world == NULL) {
+		return 1;
+	}
+
+	scene->capacity = capacity;
+	return 0;
+}
+
+/* parent is an id from an earlier scene_add or SCENE_NONE for a root, returns the new id */
+static UINT scene_add(scene_t * scene, UINT parent) {
+	if (scene->count == scene->capacity && scene_reserve(scene, scene->capacity < 64 ? 64 : scene->capacity * 2) != 0) {
+		return SCENE_NONE;
+	}
+
+	BYTE depth = parent == SCENE_NONE ? 0 : scene->depth[parent] + 1;
+	if (depth >= SCENE_MAX_DEPTH) {
+		return SCENE_NONE;
+	}
+
+	/* appended out of level order, scene_update re-sorts before it walks the levels */
+	UINT id = scene->count++;
+	UINT slot = id;
+	scene->slot[id] = slot;
+	scene->depth[id] = depth;
+	scene->id[slot] = id;
+	scene->parent[slot] = parent == SCENE_NONE ? SCENE_NONE : scene->slot[parent];
+	scene->dirty[slot] = 1;
+	mat4x4_identity(scene->local[slot]);
+	mat4x4_identity(scene->world[slot]);
+	scene->sorted = FALSE;
+
+	return id;
+}
+
+static void scene_set_local(scene_t * scene, UINT id, mat4x4 local) {
+	UINT slot = scene->slot[id];
+	mat4x4_dup(scene->local[slot], local);
+	scene->dirty[slot] = 1;
+}
+
+/* valid as of the last scene_update */
+static void scene_get_world(scene_t const * scene, UINT id, mat4x4 world) {
+	mat4x4_dup(world, scene->world[scene->slot[id]]);
+}
+
+/* counting sort by depth, stable so siblings keep their relative order */
+static int scene_sort(scene_t * scene) {
+	UINT count = scene->count;
+	if (count == 0) {
+		scene->levels = 0;
+		scene->sorted = TRUE;
+		return 0;
+	}
+
+	UINT * order = malloc(sizeof(UINT) * count);
+	UINT * parent = malloc(sizeof(UINT) * count);
+	BYTE * dirty = malloc(count);
+	mat4x4 * local = _aligned_malloc(sizeof(mat4x4) * count, 64);
+	mat4x4 * world = _aligned_malloc(sizeof(mat4x4) * count, 64);
+
+	if (order == NULL || parent == NULL || dirty == NULL || local == NULL || world == NULL) {
+		free(order);
+		free(parent);
+		free(dirty);
+		_aligned_free(local);
+		_aligned_free(world);
+		return 1;
+	}
+
+	UINT start[SCENE_MAX_DEPTH + 1] = { 0 };
+	for (UINT id = 0; id < count; ++id) {
+		++start[scene->depth[id] + 1];
+	}
+
+	scene->levels = 0;
+	for (UINT d = 0; d < SCENE_MAX_DEPTH; ++d) {
+		if (start[d + 1] != 0) {
+			scene->levels = d + 1;
+		}
+		start[d + 1] += start[d];
+	}
+	memcpy(scene->level, start, sizeof(start));
+
+	/* ids ascend within a level, so walking ids in order keeps the sort stable */
+	for (UINT id = 0; id < count; ++id) {
+		order[start[scene->depth[id]]++] = id;
+	}
+
+	for (UINT slot = 0; slot < count; ++slot) {
+		UINT old = scene->slot[order[slot]];
+		dirty[slot] = scene->dirty[old];
+		mat4x4_dup(local[slot], scene->local[old]);
+		mat4x4_dup(world[slot], scene->world[old]);
+		parent[slot] = scene->parent[old] == SCENE_NONE ? SCENE_NONE : scene->id[scene->parent[old]];
+	}
+
+	for (UINT slot = 0; slot < count; ++slot) {
+		scene->slot[order[slot]] = slot;
+	}
+	for (UINT slot = 0; slot < count; ++slot) {
+		parent[slot] = parent[slot] == SCENE_NONE ? SCENE_NONE : scene->slot[parent[slot]];
+	}
+
+	free(scene->id);
+	free(scene->parent);
+	free(scene->dirty);
+	_aligned_free(scene->local);
+	_aligned_free(scene->world);
+
+	scene->id = order;
+	scene->parent = parent;
+	scene->dirty = dirty;
+	scene->local = local;
+	scene->world = world;
+	scene->capacity = count;
+	scene->sorted = TRUE;
+
+	return 0;
+}
+
+typedef struct scene_job {
+	scene_t * scene;
+	UINT base;
+	volatile LONG updated;
+} scene_job_t;
+
+static void scene_level_range(void * user, UINT begin, UINT end) {
+	scene_job_t * job = user;
+	scene_t * scene = job->scene;
+	UINT const * parent = scene->parent;
+	BYTE * dirty = scene->dirty;
+	LONG updated = 0;
+
+	for (UINT slot = job->base + begin; slot < job->base + end; ++slot) {
+		UINT p = parent[slot];
+		if (p != SCENE_NONE) {
+			dirty[slot] |= dirty[p];
+		}
+
+		if (dirty[slot] == 0) {
+			continue;
+		}
+
+		if (p == SCENE_NONE) {
+			mat4x4_dup(scene->world[slot], scene->local[slot]);
+		} else {
+			xform_mul_sse(scene->world[slot], scene->world[p], scene->local[slot]);
+		}
+		++updated;
+	}
+
+	if (updated != 0) {
+		InterlockedAdd(&job->updated, updated);
+	}
+}
+
+static void scene_clear_range(void * user, UINT begin, UINT end) {
+	scene_t * scene = user;
+	memset(&scene->dirty[begin], 0, end - begin);
+}
+
+/* recomputes dirty subtrees level by level, nodes within a level on the worker pool */
+static int scene_update(scene_t * scene) {
+	LONGLONG start = timer_now();
+
+	if (!scene->sorted && scene_sort(scene) != 0) {
+		return 1;
+	}
+
+	scene_job_t job = {
+		.scene = scene,
+	};
+
+	for (UINT d = 0; d < scene->levels; ++d) {
+		job.base = scene->level[d];
+		jobs_parallel_for(scene->level[d + 1] - scene->level[d], SCENE_GRAIN, scene_level_range, &job);
+	}
+
+	/* flags have to survive until the deepest level read them */
+	jobs_parallel_for(scene->count, SCENE_GRAIN * 16, scene_clear_range, scene);
+
+	scene->stats = (scene_stats_t) {
+		.nodes = scene->count,
+		.levels = scene->levels,
+		.updated = (UINT) job.updated,
+		.ms = timer_ms(timer_now() - start),
+	};
+
+	return 0;
+}
+
+#endif
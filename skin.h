@@ -0,0 +1,414 @@
+#ifndef SKIN_H
+#define SKIN_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+#include <immintrin.h>
+#include "linmath.h"
+#include "vertex.h"
+#include "jobs.h"
+
+/*
+ * skeletal animation on the CPU. joint transforms are rotation + translation + uniform
+ * scale and stay in that form through sampling, blending and the hierarchy walk, so
+ * the dual quaternion palette comes straight from the quaternions without a
+ * matrix round trip. skinning reads skin_vertex_t and writes plain vertex_t.
+ *
+ * main.c draws vertices skinned by cs_skin on the compute queue, from the same palette,
+ * into its skin_out buffers. the CPU pass only fills the cached copy that culling reads,
+ * so nothing written here reaches the GPU. skin_run can still write straight into a
+ * mapped upload buffer, with streaming stores so write-combined memory only sees full
+ * sequential lines.
+ */
+
+#define SKIN_MAX_JOINTS 256
+#define SKIN_INFLUENCES 4
+#define SKIN_GRAIN 2048
+
+typedef struct skin_xform {
+	quat rotation;
+	vec3 translation;
+	float scale;
+} skin_xform_t;
+
+/* one joint's keys, times ascending */
+typedef struct skin_track {
+	UINT keys;
+	float const * times;
+	skin_xform_t const * poses;
+} skin_track_t;
+
+typedef struct skin_clip {
+	float duration;
+	UINT joints;
+	skin_track_t const * tracks;
+} skin_clip_t;
+
+/* parents precede their children, the root has parent SKIN_NO_PARENT */
+#define SKIN_NO_PARENT 0xFFFFu
+
+typedef struct skin_skeleton {
+	UINT joints;
+	USHORT const * parent;
+	/* model space to joint space in the bind pose */
+	skin_xform_t const * inverse_bind;
+} skin_skeleton_t;
+
+typedef struct skin_dq {
+	quat real;
+	quat dual;
+	float scale;
+} skin_dq_t;
+
+typedef struct skin_palette {
+	mat4x4 matrices[SKIN_MAX_JOINTS];
+	skin_dq_t dq[SKIN_MAX_JOINTS];
+} skin_palette_t;
+
+typedef struct skin_vertex {
+	float pos[4];
+	float color[4];
+	BYTE joints[SKIN_INFLUENCES];
+	float weights[SKIN_INFLUENCES];
+} skin_vertex_t;
+
+typedef enum skin_mode {
+	SKIN_LINEAR,
+	SKIN_DUAL_QUAT,
+} skin_mode_t;
+
+static void skin_xform_identity(skin_xform_t * x) {
+	quat_identity(x->rotation);
+	x->translation[0] = x->translation[1] = x->translation[2] = 0;
+	x->scale = 1;
+}
+
+/* r = a * b, b applied first */
+static void skin_xform_mul(skin_xform_t * r, skin_xform_t const * a, skin_xform_t const * b) {
+	skin_xform_t out;
+	vec3 t;
+
+	quat_mul(out.rotation, a->rotation, b->rotation);
+	quat_mul_vec3(t, a->rotation, b->translation);
+	vec3_scale(t, t, a->scale);
+	vec3_add(out.translation, a->translation, t);
+	out.scale = a->scale * b->scale;
+
+	*r = out;
+}
+
+static void skin_xform_to_mat4x4(mat4x4 m, skin_xform_t const * x) {
+	mat4x4_from_quat(m, x->rotation);
+	for (int c = 0; c < 3; ++c) {
+		vec3_scale(m[c], m[c], x->scale);
+	}
+	m[3][0] = x->translation[0];
+	m[3][1] = x->translation[1];
+	m[3][2] = x->translation[2];
+}
+
+/* dual part is half the translation quaternion times the rotation */
+static void skin_xform_to_dq(skin_dq_t * dq, skin_xform_t const * x) {
+	quat t = { x->translation[0], x->translation[1], x->translation[2], 0 };
+
+	memcpy(dq->real, x->rotation, sizeof(quat));
+	quat_mul(dq->dual, t, x->rotation);
+	quat_scale(dq->dual, dq->dual, 0.5f);
+	dq->scale = x->scale;
+}
+
+/* shortest-path slerp, falling back to normalized lerp when the angle is tiny */
+static void skin_quat_slerp(quat r, quat const a, quat const b, float t) {
+	quat end;
+	float cosine = quat_mul_inner(a, b);
+
+	memcpy(end, b, sizeof(quat));
+	if (cosine < 0) {
+		quat_scale(end, end, -1);
+		cosine = -cosine;
+	}
+
+	float wa = 1 - t;
+	float wb = t;
+	if (cosine < 0.9995f) {
+		float angle = acosf(cosine);
+		float inv = 1.0f / sinf(angle);
+		wa = sinf(wa * angle) * inv;
+		wb = sinf(wb * angle) * inv;
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		r[i] = a[i] * wa + end[i] * wb;
+	}
+	quat_norm(r, r);
+}
+
+/* shortest-path normalized lerp, enough for blending poses that are already close */
+static void skin_quat_nlerp(quat r, quat const a, quat const b, float t) {
+	float sign = quat_mul_inner(a, b) < 0 ? -1.0f : 1.0f;
+
+	for (int i = 0; i < 4; ++i) {
+		r[i] = a[i] * (1 - t) + b[i] * t * sign;
+	}
+	quat_norm(r, r);
+}
+
+/* local pose of every joint at time, which wraps around the clip */
+static void skin_sample(skin_clip_t const * clip, float time, skin_xform_t * pose) {
+	if (clip->duration > 0) {
+		time = fmodf(time, clip->duration);
+		if (time < 0) {
+			time += clip->duration;
+		}
+	}
+
+	for (UINT j = 0; j < clip->joints; ++j) {
+		skin_track_t const * track = &clip->tracks[j];
+
+		if (track->keys == 0) {
+			skin_xform_identity(&pose[j]);
+			continue;
+		}
+
+		if (track->keys == 1 || time <= track->times[0]) {
+			pose[j] = track->poses[0];
+			continue;
+		}
+
+		if (time >= track->times[track->keys - 1]) {
+			pose[j] = track->poses[track->keys - 1];
+			continue;
+		}
+
+		/* last key at or before time */
+		UINT lo = 0;
+		UINT hi = track->keys - 1;
+		while (hi - lo > 1) {
+			UINT mid = (lo + hi) / 2;
+			if (track->times[mid] <= time) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+
+		skin_xform_t const * a = &track->poses[lo];
+		skin_xform_t const * b = &track->poses[hi];
+		float t = (time - track->times[lo]) / (track->times[hi] - track->times[lo]);
+
+		skin_quat_slerp(pose[j].rotation, a->rotation, b->rotation, t);
+		for (int i = 0; i < 3; ++i) {
+			pose[j].translation[i] = a->translation[i] + (b->translation[i] - a->translation[i]) * t;
+		}
+		pose[j].scale = a->scale + (b->scale - a->scale) * t;
+	}
+}
+
+/* out = a towards b by weight, out may alias either */
+static void skin_blend(skin_xform_t * out, skin_xform_t const * a, skin_xform_t const * b, float weight, UINT joints) {
+	for (UINT j = 0; j < joints; ++j) {
+		skin_xform_t r;
+
+		skin_quat_nlerp(r.rotation, a[j].rotation, b[j].rotation, weight);
+		for (int i = 0; i < 3; ++i) {
+			r.translation[i] = a[j].translation[i] + (b[j].translation[i] - a[j].translation[i]) * weight;
+		}
+		r.scale = a[j].scale + (b[j].scale - a[j].scale) * weight;
+
+		out[j] = r;
+	}
+}
+
+/* local pose to skinning transforms: model = parent model * local, skin = model * inverse bind */
+static void skin_build_palette(skin_skeleton_t const * skeleton, skin_xform_t const * pose, skin_palette_t * palette) {
+	skin_xform_t model[SKIN_MAX_JOINTS];
+
+	for (UINT j = 0; j < skeleton->joints; ++j) {
+		USHORT parent = skeleton->parent[j];
+		if (parent == SKIN_NO_PARENT) {
+			model[j] = pose[j];
+		} else {
+			skin_xform_mul(&model[j], &model[parent], &pose[j]);
+		}
+
+		skin_xform_t skin;
+		skin_xform_mul(&skin, &model[j], &skeleton->inverse_bind[j]);
+		skin_xform_to_mat4x4(palette->matrices[j], &skin);
+		skin_xform_to_dq(&palette->dq[j], &skin);
+	}
+}
+
+/* dot product broadcast to all lanes, SSE2 only */
+static __m128 skin_dot4(__m128 a, __m128 b) {
+	__m128 m = _mm_mul_ps(a, b);
+	m = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+/* xyz cross product, w comes out as 0 */
+static __m128 skin_cross(__m128 a, __m128 b) {
+	__m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+	return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+static void skin_store(vertex_t * out, __m128 pos, __m128 color, BOOL stream) {
+	if (stream) {
+		_mm_stream_ps(out->pos, pos);
+		_mm_stream_ps(out->color, color);
+	} else {
+		_mm_storeu_ps(out->pos, pos);
+		_mm_storeu_ps(out->color, color);
+	}
+}
+
+/* blended matrix per vertex, four columns at a time */
+static void skin_linear(skin_palette_t const * palette, skin_vertex_t const * in, UINT begin, UINT end, vertex_t * out, BOOL stream) {
+	for (UINT i = begin; i < end; ++i) {
+		skin_vertex_t const * v = &in[i];
+		__m128 col[4] = {
+			_mm_setzero_ps(),
+			_mm_setzero_ps(),
+			_mm_setzero_ps(),
+			_mm_setzero_ps(),
+		};
+
+		for (int k = 0; k < SKIN_INFLUENCES; ++k) {
+			float const * m = &palette->matrices[v->joints[k]][0][0];
+			__m128 w = _mm_set1_ps(v->weights[k]);
+			col[0] = _mm_add_ps(col[0], _mm_mul_ps(w, _mm_loadu_ps(m + 0)));
+			col[1] = _mm_add_ps(col[1], _mm_mul_ps(w, _mm_loadu_ps(m + 4)));
+			col[2] = _mm_add_ps(col[2], _mm_mul_ps(w, _mm_loadu_ps(m + 8)));
+			col[3] = _mm_add_ps(col[3], _mm_mul_ps(w, _mm_loadu_ps(m + 12)));
+		}
+
+		__m128 pos = _mm_mul_ps(col[0], _mm_set1_ps(v->pos[0]));
+		pos = _mm_add_ps(pos, _mm_mul_ps(col[1], _mm_set1_ps(v->pos[1])));
+		pos = _mm_add_ps(pos, _mm_mul_ps(col[2], _mm_set1_ps(v->pos[2])));
+		pos = _mm_add_ps(pos, _mm_mul_ps(col[3], _mm_set1_ps(v->pos[3])));
+
+		skin_store(&out[i], pos, _mm_loadu_ps(v->color), stream);
+	}
+
+	if (stream) {
+		_mm_sfence();
+	}
+}
+
+/*
+ * scalar linear blend skinning, operation for operation what cs_skin in main.hlsl does:
+ * palette columns blended per influence in order, then applied column by column
+ */
+static void skin_linear_reference(skin_palette_t const * palette, skin_vertex_t const * in, UINT count, vertex_t * out) {
+	for (UINT i = 0; i < count; ++i) {
+		skin_vertex_t const * v = &in[i];
+		float col[4][4] = { 0 };
+
+		for (int k = 0; k < SKIN_INFLUENCES; ++k) {
+			for (int c = 0; c < 4; ++c) {
+				for (int r = 0; r < 4; ++r) {
+					col[c][r] = col[c][r] + v->weights[k] * palette->matrices[v->joints[k]][c][r];
+				}
+			}
+		}
+
+		for (int r = 0; r < 4; ++r) {
+			out[i].pos[r] = col[0][r] * v->pos[0] + col[1][r] * v->pos[1] + col[2][r] * v->pos[2] + col[3][r] * v->pos[3];
+			out[i].color[r] = v->color[r];
+		}
+	}
+}
+
+/*
+ * dual quaternions blended with the sign of the first influence, normalized, then
+ * applied as rotate + translate; scale is blended linearly and applied first.
+ */
+static void skin_dual_quat(skin_palette_t const * palette, skin_vertex_t const * in, UINT begin, UINT end, vertex_t * out, BOOL stream) {
+	for (UINT i = begin; i < end; ++i) {
+		skin_vertex_t const * v = &in[i];
+		skin_dq_t const * first = &palette->dq[v->joints[0]];
+		__m128 pivot = _mm_loadu_ps(first->real);
+		__m128 sign = _mm_set1_ps(-0.0f);
+		__m128 real = _mm_setzero_ps();
+		__m128 dual = _mm_setzero_ps();
+		float scale = 0;
+
+		for (int k = 0; k < SKIN_INFLUENCES; ++k) {
+			skin_dq_t const * dq = &palette->dq[v->joints[k]];
+			__m128 r = _mm_loadu_ps(dq->real);
+			/* flip the weight when this rotation is in the other hemisphere from the first */
+			__m128 ws = _mm_xor_ps(_mm_set1_ps(v->weights[k]), _mm_and_ps(skin_dot4(r, pivot), sign));
+
+			real = _mm_add_ps(real, _mm_mul_ps(ws, r));
+			dual = _mm_add_ps(dual, _mm_mul_ps(ws, _mm_loadu_ps(dq->dual)));
+			scale += v->weights[k] * dq->scale;
+		}
+
+		__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(skin_dot4(real, real)));
+		real = _mm_mul_ps(real, inv);
+		dual = _mm_mul_ps(dual, inv);
+
+		/* translation = 2 * (r.w * d.xyz - d.w * r.xyz + r.xyz x d.xyz), w lanes are don't-care */
+		__m128 rw = _mm_shuffle_ps(real, real, _MM_SHUFFLE(3, 3, 3, 3));
+		__m128 dw = _mm_shuffle_ps(dual, dual, _MM_SHUFFLE(3, 3, 3, 3));
+		__m128 t = _mm_sub_ps(_mm_mul_ps(rw, dual), _mm_mul_ps(dw, real));
+		t = _mm_add_ps(t, skin_cross(real, dual));
+		t = _mm_add_ps(t, t);
+
+		/* p + 2 * r.xyz x (r.xyz x p + r.w * p) */
+		__m128 p = _mm_mul_ps(_mm_loadu_ps(v->pos), _mm_set1_ps(scale));
+		__m128 u = _mm_add_ps(skin_cross(real, p), _mm_mul_ps(rw, p));
+		u = skin_cross(real, u);
+		__m128 rotated = _mm_add_ps(p, _mm_add_ps(u, u));
+
+		__m128 w = _mm_set1_ps(v->pos[3]);
+		__m128 pos = _mm_add_ps(rotated, _mm_mul_ps(t, w));
+		/* keep the input w, the lanes above only hold xyz */
+		pos = _mm_shuffle_ps(pos, _mm_unpackhi_ps(pos, w), _MM_SHUFFLE(1, 0, 1, 0));
+		skin_store(&out[i], pos, _mm_loadu_ps(v->color), stream);
+	}
+
+	if (stream) {
+		_mm_sfence();
+	}
+}
+
+typedef struct skin_job {
+	skin_mode_t mode;
+	skin_palette_t const * palette;
+	skin_vertex_t const * in;
+	vertex_t * out;
+	BOOL stream;
+} skin_job_t;
+
+static void skin_range(void * user, UINT begin, UINT end) {
+	skin_job_t const * job = user;
+
+	if (job->mode == SKIN_DUAL_QUAT) {
+		skin_dual_quat(job->palette, job->in, begin, end, job->out, job->stream);
+	} else {
+		skin_linear(job->palette, job->in, begin, end, job->out, job->stream);
+	}
+}
+
+/*
+ * skins count vertices into out on the worker pool. upload is for mapped upload
+ * buffers, it switches to streaming stores when out is 16-byte aligned; leave it FALSE
+ * for cached memory that is read back, as main.c's culling copy is.
+ */
+static void skin_run(skin_mode_t mode, skin_palette_t const * palette, skin_vertex_t const * in, UINT count, vertex_t * out, BOOL upload) {
+	skin_job_t job = {
+		.mode = mode,
+		.palette = palette,
+		.in = in,
+		.out = out,
+		.stream = upload && ((UINT_PTR) out & 15) == 0,
+	};
+
+	jobs_parallel_for(count, SKIN_GRAIN, skin_range, &job);
+}
+
+#endif
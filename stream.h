@@ -0,0 +1,742 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "timer.h"
+#include "jobs.h"
+#include "bc.h"
+
+/*
+ * textures streamed out of a container that is memory-mapped whole. the container holds
+ * every mip of every texture already laid out the way a buffer-to-texture copy reads it,
+ * rows at a 256 byte pitch and mips at 512 byte offsets, so loading a mip is one memcpy
+ * from the mapping into an upload slot and one copy on the GPU. texels are RGBA8 or
+ * block compressed by bc.h when the container is built.
+ *
+ * a texture keeps a contiguous range of mips resident, from its finest resident mip down
+ * to 1x1. the tail, every mip of STREAM_TAIL_SIZE texels or less, loads first and is never
+ * evicted; finer mips are requested one at a time, coarse to fine, for the textures used
+ * most recently, and copied out of the mapping on the job pool. resident bytes and bytes
+ * in flight count against the budget, and a request that doesn't fit evicts the finest
+ * mip of the least recently used texture until it does.
+ *
+ * parsing and the residency policy are plain CPU code, the GPU work goes through the
+ * backend.
+ */
+
+/* "TXPK" */
+#define STREAM_MAGIC 0x4B505854u
+#define STREAM_VERSION 1
+#define STREAM_MAX_TEXTURES 64
+#define STREAM_MAX_MIPS 15
+/* D3D12_TEXTURE_DATA_PITCH_ALIGNMENT and D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT */
+#define STREAM_PITCH_ALIGN 256
+#define STREAM_PLACEMENT_ALIGN 512
+#define STREAM_TAIL_SIZE 32
+#define STREAM_SLOTS 4
+#define STREAM_NONE 0xFFFFFFFFu
+
+/* DXGI_FORMAT values, the block compressed ones are bc.h's */
+#define STREAM_FORMAT_RGBA8 28
+
+/*
+ * file layout: the header, a record per texture, a record per mip of every texture and
+ * then the mip data. the tables are sized so the mip records stay 8 byte aligned.
+ */
+typedef struct stream_pack_header {
+	UINT magic;
+	UINT version;
+	UINT textures;
+	/* mip records over all textures */
+	UINT mips;
+	/* of the whole file */
+	UINT64 size;
+} stream_pack_header_t;
+
+typedef struct stream_pack_texture {
+	UINT width;
+	UINT height;
+	UINT format;
+	UINT mips;
+	/* mip 0's index in the mip table */
+	UINT first_mip;
+	UINT pad;
+} stream_pack_texture_t;
+
+/* a copy footprint, rows counted in blocks for block compressed formats */
+typedef struct stream_pack_mip {
+	UINT64 offset;
+	UINT64 size;
+	UINT width;
+	UINT height;
+	UINT rows;
+	UINT row_bytes;
+	UINT row_pitch;
+	UINT pad;
+} stream_pack_mip_t;
+
+/* points into the mapping, which has to outlive it */
+typedef struct stream_pack {
+	BYTE const * data;
+	UINT64 size;
+	UINT texture_count;
+	stream_pack_texture_t const * textures;
+	stream_pack_mip_t const * mips;
+} stream_pack_t;
+
+/* texels per block edge, 0 for formats the container doesn't take */
+static UINT stream_format_block(UINT format, UINT * block_bytes) {
+	switch (format) {
+	case STREAM_FORMAT_RGBA8:
+		*block_bytes = 4;
+		return 1;
+	default:
+		*block_bytes = bc_block_bytes(format);
+		return *block_bytes != 0 ? 4 : 0;
+	}
+}
+
+static char const * stream_format_name(UINT format) {
+	return format == STREAM_FORMAT_RGBA8 ? "rgba8" : bc_format_name(format);
+}
+
+/* 0 for names that aren't rgba8 or one of bc.h's */
+static UINT stream_format_from_name(char const * name) {
+	return strcmp(name, "rgba8") == 0 ? STREAM_FORMAT_RGBA8 : bc_format_from_name(name);
+}
+
+static UINT64 stream_align(UINT64 value, UINT64 alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static UINT stream_mip_extent(UINT size, UINT mip) {
+	return size >> mip != 0 ? size >> mip : 1;
+}
+
+/* the first mip no larger than STREAM_TAIL_SIZE, or the smallest one */
+static UINT stream_tail(stream_pack_texture_t const * tex) {
+	UINT m = 0;
+	while (m + 1 < tex->mips && (stream_mip_extent(tex->width, m) > STREAM_TAIL_SIZE || stream_mip_extent(tex->height, m) > STREAM_TAIL_SIZE)) {
+		++m;
+	}
+	return m;
+}
+
+/*
+ * any mip down to the tail can be the largest of a resource, and a block compressed
+ * resource has to be whole blocks across and down; false for formats the container
+ * doesn't take
+ */
+static BOOL stream_block_aligned(stream_pack_texture_t const * tex) {
+	UINT block_bytes;
+	UINT block = stream_format_block(tex->format, &block_bytes);
+	if (block == 0) {
+		return FALSE;
+	}
+	for (UINT m = 0; m <= stream_tail(tex); ++m) {
+		if (stream_mip_extent(tex->width, m) % block != 0 || stream_mip_extent(tex->height, m) % block != 0) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/* everything but the offset */
+static int stream_footprint(UINT format, UINT width, UINT height, stream_pack_mip_t * mip) {
+	UINT block_bytes;
+	UINT block = stream_format_block(format, &block_bytes);
+	if (block == 0) {
+		return 1;
+	}
+
+	memset(mip, 0, sizeof(*mip));
+	mip->width = width;
+	mip->height = height;
+	mip->rows = (height + block - 1) / block;
+	mip->row_bytes = (width + block - 1) / block * block_bytes;
+	mip->row_pitch = (UINT) stream_align(mip->row_bytes, STREAM_PITCH_ALIGN);
+	mip->size = (UINT64) mip->row_pitch * mip->rows;
+	return 0;
+}
+
+/* checks every record against the size of the mapping, non-zero if anything is off */
+static int stream_pack_parse(stream_pack_t * pack, void const * data, UINT64 size) {
+	memset(pack, 0, sizeof(*pack));
+
+	stream_pack_header_t const * header = data;
+	if (data == NULL || size < sizeof(*header) || header->magic != STREAM_MAGIC || header->version != STREAM_VERSION || header->size != size) {
+		return 1;
+	}
+	if (header->textures == 0 || header->textures > STREAM_MAX_TEXTURES || header->mips > STREAM_MAX_TEXTURES * STREAM_MAX_MIPS) {
+		return 2;
+	}
+
+	UINT64 tables = sizeof(*header) + sizeof(stream_pack_texture_t) * header->textures + sizeof(stream_pack_mip_t) * header->mips;
+	if (tables > size) {
+		return 2;
+	}
+
+	stream_pack_texture_t const * textures = (stream_pack_texture_t const *) (header + 1);
+	stream_pack_mip_t const * mips = (stream_pack_mip_t const *) (textures + header->textures);
+	for (UINT t = 0; t < header->textures; ++t) {
+		stream_pack_texture_t const * tex = &textures[t];
+		UINT largest = tex->width > tex->height ? tex->width : tex->height;
+		if (tex->width == 0 || tex->height == 0 || tex->mips == 0 || tex->mips > STREAM_MAX_MIPS || largest >> (tex->mips - 1) == 0) {
+			return 3;
+		}
+		if (tex->first_mip > header->mips || tex->mips > header->mips - tex->first_mip) {
+			return 3;
+		}
+		if (!stream_block_aligned(tex)) {
+			return 3;
+		}
+
+		for (UINT m = 0; m < tex->mips; ++m) {
+			stream_pack_mip_t expect;
+			if (stream_footprint(tex->format, stream_mip_extent(tex->width, m), stream_mip_extent(tex->height, m), &expect) != 0) {
+				return 3;
+			}
+
+			stream_pack_mip_t const * mip = &mips[tex->first_mip + m];
+			if (mip->width != expect.width || mip->height != expect.height || mip->rows != expect.rows || mip->row_bytes != expect.row_bytes) {
+				return 4;
+			}
+			if (mip->row_pitch < mip->row_bytes || mip->row_pitch % STREAM_PITCH_ALIGN != 0 || mip->size != (UINT64) mip->row_pitch * mip->rows) {
+				return 4;
+			}
+			if (mip->offset % STREAM_PLACEMENT_ALIGN != 0 || mip->offset < tables || mip->offset > size || mip->size > size - mip->offset) {
+				return 4;
+			}
+		}
+	}
+
+	pack->data = data;
+	pack->size = size;
+	pack->texture_count = header->textures;
+	pack->textures = textures;
+	pack->mips = mips;
+	return 0;
+}
+
+typedef struct stream_source {
+	UINT width;
+	UINT height;
+	/* mip 0 as tightly packed RGBA8 rows */
+	BYTE const * rgba;
+} stream_source_t;
+
+/* 2x2 box filter, the last row or column repeats for odd sizes */
+static void stream_downsample(BYTE const * src, UINT src_width, UINT src_height, UINT src_pitch, BYTE * dst, UINT width, UINT height, UINT pitch) {
+	for (UINT y = 0; y < height; ++y) {
+		UINT y0 = y * 2 < src_height ? y * 2 : src_height - 1;
+		UINT y1 = y * 2 + 1 < src_height ? y * 2 + 1 : y0;
+		for (UINT x = 0; x < width; ++x) {
+			UINT x0 = x * 2 < src_width ? x * 2 : src_width - 1;
+			UINT x1 = x * 2 + 1 < src_width ? x * 2 + 1 : x0;
+			for (UINT c = 0; c < 4; ++c) {
+				UINT sum = src[y0 * src_pitch + x0 * 4 + c] + src[y0 * src_pitch + x1 * 4 + c] + src[y1 * src_pitch + x0 * 4 + c] + src[y1 * src_pitch + x1 * 4 + c];
+				dst[y * pitch + x * 4 + c] = (BYTE) ((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+/*
+ * lays out a container of textures with full mip chains, each mip filtered from the one
+ * above it in RGBA8 and then stored in `format`, block compressed at `quality` for bc.h's
+ * formats. returns a malloc'd block of *size bytes, NULL when out of memory, for formats
+ * the container doesn't take, or when a source is empty, too large for STREAM_MAX_MIPS
+ * or not whole blocks down to its tail.
+ */
+static void * stream_pack_build(stream_source_t const * sources, UINT count, UINT format, bc_quality_t quality, UINT64 * size) {
+	if (count == 0 || count > STREAM_MAX_TEXTURES) {
+		return NULL;
+	}
+
+	stream_pack_texture_t records[STREAM_MAX_TEXTURES];
+	UINT total_mips = 0;
+	UINT largest_source = 0;
+	for (UINT t = 0; t < count; ++t) {
+		UINT largest = sources[t].width > sources[t].height ? sources[t].width : sources[t].height;
+		if (largest == 0 || sources[t].rgba == NULL) {
+			return NULL;
+		}
+		records[t] = (stream_pack_texture_t) {
+			.width = sources[t].width,
+			.height = sources[t].height,
+			.format = format,
+			.mips = 1,
+			.first_mip = total_mips,
+		};
+		while (largest >> records[t].mips != 0) {
+			++records[t].mips;
+		}
+		if (records[t].mips > STREAM_MAX_MIPS || !stream_block_aligned(&records[t])) {
+			return NULL;
+		}
+		total_mips += records[t].mips;
+		if (sources[t].width * sources[t].height > largest_source) {
+			largest_source = sources[t].width * sources[t].height;
+		}
+	}
+
+	UINT64 tables = sizeof(stream_pack_header_t) + sizeof(stream_pack_texture_t) * count + sizeof(stream_pack_mip_t) * total_mips;
+	stream_pack_mip_t * mips = malloc(sizeof(stream_pack_mip_t) * total_mips);
+	/* each mip in RGBA8, filtered from the previous one */
+	BYTE * scratch[2] = { malloc((SIZE_T) largest_source * 4), malloc((SIZE_T) largest_source * 4) };
+	if (mips == NULL || scratch[0] == NULL || scratch[1] == NULL) {
+		free(mips);
+		free(scratch[0]);
+		free(scratch[1]);
+		return NULL;
+	}
+
+	UINT64 end = stream_align(tables, STREAM_PLACEMENT_ALIGN);
+	for (UINT t = 0, index = 0; t < count; ++t) {
+		for (UINT m = 0; m < records[t].mips; ++m, ++index) {
+			stream_footprint(format, stream_mip_extent(sources[t].width, m), stream_mip_extent(sources[t].height, m), &mips[index]);
+			mips[index].offset = end;
+			end = stream_align(end + mips[index].size, STREAM_PLACEMENT_ALIGN);
+		}
+	}
+
+	/* zeroed, so padding is the same in every build */
+	BYTE * data = calloc(1, end);
+	if (data == NULL) {
+		free(mips);
+		free(scratch[0]);
+		free(scratch[1]);
+		return NULL;
+	}
+
+	stream_pack_header_t * header = (stream_pack_header_t *) data;
+	*header = (stream_pack_header_t) {
+		.magic = STREAM_MAGIC,
+		.version = STREAM_VERSION,
+		.textures = count,
+		.mips = total_mips,
+		.size = end,
+	};
+
+	stream_pack_texture_t * textures = (stream_pack_texture_t *) (header + 1);
+	memcpy(textures, records, sizeof(stream_pack_texture_t) * count);
+	for (UINT t = 0; t < count; ++t) {
+		stream_pack_mip_t const * chain = &mips[records[t].first_mip];
+		for (UINT m = 0; m < records[t].mips; ++m) {
+			BYTE const * rgba = m == 0 ? sources[t].rgba : scratch[m & 1];
+			if (m > 0) {
+				BYTE const * above = m == 1 ? sources[t].rgba : scratch[(m - 1) & 1];
+				stream_downsample(above, chain[m - 1].width, chain[m - 1].height, chain[m - 1].width * 4, scratch[m & 1], chain[m].width, chain[m].height, chain[m].width * 4);
+			}
+
+			if (format == STREAM_FORMAT_RGBA8) {
+				for (UINT y = 0; y < chain[m].height; ++y) {
+					memcpy(data + chain[m].offset + (UINT64) y * chain[m].row_pitch, rgba + (SIZE_T) y * chain[m].width * 4, chain[m].row_bytes);
+				}
+			} else {
+				bc_encode(format, quality, rgba, chain[m].width, chain[m].height, chain[m].width * 4, data + chain[m].offset, chain[m].row_pitch);
+			}
+		}
+	}
+	memcpy(textures + count, mips, sizeof(stream_pack_mip_t) * total_mips);
+
+	free(mips);
+	free(scratch[0]);
+	free(scratch[1]);
+	*size = end;
+	return data;
+}
+
+typedef struct stream_backend {
+	/* CPU address of an upload slot of staging_bytes, called from the job pool */
+	BYTE * (* staging)(void * user, UINT slot);
+	/*
+	 * replaces the texture's resource with one holding mips first to the last, copying
+	 * the mips it has in common with the old one, which held old_first to the last.
+	 * old_first is the mip count when nothing was resident. the old resource is retired
+	 * on the fence of the work being recorded.
+	 */
+	int (* resize)(void * user, UINT texture, UINT first, UINT old_first);
+	/* copies a mip at offset in an upload slot into the resource resize just created */
+	int (* upload)(void * user, UINT texture, UINT mip, UINT slot, UINT64 offset);
+	/* after resize and its uploads, the texture samples from first on */
+	int (* bind)(void * user, UINT texture, UINT first);
+	/* the fence value the work being recorded completes with */
+	UINT64 (* fence)(void * user);
+	UINT64 (* completed)(void * user);
+	void * user;
+} stream_backend_t;
+
+typedef struct stream_texture {
+	/* finest resident mip, the mip count while nothing is resident */
+	UINT first;
+	/* first mip of the tail */
+	UINT tail;
+	/* finest mip asked for in the frame it was last used */
+	UINT wanted;
+	UINT64 last_used;
+	BOOL loading;
+	/* since when the texture wants a finer mip than it has, 0 when it doesn't */
+	LONGLONG want_start;
+} stream_texture_t;
+
+typedef enum stream_slot_state {
+	STREAM_SLOT_FREE,
+	STREAM_SLOT_LOADING,
+	STREAM_SLOT_LOADED,
+	/* uploaded, waiting for the GPU to finish reading it */
+	STREAM_SLOT_RETIRING,
+} stream_slot_state_t;
+
+typedef struct stream_slot {
+	struct stream * stream;
+	volatile LONG state;
+	UINT texture;
+	/* the request loads mips first up to but not including last */
+	UINT first;
+	UINT last;
+	UINT64 bytes;
+	UINT64 fence;
+} stream_slot_t;
+
+typedef struct stream_stats {
+	UINT64 requests;
+	/* mip bytes copied out of the container */
+	UINT64 bytes;
+	UINT64 evictions;
+	UINT64 evicted_bytes;
+	/* updates that held a request back because nothing could be evicted for it */
+	UINT64 budget_stalls;
+	UINT64 peak_resident;
+	/* time the load jobs spent copying out of the mapping, page faults included */
+	volatile LONG64 load_ticks;
+	/* a texture going from wanting a finer mip to having it */
+	UINT64 upgrades;
+	double upgrade_ms;
+	double upgrade_max_ms;
+	/* from stream_init until every texture in use first had the mips it wanted, 0 until then */
+	double full_quality_ms;
+} stream_stats_t;
+
+typedef struct stream {
+	stream_pack_t const * pack;
+	stream_backend_t backend;
+	UINT64 budget;
+	UINT64 staging_bytes;
+	/* resident mips, and the ones being loaded */
+	UINT64 resident;
+	stream_texture_t textures[STREAM_MAX_TEXTURES];
+	stream_slot_t slots[STREAM_SLOTS];
+	volatile LONG pending;
+	LONGLONG start;
+	stream_stats_t stats;
+} stream_t;
+
+static UINT64 stream_mip_bytes(stream_t const * s, UINT texture, UINT first, UINT last) {
+	stream_pack_texture_t const * tex = &s->pack->textures[texture];
+	UINT64 bytes = 0;
+	for (UINT m = first; m < last; ++m) {
+		bytes += s->pack->mips[tex->first_mip + m].size;
+	}
+	return bytes;
+}
+
+/* upload space a request for these mips takes, each at the placement alignment */
+static UINT64 stream_request_bytes(stream_pack_t const * pack, UINT texture, UINT first, UINT last) {
+	stream_pack_texture_t const * tex = &pack->textures[texture];
+	UINT64 bytes = 0;
+	for (UINT m = first; m < last; ++m) {
+		bytes += stream_align(pack->mips[tex->first_mip + m].size, STREAM_PLACEMENT_ALIGN);
+	}
+	return bytes;
+}
+
+/* the upload slot size that fits any single request: a tail, or one mip above it */
+static UINT64 stream_staging_size(stream_pack_t const * pack) {
+	UINT64 largest = 0;
+	for (UINT t = 0; t < pack->texture_count; ++t) {
+		stream_pack_texture_t const * tex = &pack->textures[t];
+		UINT tail = stream_tail(tex);
+		UINT64 bytes = stream_request_bytes(pack, t, tail, tex->mips);
+		largest = bytes > largest ? bytes : largest;
+		for (UINT m = 0; m < tail; ++m) {
+			bytes = stream_request_bytes(pack, t, m, m + 1);
+			largest = bytes > largest ? bytes : largest;
+		}
+	}
+	return largest;
+}
+
+/* the coarsest mip still at least extent texels across, for a texture covering extent pixels */
+static UINT stream_wanted_mip(stream_pack_t const * pack, UINT texture, UINT extent) {
+	stream_pack_texture_t const * tex = &pack->textures[texture];
+	UINT largest = tex->width > tex->height ? tex->width : tex->height;
+	UINT m = 0;
+	while (m + 1 < tex->mips && largest >> (m + 1) >= extent) {
+		++m;
+	}
+	return m;
+}
+
+/* fails if the tails alone are over the budget or a request wouldn't fit staging_bytes */
+static int stream_init(stream_t * s, stream_pack_t const * pack, UINT64 budget, UINT64 staging_bytes, stream_backend_t backend) {
+	memset(s, 0, sizeof(*s));
+	s->pack = pack;
+	s->backend = backend;
+	s->budget = budget;
+	s->staging_bytes = staging_bytes;
+	s->start = timer_now();
+
+	UINT64 tails = 0;
+	for (UINT t = 0; t < pack->texture_count; ++t) {
+		stream_pack_texture_t const * tex = &pack->textures[t];
+		stream_texture_t * st = &s->textures[t];
+		st->tail = stream_tail(tex);
+		st->first = tex->mips;
+		st->wanted = st->tail;
+		tails += stream_mip_bytes(s, t, st->tail, tex->mips);
+	}
+	for (UINT i = 0; i < STREAM_SLOTS; ++i) {
+		s->slots[i].stream = s;
+		s->slots[i].state = STREAM_SLOT_FREE;
+	}
+
+	if (tails > budget) {
+		return 1;
+	}
+	return stream_staging_size(pack) > staging_bytes ? 2 : 0;
+}
+
+/* frames count from 1; the finest mip wins when a texture is used more than once a frame */
+static void stream_use(stream_t * s, UINT texture, UINT mip, UINT64 frame) {
+	stream_texture_t * st = &s->textures[texture];
+	if (mip > st->tail) {
+		mip = st->tail;
+	}
+	if (st->last_used != frame || mip < st->wanted) {
+		st->wanted = mip;
+	}
+	st->last_used = frame;
+}
+
+static void stream_load_job(void * user) {
+	stream_slot_t * slot = user;
+	stream_t * s = slot->stream;
+	LONGLONG start = timer_now();
+
+	BYTE * dst = s->backend.staging(s->backend.user, (UINT) (slot - s->slots));
+	stream_pack_texture_t const * tex = &s->pack->textures[slot->texture];
+	UINT64 offset = 0;
+	for (UINT m = slot->first; m < slot->last; ++m) {
+		stream_pack_mip_t const * mip = &s->pack->mips[tex->first_mip + m];
+		memcpy(dst + offset, s->pack->data + mip->offset, mip->size);
+		offset += stream_align(mip->size, STREAM_PLACEMENT_ALIGN);
+	}
+
+	InterlockedAdd64(&s->stats.load_ticks, timer_now() - start);
+	InterlockedExchange(&slot->state, STREAM_SLOT_LOADED);
+	InterlockedDecrement(&s->pending);
+}
+
+/* 1 if a mip was dropped, 0 if nothing can be, -1 if the backend failed */
+static int stream_evict(stream_t * s, UINT64 frame) {
+	UINT victim = STREAM_NONE;
+	for (UINT t = 0; t < s->pack->texture_count; ++t) {
+		stream_texture_t const * st = &s->textures[t];
+		if (st->loading || st->first >= st->tail) {
+			continue;
+		}
+		/* in use this frame and not holding more than it wants */
+		if (st->last_used == frame && st->first >= st->wanted) {
+			continue;
+		}
+
+		stream_texture_t const * v = victim != STREAM_NONE ? &s->textures[victim] : NULL;
+		if (v == NULL || st->last_used < v->last_used || (st->last_used == v->last_used && st->first < v->first)) {
+			victim = t;
+		}
+	}
+	if (victim == STREAM_NONE) {
+		return 0;
+	}
+
+	stream_texture_t * st = &s->textures[victim];
+	if (s->backend.resize(s->backend.user, victim, st->first + 1, st->first) != 0 || s->backend.bind(s->backend.user, victim, st->first + 1) != 0) {
+		return -1;
+	}
+
+	UINT64 bytes = stream_mip_bytes(s, victim, st->first, st->first + 1);
+	++st->first;
+	s->resident -= bytes;
+	++s->stats.evictions;
+	s->stats.evicted_bytes += bytes;
+	return 1;
+}
+
+/* the texture most worth a request: missing tails first, then the most recently used */
+static UINT stream_next_request(stream_t const * s, UINT64 frame) {
+	UINT best = STREAM_NONE;
+	for (UINT t = 0; t < s->pack->texture_count; ++t) {
+		stream_texture_t const * st = &s->textures[t];
+		BOOL no_tail = st->first > st->tail;
+		if (st->loading || (!no_tail && (st->last_used != frame || st->first <= st->wanted))) {
+			continue;
+		}
+		if (best == STREAM_NONE) {
+			best = t;
+			continue;
+		}
+
+		stream_texture_t const * b = &s->textures[best];
+		BOOL best_no_tail = b->first > b->tail;
+		if (no_tail != best_no_tail) {
+			best = no_tail ? t : best;
+		} else if (st->last_used != b->last_used) {
+			best = st->last_used > b->last_used ? t : best;
+		} else if (st->first - st->wanted > b->first - b->wanted) {
+			best = t;
+		}
+	}
+	return best;
+}
+
+/*
+ * once per frame, while the frame's work is recorded: swaps in what the load jobs
+ * finished, frees upload slots the GPU is done with and issues new requests.
+ */
+static int stream_update(stream_t * s, UINT64 frame) {
+	LONGLONG now = timer_now();
+	UINT64 completed = s->backend.completed(s->backend.user);
+
+	for (UINT i = 0; i < STREAM_SLOTS; ++i) {
+		stream_slot_t * slot = &s->slots[i];
+		if (ReadAcquire(&slot->state) == STREAM_SLOT_LOADED) {
+			stream_texture_t * st = &s->textures[slot->texture];
+			if (s->backend.resize(s->backend.user, slot->texture, slot->first, st->first) != 0) {
+				return 1;
+			}
+			UINT64 offset = 0;
+			for (UINT m = slot->first; m < slot->last; ++m) {
+				if (s->backend.upload(s->backend.user, slot->texture, m, i, offset) != 0) {
+					return 1;
+				}
+				offset += stream_align(s->pack->mips[s->pack->textures[slot->texture].first_mip + m].size, STREAM_PLACEMENT_ALIGN);
+			}
+			if (s->backend.bind(s->backend.user, slot->texture, slot->first) != 0) {
+				return 1;
+			}
+
+			st->first = slot->first;
+			st->loading = FALSE;
+			s->stats.bytes += slot->bytes;
+			slot->fence = s->backend.fence(s->backend.user);
+			slot->state = STREAM_SLOT_RETIRING;
+		} else if (slot->state == STREAM_SLOT_RETIRING && completed >= slot->fence) {
+			slot->state = STREAM_SLOT_FREE;
+		}
+	}
+
+	BOOL used = FALSE;
+	BOOL full = TRUE;
+	for (UINT t = 0; t < s->pack->texture_count; ++t) {
+		stream_texture_t * st = &s->textures[t];
+		if (st->last_used != frame) {
+			continue;
+		}
+
+		used = TRUE;
+		if (st->first > st->wanted) {
+			full = FALSE;
+			if (st->want_start == 0) {
+				st->want_start = now;
+			}
+		} else if (st->want_start != 0) {
+			double ms = timer_ms(now - st->want_start);
+			++s->stats.upgrades;
+			s->stats.upgrade_ms += ms;
+			s->stats.upgrade_max_ms = ms > s->stats.upgrade_max_ms ? ms : s->stats.upgrade_max_ms;
+			st->want_start = 0;
+		}
+	}
+	if (used && full && s->stats.full_quality_ms == 0) {
+		s->stats.full_quality_ms = timer_ms(now - s->start);
+	}
+
+	for (UINT i = 0; i < STREAM_SLOTS; ++i) {
+		stream_slot_t * slot = &s->slots[i];
+		if (slot->state != STREAM_SLOT_FREE) {
+			continue;
+		}
+
+		UINT t = stream_next_request(s, frame);
+		if (t == STREAM_NONE) {
+			break;
+		}
+
+		stream_texture_t * st = &s->textures[t];
+		UINT first = st->first > st->tail ? st->tail : st->first - 1;
+		UINT last = st->first > st->tail ? s->pack->textures[t].mips : st->first;
+		UINT64 bytes = stream_mip_bytes(s, t, first, last);
+
+		/* tails are always allowed in, stream_init checked they fit */
+		while (first < st->tail && s->resident + bytes > s->budget) {
+			int evicted = stream_evict(s, frame);
+			if (evicted < 0) {
+				return 1;
+			}
+			if (evicted == 0) {
+				break;
+			}
+		}
+		if (first < st->tail && s->resident + bytes > s->budget) {
+			++s->stats.budget_stalls;
+			break;
+		}
+
+		slot->texture = t;
+		slot->first = first;
+		slot->last = last;
+		slot->bytes = bytes;
+		slot->state = STREAM_SLOT_LOADING;
+		st->loading = TRUE;
+		s->resident += bytes;
+		if (s->resident > s->stats.peak_resident) {
+			s->stats.peak_resident = s->resident;
+		}
+		++s->stats.requests;
+
+		InterlockedIncrement(&s->pending);
+		jobs_push(stream_load_job, slot);
+	}
+
+	return 0;
+}
+
+/* waits for the load jobs, the backend still owns the resources */
+static void stream_destroy(stream_t * s) {
+	jobs_wait(&s->pending);
+}
+
+static void stream_report(stream_t const * s, FILE * fp) {
+	stream_stats_t const * st = &s->stats;
+	double mib = 1.0 / (1024.0 * 1024.0);
+	double load_ms = timer_ms(st->load_ticks);
+	fprintf(fp, "stream: %.1f of %.1f MiB resident (peak %.1f), %llu requests, %.1f MiB streamed at %.0f MiB/s out of the container, %llu evictions (%.1f MiB), %llu budget stalls\n", (double) s->resident * mib, (double) s->budget * mib, (double) st->peak_resident * mib, (unsigned long long) st->requests, (double) st->bytes * mib, load_ms > 0 ? (double) st->bytes * mib * 1000.0 / load_ms : 0.0, (unsigned long long) st->evictions, (double) st->evicted_bytes * mib, (unsigned long long) st->budget_stalls);
+	if (st->full_quality_ms > 0) {
+		fprintf(fp, "stream: full quality %.1f ms after start, %llu upgrades taking %.2f ms on average, %.2f ms at most\n", st->full_quality_ms, (unsigned long long) st->upgrades, st->upgrades > 0 ? st->upgrade_ms / (double) st->upgrades : 0.0, st->upgrade_max_ms);
+	} else {
+		fprintf(fp, "stream: never at full quality\n");
+	}
+	for (UINT t = 0; t < s->pack->texture_count; ++t) {
+		stream_pack_texture_t const * tex = &s->pack->textures[t];
+		stream_texture_t const * tt = &s->textures[t];
+		if (tt->first < tex->mips) {
+			fprintf(fp, "  texture %u: %ux%u %s, mips %u to %u of %u resident, wants %u\n", t, tex->width, tex->height, stream_format_name(tex->format), tt->first, tex->mips - 1, tex->mips, tt->wanted);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <windows.h>
+
+static LONGLONG timer_now(void) {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+static double timer_ms(LONGLONG ticks) {
+	static LONGLONG freq = 0;
+	if (freq == 0) {
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		freq = f.QuadPart;
+	}
+
+	return (double) ticks * 1000.0 / (double) freq;
+}
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "timer.h"
+#include "jobs.h"
+
+/*
+ * scoped CPU zones and counters for finding hitches. every thread of the job pool writes
+ * to its own ring of events, so recording is two timer reads and a store with no lock;
+ * a full ring overwrites its oldest events. trace_export writes whatever the rings still
+ * hold as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev), on demand or when a
+ * frame runs over the slow-frame threshold.
+ *
+ * names are not copied, they have to be string literals or otherwise outlive the trace.
+ */
+
+#define TRACE_EVENTS 16384
+#define TRACE_THREADS (JOBS_MAX_THREADS + 1)
+#define TRACE_CALIBRATION_ZONES 4096
+/* frames to skip after a slow-frame dump, so one long hitch doesn't write a file per frame */
+#define TRACE_SLOW_COOLDOWN 120
+
+typedef enum trace_kind {
+	TRACE_ZONE_EVENT,
+	TRACE_COUNTER_EVENT,
+} trace_kind_t;
+
+typedef struct trace_event {
+	char const * name;
+	LONGLONG start;
+	union {
+		LONGLONG end;
+		double value;
+	};
+	UINT kind;
+	UINT pad;
+} trace_event_t;
+
+/* one cache line apart, a ring is only ever written by its own thread */
+typedef struct trace_ring {
+	trace_event_t * events;
+	/* events ever written, the newest TRACE_EVENTS of them are still in the ring */
+	volatile UINT64 head;
+	BYTE pad[64 - sizeof(void *) - sizeof(UINT64)];
+} trace_ring_t;
+
+struct {
+	trace_ring_t rings[TRACE_THREADS];
+	UINT threads;
+	BOOL enabled;
+	LONGLONG origin;
+
+	/* measured in trace_init by recording into the main thread's ring */
+	double zone_ns;
+
+	/* frames over slow_ms are dumped, 0 turns the trigger off */
+	double slow_ms;
+	LONGLONG frame_start;
+	UINT frame;
+	UINT cooldown;
+	UINT dumps;
+} static trace = {
+	.threads = 0,
+	.enabled = FALSE,
+	.origin = 0,
+	.zone_ns = 0,
+	.slow_ms = 0,
+	.frame_start = 0,
+	.frame = 0,
+	.cooldown = 0,
+	.dumps = 0,
+};
+
+/* 0 when tracing is off, so the matching trace_end records nothing */
+static LONGLONG trace_begin(void) {
+	return trace.enabled ? timer_now() : 0;
+}
+
+/* single writer per ring: the slot is filled before head is published past it with a full barrier */
+static void trace_push(trace_event_t const * event) {
+	UINT t = jobs_thread_index();
+	if (t >= trace.threads) {
+		return;
+	}
+
+	trace_ring_t * ring = &trace.rings[t];
+	UINT64 head = ring->head;
+	ring->events[head & (TRACE_EVENTS - 1)] = *event;
+	InterlockedExchange64((LONG64 volatile *) &ring->head, (LONG64) (head + 1));
+}
+
+static void trace_end(char const * name, LONGLONG start) {
+	if (start == 0 || !trace.enabled) {
+		return;
+	}
+
+	trace_event_t e = {
+		.name = name,
+		.start = start,
+		.end = timer_now(),
+		.kind = TRACE_ZONE_EVENT,
+	};
+	trace_push(&e);
+}
+
+static void trace_counter(char const * name, double value) {
+	if (!trace.enabled) {
+		return;
+	}
+
+	trace_event_t e = {
+		.name = name,
+		.start = timer_now(),
+		.value = value,
+		.kind = TRACE_COUNTER_EVENT,
+	};
+	trace_push(&e);
+}
+
+/*
+ * zone around the statement or block that follows: TRACE_ZONE("present") { ... }
+ * leaving it with return, break or goto skips the end, so the zone is dropped
+ */
+#define TRACE_ZONE(name) for (LONGLONG trace_start_ = trace_begin(), trace_once_ = 1; trace_once_ != 0; trace_once_ = 0, trace_end((name), trace_start_))
+
+/* one ring per thread of the job pool, so it has to come after jobs_init */
+static int trace_init(void) {
+	trace.threads = jobs_thread_count();
+	for (UINT t = 0; t < trace.threads; ++t) {
+		trace.rings[t].events = malloc(sizeof(trace_event_t) * TRACE_EVENTS);
+		trace.rings[t].head = 0;
+		if (trace.rings[t].events == NULL) {
+			return 1;
+		}
+	}
+
+	trace.origin = timer_now();
+	trace.enabled = TRUE;
+
+	/* the first pass faults the ring's pages in, the second is timed */
+	for (UINT pass = 0; pass < 2; ++pass) {
+		LONGLONG start = timer_now();
+		for (UINT i = 0; i < TRACE_CALIBRATION_ZONES; ++i) {
+			LONGLONG zone = trace_begin();
+			trace_end("calibration", zone);
+		}
+		trace.zone_ns = timer_ms(timer_now() - start) * 1e6 / TRACE_CALIBRATION_ZONES;
+	}
+	trace.rings[0].head = 0;
+
+	return 0;
+}
+
+static void trace_destroy(void) {
+	for (UINT t = 0; t < TRACE_THREADS; ++t) {
+		free(trace.rings[t].events);
+		trace.rings[t].events = NULL;
+		trace.rings[t].head = 0;
+	}
+	trace.threads = 0;
+	trace.enabled = FALSE;
+}
+
+static double trace_us(LONGLONG ticks) {
+	return timer_ms(ticks - trace.origin) * 1000.0;
+}
+
+/*
+ * writes every event still in the rings. other threads may keep recording: events are
+ * copied out first and the ones that were overwritten during the copy are dropped,
+ * along with the oldest of a full ring, whose slot the next event goes into.
+ * returns the number of events written, -1 if out of memory.
+ */
+static int trace_export(FILE * fp) {
+	trace_event_t * copy = malloc(sizeof(trace_event_t) * TRACE_EVENTS);
+	if (copy == NULL) {
+		return -1;
+	}
+
+	int written = 0;
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"zone_ns\":%.1f},\"traceEvents\":[\n", trace.zone_ns);
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"d3d12-triangle\"}}");
+
+	for (UINT t = 0; t < trace.threads; ++t) {
+		trace_ring_t * ring = &trace.rings[t];
+		if (t == 0) {
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}}");
+		} else {
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"worker %u\"}}", t, t);
+		}
+
+		UINT64 head = ring->head;
+		UINT64 first = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+		for (UINT64 i = first; i < head; ++i) {
+			copy[i - first] = ring->events[i & (TRACE_EVENTS - 1)];
+		}
+		/* the writer may be filling the slot of event after, which held event after - TRACE_EVENTS */
+		MemoryBarrier();
+		UINT64 after = ring->head;
+		UINT64 valid = after + 1 > TRACE_EVENTS ? after + 1 - TRACE_EVENTS : 0;
+
+		for (UINT64 i = valid > first ? valid : first; i < head; ++i) {
+			trace_event_t const * e = &copy[i - first];
+			if (e->kind == TRACE_ZONE_EVENT) {
+				fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", e->name, t, trace_us(e->start), timer_ms(e->end - e->start) * 1000.0);
+			} else {
+				fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%g}}", e->name, t, trace_us(e->start), e->value);
+			}
+			++written;
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+	free(copy);
+	return written;
+}
+
+static int trace_dump(char const * reason) {
+	char path[64];
+	snprintf(path, sizeof(path), "trace-%u-%s.json", trace.frame, reason);
+	FILE * fp = fopen(path, "wb");
+	if (fp == NULL) {
+		return 1;
+	}
+
+	int written = trace_export(fp);
+	fclose(fp);
+	if (written < 0) {
+		return 1;
+	}
+
+	++trace.dumps;
+	fprintf(stderr, "trace: %d events written to %s\n", written, path);
+	return 0;
+}
+
+/*
+ * closes the frame zone opened by the previous call and opens the next one. returns 1
+ * when the frame that just ended ran over slow_ms and the caller should dump.
+ */
+static int trace_frame(void) {
+	if (!trace.enabled) {
+		return 0;
+	}
+
+	LONGLONG now = timer_now();
+	int slow = 0;
+	if (trace.frame_start != 0) {
+		trace_end("frame", trace.frame_start);
+		if (trace.cooldown > 0) {
+			--trace.cooldown;
+		} else if (trace.slow_ms > 0 && timer_ms(now - trace.frame_start) > trace.slow_ms) {
+			trace.cooldown = TRACE_SLOW_COOLDOWN;
+			slow = 1;
+		}
+	}
+
+	++trace.frame;
+	trace.frame_start = now;
+	return slow;
+}
+
+static void trace_report(FILE * fp) {
+	UINT64 events = 0;
+	UINT64 overwritten = 0;
+	for (UINT t = 0; t < trace.threads; ++t) {
+		UINT64 head = trace.rings[t].head;
+		events += head;
+		overwritten += head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+	}
+
+	fprintf(fp, "trace: %llu events on %u threads, %llu overwritten, %.1f ns per zone, %u dumps\n", (unsigned long long) events, trace.threads, (unsigned long long) overwritten, trace.zone_ns, trace.dumps);
+}
+
+#endif
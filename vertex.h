@@ -0,0 +1,9 @@
+#ifndef VERTEX_H
+#define VERTEX_H
+
+typedef struct vertex {
+	float pos[4];
+	float color[4];
+} vertex_t;
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+#include "timer.h"
+
+/*
+ * a set of render targets drawn every frame from one device and queue: windows with
+ * their own swapchain, or headless targets that are plain textures. each viewport has a
+ * ring of back buffers with a fence per slot, and a slot is only recorded into again
+ * once its fence has passed. all viewports record first and their command lists go out
+ * in a single submission, then the windows present.
+ *
+ * the backend owns the API objects; a viewport carries an opaque target pointer and the
+ * first of its VIEWPORT_FRAMES descriptor slots.
+ */
+
+#define VIEWPORT_MAX 16
+#define VIEWPORT_FRAMES 3
+#define VIEWPORT_NONE 0xFFFFFFFFu
+
+typedef enum viewport_kind {
+	VIEWPORT_WINDOW,
+	VIEWPORT_HEADLESS,
+} viewport_kind_t;
+
+typedef struct viewport {
+	viewport_kind_t kind;
+	UINT width;
+	UINT height;
+	/* back buffers in the ring, at most VIEWPORT_FRAMES */
+	UINT frames;
+	UINT slot;
+	UINT64 fences[VIEWPORT_FRAMES];
+	/* first render target descriptor of the ring, VIEWPORT_FRAMES per viewport */
+	UINT rtv_base;
+	BOOL open;
+
+	/* backend state, and the list the backend recorded this frame */
+	void * target;
+	void * list;
+
+	UINT64 drawn;
+	double record_ms;
+	double present_ms;
+} viewport_t;
+
+typedef struct viewport_backend {
+	int (* create)(void * user, UINT index, viewport_t * vp);
+	void (* destroy)(void * user, UINT index, viewport_t * vp);
+	/* records the viewport's commands for its current slot and sets vp->list */
+	int (* record)(void * user, UINT index, viewport_t * vp);
+	int (* present)(void * user, UINT index, viewport_t * vp);
+	/* used by viewport_set_frame only, callers that batch with their own lists submit themselves */
+	int (* submit)(void * user, void * const * lists, UINT count);
+	UINT64 (* signal)(void * user);
+	UINT64 (* completed)(void * user);
+	int (* wait)(void * user, UINT64 fence);
+	void * user;
+} viewport_backend_t;
+
+typedef struct viewport_stats {
+	UINT64 frames;
+	/* viewports drawn over all frames, the per-viewport figures divide by this */
+	UINT64 drawn;
+	UINT64 waits;
+	double record_ms;
+	double present_ms;
+	double submit_ms;
+	double wait_ms;
+} viewport_stats_t;
+
+typedef struct viewport_set {
+	viewport_t viewports[VIEWPORT_MAX];
+	UINT count;
+	viewport_backend_t backend;
+
+	/* the lists recorded by viewport_set_begin, in viewport order */
+	void * lists[VIEWPORT_MAX];
+	UINT list_count;
+
+	viewport_stats_t stats;
+} viewport_set_t;
+
+static void viewport_set_init(viewport_set_t * set, viewport_backend_t backend) {
+	memset(set, 0, sizeof(*set));
+	set->backend = backend;
+}
+
+/* returns the viewport's index, VIEWPORT_NONE if the set is full or the backend failed */
+static UINT viewport_add(viewport_set_t * set, viewport_kind_t kind, UINT width, UINT height, UINT frames) {
+	UINT index = VIEWPORT_NONE;
+	for (UINT i = 0; i < VIEWPORT_MAX; ++i) {
+		if (!set->viewports[i].open) {
+			index = i;
+			break;
+		}
+	}
+	if (index == VIEWPORT_NONE) {
+		return VIEWPORT_NONE;
+	}
+
+	viewport_t * vp = &set->viewports[index];
+	memset(vp, 0, sizeof(*vp));
+	vp->kind = kind;
+	vp->width = width;
+	vp->height = height;
+	vp->frames = frames < 1 ? 1 : frames > VIEWPORT_FRAMES ? VIEWPORT_FRAMES : frames;
+	vp->rtv_base = index * VIEWPORT_FRAMES;
+	if (set->backend.create(set->backend.user, index, vp) != 0) {
+		return VIEWPORT_NONE;
+	}
+
+	vp->open = TRUE;
+	if (index >= set->count) {
+		set->count = index + 1;
+	}
+	return index;
+}
+
+static void viewport_wait(viewport_set_t * set, UINT64 fence) {
+	if (fence == 0 || set->backend.completed(set->backend.user) >= fence) {
+		return;
+	}
+
+	LONGLONG start = timer_now();
+	set->backend.wait(set->backend.user, fence);
+	++set->stats.waits;
+	set->stats.wait_ms += timer_ms(timer_now() - start);
+}
+
+/* waits for everything the viewport has in flight before the backend frees it */
+static void viewport_remove(viewport_set_t * set, UINT index) {
+	viewport_t * vp = &set->viewports[index];
+	if (!vp->open) {
+		return;
+	}
+
+	for (UINT f = 0; f < vp->frames; ++f) {
+		viewport_wait(set, vp->fences[f]);
+	}
+	set->backend.destroy(set->backend.user, index, vp);
+	vp->open = FALSE;
+
+	while (set->count > 0 && !set->viewports[set->count - 1].open) {
+		--set->count;
+	}
+}
+
+/*
+ * records every open viewport into its next slot, waiting first if the slot is still in
+ * flight. the lists land in set->lists for the caller to submit in one batch.
+ */
+static int viewport_set_begin(viewport_set_t * set) {
+	set->list_count = 0;
+
+	for (UINT i = 0; i < set->count; ++i) {
+		viewport_t * vp = &set->viewports[i];
+		if (!vp->open) {
+			continue;
+		}
+
+		viewport_wait(set, vp->fences[vp->slot]);
+
+		LONGLONG start = timer_now();
+		vp->list = NULL;
+		if (set->backend.record(set->backend.user, i, vp) != 0) {
+			return 1;
+		}
+		double ms = timer_ms(timer_now() - start);
+		vp->record_ms += ms;
+		set->stats.record_ms += ms;
+
+		if (vp->list != NULL) {
+			set->lists[set->list_count++] = vp->list;
+		}
+	}
+
+	return 0;
+}
+
+/* presents the windows and stamps every slot recorded this frame with the batch's fence */
+static int viewport_set_end(viewport_set_t * set, UINT64 fence) {
+	for (UINT i = 0; i < set->count; ++i) {
+		viewport_t * vp = &set->viewports[i];
+		if (!vp->open) {
+			continue;
+		}
+
+		LONGLONG start = timer_now();
+		if (vp->kind == VIEWPORT_WINDOW && set->backend.present(set->backend.user, i, vp) != 0) {
+			return 1;
+		}
+		double ms = timer_ms(timer_now() - start);
+		vp->present_ms += ms;
+		set->stats.present_ms += ms;
+
+		vp->fences[vp->slot] = fence;
+		vp->slot = (vp->slot + 1) % vp->frames;
+		++vp->drawn;
+		++set->stats.drawn;
+	}
+
+	++set->stats.frames;
+	return 0;
+}
+
+/* a whole frame for a set that submits on its own */
+static int viewport_set_frame(viewport_set_t * set) {
+	if (viewport_set_begin(set) != 0) {
+		return 1;
+	}
+
+	LONGLONG start = timer_now();
+	if (set->list_count > 0 && set->backend.submit(set->backend.user, set->lists, set->list_count) != 0) {
+		return 1;
+	}
+	UINT64 fence = set->backend.signal(set->backend.user);
+	set->stats.submit_ms += timer_ms(timer_now() - start);
+
+	return viewport_set_end(set, fence);
+}
+
+static void viewport_set_destroy(viewport_set_t * set) {
+	for (UINT i = 0; i < VIEWPORT_MAX; ++i) {
+		viewport_remove(set, i);
+	}
+}
+
+static void viewport_set_report(viewport_set_t const * set, FILE * fp) {
+	viewport_stats_t const * s = &set->stats;
+	if (s->drawn == 0) {
+		return;
+	}
+
+	double drawn = (double) s->drawn;
+	fprintf(fp, "viewports: %llu viewport frames over %llu frames, per viewport %.4f ms recording, %.4f ms presenting, %.4f ms submitting; %llu waits (%.3f ms)\n", (unsigned long long) s->drawn, (unsigned long long) s->frames, s->record_ms / drawn, s->present_ms / drawn, s->submit_ms / drawn, (unsigned long long) s->waits, s->wait_ms);
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef VSHADE_H
+#define VSHADE_H
+
+#include <stdlib.h>
+#include <windows.h>
+#include <immintrin.h>
+#include "linmath.h"
+#include "vertex.h"
+#include "jobs.h"
+
+/*
+ * CPU copy of the vs entry point in main.hlsl: clip = mul(cbuf_mvp, position).
+ * cbuf_mvp is a memcpy of a linmath mat4x4 read column-major by HLSL, which is
+ * exactly mat4x4_mul_vec4. results come out as SoA plus a clip outcode per vertex.
+ *
+ * the widest path the compiler targets is used: 16 lanes with AVX-512F, 8 with AVX2,
+ * otherwise scalar.
+ */
+
+#define VSHADE_CLIP_LEFT 0x01
+#define VSHADE_CLIP_RIGHT 0x02
+#define VSHADE_CLIP_BOTTOM 0x04
+#define VSHADE_CLIP_TOP 0x08
+#define VSHADE_CLIP_NEAR 0x10
+#define VSHADE_CLIP_FAR 0x20
+
+#if defined(__AVX512F__)
+#define VSHADE_LANES 16
+#define VSHADE_PATH "avx512"
+#elif defined(__AVX2__)
+#define VSHADE_LANES 8
+#define VSHADE_PATH "avx2"
+#else
+#define VSHADE_LANES 1
+#define VSHADE_PATH "scalar"
+#endif
+
+typedef struct vshade_out {
+	float * x;
+	float * y;
+	float * z;
+	float * w;
+	BYTE * outcode;
+	UINT capacity;
+} vshade_out_t;
+
+static void vshade_out_free(vshade_out_t * out) {
+	_aligned_free(out->x);
+	_aligned_free(out->outcode);
+	*out = (vshade_out_t) { 0 };
+}
+
+/*
+ * one allocation for the four float streams, each padded to a multiple of 16 and 64-byte aligned.
+ * outcodes get 64 spare bytes so readers can fetch them with 32-bit gathers.
+ */
+static int vshade_out_alloc(vshade_out_t * out, UINT count) {
+	UINT padded = (count + 15) & ~15u;
+
+	if (padded <= out->capacity) {
+		return 0;
+	}
+
+	vshade_out_free(out);
+
+	float * floats = _aligned_malloc(sizeof(float) * padded * 4, 64);
+	BYTE * codes = _aligned_malloc(padded + 64, 64);
+	if (floats == NULL || codes == NULL) {
+		_aligned_free(floats);
+		_aligned_free(codes);
+		return 1;
+	}
+
+	out->x = floats;
+	out->y = floats + padded;
+	out->z = floats + padded * 2;
+	out->w = floats + padded * 3;
+	out->outcode = codes;
+	out->capacity = padded;
+
+	return 0;
+}
+
+static BYTE vshade_outcode(float x, float y, float z, float w) {
+	return (BYTE) ((x < -w ? VSHADE_CLIP_LEFT : 0) | (x > w ? VSHADE_CLIP_RIGHT : 0) | (y < -w ? VSHADE_CLIP_BOTTOM : 0) | (y > w ? VSHADE_CLIP_TOP : 0) | (z < 0 ? VSHADE_CLIP_NEAR : 0) | (z > w ? VSHADE_CLIP_FAR : 0));
+}
+
+static void vshade_scalar(mat4x4 const mvp, vertex_t const * in, UINT begin, UINT end, vshade_out_t * out) {
+	for (UINT i = begin; i < end; ++i) {
+		vec4 clip;
+		mat4x4_mul_vec4(clip, mvp, in[i].pos);
+
+		out->x[i] = clip[0];
+		out->y[i] = clip[1];
+		out->z[i] = clip[2];
+		out->w[i] = clip[3];
+		out->outcode[i] = vshade_outcode(clip[0], clip[1], clip[2], clip[3]);
+	}
+}
+
+#if VSHADE_LANES == 8
+static void vshade_simd(mat4x4 const mvp, vertex_t const * in, UINT begin, UINT end, vshade_out_t * out) {
+	__m256 m[4][4];
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			m[i][j] = _mm256_set1_ps(mvp[i][j]);
+		}
+	}
+
+	__m256 const zero = _mm256_setzero_ps();
+	__m256 const sign = _mm256_set1_ps(-0.0f);
+
+	UINT i = begin;
+	for (; i + 8 <= end; i += 8) {
+		/* pair vertex k with k + 4 in one register, then a 4x4 transpose per 128-bit lane */
+		__m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(in[i + 0].pos)), _mm_loadu_ps(in[i + 4].pos), 1);
+		__m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(in[i + 1].pos)), _mm_loadu_ps(in[i + 5].pos), 1);
+		__m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(in[i + 2].pos)), _mm_loadu_ps(in[i + 6].pos), 1);
+		__m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(in[i + 3].pos)), _mm_loadu_ps(in[i + 7].pos), 1);
+
+		__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+		__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+		__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+		__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+
+		__m256 v[4] = {
+			_mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)),
+			_mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2)),
+			_mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)),
+			_mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2)),
+		};
+
+		__m256 c[4];
+		for (int j = 0; j < 4; ++j) {
+			c[j] = _mm256_mul_ps(m[0][j], v[0]);
+			c[j] = _mm256_add_ps(c[j], _mm256_mul_ps(m[1][j], v[1]));
+			c[j] = _mm256_add_ps(c[j], _mm256_mul_ps(m[2][j], v[2]));
+			c[j] = _mm256_add_ps(c[j], _mm256_mul_ps(m[3][j], v[3]));
+		}
+
+		_mm256_storeu_ps(&out->x[i], c[0]);
+		_mm256_storeu_ps(&out->y[i], c[1]);
+		_mm256_storeu_ps(&out->z[i], c[2]);
+		_mm256_storeu_ps(&out->w[i], c[3]);
+
+		__m256 neg_w = _mm256_xor_ps(c[3], sign);
+		__m256i code = _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(c[0], neg_w, _CMP_LT_OQ)), _mm256_set1_epi32(VSHADE_CLIP_LEFT));
+		code = _mm256_or_si256(code, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(c[0], c[3], _CMP_GT_OQ)), _mm256_set1_epi32(VSHADE_CLIP_RIGHT)));
+		code = _mm256_or_si256(code, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(c[1], neg_w, _CMP_LT_OQ)), _mm256_set1_epi32(VSHADE_CLIP_BOTTOM)));
+		code = _mm256_or_si256(code, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(c[1], c[3], _CMP_GT_OQ)), _mm256_set1_epi32(VSHADE_CLIP_TOP)));
+		code = _mm256_or_si256(code, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(c[2], zero, _CMP_LT_OQ)), _mm256_set1_epi32(VSHADE_CLIP_NEAR)));
+		code = _mm256_or_si256(code, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(c[2], c[3], _CMP_GT_OQ)), _mm256_set1_epi32(VSHADE_CLIP_FAR)));
+
+		__m128i words = _mm_packus_epi32(_mm256_castsi256_si128(code), _mm256_extracti128_si256(code, 1));
+		_mm_storel_epi64((__m128i *) &out->outcode[i], _mm_packus_epi16(words, words));
+	}
+
+	vshade_scalar(mvp, in, i, end, out);
+}
+#elif VSHADE_LANES == 16
+static void vshade_simd(mat4x4 const mvp, vertex_t const * in, UINT begin, UINT end, vshade_out_t * out) {
+	__m512 m[4][4];
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			m[i][j] = _mm512_set1_ps(mvp[i][j]);
+		}
+	}
+
+	/* vertex_t is 8 floats, gather one component of 16 vertices at a time */
+	__m512i const stride = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(sizeof(vertex_t) / sizeof(float)));
+	__m512 const zero = _mm512_setzero_ps();
+
+	UINT i = begin;
+	for (; i + 16 <= end; i += 16) {
+		float const * base = in[i].pos;
+		__m512 v[4] = {
+			_mm512_i32gather_ps(stride, base + 0, 4),
+			_mm512_i32gather_ps(stride, base + 1, 4),
+			_mm512_i32gather_ps(stride, base + 2, 4),
+			_mm512_i32gather_ps(stride, base + 3, 4),
+		};
+
+		__m512 c[4];
+		for (int j = 0; j < 4; ++j) {
+			c[j] = _mm512_mul_ps(m[0][j], v[0]);
+			c[j] = _mm512_add_ps(c[j], _mm512_mul_ps(m[1][j], v[1]));
+			c[j] = _mm512_add_ps(c[j], _mm512_mul_ps(m[2][j], v[2]));
+			c[j] = _mm512_add_ps(c[j], _mm512_mul_ps(m[3][j], v[3]));
+		}
+
+		_mm512_storeu_ps(&out->x[i], c[0]);
+		_mm512_storeu_ps(&out->y[i], c[1]);
+		_mm512_storeu_ps(&out->z[i], c[2]);
+		_mm512_storeu_ps(&out->w[i], c[3]);
+
+		__m512 neg_w = _mm512_sub_ps(zero, c[3]);
+		__m512i code = _mm512_maskz_set1_epi32(_mm512_cmp_ps_mask(c[0], neg_w, _CMP_LT_OQ), VSHADE_CLIP_LEFT);
+		code = _mm512_mask_or_epi32(code, _mm512_cmp_ps_mask(c[0], c[3], _CMP_GT_OQ), code, _mm512_set1_epi32(VSHADE_CLIP_RIGHT));
+		code = _mm512_mask_or_epi32(code, _mm512_cmp_ps_mask(c[1], neg_w, _CMP_LT_OQ), code, _mm512_set1_epi32(VSHADE_CLIP_BOTTOM));
+		code = _mm512_mask_or_epi32(code, _mm512_cmp_ps_mask(c[1], c[3], _CMP_GT_OQ), code, _mm512_set1_epi32(VSHADE_CLIP_TOP));
+		code = _mm512_mask_or_epi32(code, _mm512_cmp_ps_mask(c[2], zero, _CMP_LT_OQ), code, _mm512_set1_epi32(VSHADE_CLIP_NEAR));
+		code = _mm512_mask_or_epi32(code, _mm512_cmp_ps_mask(c[2], c[3], _CMP_GT_OQ), code, _mm512_set1_epi32(VSHADE_CLIP_FAR));
+
+		_mm_storeu_si128((__m128i *) &out->outcode[i], _mm512_cvtepi32_epi8(code));
+	}
+
+	vshade_scalar(mvp, in, i, end, out);
+}
+#else
+static void vshade_simd(mat4x4 const mvp, vertex_t const * in, UINT begin, UINT end, vshade_out_t * out) {
+	vshade_scalar(mvp, in, begin, end, out);
+}
+#endif
+
+/* out must have room for count vertices, see vshade_out_alloc */
+static void vshade_run(mat4x4 const mvp, vertex_t const * in, UINT count, vshade_out_t * out) {
+	vshade_simd(mvp, in, 0, count, out);
+}
+
+typedef struct vshade_job {
+	vec4 const * mvp;
+	vertex_t const * in;
+	UINT count;
+	vshade_out_t * out;
+} vshade_job_t;
+
+static void vshade_block_range(void * user, UINT begin, UINT end) {
+	vshade_job_t * job = user;
+	end = end * 64 < job->count ? end * 64 : job->count;
+	vshade_simd(job->mvp, job->in, begin * 64, end, job->out);
+}
+
+/* chunks are multiples of 64 vertices so no two threads share a cache line of output */
+static void vshade_parallel(mat4x4 const mvp, vertex_t const * in, UINT count, vshade_out_t * out) {
+	vshade_job_t job = {
+		.mvp = mvp,
+		.in = in,
+		.count = count,
+		.out = out,
+	};
+
+	UINT blocks = (count + 63) / 64;
+	jobs_parallel_for(blocks, 64, vshade_block_range, &job);
+}
+
+#endif
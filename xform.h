@@ -0,0 +1,448 @@
+#ifndef XFORM_H
+#define XFORM_H
+
+#include <math.h>
+#include <string.h>
+#include <windows.h>
+#include <immintrin.h>
+#include "linmath.h"
+
+/*
+ * matrix kernels for the common cases linmath handles generically. mat4x4 is column
+ * major (M[column][row]), so an affine matrix has 0, 0, 0, 1 in the last row and its
+ * translation in M[3]. every kernel has a scalar version and an SSE2 _sse version that
+ * treats each column as one register.
+ */
+
+typedef enum xform_kind {
+	/* orthonormal 3x3 and a translation */
+	XFORM_RIGID,
+	/* orthogonal 3x3 with equal column lengths */
+	XFORM_UNIFORM_SCALE,
+	/* any 3x3 with last row 0, 0, 0, 1 */
+	XFORM_AFFINE,
+	XFORM_GENERAL,
+} xform_kind_t;
+
+#define XFORM_EPSILON 1e-4f
+
+static char const * xform_kind_name(xform_kind_t kind) {
+	switch (kind) {
+		case XFORM_RIGID: return "rigid";
+		case XFORM_UNIFORM_SCALE: return "uniform scale";
+		case XFORM_AFFINE: return "affine";
+		default: return "general";
+	}
+}
+
+/* tolerances are relative to the column lengths, enough for matrices built from floats */
+static xform_kind_t xform_classify(mat4x4 const M) {
+	if (M[0][3] != 0 || M[1][3] != 0 || M[2][3] != 0 || M[3][3] != 1) {
+		return XFORM_GENERAL;
+	}
+
+	float l0 = vec3_mul_inner(M[0], M[0]);
+	float l1 = vec3_mul_inner(M[1], M[1]);
+	float l2 = vec3_mul_inner(M[2], M[2]);
+	float scale = l0 > l1 ? (l0 > l2 ? l0 : l2) : (l1 > l2 ? l1 : l2);
+	float eps = XFORM_EPSILON * scale;
+
+	if (fabsf(vec3_mul_inner(M[0], M[1])) > eps || fabsf(vec3_mul_inner(M[1], M[2])) > eps || fabsf(vec3_mul_inner(M[2], M[0])) > eps) {
+		return XFORM_AFFINE;
+	}
+
+	if (fabsf(l0 - l1) > eps || fabsf(l1 - l2) > eps) {
+		return XFORM_AFFINE;
+	}
+
+	return fabsf(l0 - 1) <= XFORM_EPSILON ? XFORM_RIGID : XFORM_UNIFORM_SCALE;
+}
+
+/* R = transpose of M's 3x3 scaled by s, translation -(that * t) */
+static void xform_invert_orthogonal(mat4x4 R, mat4x4 const M, float s) {
+	mat4x4 T;
+
+	for (int c = 0; c < 3; ++c) {
+		for (int r = 0; r < 3; ++r) {
+			T[c][r] = M[r][c] * s;
+		}
+		T[c][3] = 0;
+	}
+
+	for (int r = 0; r < 3; ++r) {
+		T[3][r] = -(T[0][r] * M[3][0] + T[1][r] * M[3][1] + T[2][r] * M[3][2]);
+	}
+	T[3][3] = 1;
+
+	mat4x4_dup(R, T);
+}
+
+static void xform_invert_rigid(mat4x4 R, mat4x4 const M) {
+	xform_invert_orthogonal(R, M, 1);
+}
+
+static void xform_invert_uniform_scale(mat4x4 R, mat4x4 const M) {
+	xform_invert_orthogonal(R, M, 1.0f / vec3_mul_inner(M[0], M[0]));
+}
+
+/* rows of the 3x3 inverse are b x c, c x a, a x b over the determinant */
+static void xform_invert_affine(mat4x4 R, mat4x4 const M) {
+	float a0 = M[0][0], a1 = M[0][1], a2 = M[0][2];
+	float b0 = M[1][0], b1 = M[1][1], b2 = M[1][2];
+	float c0 = M[2][0], c1 = M[2][1], c2 = M[2][2];
+	float tx = M[3][0], ty = M[3][1], tz = M[3][2];
+
+	float r00 = b1 * c2 - b2 * c1, r01 = b2 * c0 - b0 * c2, r02 = b0 * c1 - b1 * c0;
+	float r10 = c1 * a2 - c2 * a1, r11 = c2 * a0 - c0 * a2, r12 = c0 * a1 - c1 * a0;
+	float r20 = a1 * b2 - a2 * b1, r21 = a2 * b0 - a0 * b2, r22 = a0 * b1 - a1 * b0;
+	float inv = 1.0f / (a0 * r00 + a1 * r01 + a2 * r02);
+
+	r00 *= inv; r01 *= inv; r02 *= inv;
+	r10 *= inv; r11 *= inv; r12 *= inv;
+	r20 *= inv; r21 *= inv; r22 *= inv;
+
+	R[0][0] = r00; R[0][1] = r10; R[0][2] = r20; R[0][3] = 0;
+	R[1][0] = r01; R[1][1] = r11; R[1][2] = r21; R[1][3] = 0;
+	R[2][0] = r02; R[2][1] = r12; R[2][2] = r22; R[2][3] = 0;
+	R[3][0] = -(r00 * tx + r01 * ty + r02 * tz);
+	R[3][1] = -(r10 * tx + r11 * ty + r12 * tz);
+	R[3][2] = -(r20 * tx + r21 * ty + r22 * tz);
+	R[3][3] = 1;
+}
+
+static void xform_invert(mat4x4 R, mat4x4 const M, xform_kind_t kind) {
+	switch (kind) {
+		case XFORM_RIGID: {
+			xform_invert_rigid(R, M);
+			break;
+		}
+		case XFORM_UNIFORM_SCALE: {
+			xform_invert_uniform_scale(R, M);
+			break;
+		}
+		case XFORM_AFFINE: {
+			xform_invert_affine(R, M);
+			break;
+		}
+		default: {
+			mat4x4_invert(R, M);
+			break;
+		}
+	}
+}
+
+static xform_kind_t xform_invert_auto(mat4x4 R, mat4x4 const M) {
+	xform_kind_t kind = xform_classify(M);
+	xform_invert(R, M, kind);
+	return kind;
+}
+
+/*
+ * inverse transpose of the 3x3, for transforming normals; a rigid matrix is its own
+ * normal matrix and uniform scale only changes the length. the fourth row and column
+ * are left as identity.
+ */
+static void xform_normal_matrix(mat4x4 N, mat4x4 const M, xform_kind_t kind) {
+	mat4x4 T;
+	mat4x4_identity(T);
+
+	if (kind == XFORM_RIGID || kind == XFORM_UNIFORM_SCALE) {
+		float s = kind == XFORM_RIGID ? 1 : 1.0f / vec3_mul_inner(M[0], M[0]);
+		for (int c = 0; c < 3; ++c) {
+			for (int r = 0; r < 3; ++r) {
+				T[c][r] = M[c][r] * s;
+			}
+		}
+	} else {
+		/* columns of the inverse transpose are the rows of the inverse */
+		vec3_mul_cross(T[0], M[1], M[2]);
+		vec3_mul_cross(T[1], M[2], M[0]);
+		vec3_mul_cross(T[2], M[0], M[1]);
+		float inv = 1.0f / vec3_mul_inner(M[0], T[0]);
+		for (int c = 0; c < 3; ++c) {
+			vec3_scale(T[c], T[c], inv);
+		}
+	}
+
+	mat4x4_dup(N, T);
+}
+
+static void xform_transform_normal(vec3 r, mat4x4 const N, vec3 const n) {
+	vec3 t;
+	for (int i = 0; i < 3; ++i) {
+		t[i] = N[0][i] * n[0] + N[1][i] * n[1] + N[2][i] * n[2];
+	}
+	vec3_norm(r, t);
+}
+
+/* SSE2 */
+
+static __m128 xform_cross_sse(__m128 a, __m128 b) {
+	__m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+	return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+static __m128 xform_dot3_sse(__m128 a, __m128 b) {
+	__m128 m = _mm_mul_ps(a, b);
+	__m128 y = _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1));
+	__m128 z = _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2));
+	__m128 sum = _mm_add_ss(_mm_add_ss(m, y), z);
+	return _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+/*
+ * R = A * B, summed in the same order as mat4x4_mul. the results match bit for bit
+ * unless the compiler contracts either side into FMAs, then only up to rounding
+ */
+static void xform_mul_sse(mat4x4 R, mat4x4 const A, mat4x4 const B) {
+	__m128 a0 = _mm_loadu_ps(A[0]);
+	__m128 a1 = _mm_loadu_ps(A[1]);
+	__m128 a2 = _mm_loadu_ps(A[2]);
+	__m128 a3 = _mm_loadu_ps(A[3]);
+	__m128 out[4];
+
+	for (int c = 0; c < 4; ++c) {
+		__m128 b = _mm_loadu_ps(B[c]);
+		__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 0, 0, 0)));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 1, 1, 1))));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 2, 2))));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 3, 3))));
+		out[c] = r;
+	}
+
+	for (int c = 0; c < 4; ++c) {
+		_mm_storeu_ps(R[c], out[c]);
+	}
+}
+
+/* columns c0..c2 already hold the inverse 3x3 with w = 0, adds -(inverse * t) */
+static void xform_store_inverse_sse(mat4x4 R, __m128 c0, __m128 c1, __m128 c2, __m128 t) {
+	__m128 r3 = _mm_mul_ps(c0, _mm_shuffle_ps(t, t, _MM_SHUFFLE(0, 0, 0, 0)));
+	r3 = _mm_add_ps(r3, _mm_mul_ps(c1, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1))));
+	r3 = _mm_add_ps(r3, _mm_mul_ps(c2, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 2, 2, 2))));
+	r3 = _mm_sub_ps(_mm_setr_ps(0, 0, 0, 1), r3);
+
+	_mm_storeu_ps(R[0], c0);
+	_mm_storeu_ps(R[1], c1);
+	_mm_storeu_ps(R[2], c2);
+	_mm_storeu_ps(R[3], r3);
+}
+
+static void xform_invert_orthogonal_sse(mat4x4 R, mat4x4 const M, __m128 s) {
+	__m128 mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	__m128 c0 = _mm_and_ps(_mm_loadu_ps(M[0]), mask);
+	__m128 c1 = _mm_and_ps(_mm_loadu_ps(M[1]), mask);
+	__m128 c2 = _mm_and_ps(_mm_loadu_ps(M[2]), mask);
+	__m128 c3 = _mm_setzero_ps();
+	__m128 t = _mm_loadu_ps(M[3]);
+
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+	xform_store_inverse_sse(R, _mm_mul_ps(c0, s), _mm_mul_ps(c1, s), _mm_mul_ps(c2, s), t);
+}
+
+static void xform_invert_rigid_sse(mat4x4 R, mat4x4 const M) {
+	xform_invert_orthogonal_sse(R, M, _mm_set1_ps(1));
+}
+
+static void xform_invert_uniform_scale_sse(mat4x4 R, mat4x4 const M) {
+	__m128 c0 = _mm_loadu_ps(M[0]);
+	xform_invert_orthogonal_sse(R, M, _mm_div_ps(_mm_set1_ps(1), xform_dot3_sse(c0, c0)));
+}
+
+static void xform_invert_affine_sse(mat4x4 R, mat4x4 const M) {
+	__m128 a = _mm_loadu_ps(M[0]);
+	__m128 b = _mm_loadu_ps(M[1]);
+	__m128 c = _mm_loadu_ps(M[2]);
+	__m128 r0 = xform_cross_sse(b, c);
+	__m128 r1 = xform_cross_sse(c, a);
+	__m128 r2 = xform_cross_sse(a, b);
+	__m128 r3 = _mm_setzero_ps();
+	__m128 inv = _mm_div_ps(_mm_set1_ps(1), xform_dot3_sse(a, r0));
+
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	xform_store_inverse_sse(R, _mm_mul_ps(r0, inv), _mm_mul_ps(r1, inv), _mm_mul_ps(r2, inv), _mm_loadu_ps(M[3]));
+}
+
+/*
+ * 2x2 block inverse. each register holds a 2x2 block as (m00, m01, m10, m11); the
+ * method does not care about row or column major since inverting the transpose gives
+ * the transposed inverse.
+ */
+#define XFORM_SWIZZLE(v, x, y, z, w) _mm_shuffle_ps((v), (v), _MM_SHUFFLE(w, z, y, x))
+#define XFORM_SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps((a), (b), _MM_SHUFFLE(w, z, y, x))
+
+/* A * B */
+static __m128 xform_mat2_mul(__m128 a, __m128 b) {
+	return _mm_add_ps(_mm_mul_ps(a, XFORM_SWIZZLE(b, 0, 3, 0, 3)), _mm_mul_ps(XFORM_SWIZZLE(a, 1, 0, 3, 2), XFORM_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+/* adj(A) * B */
+static __m128 xform_mat2_adj_mul(__m128 a, __m128 b) {
+	return _mm_sub_ps(_mm_mul_ps(XFORM_SWIZZLE(a, 3, 3, 0, 0), b), _mm_mul_ps(XFORM_SWIZZLE(a, 1, 1, 2, 2), XFORM_SWIZZLE(b, 2, 3, 0, 1)));
+}
+
+/* A * adj(B) */
+static __m128 xform_mat2_mul_adj(__m128 a, __m128 b) {
+	return _mm_sub_ps(_mm_mul_ps(a, XFORM_SWIZZLE(b, 3, 0, 3, 0)), _mm_mul_ps(XFORM_SWIZZLE(a, 1, 0, 3, 2), XFORM_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+static void xform_invert_general_sse(mat4x4 R, mat4x4 const M) {
+	__m128 m0 = _mm_loadu_ps(M[0]);
+	__m128 m1 = _mm_loadu_ps(M[1]);
+	__m128 m2 = _mm_loadu_ps(M[2]);
+	__m128 m3 = _mm_loadu_ps(M[3]);
+
+	__m128 a = _mm_movelh_ps(m0, m1);
+	__m128 b = _mm_movehl_ps(m1, m0);
+	__m128 c = _mm_movelh_ps(m2, m3);
+	__m128 d = _mm_movehl_ps(m3, m2);
+
+	/* |A| |B| |C| |D| */
+	__m128 det = _mm_sub_ps(_mm_mul_ps(XFORM_SHUFFLE(m0, m2, 0, 2, 0, 2), XFORM_SHUFFLE(m1, m3, 1, 3, 1, 3)), _mm_mul_ps(XFORM_SHUFFLE(m0, m2, 1, 3, 1, 3), XFORM_SHUFFLE(m1, m3, 0, 2, 0, 2)));
+	__m128 det_a = XFORM_SWIZZLE(det, 0, 0, 0, 0);
+	__m128 det_b = XFORM_SWIZZLE(det, 1, 1, 1, 1);
+	__m128 det_c = XFORM_SWIZZLE(det, 2, 2, 2, 2);
+	__m128 det_d = XFORM_SWIZZLE(det, 3, 3, 3, 3);
+
+	__m128 d_c = xform_mat2_adj_mul(d, c);
+	__m128 a_b = xform_mat2_adj_mul(a, b);
+	__m128 x = _mm_sub_ps(_mm_mul_ps(det_d, a), xform_mat2_mul(b, d_c));
+	__m128 w = _mm_sub_ps(_mm_mul_ps(det_a, d), xform_mat2_mul(c, a_b));
+	__m128 y = _mm_sub_ps(_mm_mul_ps(det_b, c), xform_mat2_mul_adj(d, a_b));
+	__m128 z = _mm_sub_ps(_mm_mul_ps(det_c, b), xform_mat2_mul_adj(a, d_c));
+
+	/* |M| = |A||D| + |B||C| - tr(adj(A) B adj(D) C) */
+	__m128 tr = _mm_mul_ps(a_b, XFORM_SWIZZLE(d_c, 0, 2, 1, 3));
+	tr = _mm_add_ps(tr, XFORM_SWIZZLE(tr, 2, 3, 0, 1));
+	tr = _mm_add_ps(tr, XFORM_SWIZZLE(tr, 1, 0, 3, 2));
+	__m128 det_m = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+
+	__m128 inv = _mm_div_ps(_mm_setr_ps(1, -1, -1, 1), det_m);
+	x = _mm_mul_ps(x, inv);
+	y = _mm_mul_ps(y, inv);
+	z = _mm_mul_ps(z, inv);
+	w = _mm_mul_ps(w, inv);
+
+	/* adjugate shuffle and the block layout back into columns in one step */
+	_mm_storeu_ps(R[0], XFORM_SHUFFLE(x, y, 3, 1, 3, 1));
+	_mm_storeu_ps(R[1], XFORM_SHUFFLE(x, y, 2, 0, 2, 0));
+	_mm_storeu_ps(R[2], XFORM_SHUFFLE(z, w, 3, 1, 3, 1));
+	_mm_storeu_ps(R[3], XFORM_SHUFFLE(z, w, 2, 0, 2, 0));
+}
+
+static void xform_invert_sse(mat4x4 R, mat4x4 const M, xform_kind_t kind) {
+	switch (kind) {
+		case XFORM_RIGID: {
+			xform_invert_rigid_sse(R, M);
+			break;
+		}
+		case XFORM_UNIFORM_SCALE: {
+			xform_invert_uniform_scale_sse(R, M);
+			break;
+		}
+		case XFORM_AFFINE: {
+			xform_invert_affine_sse(R, M);
+			break;
+		}
+		default: {
+			xform_invert_general_sse(R, M);
+			break;
+		}
+	}
+}
+
+/* xform_classify with the three columns transposed so all lengths and dots come out at once */
+static xform_kind_t xform_classify_sse(mat4x4 const M) {
+	__m128 x = _mm_loadu_ps(M[0]);
+	__m128 y = _mm_loadu_ps(M[1]);
+	__m128 z = _mm_loadu_ps(M[2]);
+	__m128 w = _mm_loadu_ps(M[3]);
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+
+	if (_mm_movemask_ps(_mm_cmpneq_ps(w, _mm_setr_ps(0, 0, 0, 1))) != 0) {
+		return XFORM_GENERAL;
+	}
+
+	/* lane i: column i against itself and against column i + 1 */
+	__m128 xr = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 yr = _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 zr = _mm_shuffle_ps(z, z, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 len = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+	__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, xr), _mm_mul_ps(y, yr)), _mm_mul_ps(z, zr));
+
+	__m128 largest = _mm_max_ps(len, _mm_shuffle_ps(len, len, _MM_SHUFFLE(3, 0, 2, 1)));
+	largest = _mm_max_ps(largest, _mm_shuffle_ps(len, len, _MM_SHUFFLE(3, 1, 0, 2)));
+	__m128 eps = _mm_mul_ps(_mm_set1_ps(XFORM_EPSILON), largest);
+	__m128 abs = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+	int skewed = _mm_movemask_ps(_mm_cmpgt_ps(_mm_and_ps(dot, abs), eps));
+	int unequal = _mm_movemask_ps(_mm_cmpgt_ps(_mm_and_ps(_mm_sub_ps(len, _mm_shuffle_ps(len, len, _MM_SHUFFLE(3, 0, 2, 1))), abs), eps));
+	if (((skewed | unequal) & 7) != 0) {
+		return XFORM_AFFINE;
+	}
+
+	return fabsf(_mm_cvtss_f32(len) - 1) <= XFORM_EPSILON ? XFORM_RIGID : XFORM_UNIFORM_SCALE;
+}
+
+static xform_kind_t xform_invert_auto_sse(mat4x4 R, mat4x4 const M) {
+	xform_kind_t kind = xform_classify_sse(M);
+	xform_invert_sse(R, M, kind);
+	return kind;
+}
+
+static void xform_normal_matrix_sse(mat4x4 N, mat4x4 const M, xform_kind_t kind) {
+	__m128 mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	__m128 a = _mm_and_ps(_mm_loadu_ps(M[0]), mask);
+	__m128 b = _mm_and_ps(_mm_loadu_ps(M[1]), mask);
+	__m128 c = _mm_and_ps(_mm_loadu_ps(M[2]), mask);
+
+	if (kind == XFORM_RIGID || kind == XFORM_UNIFORM_SCALE) {
+		__m128 s = kind == XFORM_RIGID ? _mm_set1_ps(1) : _mm_div_ps(_mm_set1_ps(1), xform_dot3_sse(a, a));
+		a = _mm_mul_ps(a, s);
+		b = _mm_mul_ps(b, s);
+		c = _mm_mul_ps(c, s);
+	} else {
+		__m128 r0 = xform_cross_sse(b, c);
+		__m128 r1 = xform_cross_sse(c, a);
+		__m128 r2 = xform_cross_sse(a, b);
+		__m128 inv = _mm_div_ps(_mm_set1_ps(1), xform_dot3_sse(a, r0));
+		a = _mm_mul_ps(r0, inv);
+		b = _mm_mul_ps(r1, inv);
+		c = _mm_mul_ps(r2, inv);
+	}
+
+	_mm_storeu_ps(N[0], a);
+	_mm_storeu_ps(N[1], b);
+	_mm_storeu_ps(N[2], c);
+	_mm_storeu_ps(N[3], _mm_setr_ps(0, 0, 0, 1));
+}
+
+/*
+ * everything a draw needs from one camera and one model matrix. the view matrix is
+ * the camera's world matrix inverted with the fast path for its kind.
+ */
+typedef struct xform_draw {
+	mat4x4 model_view;
+	mat4x4 mvp;
+	/* inverse transpose of model_view's 3x3 */
+	mat4x4 normal;
+} xform_draw_t;
+
+static void xform_build_draw(xform_draw_t * out, mat4x4 const proj, mat4x4 const camera, mat4x4 const model) {
+	mat4x4 view;
+	xform_invert_auto_sse(view, camera);
+	xform_mul_sse(out->model_view, view, model);
+	xform_mul_sse(out->mvp, proj, out->model_view);
+	xform_normal_matrix_sse(out->normal, out->model_view, xform_classify_sse(out->model_view));
+}
+
+/* proj * view * model without the intermediate results */
+static void xform_mvp_sse(mat4x4 R, mat4x4 const proj, mat4x4 const view, mat4x4 const model) {
+	mat4x4 pv;
+	xform_mul_sse(pv, proj, view);
+	xform_mul_sse(R, pv, model);
+}
+
+#endif